@@ -5,6 +5,24 @@ if (NOT TARGET LibJuice::LibJuice)
 	include(FindPackageHandleStandardArgs)
 	find_package_handle_standard_args(LibJuice DEFAULT_MSG JUICE_LIBRARY JUICE_INCLUDE_DIR)
 
+	if (LibJuice_FOUND)
+		# The concurrency mode, required for ICE UDP mux, appeared in libjuice 1.0.0
+		include(CheckCXXSourceCompiles)
+		set(CMAKE_REQUIRED_INCLUDES ${JUICE_INCLUDE_DIR})
+		check_cxx_source_compiles("
+			#include <juice/juice.h>
+			int main() {
+				juice_config_t config = {};
+				config.concurrency_mode = JUICE_CONCURRENCY_MODE_MUX;
+				return 0;
+			}" JUICE_HAS_CONCURRENCY_MODE)
+		unset(CMAKE_REQUIRED_INCLUDES)
+		if (NOT JUICE_HAS_CONCURRENCY_MODE)
+			message(FATAL_ERROR "libjuice >= 1.0.0 is required, the one found in "
+				"${JUICE_INCLUDE_DIR} is too old")
+		endif ()
+	endif ()
+
     if (LibJuice_FOUND)
         add_library(LibJuice::LibJuice UNKNOWN IMPORTED)
         set_target_properties(LibJuice::LibJuice PROPERTIES
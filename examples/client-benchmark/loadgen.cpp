@@ -0,0 +1,466 @@
+/*
+ * libdatachannel client-benchmark example
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loadgen.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+using namespace rtc;
+using namespace std;
+using namespace std::chrono_literals;
+
+using chrono::duration_cast;
+using chrono::milliseconds;
+using chrono::steady_clock;
+
+using json = nlohmann::json;
+
+namespace {
+
+template <class T> weak_ptr<T> make_weak_ptr(shared_ptr<T> ptr) { return ptr; }
+
+struct ResourceSample {
+	double cpuSeconds = 0; // user and system time of the process
+	double rssKB = 0;      // resident set size
+};
+
+ResourceSample sampleResources() {
+	ResourceSample sample;
+#ifndef _WIN32
+	struct rusage usage = {};
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		sample.cpuSeconds = double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+		                    double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+#ifdef __linux__
+	std::ifstream statm("/proc/self/statm");
+	long pages = 0, resident = 0;
+	if (statm >> pages >> resident)
+		sample.rssKB = double(resident) * double(sysconf(_SC_PAGESIZE)) / 1024;
+#endif
+	return sample;
+}
+
+double seconds(steady_clock::duration d) { return chrono::duration<double>(d).count(); }
+
+} // namespace
+
+struct LoadGenerator::Peer {
+	struct Channel {
+		shared_ptr<DataChannel> dc;
+		double credit = 0; // messages allowed to be sent, for the rate-limited mode
+	};
+
+	string remoteId;
+	int index;
+	bool offerer;
+	shared_ptr<PeerConnection> pc;
+
+	std::mutex mutex;
+	vector<Channel> channels;
+
+	steady_clock::time_point created = steady_clock::now();
+	optional<steady_clock::duration> setupDuration; // until all channels are open, offerer only
+	std::atomic<int> openCount = 0;
+	std::atomic<bool> failed = false;
+	std::atomic<size_t> sentSize = 0;
+	std::atomic<size_t> receivedSize = 0;
+};
+
+LoadGenerator::LoadGenerator(Configuration config, LoadParams params, weak_ptr<WebSocket> ws)
+    : mConfig(std::move(config)), mParams(std::move(params)), mWebSocket(std::move(ws)),
+      mMessageData(mParams.messageSize, std::byte(0xFF)) {
+	if (!mParams.noSend && mParams.messageRate > 0)
+		mSendThread = std::thread(&LoadGenerator::sendLoop, this);
+}
+
+LoadGenerator::~LoadGenerator() {
+	mStopping = true;
+	if (mSendThread.joinable())
+		mSendThread.join();
+
+	std::unordered_map<string, shared_ptr<Peer>> peers;
+	{
+		std::lock_guard lock(mMutex);
+		std::swap(peers, mPeers);
+	}
+	for (auto &[key, peer] : peers)
+		peer->pc->close();
+}
+
+bool LoadGenerator::handleSignaling(const string &id, const json &message) {
+	auto it = message.find("pc");
+	if (it == message.end())
+		return false;
+
+	const int index = it->get<int>();
+	const string type = message.value("type", "");
+
+	shared_ptr<Peer> peer;
+	{
+		std::lock_guard lock(mMutex);
+		if (auto jt = mPeers.find(id + "/" + to_string(index)); jt != mPeers.end())
+			peer = jt->second;
+	}
+
+	if (!peer) {
+		if (type != "offer")
+			return true;
+
+		peer = createPeer(id, index, false);
+	}
+
+	if (type == "offer" || type == "answer") {
+		auto sdp = message["description"].get<string>();
+		peer->pc->setRemoteDescription(Description(sdp, type));
+	} else if (type == "candidate") {
+		auto sdp = message["candidate"].get<string>();
+		auto mid = message["mid"].get<string>();
+		peer->pc->addRemoteCandidate(Candidate(sdp, mid));
+	}
+	return true;
+}
+
+shared_ptr<LoadGenerator::Peer> LoadGenerator::createPeer(const string &remoteId, int index,
+                                                          bool offerer) {
+	auto peer = make_shared<Peer>();
+	peer->remoteId = remoteId;
+	peer->index = index;
+	peer->offerer = offerer;
+	peer->pc = make_shared<PeerConnection>(mConfig);
+
+	auto wws = mWebSocket;
+	peer->pc->onLocalDescription([wws, remoteId, index](Description description) {
+		json message = {{"id", remoteId},
+		                {"pc", index},
+		                {"type", description.typeString()},
+		                {"description", string(description)}};
+
+		if (auto ws = wws.lock())
+			ws->send(message.dump());
+	});
+
+	peer->pc->onLocalCandidate([wws, remoteId, index](Candidate candidate) {
+		json message = {{"id", remoteId},
+		                {"pc", index},
+		                {"type", "candidate"},
+		                {"candidate", string(candidate)},
+		                {"mid", candidate.mid()}};
+
+		if (auto ws = wws.lock())
+			ws->send(message.dump());
+	});
+
+	peer->pc->onStateChange([wpeer = make_weak_ptr(peer)](PeerConnection::State state) {
+		if (state != PeerConnection::State::Failed && state != PeerConnection::State::Closed)
+			return;
+
+		if (auto peer = wpeer.lock()) {
+			std::lock_guard lock(peer->mutex);
+			if (!peer->setupDuration)
+				peer->failed = true;
+		}
+	});
+
+	peer->pc->onDataChannel([this, wpeer = make_weak_ptr(peer)](shared_ptr<DataChannel> dc) {
+		if (auto peer = wpeer.lock())
+			setupChannel(peer, std::move(dc));
+	});
+
+	{
+		std::lock_guard lock(mMutex);
+		mPeers.emplace(remoteId + "/" + to_string(index), peer);
+	}
+
+	if (offerer)
+		for (int i = 1; i <= mParams.channels; ++i)
+			setupChannel(peer, peer->pc->createDataChannel("DC-" + to_string(i)));
+
+	return peer;
+}
+
+void LoadGenerator::setupChannel(const shared_ptr<Peer> &peer, shared_ptr<DataChannel> dc) {
+	dc->setBufferedAmountLowThreshold(mParams.messageSize);
+
+	auto onOpen = [this, wpeer = make_weak_ptr(peer), wdc = make_weak_ptr(dc)]() {
+		auto peer = wpeer.lock();
+		auto dc = wdc.lock();
+		if (!peer || !dc)
+			return;
+
+		if (++peer->openCount == mParams.channels && peer->offerer) {
+			std::lock_guard lock(peer->mutex);
+			peer->setupDuration = steady_clock::now() - peer->created;
+		}
+
+		if (!mParams.noSend && mParams.messageRate == 0)
+			sendAvailable(dc, *peer);
+	};
+
+	if (peer->offerer)
+		dc->onOpen(onOpen);
+
+	dc->onBufferedAmountLow([this, wpeer = make_weak_ptr(peer), wdc = make_weak_ptr(dc)]() {
+		if (mParams.noSend || mParams.messageRate > 0)
+			return;
+
+		auto peer = wpeer.lock();
+		auto dc = wdc.lock();
+		if (peer && dc)
+			sendAvailable(dc, *peer);
+	});
+
+	dc->onMessage([wpeer = make_weak_ptr(peer)](variant<binary, string> data) {
+		if (!holds_alternative<binary>(data))
+			return;
+
+		if (auto peer = wpeer.lock())
+			peer->receivedSize += get<binary>(data).size();
+	});
+
+	{
+		std::lock_guard lock(peer->mutex);
+		peer->channels.push_back({dc, 0});
+	}
+
+	// Incoming channels are already open
+	if (!peer->offerer)
+		onOpen();
+}
+
+void LoadGenerator::sendAvailable(const shared_ptr<DataChannel> &dc, Peer &peer) {
+	try {
+		while (dc->isOpen() && dc->bufferedAmount() <= mParams.messageSize) {
+			dc->send(mMessageData);
+			peer.sentSize += mMessageData.size();
+		}
+	} catch (const std::exception &e) {
+		cout << "Send failed: " << e.what() << endl;
+	}
+}
+
+void LoadGenerator::sendLoop() {
+	const auto stepDuration = 10ms;
+	auto stepTime = steady_clock::now();
+	while (!mStopping) {
+		std::this_thread::sleep_until(stepTime + stepDuration);
+		const auto now = steady_clock::now();
+		const double elapsed = seconds(now - stepTime);
+		stepTime = now;
+
+		vector<shared_ptr<Peer>> peers;
+		{
+			std::lock_guard lock(mMutex);
+			peers.reserve(mPeers.size());
+			for (const auto &[key, peer] : mPeers)
+				peers.push_back(peer);
+		}
+
+		// Allow a burst of one second at most when a channel is congested
+		const double maxCredit = std::max(double(mParams.messageRate), 1.0);
+		for (const auto &peer : peers) {
+			std::lock_guard lock(peer->mutex);
+			for (auto &channel : peer->channels) {
+				if (!channel.dc->isOpen())
+					continue;
+
+				channel.credit =
+				    std::min(channel.credit + elapsed * mParams.messageRate, maxCredit);
+				try {
+					while (channel.credit >= 1 &&
+					       channel.dc->bufferedAmount() <= mParams.messageSize * maxCredit) {
+						channel.dc->send(mMessageData);
+						peer->sentSize += mMessageData.size();
+						channel.credit -= 1;
+					}
+				} catch (const std::exception &e) {
+					cout << "Send failed: " << e.what() << endl;
+				}
+			}
+		}
+	}
+}
+
+json LoadGenerator::run(const string &remoteId) {
+	const auto baseline = sampleResources();
+	const auto interval = mParams.rampUpPerSec > 0
+	                          ? chrono::duration_cast<steady_clock::duration>(
+	                                chrono::duration<double>(1.0 / mParams.rampUpPerSec))
+	                          : steady_clock::duration(0);
+
+	cout << "Offering " << mParams.peers << " connections to " << remoteId << " with "
+	     << mParams.channels << " channels each" << endl;
+
+	vector<shared_ptr<Peer>> peers;
+	peers.reserve(mParams.peers);
+	const auto startTime = steady_clock::now();
+	for (int i = 0; i < mParams.peers; ++i) {
+		peers.push_back(createPeer(remoteId, i, true));
+		std::this_thread::sleep_until(startTime + interval * (i + 1));
+	}
+	const auto rampUpDuration = steady_clock::now() - startTime;
+
+	auto status = [&peers, this]() {
+		int connected = 0, failed = 0;
+		const auto now = steady_clock::now();
+		for (const auto &peer : peers) {
+			std::lock_guard lock(peer->mutex);
+			if (peer->setupDuration)
+				++connected;
+			else if (peer->failed || now - peer->created > mParams.setupTimeout)
+				++failed;
+		}
+		return std::make_pair(connected, failed);
+	};
+
+	auto totals = [&peers]() {
+		size_t sent = 0, received = 0;
+		for (const auto &peer : peers) {
+			sent += peer->sentSize.load();
+			received += peer->receivedSize.load();
+		}
+		return std::make_pair(sent, received);
+	};
+
+	cout << "Ramp-up done in " << duration_cast<milliseconds>(rampUpDuration).count()
+	     << " ms, running for " << mParams.duration.count() << " seconds" << endl;
+
+	const auto [initialSent, initialReceived] = totals();
+	const auto runStartTime = steady_clock::now();
+	const auto runResources = sampleResources();
+	auto [lastSent, lastReceived] = std::make_pair(initialSent, initialReceived);
+	auto printTime = runStartTime;
+	for (int i = 1; i <= mParams.duration.count(); ++i) {
+		std::this_thread::sleep_until(runStartTime + chrono::seconds(i));
+		const auto now = steady_clock::now();
+		const double elapsed = seconds(now - printTime);
+		printTime = now;
+
+		auto [connected, failed] = status();
+		auto [sent, received] = totals();
+		cout << "#" << i << " Connected: " << connected << "   Failed: " << failed
+		     << "   Received: " << size_t((received - lastReceived) / (elapsed * 1000)) << " KB/s"
+		     << "   Sent: " << size_t((sent - lastSent) / (elapsed * 1000)) << " KB/s" << endl;
+
+		lastSent = sent;
+		lastReceived = received;
+	}
+
+	const double runDuration = seconds(steady_clock::now() - runStartTime);
+	const auto endResources = sampleResources();
+	const auto [connected, failed] = status();
+	const auto [sent, received] = totals();
+
+	vector<double> setupMs;
+	for (const auto &peer : peers) {
+		std::lock_guard lock(peer->mutex);
+		if (peer->setupDuration)
+			setupMs.push_back(chrono::duration<double, std::milli>(*peer->setupDuration).count());
+	}
+	std::sort(setupMs.begin(), setupMs.end());
+
+	auto percentile = [&setupMs](double p) -> json {
+		if (setupMs.empty())
+			return nullptr;
+
+		size_t rank = size_t(std::ceil(p * double(setupMs.size())));
+		return setupMs[std::clamp(rank, size_t(1), setupMs.size()) - 1];
+	};
+
+	const int bounds[] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+	json histogram = json::array();
+	auto it = setupMs.begin();
+	for (int bound : bounds) {
+		auto next = std::upper_bound(it, setupMs.end(), bound);
+		histogram.push_back({{"le", bound}, {"count", std::distance(it, next)}});
+		it = next;
+	}
+	histogram.push_back({{"le", "inf"}, {"count", std::distance(it, setupMs.end())}});
+
+	const int perConnection = std::max(connected, 1);
+	const double cpuSeconds = endResources.cpuSeconds - runResources.cpuSeconds;
+	const double receivedRate = double(received - initialReceived) / (runDuration * 1000);
+	const double sentRate = double(sent - initialSent) / (runDuration * 1000);
+
+	return {
+	    {"connections",
+	     {{"attempted", mParams.peers},
+	      {"connected", connected},
+	      {"failed", failed},
+	      {"pending", mParams.peers - connected - failed},
+	      {"successRate", mParams.peers > 0 ? double(connected) / mParams.peers : 0.},
+	      {"rampUpMs", duration_cast<milliseconds>(rampUpDuration).count()}}},
+	    {"setupMs",
+	     {{"p50", percentile(0.50)},
+	      {"p90", percentile(0.90)},
+	      {"p99", percentile(0.99)},
+	      {"max", setupMs.empty() ? json(nullptr) : json(setupMs.back())},
+	      {"histogram", histogram}}},
+	    {"throughput",
+	     {{"durationSec", runDuration},
+	      {"receivedKBps", receivedRate},
+	      {"sentKBps", sentRate},
+	      {"receivedKBpsPerConnection", receivedRate / perConnection},
+	      {"sentKBpsPerConnection", sentRate / perConnection}}},
+	    {"resources",
+	     {{"cpuPercent", 100 * cpuSeconds / runDuration},
+	      {"cpuPercentPerConnection", 100 * cpuSeconds / runDuration / perConnection},
+	      {"rssKB", endResources.rssKB},
+	      {"rssKBPerConnection", (endResources.rssKB - baseline.rssKB) / perConnection}}},
+	};
+}
+
+void LoadGenerator::printReport(const json &report) {
+	const auto &connections = report["connections"];
+	const auto &setup = report["setupMs"];
+	const auto &throughput = report["throughput"];
+	const auto &resources = report["resources"];
+
+	cout << "Connections: " << connections["connected"] << "/" << connections["attempted"]
+	     << " connected, " << connections["failed"] << " failed (success rate "
+	     << connections["successRate"].get<double>() * 100 << "%)" << endl;
+
+	cout << "Setup latency: p50 " << setup["p50"] << " ms, p90 " << setup["p90"] << " ms, p99 "
+	     << setup["p99"] << " ms, max " << setup["max"] << " ms" << endl;
+
+	for (const auto &bucket : setup["histogram"]) {
+		const auto &le = bucket["le"];
+		const string bound = le.is_string() ? le.get<string>() : le.dump();
+		cout << std::setw(10) << ("<= " + bound) << " ms: " << bucket["count"] << endl;
+	}
+
+	cout << "Throughput: Received " << size_t(throughput["receivedKBps"].get<double>())
+	     << " KB/s   Sent " << size_t(throughput["sentKBps"].get<double>()) << " KB/s" << endl;
+
+	cout << "Resources: CPU " << resources["cpuPercent"].get<double>() << "% ("
+	     << resources["cpuPercentPerConnection"].get<double>() << "% per connection), RSS "
+	     << size_t(resources["rssKB"].get<double>()) << " KB ("
+	     << size_t(resources["rssKBPerConnection"].get<double>()) << " KB per connection)"
+	     << endl;
+}
@@ -0,0 +1,81 @@
+/*
+ * libdatachannel client-benchmark example
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include "rtc/rtc.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct LoadParams {
+	int peers = 0;                         // connections to offer
+	int rampUpPerSec = 50;                 // connections created per second
+	int channels = 1;                      // data channels per connection
+	size_t messageSize = 65535;            // bytes
+	int messageRate = 0;                   // per channel per second, 0 is unlimited
+	bool noSend = false;                   // only receive
+	std::chrono::seconds duration{60};     // after the ramp-up
+	std::chrono::seconds setupTimeout{30}; // before a connection counts as failed
+};
+
+// Many concurrent PeerConnections multiplexed on a single signaling WebSocket
+// Signaling messages carry a "pc" field with the connection index so the remote client can tell
+// the connections apart, signaling servers forward it untouched.
+class LoadGenerator final {
+public:
+	LoadGenerator(rtc::Configuration config, LoadParams params, std::weak_ptr<rtc::WebSocket> ws);
+	~LoadGenerator();
+
+	// Returns false if the message is not tagged with a connection index
+	bool handleSignaling(const std::string &id, const nlohmann::json &message);
+
+	// Offer connections to the remote client, run the load for the duration, and report
+	nlohmann::json run(const std::string &remoteId);
+
+	static void printReport(const nlohmann::json &report);
+
+private:
+	struct Peer;
+
+	std::shared_ptr<Peer> createPeer(const std::string &remoteId, int index, bool offerer);
+	void setupChannel(const std::shared_ptr<Peer> &peer, std::shared_ptr<rtc::DataChannel> dc);
+	void sendAvailable(const std::shared_ptr<rtc::DataChannel> &dc, Peer &peer);
+	void sendLoop();
+
+	const rtc::Configuration mConfig;
+	const LoadParams mParams;
+	const std::weak_ptr<rtc::WebSocket> mWebSocket;
+	const rtc::binary mMessageData;
+
+	std::mutex mMutex;
+	std::unordered_map<std::string, std::shared_ptr<Peer>> mPeers;
+
+	std::atomic<bool> mStopping = false;
+	std::thread mSendThread; // only with a limited message rate
+};
+
+#endif
@@ -23,6 +23,7 @@
 
 #include "rtc/rtc.hpp"
 
+#include "loadgen.hpp"
 #include "parse_cl.h"
 
 #include <nlohmann/json.hpp>
@@ -30,6 +31,7 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <fstream>
 #include <future>
 #include <iomanip>
 #include <iostream>
@@ -60,8 +62,7 @@ shared_ptr<PeerConnection> createPeerConnection(const Configuration &config,
 string randomId(size_t length);
 
 // Benchmark
-const size_t messageSize = 65535;
-binary messageData(messageSize);
+binary messageData;
 unordered_map<string, atomic<size_t>> receivedSizeMap;
 unordered_map<string, atomic<size_t>> sentSizeMap;
 bool noSend = false;
@@ -79,7 +80,7 @@ int main(int argc, char **argv) try {
 	rtc::InitLogger(LogLevel::Info);
 
 	// Benchmark - construct message to send
-	fill(messageData.begin(), messageData.end(), std::byte(0xFF));
+	messageData.assign(size_t(params.messageSize()), std::byte(0xFF));
 
 	// Benchmark - enableThroughputSet params
 	enableThroughputSet = params.enableThroughputSet();
@@ -105,11 +106,23 @@ int main(int argc, char **argv) try {
 		config.iceServers.emplace_back(stunServer);
 	}
 
+	LoadParams loadParams;
+	loadParams.peers = params.loadPeers();
+	loadParams.rampUpPerSec = params.rampUpPerSec();
+	loadParams.channels = params.dataChannelCount();
+	loadParams.messageSize = messageData.size();
+	loadParams.messageRate = params.messageRate();
+	loadParams.noSend = noSend;
+	loadParams.duration = chrono::seconds(params.durationInSec() > 0 ? params.durationInSec() : 60);
+
 	localId = randomId(4);
 	cout << "The local ID is: " << localId << endl;
 
 	auto ws = make_shared<WebSocket>();
 
+	// Connections tagged with an index are handled by the load generator, on both sides
+	auto load = make_shared<LoadGenerator>(config, loadParams, ws);
+
 	std::promise<void> wsPromise;
 	auto wsFuture = wsPromise.get_future();
 
@@ -136,6 +149,9 @@ int main(int argc, char **argv) try {
 			return;
 		string id = it->get<string>();
 
+		if (load->handleSignaling(id, message))
+			return;
+
 		it = message.find("type");
 		if (it == message.end())
 			return;
@@ -173,10 +189,12 @@ int main(int argc, char **argv) try {
 	cout << "Waiting for signaling to be connected..." << endl;
 	wsFuture.get();
 
-	string id;
-	cout << "Enter a remote ID to send an offer:" << endl;
-	cin >> id;
-	cin.ignore();
+	string id = params.remoteId();
+	if (id.empty()) {
+		cout << "Enter a remote ID to send an offer:" << endl;
+		cin >> id;
+		cin.ignore();
+	}
 	if (id.empty()) {
 		// Nothing to do
 		return 0;
@@ -186,6 +204,19 @@ int main(int argc, char **argv) try {
 		return 0;
 	}
 
+	if (loadParams.peers > 0) {
+		json report = load->run(id);
+		LoadGenerator::printReport(report);
+		if (!params.reportFile().empty()) {
+			std::ofstream file(params.reportFile());
+			file << report.dump(2) << endl;
+		}
+
+		cout << "Cleaning up..." << endl;
+		load.reset();
+		return 0;
+	}
+
 	cout << "Offering to " + id << endl;
 	auto pc = createPeerConnection(config, ws, id);
 
@@ -52,6 +52,12 @@ Cmdline::Cmdline(int argc, char *argv[]) // ISO C++17 not allowed: throw (std::s
 	                                       {"throughtputSetAsKB", required_argument, NULL, 'r'},
 	                                       {"bufferSize", required_argument, NULL, 'b'},
 										   {"dataChannelCount", required_argument, NULL, 'c'},
+	                                       {"loadPeers", required_argument, NULL, 'l'},
+	                                       {"remoteId", required_argument, NULL, 'i'},
+	                                       {"rampUpPerSec", required_argument, NULL, 'a'},
+	                                       {"messageSize", required_argument, NULL, 'm'},
+	                                       {"messageRate", required_argument, NULL, 'g'},
+	                                       {"reportFile", required_argument, NULL, 'j'},
 	                                       {"help", no_argument, NULL, 'h'},
 	                                       {NULL, 0, NULL, 0}};
 
@@ -70,9 +76,15 @@ Cmdline::Cmdline(int argc, char *argv[]) // ISO C++17 not allowed: throw (std::s
 	_r = 300;
 	_b = 0;
 	_c = 1;
+	_l = 0;
+	_i = "";
+	_a = 50;
+	_m = 65535;
+	_g = 0;
+	_j = "";
 
 	optind = 0;
-	while ((c = getopt_long(argc, argv, "s:t:w:x:d:r:b:c:enhvop", long_options, &optind)) != -1) {
+	while ((c = getopt_long(argc, argv, "s:t:w:x:d:r:b:c:l:i:a:m:g:j:enhvop", long_options, &optind)) != -1) {
 		switch (c) {
 		case 'n':
 			_n = true;
@@ -158,6 +170,50 @@ Cmdline::Cmdline(int argc, char *argv[]) // ISO C++17 not allowed: throw (std::s
 			}
 			break;
 
+		case 'l':
+			_l = atoi(optarg);
+			if (_l < 0) {
+				std::string err;
+				err += "parameter range error: l must be >= 0";
+				throw(std::range_error(err));
+			}
+			break;
+
+		case 'i':
+			_i = optarg;
+			break;
+
+		case 'a':
+			_a = atoi(optarg);
+			if (_a < 0) {
+				std::string err;
+				err += "parameter range error: a must be >= 0";
+				throw(std::range_error(err));
+			}
+			break;
+
+		case 'm':
+			_m = atoi(optarg);
+			if (_m <= 0) {
+				std::string err;
+				err += "parameter range error: m must be > 0";
+				throw(std::range_error(err));
+			}
+			break;
+
+		case 'g':
+			_g = atoi(optarg);
+			if (_g < 0) {
+				std::string err;
+				err += "parameter range error: g must be >= 0";
+				throw(std::range_error(err));
+			}
+			break;
+
+		case 'j':
+			_j = optarg;
+			break;
+
 		case 'h':
 			_h = true;
 			this->usage(EXIT_SUCCESS);
@@ -185,7 +241,7 @@ void Cmdline::usage(int status) {
 	else {
 		std::cout << "\
 usage: " << _program_name
-		          << " [ -enstwxdobprhv ] \n\
+		          << " [ -enstwxdobprclimagjhv ] \n\
 libdatachannel client implementing WebRTC Data Channels with WebSocket signaling\n\
    [ -n ] [ --noStun ] (type=FLAG)\n\
           Do NOT use a stun server (overrides -s and -t).\n\
@@ -209,6 +265,18 @@ libdatachannel client implementing WebRTC Data Channels with WebSocket signaling
           Send constant data per second (KB).\n\
    [ -c ] [ --dataChannelCount ] (type=INTEGER, range>0...INT_MAX, default=1)\n\
           Dat Channel count to create.\n\
+   [ -l ] [ --loadPeers ] (type=INTEGER, range>=0...INT_MAX, default=0)\n\
+          Load mode: offer this many concurrent connections to the remote ID.\n\
+   [ -i ] [ --remoteId ] (type=STRING)\n\
+          Remote ID to offer to, instead of reading it from the standard input.\n\
+   [ -a ] [ --rampUpPerSec ] (type=INTEGER, range>=0...INT_MAX, 0:all at once, default=50)\n\
+          Load mode: connections created per second.\n\
+   [ -m ] [ --messageSize ] (type=INTEGER, range>0...INT_MAX, default=65535)\n\
+          Message size in bytes.\n\
+   [ -g ] [ --messageRate ] (type=INTEGER, range>=0...INT_MAX, 0:unlimited, default=0)\n\
+          Load mode: messages sent per second on each Data Channel.\n\
+   [ -j ] [ --reportFile ] (type=STRING)\n\
+          Load mode: write the JSON report to this file.\n\
    [ -h ] [ --help ] (type=FLAG)\n\
           Display this help and exit.\n";
 	}
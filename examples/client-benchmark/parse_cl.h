@@ -46,6 +46,12 @@ private:
   int _r;
   int _b;
   int _c;
+  int _l;
+  std::string _i;
+  int _a;
+  int _m;
+  int _g;
+  std::string _j;
 
   /* other stuff to keep track of */
   std::string _program_name;
@@ -74,6 +80,12 @@ public:
   bool enableThroughputSet () const { return _p; }
   int throughtputSetAsKB() const { return _r; }  
   int dataChannelCount() const { return _c; }
+  int loadPeers() const { return _l; }
+  std::string remoteId() const { return _i; }
+  int rampUpPerSec() const { return _a; }
+  int messageSize() const { return _m; }
+  int messageRate() const { return _g; }
+  std::string reportFile() const { return _j; }
 };
 
 #endif
@@ -64,19 +64,6 @@ int main() {
 
 		const rtc::SSRC targetSSRC = 4;
 
-		track->onMessage(
-		    [&receivers, targetSSRC](rtc::binary message) {
-			    // This is an RTP packet
-			    auto rtp = reinterpret_cast<rtc::RtpHeader *>(message.data());
-			    rtp->setSsrc(targetSSRC);
-			    for (auto pc : receivers) {
-				    if (pc->track != nullptr && pc->track->isOpen()) {
-					    pc->track->send(message);
-				    }
-			    }
-		    },
-		    nullptr);
-
 		// Set the SENDERS Answer
 		{
 			std::cout << "Please copy/paste the answer provided by the SENDER: " << std::endl;
@@ -115,6 +102,14 @@ int main() {
 			pc->track = pc->conn->addTrack(media);
 			pc->conn->setLocalDescription();
 
+			// Relay RTP packets directly from the sender track, rewriting the SSRC
+			// To switch between several senders, send their packets to the track instead with an
+			// rtc::RtpHeaderRewriter as media handler, which also keeps sequence numbers and
+			// timestamps continuous
+			rtc::Track::ForwardingRules rules;
+			rules.ssrc = targetSSRC;
+			track->forwardTo(pc->track, rules);
+
 			pc->track->onMessage([](rtc::binary var) {}, nullptr);
 
 			std::cout << "Please copy/paste the answer provided by the RECEIVER: " << std::endl;
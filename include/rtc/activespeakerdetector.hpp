@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_ACTIVE_SPEAKER_DETECTOR_H
+#define RTC_ACTIVE_SPEAKER_DETECTOR_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace rtc {
+
+/// Detects the dominant speaker from the audio level header extension (RFC 6464) of incoming
+/// RTP packets, without decoding them. Levels are smoothed per SSRC, and the dominant speaker
+/// changes only when another speaker is clearly louder, at most every 500 ms.
+class RTC_CPP_EXPORT ActiveSpeakerDetector final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+
+	/// @param extensionId RTP header extension ID of the audio level
+	/// @param shareWith Detector to share speaker levels with, so the dominant speaker is
+	/// detected across all the audio tracks of a conference
+	ActiveSpeakerDetector(uint8_t extensionId,
+	                      shared_ptr<ActiveSpeakerDetector> shareWith = nullptr);
+
+	/// Called when the dominant speaker changes
+	void onDominantSpeaker(std::function<void(SSRC ssrc)> callback);
+
+	/// Returns the current dominant speaker, if any
+	optional<SSRC> dominantSpeaker() const;
+
+	/// Returns up to count active speakers, loudest first
+	std::vector<SSRC> loudestSpeakers(size_t count) const;
+
+	/// Returns the smoothed level of a speaker in -dBov, 127 for silence
+	uint8_t level(SSRC ssrc) const;
+
+	/// Reads audio levels of incoming RTP packets
+	/// @param messages RTP packets
+	/// @returns Unchanged RTP packets
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	struct Speaker {
+		double loudness = 0; // smoothed, in dB above silence
+		clock::time_point lastUpdate;
+	};
+
+	struct State {
+		std::unordered_map<SSRC, Speaker> speakers;
+		optional<SSRC> dominant;
+		clock::time_point lastSwitch;
+		synchronized_callback<SSRC> dominantSpeakerCallback;
+		mutable std::mutex mutex;
+
+		double loudness(const Speaker &speaker, clock::time_point now) const;
+		optional<SSRC> update(SSRC ssrc, uint8_t level, clock::time_point now);
+	};
+
+	const uint8_t extensionId;
+	const shared_ptr<State> state;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_ACTIVE_SPEAKER_DETECTOR_H */
@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2019 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_ASYNC_H
+#define RTC_ASYNC_H
+
+// Optional C++20 coroutine awaitables, available only when compiling with coroutine support
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include "channel.hpp"
+#include "common.hpp"
+#include "peerconnection.hpp"
+
+#include <coroutine>
+#include <memory>
+#include <mutex>
+
+// Awaitables resume the coroutine directly in the library thread which triggered the event, so
+// the coroutine must not block. An awaitable takes over the channel or PeerConnection callbacks
+// it relies on, they must not be used concurrently for anything else.
+//
+// Example:
+//     co_await rtc::async::open(*dc);
+//     while (auto message = co_await rtc::async::receive(*dc)) { ... }
+
+namespace rtc::async {
+
+namespace detail {
+
+// Result shared between the awaiter and the callbacks, which may outlive it
+template <typename T> class AwaitState final {
+public:
+	// Complete with the value returned by poll if any, returns true if completed
+	template <typename F> bool complete(F &&poll) {
+		std::coroutine_handle<> handle;
+		{
+			std::lock_guard lock(mMutex);
+			if (mResult)
+				return false;
+
+			auto result = poll(); // under lock so nothing is consumed once completed
+			if (!result)
+				return false;
+
+			mResult.emplace(std::move(*result));
+			if (mSuspending || !mHandle)
+				return true; // resumption is left to await_suspend()
+
+			handle = std::exchange(mHandle, nullptr);
+		}
+		handle.resume();
+		return true;
+	}
+
+	void beginSuspend(std::coroutine_handle<> handle) {
+		std::lock_guard lock(mMutex);
+		mHandle = handle;
+		mSuspending = true;
+	}
+
+	bool endSuspend() { // returns false if already completed, i.e. not suspended
+		std::lock_guard lock(mMutex);
+		mSuspending = false;
+		if (!mResult)
+			return true;
+
+		mHandle = nullptr;
+		return false;
+	}
+
+	T take() {
+		std::lock_guard lock(mMutex);
+		return std::move(*mResult);
+	}
+
+private:
+	std::mutex mMutex;
+	std::coroutine_handle<> mHandle;
+	optional<T> mResult;
+	bool mSuspending = false;
+};
+
+} // namespace detail
+
+// Await the next message, nullopt means the channel is closed
+class ReceiveAwaiter final {
+public:
+	using result_type = optional<message_variant>;
+
+	explicit ReceiveAwaiter(Channel &channel)
+	    : mChannel(&channel), mState(std::make_shared<detail::AwaitState<result_type>>()) {}
+
+	bool await_ready() { return mState->complete([channel = mChannel] { return Poll(*channel); }); }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		auto state = mState;
+		auto channel = mChannel;
+		state->beginSuspend(handle);
+		channel->onAvailable(
+		    [state, channel]() { state->complete([channel] { return Poll(*channel); }); });
+		channel->onClosed([state, channel]() { state->complete([channel] { return Poll(*channel); }); });
+
+		// A message might have arrived before callbacks were set
+		state->complete([channel] { return Poll(*channel); });
+		return state->endSuspend();
+	}
+
+	result_type await_resume() { return mState->take(); }
+
+private:
+	static optional<result_type> Poll(Channel &channel) {
+		if (auto message = channel.receive())
+			return result_type(std::move(message));
+
+		if (channel.isClosed())
+			return result_type(nullopt);
+
+		return nullopt;
+	}
+
+	Channel *mChannel;
+	shared_ptr<detail::AwaitState<result_type>> mState;
+};
+
+// Await the channel opening, false means it was closed or failed before opening
+class OpenAwaiter final {
+public:
+	explicit OpenAwaiter(Channel &channel)
+	    : mChannel(&channel), mState(std::make_shared<detail::AwaitState<bool>>()) {}
+
+	bool await_ready() { return mState->complete([channel = mChannel] { return Poll(*channel); }); }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		auto state = mState;
+		auto channel = mChannel;
+		state->beginSuspend(handle);
+		channel->onOpen([state]() { state->complete([] { return optional<bool>(true); }); });
+		channel->onClosed([state]() { state->complete([] { return optional<bool>(false); }); });
+		channel->onError(
+		    [state](string) { state->complete([] { return optional<bool>(false); }); });
+
+		state->complete([channel] { return Poll(*channel); });
+		return state->endSuspend();
+	}
+
+	bool await_resume() { return mState->take(); }
+
+private:
+	static optional<bool> Poll(Channel &channel) {
+		if (channel.isOpen())
+			return true;
+
+		if (channel.isClosed())
+			return false;
+
+		return nullopt;
+	}
+
+	Channel *mChannel;
+	shared_ptr<detail::AwaitState<bool>> mState;
+};
+
+// Await the end of ICE candidates gathering
+class GatheringAwaiter final {
+public:
+	explicit GatheringAwaiter(PeerConnection &pc)
+	    : mPeerConnection(&pc), mState(std::make_shared<detail::AwaitState<bool>>()) {}
+
+	bool await_ready() { return mState->complete([pc = mPeerConnection] { return Poll(*pc); }); }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		auto state = mState;
+		auto pc = mPeerConnection;
+		state->beginSuspend(handle);
+		pc->onGatheringStateChange([state](PeerConnection::GatheringState gatheringState) {
+			if (gatheringState == PeerConnection::GatheringState::Complete)
+				state->complete([] { return optional<bool>(true); });
+		});
+
+		state->complete([pc] { return Poll(*pc); });
+		return state->endSuspend();
+	}
+
+	void await_resume() { mState->take(); }
+
+private:
+	static optional<bool> Poll(PeerConnection &pc) {
+		if (pc.gatheringState() == PeerConnection::GatheringState::Complete)
+			return true;
+
+		return nullopt;
+	}
+
+	PeerConnection *mPeerConnection;
+	shared_ptr<detail::AwaitState<bool>> mState;
+};
+
+inline ReceiveAwaiter receive(Channel &channel) { return ReceiveAwaiter(channel); }
+inline OpenAwaiter open(Channel &channel) { return OpenAwaiter(channel); }
+inline GatheringAwaiter gatheringComplete(PeerConnection &pc) { return GatheringAwaiter(pc); }
+
+} // namespace rtc::async
+
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_BROADCAST_GROUP_H
+#define RTC_BROADCAST_GROUP_H
+
+#include "datachannel.hpp"
+
+namespace rtc {
+
+// What happens to a subscriber whose buffered amount exceeds its limit
+enum class SlowConsumerPolicy {
+	Queue, // messages are queued anyway
+	Drop,  // messages are skipped until the subscriber catches up
+	Close  // the data channel is closed
+};
+
+struct BroadcastSubscriberOptions {
+	SlowConsumerPolicy policy = SlowConsumerPolicy::Drop;
+	size_t maxBufferedAmount = 1024 * 1024; // in bytes
+};
+
+/// Fan-out of the same messages to many data channels, for instance live updates to a large
+/// audience. Each published message is stored once, and all subscribers reference the same
+/// immutable payload in their send queues until it is sent, so the cost per subscriber is reduced
+/// to the SCTP and DTLS processing. Subscribers are not kept alive by the group, closed ones are
+/// removed automatically.
+class RTC_CPP_EXPORT BroadcastGroup final {
+public:
+	struct Stats {
+		size_t subscribers = 0;
+		uint64_t published = 0; // messages
+		uint64_t sent = 0;      // messages handed over to subscribers
+		uint64_t dropped = 0;   // messages skipped for slow or failing subscribers
+		uint64_t closed = 0;    // slow subscribers closed
+	};
+
+	BroadcastGroup();
+	~BroadcastGroup();
+
+	BroadcastGroup(const BroadcastGroup &) = delete;
+	BroadcastGroup &operator=(const BroadcastGroup &) = delete;
+
+	void subscribe(shared_ptr<DataChannel> channel, BroadcastSubscriberOptions options = {});
+	void unsubscribe(const shared_ptr<DataChannel> &channel);
+	size_t size() const;
+
+	/// Returns the number of subscribers the message was handed over to, channels which are not
+	/// open yet are skipped
+	size_t publish(message_variant data);
+	size_t publish(shared_ptr<const binary> data); // zero-copy
+	size_t publish(const byte *data, size_t size);
+
+	Stats stats() const;
+
+private:
+	struct Group;
+	const shared_ptr<Group> group;
+};
+
+} // namespace rtc
+
+#endif
@@ -40,6 +40,12 @@ public:
 	enum class ResolveMode { Simple, Lookup };
 	bool resolve(ResolveMode mode = ResolveMode::Simple);
 
+	// Replace the node by a numeric address resolved elsewhere, keeping the port
+	void changeAddress(string addr);
+
+	// Replace the priority, for instance to reorder connectivity checks
+	void changePriority(uint32_t priority);
+
 	Type type() const;
 	TransportType transportType() const;
 	uint32_t priority() const;
@@ -54,6 +60,7 @@ public:
 	Family family() const;
 	optional<string> address() const;
 	optional<uint16_t> port() const;
+	string node() const; // address or hostname as signaled
 
 private:
 	void parse(string candidate);
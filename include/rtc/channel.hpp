@@ -20,9 +20,11 @@
 #define RTC_CHANNEL_H
 
 #include "common.hpp"
+#include "message.hpp"
 
 #include <atomic>
 #include <functional>
+#include <vector>
 
 namespace rtc {
 
@@ -51,12 +53,17 @@ public:
 	void onMessage(std::function<void(binary data)> binaryCallback,
 	               std::function<void(string data)> stringCallback);
 
+	// Batched receiving: the messages available are delivered together in a single call, without
+	// conversion, see Message::type and Message::payload(). It takes precedence over onMessage().
+	void onMessages(std::function<void(const std::vector<message_ptr> &messages)> callback);
+
 	void onBufferedAmountLow(std::function<void()> callback);
 	void setBufferedAmountLowThreshold(size_t amount);
 
 	// Extended API
 	optional<message_variant> receive(); // only if onMessage unset
 	optional<message_variant> peek();    // only if onMessage unset
+	message_ptr receiveMessage();        // only if onMessage unset, without copy, null if none
 	size_t availableAmount() const;      // total size available to receive
 	void onAvailable(std::function<void()> callback);
 
@@ -27,6 +27,10 @@
 #define RTC_ENABLE_MEDIA 1
 #endif
 
+#ifndef RTC_ENABLE_LATENCY_TRACING
+#define RTC_ENABLE_LATENCY_TRACING 0
+#endif
+
 #ifdef _WIN32
 #define RTC_CPP_EXPORT __declspec(dllexport)
 #ifndef _WIN32_WINNT
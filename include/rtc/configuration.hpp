@@ -21,6 +21,8 @@
 
 #include "common.hpp"
 
+#include <chrono>
+#include <map>
 #include <vector>
 
 namespace rtc {
@@ -47,7 +49,7 @@ struct RTC_CPP_EXPORT IceServer {
 	Type type;
 	string username;
 	string password;
-	RelayType relayType;
+	RelayType relayType; // TCP and TLS require libnice, libjuice uses UDP instead
 };
 
 struct RTC_CPP_EXPORT ProxyServer {
@@ -66,7 +68,41 @@ struct RTC_CPP_EXPORT ProxyServer {
 enum class CertificateType {
 	Default = RTC_CERTIFICATE_DEFAULT, // ECDSA
 	Ecdsa = RTC_CERTIFICATE_ECDSA,
-	Rsa = RTC_CERTIFICATE_RSA
+	Rsa = RTC_CERTIFICATE_RSA,
+	Ed25519 = RTC_CERTIFICATE_ED25519 // faster to generate and sign, not supported by all browsers
+};
+
+// ECN codepoint of outgoing media packets, the remote must report Congestion Experienced marks
+// with RFC 8888 feedback and the sender must react to them (see TwccBandwidthEstimator)
+enum class EcnMarking {
+	None,    // Not-ECT
+	Classic, // ECT(0), Congestion Experienced is handled like loss
+	L4S      // ECT(1) for Low Latency Low Loss Scalable throughput (RFC 9331)
+};
+
+// Impairment of outgoing datagrams with the in-process loopback, for reproducible tests
+// Random decisions are drawn from a generator seeded with the seed, so a run can be replayed.
+struct RTC_CPP_EXPORT NetworkImpairment {
+	std::chrono::milliseconds delay{0};  // one-way
+	std::chrono::milliseconds jitter{0}; // uniform in [-jitter, jitter], datagrams may be reordered
+
+	// Gilbert-Elliott loss model: the link switches between a good and a bad state with the
+	// transition probabilities per datagram, and loses datagrams with the probability of the
+	// current state. Only lossGood is needed for uniform random loss.
+	double lossGood = 0;
+	double lossBad = 1;
+	double goodToBad = 0;
+	double badToGood = 1;
+
+	double reorder = 0; // probability for a datagram to skip the delay and overtake earlier ones
+
+	// Bottleneck: datagrams are serialized at the bitrate, and dropped when the queue is full
+	optional<unsigned int> bitrate; // in bits/s, unlimited if unset
+	size_t queueSize = 64 * 1024;   // in bytes
+
+	// Only the loss, reordering, and jitter draws are reproducible for a given seed, delivery
+	// still follows the real clock, like the DTLS and SCTP timers
+	uint32_t seed = 1;
 };
 
 enum class TransportPolicy { All = RTC_TRANSPORT_POLICY_ALL, Relay = RTC_TRANSPORT_POLICY_RELAY };
@@ -79,19 +115,117 @@ struct RTC_CPP_EXPORT Configuration {
 
 	// Options
 	CertificateType certificateType = CertificateType::Default;
+	bool shareCertificate = true; // use a process-wide certificate instead of a dedicated one
 	TransportPolicy iceTransportPolicy = TransportPolicy::All;
-	bool enableIceTcp = false;
+	bool enableIceTcp = false;          // passive candidates only with libjuice
+	bool enableIceUdpMux = false;       // libjuice only, connections share the same UDP port
+	bool enableUdpSegmentation = false; // GSO for media batches, libnice on Linux only
+	// Race IPv6 and IPv4 pairs by interleaving remote candidates (RFC 8421) and nominate the first
+	// valid pair, switching later to a better one. With libjuice, the agent nominates on its own.
+	bool enableIceAggressiveNomination = false;
 	bool disableAutoNegotiation = false;
 
 	// Port range
+	// With ICE UDP mux and a range set, connections are spread over its first ports, one per core
 	uint16_t portRangeBegin = 1024;
 	uint16_t portRangeEnd = 65535;
 
+	// Passive ICE-TCP listening port with libjuice, shared by all connections, any port if unset
+	optional<uint16_t> iceTcpPort;
+
+	// Report gathering as complete after this delay even if some servers have not answered,
+	// candidates gathered later are not reported
+	optional<std::chrono::milliseconds> iceGatheringTimeout;
+
+	// ICE transports gathered in advance by a PeerConnectionFactory, like iceCandidatePoolSize in
+	// browsers, so local descriptions are complete right away. Ignored by a PeerConnection.
+	unsigned int iceCandidatePoolSize = 0;
+
+	// In-process loopback instead of ICE, for co-located peers and benchmarks: datagrams are handed
+	// in memory to the PeerConnection of the same process whose description is set as remote,
+	// without sockets nor connectivity checks. Both peers must enable it, and ICE servers, ports,
+	// and candidates are ignored.
+	bool enableInProcessLoopback = false;
+	optional<NetworkImpairment> loopbackImpairment; // on datagrams sent by this peer
+
 	// Network MTU
 	optional<size_t> mtu;
 
+	// DTLS handshake retransmissions, for lossy or high-latency links
+	optional<std::chrono::milliseconds> dtlsRetransmitTimeout;    // initial, default 1s
+	optional<std::chrono::milliseconds> dtlsMaxRetransmitTimeout; // default 60s (OpenSSL only)
+	optional<std::chrono::milliseconds> dtlsHandshakeTimeout;     // default 30s
+	bool dtlsAdaptiveRetransmit = false; // adapt to the handshake round-trip time once measured
+
+	// Media pacing, outgoing RTP packets of all tracks are spread at a multiple of the target
+	// bitrate instead of being sent in bursts, audio is sent before video
+	// The target bitrate is updated from the estimation reported to Track::onTargetBitrate(), it is
+	// the sum of the latest estimations of each transport
+	bool enableMediaPacing = false;
+	double mediaPacingFactor = 2.5;
+	unsigned int mediaPacingBitrate = 1000000; // in bits/s, initial target bitrate
+
+	// Explicit Congestion Notification marking of media packets, not available with ICE-TCP
+	// Packets stay Not-ECT unless both descriptions have a=rtcp-fb:* ack ccfb (RFC 8888)
+	EcnMarking mediaEcn = EcnMarking::None;
+
+	// Egress scheduling of all outgoing packets under a total rate cap, so bulk transfers on Data
+	// Channels don't add jitter to media: audio has strict priority, while video and the rest
+	// share the cap by weight. Packets are classified by DSCP, see Track::setDscp().
+	optional<unsigned int> egressMaxBitrate; // in bits/s, enables the scheduler
+	unsigned int egressVideoWeight = 3;
+	unsigned int egressDataWeight = 1;
+
+	// Media-only mode, Data Channels can't be created and SCTP is never started, an application
+	// in the remote offer is rejected with port 0 in the answer
+	bool disableDataChannels = false;
+
 	// Local maximum message size for Data Channels
 	optional<size_t> maxMessageSize;
+
+	// Preset dictionaries for Data Channel compression, by name, see DataChannelInit::compression
+	// A dictionary made of samples of typical messages improves compression of small messages, and
+	// remote peers must have the same dictionary under the same name.
+	std::map<string, binary> compressionDictionaries;
+
+	// Datagrams sent directly over DTLS, bypassing SCTP, for loss-tolerant latency-critical data
+	// This is a libdatachannel extension negotiated in SDP, so both peers must enable it, and it
+	// requires Data Channels to be enabled. See PeerConnection::sendDatagram().
+	bool enableDatagrams = false;
+	optional<unsigned int> datagramMaxBitrate; // in bits/s, datagrams over the rate are dropped
+
+	// SCTP tuning for this connection, for high bandwidth-delay product links
+	bool sctpAutoBufferSize = false;      // grow buffers to the measured bandwidth-delay product
+	optional<uint64_t> sctpTargetBitrate; // in bits/s, buffers are sized for it using the RTT
+	optional<size_t> sctpMaxBufferSize;   // in bytes, limit for automatic sizing (default 16MiB)
+	optional<unsigned int> sctpMaxBurst;  // in MTUs, overrides SctpSettings::maxBurst
+
+	// Negotiate few outgoing SCTP streams and add more with RFC 6525 when Data Channel ids exceed
+	// them, instead of all 65535 upfront, for sessions opening thousands of channels with a small
+	// footprint. The remote peer must support adding streams, messages on streams it refuses to add
+	// are dropped. Overrides the stream limit of compactMemory.
+	bool sctpDynamicStreams = false;
+
+	// Latency tracing, if the library is built with RTC_ENABLE_LATENCY_TRACING: one message out of
+	// this interval is timed at each layer boundary, 1 times all of them
+	unsigned int latencySampleInterval = 64;
+
+	// Capture of the decrypted traffic to this file for offline replay, see TrafficCapture: SCTP
+	// packets after DTLS, and RTP and RTCP packets after SRTP, with timestamps. The file contains
+	// the application data in clear.
+	optional<string> capturePath;
+
+	// Limit on the bytes held in receive queues, the SCTP send queue, and SCTP reassembly, see
+	// PeerConnection::memoryStats(). When exceeded, channels receiving a message are closed with an
+	// error, and sending on data channels throws until the usage goes back under the limit.
+	optional<size_t> memoryLimit;
+
+	// Compact profile for many mostly idle connections: only 256 SCTP streams are negotiated (so
+	// Data Channel ids must be lower), SCTP buffers start small and grow with the traffic, and
+	// reassembly buffers are not reserved upfront. Combine with libjuice and enableIceUdpMux so
+	// connections also share the ICE thread and socket. The target is 128KiB per connection with
+	// one idle Data Channel, the "idle_footprint" scenario of rtc_bench checks it.
+	bool compactMemory = false;
 };
 
 } // namespace rtc
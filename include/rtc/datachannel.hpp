@@ -23,6 +23,7 @@
 #include "common.hpp"
 #include "reliability.hpp"
 
+#include <future>
 #include <type_traits>
 
 namespace rtc {
@@ -34,6 +35,15 @@ struct PeerConnection;
 
 } // namespace impl
 
+struct DataChannelStats {
+	uint64_t abandonedUnsent = 0; // partially reliable messages abandoned before being sent
+	uint64_t abandonedSent = 0;   // partially reliable messages abandoned after being sent
+	size_t queuedMessages = 0;    // messages waiting in the local send queue
+	size_t bufferedAmount = 0;    // amount waiting in the local send queue
+	uint64_t abandonedQueued = 0; // timed messages expired in the local send queue
+	size_t droppedMessages = 0;   // received messages dropped because the queue was full
+};
+
 class RTC_CPP_EXPORT DataChannel final : private CheshireCat<impl::DataChannel>, public Channel {
 public:
 	DataChannel(impl_ptr<impl::DataChannel> impl);
@@ -44,6 +54,15 @@ public:
 	string label() const;
 	string protocol() const;
 	Reliability reliability() const;
+	bool isCompressed() const; // see DataChannelInit::compression
+	uint16_t priority() const;
+	DataChannelStats stats() const;
+
+	// Differentiated Services Code Point of outgoing messages, 0 restores the default value given
+	// the priority: CS1 (8) for very low, AF21 (18) for high, AF11 (10) otherwise. As SCTP bundles
+	// all channels in the same packets, the value applies to the packets sent after the message.
+	unsigned int dscp() const;
+	void setDscp(unsigned int dscp);
 
 	bool isOpen(void) const override;
 	bool isClosed(void) const override;
@@ -52,11 +71,55 @@ public:
 	void close(void) override;
 	bool send(message_variant data) override;
 	bool send(const byte *data, size_t size) override;
+
+	// Send several messages at once with a single flush, returns false if any was buffered
+	bool sendBatch(std::vector<message_variant> messages);
+
+	// The reliability overrides the one of the channel for these messages only, for instance so
+	// the chunks of a media frame are abandoned once the frame is late
+	bool send(message_variant data, const Reliability &reliability);
+	bool sendBatch(std::vector<message_variant> messages, const Reliability &reliability);
+
+	// Bounded send mode: messages which would exceed the budget of buffered bytes are held back
+	// by the channel and handed to the transport as the buffered amount decreases
+	void setSendBudget(optional<size_t> bytes);
+
+	// Limit in bytes on the messages waiting to be received. When exceeded, further messages are
+	// held back within the receive window of the channel, so other channels are not stalled.
+	void setReceiveQueueLimit(optional<size_t> bytes);
+
+	// Bytes held back over the queue limit, 1MiB by default. Once the window is exhausted, a
+	// channel with partial reliability drops messages, while a reliable one pauses receiving for
+	// the whole connection so the SCTP window applies backpressure to the remote sender. Receiving
+	// resumes as the application receives again and the held back messages fit in the window.
+	void setReceiveWindow(size_t bytes);
+
+	// The future completes when the message is accepted by the transport, or holds an exception
+	// if the channel is closed first
+	std::future<void> sendAsync(message_variant data);
+
+	// Streamed sending: the binary message is read in fragments as the buffered amount allows,
+	// the reader returns the number of bytes written to the buffer, or 0 at the end. The message
+	// may exceed maxMessageSize(), so the remote peer should receive it in streamed mode. If the
+	// peer does not support SCTP message interleaving, the message is read entirely and sent as a
+	// whole, so it must not exceed maxMessageSize().
+	using stream_reader = std::function<size_t(byte *buffer, size_t size)>;
+	std::future<void> sendStream(stream_reader reader);
+
+	// Streamed receiving: incoming messages are delivered in fragments as they arrive instead of
+	// being reassembled and passed to onMessage, last is true on the final fragment of a message
+	void onFragment(std::function<void(message_variant fragment, bool last)> callback);
+
+	// Zero-copy sending, the buffer is shared until the message is actually sent
+	bool send(shared_ptr<const binary> data);
+	bool send(const byte *data, size_t size, std::function<void()> release);
 	template <typename Buffer> bool sendBuffer(const Buffer &buf);
 	template <typename Iterator> bool sendBuffer(Iterator first, Iterator last);
 
 private:
 	using CheshireCat<impl::DataChannel>::impl;
+
+	friend class BroadcastGroup;
 };
 
 template <typename Buffer> std::pair<const byte *, size_t> to_bytes(const Buffer &buf) {
@@ -25,6 +25,8 @@
 
 #include <iostream>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace rtc {
@@ -86,8 +88,13 @@ public:
 		Direction direction() const { return mDirection; }
 		void setDirection(Direction dir);
 
+		// A removed entry is rejected with port 0 and excluded from the bundle
+		bool isRemoved() const { return mIsRemoved; }
+		void markRemoved();
+
 		operator string() const;
 		string generateSdp(string_view eol, string_view addr, string_view port) const;
+		void appendSdp(string &sdp, string_view eol, string_view addr, string_view port) const;
 
 		virtual void parseSdpLine(string_view line);
 
@@ -116,7 +123,7 @@ public:
 
 	protected:
 		Entry(const string &mline, string mid, Direction dir = Direction::Unknown);
-		virtual string generateSdpLines(string_view eol) const;
+		virtual void appendSdpLines(string &sdp, string_view eol) const;
 
 		std::vector<string> mAttributes;
 		std::map<int, ExtMap> mExtMap;
@@ -126,6 +133,7 @@ public:
 		string mDescription;
 		string mMid;
 		Direction mDirection;
+		bool mIsRemoved = false;
 	};
 
 	struct RTC_CPP_EXPORT Application : public Entry {
@@ -139,17 +147,20 @@ public:
 		void setSctpPort(uint16_t port) { mSctpPort = port; }
 		void hintSctpPort(uint16_t port) { mSctpPort = mSctpPort.value_or(port); }
 		void setMaxMessageSize(size_t size) { mMaxMessageSize = size; }
+		void setDatagrams(bool enabled) { mDatagrams = enabled; } // libdatachannel extension
 
 		optional<uint16_t> sctpPort() const { return mSctpPort; }
 		optional<size_t> maxMessageSize() const { return mMaxMessageSize; }
+		bool datagrams() const { return mDatagrams; }
 
 		virtual void parseSdpLine(string_view line) override;
 
 	private:
-		virtual string generateSdpLines(string_view eol) const override;
+		virtual void appendSdpLines(string &sdp, string_view eol) const override;
 
 		optional<uint16_t> mSctpPort;
 		optional<size_t> mMaxMessageSize;
+		bool mDatagrams = false;
 	};
 
 	// Media (non-data)
@@ -169,10 +180,20 @@ public:
 		void removeSSRC(uint32_t oldSSRC);
 		void replaceSSRC(uint32_t oldSSRC, uint32_t ssrc, optional<string> name,
 		                 optional<string> msid = nullopt, optional<string> trackID = nullopt);
-		bool hasSSRC(uint32_t ssrc);
-		std::vector<uint32_t> getSSRCs();
+		bool hasSSRC(uint32_t ssrc) const;
+		std::vector<uint32_t> getSSRCs() const;
 		std::optional<std::string> getCNameForSsrc(uint32_t ssrc);
 
+		// SSRC groups, like FID for an RTX stream associated with the original one (RFC 5576)
+		void addSSRCGroup(const string &semantics, const std::vector<uint32_t> &ssrcs);
+		std::vector<std::vector<uint32_t>> getSSRCGroups(const string &semantics) const;
+		optional<uint32_t> getRtxSSRC(uint32_t ssrc) const;
+
+		// Simulcast layers identified by RTP stream IDs (RFC 8851, RFC 8853)
+		void addRid(const string &rid, Direction direction = Direction::SendOnly);
+		std::vector<string> getRids(Direction direction = Direction::SendOnly) const;
+		bool hasSimulcast() const;
+
 		void setBitrate(int bitrate);
 		int getBitrate() const;
 
@@ -180,6 +201,17 @@ public:
 
 		void addRTXCodec(unsigned int payloadType, unsigned int originalPayloadType,
 		                 unsigned int clockRate);
+		optional<int> getRtxPayloadType(int originalPayloadType) const;
+		optional<int> getRtxOriginalPayloadType(int rtxPayloadType) const;
+
+		// Redundant payloads (RFC 2198) and ULP forward error correction (RFC 5109)
+		// The RED payload type has the clock rate and channels of the primary payload type, and
+		// fmtp lists the block payload types when redundancy is used
+		void addREDCodec(unsigned int payloadType, unsigned int primaryPayloadType,
+		                 unsigned int redundancy = 1);
+		void addULPFECCodec(unsigned int payloadType, unsigned int clockRate = 90000);
+		optional<int> getRedPayloadType() const;
+		optional<int> getUlpfecPayloadType() const;
 
 		virtual void parseSdpLine(string_view line) override;
 
@@ -210,7 +242,7 @@ public:
 		std::map<int, RTPMap>::iterator removeMap(std::map<int, RTPMap>::iterator iterator);
 
 	private:
-		virtual string generateSdpLines(string_view eol) const override;
+		virtual void appendSdpLines(string &sdp, string_view eol) const override;
 
 		int mBas = -1;
 
@@ -219,6 +251,7 @@ public:
 
 		std::map<int, RTPMap> mRtpMap;
 		std::vector<uint32_t> mSsrcs;
+		std::unordered_set<uint32_t> mSsrcSet; // for lookups, mSsrcs keeps the order
 		std::map<uint32_t, string> mCNameMap;
 	};
 
@@ -238,6 +271,8 @@ public:
 		void addVideoCodec(int payloadType, string codec, optional<string> profile = std::nullopt);
 
 		void addH264Codec(int payloadType, optional<string> profile = DEFAULT_H264_VIDEO_PROFILE);
+		void addH265Codec(int payloadType);
+		void addAV1Codec(int payloadType);
 		void addVP8Codec(int payloadType);
 		void addVP9Codec(int payloadType);
 	};
@@ -257,6 +292,10 @@ public:
 	variant<const Media *, const Application *> media(unsigned int index) const;
 	unsigned int mediaCount() const;
 
+	// Indexed lookups, in constant time
+	optional<unsigned int> mediaIndex(string_view mid) const;
+	optional<unsigned int> mediaIndexFromSsrc(uint32_t ssrc) const;
+
 	const Application *application() const;
 	Application *application();
 
@@ -265,8 +304,11 @@ public:
 
 private:
 	optional<Candidate> defaultCandidate() const;
+	void appendSessionAttributes(string &sdp, string_view eol) const;
 	shared_ptr<Entry> createEntry(string mline, string mid, Direction dir);
 	void removeApplication();
+	void indexEntry(unsigned int index);
+	void reindexEntries();
 
 	Type mType;
 
@@ -281,6 +323,11 @@ private:
 	std::vector<shared_ptr<Entry>> mEntries;
 	shared_ptr<Application> mApplication;
 
+	// Entry indexes by mid and by SSRC, they are checked on lookup as media may be modified in
+	// place after being added
+	std::unordered_map<string, unsigned int> mMidIndex;
+	std::unordered_map<uint32_t, unsigned int> mSsrcIndex;
+
 	// Candidates
 	std::vector<Candidate> mCandidates;
 	bool mEnded = false;
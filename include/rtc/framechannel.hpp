@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_FRAME_CHANNEL_H
+#define RTC_FRAME_CHANNEL_H
+
+#include "common.hpp"
+#include "datachannel.hpp"
+#include "utils.hpp"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace rtc {
+
+struct FrameChannelConfiguration {
+	size_t chunkSize = 16384;               // payload bytes per chunk, at most
+	size_t maxFrameSize = 16 * 1024 * 1024; // larger incoming frames are dropped
+	size_t maxPendingFrames = 8;            // incoming frames being reassembled
+};
+
+/// Media frames over a DataChannel with partial reliability per frame, for instance encoded
+/// video of a custom codec
+/// Frames are split into chunks with a small header, and chunks are only retransmitted until the
+/// frame deadline, so a lost chunk delays one frame at most instead of stalling the channel.
+/// The receiver drops late and incomplete frames, and reassembles the others into reused
+/// buffers. The channel should preferably be unordered.
+class RTC_CPP_EXPORT FrameChannel final {
+public:
+	using Configuration = FrameChannelConfiguration;
+
+	struct Stats {
+		uint64_t framesSent = 0;
+		uint64_t framesReceived = 0; // delivered complete
+		uint64_t framesDropped = 0;  // incomplete before their deadline, or late
+	};
+
+	using frame_callback = std::function<void(const binary &frame)>;
+
+	/// @param channel DataChannel, its message callback is taken over
+	FrameChannel(shared_ptr<DataChannel> channel, Configuration config = {});
+	~FrameChannel();
+
+	/// Sends a frame, which is abandoned if not received before the deadline
+	/// @param deadline Frame lifetime from now, up to 65535 ms
+	/// @returns false if chunks were buffered
+	bool sendFrame(const byte *data, size_t size, std::chrono::milliseconds deadline);
+	bool sendFrame(const binary &frame, std::chrono::milliseconds deadline);
+
+	/// Frames are delivered in order, the buffer is reused once the callback returns
+	void onFrame(frame_callback callback);
+
+	Stats stats() const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Pending {
+		uint32_t number;
+		binary buffer;
+		size_t received;
+		clock::time_point deadline;
+	};
+
+	void incoming(binary chunk);
+	void dropUntil(uint32_t number); // mutex must be locked
+	binary acquireBuffer(size_t size); // mutex must be locked
+
+	const shared_ptr<DataChannel> channel;
+	const Configuration config;
+
+	mutable std::mutex mutex;
+	uint32_t nextNumber = 0;
+	std::vector<Pending> pending;
+	std::vector<binary> freeBuffers;
+	optional<uint32_t> floor; // frames up to this number are delivered or dropped
+	Stats counters;
+
+	synchronized_callback<const binary &> frameCallback;
+};
+
+} // namespace rtc
+
+#endif /* RTC_FRAME_CHANNEL_H */
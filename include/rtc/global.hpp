@@ -21,6 +21,7 @@
 
 #include "common.hpp"
 
+#include <array>
 #include <chrono>
 #include <iostream>
 #include <future>
@@ -41,6 +42,20 @@ typedef std::function<void(LogLevel level, string message)> LogCallback;
 
 RTC_CPP_EXPORT void InitLogger(LogLevel level, LogCallback callback = nullptr);
 
+enum class LogSubsystem {
+	General = 0,
+	Ice = 1,
+	Dtls = 2,
+	Srtp = 3,
+	Sctp = 4,
+	Tcp = 5,
+	Tls = 6,
+	WebSocket = 7
+};
+
+// Restrict the level of a subsystem below the one passed to InitLogger(), Verbose by default
+RTC_CPP_EXPORT void SetLogLevel(LogSubsystem subsystem, LogLevel level);
+
 #ifdef PLOG_DEFAULT_INSTANCE_ID
 // Deprecated, kept for retro-compatibility
 [[deprecated]]
@@ -49,6 +64,8 @@ RTC_CPP_EXPORT void InitLogger(plog::Severity severity, plog::IAppender *appende
 
 RTC_CPP_EXPORT void Preload();
 RTC_CPP_EXPORT std::shared_future<void> Cleanup();
+// SCTP associations still shutting down gracefully after the timeout are aborted
+RTC_CPP_EXPORT std::shared_future<void> Cleanup(std::chrono::milliseconds timeout);
 
 struct SctpSettings {
 	// For the following settings, not set means optimized default
@@ -64,10 +81,102 @@ struct SctpSettings {
 	optional<std::chrono::milliseconds> initialRetransmitTimeout;
 	optional<unsigned int> maxRetransmitAttempts;
 	optional<std::chrono::milliseconds> heartbeatInterval;
+	optional<bool> messageInterleaving; // I-DATA (RFC 8260) if the peer supports it, default true
+	optional<std::chrono::milliseconds> shutdownTimeout; // graceful close before abort, default 1s
+	// Run usrsctp timers on a libdatachannel thread which hands the packets they trigger, like
+	// retransmissions and delayed SACKs, over to the worker of each association, instead of sending
+	// them all from the single usrsctp timer thread. Default false, takes effect on next
+	// initialization.
+	optional<bool> offloadTimerOutput;
 };
 
 RTC_CPP_EXPORT void SetSctpSettings(SctpSettings s);
 
+struct ThreadPoolSettings {
+	// For the following settings, not set means default
+	optional<unsigned int> workersCount;       // workers for message dispatch (default 4, min 2)
+	optional<unsigned int> cryptoWorkersCount; // dedicated workers for crypto-heavy tasks like
+	                                           // certificate generation (default 0, i.e. shared)
+	bool pinWorkers = false; // pin each worker thread to a CPU (Linux only)
+	bool external = false;   // spawn no workers, the application runs tasks with Poll()
+};
+
+// Settings take effect on next initialization
+RTC_CPP_EXPORT void SetThreadPoolSettings(ThreadPoolSettings s);
+
+struct ThreadPoolStats {
+	// Histogram buckets are powers of two in microseconds: bucket i counts durations in
+	// [2^(i-1), 2^i) us (bucket 0 is below 1us), the last bucket also counts longer durations
+	static const size_t HistogramSize = 20;
+	using Histogram = std::array<uint64_t, HistogramSize>;
+
+	unsigned int workers = 0;
+	unsigned int busyWorkers = 0;      // workers currently running a task
+	size_t queuedTasks = 0;            // ready tasks waiting for a worker
+	size_t pendingTimers = 0;          // delayed tasks not expired yet
+	size_t processorQueuedTasks = 0;   // tasks waiting in serial processors
+	uint64_t tasksRun = 0;             // since the pool was created
+	uint64_t lockContentions = 0;      // contended lock acquisitions in the pool
+	std::chrono::nanoseconds lockWaitTime{0}; // total time spent waiting for contended locks
+	Histogram queueLatency = {};       // time from enqueue to start, for ready tasks
+	Histogram runTime = {};            // task run time
+};
+
+RTC_CPP_EXPORT ThreadPoolStats GetThreadPoolStats();
+
+// Threads of the library are named after their role with a "rtc-" prefix, like "rtc-worker-0"
+struct ThreadRoleStats {
+	string role;                         // "worker", "crypto", "poll", "ice", "sctp-timer", etc
+	unsigned int threads = 0;            // running threads
+	std::chrono::nanoseconds cpuTime{0}; // consumed by all threads since startup (Linux only)
+};
+
+RTC_CPP_EXPORT std::vector<ThreadRoleStats> GetThreadStats(); // one entry per role
+
+// Overload protection, driven by the latency of tasks waiting in the thread pool queues
+// Past each threshold of the smoothed latency, work is shed in the order of the levels, and a level
+// is left when the latency falls below half of its threshold.
+enum class OverloadLevel {
+	Normal = 0,
+	DeferHandshakes = 1,   // DTLS handshakes of new connections are deferred
+	PauseVideoLayers = 2,  // forwardings with ForwardingRules::pauseOnOverload are paused
+	ReduceSctpBuffers = 3, // SCTP buffer targets are halved
+	RejectUpgrades = 4     // new WebSocket upgrades are rejected with 503 Service Unavailable
+};
+
+struct OverloadSettings {
+	bool enabled = false;
+	std::chrono::milliseconds sampleInterval{100};
+	// Thresholds on the smoothed queue latency to enter each level
+	std::chrono::milliseconds deferHandshakesThreshold{10};
+	std::chrono::milliseconds pauseVideoLayersThreshold{25};
+	std::chrono::milliseconds reduceSctpBuffersThreshold{50};
+	std::chrono::milliseconds rejectUpgradesThreshold{100};
+	std::chrono::milliseconds maxHandshakeDeferral{3000}; // the handshake starts anyway after it
+};
+
+// Settings take effect on next initialization
+RTC_CPP_EXPORT void SetOverloadSettings(OverloadSettings s);
+
+struct OverloadState {
+	OverloadLevel level = OverloadLevel::Normal;
+	std::chrono::microseconds queueLatency{0}; // smoothed
+	uint64_t levelChanges = 0;                 // since initialization
+};
+
+// For instance, a load balancer should drain the node while the level is not Normal
+RTC_CPP_EXPORT OverloadState GetOverloadState();
+
+// Event-loop integration for ThreadPoolSettings::external
+// Poll() runs ready tasks and expired timers, or waits up to timeout for some, and returns the
+// number of tasks run. The poll handle becomes readable when tasks are ready or the timeout
+// changes, it should be polled with a timeout given by GetPollTimeout(). Certificates are then
+// generated synchronously, and calls waiting for pending tasks, like destroying a PeerConnection,
+// run them on the calling thread.
+RTC_CPP_EXPORT int Poll(std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+RTC_CPP_EXPORT int GetPollHandle(); // file descriptor, -1 if unsupported on this platform
+RTC_CPP_EXPORT optional<std::chrono::milliseconds> GetPollTimeout(); // nullopt means infinite
+
 } // namespace rtc
 
 RTC_CPP_EXPORT std::ostream &operator<<(std::ostream &out, rtc::LogLevel level);
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_H264_RTP_DEPACKETIZER_H
+#define RTC_H264_RTP_DEPACKETIZER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "h264rtppacketizer.hpp"
+#include "mediahandlerrootelement.hpp"
+#include "rtpdepacketizer.hpp"
+
+namespace rtc {
+
+/// RTP depacketization of h264 payload
+/// Single NAL unit, STAP-A, and FU-A packets are reassembled into access units, which are output
+/// as messages. Access units missing packets are dropped.
+class RTC_CPP_EXPORT H264RtpDepacketizer final : public RtpDepacketizer,
+                                                 public MediaHandlerRootElement {
+public:
+	using Separator = H264RtpPacketizer::Separator;
+
+	/// Construct h264 depacketizer
+	/// @param separator NAL unit separator in output access units, StartSequence is equivalent to
+	/// LongStartSequence
+	H264RtpDepacketizer(Separator separator = Separator::LongStartSequence);
+
+	/// Check if an RTP packet starts or carries an IDR or SPS NAL unit
+	static bool IsKeyframe(const binary &packet);
+
+	/// Reassembles access units from RTP packets
+	/// @param messages RTP packets, in sequence order
+	/// @returns Complete access units
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	void appendNalUnit(const byte *header, const byte *data, size_t size);
+	void flush(std::vector<binary_ptr> &frames);
+	void reset();
+
+	const Separator separator;
+
+	binary frame;
+	optional<uint32_t> timestamp;
+	optional<uint16_t> lastSeqNumber;
+	optional<size_t> fragmentStart; // start of the NAL unit being reassembled from FU-A
+	bool broken = false;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_H264_RTP_DEPACKETIZER_H */
@@ -30,7 +30,14 @@ namespace rtc {
 /// RTP packetization of h264 payload
 class RTC_CPP_EXPORT H264RtpPacketizer final : public RtpPacketizer,
                                                public MediaHandlerRootElement {
-	shared_ptr<NalUnits> splitMessage(binary_ptr message);
+	// NAL units are views into the access unit, their data is only copied into RTP packets
+	using NalUnitRange = std::pair<const byte *, size_t>;
+
+	void packetizeAggregation(const std::vector<NalUnitRange> &nalus, bool setMark,
+	                          std::vector<binary_ptr> &packets);
+	void packetizeFragments(const byte *nalu, size_t size, bool setMark,
+	                        std::vector<binary_ptr> &packets);
+
 	const uint16_t maximumFragmentSize;
 
 public:
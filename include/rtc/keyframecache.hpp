@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_KEYFRAME_CACHE_H
+#define RTC_KEYFRAME_CACHE_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace rtc {
+
+/// Caches the RTP packets of the most recent keyframe of each received stream, typically on the
+/// track of a publisher in an SFU
+/// A new subscriber can be sent the cached keyframe before forwarding starts, so it can render
+/// immediately instead of waiting for the next keyframe.
+class RTC_CPP_EXPORT KeyframeCache final : public MediaHandlerElement {
+public:
+	using keyframe_detector = std::function<bool(const binary &packet)>;
+
+	/// @param isKeyframe Returns true if the RTP packet starts a keyframe, H264 if not set
+	KeyframeCache(keyframe_detector isKeyframe = {});
+
+	/// Returns the RTP packets of the most recent complete keyframe of a stream
+	/// Sequence numbers are rewritten so the last packet immediately precedes the next packet to
+	/// be received, the stream stays continuous when forwarding starts right after.
+	/// @param ssrc SSRC of the stream
+	/// @returns RTP packets in sequence order, empty if no keyframe is cached
+	std::vector<binary> keyframe(SSRC ssrc) const;
+
+	/// Removes all cached keyframes
+	void clear();
+
+	/// Caches keyframe packets
+	/// @param messages RTP packets from the publisher
+	/// @returns Unchanged RTP packets
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	struct Stream {
+		std::vector<binary> cached;    // complete keyframe
+		std::vector<binary> receiving; // keyframe being received
+		optional<uint32_t> timestamp;  // of the keyframe being received
+		optional<uint16_t> lastSeq;    // highest received sequence number
+	};
+
+	void record(Stream &stream, const binary &packet);
+	static bool IsComplete(std::vector<binary> &packets); // sorts packets in sequence order
+
+	const keyframe_detector isKeyframe;
+
+	std::unordered_map<SSRC, Stream> streams;
+	mutable std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_KEYFRAME_CACHE_H */
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_KEYFRAME_REQUEST_AGGREGATOR_H
+#define RTC_KEYFRAME_REQUEST_AGGREGATOR_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace rtc {
+
+/// Coalesces keyframe requests sent to a publisher, typically in an SFU
+/// The element is placed in the chain of the publisher track. A PLI or FIR for an SSRC is sent only
+/// if no request for this SSRC is pending, later requests wait for the same keyframe. A request is
+/// pending until the next keyframe is received or the window elapses.
+class RTC_CPP_EXPORT KeyframeRequestAggregator final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+	using keyframe_detector = std::function<bool(const binary &packet)>;
+
+	/// @param window Duration after which a request is sent again if no keyframe was received
+	/// @param isKeyframe Returns true if the RTP packet starts a keyframe, H264 if not set
+	KeyframeRequestAggregator(std::chrono::milliseconds window = std::chrono::milliseconds(1000),
+	                          keyframe_detector isKeyframe = {});
+
+	/// Registers a keyframe request for an SSRC, for instance before calling
+	/// Track::requestKeyframe() when the track doesn't use a media handler chain
+	/// @param ssrc SSRC of the publisher
+	/// @returns true if the request must be sent, false if it waits for a pending one
+	bool request(SSRC ssrc);
+
+	/// Sets the callback called when a keyframe answers pending requests
+	/// @param callback Called with the SSRC and the number of requests answered by the keyframe
+	void onKeyframe(std::function<void(SSRC ssrc, size_t requests)> callback);
+
+	/// Drops PLI and FIR for SSRCs with a pending request
+	/// @param message RTCP message
+	/// @returns RTCP message without the coalesced requests, empty if nothing is left to send
+	message_ptr processOutgoingControlMessage(message_ptr message) override;
+
+	/// Answers pending requests when a keyframe is received
+	/// @param messages RTP packets from the publisher
+	/// @returns Unchanged RTP packets
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	struct Pending {
+		clock::time_point sent;
+		size_t requests = 0;
+	};
+
+	bool add(SSRC ssrc, clock::time_point now);
+
+	const std::chrono::milliseconds window;
+	const keyframe_detector isKeyframe;
+
+	std::unordered_map<SSRC, Pending> pending;
+	synchronized_callback<SSRC, size_t> keyframeCallback;
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_KEYFRAME_REQUEST_AGGREGATOR_H */
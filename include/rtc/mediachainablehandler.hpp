@@ -21,21 +21,21 @@
 
 #if RTC_ENABLE_MEDIA
 
-#include "mediahandler.hpp"
 #include "mediahandlerrootelement.hpp"
+#include "mediapipeline.hpp"
 
 namespace rtc {
 
-class RTC_CPP_EXPORT MediaChainableHandler : public MediaHandler {
+class RTC_CPP_EXPORT MediaChainableHandler : public MediaPipelineBase {
 	const shared_ptr<MediaHandlerRootElement> root;
 	shared_ptr<MediaHandlerElement> leaf;
 	mutable std::mutex mutex;
+	const std::function<bool(ChainedOutgoingProduct)> sendProductCallback;
 
 	message_ptr handleIncomingBinary(message_ptr);
 	message_ptr handleIncomingControl(message_ptr);
-	message_ptr handleOutgoingBinary(message_ptr);
+	message_ptr handleOutgoingBinary(message_ptr, std::vector<message_ptr> *collected = nullptr);
 	message_ptr handleOutgoingControl(message_ptr);
-	bool sendProduct(ChainedOutgoingProduct product);
 	shared_ptr<MediaHandlerElement> getLeaf() const;
 
 public:
@@ -43,8 +43,9 @@ public:
 	~MediaChainableHandler();
 	message_ptr incoming(message_ptr ptr) override;
 	message_ptr outgoing(message_ptr ptr) override;
-
-	bool send(message_ptr msg);
+	void outgoingBatch(message_ptr ptr, std::vector<message_ptr> &batch) override;
+	void sent(const message_ptr &message) override;
+	size_t memoryUsage() const override;
 
 	/// Adds element to chain
 	/// @param chainable Chainable element
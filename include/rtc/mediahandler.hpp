@@ -23,6 +23,8 @@
 #include "common.hpp"
 #include "message.hpp"
 
+#include <vector>
+
 namespace rtc {
 
 class RTC_CPP_EXPORT MediaHandler {
@@ -30,6 +32,12 @@ protected:
 	// Use this callback when trying to send custom data (such as RTCP) to the client.
 	synchronized_callback<message_ptr> outgoingCallback;
 
+	// Use this callback when a single incoming message results in more than one message.
+	synchronized_callback<message_ptr> incomingCallback;
+
+	// Use this callback when a new target bitrate for sending is estimated.
+	synchronized_callback<unsigned int> targetBitrateCallback;
+
 public:
 	// Called when there is traffic coming from the peer
 	virtual message_ptr incoming(message_ptr ptr) = 0;
@@ -37,12 +45,35 @@ public:
 	// Called when there is traffic that needs to be sent to the peer
 	virtual message_ptr outgoing(message_ptr ptr) = 0;
 
+	// Same as outgoing() but all resulting messages, like the packets of a frame, are appended to
+	// the batch so they can be sent at once
+	virtual void outgoingBatch(message_ptr ptr, std::vector<message_ptr> &batch) {
+		if (auto message = outgoing(std::move(ptr)))
+			batch.push_back(std::move(message));
+	}
+
 	// This callback is used to send traffic back to the peer.
 	void onOutgoing(const std::function<void(message_ptr)> &cb) {
 		this->outgoingCallback = synchronized_callback<message_ptr>(cb);
 	}
 
+	// This callback is used to deliver additional incoming traffic to the track.
+	void onIncoming(const std::function<void(message_ptr)> &cb) {
+		this->incomingCallback = synchronized_callback<message_ptr>(cb);
+	}
+
+	// This callback is used to report the target bitrate to the track.
+	void onTargetBitrate(const std::function<void(unsigned int)> &cb) {
+		this->targetBitrateCallback = synchronized_callback<unsigned int>(cb);
+	}
+
+	// Called when an outgoing binary message is handed to the transport, after pacing if enabled
+	virtual void sent([[maybe_unused]] const message_ptr &message) {}
+
 	virtual bool requestKeyframe() { return false; }
+
+	// Bytes held by the handler, like packets stored for retransmission
+	virtual size_t memoryUsage() const { return 0; }
 };
 
 } // namespace rtc
@@ -29,9 +29,14 @@ namespace rtc {
 
 using ChainedMessagesProduct = shared_ptr<std::vector<binary_ptr>>;
 
+/// Creates an empty batch of messages, reusing a recycled one of the current thread if possible
 RTC_CPP_EXPORT ChainedMessagesProduct make_chained_messages_product();
 RTC_CPP_EXPORT ChainedMessagesProduct make_chained_messages_product(message_ptr msg);
 
+/// Gives a batch no longer in use back for reuse by make_chained_messages_product()
+/// The batch is only kept if the caller holds the last reference to it
+RTC_CPP_EXPORT void recycle_chained_messages_product(ChainedMessagesProduct messages);
+
 /// Ougoing messages
 struct RTC_CPP_EXPORT ChainedOutgoingProduct {
 	ChainedOutgoingProduct(ChainedMessagesProduct messages = nullptr,
@@ -44,6 +49,7 @@ struct RTC_CPP_EXPORT ChainedOutgoingProduct {
 struct RTC_CPP_EXPORT ChainedIncomingProduct {
 	ChainedIncomingProduct(ChainedMessagesProduct incoming = nullptr,
 	                       ChainedMessagesProduct outgoing = nullptr);
+	ChainedIncomingProduct(ChainedMessagesProduct incoming, ChainedOutgoingProduct outgoing);
 	const ChainedMessagesProduct incoming;
 	const ChainedOutgoingProduct outgoing;
 };
@@ -62,27 +68,36 @@ class RTC_CPP_EXPORT MediaHandlerElement
 	shared_ptr<MediaHandlerElement> upstream = nullptr;
 	shared_ptr<MediaHandlerElement> downstream = nullptr;
 
-	void prepareAndSendResponse(optional<ChainedOutgoingProduct> outgoing,
-	                            std::function<bool(ChainedOutgoingProduct)> send);
+	void prepareAndSendResponse(const optional<ChainedOutgoingProduct> &outgoing,
+	                            const std::function<bool(ChainedOutgoingProduct)> &send);
 
 	void removeFromChain();
 
+	synchronized_callback<unsigned int> targetBitrateCallback;
+
+protected:
+	/// Reports a new target bitrate for sending, for elements estimating the bandwidth
+	/// @param bitrate Target bitrate in bits per second
+	void reportTargetBitrate(unsigned int bitrate);
+
 public:
 	MediaHandlerElement();
 
 	/// Creates response to incoming message
 	/// @param messages Current repsonse
 	/// @returns New response
-	optional<ChainedOutgoingProduct> processOutgoingResponse(ChainedOutgoingProduct messages);
+	optional<ChainedOutgoingProduct>
+	processOutgoingResponse(const ChainedOutgoingProduct &messages);
 
 	// Process incoming and ougoing messages
 	message_ptr formIncomingControlMessage(message_ptr message,
-	                                       std::function<bool(ChainedOutgoingProduct)> send);
+	                                       const std::function<bool(ChainedOutgoingProduct)> &send);
 	ChainedMessagesProduct
 	formIncomingBinaryMessage(ChainedMessagesProduct messages,
-	                          std::function<bool(ChainedOutgoingProduct)> send);
+	                          const std::function<bool(ChainedOutgoingProduct)> &send);
 	message_ptr formOutgoingControlMessage(message_ptr message);
-	optional<ChainedOutgoingProduct> formOutgoingBinaryMessage(ChainedOutgoingProduct product);
+	optional<ChainedOutgoingProduct>
+	formOutgoingBinaryMessage(const ChainedOutgoingProduct &product);
 
 	/// Process current control message
 	/// @param messages current message
@@ -91,21 +106,28 @@ public:
 
 	/// Process current control message
 	/// @param messages current message
-	/// @returns Modified message
+	/// @returns Modified message, an empty message drops it
 	virtual message_ptr processOutgoingControlMessage(message_ptr messages);
 
 	/// Process current binary message
+	/// Messages may be modified in place, returning the same batch avoids any allocation
 	/// @param messages current message
 	/// @returns Modified message and response
 	virtual ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages);
 
 	/// Process current binary message
+	/// Messages may be modified in place, returning the same batch avoids any allocation
 	/// @param messages current message
 	/// @param control current control message
-	/// @returns Modified binary message and control message
+	/// @returns Modified binary message and control message, an empty batch drops the message
 	virtual ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
 	                                                            message_ptr control);
 
+	/// Called when an outgoing binary message is handed to the transport, after pacing if enabled
+	/// The message must not be modified.
+	/// @param message current message
+	virtual void processSentBinaryMessage([[maybe_unused]] const message_ptr &message) {}
+
 	/// Set given element as upstream to this
 	/// @param upstream Upstream element
 	/// @returns Upstream element
@@ -113,6 +135,20 @@ public:
 
 	/// Remove all downstream elements from chain
 	void recursiveRemoveChain();
+
+	/// Bytes held by the element, like packets stored for retransmission
+	virtual size_t memoryUsage() const { return 0; }
+
+	/// Bytes held by this element and all downstream elements
+	size_t chainMemoryUsage() const;
+
+	/// Notifies this element and all downstream elements that a message was sent
+	void chainSentBinaryMessage(const message_ptr &message);
+
+	/// Sets the callback called when a new target bitrate is estimated
+	/// Once the element is chained, the target bitrate is reported to Track::onTargetBitrate()
+	/// @param callback Callback taking the bitrate in bits per second
+	void onTargetBitrate(std::function<void(unsigned int bitrate)> callback);
 };
 
 } // namespace rtc
@@ -0,0 +1,316 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_MEDIA_PIPELINE_H
+#define RTC_MEDIA_PIPELINE_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandler.hpp"
+#include "mediahandlerrootelement.hpp"
+
+#include <tuple>
+#include <type_traits>
+
+namespace rtc {
+
+/// Base for media handlers passing messages through media handler elements
+class RTC_CPP_EXPORT MediaPipelineBase : public MediaHandler {
+public:
+	bool send(message_ptr msg);
+
+protected:
+	void deliver(message_ptr msg);
+	bool sendProduct(const ChainedOutgoingProduct &product);
+
+	/// Sends the outgoing product of the elements
+	/// @param outgoing Product, or nullopt if generating it failed
+	/// @param batch Batch which was passed to the first element
+	/// @param collected If set, all messages are appended to it instead of being sent
+	/// @returns Last message, which is left to the caller to send, nullptr if collected is set
+	message_ptr sendOutgoingProduct(optional<ChainedOutgoingProduct> &&outgoing,
+	                                ChainedMessagesProduct batch,
+	                                std::vector<message_ptr> *collected = nullptr);
+
+	/// Delivers the incoming product of the elements
+	/// @param root Root element reducing the messages
+	/// @param incoming Product, may be nullptr
+	/// @returns Last message, which is left to the caller to deliver
+	message_ptr deliverIncomingProduct(MediaHandlerRootElement &root,
+	                                   ChainedMessagesProduct incoming);
+
+	static void logError(const char *message);
+};
+
+/// Media handler composing elements at compile time
+/// Elements are listed in the same order as they would be added to a MediaChainableHandler: the
+/// root element first, outgoing messages go from left to right, incoming messages from right to
+/// left. Processing functions are called statically so the compiler may inline them.
+/// Example: MediaPipeline<H264RtpPacketizer, RtcpSrReporter, RtcpNackResponder>
+template <class Root, class... Elements> class MediaPipeline final : public MediaPipelineBase {
+	static_assert(std::is_base_of_v<MediaHandlerRootElement, Root>,
+	              "The first element of a pipeline must be a root element");
+	static_assert((std::is_base_of_v<MediaHandlerElement, Elements> && ...),
+	              "Pipeline elements must be media handler elements");
+
+	using elements_tuple = std::tuple<shared_ptr<Root>, shared_ptr<Elements>...>;
+	template <size_t I>
+	using element_t = typename std::tuple_element_t<I, elements_tuple>::element_type;
+	static constexpr size_t Size = 1 + sizeof...(Elements);
+
+public:
+	MediaPipeline(shared_ptr<Root> root, shared_ptr<Elements>... elements);
+	~MediaPipeline();
+
+	message_ptr incoming(message_ptr ptr) override;
+	message_ptr outgoing(message_ptr ptr) override;
+	void outgoingBatch(message_ptr ptr, std::vector<message_ptr> &batch) override;
+	void sent(const message_ptr &message) override;
+	size_t memoryUsage() const override;
+
+	/// Returns the element at the given position, 0 being the root element
+	template <size_t I> shared_ptr<element_t<I>> element() const { return std::get<I>(mElements); }
+
+private:
+	template <size_t I>
+	optional<ChainedOutgoingProduct> formOutgoingBinary(ChainedMessagesProduct messages,
+	                                                    message_ptr control);
+	template <size_t I> message_ptr formOutgoingControl(message_ptr message);
+	template <size_t I> ChainedMessagesProduct formIncomingBinary(ChainedMessagesProduct messages);
+	template <size_t I> message_ptr formIncomingControl(message_ptr message);
+	template <size_t I> void sendResponse(const optional<ChainedOutgoingProduct> &outgoing);
+
+	template <size_t... Is> void bindTargetBitrate(std::index_sequence<Is...>);
+	template <size_t... Is> void unbindTargetBitrate(std::index_sequence<Is...>);
+
+	const elements_tuple mElements;
+};
+
+template <class Root, class... Elements>
+MediaPipeline<Root, Elements...>::MediaPipeline(shared_ptr<Root> root,
+                                                shared_ptr<Elements>... elements)
+    : mElements(std::move(root), std::move(elements)...) {
+	bindTargetBitrate(std::make_index_sequence<Size>());
+}
+
+template <class Root, class... Elements> MediaPipeline<Root, Elements...>::~MediaPipeline() {
+	unbindTargetBitrate(std::make_index_sequence<Size>());
+}
+
+template <class Root, class... Elements>
+void MediaPipeline<Root, Elements...>::sent(const message_ptr &message) {
+	std::apply(
+	    [&message](const auto &...elements) {
+		    (elements->processSentBinaryMessage(message), ...);
+	    },
+	    mElements);
+}
+
+template <class Root, class... Elements>
+size_t MediaPipeline<Root, Elements...>::memoryUsage() const {
+	return std::apply([](const auto &...elements) { return (elements->memoryUsage() + ...); },
+	                  mElements);
+}
+
+template <class Root, class... Elements>
+message_ptr MediaPipeline<Root, Elements...>::outgoing(message_ptr ptr) {
+	if (!ptr) {
+		logError("Outgoing message is nullptr, ignoring");
+		return nullptr;
+	}
+	if (ptr->type == Message::Binary) {
+		auto batch = make_chained_messages_product(std::move(ptr));
+		auto outgoing = formOutgoingBinary<0>(batch, nullptr);
+		return sendOutgoingProduct(std::move(outgoing), std::move(batch));
+	} else if (ptr->type == Message::Control) {
+		auto outgoing = formOutgoingControl<0>(std::move(ptr));
+		if (!outgoing) {
+			logError("Generating outgoing control message failed");
+			return nullptr;
+		}
+		if (outgoing->empty())
+			return nullptr; // dropped by an element
+
+		return outgoing;
+	}
+	return ptr;
+}
+
+template <class Root, class... Elements>
+void MediaPipeline<Root, Elements...>::outgoingBatch(message_ptr ptr,
+                                                     std::vector<message_ptr> &batch) {
+	if (ptr && ptr->type == Message::Binary) {
+		auto messages = make_chained_messages_product(std::move(ptr));
+		auto outgoing = formOutgoingBinary<0>(messages, nullptr);
+		sendOutgoingProduct(std::move(outgoing), std::move(messages), &batch);
+	} else if (auto message = outgoing(std::move(ptr))) {
+		batch.push_back(std::move(message));
+	}
+}
+
+template <class Root, class... Elements>
+message_ptr MediaPipeline<Root, Elements...>::incoming(message_ptr ptr) {
+	if (!ptr) {
+		logError("Incoming message is nullptr, ignoring");
+		return nullptr;
+	}
+	if (ptr->type == Message::Binary) {
+		auto &root = *std::get<0>(mElements);
+		auto incoming = formIncomingBinary<Size - 1>(root.Root::split(std::move(ptr)));
+		return deliverIncomingProduct(root, std::move(incoming));
+	} else if (ptr->type == Message::Control) {
+		return formIncomingControl<Size - 1>(std::move(ptr));
+	}
+	return ptr;
+}
+
+template <class Root, class... Elements>
+template <size_t I>
+optional<ChainedOutgoingProduct>
+MediaPipeline<Root, Elements...>::formOutgoingBinary(ChainedMessagesProduct messages,
+                                                     message_ptr control) {
+	using E = element_t<I>;
+	auto product = std::get<I>(mElements)->E::processOutgoingBinaryMessage(messages, control);
+	if (control && !product.control) {
+		logError("Outgoing message must not remove control message");
+		return nullopt;
+	}
+	if (!product.messages) {
+		logError("Failed to generate message");
+		return nullopt;
+	}
+	if constexpr (I + 1 < Size) {
+		if (product.messages->empty())
+			return product; // the element dropped all messages
+
+		return formOutgoingBinary<I + 1>(product.messages, product.control);
+	} else {
+		return product;
+	}
+}
+
+template <class Root, class... Elements>
+template <size_t I>
+message_ptr MediaPipeline<Root, Elements...>::formOutgoingControl(message_ptr message) {
+	using E = element_t<I>;
+	auto newMessage = std::get<I>(mElements)->E::processOutgoingControlMessage(std::move(message));
+	if (!newMessage) {
+		logError("Failed to generate outgoing message");
+		return nullptr;
+	}
+	if constexpr (I + 1 < Size) {
+		if (newMessage->empty())
+			return newMessage; // the element dropped the message
+
+		return formOutgoingControl<I + 1>(std::move(newMessage));
+	} else {
+		return newMessage;
+	}
+}
+
+template <class Root, class... Elements>
+template <size_t I>
+ChainedMessagesProduct
+MediaPipeline<Root, Elements...>::formIncomingBinary(ChainedMessagesProduct messages) {
+	using E = element_t<I>;
+	ChainedMessagesProduct incoming;
+	{
+		auto product = std::get<I>(mElements)->E::processIncomingBinaryMessage(messages);
+		sendResponse<I>(product.outgoing);
+		incoming = product.incoming;
+	}
+	if (incoming != messages)
+		recycle_chained_messages_product(std::move(messages)); // replaced by the element
+
+	if constexpr (I > 0) {
+		if (!incoming || incoming->empty())
+			return incoming;
+
+		return formIncomingBinary<I - 1>(std::move(incoming));
+	} else {
+		return incoming;
+	}
+}
+
+template <class Root, class... Elements>
+template <size_t I>
+message_ptr MediaPipeline<Root, Elements...>::formIncomingControl(message_ptr message) {
+	using E = element_t<I>;
+	auto product = std::get<I>(mElements)->E::processIncomingControlMessage(std::move(message));
+	sendResponse<I>(product.outgoing);
+	if constexpr (I > 0) {
+		if (!product.incoming)
+			return nullptr;
+
+		return formIncomingControl<I - 1>(product.incoming);
+	} else {
+		return product.incoming;
+	}
+}
+
+template <class Root, class... Elements>
+template <size_t I>
+void MediaPipeline<Root, Elements...>::sendResponse(
+    const optional<ChainedOutgoingProduct> &outgoing) {
+	if (!outgoing)
+		return;
+
+	// Responses go through the elements closer to the transport
+	if constexpr (I + 1 < Size) {
+		if (outgoing->messages) {
+			auto response = formOutgoingBinary<I + 1>(outgoing->messages, outgoing->control);
+			if (!response) {
+				logError("Generating outgoing message failed");
+				return;
+			}
+			sendProduct(*response);
+
+		} else if (outgoing->control) {
+			auto control = formOutgoingControl<I + 1>(outgoing->control);
+			if (!control) {
+				logError("Generating outgoing control message failed");
+				return;
+			}
+			if (control->empty())
+				return; // dropped by an element
+
+			sendProduct(ChainedOutgoingProduct(nullptr, std::move(control)));
+		}
+	} else {
+		sendProduct(*outgoing);
+	}
+}
+
+template <class Root, class... Elements>
+template <size_t... Is>
+void MediaPipeline<Root, Elements...>::bindTargetBitrate(std::index_sequence<Is...>) {
+	auto callback = [this](unsigned int bitrate) { targetBitrateCallback(bitrate); };
+	(std::get<Is>(mElements)->onTargetBitrate(callback), ...);
+}
+
+template <class Root, class... Elements>
+template <size_t... Is>
+void MediaPipeline<Root, Elements...>::unbindTargetBitrate(std::index_sequence<Is...>) {
+	(std::get<Is>(mElements)->onTargetBitrate(nullptr), ...);
+}
+
+} // namespace rtc
+
+#endif // RTC_ENABLE_MEDIA
+
+#endif // RTC_MEDIA_PIPELINE_H
@@ -20,8 +20,8 @@
 #define RTC_MESSAGE_H
 
 #include "common.hpp"
-#include "reliability.hpp"
 
+#include <chrono>
 #include <functional>
 
 namespace rtc {
@@ -38,39 +38,81 @@ struct RTC_CPP_EXPORT Message : binary {
 
 	Message(binary &&data, Type type_ = Binary) : binary(std::move(data)), type(type_) {}
 
+	// External payload, referenced instead of the message contents to avoid copies
+	struct View {
+		const byte *data;
+		size_t size;
+		shared_ptr<const void> owner; // keeps the buffer alive as long as the message
+	};
+
+	Message(View view_, Type type_ = Binary) : type(type_), view(std::move(view_)) {}
+
+	// Payload, either the external view or the message contents
+	const byte *payload() const { return view ? view->data : data(); }
+	size_t payloadSize() const { return view ? view->size : size(); }
+
+	// Size of a media packet, including the tail
+	size_t packetSize() const { return size() + (tail ? tail->size : 0); }
+
 	Type type;
 	unsigned int stream = 0; // Stream id (SCTP stream or SSRC)
 	unsigned int dscp = 0;   // Differentiated Services Code Point
-	shared_ptr<Reliability> reliability;
+	unsigned int ecn = 0;    // Explicit Congestion Notification codepoint, 0 is Not-ECT
+	optional<View> view;
+	// Shared part of a media packet following the contents, so a packet relayed to several
+	// tracks only has its header copied for each one, it is appended right before protection
+	optional<View> tail;
+	bool incomplete = false; // fragment of a streamed message, more fragments follow
+	// Reception time of an incoming packet, taken as soon as the ICE transport gets it so that
+	// delay measurements do not include the handoffs to DTLS, SRTP, and the processor
+	optional<std::chrono::steady_clock::time_point> arrivalTime;
+#if RTC_ENABLE_LATENCY_TRACING
+	optional<std::chrono::steady_clock::time_point> traceTime; // set if sampled for tracing
+#endif
 };
 
 using message_ptr = shared_ptr<Message>;
 using message_callback = std::function<void(message_ptr message)>;
 
 inline size_t message_size_func(const message_ptr &m) {
-	return m->type == Message::Binary || m->type == Message::String ? m->size() : 0;
+	return m->type == Message::Binary || m->type == Message::String ? m->payloadSize() : 0;
 }
 
+// Messages are allocated from a per-thread pool and recycled when released
+RTC_CPP_EXPORT message_ptr make_message(size_t size, Message::Type type = Message::Binary,
+                                        unsigned int stream = 0);
+
 template <typename Iterator>
 message_ptr make_message(Iterator begin, Iterator end, Message::Type type = Message::Binary,
-                         unsigned int stream = 0, shared_ptr<Reliability> reliability = nullptr) {
-	auto message = std::make_shared<Message>(begin, end, type);
-	message->stream = stream;
-	message->reliability = reliability;
+                         unsigned int stream = 0) {
+	auto message = make_message(size_t(0), type, stream);
+	message->assign(begin, end); // reuses the recycled storage
 	return message;
 }
 
-RTC_CPP_EXPORT message_ptr make_message(size_t size, Message::Type type = Message::Binary,
-                                        unsigned int stream = 0,
-                                        shared_ptr<Reliability> reliability = nullptr);
-
 RTC_CPP_EXPORT message_ptr make_message(binary &&data, Message::Type type = Message::Binary,
-                                        unsigned int stream = 0,
-                                        shared_ptr<Reliability> reliability = nullptr);
+                                        unsigned int stream = 0);
 
 RTC_CPP_EXPORT message_ptr make_message(message_variant data);
 
-RTC_CPP_EXPORT message_variant to_variant(Message &&message);
+// Message from data without copy, the storage of binary data is taken over while large strings
+// are referenced as an external view, so the payload must be read with payload()
+RTC_CPP_EXPORT message_ptr make_payload_message(message_variant data);
+
+// Message referencing an external buffer, which must stay valid as long as the owner is alive
+RTC_CPP_EXPORT message_ptr make_message(const byte *data, size_t size, shared_ptr<const void> owner,
+                                        Message::Type type = Message::Binary);
+
+RTC_CPP_EXPORT message_variant to_variant(Message &&message); // the contents are moved out
+RTC_CPP_EXPORT message_variant to_variant(const Message &message); // copy, for a queued message
+
+// Spare capacity reserved after media packets, so the SRTP trailer can be appended in place
+const size_t MediaTailroom = 144; // SRTP_MAX_TRAILER_LEN
+
+// Media message from a packet, which is moved if not referenced elsewhere and copied otherwise
+RTC_CPP_EXPORT message_ptr make_media_message(binary_ptr &&packet);
+// Media message copied from a packet
+RTC_CPP_EXPORT message_ptr make_media_message(const binary_ptr &packet);
 
 } // namespace rtc
 
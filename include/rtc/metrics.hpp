@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_METRICS_H
+#define RTC_METRICS_H
+
+#include "common.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+namespace rtc {
+
+using MetricLabels = std::vector<std::pair<string, string>>;
+
+// Receives metrics from CollectMetrics(), it is designed to map directly onto OpenTelemetry
+// asynchronous instruments: counters are cumulative totals, gauges are instantaneous values, and
+// histograms are cumulative with explicit bucket boundaries. Durations are in seconds.
+class RTC_CPP_EXPORT MetricsSink {
+public:
+	using clock = std::chrono::steady_clock;
+
+	virtual ~MetricsSink() = default;
+
+	virtual void counter(const string &name, const MetricLabels &labels, uint64_t value) = 0;
+	virtual void gauge(const string &name, const MetricLabels &labels, double value) = 0;
+
+	// counts has one more element than bounds, the last bucket counts values above the last bound
+	virtual void histogram(const string &name, const MetricLabels &labels,
+	                       const std::vector<double> &bounds, const std::vector<uint64_t> &counts);
+
+	// Completed spans of connection setup steps, called once per step from a library thread
+	virtual void span(const string &name, const MetricLabels &labels, clock::time_point start,
+	                  clock::time_point end, bool success);
+};
+
+// Install or remove (with nullptr) the process-wide sink
+RTC_CPP_EXPORT void SetMetricsSink(shared_ptr<MetricsSink> sink);
+
+// Report the current values of all live objects to the sink, typically from the export callback
+// of the observability SDK. Values are read from the counters the library maintains anyway, so
+// nothing is recorded when no sink is installed.
+RTC_CPP_EXPORT void CollectMetrics();
+
+} // namespace rtc
+
+#endif
@@ -37,20 +37,34 @@ public:
 	/// @note RTP configuration is used in packetization process which may change some configuration
 	/// properties such as sequence number.
 	/// @param rtpConfig  RTP configuration
-	OpusRtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig);
+	/// @param suppressDtx Do not send DTX frames, so silence costs no bandwidth
+	OpusRtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig, bool suppressDtx = false);
 
 	/// Creates RTP packet for given payload based on `rtpConfig`.
 	/// @note This function increase sequence number after packetization.
 	/// @param payload RTP payload
-	/// @param setMark This needs to be `false` for all RTP packets with opus payload
+	/// @param setMark Set for the first packet of a talkspurt, after silence
 	binary_ptr packetize(binary_ptr payload, bool setMark) override;
 
-	/// Creates RTP packet for given samples (all samples share same RTP timesamp)
-	/// @param messages opus samples
+	/// Creates RTP packets for given frames, the first one has the current RTP timestamp and the
+	/// following ones are timestamped after the duration of the previous frames
+	/// @param messages opus frames
 	/// @param control RTCP
 	/// @returns RTP packets and unchanged `control`
 	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
 	                                                    message_ptr control) override;
+
+	/// Returns true if the frame is a DTX (discontinuous transmission) frame
+	static bool IsDtxFrame(const binary &frame);
+
+	/// Returns the duration of the frame in samples at 48kHz, parsed from its TOC byte, or 0 if
+	/// the frame is invalid
+	static uint32_t GetFrameSamples(const binary &frame);
+
+private:
+	const bool suppressDtx;
+	bool silent = false;        // the previous frame was a DTX frame
+	binary audioLevelExtension; // avoids an allocation per packet
 };
 
 } // namespace rtc
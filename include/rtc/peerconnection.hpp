@@ -27,6 +27,7 @@
 #include "reliability.hpp"
 #include "track.hpp"
 
+#include <array>
 #include <chrono>
 #include <functional>
 
@@ -38,11 +39,116 @@ struct PeerConnection;
 
 }
 
+struct SctpStats {
+	// Association, from usrsctp
+	size_t congestionWindow = 0;    // in bytes, on the primary path
+	size_t peerReceiveWindow = 0;   // in bytes
+	unsigned int unackedChunks = 0; // chunks in flight
+	unsigned int pendingChunks = 0; // chunks waiting to be sent
+	size_t mtu = 0;
+	std::chrono::milliseconds rtt{0}; // smoothed
+	std::chrono::milliseconds rto{0}; // retransmission timeout
+	uint64_t abandonedUnsent = 0;     // partially reliable messages abandoned before being sent
+	uint64_t abandonedSent = 0;       // partially reliable messages abandoned after being sent
+
+	// Local send queue
+	size_t queuedMessages = 0;
+	size_t bufferedAmount = 0;
+	uint64_t abandonedQueued = 0; // timed messages expired before being handed to usrsctp
+
+	// usrsctp does not count retransmissions per association, this is process-wide
+	uint64_t retransmissions = 0;
+};
+
+// Traffic on the selected ICE candidate pair, including DTLS and SRTP overhead
+struct IceStats {
+	size_t bytesSent = 0;
+	size_t bytesReceived = 0;
+	size_t packetsSent = 0;
+	size_t packetsReceived = 0;
+	size_t sendRate = 0;          // in bytes/s, averaged over the last seconds
+	size_t receiveRate = 0;       // same
+	size_t sendPacketRate = 0;    // in packets/s, same
+	size_t receivePacketRate = 0; // same
+
+	// Neither libjuice nor libnice report connectivity check round trips, so this is the SCTP
+	// smoothed RTT when available, or else the last DTLS handshake round trip
+	optional<std::chrono::milliseconds> rtt;
+};
+
+// HDR histogram of latencies in nanoseconds: values below 2^SubBucketBits have their own bucket,
+// then each power of two is split in 2^SubBucketBits linear sub-buckets, so precision is 12.5%
+// The last bucket also counts longer latencies.
+struct RTC_CPP_EXPORT LatencyHistogram {
+	static const int SubBucketBits = 3;
+	static const int MaxMagnitude = 36; // 2^36 ns, around 68s
+	static const size_t BucketCount = size_t(MaxMagnitude - SubBucketBits + 1) << SubBucketBits;
+
+	std::array<uint64_t, BucketCount> counts = {};
+	uint64_t count = 0; // total samples
+
+	static size_t BucketIndex(uint64_t ns);
+	static uint64_t BucketUpperBound(size_t index); // exclusive, in nanoseconds
+
+	std::chrono::nanoseconds percentile(double p) const; // bucket upper bound, 0 if empty
+};
+
+// Sampled per-message latencies at transport layer boundaries, only available if the library is
+// built with RTC_ENABLE_LATENCY_TRACING, see Configuration::latencySampleInterval
+struct LatencyStats {
+	// Sending
+	LatencyHistogram sctpQueue;   // from DataChannel send to SCTP, including send buffering
+	LatencyHistogram dtlsEncrypt; // DTLS record encryption
+	LatencyHistogram iceSend;     // datagram send on the selected candidate pair
+
+	// Receiving
+	LatencyHistogram dtlsDecrypt; // DTLS record decryption
+	LatencyHistogram sctpInput;   // SCTP packet processing
+	LatencyHistogram delivery;    // from SCTP reassembly until read from the DataChannel
+};
+
+// Timestamps of connection setup steps, unset if the step did not happen (yet)
+struct SetupTimeline {
+	using clock = std::chrono::steady_clock;
+
+	struct Flight {
+		clock::time_point time; // first datagram, retransmissions are not recorded
+		bool outgoing;          // sent by the local peer
+	};
+
+	clock::time_point created;
+	optional<clock::time_point> iceConnected;
+	std::vector<Flight> dtlsFlights;
+	optional<clock::time_point> dtlsConnected;   // handshake finished
+	optional<clock::time_point> srtpKeysDerived; // with media only
+	optional<clock::time_point> sctpConnected;   // with data channels only
+	optional<clock::time_point> dataChannelOpen; // first one
+};
+
+// Bytes currently held by a connection, for accounting and Configuration::memoryLimit
+struct MemoryStats {
+	size_t receiveQueues = 0; // received messages not read yet on data channels and tracks
+	size_t sendQueue = 0;     // messages waiting in the SCTP send queue
+	size_t reassembly = 0;    // allocated for partial SCTP messages being reassembled
+	size_t nackStorage = 0;   // packets kept by media handlers for retransmission, not limited
+
+	size_t total() const { return receiveQueues + sendQueue + reassembly + nackStorage; }
+};
+
 struct RTC_CPP_EXPORT DataChannelInit {
 	Reliability reliability = {};
 	bool negotiated = false;
 	optional<uint16_t> id = nullopt;
 	string protocol = "";
+	uint16_t priority = RTC_PRIORITY_LOW; // streams with higher priority are sent first
+
+	// Message compression with deflate and a context kept across messages sent reliably in order,
+	// skipped when it does not pay off. It is announced to the remote peer in the protocol, so the
+	// remote peer must be libdatachannel, and negotiated channels must enable it on both sides.
+	// Streamed sending and fragmented receiving are not available on compressed channels. The
+	// channel is closed with an error if a received message can't be decompressed.
+	bool compression = false;
+	string compressionDictionary = ""; // name in Configuration::compressionDictionaries, if any
 };
 
 class RTC_CPP_EXPORT PeerConnection final : CheshireCat<impl::PeerConnection> {
@@ -76,6 +182,12 @@ public:
 
 	void close();
 
+	// Close many connections without blocking, for instance to tear down a room: they are closed
+	// on the thread pool, at most concurrency at a time, and the callback is called on the thread
+	// pool once all their transports are stopped and released.
+	static void CloseAll(std::vector<shared_ptr<PeerConnection>> peerConnections,
+	                     std::function<void()> callback = nullptr, unsigned int concurrency = 64);
+
 	const Configuration *config() const;
 	State state() const;
 	GatheringState gatheringState() const;
@@ -88,6 +200,7 @@ public:
 	bool getSelectedCandidatePair(Candidate *local, Candidate *remote);
 
 	void setLocalDescription(Description::Type type = Description::Type::Unspec);
+	void restartIce(); // keeps the DTLS session and the SCTP association
 	void setRemoteDescription(Description description);
 	void addRemoteCandidate(Candidate candidate);
 
@@ -97,6 +210,11 @@ public:
 	[[nodiscard]] shared_ptr<Track> addTrack(Description::Media description);
 	void onTrack(std::function<void(std::shared_ptr<Track> track)> callback);
 
+	// Unordered and unreliable datagrams, requires Configuration::enableDatagrams on both peers
+	bool sendDatagram(binary data); // false if not negotiated, not connected, or dropped
+	void onDatagram(std::function<void(binary data)> callback);
+	size_t maxDatagramSize() const;
+
 	void onLocalDescription(std::function<void(Description description)> callback);
 	void onLocalCandidate(std::function<void(Candidate candidate)> callback);
 	void onStateChange(std::function<void(State state)> callback);
@@ -108,6 +226,17 @@ public:
 	size_t bytesSent();
 	size_t bytesReceived();
 	optional<std::chrono::milliseconds> rtt();
+	size_t sendThroughput();    // in bytes/s, averaged over the last seconds
+	size_t receiveThroughput(); // same
+	optional<SctpStats> sctpStats();       // not available if not connected
+	optional<IceStats> iceStats();         // same
+	optional<LatencyStats> latencyStats(); // not available without latency tracing
+	SetupTimeline setupTimeline();
+	MemoryStats memoryStats();
+
+private:
+	friend class PeerConnectionFactory;
+	PeerConnection(impl_ptr<impl::PeerConnection> impl);
 };
 
 } // namespace rtc
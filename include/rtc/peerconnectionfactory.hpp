@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_PEER_CONNECTION_FACTORY_H
+#define RTC_PEER_CONNECTION_FACTORY_H
+
+#include "configuration.hpp"
+#include "peerconnection.hpp"
+
+namespace rtc {
+
+/// Creates many PeerConnections sharing the same Configuration
+/// The configuration is validated once, STUN and TURN UDP server hostnames are resolved up front
+/// and refreshed in the background, and all connections use the same certificate unless
+/// shareCertificate is disabled, so creating a connection does not wait on DNS or certificate
+/// generation. With iceCandidatePoolSize, ICE candidates including TURN allocations are gathered
+/// in advance and connections get them as soon as the local description is created. Pooled
+/// candidates are regathered in the background once old enough for NAT bindings to time out.
+class RTC_CPP_EXPORT PeerConnectionFactory final {
+public:
+	PeerConnectionFactory(Configuration config = {});
+	~PeerConnectionFactory();
+
+	PeerConnectionFactory(const PeerConnectionFactory &) = delete;
+	PeerConnectionFactory &operator=(const PeerConnectionFactory &) = delete;
+
+	Configuration config() const; // with resolved server addresses
+
+	[[nodiscard]] shared_ptr<PeerConnection> create();
+
+private:
+	struct Template;
+	const shared_ptr<Template> tmpl;
+};
+
+} // namespace rtc
+
+#endif
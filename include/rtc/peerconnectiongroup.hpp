@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_PEER_CONNECTION_GROUP_H
+#define RTC_PEER_CONNECTION_GROUP_H
+
+#include "peerconnection.hpp"
+
+#include <functional>
+
+namespace rtc {
+
+/// Several PeerConnections between the same two peers behind a single facade
+/// Each member has its own SCTP association, processed on its own worker, so data channels spread
+/// across members are not serialized by a single association. This is meant for links between
+/// servers where the aggregate throughput of one connection is limited by one core.
+///
+/// Both sides must use groups of the same size, each member is signaled like a standalone
+/// PeerConnection, with its index to tell them apart. Negotiated data channels are assigned to
+/// the member given by their id modulo the size, so both sides agree, and other data channels are
+/// assigned round-robin. Callbacks must be set before signaling starts.
+class RTC_CPP_EXPORT PeerConnectionGroup final {
+public:
+	using State = PeerConnection::State;
+
+	PeerConnectionGroup(size_t size, Configuration config = {});
+	~PeerConnectionGroup();
+
+	PeerConnectionGroup(const PeerConnectionGroup &) = delete;
+	PeerConnectionGroup &operator=(const PeerConnectionGroup &) = delete;
+
+	void close();
+
+	size_t size() const;
+	shared_ptr<PeerConnection> member(size_t index) const;
+
+	/// Connected once all members in use are connected, Failed or Disconnected as soon as one is
+	/// Members are in use once negotiated, so members without data channels are ignored
+	State state() const;
+
+	void setRemoteDescription(size_t index, Description description);
+	void addRemoteCandidate(size_t index, Candidate candidate);
+
+	[[nodiscard]] shared_ptr<DataChannel> createDataChannel(string label,
+	                                                        DataChannelInit init = {});
+	void onDataChannel(std::function<void(shared_ptr<DataChannel> dataChannel)> callback);
+
+	void onLocalDescription(std::function<void(size_t index, Description description)> callback);
+	void onLocalCandidate(std::function<void(size_t index, Candidate candidate)> callback);
+	void onStateChange(std::function<void(State state)> callback);
+
+	// Stats, summed over members
+	size_t bytesSent();
+	size_t bytesReceived();
+	size_t sendThroughput();    // in bytes/s
+	size_t receiveThroughput(); // same
+
+private:
+	struct Group;
+	const shared_ptr<Group> group;
+};
+
+} // namespace rtc
+
+#endif
@@ -45,6 +45,12 @@ extern "C" {
 
 #define RTC_DEFAULT_MTU 1280 // IPv6 minimum guaranteed MTU
 
+// DataChannel priorities, higher is more important (RFC 8831 and W3C WebRTC)
+#define RTC_PRIORITY_VERY_LOW 128
+#define RTC_PRIORITY_LOW 256 // default
+#define RTC_PRIORITY_MEDIUM 512
+#define RTC_PRIORITY_HIGH 1024
+
 #if RTC_ENABLE_MEDIA
 #define RTC_DEFAULT_MAXIMUM_FRAGMENT_SIZE                                                          \
 	((uint16_t)(RTC_DEFAULT_MTU - 12 - 8 - 40)) // SRTP/UDP/IPv6
@@ -93,6 +99,7 @@ typedef enum {
 	RTC_CERTIFICATE_DEFAULT = 0, // ECDSA
 	RTC_CERTIFICATE_ECDSA = 1,
 	RTC_CERTIFICATE_RSA = 2,
+	RTC_CERTIFICATE_ED25519 = 3, // not supported by all browsers
 } rtcCertificateType;
 
 typedef enum {
@@ -100,6 +107,8 @@ typedef enum {
 	RTC_CODEC_H264 = 0,
 	RTC_CODEC_VP8 = 1,
 	RTC_CODEC_VP9 = 2,
+	RTC_CODEC_H265 = 3,
+	RTC_CODEC_AV1 = 4,
 
 	// audio
 	RTC_CODEC_OPUS = 128
@@ -147,6 +156,42 @@ RTC_EXPORT void rtcInitLogger(rtcLogLevel level, rtcLogCallbackFunc cb);
 RTC_EXPORT void rtcSetUserPointer(int id, void *ptr);
 RTC_EXPORT void *rtcGetUserPointer(int i);
 
+// Event queue
+
+// Instead of calling callbacks on internal threads, events of objects with rtcQueueEvents()
+// enabled are queued, and the application polls them in batches from its own threads
+typedef enum {
+	RTC_EVENT_LOCAL_DESCRIPTION = 0,      // data: sdp, extra: type
+	RTC_EVENT_LOCAL_CANDIDATE = 1,        // data: candidate, extra: mid
+	RTC_EVENT_STATE_CHANGE = 2,           // value: rtcState
+	RTC_EVENT_GATHERING_STATE_CHANGE = 3, // value: rtcGatheringState
+	RTC_EVENT_SIGNALING_STATE_CHANGE = 4, // value: rtcSignalingState
+	RTC_EVENT_DATA_CHANNEL = 5,           // value: dc
+	RTC_EVENT_TRACK = 6,                  // value: tr
+	RTC_EVENT_OPEN = 7,
+	RTC_EVENT_CLOSED = 8,
+	RTC_EVENT_ERROR = 9,                  // data: error
+	RTC_EVENT_MESSAGE = 10,               // data: message, value: size as in rtcMessageCallbackFunc
+	RTC_EVENT_BUFFERED_AMOUNT_LOW = 11,
+	RTC_EVENT_WEBSOCKET_CLIENT = 12,      // value: ws
+} rtcEventType;
+
+typedef struct {
+	rtcEventType type;
+	int id;            // the object the event is for
+	int value;         // see rtcEventType
+	const char *data;  // NULL if none, see rtcEventType
+	const char *extra; // NULL if none, see rtcEventType
+	void *ptr;         // user pointer of the object
+} rtcEvent;
+
+// Replaces (or unsets if !enabled) all callbacks of the object by queued events, Data Channels,
+// Tracks, and WebSockets created by the object inherit the setting
+RTC_EXPORT int rtcQueueEvents(int id, bool enabled);
+// Returns the number of events polled, 0 if timed out, timeout < 0 means infinite
+// Event data stays valid until the next call on the same thread
+RTC_EXPORT int rtcPollEvents(rtcEvent *events, int count, int timeoutMs);
+
 // PeerConnection
 
 typedef struct {
@@ -155,7 +200,8 @@ typedef struct {
 	const char *bindAddress; // libjuice only, NULL means any
 	rtcCertificateType certificateType;
 	rtcTransportPolicy iceTransportPolicy;
-	bool enableIceTcp;
+	bool enableIceTcp;    // passive only with libjuice
+	bool enableIceUdpMux; // libjuice only
 	bool disableAutoNegotiation;
 	uint16_t portRangeBegin; // 0 means automatic
 	uint16_t portRangeEnd;   // 0 means automatic
@@ -175,6 +221,7 @@ RTC_EXPORT int rtcSetSignalingStateChangeCallback(int pc, rtcSignalingStateCallb
 RTC_EXPORT int rtcSetLocalDescription(int pc, const char *type);
 RTC_EXPORT int rtcSetRemoteDescription(int pc, const char *sdp, const char *type);
 RTC_EXPORT int rtcAddRemoteCandidate(int pc, const char *cand, const char *mid);
+RTC_EXPORT int rtcRestartIce(int pc);
 
 RTC_EXPORT int rtcGetLocalDescription(int pc, char *buffer, int size);
 RTC_EXPORT int rtcGetRemoteDescription(int pc, char *buffer, int size);
@@ -188,6 +235,23 @@ RTC_EXPORT int rtcGetRemoteAddress(int pc, char *buffer, int size);
 RTC_EXPORT int rtcGetSelectedCandidatePair(int pc, char *local, int localSize, char *remote,
                                            int remoteSize);
 
+typedef struct {
+	uint32_t congestionWindow;  // in bytes, on the primary path
+	uint32_t peerReceiveWindow; // in bytes
+	uint32_t unackedChunks;
+	uint32_t pendingChunks;
+	uint32_t mtu;
+	int rtt; // in milliseconds
+	int rto; // in milliseconds
+	uint64_t abandonedUnsent;
+	uint64_t abandonedSent;
+	uint64_t queuedMessages;
+	uint64_t bufferedAmount;
+	uint64_t retransmissions; // process-wide
+} rtcSctpStats;
+
+RTC_EXPORT int rtcGetSctpStats(int pc, rtcSctpStats *stats);
+
 // DataChannel, Track, and WebSocket common API
 
 RTC_EXPORT int rtcSetOpenCallback(int id, rtcOpenCallbackFunc cb);
@@ -195,6 +259,8 @@ RTC_EXPORT int rtcSetClosedCallback(int id, rtcClosedCallbackFunc cb);
 RTC_EXPORT int rtcSetErrorCallback(int id, rtcErrorCallbackFunc cb);
 RTC_EXPORT int rtcSetMessageCallback(int id, rtcMessageCallbackFunc cb);
 RTC_EXPORT int rtcSendMessage(int id, const char *data, int size);
+// Send count messages at once, sizes are interpreted like in rtcSendMessage()
+RTC_EXPORT int rtcSendMessages(int id, const char *const *data, const int *sizes, int count);
 RTC_EXPORT bool rtcIsOpen(int id);
 RTC_EXPORT bool rtcIsClosed(int id);
 
@@ -208,6 +274,18 @@ RTC_EXPORT int rtcGetAvailableAmount(int id); // total size available to receive
 RTC_EXPORT int rtcSetAvailableCallback(int id, rtcAvailableCallbackFunc cb);
 RTC_EXPORT int rtcReceiveMessage(int id, char *buffer, int *size);
 
+// Zero-copy receive: messages are borrowed from the channel instead of being copied, their data
+// stays valid until released with rtcReleaseMessage()
+typedef struct {
+	int handle;       // to pass to rtcReleaseMessage()
+	const char *data; // not null-terminated
+	int size;         // negative for strings, like in rtcReceiveMessage()
+} rtcMessage;
+
+RTC_EXPORT int rtcBorrowMessage(int id, rtcMessage *message); // RTC_ERR_NOT_AVAIL if none
+RTC_EXPORT int rtcReceiveMessages(int id, rtcMessage *messages, int count); // returns count
+RTC_EXPORT int rtcReleaseMessage(int handle);
+
 // DataChannel
 
 typedef struct {
@@ -222,7 +300,8 @@ typedef struct {
 	const char *protocol; // empty string if NULL
 	bool negotiated;
 	bool manualStream;
-	uint16_t stream; // numeric ID 0-65534, ignored if manualStream is false
+	uint16_t stream;   // numeric ID 0-65534, ignored if manualStream is false
+	uint16_t priority; // RTC_PRIORITY_*, 0 means default
 } rtcDataChannelInit;
 
 RTC_EXPORT int rtcSetDataChannelCallback(int pc, rtcDataChannelCallbackFunc cb);
@@ -236,6 +315,16 @@ RTC_EXPORT int rtcGetDataChannelLabel(int dc, char *buffer, int size);
 RTC_EXPORT int rtcGetDataChannelProtocol(int dc, char *buffer, int size);
 RTC_EXPORT int rtcGetDataChannelReliability(int dc, rtcReliability *reliability);
 
+typedef struct {
+	uint64_t abandonedUnsent;
+	uint64_t abandonedSent;
+	uint64_t queuedMessages;
+	uint64_t bufferedAmount;
+	uint64_t droppedMessages;
+} rtcDataChannelStats;
+
+RTC_EXPORT int rtcGetDataChannelStats(int dc, rtcDataChannelStats *stats);
+
 // Track
 
 typedef struct {
@@ -256,11 +345,33 @@ RTC_EXPORT int rtcDeleteTrack(int tr);
 
 RTC_EXPORT int rtcGetTrackDescription(int tr, char *buffer, int size);
 
+typedef struct {
+	uint32_t ssrc;
+	uint64_t packetsSent;
+	uint64_t bytesSent;
+	uint64_t retransmittedPackets;
+	uint64_t retransmittedBytes;
+	uint64_t nacksReceived;
+	uint64_t keyframeRequestsReceived;
+	unsigned int bitrateSent; // bits per second, since the previous call
+	uint64_t packetsReceived;
+	uint64_t bytesReceived;
+	uint64_t nacksSent;
+	uint64_t keyframeRequestsSent;
+	unsigned int bitrateReceived;
+	int64_t packetsLost;
+	double jitter; // seconds
+	int rtt;       // milliseconds, -1 if unknown
+} rtcTrackStreamStats;
+
+// Returns the number of streams, or the required count if buffer is NULL
+RTC_EXPORT int rtcGetTrackStats(int tr, rtcTrackStreamStats *buffer, int count);
+
 #if RTC_ENABLE_MEDIA
 
 // Media
 
-// Define how NAL units are separated in a H264 sample
+// Define how NAL units are separated in a H264 or H265 sample
 typedef enum {
 	RTC_NAL_SEPARATOR_LENGTH = 0,               // first 4 bytes are NAL unit length
 	RTC_NAL_SEPARATOR_LONG_START_SEQUENCE = 1,  // 0x00, 0x00, 0x00, 0x01
@@ -276,9 +387,9 @@ typedef struct {
 	uint16_t sequenceNumber;
 	uint32_t timestamp;
 
-	// H264
+	// H264 and H265
 	rtcNalUnitSeparator nalSeparator; // NAL unit separator
-	uint16_t maxFragmentSize;         // Maximum NAL unit fragment size
+	uint16_t maxFragmentSize;         // Maximum NAL unit fragment size, or AV1/VP8/VP9 payload size
 
 } rtcPacketizationHandlerInit;
 
@@ -299,6 +410,18 @@ typedef struct {
 // Set H264PacketizationHandler for track
 RTC_EXPORT int rtcSetH264PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init);
 
+// Set H265PacketizationHandler for track
+RTC_EXPORT int rtcSetH265PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init);
+
+// Set AV1PacketizationHandler for track
+RTC_EXPORT int rtcSetAV1PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init);
+
+// Set VP8PacketizationHandler for track
+RTC_EXPORT int rtcSetVP8PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init);
+
+// Set VP9PacketizationHandler for track
+RTC_EXPORT int rtcSetVP9PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init);
+
 // Set OpusPacketizationHandler for track
 RTC_EXPORT int rtcSetOpusPacketizationHandler(int tr, const rtcPacketizationHandlerInit *init);
 
@@ -308,6 +431,17 @@ RTC_EXPORT int rtcChainRtcpSrReporter(int tr);
 // Chain RtcpNackResponder to handler chain for given track
 RTC_EXPORT int rtcChainRtcpNackResponder(int tr, unsigned int maxStoredPacketsCount);
 
+// Chain RtcpNackResponder sending retransmissions on an RTX stream to handler chain
+RTC_EXPORT int rtcChainRtcpNackResponderRtx(int tr, unsigned int maxStoredPacketsCount,
+                                            uint32_t rtxSsrc, int rtxPayloadType);
+
+// Chain RtcpNackRequester to handler chain for given track
+RTC_EXPORT int rtcChainRtcpNackRequester(int tr, unsigned int maxRetries);
+
+// Chain RtxReceiver restoring incoming RTX retransmissions to handler chain for given track
+RTC_EXPORT int rtcChainRtxReceiver(int tr, uint32_t ssrc, uint32_t rtxSsrc, int payloadType,
+                                   int rtxPayloadType);
+
 /// Set start time for RTP stream
 RTC_EXPORT int rtcSetRtpConfigurationStartTime(int id, const rtcStartTime *startTime);
 
@@ -414,6 +548,23 @@ typedef struct {
 // Note: SCTP settings apply to newly-created PeerConnections only
 RTC_EXPORT int rtcSetSctpSettings(const rtcSctpSettings *settings);
 
+// Thread pool global settings
+
+typedef struct {
+	int workersCount;       // workers for message dispatch, <= 0 means default
+	int cryptoWorkersCount; // dedicated workers for crypto-heavy tasks, <= 0 means shared
+	bool pinWorkers;        // pin each worker thread to a CPU (Linux only)
+	bool external;          // spawn no workers, the application runs tasks with rtcPoll()
+} rtcThreadPoolSettings;
+
+// Note: thread pool settings apply on next initialization only
+RTC_EXPORT int rtcSetThreadPoolSettings(const rtcThreadPoolSettings *settings);
+
+// Event-loop integration for external mode
+RTC_EXPORT int rtcPoll(int timeoutMs); // returns the number of tasks run
+RTC_EXPORT int rtcGetPollHandle(void); // file descriptor readable when tasks are ready
+RTC_EXPORT int rtcGetPollTimeout(void); // in msecs, < 0 means infinite
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
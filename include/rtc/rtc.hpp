@@ -22,29 +22,67 @@
 // C++ API
 #include "common.hpp"
 #include "global.hpp"
+#include "metrics.hpp"
 //
+#include "broadcastgroup.hpp"
 #include "datachannel.hpp"
+#include "framechannel.hpp"
 #include "peerconnection.hpp"
+#include "peerconnectionfactory.hpp"
+#include "peerconnectiongroup.hpp"
+#include "trafficcapture.hpp"
 #include "track.hpp"
 
+// C++20 coroutines (only if supported)
+#include "async.hpp"
+
 #if RTC_ENABLE_WEBSOCKET
 
 // WebSocket
 #include "websocket.hpp"
 #include "websocketserver.hpp"
 
+// WHIP/WHEP
+#include "whipserver.hpp"
+
 #endif // RTC_ENABLE_WEBSOCKET
 
 #if RTC_ENABLE_MEDIA
 
 // Media handling
+#include "activespeakerdetector.hpp"
+#include "keyframecache.hpp"
+#include "keyframerequestaggregator.hpp"
 #include "mediachainablehandler.hpp"
+#include "mediapipeline.hpp"
+#include "rtcpnackrequester.hpp"
 #include "rtcpnackresponder.hpp"
 #include "rtcpreceivingsession.hpp"
 #include "rtcpsrreporter.hpp"
+#include "rtcptwccreporter.hpp"
+#include "rtpheaderrewriter.hpp"
+#include "rtpjitterbuffer.hpp"
+#include "rtpplayer.hpp"
+#include "rtprecorder.hpp"
+#include "rtpreddecoder.hpp"
+#include "rtpredencoder.hpp"
+#include "rtxreceiver.hpp"
+#include "simulcastforwarder.hpp"
+#include "temporallayerfilter.hpp"
+#include "twccbandwidthestimator.hpp"
+#include "ulpfecgenerator.hpp"
+#include "ulpfecreceiver.hpp"
 
-// Opus/h264 streaming
+// Opus/h264/h265/AV1/VP8/VP9 streaming
+#include "av1packetizationhandler.hpp"
 #include "h264packetizationhandler.hpp"
+#include "h265packetizationhandler.hpp"
 #include "opuspacketizationhandler.hpp"
+#include "vp8packetizationhandler.hpp"
+#include "vp9packetizationhandler.hpp"
+
+// Opus/h264 receiving
+#include "h264rtpdepacketizer.hpp"
+#include "opusrtpdepacketizer.hpp"
 
 #endif // RTC_ENABLE_MEDIA
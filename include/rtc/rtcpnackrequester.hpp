@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTCP_NACK_REQUESTER_H
+#define RTC_RTCP_NACK_REQUESTER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+namespace rtc {
+
+/// Detects missing incoming RTP packets and requests them with RTCP Generic NACK
+/// A missing packet is requested immediately, then again each time a retransmission should have
+/// arrived, up to a maximum count of retries. The round-trip time is estimated from the delay of
+/// retransmissions answering a first request.
+class RTC_CPP_EXPORT RtcpNackRequester final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+
+	static const unsigned defaultMaxRetries = 5;
+
+	/// @param initialRtt Round-trip time used before it is estimated
+	/// @param maxRetries Maximum count of requests for a missing packet
+	RtcpNackRequester(std::chrono::milliseconds initialRtt = std::chrono::milliseconds(100),
+	                  unsigned maxRetries = defaultMaxRetries);
+
+	/// Tracks incoming RTP packets
+	/// @param messages RTP packets
+	/// @returns Unchanged RTP packets and RTCP NACK
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+	/// Sets the round-trip time, for instance if it is known from RTCP reports
+	void setRtt(std::chrono::milliseconds rtt);
+
+	/// Returns the current round-trip time estimation
+	std::chrono::milliseconds rtt() const;
+
+private:
+	// Missing sequence numbers are tracked in a window ending at the highest one received, a
+	// larger jump of sequence numbers restarts tracking
+	static const size_t WindowSize = 1024;
+
+	struct Stream {
+		bool initialized = false;
+		uint16_t highest = 0;
+		size_t missingCount = 0;
+		std::array<uint64_t, WindowSize / 64> missing = {};
+		std::array<uint8_t, WindowSize> retries = {};
+		std::array<clock::time_point, WindowSize> requested = {};
+	};
+
+	void receive(Stream &stream, uint16_t seq, clock::time_point now);
+	void setMissing(Stream &stream, uint16_t seq, bool missing);
+	bool isMissing(const Stream &stream, uint16_t seq) const;
+	message_ptr buildNack(SSRC ssrc, const std::vector<uint16_t> &seqs) const;
+
+	const unsigned maxRetries;
+
+	std::unordered_map<SSRC, Stream> streams;
+	std::chrono::duration<double, std::milli> currentRtt;
+	std::vector<uint16_t> requests;
+	mutable std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTCP_NACK_REQUESTER_H */
@@ -23,59 +23,156 @@
 
 #include "mediahandlerelement.hpp"
 
-#include <queue>
-#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
 
 namespace rtc {
 
 class RTC_CPP_EXPORT RtcpNackResponder final : public MediaHandlerElement {
+	using clock = std::chrono::steady_clock;
 
-	/// Packet storage
+	/// Packet storage, a ring of packets indexed by sequence number
 	class RTC_CPP_EXPORT Storage {
+		using clock = std::chrono::steady_clock;
 
 		/// Packet storage element
 		struct RTC_CPP_EXPORT Element {
-			Element(binary_ptr packet, uint16_t sequenceNumber, shared_ptr<Element> next = nullptr);
-			const binary_ptr packet;
-			const uint16_t sequenceNumber;
-			/// Pointer to newer element
-			shared_ptr<Element> next = nullptr;
+			binary_ptr packet;
+			clock::time_point time;
+			clock::time_point retransmitted;
 		};
 
 	private:
-		/// Oldest packet in storage
-		shared_ptr<Element> oldest = nullptr;
-		/// Newest packet in storage
-		shared_ptr<Element> newest = nullptr;
+		/// Preallocated ring, its size is a power of 2
+		std::vector<Element> ring;
 
-		/// Inner storage
-		std::unordered_map<uint16_t, shared_ptr<Element>> storage{};
+		/// Range of stored sequence numbers
+		optional<uint16_t> oldest;
+		uint16_t newest = 0;
+
+		size_t bytes = 0;
 
 		/// Maximum storage size
 		const unsigned maximumSize;
+		const std::chrono::milliseconds maximumDuration;
+		const size_t maximumBytes;
+
+		std::mutex mutex;
 
-		/// Returnst current size
-		unsigned size();
+		Element &at(uint16_t sequenceNumber);
+		void release(Element &element);
+		void evictOldest();
 
 	public:
 		static const unsigned defaultMaximumSize = 512;
+		static const unsigned defaultMaximumDurationSize = 4096;
 
-		Storage(unsigned _maximumSize);
+		/// @param maximumSize Maximum count of stored packets
+		/// @param maximumDuration Maximum age of stored packets, zero for no limit
+		/// @param maximumBytes Maximum total size of stored packets, zero for no limit
+		Storage(unsigned maximumSize,
+		        std::chrono::milliseconds maximumDuration = std::chrono::milliseconds::zero(),
+		        size_t maximumBytes = 0);
 
 		/// Returns packet with given sequence number
 		optional<binary_ptr> get(uint16_t sequenceNumber);
 
+		/// Returns packet with given sequence number if it is still worth retransmitting
+		/// @param minInterval Minimum interval since the previous retransmission of the packet
+		/// @param maxAge Maximum age of the packet, zero for no limit
+		optional<binary_ptr> getForRetransmission(uint16_t sequenceNumber, clock::time_point now,
+		                                          std::chrono::milliseconds minInterval,
+		                                          std::chrono::milliseconds maxAge);
+
+		/// Records the retransmission of the packet with given sequence number
+		void setRetransmitted(uint16_t sequenceNumber, clock::time_point now);
+
 		/// Stores packet
 		/// @param packet Packet
 		void store(binary_ptr packet);
+
+		/// Returns total size of stored packets
+		size_t storedBytes();
 	};
 
 	const shared_ptr<Storage> storage;
-	std::mutex reportMutex;
+
+	/// RTX stream (RFC 4588) for retransmissions
+	struct Rtx {
+		SSRC ssrc;
+		uint8_t payloadType;
+		uint16_t sequenceNumber;
+	};
+
+	optional<Rtx> rtx;
+	std::mutex rtxMutex;
+
+	/// Transport-wide sequence numbering of retransmissions
+	uint8_t transportSequenceNumberId = 0;
+	shared_ptr<std::atomic<uint16_t>> transportSequenceNumber;
+
+	binary_ptr createRtxPacket(const binary &packet);
+	void renumberTransportSequence(binary &packet);
+
+	/// Retransmission limits
+	std::chrono::milliseconds rtt = std::chrono::milliseconds::zero();
+	std::chrono::milliseconds maxPacketAge = std::chrono::milliseconds::zero();
+	double budgetFraction = 0.;
+
+	/// Retransmission budget, credited with a fraction of the sent bytes
+	double budgetBytes = 0.;
+	double sendRate = 0.; // bytes per second
+	size_t rateWindowBytes = 0;
+	clock::time_point rateWindowStart;
+	std::mutex budgetMutex;
+
+	void updateBudget(size_t sentBytes, clock::time_point now);
+	bool consumeBudget(size_t bytes);
 
 public:
 	RtcpNackResponder(unsigned maxStoredPacketCount = Storage::defaultMaximumSize);
 
+	/// Stores packets sent during the given duration instead of a fixed count
+	/// @param maxStoredDuration Maximum age of stored packets
+	/// @param maxStoredBytes Maximum total size of stored packets, zero for no limit
+	/// @param maxStoredPacketCount Maximum count of stored packets
+	RtcpNackResponder(std::chrono::milliseconds maxStoredDuration, size_t maxStoredBytes = 0,
+	                  unsigned maxStoredPacketCount = Storage::defaultMaximumDurationSize);
+
+	/// Sends retransmissions on a separate RTX stream instead of the original stream
+	/// @param rtxSsrc SSRC of the RTX stream, associated with the original one by an FID group
+	/// @param rtxPayloadType Payload type of the RTX stream, its apt is the original payload type
+	void enableRtx(SSRC rtxSsrc, uint8_t rtxPayloadType);
+
+	/// Disables the RTX stream, retransmissions are sent on the original stream
+	void disableRtx();
+
+	/// Assigns fresh transport-wide sequence numbers to retransmissions, so transport-wide
+	/// congestion control feedback for a retransmission is not mistaken for the original packet
+	/// @param extensionId RTP header extension ID of the transport-wide sequence number
+	/// @param transportSequenceNumber Transport-wide sequence number counter shared with the
+	/// packetizers, see RtpPacketizationConfig::transportSequenceNumber
+	void enableTransportSequenceNumbers(uint8_t extensionId,
+	                                    shared_ptr<std::atomic<uint16_t>> transportSequenceNumber);
+
+	/// Limits the retransmission rate to a fraction of the media send rate
+	/// Requested packets exceeding the budget are not retransmitted, so that retransmissions do
+	/// not starve new media on a congested link.
+	/// @param fraction Fraction of the send rate, zero for no limit (default)
+	void setRetransmissionBudget(double fraction);
+
+	/// Sets the round-trip time, a packet is retransmitted at most once per round-trip time
+	/// @param rtt Round-trip time, zero to retransmit on every request (default)
+	void setRtt(std::chrono::milliseconds rtt);
+
+	/// Sets the age after which a packet is too late for playout and is not retransmitted anymore
+	/// @param maxAge Maximum age of retransmitted packets, zero for no limit (default)
+	void setMaxPacketAge(std::chrono::milliseconds maxAge);
+
+	size_t memoryUsage() const override;
+
 	/// Checks for RTCP NACK and handles it,
 	/// @param message RTCP message
 	/// @returns unchanged RTCP message and requested RTP packets
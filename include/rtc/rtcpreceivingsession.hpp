@@ -27,11 +27,37 @@
 #include "message.hpp"
 #include "rtp.hpp"
 
+#include <bitset>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 namespace rtc {
 
 // An RtcpSession can be plugged into a Track to handle the whole RTCP session
 class RTC_CPP_EXPORT RtcpReceivingSession : public MediaHandler {
 public:
+	using clock = std::chrono::steady_clock;
+
+	// Reception statistics of a source (RFC 3550 section 6.4.1)
+	struct Stats {
+		SSRC ssrc;
+		uint32_t extendedHighestSeqNo; // highest sequence number with cycles in the upper bits
+		uint32_t packetsReceived;
+		int32_t packetsLost;          // cumulative, negative if packets were duplicated
+		uint8_t fractionLost;         // in 1/256 since the previous receiver report
+		uint32_t jitter;              // interarrival jitter in timestamp units
+		double jitterSeconds;         // interarrival jitter using the clock rate
+		optional<uint64_t> lastSrNtp; // NTP timestamp of the last sender report
+	};
+
+	// The clock rate of the media is required to compute the jitter
+	RtcpReceivingSession(uint32_t clockRate = 90000);
+
+	optional<Stats> stats(SSRC ssrc) const;
+	std::vector<Stats> stats() const;
+
 	message_ptr incoming(message_ptr ptr) override;
 	message_ptr outgoing(message_ptr ptr) override;
 	bool send(message_ptr ptr);
@@ -42,14 +68,51 @@ public:
 
 protected:
 	void pushREMB(unsigned int bitrate);
-	void pushRR(unsigned int lastSR_delay);
+	void pushRR();
 
 	void pushPLI();
 
 	unsigned int mRequestedBitrate = 0;
 	SSRC mSsrc = 0;
 	uint32_t mGreatestSeqNo = 0;
-	uint64_t mSyncRTPTS, mSyncNTPTS;
+	uint64_t mSyncRTPTS = 0, mSyncNTPTS = 0;
+
+private:
+	static const size_t DuplicateWindow = 512; // sequence numbers
+
+	// Receive state of a source, see RFC 3550 appendix A.1 and A.8
+	struct Source {
+		uint16_t maxSeq = 0;
+		uint32_t cycles = 0;
+		uint32_t baseSeq = 0;
+		uint32_t badSeq = 0;
+		int probation = 0;
+		uint32_t received = 0;
+		uint32_t expectedPrior = 0;
+		uint32_t receivedPrior = 0;
+		optional<uint32_t> transit;
+		double jitter = 0;
+		optional<uint64_t> lastSrNtp;
+		clock::time_point lastSrTime;
+		std::bitset<DuplicateWindow> seen; // ring indexed by sequence number
+		bool initialized = false;
+
+		void init(uint16_t seq);
+		bool update(uint16_t seq); // returns false if the packet must not be counted
+		bool valid() const;
+		uint32_t extendedMax() const;
+		uint32_t expected() const;
+		int32_t lost() const;
+		uint8_t fraction() const; // since the previous report
+	};
+
+	Stats makeStats(SSRC ssrc, const Source &source) const;
+	void recordPacket(const RtpHeader *rtp, clock::time_point now);
+
+	const uint32_t mClockRate;
+	const clock::time_point mStart;
+	std::unordered_map<SSRC, Source> mSources;
+	mutable std::mutex mMutex;
 };
 
 } // namespace rtc
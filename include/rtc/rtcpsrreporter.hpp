@@ -25,19 +25,42 @@
 #include "message.hpp"
 #include "rtppacketizationconfig.hpp"
 
+#include <chrono>
+#include <vector>
+
 namespace rtc {
 
+/// Sends RTCP sender reports for the outgoing RTP stream
+/// Reports are sent when requested with setNeedsToReport(), or automatically at randomized
+/// intervals (RFC 3550 section 6.2). Reporters of several tracks can be grouped so that a single
+/// compound packet reports every SSRC of the group.
 class RTC_CPP_EXPORT RtcpSrReporter final : public MediaHandlerElement {
-	bool needsToReport = false;
+	struct Group;
 
 	uint32_t packetCount = 0;
 	uint32_t payloadOctets = 0;
 	double timeOffset = 0;
+	optional<uint32_t> lastTimestamp; // of the last sent packet
 
 	uint32_t mPreviousReportedTimestamp = 0;
 
+	const shared_ptr<Group> group;
+
+	// Values reported for an SSRC, copied so the report is built without the group lock
+	struct Report {
+		SSRC ssrc;
+		string cname;
+		uint32_t timestamp;
+		uint64_t ntpTimestamp;
+		uint32_t packetCount;
+		uint32_t octetCount;
+	};
+
 	void addToReport(RtpHeader *rtp, uint32_t rtpSize);
-	message_ptr getSenderReport(uint32_t timestamp);
+	std::vector<Report> collectReports(uint32_t timestamp); // group mutex must be locked
+
+	static size_t SenderReportSize(const std::vector<Report> &reports);
+	static message_ptr BuildSenderReport(const std::vector<Report> &reports);
 
 public:
 	static uint64_t secondsToNTP(double seconds);
@@ -48,7 +71,12 @@ public:
 	/// RTP configuration
 	const shared_ptr<RtpPacketizationConfig> rtpConfig;
 
-	RtcpSrReporter(shared_ptr<RtpPacketizationConfig> rtpConfig);
+	/// @param rtpConfig RTP configuration
+	/// @param reportWith Reporter to group with, typically of another track of the same
+	/// PeerConnection, so their SSRCs are reported together in one compound packet
+	RtcpSrReporter(shared_ptr<RtpPacketizationConfig> rtpConfig,
+	               shared_ptr<RtcpSrReporter> reportWith = nullptr);
+	~RtcpSrReporter();
 
 	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
 	                                                    message_ptr control) override;
@@ -57,6 +85,12 @@ public:
 	/// timestamp.
 	void setNeedsToReport();
 
+	/// Schedules reports of the group automatically, at randomized intervals following the
+	/// sending bitrate (RFC 3550 section 6.2). Each report goes with the next RTP packet.
+	/// @param minInterval Minimum interval between reports, RFC 3550 recommends 5 seconds
+	void enableAutomaticReports(std::chrono::milliseconds minInterval = std::chrono::seconds(5));
+	void disableAutomaticReports();
+
 	/// Set offset to compute NTS for RTCP SR packets. Offset represents relation between real start
 	/// time and timestamp of the stream in RTP packets
 	/// @note `time_offset = rtpConfig->startTime - rtpConfig->timestampToSeconds(rtpConfig->timestamp)`
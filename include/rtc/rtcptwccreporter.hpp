@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTCP_TWCC_REPORTER_H
+#define RTC_RTCP_TWCC_REPORTER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+namespace rtc {
+
+/// Sends transport-wide congestion control feedback for incoming RTP packets
+/// Arrival times of packets carrying the transport-wide sequence number header extension are
+/// reported periodically to the sender, which estimates the available bandwidth from them.
+class RTC_CPP_EXPORT RtcpTwccReporter final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+
+	/// @param extensionId RTP header extension ID of the transport-wide sequence number
+	/// @param interval Interval between feedback packets
+	RtcpTwccReporter(uint8_t extensionId,
+	                 std::chrono::milliseconds interval = std::chrono::milliseconds(50));
+
+	/// Records arrival times of incoming RTP packets
+	/// @param messages RTP packets
+	/// @returns Unchanged RTP packets and RTCP transport-wide feedback
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	message_ptr buildFeedback();
+
+	const uint8_t extensionId;
+	const std::chrono::milliseconds interval;
+	const clock::time_point start;
+
+	std::map<int64_t, int64_t> arrivals; // unwrapped sequence number to arrival time in us
+	optional<int64_t> highest;
+	optional<int64_t> nextBase;
+	SSRC mediaSsrc = 0;
+	uint8_t feedbackCount = 0;
+	clock::time_point lastFeedback;
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTCP_TWCC_REPORTER_H */
@@ -47,6 +47,16 @@ struct RTC_CPP_EXPORT RtpExtensionHeader {
 
 	void clearBody();
 	void writeCurrentVideoOrientation(size_t offset, uint8_t id, uint8_t value);
+	void writeOneByteHeader(size_t offset, uint8_t id, const byte *value, size_t size);
+	void writeTwoByteHeader(size_t offset, uint8_t id, const byte *value, size_t size);
+
+	// Returns the value of the one-byte header element with the given id, or nullptr if absent
+	[[nodiscard]] const char *findOneByteHeader(uint8_t id, size_t &size) const;
+	[[nodiscard]] const char *findTwoByteHeader(uint8_t id, size_t &size) const;
+	[[nodiscard]] const char *findHeader(uint8_t id, size_t &size) const; // either form
+
+	// Returns the value of a string header element, like MID or RTP stream ID (RFC 8852)
+	[[nodiscard]] optional<string> findStringHeader(uint8_t id) const;
 };
 
 struct RTC_CPP_EXPORT RtpHeader {
@@ -83,6 +93,7 @@ struct RTC_CPP_EXPORT RtpHeader {
 	void setMarker(bool marker);
 	void setTimestamp(uint32_t i);
 	void setExtension(bool extension);
+	void setPadding(bool padding);
 };
 
 struct RTC_CPP_EXPORT RtcpReportBlock {
@@ -98,9 +109,11 @@ struct RTC_CPP_EXPORT RtcpReportBlock {
 	[[nodiscard]] uint16_t highestSeqNo() const;
 	[[nodiscard]] uint32_t jitter() const;
 	[[nodiscard]] uint32_t delaySinceSR() const;
+	[[nodiscard]] uint8_t fractionLost() const; // in 1/256 since the previous report
+	[[nodiscard]] int32_t cumulativeLost() const;
 
 	[[nodiscard]] SSRC getSSRC() const;
-	[[nodiscard]] uint32_t getNTPOfSR() const;
+	[[nodiscard]] uint64_t getNTPOfSR() const;
 	[[nodiscard]] unsigned int getLossPercentage() const;
 	[[nodiscard]] unsigned int getPacketLostCount() const;
 
@@ -109,6 +122,7 @@ struct RTC_CPP_EXPORT RtcpReportBlock {
 	                   uint64_t lastSR_NTP, uint64_t lastSR_DELAY);
 	void setSSRC(SSRC in_ssrc);
 	void setPacketsLost(unsigned int packetsLost, unsigned int totalPackets);
+	void setLoss(uint8_t fractionLost, int32_t cumulativeLost);
 	void setSeqNo(uint16_t highestSeqNo, uint16_t seqNoCycles);
 	void setJitter(uint32_t jitter);
 	void setNTPOfSR(uint64_t ntp);
@@ -345,6 +359,33 @@ struct RTC_CPP_EXPORT RtcpNack {
 	bool addMissingPacket(unsigned int *fciCount, uint16_t *fciPID, uint16_t missingPacket);
 };
 
+// Transport-wide congestion control feedback (draft-holmer-rmcat-transport-wide-cc-extensions)
+struct RTC_CPP_EXPORT RtcpTwcc {
+	RtcpFbHeader header;
+
+	uint16_t _baseSeqNumber;
+	uint16_t _packetStatusCount;
+	uint32_t _referenceTimeAndCount; // reference time is 24-bit signed, feedback count is 8-bit
+
+	[[nodiscard]] static unsigned int Size(size_t bodySize); // body is padded to 32-bit
+
+	[[nodiscard]] uint16_t baseSeqNumber() const;
+	[[nodiscard]] uint16_t packetStatusCount() const;
+	[[nodiscard]] int32_t referenceTime() const; // in multiples of 64ms
+	[[nodiscard]] uint8_t feedbackCount() const;
+
+	// Packet status chunks followed by receive deltas
+	[[nodiscard]] const uint8_t *getBody() const;
+	[[nodiscard]] uint8_t *getBody();
+	[[nodiscard]] size_t getBodySize() const;
+
+	void preparePacket(SSRC senderSSRC, SSRC mediaSSRC, size_t bodySize);
+	void setBaseSeqNumber(uint16_t baseSeqNumber);
+	void setPacketStatusCount(uint16_t packetStatusCount);
+	void setReferenceTime(int32_t referenceTime);
+	void setFeedbackCount(uint8_t feedbackCount);
+};
+
 struct RTC_CPP_EXPORT RtpRtx {
 	RtpHeader header;
 
@@ -381,6 +422,66 @@ using RTP_RTX = RtpRtx;
 
 #pragma pack(pop)
 
+// Index of the header extension elements of an RTP packet (RFC 8285), built in one pass over
+// the one-byte or two-byte form without allocation. The packet must outlive the index.
+class RTC_CPP_EXPORT RtpExtensionIndex {
+public:
+	static const size_t MaxElements = 16; // further elements are ignored
+
+	struct Element {
+		uint8_t id;
+		uint8_t size;
+		uint16_t offset; // of the value, from the start of the packet
+	};
+
+	struct AudioLevel {
+		bool voiceActivity;
+		uint8_t level; // in -dBov, 127 means silence
+	};
+
+	// Mandatory fields of the AV1 dependency descriptor
+	struct DependencyDescriptor {
+		bool startOfFrame;
+		bool endOfFrame;
+		uint8_t templateId;
+		uint16_t frameNumber;
+	};
+
+	RtpExtensionIndex() = default;
+	RtpExtensionIndex(const byte *packet, size_t size);
+
+	// Returns false if the packet is malformed, elements indexed before the error are kept
+	bool parse(const byte *packet, size_t size);
+	void clear();
+
+	[[nodiscard]] bool empty() const { return mCount == 0; }
+	[[nodiscard]] size_t count() const { return mCount; }
+	[[nodiscard]] bool isTwoByte() const { return mTwoByte; }
+	[[nodiscard]] const Element *begin() const { return mElements; }
+	[[nodiscard]] const Element *end() const { return mElements + mCount; }
+
+	[[nodiscard]] const Element *find(uint8_t id) const;
+	[[nodiscard]] const byte *value(uint8_t id, size_t &size) const;
+
+	// Typed values, nullopt if absent or malformed
+	[[nodiscard]] optional<uint32_t> absSendTime(uint8_t id) const; // 6.18 fixed point seconds
+	[[nodiscard]] optional<uint16_t> transportSequenceNumber(uint8_t id) const;
+	[[nodiscard]] optional<AudioLevel> audioLevel(uint8_t id) const;
+	[[nodiscard]] optional<string_view> stringValue(uint8_t id) const; // MID, RID, repaired RID
+	[[nodiscard]] optional<DependencyDescriptor> dependencyDescriptor(uint8_t id) const;
+
+	// Rewrite a value in place in the indexed packet, size must match the existing element
+	bool write(byte *packet, uint8_t id, const byte *value, size_t size) const;
+	bool writeAbsSendTime(byte *packet, uint8_t id, uint32_t time) const;
+	bool writeTransportSequenceNumber(byte *packet, uint8_t id, uint16_t seq) const;
+
+private:
+	const byte *mPacket = nullptr;
+	Element mElements[MaxElements];
+	size_t mCount = 0;
+	bool mTwoByte = false;
+};
+
 } // namespace rtc
 
 #endif
@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTP_DEPACKETIZER_H
+#define RTC_RTP_DEPACKETIZER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "message.hpp"
+#include "rtp.hpp"
+
+namespace rtc {
+
+/// Class responsible for RTP depacketization
+class RTC_CPP_EXPORT RtpDepacketizer {
+public:
+	RtpDepacketizer();
+	virtual ~RtpDepacketizer();
+
+protected:
+	/// Payload of an RTP packet, the data is not copied
+	struct Payload {
+		const RtpHeader *header;
+		const byte *data;
+		size_t size;
+	};
+
+	/// Parses RTP packet, skipping header, header extension, and padding
+	/// @param packet RTP packet
+	/// @returns Payload, or nullopt if the packet is malformed
+	static optional<Payload> parse(const binary &packet);
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTP_DEPACKETIZER_H */
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTP_HEADER_REWRITER_H
+#define RTC_RTP_HEADER_REWRITER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+namespace rtc {
+
+/// Rewrites the RTP packets of a source selected among several into a single continuous stream,
+/// typically to forward the active speaker in an SFU. RTP packets of all sources are sent to the
+/// subscriber track, the element drops the packets of other sources and rewrites SSRC, sequence
+/// number, and timestamp of the selected one in place, so the receiver sees no discontinuity.
+/// Switching to another source happens on a keyframe of the new source.
+class RTC_CPP_EXPORT RtpHeaderRewriter final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+	using keyframe_detector = std::function<bool(const binary &packet)>;
+
+	/// @param ssrc SSRC of the output stream
+	/// @param clockRate RTP clock rate of the media
+	/// @param isKeyframe Returns true if the RTP packet starts a keyframe, H264 if not set, for
+	/// audio pass a function always returning true to switch on the next packet
+	RtpHeaderRewriter(SSRC ssrc, uint32_t clockRate = 90000, keyframe_detector isKeyframe = {});
+
+	/// Selects the source to forward, the switch happens on its next keyframe
+	/// @param source SSRC of the source, as sent to the track
+	void switchTo(SSRC source);
+
+	/// Stops forwarding, all packets are dropped until the next switch
+	void stop();
+
+	/// Sets the callback called with the SSRC of a source when a keyframe is needed, for instance
+	/// to call Track::requestKeyframe() on the track of the publisher
+	void onKeyframeRequest(std::function<void(SSRC ssrc)> callback);
+
+	/// Returns the SSRC of the forwarded source, if any
+	optional<SSRC> selectedSsrc() const;
+
+	/// Returns the SSRC of the source waiting for a keyframe, if any
+	optional<SSRC> pendingSsrc() const;
+
+	/// Keeps and rewrites the packets of the selected source
+	/// @param messages RTP packets of all sources
+	/// @param control RTCP
+	/// @returns Rewritten RTP packets of the selected source and RTCP
+	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+	                                                    message_ptr control) override;
+
+	/// Forwards keyframe requests of the subscriber
+	/// @param message RTCP message
+	/// @returns Unchanged RTCP message
+	ChainedIncomingControlProduct processIncomingControlMessage(message_ptr message) override;
+
+private:
+	void rewrite(RtpHeader *rtp, clock::time_point now);
+
+	const SSRC ssrc;
+	const uint32_t clockRate;
+	const keyframe_detector isKeyframe;
+
+	optional<SSRC> current;
+	optional<SSRC> pending;
+	bool forwarded = false; // at least one packet was forwarded
+	uint16_t seqOffset = 0;
+	uint32_t timestampOffset = 0;
+	uint16_t lastSeq = 0;
+	uint32_t lastTimestamp = 0;
+	clock::time_point lastForward;
+
+	synchronized_callback<SSRC> keyframeRequestCallback;
+	mutable std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTP_HEADER_REWRITER_H */
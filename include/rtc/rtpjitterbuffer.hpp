@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTP_JITTER_BUFFER_H
+#define RTC_RTP_JITTER_BUFFER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+namespace rtc {
+
+/// Reorders incoming RTP packets per SSRC
+/// In-order packets are released immediately. When a packet is missing, following packets are
+/// held until it arrives or for an adaptive delay derived from the interarrival jitter, after
+/// which it is considered lost. Held packets are only released when new packets arrive. A
+/// sequence jump beyond the capacity in either direction, like a source restart, flushes the
+/// buffer, and timestamp discontinuities are ignored by the jitter estimation.
+class RTC_CPP_EXPORT RtpJitterBuffer final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+
+	static const size_t defaultCapacity = 512;
+
+	/// Construct jitter buffer
+	/// @param clockRate Clock rate of RTP timestamps
+	/// @param minDelay Minimum delay before a missing packet is considered lost
+	/// @param maxDelay Maximum delay before a missing packet is considered lost
+	/// @param capacity Maximum count of packets held per SSRC, rounded up to a power of 2
+	RtpJitterBuffer(uint32_t clockRate,
+	                std::chrono::milliseconds minDelay = std::chrono::milliseconds(10),
+	                std::chrono::milliseconds maxDelay = std::chrono::milliseconds(200),
+	                size_t capacity = defaultCapacity);
+
+	/// Reorders RTP packets
+	/// @param messages RTP packets
+	/// @returns RTP packets ready in sequence order
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+	/// Returns the current delay for the given SSRC
+	std::chrono::milliseconds delay(SSRC ssrc) const;
+
+private:
+	struct Stream {
+		Stream(size_t capacity);
+
+		// Packets are preallocated slots indexed by sequence number
+		std::vector<binary_ptr> packets;
+		std::vector<clock::time_point> arrivals;
+		size_t count = 0;
+		optional<uint16_t> next;
+
+		// Interarrival jitter in milliseconds, see RFC 3550
+		double jitter = 0.;
+		optional<clock::time_point> lastArrival;
+		uint32_t lastTimestamp = 0;
+	};
+
+	void insert(Stream &stream, binary_ptr packet, clock::time_point now,
+	            std::vector<binary_ptr> &released);
+	void release(Stream &stream, clock::time_point now, std::vector<binary_ptr> &released);
+	void releaseAll(Stream &stream, std::vector<binary_ptr> &released);
+	std::chrono::milliseconds targetDelay(const Stream &stream) const;
+
+	const uint32_t clockRate;
+	const std::chrono::milliseconds minDelay;
+	const std::chrono::milliseconds maxDelay;
+	const size_t capacity;
+
+	std::unordered_map<SSRC, Stream> streams;
+	mutable std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTP_JITTER_BUFFER_H */
@@ -23,6 +23,8 @@
 
 #include "rtp.hpp"
 
+#include <atomic>
+
 namespace rtc {
 
 /// RTP configuration used in packetization process
@@ -66,6 +68,25 @@ public:
 	///   3 - 270 degrees
 	uint8_t videoOrientation = 0;
 
+	/// RTP header extension ID of the AV1 dependency descriptor, 0 to disable it
+	uint8_t dependencyDescriptorId = 0;
+
+	/// RTP header extension ID of the client-to-mixer audio level (RFC 6464), 0 to disable it
+	uint8_t audioLevelId = 0;
+
+	/// Current audio level in -dBov, from 0 (loudest) to 127 (silence)
+	uint8_t audioLevel = 127;
+
+	/// Current voice activity flag of the audio level
+	bool voiceActivity = false;
+
+	/// RTP header extension ID of the transport-wide sequence number, 0 to disable it
+	uint8_t transportSequenceNumberId = 0;
+
+	/// Transport-wide sequence number counter, it must be shared between the configurations of
+	/// all tracks of a PeerConnection so packets are numbered across the whole transport
+	shared_ptr<std::atomic<uint16_t>> transportSequenceNumber;
+
 	// For backward compatibility, do not use
 	const double &startTime_s = mStartTime;
 
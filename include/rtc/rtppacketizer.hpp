@@ -29,7 +29,7 @@ namespace rtc {
 /// Class responsible for RTP packetization
 class RTC_CPP_EXPORT RtpPacketizer {
 	static const auto rtpHeaderSize = 12;
-	static const auto rtpExtHeaderCvoSize = 8;
+	static const auto rtpExtHeaderSize = 4;
 
 public:
 	// RTP configuration
@@ -46,6 +46,16 @@ public:
 	/// @param payload RTP payload
 	/// @param setMark Set marker flag in RTP packet if true
 	virtual shared_ptr<binary> packetize(shared_ptr<binary> payload, bool setMark);
+
+protected:
+	/// Creates RTP packet with room for a payload of given size, to be written at its end.
+	/// @note This function increase sequence number after packetization.
+	/// @param payloadSize RTP payload size
+	/// @param setMark Set marker flag in RTP packet if true
+	/// @param extensionId One-byte header extension ID of extension, 0 for none
+	/// @param extension Header extension element of at most 16 bytes, written after the CVO
+	shared_ptr<binary> createPacket(size_t payloadSize, bool setMark, uint8_t extensionId = 0,
+	                                const binary *extension = nullptr);
 };
 
 } // namespace rtc
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTP_PLAYER_H
+#define RTC_RTP_PLAYER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "track.hpp"
+
+#include <chrono>
+#include <functional>
+
+namespace rtc {
+
+/// Plays a recording of RTP packets made with RtpRecorder into one or many tracks
+/// The recording is memory-mapped and paced on the shared timer of the thread pool, so reading
+/// and pacing are done once for all tracks. Each track gets a copy of the packets with only the
+/// RTP header rewritten, since it needs to protect them with its own SRTP context.
+class RTC_CPP_EXPORT RtpPlayer final {
+public:
+	using clock = std::chrono::steady_clock;
+
+	/// @param path Path of the recording, its index `<path>.idx` must exist
+	RtpPlayer(string path);
+	~RtpPlayer();
+
+	RtpPlayer(const RtpPlayer &) = delete;
+	RtpPlayer &operator=(const RtpPlayer &) = delete;
+
+	/// Adds a track to play into, it receives packets from the current position
+	/// @param rules Rewriting applied to the RTP packets for the track
+	void addTrack(shared_ptr<Track> track, Track::ForwardingRules rules = {});
+	void removeTrack(shared_ptr<Track> track);
+
+	/// Starts playing
+	/// @param position Position to start from, relative to the start of the recording
+	void start(std::chrono::microseconds position = std::chrono::microseconds::zero());
+	void stop();
+	bool isPlaying() const;
+
+	/// Time of the last record, relative to the start of the recording
+	std::chrono::microseconds duration() const;
+
+	/// Called when the end of the recording is reached
+	void onEnded(std::function<void()> callback);
+
+private:
+	struct State;
+	const shared_ptr<State> state;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTP_PLAYER_H */
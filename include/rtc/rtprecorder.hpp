@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTP_RECORDER_H
+#define RTC_RTP_RECORDER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace rtc {
+
+/// Records incoming messages to an append-only chunked file, without decoding
+/// Placed before a depacketizer, the element records raw RTP packets, after it depacketized
+/// frames. Records are buffered in chunks written asynchronously off the network threads, and
+/// each written chunk is appended to an index file `<path>.idx` so that recordings can be seeked
+/// by time without scanning them.
+///
+/// File format, integers are in network byte order:
+/// - Recording: "RTCREC01", start time (64-bit, microseconds since epoch), then chunks
+/// - Chunk: "RCHK", payload size (32-bit), records count (32-bit), then records
+/// - Record: time since start (64-bit, microseconds), size (32-bit), then data
+/// - Index: "RTCRIDX1", then entries of first record time (64-bit) and chunk offset (64-bit)
+class RTC_CPP_EXPORT RtpRecorder final : public MediaHandlerElement {
+public:
+	struct Record {
+		std::chrono::microseconds time; // since the start of the recording
+		binary data;
+	};
+
+	struct IndexEntry {
+		std::chrono::microseconds time; // of the first record of the chunk
+		uint64_t offset;                // of the chunk in the recording
+	};
+
+	/// @param path Path of the recording, truncated if it exists
+	/// @param chunkSize A chunk is written when its size reaches this value in bytes
+	/// @param chunkDuration A chunk is written when it spans this duration
+	RtpRecorder(string path, size_t chunkSize = 1024 * 1024,
+	            std::chrono::milliseconds chunkDuration = std::chrono::seconds(1));
+	~RtpRecorder(); // writes the last chunk and waits for pending writes
+
+	/// Writes the current chunk asynchronously
+	void flush();
+
+	/// Records incoming messages
+	/// @param messages RTP packets or frames
+	/// @returns Unchanged messages
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+	/// Reads the index of a recording
+	/// @param path Path of the recording, not of the index
+	static std::vector<IndexEntry> ReadIndex(const string &path);
+
+	/// Reads the records of a chunk
+	/// @param path Path of the recording
+	/// @param offset Offset of the chunk, from the index
+	static std::vector<Record> ReadChunk(const string &path, uint64_t offset);
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Writer;
+
+	void flushChunk(); // mutex needs to be locked
+
+	const size_t chunkSize;
+	const std::chrono::milliseconds chunkDuration;
+	const clock::time_point startTime;
+
+	std::unique_ptr<Writer> writer;
+
+	binary chunk; // records of the current chunk
+	uint32_t chunkCount = 0;
+	std::chrono::microseconds chunkTime{0}; // of the first record of the current chunk
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTP_RECORDER_H */
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTP_RED_DECODER_H
+#define RTC_RTP_RED_DECODER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace rtc {
+
+/// Decapsulates incoming redundant payloads (RFC 2198)
+/// RED packets are replaced by packets of their primary payload. When packets are missing, they
+/// are restored from the redundant payloads of the next packet, assuming each block is one packet
+/// older than the next one. It should be placed before other elements in the incoming direction.
+class RTC_CPP_EXPORT RtpRedDecoder final : public MediaHandlerElement {
+public:
+	/// @param payloadType RED payload type
+	RtpRedDecoder(uint8_t payloadType);
+
+	/// Decapsulates RED packets, other packets are unchanged
+	/// @param messages RTP packets
+	/// @returns RTP packets with restored packets before the packet carrying them
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	const uint8_t payloadType;
+
+	std::unordered_map<SSRC, uint16_t> lastSeqs; // highest sequence number for each stream
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTP_RED_DECODER_H */
@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTP_RED_ENCODER_H
+#define RTC_RTP_RED_ENCODER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <deque>
+#include <mutex>
+
+namespace rtc {
+
+/// Encapsulates outgoing RTP packets in redundant payloads (RFC 2198)
+/// Each packet carries up to the given number of previous payloads of the stream, so a receiver
+/// can recover from isolated losses without retransmission, typically for Opus. Without
+/// redundancy, the element only encapsulates, for instance to carry ULPFEC with video.
+class RTC_CPP_EXPORT RtpRedEncoder final : public MediaHandlerElement {
+public:
+	/// @param payloadType RED payload type
+	/// @param redundancy Number of previous payloads sent again in each packet
+	RtpRedEncoder(uint8_t payloadType, unsigned int redundancy = 1);
+
+	/// Encapsulates RTP packets
+	/// @param messages RTP packets, in sequence order
+	/// @param control RTCP
+	/// @returns RED packets and RTCP
+	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+	                                                    message_ptr control) override;
+
+private:
+	struct Block {
+		uint8_t payloadType;
+		uint32_t timestamp;
+		binary payload;
+	};
+
+	const uint8_t payloadType;
+	const unsigned int redundancy;
+
+	std::deque<Block> previous; // oldest first
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTP_RED_ENCODER_H */
@@ -0,0 +1,59 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_RTX_RECEIVER_H
+#define RTC_RTX_RECEIVER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <map>
+#include <mutex>
+
+namespace rtc {
+
+/// Restores incoming RTX retransmissions (RFC 4588) as packets of the original stream
+/// It should be the last element of the chain, so other elements only see the original stream.
+class RTC_CPP_EXPORT RtxReceiver final : public MediaHandlerElement {
+public:
+	/// @param ssrc SSRC of the original stream
+	/// @param rtxSsrc SSRC of the RTX stream, associated with the original one by an FID group
+	RtxReceiver(SSRC ssrc, SSRC rtxSsrc);
+
+	/// Associates an RTX payload type with the original payload type given by its apt parameter
+	void addPayloadType(uint8_t rtxPayloadType, uint8_t payloadType);
+
+	/// Rewrites RTX packets, padding-only RTX packets are dropped
+	/// @param messages RTP packets
+	/// @returns RTP packets of the original stream
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	const SSRC ssrc;
+	const SSRC rtxSsrc;
+
+	std::map<uint8_t, uint8_t> payloadTypes; // RTX payload type to original payload type
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_RTX_RECEIVER_H */
@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_SIMULCAST_FORWARDER_H
+#define RTC_SIMULCAST_FORWARDER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace rtc {
+
+/// Forwards a single simulcast layer of a received video to a subscriber, typically in an SFU
+/// RTP packets of all layers are sent to the subscriber track, the element keeps the packets of
+/// the selected layer and rewrites them into a single continuous stream. The layer with the
+/// highest measured bitrate fitting the target bitrate is selected, and switching happens on a
+/// keyframe of the new layer.
+class RTC_CPP_EXPORT SimulcastForwarder final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+	using keyframe_detector = std::function<bool(const binary &packet)>;
+
+	/// @param ssrc SSRC of the forwarded stream
+	/// @param clockRate RTP clock rate of the video
+	/// @param isKeyframe Returns true if the RTP packet starts a keyframe, H264 if not set
+	SimulcastForwarder(SSRC ssrc, uint32_t clockRate = 90000, keyframe_detector isKeyframe = {});
+
+	/// Sets the ID of the RTP stream ID header extension, to identify layers by RID
+	void setRidExtensionId(uint8_t id);
+
+	/// Sets the bitrate available towards the subscriber, typically from Track::onTargetBitrate()
+	/// @param bitrate Bitrate in bits per second, 0 selects the lowest layer
+	void setTargetBitrate(unsigned int bitrate);
+
+	/// Sets the callback called with the SSRC of a layer when a keyframe is needed, for instance to
+	/// call Track::requestKeyframe() on the track of the publisher
+	void onKeyframeRequest(std::function<void(SSRC ssrc)> callback);
+
+	/// Returns the SSRC and the RTP stream ID of the forwarded layer, if any
+	optional<SSRC> selectedSsrc() const;
+	optional<string> selectedRid() const;
+
+	/// Keeps the packets of the selected layer
+	/// @param messages RTP packets of all layers
+	/// @param control RTCP
+	/// @returns Rewritten RTP packets of the selected layer and RTCP
+	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+	                                                    message_ptr control) override;
+
+	/// Forwards keyframe requests of the subscriber
+	/// @param message RTCP message
+	/// @returns Unchanged RTCP message
+	ChainedIncomingControlProduct processIncomingControlMessage(message_ptr message) override;
+
+private:
+	struct Layer {
+		optional<string> rid;
+		size_t bytes = 0;   // in the current window
+		double bitrate = 0; // bits per second, 0 until measured
+		clock::time_point windowStart;
+		clock::time_point lastPacket;
+	};
+
+	optional<SSRC> select(clock::time_point now) const;
+	void updateLayers(clock::time_point now);
+	void rewrite(RtpHeader *rtp, clock::time_point now);
+
+	const SSRC ssrc;
+	const uint32_t clockRate;
+	const keyframe_detector isKeyframe;
+
+	uint8_t ridExtensionId = 0;
+	unsigned int targetBitrate = 0;
+	std::unordered_map<SSRC, Layer> layers;
+	clock::time_point lastUpdate;
+
+	optional<SSRC> current;
+	optional<SSRC> pending;
+	bool forwarded = false; // at least one packet was forwarded
+	uint16_t seqOffset = 0;
+	uint32_t timestampOffset = 0;
+	uint16_t lastSeq = 0;
+	uint32_t lastTimestamp = 0;
+	clock::time_point lastForward;
+
+	synchronized_callback<SSRC> keyframeRequestCallback;
+	mutable std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_SIMULCAST_FORWARDER_H */
@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_TEMPORAL_LAYER_FILTER_H
+#define RTC_TEMPORAL_LAYER_FILTER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <array>
+#include <chrono>
+#include <mutex>
+
+namespace rtc {
+
+/// Drops whole frames of the upper temporal layers of a video forwarded to a subscriber whose
+/// bandwidth does not allow all of them, typically in an SFU after a SimulcastForwarder
+/// Temporal layers are read from the dependency descriptor if its extension ID is set, from the
+/// payload descriptor for VP8 and VP9, and from SVC prefix NAL units for H264. Frames which are not
+/// references, i.e. H264 frames with nal_ref_idc 0 or VP8 frames with the N bit, are put above the
+/// base layer when no layer is signaled, so they are dropped first. Sequence numbers are rewritten
+/// to hide dropped frames, so the subscriber neither requests them nor a keyframe. Upper layers are
+/// restored at a base layer frame or a switching point, as following frames don't reference the
+/// frames dropped before.
+class RTC_CPP_EXPORT TemporalLayerFilter final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+
+	enum class Codec { H264, VP8, VP9 };
+
+	static const uint8_t MaxLayers = 8;
+
+	/// @param codec Codec of the forwarded video
+	TemporalLayerFilter(Codec codec);
+
+	/// Sets the ID of the dependency descriptor header extension, which takes precedence over the
+	/// payload descriptor when present
+	void setDependencyDescriptorExtensionId(uint8_t id);
+
+	/// Sets the bitrate available towards the subscriber, typically from Track::onTargetBitrate()
+	/// @param bitrate Bitrate in bits per second, 0 forwards all layers
+	void setTargetBitrate(unsigned int bitrate);
+
+	/// Caps the forwarded layers regardless of the bitrate, nullopt removes the cap
+	void setMaxLayer(optional<uint8_t> layer);
+
+	/// Returns the highest forwarded layer
+	uint8_t forwardedLayer() const;
+
+	/// Returns the number of frames dropped so far
+	uint64_t droppedFrames() const;
+
+	/// Drops the frames of the layers over the selected one
+	/// @param messages RTP packets
+	/// @param control RTCP
+	/// @returns Forwarded RTP packets with rewritten sequence numbers, and RTCP
+	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+	                                                    message_ptr control) override;
+
+private:
+	struct FrameInfo {
+		uint8_t layer = 0;
+		bool switchingPoint = false; // upper layers may be restored from this frame
+	};
+
+	struct Frame {
+		uint32_t timestamp = 0;
+		uint8_t layer = 0;
+		bool dropped = false;
+		uint16_t seqOffset = 0;
+	};
+
+	optional<FrameInfo> parse(const binary &packet);
+	optional<FrameInfo> parseDependencyDescriptor(const binary &packet);
+	optional<FrameInfo> parseH264(const uint8_t *payload, const uint8_t *end) const;
+	optional<FrameInfo> parseVP8(const uint8_t *payload, const uint8_t *end) const;
+	optional<FrameInfo> parseVP9(const uint8_t *payload, const uint8_t *end) const;
+	uint8_t select() const;
+	void updateBitrates(clock::time_point now);
+	void startFrame(const binary &packet, uint32_t timestamp, uint16_t seq);
+
+	const Codec codec;
+	uint8_t dependencyDescriptorId = 0;
+	std::array<uint8_t, 64> templateLayers = {}; // temporal IDs by template ID, from the structure
+	bool hasTemplates = false;
+
+	unsigned int targetBitrate = 0;
+	optional<uint8_t> maxLayer;
+	std::array<size_t, MaxLayers> layerBytes = {};    // in the current window
+	std::array<double, MaxLayers> layerBitrates = {}; // bits per second, 0 until measured
+	clock::time_point windowStart;
+
+	uint8_t layer = MaxLayers - 1; // highest forwarded layer
+	std::array<Frame, 16> frames;  // recent frames, for reordered packets
+	size_t frameCount = 0;
+	bool forwarded = false; // at least one packet was forwarded
+	uint16_t lastSeq = 0;   // last forwarded, rewritten
+	uint16_t seqOffset = 0;
+	uint64_t dropped = 0;
+	mutable std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_TEMPORAL_LAYER_FILTER_H */
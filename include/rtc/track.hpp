@@ -24,6 +24,9 @@
 #include "description.hpp"
 #include "mediahandler.hpp"
 
+#include <chrono>
+#include <functional>
+
 namespace rtc {
 
 namespace impl {
@@ -32,8 +35,48 @@ class Track;
 
 } // namespace impl
 
+// Statistics of an RTP stream of a track, identified by its SSRC
+struct RtpStreamStats {
+	uint32_t ssrc = 0;
+
+	// Sending, retransmissions on the associated RTX stream are counted separately
+	uint64_t packetsSent = 0;
+	uint64_t bytesSent = 0; // including headers
+	uint64_t retransmittedPackets = 0;
+	uint64_t retransmittedBytes = 0;
+	uint64_t nacksReceived = 0;
+	uint64_t keyframeRequestsReceived = 0; // PLI or FIR
+	unsigned int bitrateSent = 0;          // in bits per second, since the previous call
+
+	// Receiving
+	uint64_t packetsReceived = 0;
+	uint64_t bytesReceived = 0; // including headers
+	uint64_t nacksSent = 0;
+	uint64_t keyframeRequestsSent = 0;
+	unsigned int bitrateReceived = 0;
+
+	// Measured on reception, or reported by the remote receiver for a sent stream
+	int64_t packetsLost = 0;
+	double jitter = 0; // in seconds
+
+	// Round-trip time from receiver reports, sent streams only
+	optional<std::chrono::milliseconds> rtt;
+};
+
 class RTC_CPP_EXPORT Track final : private CheshireCat<impl::Track>, public Channel {
 public:
+	// Rewriting applied to RTP packets relayed with forwardTo()
+	struct ForwardingRules {
+		optional<uint32_t> ssrc;                // replaces the SSRC if set
+		optional<uint8_t> payloadType;          // replaces the payload type if set
+		optional<uint16_t> firstSequenceNumber; // renumbers packets from this value if set
+		// For upper simulcast layers, see OverloadLevel. Whole frames are skipped and forwarding
+		// resumes on a keyframe requested from this track.
+		bool pauseOnOverload = false;
+		// Returns true if the RTP packet starts a keyframe, H264 if not set
+		std::function<bool(const binary &packet)> isKeyframe;
+	};
+
 	Track(impl_ptr<impl::Track> impl);
 	~Track() = default;
 
@@ -47,15 +90,46 @@ public:
 	bool send(message_variant data) override;
 	bool send(const byte *data, size_t size) override;
 
+	// Send several messages at once, typically the RTP packets of a frame when the application
+	// packetizes itself. Messages go through the media handler one by one, then all resulting
+	// packets are protected and sent as a single batch.
+	bool sendBatch(std::vector<binary> messages);
+
 	bool isOpen(void) const override;
 	bool isClosed(void) const override;
 	size_t maxMessageSize() const override;
 
 	bool requestKeyframe();
 
+	// Statistics of the RTP streams sent and received on the track
+	std::vector<RtpStreamStats> stats() const;
+	optional<RtpStreamStats> stats(uint32_t ssrc) const;
+
+	// Called when the media handler estimates a new target bitrate for sending, in bits per second
+	void onTargetBitrate(std::function<void(unsigned int bitrate)> callback);
+
 	void setMediaHandler(shared_ptr<MediaHandler> handler);
 	shared_ptr<MediaHandler> getMediaHandler();
 
+	// Relay incoming RTP packets directly to the SRTP transport of the target track, bypassing
+	// the media handler of the target. While forwarding, RTP packets are not delivered to
+	// onMessage but are still seen by the media handler of this track for RTCP feedback.
+	// Targets share the payload of each packet until they protect it, so the media handler of
+	// this track must not modify forwarded packets in place. RTX packets are relayed as the
+	// original packets, with the original SSRC from the FID group of the description if the rules
+	// do not set one.
+	void forwardTo(shared_ptr<Track> target, ForwardingRules rules);
+	void forwardTo(shared_ptr<Track> target); // default rules
+	void stopForwarding(shared_ptr<Track> target);
+
+	// Differentiated Services Code Point of outgoing packets, including forwarded ones, 0 restores
+	// the default value, which is EF (46) for audio and AF42 (36) for video
+	unsigned int dscp() const;
+	void setDscp(unsigned int dscp);
+
+	// Limit in bytes on the packets waiting to be received, the oldest are dropped when exceeded
+	void setReceiveQueueLimit(optional<size_t> amount);
+
 	// Deprecated, use setMediaHandler() and getMediaHandler()
 	inline void setRtcpHandler(shared_ptr<MediaHandler> handler) { setMediaHandler(handler); }
 	inline shared_ptr<MediaHandler> getRtcpHandler() { return getMediaHandler(); }
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_TRAFFIC_CAPTURE_H
+#define RTC_TRAFFIC_CAPTURE_H
+
+#include "common.hpp"
+
+#include <chrono>
+#include <vector>
+
+namespace rtc {
+
+/// Reads a capture of the decrypted traffic of a PeerConnection, see Configuration::capturePath
+/// Records are SCTP packets after DTLS, and RTP and RTCP packets after SRTP, so a capture contains
+/// the application data in clear and must be handled accordingly.
+///
+/// File format, integers are in network byte order:
+/// - Capture: "RTCCAP01", start time (64-bit, microseconds since epoch), then chunks
+/// - Chunk: "CCHK", payload size (32-bit), records count (32-bit), then records
+/// - Record: time since start (64-bit, microseconds), type (8-bit), size (32-bit), then data
+/// The type is the Type value, with the high bit set for outgoing packets.
+class RTC_CPP_EXPORT TrafficCapture final {
+public:
+	enum class Type : uint8_t { Sctp = 0, Rtp = 1, Rtcp = 2 };
+
+	struct Record {
+		std::chrono::microseconds time; // since the start of the capture
+		Type type;
+		bool outgoing;
+		binary data;
+	};
+
+	// User message reassembled from the DATA or I-DATA chunks of SCTP packets
+	struct SctpMessage {
+		std::chrono::microseconds time; // of the packet completing the message
+		uint16_t stream;
+		uint32_t ppid;
+		bool unordered;
+		binary data;
+	};
+
+	/// Reads a whole capture, a truncated last chunk is ignored
+	/// @param path Path of the capture
+	TrafficCapture(const string &path);
+
+	const std::vector<Record> &records() const { return mRecords; }
+
+	/// Time of the last record, relative to the start of the capture
+	std::chrono::microseconds duration() const;
+
+	/// Reassembles the user messages carried by the SCTP packets of a direction, in DATA chunks or
+	/// in I-DATA chunks when message interleaving (RFC 8260) is negotiated, which is the default
+	/// between libdatachannel peers. Retransmitted chunks are ignored, and messages are sorted by
+	/// time.
+	std::vector<SctpMessage> sctpMessages(bool outgoing = false) const;
+
+private:
+	std::vector<Record> mRecords;
+};
+
+} // namespace rtc
+
+#endif /* RTC_TRAFFIC_CAPTURE_H */
@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_TWCC_BANDWIDTH_ESTIMATOR_H
+#define RTC_TWCC_BANDWIDTH_ESTIMATOR_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace rtc {
+
+/// Send-side bandwidth estimation from transport-wide congestion control feedback
+/// The delay-based estimate detects overuse from the trend of the one-way delay variation and
+/// adapts the bitrate with additive-increase multiplicative-decrease, while the loss-based
+/// estimate backs off on heavy loss. The target bitrate is the minimum of both.
+/// If media packets are ECN-capable (see Configuration::mediaEcn) and the remote sends RFC 8888
+/// congestion control feedback, Congestion Experienced marks decrease the delay-based estimate,
+/// like loss for classic ECN, or in proportion to the marked fraction for L4S.
+/// With probing enabled, clusters of padding packets are sent at a multiple of the target bitrate
+/// after the first media packets and on request, and the rate at which a cluster is received
+/// raises the delay-based estimate, so it ramps up in a few round trips instead of seconds. The
+/// element should be the last of the chain so padding packets are not seen by other elements, and
+/// media pacing (see Configuration::enableMediaPacing) should be enabled to spread clusters.
+class RTC_CPP_EXPORT TwccBandwidthEstimator final : public MediaHandlerElement {
+public:
+	using clock = std::chrono::steady_clock;
+
+	static const unsigned int defaultInitialBitrate = 300000;
+	static const unsigned int defaultMinBitrate = 30000;
+	static const unsigned int defaultMaxBitrate = 10000000;
+
+	/// @param extensionId RTP header extension ID of the transport-wide sequence number
+	/// @param initialBitrate Bitrate used before it is estimated, in bits per second
+	/// @param minBitrate Minimum target bitrate, in bits per second
+	/// @param maxBitrate Maximum target bitrate, in bits per second
+	TwccBandwidthEstimator(uint8_t extensionId, unsigned int initialBitrate = defaultInitialBitrate,
+	                       unsigned int minBitrate = defaultMinBitrate,
+	                       unsigned int maxBitrate = defaultMaxBitrate);
+
+	/// Updates the estimation from RTCP transport-wide feedback and congestion control feedback
+	/// @param message RTCP message
+	/// @returns Unchanged RTCP message
+	ChainedIncomingControlProduct processIncomingControlMessage(message_ptr message) override;
+
+	/// Records sizes and provisional send times of RTP packets
+	/// @param messages RTP packets
+	/// @param control RTCP
+	/// @returns Unchanged RTP and RTCP
+	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+	                                                    message_ptr control) override;
+
+	/// Records the actual send time of an RTP packet, once released by the pacer
+	/// @param message RTP packet
+	void processSentBinaryMessage(const message_ptr &message) override;
+
+	/// Returns the current target bitrate in bits per second
+	unsigned int targetBitrate() const;
+
+	/// Enables probe clusters of padding-only packets
+	/// @param ssrc SSRC of padding packets, typically the one of the RTX stream
+	/// @param payloadType Payload type of padding packets, typically the RTX payload type
+	/// @param transportSequenceNumber Transport-wide sequence number counter shared with the
+	/// packetizers, see RtpPacketizationConfig::transportSequenceNumber
+	void enableProbing(SSRC ssrc, uint8_t payloadType,
+	                   shared_ptr<std::atomic<uint16_t>> transportSequenceNumber);
+
+	/// Requests a probe cluster, for instance when a layer is enabled
+	/// The cluster is sent with the next outgoing media packets.
+	/// @param bitrate Bitrate of the cluster in bits per second
+	void probe(unsigned int bitrate);
+
+private:
+	static const size_t HistorySize = 8192;
+	static const size_t TrendlineWindowSize = 20;
+	static const size_t MaxProbeClusters = 4;
+
+	enum class Usage { Normal, Overusing, Underusing };
+
+	struct SentPacket {
+		bool valid = false;
+		uint16_t seq = 0;
+		int64_t time = 0; // us
+		size_t size = 0;
+		int cluster = -1; // probe cluster id
+	};
+
+	struct PacketResult {
+		int64_t sendTime;    // us
+		int64_t arrivalTime; // us
+		size_t size;
+		int cluster;
+	};
+
+	struct Probing {
+		SSRC ssrc;
+		uint8_t payloadType;
+		shared_ptr<std::atomic<uint16_t>> transportSequenceNumber;
+		uint16_t sequenceNumber;
+		bool started = false;
+	};
+
+	struct ProbeCluster {
+		int id;
+		double bitrate;
+		int64_t sendTime; // us
+		size_t sentCount = 0;
+		size_t receivedCount = 0;
+		size_t receivedBytes = 0;
+		int64_t firstArrivalTime = 0; // us
+		int64_t lastArrivalTime = 0;  // us
+		size_t lastSize = 0;          // size of the last packet to arrive
+	};
+
+	struct PacketGroup {
+		bool valid = false;
+		int64_t firstSendTime = 0;
+		int64_t lastSendTime = 0;
+		int64_t lastArrivalTime = 0;
+	};
+
+	void processFeedback(const RtcpTwcc *twcc, int64_t now);
+	void processCongestionFeedback(const uint8_t *data, size_t size, int64_t now);
+	void updateDelayBased(const std::vector<PacketResult> &results, int64_t now);
+	void updateTrendline(double delta, double sendDelta, int64_t arrivalTime);
+	void updateLossBased(size_t lost, size_t total);
+	void updateEcnBased(size_t marked, size_t total, bool scalable, int64_t now);
+	void updateAckedBitrate(const std::vector<PacketResult> &results);
+	void updateProbes(const std::vector<PacketResult> &results, int64_t now);
+	void sendProbe(double bitrate, uint32_t timestamp, int64_t now, std::vector<binary_ptr> &out);
+
+	const uint8_t extensionId;
+	const double minBitrate;
+	const double maxBitrate;
+	const clock::time_point start;
+
+	std::vector<SentPacket> history;
+
+	// Inter-arrival
+	PacketGroup currentGroup;
+	PacketGroup previousGroup;
+
+	// Trendline filter
+	double accumulatedDelay = 0;
+	double smoothedDelay = 0;
+	size_t deltaCount = 0;
+	std::deque<std::pair<double, double>> trendline; // arrival time and smoothed delay in ms
+	optional<int64_t> firstArrivalTime;
+
+	// Overuse detector
+	double threshold = 12.5;
+	double previousTrend = 0;
+	double timeOverUsing = -1;
+	int overuseCounter = 0;
+	optional<int64_t> lastThresholdUpdate;
+	Usage usage = Usage::Normal;
+
+	// Acked bitrate
+	std::deque<std::pair<int64_t, size_t>> acked; // arrival time and size
+	size_t ackedBytes = 0;
+	optional<double> ackedBitrate;
+
+	// Loss
+	size_t lostCount = 0;
+	size_t totalCount = 0;
+
+	// Explicit Congestion Notification
+	double markedFraction = 0; // moving average for L4S
+
+	// Probing
+	optional<Probing> probing;
+	std::vector<double> pendingProbes; // bitrates of clusters to send
+	std::deque<ProbeCluster> clusters; // sent clusters waiting for feedback
+	int nextClusterId = 0;
+	optional<double> probeBitrate; // result of the last successful probe
+
+	double delayBitrate;
+	double lossBitrate;
+	optional<int64_t> lastUpdate;
+	optional<int64_t> lastDecrease;
+	unsigned int currentTarget;
+
+	mutable std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_TWCC_BANDWIDTH_ESTIMATOR_H */
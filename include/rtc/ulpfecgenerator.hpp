@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_ULPFEC_GENERATOR_H
+#define RTC_ULPFEC_GENERATOR_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <mutex>
+
+namespace rtc {
+
+/// Generates XOR forward error correction packets (RFC 5109) for outgoing RTP packets
+/// A FEC packet protects a group of consecutive packets and allows to recover any single packet of
+/// the group. A group ends after the number of packets given by the protection ratio, or at the
+/// end of a frame. FEC packets are inserted in the stream, so sequence numbers are rewritten. The
+/// element should follow the packetizer, typically followed by an RtpRedEncoder without
+/// redundancy to carry FEC packets the way browsers expect.
+class RTC_CPP_EXPORT UlpfecGenerator final : public MediaHandlerElement {
+public:
+	/// @param payloadType ULPFEC payload type
+	/// @param protectionRatio Number of FEC packets per media packet, in ]0, 1], at least one FEC
+	/// packet is sent for every 16 packets
+	UlpfecGenerator(uint8_t payloadType, double protectionRatio = 0.25);
+
+	/// Sets the protection ratio, for instance from the loss rate reported by the receiver
+	void setProtectionRatio(double protectionRatio);
+
+	/// Adds FEC packets
+	/// @param messages RTP packets, in sequence order
+	/// @param control RTCP
+	/// @returns RTP packets followed by FEC packets for each complete group, and RTCP
+	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+	                                                    message_ptr control) override;
+
+private:
+	// XOR of the packets protected by the next FEC packet, computed as they are sent
+	struct Group {
+		size_t count = 0;
+		uint16_t base = 0; // first sequence number
+		uint16_t mask = 0;
+		uint8_t first = 0;  // P, X, and CC
+		uint8_t second = 0; // M and PT
+		uint32_t timestamp = 0;
+		uint16_t length = 0;
+		binary payload;
+	};
+
+	void protect(const binary &packet);
+	binary_ptr generate(const RtpHeader *last);
+
+	const uint8_t payloadType;
+
+	size_t groupSize;
+	Group group;
+	uint16_t seqOffset = 0; // number of FEC packets sent
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_ULPFEC_GENERATOR_H */
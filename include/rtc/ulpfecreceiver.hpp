@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_ULPFEC_RECEIVER_H
+#define RTC_ULPFEC_RECEIVER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerelement.hpp"
+
+#include <array>
+#include <mutex>
+
+namespace rtc {
+
+/// Recovers lost RTP packets from incoming XOR forward error correction packets (RFC 5109)
+/// FEC packets are removed from the stream. When exactly one packet protected by a FEC packet is
+/// missing, it is recovered and inserted in the stream. The element should be placed in front of
+/// the depacketizer, after an RtpRedDecoder if FEC is carried in RED.
+class RTC_CPP_EXPORT UlpfecReceiver final : public MediaHandlerElement {
+public:
+	/// @param payloadType ULPFEC payload type
+	UlpfecReceiver(uint8_t payloadType);
+
+	/// Recovers lost packets
+	/// @param messages RTP packets, including FEC packets
+	/// @returns RTP packets, with recovered packets in place of FEC packets
+	ChainedIncomingProduct processIncomingBinaryMessage(ChainedMessagesProduct messages) override;
+
+private:
+	static const size_t HistorySize = 64; // must be a power of two
+
+	binary_ptr recover(const binary &fec);
+	void store(binary_ptr packet);
+	binary_ptr find(SSRC ssrc, uint16_t seq) const;
+
+	const uint8_t payloadType;
+
+	std::array<binary_ptr, HistorySize> history; // recent packets by sequence number
+	std::mutex mutex;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_ULPFEC_RECEIVER_H */
@@ -19,10 +19,12 @@
 #ifndef RTC_UTILS_H
 #define RTC_UTILS_H
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <thread>
 #include <tuple>
 #include <utility>
 
@@ -60,6 +62,9 @@ private:
 };
 
 // callback with built-in synchronization
+// Invocation is lock-free: the callback is swapped atomically and never called under a lock, so
+// concurrent invocations don't serialize. Reassignment waits for calls of the previous callback
+// in progress on other threads, hence it is not called anymore once the assignment returns.
 template <typename... Args> class synchronized_callback {
 public:
 	synchronized_callback() = default;
@@ -69,51 +74,102 @@ public:
 	virtual ~synchronized_callback() { *this = nullptr; }
 
 	synchronized_callback &operator=(synchronized_callback &&cb) {
-		std::scoped_lock lock(mutex, cb.mutex);
-		set(std::exchange(cb.callback, nullptr));
+		auto holder = std::atomic_exchange(&cb.callback, shared_ptr_type{});
+		set(holder ? holder->func : nullptr);
+		if (holder)
+			holder->wait();
+
 		return *this;
 	}
 
 	synchronized_callback &operator=(const synchronized_callback &cb) {
-		std::scoped_lock lock(mutex, cb.mutex);
-		set(cb.callback);
+		auto holder = std::atomic_load(&cb.callback);
+		set(holder ? holder->func : nullptr);
 		return *this;
 	}
 
 	synchronized_callback &operator=(std::function<void(Args...)> func) {
-		std::lock_guard lock(mutex);
 		set(std::move(func));
 		return *this;
 	}
 
-	bool operator()(Args... args) const {
-		std::lock_guard lock(mutex);
-		return call(std::move(args)...);
-	}
+	bool operator()(Args... args) const { return call(std::move(args)...); }
 
-	operator bool() const {
-		std::lock_guard lock(mutex);
-		return callback ? true : false;
-	}
+	operator bool() const { return std::atomic_load(&callback) ? true : false; }
 
 	std::function<void(Args...)> wrap() const {
 		return [this](Args... args) { (*this)(std::move(args)...); };
 	}
 
 protected:
-	virtual void set(std::function<void(Args...)> func) { callback = std::move(func); }
-	virtual bool call(Args... args) const {
-		if (!callback)
-			return false;
+	virtual void set(std::function<void(Args...)> func) {
+		auto holder = func ? std::make_shared<const Holder>(std::move(func)) : nullptr;
+		if (auto previous = std::atomic_exchange(&callback, std::move(holder)))
+			previous->wait();
+	}
 
-		callback(std::move(args)...);
-		return true;
+	virtual bool call(Args... args) const {
+		auto holder = std::atomic_load(&callback);
+		while (holder) {
+			shared_ptr_type current;
+			{
+				// The invocation must be registered before checking the callback is still current,
+				// otherwise a concurrent reassignment could return before the call starts
+				Invocation invocation(holder.get());
+				current = std::atomic_load(&callback);
+				if (current == holder) {
+					holder->func(std::move(args)...);
+					return true;
+				}
+			}
+
+			// The callback was replaced meanwhile, call the new one so the call is not lost
+			holder = std::move(current);
+		}
+		return false;
 	}
 
-	std::function<void(Args...)> callback;
-	mutable std::recursive_mutex mutex;
+private:
+	struct Holder {
+		Holder(std::function<void(Args...)> f) : func(std::move(f)) {}
+		void wait() const;
+
+		const std::function<void(Args...)> func;
+		mutable std::atomic<size_t> calls = 0; // in progress
+	};
+
+	// Calls in progress on the current thread, to allow reassignment from the callback itself
+	struct Invocation {
+		Invocation(const Holder *h) : holder(h), previous(Current) {
+			holder->calls.fetch_add(1, std::memory_order_seq_cst);
+			Current = this;
+		}
+		~Invocation() {
+			Current = previous;
+			holder->calls.fetch_sub(1, std::memory_order_release);
+		}
+
+		const Holder *const holder;
+		const Invocation *const previous;
+
+		inline static thread_local const Invocation *Current = nullptr;
+	};
+
+	using shared_ptr_type = std::shared_ptr<const Holder>;
+
+	shared_ptr_type callback;
 };
 
+template <typename... Args> void synchronized_callback<Args...>::Holder::wait() const {
+	size_t own = 0;
+	for (auto *i = Invocation::Current; i; i = i->previous)
+		if (i->holder == this)
+			++own;
+
+	while (calls.load(std::memory_order_seq_cst) > own)
+		std::this_thread::yield();
+}
+
 // callback with built-in synchronization and replay of the last missed call
 template <typename... Args>
 class synchronized_stored_callback final : public synchronized_callback<Args...> {
@@ -123,8 +179,19 @@ public:
 	    : synchronized_callback<Args...>(std::forward<CArgs>(cargs)...) {}
 	~synchronized_stored_callback() {}
 
+	synchronized_stored_callback &operator=(synchronized_stored_callback &&cb) {
+		synchronized_callback<Args...>::operator=(std::move(cb));
+		return *this;
+	}
+
+	synchronized_stored_callback &operator=(const synchronized_stored_callback &cb) {
+		synchronized_callback<Args...>::operator=(cb);
+		return *this;
+	}
+
 private:
 	void set(std::function<void(Args...)> func) {
+		std::lock_guard lock(mutex);
 		synchronized_callback<Args...>::set(func);
 		if (func && stored) {
 			std::apply(func, std::move(*stored));
@@ -133,6 +200,11 @@ private:
 	}
 
 	bool call(Args... args) const {
+		if (synchronized_callback<Args...>::call(args...))
+			return true;
+
+		// Slow path, the callback might have been set concurrently
+		std::lock_guard lock(mutex);
 		if (!synchronized_callback<Args...>::call(args...))
 			stored.emplace(std::move(args)...);
 
@@ -140,6 +212,7 @@ private:
 	}
 
 	mutable std::optional<std::tuple<Args...>> stored;
+	mutable std::recursive_mutex mutex;
 };
 
 // pimpl base class
@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_VP8_PACKETIZATION_HANDLER_H
+#define RTC_VP8_PACKETIZATION_HANDLER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediachainablehandler.hpp"
+#include "vp8rtppacketizer.hpp"
+
+namespace rtc {
+
+/// Handler for VP8 packetization
+class RTC_CPP_EXPORT VP8PacketizationHandler final : public MediaChainableHandler {
+public:
+	/// Construct handler for VP8 packetization.
+	/// @param packetizer RTP packetizer for VP8
+	VP8PacketizationHandler(shared_ptr<VP8RtpPacketizer> packetizer);
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_VP8_PACKETIZATION_HANDLER_H */
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_VP9_RTP_PACKETIZER_H
+#define RTC_VP9_RTP_PACKETIZER_H
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediahandlerrootelement.hpp"
+#include "nalunit.hpp"
+#include "rtppacketizer.hpp"
+
+#include <mutex>
+
+namespace rtc {
+
+/// RTP packetization of VP9 payload (RFC 9628)
+/// Messages are encoded pictures. With several spatial layers, a message is a superframe holding
+/// one frame per spatial layer in increasing order, and each frame is packetized separately. The
+/// payload descriptor carries a 15-bit picture ID and B and E bits at frame boundaries. Layer
+/// indices in non-flexible mode, so a forwarder can drop layers without decoding, are only sent
+/// for pictures the encoder described with setPictureLayers(), and key frames described this way
+/// carry the scalability structure.
+class RTC_CPP_EXPORT VP9RtpPacketizer final : public RtpPacketizer,
+                                              public MediaHandlerRootElement {
+public:
+	/// Layers of a picture, as decided by the encoder
+	struct PictureLayers {
+		uint8_t temporalId = 0;
+		bool switchingUp = false;          // U: upper temporal layers may be switched to
+		uint8_t firstSpatialId = 0;        // of the first frame, next ones are the next layers
+		bool interLayerDependency = false; // D: upper spatial layers depend on the layer below
+	};
+
+private:
+	const uint16_t maximumPayloadSize;
+	const uint8_t spatialLayers;
+	const uint8_t temporalLayers;
+	uint16_t pictureId;
+	uint8_t tl0PicIdx = 0;
+	std::mutex layersMutex;
+	optional<PictureLayers> nextLayers;
+
+public:
+	/// Default clock rate for VP9 in RTP
+	inline static const uint32_t defaultClockRate = 90 * 1000;
+
+	/// Constructs VP9 payload packetizer with given RTP configuration.
+	/// @note RTP configuration is used in packetization process which may change some configuration
+	/// properties such as sequence number.
+	/// @param rtpConfig  RTP configuration
+	/// @param maximumPayloadSize maximum size of one RTP payload, including the descriptor
+	/// @param spatialLayers number of spatial layers, from 1 to 8
+	/// @param temporalLayers number of temporal layers, from 1 to 8
+	VP9RtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig,
+	                 uint16_t maximumPayloadSize = NalUnits::defaultMaximumFragmentSize,
+	                 uint8_t spatialLayers = 1, uint8_t temporalLayers = 1);
+
+	/// Sets the layers of the next picture to be sent, layer indices are omitted otherwise
+	void setPictureLayers(PictureLayers layers);
+
+	ChainedOutgoingProduct processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+	                                                    message_ptr control) override;
+};
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif /* RTC_VP9_RTP_PACKETIZER_H */
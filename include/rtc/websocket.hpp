@@ -24,6 +24,8 @@
 #include "channel.hpp"
 #include "common.hpp"
 
+#include <chrono>
+
 namespace rtc {
 
 namespace impl {
@@ -41,9 +43,27 @@ public:
 		Closed = 3,
 	};
 
+	// permessage-deflate compression extension (RFC 7692), requires zlib
+	struct DeflateConfiguration {
+		bool noContextTakeover = false;       // reset compression after each sent message
+		bool remoteNoContextTakeover = false; // request the remote peer to do the same
+		int maxWindowBits = 15;               // window size for sent messages, from 9 to 15
+		int remoteMaxWindowBits = 15;         // window size requested from the remote peer
+	};
+
 	struct Configuration {
 		bool disableTlsVerification = false; // if true, don't verify the TLS certificate
 		std::vector<string> protocols;
+		optional<DeflateConfiguration> deflate; // no compression if unset
+		optional<std::chrono::milliseconds> pingInterval; // ping when idle, default 10s, 0 disables
+		bool kernelTls = false; // offload TLS 1.2 AEAD encryption to the kernel (Linux)
+		// The connection is closed with status 1009 if exceeded, the message limit defaults to
+		// 65536 bytes and applies after decompression
+		optional<size_t> maxIncomingMessageSize;
+		optional<size_t> maxIncomingFrameSize;
+		// If true, wss:// WebSockets to the same server share one HTTP/2 connection (RFC 8441),
+		// falling back to a connection of their own if the server does not support it
+		bool http2 = false;
 	};
 
 	WebSocket();
@@ -65,6 +85,17 @@ public:
 	optional<string> remoteAddress() const;
 	optional<string> path() const;
 
+	// Streaming receive: if set before the WebSocket is open, uncompressed binary messages are not
+	// reassembled but passed to the callback fragment by fragment as they arrive instead of being
+	// delivered as messages, last is true for the final fragment of each message.
+	void onFragment(std::function<void(binary data, bool last)> callback);
+
+	// Send the same message to many WebSockets, typically clients of a WebSocketServer
+	// The frame is built once and shared by clients without compression, WebSockets which are not
+	// open are skipped. Returns the number of WebSockets the message was sent to.
+	static size_t Broadcast(const std::vector<shared_ptr<WebSocket>> &webSockets,
+	                        message_variant data);
+
 private:
 	using CheshireCat<impl::WebSocket>::impl;
 };
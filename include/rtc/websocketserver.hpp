@@ -40,6 +40,14 @@ public:
 		optional<string> certificatePemFile;
 		optional<string> keyPemFile;
 		optional<string> keyPemPass;
+		optional<WebSocket::DeflateConfiguration> deflate; // accepted from clients if set
+		optional<std::chrono::milliseconds> pingInterval;  // for clients, see WebSocket
+		bool kernelTls = false;                            // for clients, see WebSocket
+		optional<size_t> maxIncomingMessageSize;           // same
+		optional<size_t> maxIncomingFrameSize;             // same
+		optional<int> backlog;                             // listen backlog, system max if unset
+		optional<size_t> maxPendingHandshakes;             // further connections are refused
+		bool reusePort = false; // let other servers and processes listen on the same port
 	};
 
 	WebSocketServer();
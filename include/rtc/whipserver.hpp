@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_WHIP_SERVER_H
+#define RTC_WHIP_SERVER_H
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "common.hpp"
+#include "configuration.hpp"
+#include "description.hpp"
+#include "peerconnection.hpp"
+
+#include <chrono>
+#include <functional>
+
+namespace rtc {
+
+namespace impl {
+
+struct WhipServer;
+
+}
+
+/// Lightweight HTTP server for WebRTC ingest (WHIP, RFC 9725) and playback (WHEP)
+/// Clients post an SDP offer and get the answer with gathered candidates in the response, so a
+/// session is set up in a single round trip. Sessions are deleted with DELETE on the URL in the
+/// Location header, and trickled candidates are accepted with PATCH.
+class RTC_CPP_EXPORT WhipServer final : private CheshireCat<impl::WhipServer> {
+public:
+	enum class Kind {
+		Whip, // ingest, the client sends media
+		Whep  // playback, the client receives media
+	};
+
+	struct Configuration {
+		uint16_t port = 8080;
+		bool enableTls = false;
+		optional<string> certificatePemFile;
+		optional<string> keyPemFile;
+		optional<string> keyPemPass;
+		string whipPath = "/whip";
+		string whepPath = "/whep";
+		rtc::Configuration peerConfiguration; // for the PeerConnections of sessions
+		// The answer is sent with the candidates gathered so far after this delay
+		std::chrono::milliseconds gatheringTimeout{2000};
+		optional<size_t> maxSessions; // further offers are refused with 503
+		optional<int> backlog;        // listen backlog, system max if unset
+		bool reusePort = false;       // let other servers and processes listen on the same port
+	};
+
+	struct Session {
+		Kind kind;
+		string id;                      // last segment of the session URL
+		string path;                    // request target of the offer
+		optional<string> authorization; // Authorization header, usually "Bearer <token>"
+		Description offer;
+		shared_ptr<PeerConnection> peerConnection;
+	};
+
+	WhipServer();
+	WhipServer(Configuration config);
+	~WhipServer();
+
+	void stop();
+
+	uint16_t port() const;
+
+	/// Called for each offer before it is set as remote description, so tracks can be received
+	/// with PeerConnection::onTrack(). For WHEP, media is sent on the tracks created for the
+	/// offered media. Returning false rejects the offer with 403 Forbidden.
+	/// The server uses the gathering state callback of the PeerConnection.
+	void onSession(std::function<bool(Session &session)> callback);
+
+private:
+	using CheshireCat<impl::WhipServer>::impl;
+};
+
+} // namespace rtc
+
+#endif
+
+#endif
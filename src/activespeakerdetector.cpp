@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "activespeakerdetector.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+const double SilenceLevel = 127;           // in -dBov
+const double SmoothingFactor = 0.15;       // weight of each new level
+const double MinDominantLoudness = 20;     // quieter speakers are considered silent
+const double SwitchMargin = 6;             // in dB
+const auto SwitchInterval = std::chrono::milliseconds(500);
+const auto ActivityTimeout = std::chrono::seconds(1); // no packets means silence with DTX
+
+} // namespace
+
+ActiveSpeakerDetector::ActiveSpeakerDetector(uint8_t _extensionId,
+                                             shared_ptr<ActiveSpeakerDetector> shareWith)
+    : MediaHandlerElement(), extensionId(_extensionId),
+      state(shareWith ? shareWith->state : std::make_shared<State>()) {}
+
+void ActiveSpeakerDetector::onDominantSpeaker(std::function<void(SSRC ssrc)> callback) {
+	state->dominantSpeakerCallback = std::move(callback);
+}
+
+optional<SSRC> ActiveSpeakerDetector::dominantSpeaker() const {
+	std::lock_guard lock(state->mutex);
+	return state->dominant;
+}
+
+std::vector<SSRC> ActiveSpeakerDetector::loudestSpeakers(size_t count) const {
+	std::vector<std::pair<double, SSRC>> active;
+	{
+		std::lock_guard lock(state->mutex);
+		const auto now = clock::now();
+		active.reserve(state->speakers.size());
+		for (const auto &[ssrc, speaker] : state->speakers)
+			if (double loudness = state->loudness(speaker, now); loudness >= MinDominantLoudness)
+				active.emplace_back(loudness, ssrc);
+	}
+
+	count = std::min(count, active.size());
+	std::partial_sort(active.begin(), active.begin() + count, active.end(),
+	                  [](const auto &a, const auto &b) { return a.first > b.first; });
+
+	std::vector<SSRC> result;
+	result.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		result.push_back(active[i].second);
+
+	return result;
+}
+
+uint8_t ActiveSpeakerDetector::level(SSRC ssrc) const {
+	std::lock_guard lock(state->mutex);
+	auto it = state->speakers.find(ssrc);
+	if (it == state->speakers.end())
+		return uint8_t(SilenceLevel);
+
+	return uint8_t(SilenceLevel - state->loudness(it->second, clock::now()) + 0.5);
+}
+
+ChainedIncomingProduct
+ActiveSpeakerDetector::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	optional<SSRC> changed;
+	{
+		std::lock_guard lock(state->mutex);
+		const auto now = clock::now();
+		for (const auto &message : *messages) {
+			if (message->size() < RtpHeaderMinSize)
+				continue;
+
+			RtpExtensionIndex extensions(message->data(), message->size());
+			auto audioLevel = extensions.audioLevel(extensionId);
+			if (!audioLevel)
+				continue;
+
+			auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+			if (auto dominant = state->update(rtp->ssrc(), audioLevel->level, now))
+				changed = dominant;
+		}
+	}
+
+	if (changed)
+		state->dominantSpeakerCallback(*changed);
+
+	return {messages};
+}
+
+double ActiveSpeakerDetector::State::loudness(const Speaker &speaker,
+                                              clock::time_point now) const {
+	return now - speaker.lastUpdate <= ActivityTimeout ? speaker.loudness : 0;
+}
+
+optional<SSRC> ActiveSpeakerDetector::State::update(SSRC ssrc, uint8_t level,
+                                                    clock::time_point now) {
+	auto &speaker = speakers[ssrc];
+	const double value = SilenceLevel - std::min(double(level), SilenceLevel);
+	speaker.loudness = loudness(speaker, now) * (1 - SmoothingFactor) + value * SmoothingFactor;
+	speaker.lastUpdate = now;
+
+	if (dominant && *dominant == ssrc)
+		return nullopt;
+
+	if (speaker.loudness < MinDominantLoudness)
+		return nullopt;
+
+	// Switch only if the speaker is clearly louder than the current one, at most every interval
+	double current = 0;
+	if (auto it = dominant ? speakers.find(*dominant) : speakers.end(); it != speakers.end())
+		current = loudness(it->second, now);
+
+	const bool silent = current < MinDominantLoudness;
+	if (!silent && (speaker.loudness < current + SwitchMargin || now - lastSwitch < SwitchInterval))
+		return nullopt;
+
+	dominant = ssrc;
+	lastSwitch = now;
+	return dominant;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
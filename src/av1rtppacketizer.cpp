@@ -0,0 +1,294 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "av1rtppacketizer.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace rtc {
+
+namespace {
+
+// Aggregation header: Z (1 bit), Y (1 bit), W (2 bits), N (1 bit), reserved (3 bits)
+const uint8_t AggregationContinuesFirst = 0x80; // Z: first element continues an OBU fragment
+const uint8_t AggregationContinuesLast = 0x40;  // Y: last element continues in the next packet
+const uint8_t AggregationNewSequence = 0x08;    // N: first packet of a coded video sequence
+const int AggregationCountShift = 4;            // W: count of elements, 0 if all are prefixed
+const size_t AggregationMaxCount = 3;
+
+// OBU header: forbidden (1 bit), type (4 bits), extension flag (1 bit), has size field (1 bit)
+const uint8_t ObuExtensionFlag = 0x04;
+const uint8_t ObuHasSizeField = 0x02;
+
+enum ObuType : uint8_t {
+	ObuSequenceHeader = 1,
+	ObuTemporalDelimiter = 2,
+	ObuTileList = 8,
+	ObuPadding = 15,
+};
+
+// Dependency descriptor templates for a single spatial and temporal layer
+const uint8_t KeyFrameTemplateId = 0;
+const uint8_t DeltaFrameTemplateId = 1;
+
+struct ObuElement {
+	// The OBU header is rewritten without size field, which is replaced by the element length
+	std::array<byte, 2> header;
+	size_t headerSize;
+	const byte *payload;
+	size_t payloadSize;
+
+	size_t size() const { return headerSize + payloadSize; }
+
+	void copy(size_t offset, size_t length, byte *dest) const {
+		if (offset < headerSize) {
+			size_t len = std::min(length, headerSize - offset);
+			std::memcpy(dest, header.data() + offset, len);
+			dest += len;
+			length -= len;
+			offset = 0;
+		} else {
+			offset -= headerSize;
+		}
+		std::memcpy(dest, payload + offset, length);
+	}
+};
+
+struct PacketElement {
+	size_t index;
+	size_t offset;
+	size_t length;
+};
+
+size_t Leb128Size(size_t value) {
+	size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		++size;
+	}
+	return size;
+}
+
+byte *WriteLeb128(byte *data, size_t value) {
+	while (value >= 0x80) {
+		*data++ = byte(0x80 | (value & 0x7F));
+		value >>= 7;
+	}
+	*data++ = byte(value);
+	return data;
+}
+
+optional<size_t> ReadLeb128(const byte *&data, const byte *end) {
+	size_t value = 0;
+	for (int i = 0; i < 8 && data < end; ++i) {
+		uint8_t b = uint8_t(*data++);
+		value |= size_t(b & 0x7F) << (i * 7);
+		if (!(b & 0x80))
+			return value;
+	}
+	return nullopt;
+}
+
+// Parse a temporal unit, temporal delimiters, tile lists, and padding are dropped
+std::vector<ObuElement> ParseObus(const binary &message, bool &hasSequenceHeader) {
+	std::vector<ObuElement> obus;
+	const byte *data = message.data();
+	const byte *end = data + message.size();
+	while (data < end) {
+		const uint8_t header = uint8_t(data[0]);
+		ObuElement obu;
+		obu.headerSize = header & ObuExtensionFlag ? 2 : 1;
+		if (size_t(end - data) < obu.headerSize) {
+			LOG_WARNING << "Invalid OBU data (incomplete header), ignoring!";
+			break;
+		}
+		obu.header[0] = byte(header & ~ObuHasSizeField);
+		obu.header[1] = obu.headerSize > 1 ? data[1] : byte(0);
+
+		const byte *cur = data + obu.headerSize;
+		if (header & ObuHasSizeField) {
+			auto size = ReadLeb128(cur, end);
+			if (!size || *size > size_t(end - cur)) {
+				LOG_WARNING << "Invalid OBU data (incomplete unit), ignoring!";
+				break;
+			}
+			obu.payloadSize = *size;
+		} else {
+			obu.payloadSize = size_t(end - cur); // the OBU extends to the end of the data
+		}
+		obu.payload = cur;
+		data = cur + obu.payloadSize;
+
+		const uint8_t type = (header >> 3) & 0x0F;
+		if (type == ObuSequenceHeader)
+			hasSequenceHeader = true;
+
+		if (type != ObuTemporalDelimiter && type != ObuTileList && type != ObuPadding)
+			obus.push_back(obu);
+	}
+	return obus;
+}
+
+class BitWriter {
+public:
+	BitWriter(binary &data) : mData(data) {}
+
+	void write(uint32_t value, int bits) {
+		while (bits-- > 0) {
+			if (mBit % 8 == 0)
+				mData.push_back(byte(0));
+
+			if ((value >> bits) & 1)
+				mData.back() |= byte(0x80 >> (mBit % 8));
+
+			++mBit;
+		}
+	}
+
+private:
+	binary &mData;
+	size_t mBit = 0;
+};
+
+// See the Dependency Descriptor RTP Header Extension in the AV1 RTP payload format
+void WriteDependencyDescriptor(binary &data, bool startOfFrame, bool endOfFrame, bool keyFrame,
+                               bool withStructure, uint16_t frameNumber) {
+	data.clear();
+	BitWriter writer(data);
+	writer.write(startOfFrame, 1);
+	writer.write(endOfFrame, 1);
+	writer.write(keyFrame ? KeyFrameTemplateId : DeltaFrameTemplateId, 6);
+	writer.write(frameNumber, 16);
+	if (!withStructure)
+		return;
+
+	writer.write(1, 1); // template_dependency_structure_present_flag
+	writer.write(0, 4); // active_decode_targets_present_flag and custom flags
+	writer.write(KeyFrameTemplateId, 6); // template_id_offset
+	writer.write(0, 5);                  // dt_cnt_minus_one
+
+	// Both templates are on the same layer
+	writer.write(0, 2); // next_layer_idc: same layer for the next template
+	writer.write(3, 2); // next_layer_idc: no more templates
+
+	// Both templates are switch points for the only decode target
+	writer.write(2, 2);
+	writer.write(2, 2);
+
+	// The key frame has no dependency, the delta frame depends on the previous one
+	writer.write(0, 1); // fdiff_follows_flag
+	writer.write(1, 1); // fdiff_follows_flag
+	writer.write(0, 4); // fdiff_minus_one
+	writer.write(0, 1); // fdiff_follows_flag
+
+	writer.write(0, 1); // chain_cnt, encoded as ns(2)
+	writer.write(0, 1); // resolutions_present_flag
+}
+
+} // namespace
+
+AV1RtpPacketizer::AV1RtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig,
+                                   uint16_t maximumPayloadSize)
+    : RtpPacketizer(rtpConfig), MediaHandlerRootElement(), maximumPayloadSize(maximumPayloadSize) {}
+
+ChainedOutgoingProduct
+AV1RtpPacketizer::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                               message_ptr control) {
+	ChainedMessagesProduct packets = make_chained_messages_product();
+	std::vector<PacketElement> elements;
+	binary descriptor;
+	for (const auto &message : *messages) {
+		// The message owns the data of the OBUs until they are packetized
+		bool keyFrame = false;
+		auto obus = ParseObus(*message, keyFrame);
+		if (obus.empty()) {
+			return ChainedOutgoingProduct();
+		}
+
+		const uint8_t descriptorId = rtpConfig->dependencyDescriptorId;
+		size_t index = 0;
+		size_t offset = 0;
+		bool first = true;
+		while (index < obus.size()) {
+			// Fill the packet, reserving a length prefix for every element
+			uint8_t header = offset > 0 ? AggregationContinuesFirst : 0;
+			size_t room = maximumPayloadSize - 1;
+			elements.clear();
+			while (index < obus.size() && room > 1) {
+				const size_t remaining = obus[index].size() - offset;
+				const size_t length = std::min(remaining, room - Leb128Size(room));
+				elements.push_back({index, offset, length});
+				room -= Leb128Size(length) + length;
+				if (length < remaining) {
+					header |= AggregationContinuesLast;
+					offset += length;
+					break;
+				}
+				offset = 0;
+				++index;
+			}
+
+			// With at most 3 elements, the count is set and the last one has no length prefix
+			const bool counted = elements.size() <= AggregationMaxCount;
+			if (counted)
+				header |= uint8_t(elements.size() << AggregationCountShift);
+
+			if (first && keyFrame)
+				header |= AggregationNewSequence;
+
+			size_t payloadSize = 1;
+			for (size_t i = 0; i < elements.size(); ++i) {
+				if (!counted || i + 1 < elements.size())
+					payloadSize += Leb128Size(elements[i].length);
+
+				payloadSize += elements[i].length;
+			}
+
+			const bool last = index == obus.size();
+			if (descriptorId)
+				WriteDependencyDescriptor(descriptor, first, last, keyFrame, first && keyFrame,
+				                          frameNumber);
+
+			auto packet = createPacket(payloadSize, last, descriptorId, &descriptor);
+			byte *data = packet->data() + packet->size() - payloadSize;
+			*data++ = byte(header);
+			for (size_t i = 0; i < elements.size(); ++i) {
+				const auto &element = elements[i];
+				if (!counted || i + 1 < elements.size())
+					data = WriteLeb128(data, element.length);
+
+				obus[element.index].copy(element.offset, element.length, data);
+				data += element.length;
+			}
+			packets->push_back(std::move(packet));
+			first = false;
+		}
+		++frameNumber;
+	}
+	return {packets, control};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
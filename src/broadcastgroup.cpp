@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "broadcastgroup.hpp"
+
+#include "impl/datachannel.hpp"
+#include "impl/internals.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <shared_mutex>
+#include <vector>
+
+namespace rtc {
+
+struct BroadcastGroup::Group {
+	struct Subscriber {
+		weak_ptr<impl::DataChannel> channel;
+		BroadcastSubscriberOptions options;
+	};
+
+	size_t publish(const byte *data, size_t size, shared_ptr<const void> owner, Message::Type type);
+	void remove(const std::vector<shared_ptr<impl::DataChannel>> &closing);
+
+	std::vector<Subscriber> subscribers;
+	mutable std::shared_mutex mutex;
+
+	std::atomic<uint64_t> published = 0;
+	std::atomic<uint64_t> sent = 0;
+	std::atomic<uint64_t> dropped = 0;
+	std::atomic<uint64_t> closed = 0;
+};
+
+size_t BroadcastGroup::Group::publish(const byte *data, size_t size, shared_ptr<const void> owner,
+                                      Message::Type type) {
+	++published;
+
+	size_t count = 0, skipped = 0;
+	bool expired = false;
+	std::vector<shared_ptr<impl::DataChannel>> closing;
+	{
+		// Publishers may run concurrently, only subscription changes are exclusive
+		std::shared_lock lock(mutex);
+		for (const auto &subscriber : subscribers) {
+			auto channel = subscriber.channel.lock();
+			if (!channel || channel->isClosed()) {
+				expired = true;
+				continue;
+			}
+			if (!channel->isOpen())
+				continue;
+
+			const auto &options = subscriber.options;
+			if (options.policy != SlowConsumerPolicy::Queue &&
+			    channel->bufferedAmount > options.maxBufferedAmount) {
+				if (options.policy == SlowConsumerPolicy::Close)
+					closing.push_back(std::move(channel));
+
+				++skipped;
+				continue;
+			}
+
+			try {
+				// Only the message header is allocated for each subscriber
+				channel->outgoing(make_message(data, size, owner, type));
+				++count;
+
+			} catch (const std::exception &e) {
+				// For instance, the channel was closed concurrently
+				PLOG_DEBUG << "Broadcast to a subscriber failed: " << e.what();
+				++skipped;
+			}
+		}
+	}
+
+	sent += count;
+	dropped += skipped;
+
+	// Channels are closed outside of the lock, as callbacks might change subscriptions
+	for (auto &channel : closing) {
+		PLOG_INFO << "Closing slow broadcast subscriber, buffered amount "
+		          << channel->bufferedAmount.load();
+		channel->close();
+	}
+	closed += closing.size();
+
+	if (expired || !closing.empty())
+		remove(closing);
+
+	return count;
+}
+
+void BroadcastGroup::Group::remove(const std::vector<shared_ptr<impl::DataChannel>> &closing) {
+	auto removed = [&closing](const Subscriber &subscriber) {
+		auto channel = subscriber.channel.lock();
+		return !channel || channel->isClosed() ||
+		       std::find(closing.begin(), closing.end(), channel) != closing.end();
+	};
+
+	std::unique_lock lock(mutex);
+	subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), removed),
+	                  subscribers.end());
+}
+
+BroadcastGroup::BroadcastGroup() : group(std::make_shared<Group>()) {}
+
+BroadcastGroup::~BroadcastGroup() {}
+
+void BroadcastGroup::subscribe(shared_ptr<DataChannel> channel,
+                               BroadcastSubscriberOptions options) {
+	if (!channel)
+		throw std::invalid_argument("Subscriber channel is null");
+
+	auto impl = channel->impl();
+	std::unique_lock lock(group->mutex);
+	auto &subscribers = group->subscribers;
+	auto it = std::find_if(subscribers.begin(), subscribers.end(), [&impl](const auto &s) {
+		return s.channel.lock() == impl;
+	});
+	if (it != subscribers.end())
+		it->options = std::move(options);
+	else
+		subscribers.push_back({impl, std::move(options)});
+}
+
+void BroadcastGroup::unsubscribe(const shared_ptr<DataChannel> &channel) {
+	if (!channel)
+		return;
+
+	auto impl = channel->impl();
+	std::unique_lock lock(group->mutex);
+	auto &subscribers = group->subscribers;
+	subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+	                                 [&impl](const auto &s) { return s.channel.lock() == impl; }),
+	                  subscribers.end());
+}
+
+size_t BroadcastGroup::size() const {
+	std::shared_lock lock(group->mutex);
+	return group->subscribers.size();
+}
+
+size_t BroadcastGroup::publish(message_variant data) {
+	return std::visit( //
+	    overloaded{
+	        [this](binary b) {
+		        return publish(std::make_shared<const binary>(std::move(b)));
+	        },
+	        [this](string s) {
+		        auto str = std::make_shared<const string>(std::move(s));
+		        auto bytes = reinterpret_cast<const byte *>(str->data());
+		        auto size = str->size();
+		        return group->publish(bytes, size, std::move(str), Message::String);
+	        },
+	    },
+	    std::move(data));
+}
+
+size_t BroadcastGroup::publish(shared_ptr<const binary> data) {
+	if (!data)
+		throw std::invalid_argument("Data is null");
+
+	auto bytes = data->data();
+	auto size = data->size();
+	return group->publish(bytes, size, std::move(data), Message::Binary);
+}
+
+size_t BroadcastGroup::publish(const byte *data, size_t size) {
+	return publish(std::make_shared<const binary>(data, data + size));
+}
+
+BroadcastGroup::Stats BroadcastGroup::stats() const {
+	Stats s;
+	s.subscribers = size();
+	s.published = group->published;
+	s.sent = group->sent;
+	s.dropped = group->dropped;
+	s.closed = group->closed;
+	return s;
+}
+
+} // namespace rtc
@@ -188,6 +188,18 @@ bool Candidate::resolve(ResolveMode mode) {
 	return mFamily != Family::Unresolved;
 }
 
+void Candidate::changeAddress(string addr) {
+	mNode = std::move(addr);
+	mFamily = Family::Unresolved;
+	mAddress.clear();
+	mPort = 0;
+
+	if (!resolve(ResolveMode::Simple))
+		throw std::invalid_argument("Invalid candidate address \"" + mNode + "\"");
+}
+
+void Candidate::changePriority(uint32_t priority) { mPriority = priority; }
+
 Candidate::Type Candidate::type() const { return mType; }
 
 Candidate::TransportType Candidate::transportType() const { return mTransportType; }
@@ -240,6 +252,8 @@ optional<uint16_t> Candidate::port() const {
 	return isResolved() ? std::make_optional(mPort) : nullopt;
 }
 
+string Candidate::node() const { return mNode; }
+
 } // namespace rtc
 
 std::ostream &operator<<(std::ostream &out, const rtc::Candidate &candidate) {
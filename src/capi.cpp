@@ -21,12 +21,17 @@
 
 #include "impl/internals.hpp"
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <mutex>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 using namespace rtc;
 using namespace std::chrono_literals;
@@ -34,141 +39,290 @@ using std::chrono::milliseconds;
 
 namespace {
 
-std::unordered_map<int, shared_ptr<PeerConnection>> peerConnectionMap;
-std::unordered_map<int, shared_ptr<DataChannel>> dataChannelMap;
-std::unordered_map<int, shared_ptr<Track>> trackMap;
-#if RTC_ENABLE_MEDIA
-std::unordered_map<int, shared_ptr<MediaChainableHandler>> rtcpChainableHandlerMap;
-std::unordered_map<int, shared_ptr<RtcpSrReporter>> rtcpSrReporterMap;
-std::unordered_map<int, shared_ptr<RtpPacketizationConfig>> rtpConfigMap;
-#endif
-#if RTC_ENABLE_WEBSOCKET
-std::unordered_map<int, shared_ptr<WebSocket>> webSocketMap;
-std::unordered_map<int, shared_ptr<WebSocketServer>> webSocketServerMap;
-#endif
-std::unordered_map<int, void *> userPointerMap;
-std::mutex mutex;
-int lastId = 0;
+enum class Kind : uint8_t {
+	PeerConnection,
+	DataChannel,
+	Track,
+	WebSocket,
+	WebSocketServer,
+	Message, // borrowed by the application
+};
+
+// Objects attached to a track by the media functions
+enum class Attachment : size_t {
+	RtcpSrReporter,
+	MediaChainableHandler,
+	RtpConfig,
+	Count,
+};
+
+// Table of handles to objects, shared between all kinds of objects
+// A handle is the index of a slot tagged with the generation of the slot, so a stale handle is
+// not resolved to an object created later in the same slot unless the generation wrapped, and
+// freed slots are reused in order only once many are free to make that unlikely. Slots are
+// allocated by chunks which are never moved, and the entry of a slot is swapped with atomic
+// shared_ptr operations, so lookups are O(1) and don't take the table mutex. Note those operations
+// are not lock-free with common standard libraries, which guard them with a small pool of locks.
+// Only creation and deletion of handles are serialized.
+class HandleTable final {
+public:
+	HandleTable() = default;
+	HandleTable(const HandleTable &) = delete;
+	HandleTable &operator=(const HandleTable &) = delete;
+
+	template <typename T> int emplace(Kind kind, shared_ptr<T> object);
+	template <typename T> shared_ptr<T> get(int id, Kind kind) const;
+	shared_ptr<Channel> getChannel(int id) const;
+	bool erase(int id, Kind kind);
+	size_t clear();
+
+	optional<void *> userPointer(int id) const;
+	void setUserPointer(int id, void *ptr);
+
+	template <typename T> shared_ptr<T> attachment(int id, Attachment a) const;
+	void attach(int id, Attachment a, shared_ptr<void> object); // keeps the existing one if any
+
+private:
+	struct Entry {
+		uint32_t generation;
+		Kind kind;
+		shared_ptr<void> object;
+		shared_ptr<Channel> channel; // set for Data Channels, Tracks, and WebSockets
+	};
+
+	struct Slot {
+		shared_ptr<const Entry> entry; // accessed atomically
+		std::atomic<void *> userPointer = nullptr;
+		std::array<shared_ptr<void>, size_t(Attachment::Count)> attachments; // accessed atomically
+		uint32_t generation = 0; // protected by mMutex
+	};
+
+	static const int IndexBits = 18; // leaves 13 bits of generation in a positive int
+	static const uint32_t IndexMask = (uint32_t(1) << IndexBits) - 1;
+	static const uint32_t GenerationMask = (uint32_t(1) << (31 - IndexBits)) - 1;
+	static const size_t MinFreeIndexes = 1024; // before freed slots are reused
+	static const size_t ChunkSize = 1024;
+	static const size_t ChunksCount = (size_t(1) << IndexBits) / ChunkSize;
+
+	Slot *slot(uint32_t index) const;
+	shared_ptr<const Entry> find(int id, Slot **s = nullptr) const; // null if not found
+	int emplaceEntry(Kind kind, shared_ptr<void> object, shared_ptr<Channel> channel);
+
+	std::array<std::atomic<Slot *>, ChunksCount> mChunks = {};
+	std::vector<std::unique_ptr<Slot[]>> mOwnedChunks; // protected by mMutex
+	std::deque<uint32_t> mFreeIndexes;                 // protected by mMutex
+	uint32_t mNextIndex = 1;                           // index 0 is never used, so ids are > 0
+	std::mutex mMutex;
+};
+
+template <typename T> int HandleTable::emplace(Kind kind, shared_ptr<T> object) {
+	shared_ptr<Channel> channel;
+	if constexpr (std::is_base_of_v<Channel, T>)
+		channel = object;
+
+	return emplaceEntry(kind, std::move(object), std::move(channel));
+}
+
+template <typename T> shared_ptr<T> HandleTable::get(int id, Kind kind) const {
+	auto entry = find(id);
+	return entry && entry->kind == kind ? std::static_pointer_cast<T>(entry->object) : nullptr;
+}
+
+shared_ptr<Channel> HandleTable::getChannel(int id) const {
+	auto entry = find(id);
+	return entry ? entry->channel : nullptr;
+}
+
+bool HandleTable::erase(int id, Kind kind) {
+	std::lock_guard lock(mMutex);
+	Slot *s;
+	auto entry = find(id, &s);
+	if (!entry || entry->kind != kind)
+		return false;
+
+	std::atomic_store(&s->entry, shared_ptr<const Entry>());
+	for (auto &a : s->attachments)
+		std::atomic_store(&a, shared_ptr<void>());
+
+	s->userPointer.store(nullptr, std::memory_order_relaxed);
+	s->generation = (s->generation + 1) & GenerationMask;
+	mFreeIndexes.push_back(uint32_t(id) & IndexMask); // reused last to delay generation wrapping
+	return true;
+}
+
+size_t HandleTable::clear() {
+	std::lock_guard lock(mMutex);
+	size_t count = 0;
+	for (uint32_t index = 1; index < mNextIndex; ++index) {
+		Slot *s = slot(index);
+		if (!std::atomic_load(&s->entry))
+			continue;
+
+		++count;
+		for (auto &a : s->attachments)
+			if (std::atomic_exchange(&a, shared_ptr<void>()))
+				++count;
+
+		std::atomic_store(&s->entry, shared_ptr<const Entry>());
+		s->userPointer.store(nullptr, std::memory_order_relaxed);
+		s->generation = (s->generation + 1) & GenerationMask;
+		mFreeIndexes.push_back(index);
+	}
+	return count;
+}
+
+optional<void *> HandleTable::userPointer(int id) const {
+	Slot *s;
+	if (!find(id, &s))
+		return nullopt;
+
+	return s->userPointer.load(std::memory_order_acquire);
+}
+
+void HandleTable::setUserPointer(int id, void *ptr) {
+	Slot *s;
+	if (find(id, &s))
+		s->userPointer.store(ptr, std::memory_order_release);
+}
+
+template <typename T> shared_ptr<T> HandleTable::attachment(int id, Attachment a) const {
+	Slot *s;
+	if (!find(id, &s))
+		return nullptr;
+
+	return std::static_pointer_cast<T>(std::atomic_load(&s->attachments[size_t(a)]));
+}
+
+void HandleTable::attach(int id, Attachment a, shared_ptr<void> object) {
+	std::lock_guard lock(mMutex);
+	Slot *s;
+	if (find(id, &s) && !std::atomic_load(&s->attachments[size_t(a)]))
+		std::atomic_store(&s->attachments[size_t(a)], std::move(object));
+}
+
+HandleTable::Slot *HandleTable::slot(uint32_t index) const {
+	Slot *chunk = mChunks[index / ChunkSize].load(std::memory_order_acquire);
+	return chunk ? chunk + index % ChunkSize : nullptr;
+}
+
+shared_ptr<const HandleTable::Entry> HandleTable::find(int id, Slot **s) const {
+	if (id <= 0)
+		return nullptr;
+
+	Slot *found = slot(uint32_t(id) & IndexMask);
+	if (!found)
+		return nullptr;
+
+	auto entry = std::atomic_load(&found->entry);
+	if (!entry || entry->generation != uint32_t(id) >> IndexBits)
+		return nullptr;
+
+	if (s)
+		*s = found;
 
-optional<void *> getUserPointer(int id) {
-	std::lock_guard lock(mutex);
-	auto it = userPointerMap.find(id);
-	return it != userPointerMap.end() ? std::make_optional(it->second) : nullopt;
+	return entry;
 }
 
-void setUserPointer(int i, void *ptr) {
-	std::lock_guard lock(mutex);
-	userPointerMap[i] = ptr;
+int HandleTable::emplaceEntry(Kind kind, shared_ptr<void> object, shared_ptr<Channel> channel) {
+	std::lock_guard lock(mMutex);
+	uint32_t index;
+	if (mFreeIndexes.size() > MinFreeIndexes || (!mFreeIndexes.empty() && mNextIndex > IndexMask)) {
+		index = mFreeIndexes.front();
+		mFreeIndexes.pop_front();
+	} else {
+		if (mNextIndex > IndexMask)
+			throw std::runtime_error("Too many objects");
+
+		index = mNextIndex++;
+		auto &chunk = mChunks[index / ChunkSize];
+		if (!chunk.load(std::memory_order_relaxed)) {
+			mOwnedChunks.emplace_back(new Slot[ChunkSize]);
+			chunk.store(mOwnedChunks.back().get(), std::memory_order_release);
+		}
+	}
+
+	// The slot might have been set by a call racing with the deletion of the previous handle
+	Slot *s = slot(index);
+	s->userPointer.store(nullptr, std::memory_order_relaxed);
+	for (auto &a : s->attachments)
+		std::atomic_store(&a, shared_ptr<void>());
+
+	auto entry = std::make_shared<const Entry>(
+	    Entry{s->generation, kind, std::move(object), std::move(channel)});
+	std::atomic_store(&s->entry, std::move(entry));
+	return int((s->generation << IndexBits) | index);
 }
 
+HandleTable table;
+
+optional<void *> getUserPointer(int id) { return table.userPointer(id); }
+
+void setUserPointer(int i, void *ptr) { table.setUserPointer(i, ptr); }
+
 shared_ptr<PeerConnection> getPeerConnection(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = peerConnectionMap.find(id); it != peerConnectionMap.end())
-		return it->second;
+	if (auto ptr = table.get<PeerConnection>(id, Kind::PeerConnection))
+		return ptr;
 	else
 		throw std::invalid_argument("PeerConnection ID does not exist");
 }
 
 shared_ptr<DataChannel> getDataChannel(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = dataChannelMap.find(id); it != dataChannelMap.end())
-		return it->second;
+	if (auto ptr = table.get<DataChannel>(id, Kind::DataChannel))
+		return ptr;
 	else
 		throw std::invalid_argument("DataChannel ID does not exist");
 }
 
 shared_ptr<Track> getTrack(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = trackMap.find(id); it != trackMap.end())
-		return it->second;
+	if (auto ptr = table.get<Track>(id, Kind::Track))
+		return ptr;
 	else
 		throw std::invalid_argument("Track ID does not exist");
 }
 
 int emplacePeerConnection(shared_ptr<PeerConnection> ptr) {
-	std::lock_guard lock(mutex);
-	int pc = ++lastId;
-	peerConnectionMap.emplace(std::make_pair(pc, ptr));
-	userPointerMap.emplace(std::make_pair(pc, nullptr));
-	return pc;
+	return table.emplace(Kind::PeerConnection, std::move(ptr));
 }
 
 int emplaceDataChannel(shared_ptr<DataChannel> ptr) {
-	std::lock_guard lock(mutex);
-	int dc = ++lastId;
-	dataChannelMap.emplace(std::make_pair(dc, ptr));
-	userPointerMap.emplace(std::make_pair(dc, nullptr));
-	return dc;
+	return table.emplace(Kind::DataChannel, std::move(ptr));
 }
 
-int emplaceTrack(shared_ptr<Track> ptr) {
-	std::lock_guard lock(mutex);
-	int tr = ++lastId;
-	trackMap.emplace(std::make_pair(tr, ptr));
-	userPointerMap.emplace(std::make_pair(tr, nullptr));
-	return tr;
-}
+int emplaceTrack(shared_ptr<Track> ptr) { return table.emplace(Kind::Track, std::move(ptr)); }
 
 void erasePeerConnection(int pc) {
-	std::lock_guard lock(mutex);
-	if (peerConnectionMap.erase(pc) == 0)
+	if (!table.erase(pc, Kind::PeerConnection))
 		throw std::invalid_argument("Peer Connection ID does not exist");
-	userPointerMap.erase(pc);
 }
 
 void eraseDataChannel(int dc) {
-	std::lock_guard lock(mutex);
-	if (dataChannelMap.erase(dc) == 0)
+	if (!table.erase(dc, Kind::DataChannel))
 		throw std::invalid_argument("Data Channel ID does not exist");
-	userPointerMap.erase(dc);
 }
 
 void eraseTrack(int tr) {
-	std::lock_guard lock(mutex);
-	if (trackMap.erase(tr) == 0)
+	// Media attachments are erased with the track
+	if (!table.erase(tr, Kind::Track))
 		throw std::invalid_argument("Track ID does not exist");
-#if RTC_ENABLE_MEDIA
-	rtcpSrReporterMap.erase(tr);
-	rtcpChainableHandlerMap.erase(tr);
-	rtpConfigMap.erase(tr);
-#endif
-	userPointerMap.erase(tr);
 }
 
-size_t eraseAll() {
-	std::lock_guard lock(mutex);
-	size_t count = dataChannelMap.size() + trackMap.size() + peerConnectionMap.size();
-	dataChannelMap.clear();
-	trackMap.clear();
-	peerConnectionMap.clear();
-#if RTC_ENABLE_MEDIA
-	count += rtcpChainableHandlerMap.size() + rtcpSrReporterMap.size() + rtpConfigMap.size();
-	rtcpChainableHandlerMap.clear();
-	rtcpSrReporterMap.clear();
-	rtpConfigMap.clear();
-#endif
-#if RTC_ENABLE_WEBSOCKET
-	count += webSocketMap.size() + webSocketServerMap.size();
-	webSocketMap.clear();
-	webSocketServerMap.clear();
-#endif
-	userPointerMap.clear();
-	return count;
-}
+size_t eraseAll() { return table.clear(); }
 
 shared_ptr<Channel> getChannel(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = dataChannelMap.find(id); it != dataChannelMap.end())
-		return it->second;
-	if (auto it = trackMap.find(id); it != trackMap.end())
-		return it->second;
-#if RTC_ENABLE_WEBSOCKET
-	if (auto it = webSocketMap.find(id); it != webSocketMap.end())
-		return it->second;
-#endif
+	if (auto ptr = table.getChannel(id))
+		return ptr;
+
 	throw std::invalid_argument("DataChannel, Track, or WebSocket ID does not exist");
 }
 
+// The message is kept in the table until released, so its data can be borrowed
+void borrowMessage(message_ptr message, rtcMessage *borrowed) {
+	const int size = int(message->payloadSize());
+	borrowed->data = reinterpret_cast<const char *>(message->payload());
+	borrowed->size = message->type == Message::String ? -size : size;
+	borrowed->handle = table.emplace(Kind::Message, std::move(message));
+}
+
 int copyAndReturn(string s, char *buffer, int size) {
 	if (!buffer)
 		return int(s.size() + 1);
@@ -226,45 +380,39 @@ string lowercased(string str) {
 }
 
 shared_ptr<RtcpSrReporter> getRtcpSrReporter(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = rtcpSrReporterMap.find(id); it != rtcpSrReporterMap.end()) {
-		return it->second;
+	if (auto ptr = table.attachment<RtcpSrReporter>(id, Attachment::RtcpSrReporter)) {
+		return ptr;
 	} else {
 		throw std::invalid_argument("RTCP SR reporter ID does not exist");
 	}
 }
 
 void emplaceRtcpSrReporter(shared_ptr<RtcpSrReporter> ptr, int tr) {
-	std::lock_guard lock(mutex);
-	rtcpSrReporterMap.emplace(std::make_pair(tr, ptr));
+	table.attach(tr, Attachment::RtcpSrReporter, std::move(ptr));
 }
 
 shared_ptr<MediaChainableHandler> getMediaChainableHandler(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = rtcpChainableHandlerMap.find(id); it != rtcpChainableHandlerMap.end()) {
-		return it->second;
+	if (auto ptr = table.attachment<MediaChainableHandler>(id, Attachment::MediaChainableHandler)) {
+		return ptr;
 	} else {
 		throw std::invalid_argument("RTCP chainable handler ID does not exist");
 	}
 }
 
 void emplaceMediaChainableHandler(shared_ptr<MediaChainableHandler> ptr, int tr) {
-	std::lock_guard lock(mutex);
-	rtcpChainableHandlerMap.emplace(std::make_pair(tr, ptr));
+	table.attach(tr, Attachment::MediaChainableHandler, std::move(ptr));
 }
 
 shared_ptr<RtpPacketizationConfig> getRtpConfig(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = rtpConfigMap.find(id); it != rtpConfigMap.end()) {
-		return it->second;
+	if (auto ptr = table.attachment<RtpPacketizationConfig>(id, Attachment::RtpConfig)) {
+		return ptr;
 	} else {
 		throw std::invalid_argument("RTP configuration ID does not exist");
 	}
 }
 
 void emplaceRtpConfig(shared_ptr<RtpPacketizationConfig> ptr, int tr) {
-	std::lock_guard lock(mutex);
-	rtpConfigMap.emplace(std::make_pair(tr, ptr));
+	table.attach(tr, Attachment::RtpConfig, std::move(ptr));
 }
 
 shared_ptr<RtpPacketizationConfig>
@@ -285,53 +433,274 @@ createRtpPacketizationConfig(const rtcPacketizationHandlerInit *init) {
 #if RTC_ENABLE_WEBSOCKET
 
 shared_ptr<WebSocket> getWebSocket(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = webSocketMap.find(id); it != webSocketMap.end())
-		return it->second;
+	if (auto ptr = table.get<WebSocket>(id, Kind::WebSocket))
+		return ptr;
 	else
 		throw std::invalid_argument("WebSocket ID does not exist");
 }
 
 int emplaceWebSocket(shared_ptr<WebSocket> ptr) {
-	std::lock_guard lock(mutex);
-	int ws = ++lastId;
-	webSocketMap.emplace(std::make_pair(ws, ptr));
-	userPointerMap.emplace(std::make_pair(ws, nullptr));
-	return ws;
+	return table.emplace(Kind::WebSocket, std::move(ptr));
 }
 
 void eraseWebSocket(int ws) {
-	std::lock_guard lock(mutex);
-	if (webSocketMap.erase(ws) == 0)
+	if (!table.erase(ws, Kind::WebSocket))
 		throw std::invalid_argument("WebSocket ID does not exist");
-	userPointerMap.erase(ws);
 }
 
 shared_ptr<WebSocketServer> getWebSocketServer(int id) {
-	std::lock_guard lock(mutex);
-	if (auto it = webSocketServerMap.find(id); it != webSocketServerMap.end())
-		return it->second;
+	if (auto ptr = table.get<WebSocketServer>(id, Kind::WebSocketServer))
+		return ptr;
 	else
 		throw std::invalid_argument("WebSocketServer ID does not exist");
 }
 
 int emplaceWebSocketServer(shared_ptr<WebSocketServer> ptr) {
-	std::lock_guard lock(mutex);
-	int wsserver = ++lastId;
-	webSocketServerMap.emplace(std::make_pair(wsserver, ptr));
-	userPointerMap.emplace(std::make_pair(wsserver, nullptr));
-	return wsserver;
+	return table.emplace(Kind::WebSocketServer, std::move(ptr));
 }
 
 void eraseWebSocketServer(int wsserver) {
-	std::lock_guard lock(mutex);
-	if (webSocketServerMap.erase(wsserver) == 0)
+	if (!table.erase(wsserver, Kind::WebSocketServer))
 		throw std::invalid_argument("WebSocketServer ID does not exist");
-	userPointerMap.erase(wsserver);
 }
 
 #endif
 
+// Queue of events polled by the application instead of callbacks
+// Producers are internal threads which never take a lock, they link events to an intrusive list
+// (Vyukov's MPSC queue). Consumers are serialized, and only lock the wait mutex to sleep when the
+// queue is empty.
+class EventQueue final {
+public:
+	struct Event {
+		rtcEventType type = RTC_EVENT_OPEN;
+		int id = 0;
+		int value = 0;
+		optional<string> data;
+		optional<string> extra;
+		void *ptr = nullptr; // set when polled
+	};
+
+	using filter_func = std::function<bool(Event &event)>; // false to drop the event
+
+	EventQueue();
+	~EventQueue();
+
+	void push(Event event);
+	void poll(std::vector<Event> &events, size_t count, optional<milliseconds> timeout,
+	          filter_func filter);
+	void interrupt(); // wakes up consumers waiting in poll()
+
+private:
+	struct Node {
+		Event event;
+		std::atomic<Node *> next = nullptr;
+	};
+
+	optional<Event> pop(); // mPopMutex must be locked
+
+	std::atomic<Node *> mTail;
+	Node *mHead; // stub node, protected by mPopMutex
+	std::mutex mPopMutex;
+
+	std::atomic<size_t> mSize = 0;
+	std::atomic<int> mWaiters = 0;
+	uint64_t mInterrupts = 0; // protected by mWaitMutex
+	std::mutex mWaitMutex;
+	std::condition_variable mWaitCondition;
+};
+
+EventQueue::EventQueue() : mHead(new Node) { mTail.store(mHead); }
+
+EventQueue::~EventQueue() {
+	while (mHead) {
+		Node *next = mHead->next.load();
+		delete mHead;
+		mHead = next;
+	}
+}
+
+void EventQueue::push(Event event) {
+	Node *node = new Node{std::move(event)};
+	Node *prev = mTail.exchange(node);
+	prev->next.store(node);
+	mSize.fetch_add(1);
+
+	if (mWaiters.load() > 0) {
+		std::lock_guard lock(mWaitMutex);
+		mWaitCondition.notify_all();
+	}
+}
+
+void EventQueue::poll(std::vector<Event> &events, size_t count, optional<milliseconds> timeout,
+                      filter_func filter) {
+	using clock = std::chrono::steady_clock;
+	const auto deadline = timeout ? make_optional(clock::now() + *timeout) : nullopt;
+	events.clear();
+	while (true) {
+		{
+			std::lock_guard lock(mPopMutex);
+			while (events.size() < count) {
+				auto event = pop();
+				if (!event)
+					break;
+
+				if (filter(*event))
+					events.push_back(std::move(*event));
+			}
+		}
+
+		if (!events.empty() || count == 0)
+			return;
+
+		std::unique_lock lock(mWaitMutex);
+		if (deadline && clock::now() >= *deadline)
+			return;
+
+		// Registering as a waiter before checking the size guarantees a notification
+		mWaiters.fetch_add(1);
+		const uint64_t interrupts = mInterrupts;
+		auto pred = [&]() { return mSize.load() > 0 || mInterrupts != interrupts; };
+		if (deadline)
+			mWaitCondition.wait_until(lock, *deadline, pred);
+		else
+			mWaitCondition.wait(lock, pred);
+
+		mWaiters.fetch_sub(1);
+		if (mInterrupts != interrupts)
+			return;
+	}
+}
+
+void EventQueue::interrupt() {
+	std::lock_guard lock(mWaitMutex);
+	++mInterrupts;
+	mWaitCondition.notify_all();
+}
+
+optional<EventQueue::Event> EventQueue::pop() {
+	// The next node is null if the queue is empty or a producer has not linked it yet
+	Node *next = mHead->next.load();
+	if (!next)
+		return nullopt;
+
+	delete mHead;
+	mHead = next;
+	mSize.fetch_sub(1);
+	return std::move(next->event);
+}
+
+EventQueue eventQueue;
+
+void pushEvent(rtcEventType type, int id, int value = 0, optional<string> data = nullopt,
+               optional<string> extra = nullopt) {
+	eventQueue.push({type, id, value, std::move(data), std::move(extra)});
+}
+
+void queueEvents(int id, bool enabled);
+
+void queuePeerConnectionEvents(int pc, shared_ptr<PeerConnection> peerConnection, bool enabled) {
+	if (!enabled) {
+		peerConnection->onLocalDescription(nullptr);
+		peerConnection->onLocalCandidate(nullptr);
+		peerConnection->onStateChange(nullptr);
+		peerConnection->onGatheringStateChange(nullptr);
+		peerConnection->onSignalingStateChange(nullptr);
+		peerConnection->onDataChannel(nullptr);
+		peerConnection->onTrack(nullptr);
+		return;
+	}
+
+	peerConnection->onLocalDescription([pc](Description desc) {
+		pushEvent(RTC_EVENT_LOCAL_DESCRIPTION, pc, 0, string(desc), desc.typeString());
+	});
+	peerConnection->onLocalCandidate([pc](Candidate cand) {
+		pushEvent(RTC_EVENT_LOCAL_CANDIDATE, pc, 0, cand.candidate(), cand.mid());
+	});
+	peerConnection->onStateChange([pc](PeerConnection::State state) {
+		pushEvent(RTC_EVENT_STATE_CHANGE, pc, int(state));
+	});
+	peerConnection->onGatheringStateChange([pc](PeerConnection::GatheringState state) {
+		pushEvent(RTC_EVENT_GATHERING_STATE_CHANGE, pc, int(state));
+	});
+	peerConnection->onSignalingStateChange([pc](PeerConnection::SignalingState state) {
+		pushEvent(RTC_EVENT_SIGNALING_STATE_CHANGE, pc, int(state));
+	});
+
+	// Events of new objects are queued before the application learns about them
+	peerConnection->onDataChannel([pc](shared_ptr<DataChannel> dataChannel) {
+		int dc = emplaceDataChannel(dataChannel);
+		setUserPointer(dc, getUserPointer(pc).value_or(nullptr));
+		queueEvents(dc, true);
+		pushEvent(RTC_EVENT_DATA_CHANNEL, pc, dc);
+	});
+	peerConnection->onTrack([pc](shared_ptr<Track> track) {
+		int tr = emplaceTrack(track);
+		setUserPointer(tr, getUserPointer(pc).value_or(nullptr));
+		queueEvents(tr, true);
+		pushEvent(RTC_EVENT_TRACK, pc, tr);
+	});
+}
+
+void queueChannelEvents(int id, shared_ptr<Channel> channel, bool enabled) {
+	if (!enabled) {
+		channel->onOpen(nullptr);
+		channel->onClosed(nullptr);
+		channel->onError(nullptr);
+		channel->onMessage(nullptr);
+		channel->onBufferedAmountLow(nullptr);
+		return;
+	}
+
+	channel->onOpen([id]() { pushEvent(RTC_EVENT_OPEN, id); });
+	channel->onClosed([id]() { pushEvent(RTC_EVENT_CLOSED, id); });
+	channel->onError([id](string error) { pushEvent(RTC_EVENT_ERROR, id, 0, std::move(error)); });
+	channel->onMessage(
+	    [id](binary b) {
+		    int size = int(b.size());
+		    pushEvent(RTC_EVENT_MESSAGE, id, size,
+		              string(reinterpret_cast<const char *>(b.data()), b.size()));
+	    },
+	    [id](string s) {
+		    int size = -int(s.size() + 1);
+		    pushEvent(RTC_EVENT_MESSAGE, id, size, std::move(s));
+	    });
+	channel->onBufferedAmountLow([id]() { pushEvent(RTC_EVENT_BUFFERED_AMOUNT_LOW, id); });
+}
+
+#if RTC_ENABLE_WEBSOCKET
+void queueWebSocketServerEvents(int wsserver, shared_ptr<WebSocketServer> webSocketServer,
+                                bool enabled) {
+	if (!enabled) {
+		webSocketServer->onClient(nullptr);
+		return;
+	}
+
+	webSocketServer->onClient([wsserver](shared_ptr<WebSocket> webSocket) {
+		int ws = emplaceWebSocket(webSocket);
+		setUserPointer(ws, getUserPointer(wsserver).value_or(nullptr));
+		queueEvents(ws, true);
+		pushEvent(RTC_EVENT_WEBSOCKET_CLIENT, wsserver, ws);
+	});
+}
+#endif
+
+void queueEvents(int id, bool enabled) {
+	if (auto peerConnection = table.get<PeerConnection>(id, Kind::PeerConnection)) {
+		queuePeerConnectionEvents(id, std::move(peerConnection), enabled);
+		return;
+	}
+
+#if RTC_ENABLE_WEBSOCKET
+	if (auto webSocketServer = table.get<WebSocketServer>(id, Kind::WebSocketServer)) {
+		queueWebSocketServerEvents(id, std::move(webSocketServer), enabled);
+		return;
+	}
+#endif
+
+	queueChannelEvents(id, getChannel(id), enabled);
+}
+
 } // namespace
 
 void rtcInitLogger(rtcLogLevel level, rtcLogCallbackFunc cb) {
@@ -348,6 +717,42 @@ void rtcSetUserPointer(int i, void *ptr) { setUserPointer(i, ptr); }
 
 void *rtcGetUserPointer(int i) { return getUserPointer(i).value_or(nullptr); }
 
+int rtcQueueEvents(int id, bool enabled) {
+	return wrap([&] {
+		queueEvents(id, enabled);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
+int rtcPollEvents(rtcEvent *events, int count, int timeoutMs) {
+	return wrap([&] {
+		if (!events && count > 0)
+			throw std::invalid_argument("Unexpected null pointer for events");
+
+		// Events of deleted objects are dropped, like callbacks are not called anymore
+		thread_local std::vector<EventQueue::Event> polled;
+		eventQueue.poll(polled, size_t(std::max(count, 0)),
+		                timeoutMs >= 0 ? make_optional(milliseconds(timeoutMs)) : nullopt,
+		                [](EventQueue::Event &event) {
+			                auto ptr = getUserPointer(event.id);
+			                event.ptr = ptr.value_or(nullptr);
+			                return ptr.has_value();
+		                });
+
+		for (size_t i = 0; i < polled.size(); ++i) {
+			const auto &event = polled[i];
+			auto &e = events[i];
+			e.type = event.type;
+			e.id = event.id;
+			e.value = event.value;
+			e.data = event.data ? event.data->c_str() : nullptr;
+			e.extra = event.extra ? event.extra->c_str() : nullptr;
+			e.ptr = event.ptr;
+		}
+		return int(polled.size());
+	});
+}
+
 int rtcCreatePeerConnection(const rtcConfiguration *config) {
 	return wrap([config] {
 		Configuration c;
@@ -365,6 +770,7 @@ int rtcCreatePeerConnection(const rtcConfiguration *config) {
 		c.certificateType = static_cast<CertificateType>(config->certificateType);
 		c.iceTransportPolicy = static_cast<TransportPolicy>(config->iceTransportPolicy);
 		c.enableIceTcp = config->enableIceTcp;
+		c.enableIceUdpMux = config->enableIceUdpMux;
 		c.disableAutoNegotiation = config->disableAutoNegotiation;
 
 		if (config->mtu > 0)
@@ -505,6 +911,14 @@ int rtcSetLocalDescription(int pc, const char *type) {
 	});
 }
 
+int rtcRestartIce(int pc) {
+	return wrap([&] {
+		auto peerConnection = getPeerConnection(pc);
+		peerConnection->restartIce();
+		return RTC_ERR_SUCCESS;
+	});
+}
+
 int rtcSetRemoteDescription(int pc, const char *sdp, const char *type) {
 	return wrap([&] {
 		auto peerConnection = getPeerConnection(pc);
@@ -616,6 +1030,34 @@ int rtcGetSelectedCandidatePair(int pc, char *local, int localSize, char *remote
 	});
 }
 
+int rtcGetSctpStats(int pc, rtcSctpStats *stats) {
+	return wrap([&] {
+		auto peerConnection = getPeerConnection(pc);
+
+		if (!stats)
+			throw std::invalid_argument("Unexpected null pointer for stats");
+
+		auto s = peerConnection->sctpStats();
+		if (!s)
+			return RTC_ERR_NOT_AVAIL;
+
+		std::memset(stats, 0, sizeof(*stats));
+		stats->congestionWindow = uint32_t(s->congestionWindow);
+		stats->peerReceiveWindow = uint32_t(s->peerReceiveWindow);
+		stats->unackedChunks = s->unackedChunks;
+		stats->pendingChunks = s->pendingChunks;
+		stats->mtu = uint32_t(s->mtu);
+		stats->rtt = int(s->rtt.count());
+		stats->rto = int(s->rto.count());
+		stats->abandonedUnsent = s->abandonedUnsent;
+		stats->abandonedSent = s->abandonedSent;
+		stats->queuedMessages = s->queuedMessages;
+		stats->bufferedAmount = s->bufferedAmount;
+		stats->retransmissions = s->retransmissions;
+		return RTC_ERR_SUCCESS;
+	});
+}
+
 int rtcSetOpenCallback(int id, rtcOpenCallbackFunc cb) {
 	return wrap([&] {
 		auto channel = getChannel(id);
@@ -697,6 +1139,52 @@ int rtcSendMessage(int id, const char *data, int size) {
 	});
 }
 
+int rtcSendMessages(int id, const char *const *data, const int *sizes, int count) {
+	return wrap([&] {
+		auto channel = getChannel(id);
+
+		if (count > 0 && (!data || !sizes))
+			throw std::invalid_argument("Unexpected null pointer for messages");
+
+		std::vector<message_variant> messages;
+		messages.reserve(size_t(std::max(count, 0)));
+		for (int i = 0; i < count; ++i) {
+			if (!data[i] && sizes[i] != 0)
+				throw std::invalid_argument("Unexpected null pointer for data");
+
+			if (sizes[i] >= 0) {
+				auto b = reinterpret_cast<const byte *>(data[i]);
+				messages.emplace_back(binary(b, b + sizes[i]));
+			} else {
+				messages.emplace_back(string(data[i]));
+			}
+		}
+
+		if (auto dataChannel = std::dynamic_pointer_cast<DataChannel>(channel)) {
+			dataChannel->sendBatch(std::move(messages));
+
+		} else if (auto track = std::dynamic_pointer_cast<Track>(channel)) {
+			std::vector<binary> packets;
+			packets.reserve(messages.size());
+			for (auto &message : messages)
+				packets.push_back(std::visit(
+				    overloaded{[](binary b) { return b; },
+				               [](string s) {
+					               auto b = reinterpret_cast<const byte *>(s.data());
+					               return binary(b, b + s.size());
+				               }},
+				    std::move(message)));
+
+			track->sendBatch(std::move(packets));
+
+		} else {
+			for (auto &message : messages)
+				channel->send(std::move(message));
+		}
+		return count;
+	});
+}
+
 bool rtcIsOpen(int id) {
 	return wrap([id] { return getChannel(id)->isOpen() ? 0 : 1; }) == 0 ? true : false;
 }
@@ -734,6 +1222,50 @@ int rtcSetBufferedAmountLowCallback(int id, rtcBufferedAmountLowCallbackFunc cb)
 	});
 }
 
+int rtcReceiveMessages(int id, rtcMessage *messages, int count) {
+	return wrap([&] {
+		auto channel = getChannel(id);
+
+		if (!messages && count > 0)
+			throw std::invalid_argument("Unexpected null pointer for messages");
+
+		int received = 0;
+		while (received < count) {
+			auto message = channel->receiveMessage();
+			if (!message)
+				break;
+
+			borrowMessage(std::move(message), messages + received++);
+		}
+		return received;
+	});
+}
+
+int rtcBorrowMessage(int id, rtcMessage *message) {
+	return wrap([&] {
+		auto channel = getChannel(id);
+
+		if (!message)
+			throw std::invalid_argument("Unexpected null pointer for message");
+
+		auto received = channel->receiveMessage();
+		if (!received)
+			return RTC_ERR_NOT_AVAIL;
+
+		borrowMessage(std::move(received), message);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
+int rtcReleaseMessage(int handle) {
+	return wrap([&] {
+		if (!table.erase(handle, Kind::Message))
+			throw std::invalid_argument("Message handle does not exist");
+
+		return RTC_ERR_SUCCESS;
+	});
+}
+
 int rtcGetAvailableAmount(int id) {
 	return wrap([id] { return int(getChannel(id)->availableAmount()); });
 }
@@ -819,6 +1351,7 @@ int rtcCreateDataChannelEx(int pc, const char *label, const rtcDataChannelInit *
 			dci.negotiated = init->negotiated;
 			dci.id = init->manualStream ? std::make_optional(init->stream) : nullopt;
 			dci.protocol = init->protocol ? init->protocol : "";
+			dci.priority = init->priority ? init->priority : RTC_PRIORITY_LOW;
 		}
 
 		auto peerConnection = getPeerConnection(pc);
@@ -891,6 +1424,24 @@ int rtcGetDataChannelReliability(int dc, rtcReliability *reliability) {
 	});
 }
 
+int rtcGetDataChannelStats(int dc, rtcDataChannelStats *stats) {
+	return wrap([&] {
+		auto dataChannel = getDataChannel(dc);
+
+		if (!stats)
+			throw std::invalid_argument("Unexpected null pointer for stats");
+
+		DataChannelStats s = dataChannel->stats();
+		std::memset(stats, 0, sizeof(*stats));
+		stats->abandonedUnsent = s.abandonedUnsent;
+		stats->abandonedSent = s.abandonedSent;
+		stats->queuedMessages = s.queuedMessages;
+		stats->bufferedAmount = s.bufferedAmount;
+		stats->droppedMessages = s.droppedMessages;
+		return RTC_ERR_SUCCESS;
+	});
+}
+
 int rtcAddTrack(int pc, const char *mediaDescriptionSdp) {
 	return wrap([&] {
 		if (!mediaDescriptionSdp)
@@ -921,6 +1472,8 @@ int rtcAddTrackEx(int pc, const rtcTrackInit *init) {
 		} else {
 			switch (init->codec) {
 			case RTC_CODEC_H264:
+			case RTC_CODEC_H265:
+			case RTC_CODEC_AV1:
 			case RTC_CODEC_VP8:
 			case RTC_CODEC_VP9:
 				mid = "video";
@@ -938,6 +1491,8 @@ int rtcAddTrackEx(int pc, const rtcTrackInit *init) {
 
 		switch (init->codec) {
 		case RTC_CODEC_H264:
+		case RTC_CODEC_H265:
+		case RTC_CODEC_AV1:
 		case RTC_CODEC_VP8:
 		case RTC_CODEC_VP9: {
 			auto desc = Description::Video(mid, direction);
@@ -945,11 +1500,17 @@ int rtcAddTrackEx(int pc, const rtcTrackInit *init) {
 			case RTC_CODEC_H264:
 				desc.addH264Codec(init->payloadType);
 				break;
+			case RTC_CODEC_H265:
+				desc.addH265Codec(init->payloadType);
+				break;
+			case RTC_CODEC_AV1:
+				desc.addAV1Codec(init->payloadType);
+				break;
 			case RTC_CODEC_VP8:
 				desc.addVP8Codec(init->payloadType);
 				break;
 			case RTC_CODEC_VP9:
-				desc.addVP8Codec(init->payloadType);
+				desc.addVP9Codec(init->payloadType);
 				break;
 			default:
 				break;
@@ -1012,6 +1573,34 @@ int rtcGetTrackDescription(int tr, char *buffer, int size) {
 	});
 }
 
+int rtcGetTrackStats(int tr, rtcTrackStreamStats *buffer, int count) {
+	return wrap([&] {
+		auto track = getTrack(tr);
+		std::vector<rtcTrackStreamStats> result;
+		for (const auto &stats : track->stats()) {
+			rtcTrackStreamStats s = {};
+			s.ssrc = stats.ssrc;
+			s.packetsSent = stats.packetsSent;
+			s.bytesSent = stats.bytesSent;
+			s.retransmittedPackets = stats.retransmittedPackets;
+			s.retransmittedBytes = stats.retransmittedBytes;
+			s.nacksReceived = stats.nacksReceived;
+			s.keyframeRequestsReceived = stats.keyframeRequestsReceived;
+			s.bitrateSent = stats.bitrateSent;
+			s.packetsReceived = stats.packetsReceived;
+			s.bytesReceived = stats.bytesReceived;
+			s.nacksSent = stats.nacksSent;
+			s.keyframeRequestsSent = stats.keyframeRequestsSent;
+			s.bitrateReceived = stats.bitrateReceived;
+			s.packetsLost = stats.packetsLost;
+			s.jitter = stats.jitter;
+			s.rtt = stats.rtt ? int(stats.rtt->count()) : -1;
+			result.push_back(s);
+		}
+		return copyAndReturn(std::move(result), buffer, count);
+	});
+}
+
 #if RTC_ENABLE_MEDIA
 
 void setSSRC(Description::Media *description, uint32_t ssrc, const char *_name, const char *_msid,
@@ -1057,6 +1646,85 @@ int rtcSetH264PacketizationHandler(int tr, const rtcPacketizationHandlerInit *in
 	});
 }
 
+int rtcSetH265PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init) {
+	return wrap([&] {
+		auto track = getTrack(tr);
+		// create RTP configuration
+		auto rtpConfig = createRtpPacketizationConfig(init);
+		// create packetizer
+		auto nalSeparator = init ? init->nalSeparator : RTC_NAL_SEPARATOR_LENGTH;
+		auto maxFragmentSize = init && init->maxFragmentSize ? init->maxFragmentSize
+		                                                     : RTC_DEFAULT_MAXIMUM_FRAGMENT_SIZE;
+		auto packetizer = std::make_shared<H265RtpPacketizer>(
+		    static_cast<rtc::H265RtpPacketizer::Separator>(nalSeparator), rtpConfig,
+		    maxFragmentSize);
+		// create H265 handler
+		auto h265Handler = std::make_shared<H265PacketizationHandler>(packetizer);
+		emplaceMediaChainableHandler(h265Handler, tr);
+		emplaceRtpConfig(rtpConfig, tr);
+		// set handler
+		track->setMediaHandler(h265Handler);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
+int rtcSetAV1PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init) {
+	return wrap([&] {
+		auto track = getTrack(tr);
+		// create RTP configuration
+		auto rtpConfig = createRtpPacketizationConfig(init);
+		// create packetizer
+		auto maxPayloadSize = init && init->maxFragmentSize ? init->maxFragmentSize
+		                                                    : RTC_DEFAULT_MAXIMUM_FRAGMENT_SIZE;
+		auto packetizer = std::make_shared<AV1RtpPacketizer>(rtpConfig, maxPayloadSize);
+		// create AV1 handler
+		auto av1Handler = std::make_shared<AV1PacketizationHandler>(packetizer);
+		emplaceMediaChainableHandler(av1Handler, tr);
+		emplaceRtpConfig(rtpConfig, tr);
+		// set handler
+		track->setMediaHandler(av1Handler);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
+int rtcSetVP8PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init) {
+	return wrap([&] {
+		auto track = getTrack(tr);
+		// create RTP configuration
+		auto rtpConfig = createRtpPacketizationConfig(init);
+		// create packetizer
+		auto maxPayloadSize = init && init->maxFragmentSize ? init->maxFragmentSize
+		                                                    : RTC_DEFAULT_MAXIMUM_FRAGMENT_SIZE;
+		auto packetizer = std::make_shared<VP8RtpPacketizer>(rtpConfig, maxPayloadSize);
+		// create VP8 handler
+		auto vp8Handler = std::make_shared<VP8PacketizationHandler>(packetizer);
+		emplaceMediaChainableHandler(vp8Handler, tr);
+		emplaceRtpConfig(rtpConfig, tr);
+		// set handler
+		track->setMediaHandler(vp8Handler);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
+int rtcSetVP9PacketizationHandler(int tr, const rtcPacketizationHandlerInit *init) {
+	return wrap([&] {
+		auto track = getTrack(tr);
+		// create RTP configuration
+		auto rtpConfig = createRtpPacketizationConfig(init);
+		// create packetizer
+		auto maxPayloadSize = init && init->maxFragmentSize ? init->maxFragmentSize
+		                                                    : RTC_DEFAULT_MAXIMUM_FRAGMENT_SIZE;
+		auto packetizer = std::make_shared<VP9RtpPacketizer>(rtpConfig, maxPayloadSize);
+		// create VP9 handler
+		auto vp9Handler = std::make_shared<VP9PacketizationHandler>(packetizer);
+		emplaceMediaChainableHandler(vp9Handler, tr);
+		emplaceRtpConfig(rtpConfig, tr);
+		// set handler
+		track->setMediaHandler(vp9Handler);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
 int rtcSetOpusPacketizationHandler(int tr, const rtcPacketizationHandlerInit *init) {
 	return wrap([&] {
 		auto track = getTrack(tr);
@@ -1094,6 +1762,45 @@ int rtcChainRtcpNackResponder(int tr, unsigned int maxStoredPacketsCount) {
 	});
 }
 
+int rtcChainRtcpNackResponderRtx(int tr, unsigned int maxStoredPacketsCount, uint32_t rtxSsrc,
+                                 int rtxPayloadType) {
+	return wrap([&] {
+		if (rtxPayloadType < 0 || rtxPayloadType > 127)
+			throw std::invalid_argument("Unexpected RTX payload type");
+
+		auto responder = std::make_shared<RtcpNackResponder>(maxStoredPacketsCount);
+		responder->enableRtx(rtxSsrc, uint8_t(rtxPayloadType));
+		auto chainableHandler = getMediaChainableHandler(tr);
+		chainableHandler->addToChain(responder);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
+int rtcChainRtcpNackRequester(int tr, unsigned int maxRetries) {
+	return wrap([tr, maxRetries] {
+		auto requester = std::make_shared<RtcpNackRequester>(
+		    std::chrono::milliseconds(100),
+		    maxRetries > 0 ? maxRetries : RtcpNackRequester::defaultMaxRetries);
+		auto chainableHandler = getMediaChainableHandler(tr);
+		chainableHandler->addToChain(requester);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
+int rtcChainRtxReceiver(int tr, uint32_t ssrc, uint32_t rtxSsrc, int payloadType,
+                        int rtxPayloadType) {
+	return wrap([&] {
+		if (payloadType < 0 || payloadType > 127 || rtxPayloadType < 0 || rtxPayloadType > 127)
+			throw std::invalid_argument("Unexpected payload type");
+
+		auto receiver = std::make_shared<RtxReceiver>(ssrc, rtxSsrc);
+		receiver->addPayloadType(uint8_t(rtxPayloadType), uint8_t(payloadType));
+		auto chainableHandler = getMediaChainableHandler(tr);
+		chainableHandler->addToChain(receiver);
+		return RTC_ERR_SUCCESS;
+	});
+}
+
 int rtcSetRtpConfigurationStartTime(int id, const rtcStartTime *startTime) {
 	return wrap([&] {
 		auto config = getRtpConfig(id);
@@ -1372,6 +2079,8 @@ void rtcPreload() {
 
 void rtcCleanup() {
 	try {
+		eventQueue.interrupt();
+
 		size_t count = eraseAll();
 		if(count != 0) {
 			PLOG_INFO << count << " objects were not properly destroyed before cleanup";
@@ -1434,3 +2143,39 @@ int rtcSetSctpSettings(const rtcSctpSettings *settings) {
 		return RTC_ERR_SUCCESS;
 	});
 }
+
+int rtcPoll(int timeoutMs) {
+	return wrap([&] { return Poll(std::chrono::milliseconds(std::max(timeoutMs, 0))); });
+}
+
+int rtcGetPollHandle() {
+	return wrap([&] {
+		int fd = GetPollHandle();
+		return fd >= 0 ? fd : RTC_ERR_NOT_AVAIL;
+	});
+}
+
+int rtcGetPollTimeout() {
+	return wrap([&] {
+		auto timeout = GetPollTimeout();
+		return timeout ? int(timeout->count()) : -1;
+	});
+}
+
+int rtcSetThreadPoolSettings(const rtcThreadPoolSettings *settings) {
+	return wrap([&] {
+		ThreadPoolSettings s = {};
+
+		if (settings->workersCount > 0)
+			s.workersCount = unsigned(settings->workersCount);
+
+		if (settings->cryptoWorkersCount > 0)
+			s.cryptoWorkersCount = unsigned(settings->cryptoWorkersCount);
+
+		s.pinWorkers = settings->pinWorkers;
+		s.external = settings->external;
+
+		SetThreadPoolSettings(std::move(s));
+		return RTC_ERR_SUCCESS;
+	});
+}
@@ -51,6 +51,11 @@ void Channel::onMessage(std::function<void(binary data)> binaryCallback,
 	});
 }
 
+void Channel::onMessages(std::function<void(const std::vector<message_ptr> &messages)> callback) {
+	impl()->messagesCallback = callback;
+	impl()->flushPendingMessages();
+}
+
 void Channel::onBufferedAmountLow(std::function<void()> callback) {
 	impl()->bufferedAmountLowCallback = callback;
 }
@@ -63,6 +68,8 @@ optional<message_variant> Channel::receive() { return impl()->receive(); }
 
 optional<message_variant> Channel::peek() { return impl()->peek(); }
 
+message_ptr Channel::receiveMessage() { return impl()->receiveMessage(); }
+
 size_t Channel::availableAmount() const { return impl()->availableAmount(); }
 
 void Channel::onAvailable(std::function<void()> callback) { impl()->availableCallback = callback; }
@@ -56,6 +56,16 @@ string DataChannel::protocol() const { return impl()->protocol(); }
 
 Reliability DataChannel::reliability() const { return impl()->reliability(); }
 
+bool DataChannel::isCompressed() const { return impl()->isCompressed(); }
+
+uint16_t DataChannel::priority() const { return impl()->priority(); }
+
+unsigned int DataChannel::dscp() const { return impl()->dscp(); }
+
+void DataChannel::setDscp(unsigned int dscp) { impl()->setDscp(dscp); }
+
+DataChannelStats DataChannel::stats() const { return impl()->stats(); }
+
 bool DataChannel::isOpen(void) const { return impl()->isOpen(); }
 
 bool DataChannel::isClosed(void) const { return impl()->isClosed(); }
@@ -63,11 +73,72 @@ bool DataChannel::isClosed(void) const { return impl()->isClosed(); }
 size_t DataChannel::maxMessageSize() const { return impl()->maxMessageSize(); }
 
 bool DataChannel::send(message_variant data) {
-	return impl()->outgoing(make_message(std::move(data)));
+	return impl()->outgoing(make_payload_message(std::move(data)));
 }
 
 bool DataChannel::send(const byte *data, size_t size) {
-	return impl()->outgoing(std::make_shared<Message>(data, data + size, Message::Binary));
+	return impl()->outgoing(make_message(data, data + size, Message::Binary));
+}
+
+bool DataChannel::sendBatch(std::vector<message_variant> messages) {
+	std::vector<message_ptr> batch;
+	batch.reserve(messages.size());
+	for (auto &data : messages)
+		batch.push_back(make_payload_message(std::move(data)));
+
+	return impl()->outgoingBatch(std::move(batch));
+}
+
+bool DataChannel::send(message_variant data, const Reliability &reliability) {
+	return impl()->outgoing(make_payload_message(std::move(data)), reliability);
+}
+
+bool DataChannel::sendBatch(std::vector<message_variant> messages,
+                            const Reliability &reliability) {
+	std::vector<message_ptr> batch;
+	batch.reserve(messages.size());
+	for (auto &data : messages)
+		batch.push_back(make_payload_message(std::move(data)));
+
+	return impl()->outgoingBatch(std::move(batch), reliability);
+}
+
+void DataChannel::setSendBudget(optional<size_t> bytes) { impl()->setSendBudget(bytes); }
+
+void DataChannel::setReceiveQueueLimit(optional<size_t> bytes) {
+	impl()->setReceiveQueueLimit(bytes);
+}
+
+void DataChannel::setReceiveWindow(size_t bytes) { impl()->setReceiveWindow(bytes); }
+
+std::future<void> DataChannel::sendAsync(message_variant data) {
+	return impl()->outgoingAsync(make_payload_message(std::move(data)));
+}
+
+std::future<void> DataChannel::sendStream(stream_reader reader) {
+	return impl()->outgoingStream(std::move(reader));
+}
+
+void DataChannel::onFragment(std::function<void(message_variant fragment, bool last)> callback) {
+	impl()->setFragmentCallback(std::move(callback));
+}
+
+bool DataChannel::send(shared_ptr<const binary> data) {
+	if (!data)
+		throw std::invalid_argument("Data is null");
+
+	auto bytes = data->data();
+	auto size = data->size();
+	return impl()->outgoing(make_message(bytes, size, std::move(data)));
+}
+
+bool DataChannel::send(const byte *data, size_t size, std::function<void()> release) {
+	// The owner calls release on destruction, i.e. when the message is discarded
+	shared_ptr<const void> owner(data, [release = std::move(release)](const void *) {
+		if (release)
+			release();
+	});
+	return impl()->outgoing(make_message(data, size, std::move(owner)));
 }
 
 } // namespace rtc
@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <charconv>
 #include <chrono>
 #include <iostream>
 #include <random>
@@ -47,10 +48,63 @@ inline void trim_begin(string &str) {
 	          std::find_if(str.begin(), str.end(), [](char c) { return !std::isspace(c); }));
 }
 
-inline void trim_end(string &str) {
-	str.erase(
-	    std::find_if(str.rbegin(), str.rend(), [](char c) { return !std::isspace(c); }).base(),
-	    str.end());
+inline string_view trim_end(string_view str) {
+	while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+		str.remove_suffix(1);
+	return str;
+}
+
+// Call func on each non-empty line of sdp, lines are views into sdp so nothing is copied
+template <typename F> void for_each_line(string_view sdp, F func) {
+	while (!sdp.empty()) {
+		size_t end = sdp.find('\n');
+		string_view line = trim_end(sdp.substr(0, end));
+		sdp.remove_prefix(end != string::npos ? end + 1 : sdp.size());
+		if (!line.empty())
+			func(line);
+	}
+}
+
+// Split the first whitespace-separated token off str
+inline string_view next_token(string_view &str) {
+	const char *whitespace = " \t\r\n";
+	size_t begin = str.find_first_not_of(whitespace);
+	str.remove_prefix(begin != string::npos ? begin : str.size());
+	size_t end = str.find_first_of(whitespace);
+	string_view token = str.substr(0, end);
+	str.remove_prefix(end != string::npos ? end : str.size());
+	return token;
+}
+
+// Generation appends to a single buffer instead of building intermediate strings
+inline void append(string &out, string_view str) { out.append(str); }
+
+inline void append(string &out, char c) { out.push_back(c); }
+
+template <typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+void append(string &out, T value) {
+	char buffer[24];
+	auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	out.append(buffer, result.ptr);
+}
+
+template <typename A, typename B, typename... Args>
+void append(string &out, A &&a, B &&b, Args &&...args) {
+	append(out, std::forward<A>(a));
+	append(out, std::forward<B>(b), std::forward<Args>(args)...);
+}
+
+// Used for SDP generation, do not change
+inline string_view role_to_string(rtc::Description::Role role) {
+	using Role = rtc::Description::Role;
+	switch (role) {
+	case Role::Active:
+		return "active";
+	case Role::Passive:
+		return "passive";
+	default:
+		return "actpass";
+	}
 }
 
 inline std::pair<string_view, string_view> parse_pair(string_view attr) {
@@ -89,6 +143,93 @@ inline bool is_sha256_fingerprint(string_view f) {
 	return true;
 }
 
+std::vector<uint32_t> parse_ssrc_group(string_view value) {
+	// value is "<semantics> <ssrc> <ssrc>..."
+	std::vector<uint32_t> ssrcs;
+	std::istringstream ss{string(value)};
+	string semantics;
+	ss >> semantics;
+	uint32_t ssrc;
+	while (ss >> ssrc)
+		ssrcs.push_back(ssrc);
+	return ssrcs;
+}
+
+// Returns the send and receive layers of a simulcast attribute value
+// "send <rids> recv <rids>", alternatives are flattened and paused layers are included
+std::pair<std::vector<string>, std::vector<string>> parse_simulcast(string_view value) {
+	std::pair<std::vector<string>, std::vector<string>> result;
+	std::istringstream ss{string(value)};
+	string dir, list;
+	while (ss >> dir >> list) {
+		auto &rids = dir == "recv" ? result.second : result.first;
+		std::istringstream ls(list);
+		string rid;
+		while (std::getline(ls, rid, ';')) {
+			std::istringstream as(rid);
+			string alternative;
+			while (std::getline(as, alternative, ','))
+				if (!alternative.empty())
+					rids.push_back(alternative[0] == '~' ? alternative.substr(1) : alternative);
+		}
+	}
+	return result;
+}
+
+string generate_simulcast(const std::vector<string> &send, const std::vector<string> &recv) {
+	auto join = [](const std::vector<string> &rids) {
+		string list;
+		for (const auto &rid : rids)
+			list += (list.empty() ? "" : ";") + rid;
+		return list;
+	};
+	string value = "simulcast:";
+	if (!send.empty())
+		value += "send " + join(send);
+	if (!recv.empty())
+		value += (send.empty() ? "recv " : " recv ") + join(recv);
+	return value;
+}
+
+// Swaps the send and recv keywords of a rid or simulcast attribute
+string reciprocate_simulcast_attribute(string_view attr) {
+	std::istringstream ss{string(attr)};
+	string result, token;
+	while (ss >> token) {
+		if (token == "send")
+			token = "recv";
+		else if (token == "recv")
+			token = "send";
+
+		result += (result.empty() ? "" : " ") + token;
+	}
+	return result;
+}
+
+std::optional<int> parse_apt(const std::vector<string> &fmtps) {
+	for (const auto &fmtp : fmtps) {
+		std::istringstream ss(fmtp);
+		string param;
+		while (std::getline(ss, param, ';')) {
+			trim_begin(param);
+			if (match_prefix(param, "apt="))
+				return to_integer<int>(string_view(param).substr(4));
+		}
+	}
+	return std::nullopt;
+}
+
+bool is_format(const string &format, string_view name) {
+	return format.size() == name.size() &&
+	       std::equal(format.begin(), format.end(), name.begin(),
+	                  [](char a, char b) { return std::tolower(a) == std::tolower(b); });
+}
+
+bool is_rtx_format(const string &format) {
+	return format.size() == 3 && std::tolower(format[0]) == 'r' &&
+	       std::tolower(format[1]) == 't' && std::tolower(format[2]) == 'x';
+}
+
 } // namespace
 
 namespace rtc {
@@ -99,23 +240,18 @@ Description::Description(const string &sdp, Type type, Role role)
 
 	int index = -1;
 	shared_ptr<Entry> current;
-	std::istringstream ss(sdp);
-	while (ss) {
-		string line;
-		std::getline(ss, line);
-		trim_end(line);
-		if (line.empty())
-			continue;
-
+	for_each_line(sdp, [&](string_view line) {
 		if (match_prefix(line, "m=")) { // Media description line (aka m-line)
-			current = createEntry(line.substr(2), std::to_string(++index), Direction::Unknown);
+			current =
+			    createEntry(string(line.substr(2)), std::to_string(++index), Direction::Unknown);
 
 		} else if (match_prefix(line, "o=")) { // Origin line
-			std::istringstream origin(line.substr(2));
-			origin >> mUsername >> mSessionId;
+			string_view origin = line.substr(2);
+			mUsername = next_token(origin);
+			mSessionId = next_token(origin);
 
 		} else if (match_prefix(line, "a=")) { // Attribute line
-			string attr = line.substr(2);
+			string_view attr = line.substr(2);
 			auto [key, value] = parse_pair(attr);
 
 			if (key == "setup") {
@@ -139,17 +275,20 @@ Description::Description(const string &sdp, Type type, Role role)
 			} else if (key == "ice-pwd") {
 				mIcePwd = value;
 			} else if (key == "candidate") {
-				addCandidate(Candidate(attr, bundleMid()));
+				addCandidate(Candidate(string(attr), bundleMid()));
 			} else if (key == "end-of-candidates") {
 				mEnded = true;
 			} else if (current) {
-				current->parseSdpLine(std::move(line));
+				current->parseSdpLine(line);
 			}
 
 		} else if (current) {
-			current->parseSdpLine(std::move(line));
+			current->parseSdpLine(line);
 		}
-	}
+	});
+
+	// Mids are only known once entries are parsed
+	reindexEntries();
 
 	if (mUsername.empty())
 		mUsername = "rtc";
@@ -173,7 +312,11 @@ string Description::typeString() const { return typeToString(mType); }
 Description::Role Description::role() const { return mRole; }
 
 string Description::bundleMid() const {
-	// Get the mid of the first media
+	// Get the mid of the first media which is not removed
+	for (const auto &entry : mEntries)
+		if (!entry->isRemoved())
+			return entry->mid();
+
 	return !mEntries.empty() ? mEntries[0]->mid() : "0";
 }
 
@@ -237,42 +380,36 @@ std::vector<Candidate> Description::extractCandidates() {
 Description::operator string() const { return generateSdp("\r\n"); }
 
 string Description::generateSdp(string_view eol) const {
-	std::ostringstream sdp;
+	string sdp;
+	sdp.reserve(512 + mEntries.size() * 1024 + mCandidates.size() * 128);
 
 	// Header
-	sdp << "v=0" << eol;
-	sdp << "o=" << mUsername << " " << mSessionId << " 0 IN IP4 127.0.0.1" << eol;
-	sdp << "s=-" << eol;
-	sdp << "t=0 0" << eol;
+	append(sdp, "v=0", eol);
+	append(sdp, "o=", mUsername, ' ', mSessionId, " 0 IN IP4 127.0.0.1", eol);
+	append(sdp, "s=-", eol);
+	append(sdp, "t=0 0", eol);
 
 	// Bundle (RFC8843 Negotiating Media Multiplexing Using the Session Description Protocol)
 	// https://tools.ietf.org/html/rfc8843
-	sdp << "a=group:BUNDLE";
+	append(sdp, "a=group:BUNDLE");
 	for (const auto &entry : mEntries)
-		sdp << ' ' << entry->mid();
-	sdp << eol;
+		if (!entry->isRemoved())
+			append(sdp, ' ', entry->mid());
+	append(sdp, eol);
 
 	// Lip-sync
-	std::ostringstream lsGroup;
-	for (const auto &entry : mEntries)
-		if (entry != mApplication)
-			lsGroup << ' ' << entry->mid();
-
-	if (!lsGroup.str().empty())
-		sdp << "a=group:LS" << lsGroup.str() << eol;
+	if (std::any_of(mEntries.begin(), mEntries.end(), [this](const auto &entry) {
+		    return entry != mApplication && !entry->isRemoved();
+	    })) {
+		append(sdp, "a=group:LS");
+		for (const auto &entry : mEntries)
+			if (entry != mApplication && !entry->isRemoved())
+				append(sdp, ' ', entry->mid());
+		append(sdp, eol);
+	}
 
 	// Session-level attributes
-	sdp << "a=msid-semantic:WMS *" << eol;
-	sdp << "a=setup:" << mRole << eol;
-
-	if (mIceUfrag)
-		sdp << "a=ice-ufrag:" << *mIceUfrag << eol;
-	if (mIcePwd)
-		sdp << "a=ice-pwd:" << *mIcePwd << eol;
-	if (!mEnded)
-		sdp << "a=ice-options:trickle" << eol;
-	if (mFingerprint)
-		sdp << "a=fingerprint:sha-256 " << *mFingerprint << eol;
+	appendSessionAttributes(sdp, eol);
 
 	auto cand = defaultCandidate();
 	const string addr = cand && cand->isResolved()
@@ -285,29 +422,31 @@ string Description::generateSdp(string_view eol) const {
 	// Entries
 	bool first = true;
 	for (const auto &entry : mEntries) {
-		sdp << entry->generateSdp(eol, addr, port);
+		entry->appendSdp(sdp, eol, addr, port);
 
-		if (std::exchange(first, false)) {
+		// Candidates go with the first bundled entry
+		if (!entry->isRemoved() && std::exchange(first, false)) {
 			// Candidates
 			for (const auto &candidate : mCandidates)
-				sdp << string(candidate) << eol;
+				append(sdp, string(candidate), eol);
 
 			if (mEnded)
-				sdp << "a=end-of-candidates" << eol;
+				append(sdp, "a=end-of-candidates", eol);
 		}
 	}
 
-	return sdp.str();
+	return sdp;
 }
 
 string Description::generateApplicationSdp(string_view eol) const {
-	std::ostringstream sdp;
+	string sdp;
+	sdp.reserve(1024 + mCandidates.size() * 128);
 
 	// Header
-	sdp << "v=0" << eol;
-	sdp << "o=" << mUsername << " " << mSessionId << " 0 IN IP4 127.0.0.1" << eol;
-	sdp << "s=-" << eol;
-	sdp << "t=0 0" << eol;
+	append(sdp, "v=0", eol);
+	append(sdp, "o=", mUsername, ' ', mSessionId, " 0 IN IP4 127.0.0.1", eol);
+	append(sdp, "s=-", eol);
+	append(sdp, "t=0 0", eol);
 
 	auto cand = defaultCandidate();
 	const string addr = cand && cand->isResolved()
@@ -319,29 +458,33 @@ string Description::generateApplicationSdp(string_view eol) const {
 
 	// Application
 	auto app = mApplication ? mApplication : std::make_shared<Application>();
-	sdp << app->generateSdp(eol, addr, port);
+	app->appendSdp(sdp, eol, addr, port);
 
 	// Session-level attributes
-	sdp << "a=msid-semantic:WMS *" << eol;
-	sdp << "a=setup:" << mRole << eol;
-
-	if (mIceUfrag)
-		sdp << "a=ice-ufrag:" << *mIceUfrag << eol;
-	if (mIcePwd)
-		sdp << "a=ice-pwd:" << *mIcePwd << eol;
-	if (!mEnded)
-		sdp << "a=ice-options:trickle" << eol;
-	if (mFingerprint)
-		sdp << "a=fingerprint:sha-256 " << *mFingerprint << eol;
+	appendSessionAttributes(sdp, eol);
 
 	// Candidates
 	for (const auto &candidate : mCandidates)
-		sdp << string(candidate) << eol;
+		append(sdp, string(candidate), eol);
 
 	if (mEnded)
-		sdp << "a=end-of-candidates" << eol;
+		append(sdp, "a=end-of-candidates", eol);
+
+	return sdp;
+}
 
-	return sdp.str();
+void Description::appendSessionAttributes(string &sdp, string_view eol) const {
+	append(sdp, "a=msid-semantic:WMS *", eol);
+	append(sdp, "a=setup:", role_to_string(mRole), eol);
+
+	if (mIceUfrag)
+		append(sdp, "a=ice-ufrag:", *mIceUfrag, eol);
+	if (mIcePwd)
+		append(sdp, "a=ice-pwd:", *mIcePwd, eol);
+	if (!mEnded)
+		append(sdp, "a=ice-options:trickle", eol);
+	if (mFingerprint)
+		append(sdp, "a=fingerprint:sha-256 ", *mFingerprint, eol);
 }
 
 optional<Candidate> Description::defaultCandidate() const {
@@ -364,6 +507,11 @@ shared_ptr<Description::Entry> Description::createEntry(string mline, string mid
 	if (type == "application") {
 		removeApplication();
 		mApplication = std::make_shared<Application>(std::move(mid));
+		string_view view = mline;
+		next_token(view);
+		if (next_token(view) == "0") // port 0, unless bundle-only
+			mApplication->markRemoved();
+
 		mEntries.emplace_back(mApplication);
 		return mApplication;
 	} else {
@@ -382,9 +530,29 @@ void Description::removeApplication() {
 		mEntries.erase(it);
 
 	mApplication.reset();
+	reindexEntries();
+}
+
+void Description::indexEntry(unsigned int index) {
+	const auto &entry = mEntries[index];
+	mMidIndex.emplace(entry->mid(), index); // the first entry wins on duplicates
+	if (entry == mApplication)
+		return;
+
+	if (auto media = dynamic_cast<const Media *>(entry.get())) {
+		for (uint32_t ssrc : media->getSSRCs())
+			mSsrcIndex.emplace(ssrc, index);
+	}
 }
 
-bool Description::hasApplication() const { return mApplication != nullptr; }
+void Description::reindexEntries() {
+	mMidIndex.clear();
+	mSsrcIndex.clear();
+	for (unsigned int i = 0; i < mEntries.size(); ++i)
+		indexEntry(i);
+}
+
+bool Description::hasApplication() const { return mApplication && !mApplication->isRemoved(); }
 
 bool Description::hasAudioOrVideo() const {
 	for (auto entry : mEntries)
@@ -394,16 +562,46 @@ bool Description::hasAudioOrVideo() const {
 	return false;
 }
 
-bool Description::hasMid(string_view mid) const {
-	for (const auto &entry : mEntries)
-		if (entry->mid() == mid)
-			return true;
+bool Description::hasMid(string_view mid) const { return mediaIndex(mid).has_value(); }
 
-	return false;
+optional<unsigned int> Description::mediaIndex(string_view mid) const {
+	auto it = mMidIndex.find(string(mid));
+	if (it == mMidIndex.end())
+		return nullopt;
+
+	if (it->second < mEntries.size() && mEntries[it->second]->mid() == mid)
+		return it->second;
+
+	// The mid has been changed in place
+	for (unsigned int i = 0; i < mEntries.size(); ++i)
+		if (mEntries[i]->mid() == mid)
+			return i;
+
+	return nullopt;
+}
+
+optional<unsigned int> Description::mediaIndexFromSsrc(uint32_t ssrc) const {
+	auto hasSsrc = [this, ssrc](unsigned int index) {
+		const auto &entry = mEntries[index];
+		auto media = entry != mApplication ? dynamic_cast<const Media *>(entry.get()) : nullptr;
+		return media && media->hasSSRC(ssrc);
+	};
+
+	if (auto it = mSsrcIndex.find(ssrc);
+	    it != mSsrcIndex.end() && it->second < mEntries.size() && hasSsrc(it->second))
+		return it->second;
+
+	// SSRCs might have been changed in place on media, which only needs a check per entry
+	for (unsigned int i = 0; i < mEntries.size(); ++i)
+		if (hasSsrc(i))
+			return i;
+
+	return nullopt;
 }
 
 int Description::addMedia(Media media) {
 	mEntries.emplace_back(std::make_shared<Media>(std::move(media)));
+	indexEntry(unsigned(mEntries.size()) - 1);
 	return int(mEntries.size()) - 1;
 }
 
@@ -411,6 +609,7 @@ int Description::addMedia(Application application) {
 	removeApplication();
 	mApplication = std::make_shared<Application>(std::move(application));
 	mEntries.emplace_back(mApplication);
+	indexEntry(unsigned(mEntries.size()) - 1);
 	return int(mEntries.size()) - 1;
 }
 
@@ -431,6 +630,8 @@ int Description::addAudio(string mid, Direction dir) {
 void Description::clearMedia() {
 	mEntries.clear();
 	mApplication.reset();
+	mMidIndex.clear();
+	mSsrcIndex.clear();
 }
 
 variant<Description::Media *, Description::Application *> Description::media(unsigned int index) {
@@ -475,70 +676,82 @@ unsigned int Description::mediaCount() const { return unsigned(mEntries.size());
 Description::Entry::Entry(const string &mline, string mid, Direction dir)
     : mMid(std::move(mid)), mDirection(dir) {
 
-	unsigned int port;
-	std::istringstream ss(mline);
-	ss >> mType;
-	ss >> port; // ignored
-	ss >> mDescription;
+	string_view view = mline;
+	mType = next_token(view);
+	mIsRemoved = next_token(view) == "0"; // the port is ignored otherwise
+	mDescription = next_token(view);
 }
 
 void Description::Entry::setDirection(Direction dir) { mDirection = dir; }
 
+void Description::Entry::markRemoved() { mIsRemoved = true; }
+
 Description::Entry::operator string() const { return generateSdp("\r\n", "IP4 0.0.0.0", "9"); }
 
 string Description::Entry::generateSdp(string_view eol, string_view addr, string_view port) const {
-	std::ostringstream sdp;
-	sdp << "m=" << type() << ' ' << port << ' ' << description() << eol;
-	sdp << "c=IN " << addr << eol;
-	sdp << generateSdpLines(eol);
+	string sdp;
+	appendSdp(sdp, eol, addr, port);
+	return sdp;
+}
+
+void Description::Entry::appendSdp(string &sdp, string_view eol, string_view addr,
+                                   string_view port) const {
+	if (mIsRemoved) {
+		// See https://www.rfc-editor.org/rfc/rfc8843.html#section-7.3.3
+		append(sdp, "m=", type(), " 0 ", description(), eol);
+		append(sdp, "c=IN ", addr, eol);
+		append(sdp, "a=mid:", mMid, eol);
+		return;
+	}
 
-	return sdp.str();
+	append(sdp, "m=", type(), ' ', port, ' ', description(), eol);
+	append(sdp, "c=IN ", addr, eol);
+	appendSdpLines(sdp, eol);
 }
 
-string Description::Entry::generateSdpLines(string_view eol) const {
-	std::ostringstream sdp;
-	sdp << "a=bundle-only" << eol;
-	sdp << "a=mid:" << mMid << eol;
+void Description::Entry::appendSdpLines(string &sdp, string_view eol) const {
+	append(sdp, "a=bundle-only", eol);
+	append(sdp, "a=mid:", mMid, eol);
 
 	for (auto it = mExtMap.begin(); it != mExtMap.end(); ++it) {
 		auto &map = it->second;
 
-		sdp << "a=extmap:" << map.id;
+		append(sdp, "a=extmap:", map.id);
 		switch (map.direction) {
 		case Direction::SendOnly:
-			sdp << "/sendonly";
+			append(sdp, "/sendonly");
 			break;
 		case Direction::RecvOnly:
-			sdp << "/recvonly";
+			append(sdp, "/recvonly");
 			break;
 		case Direction::SendRecv:
-			sdp << "/sendrecv";
+			append(sdp, "/sendrecv");
 			break;
 		case Direction::Inactive:
-			sdp << "/inactive";
+			append(sdp, "/inactive");
 			break;
 		default:
 			// Ignore
 			break;
 		}
-		sdp << ' ' << map.uri;
+		append(sdp, ' ', map.uri);
 		if (!map.attributes.empty())
-			sdp << ' ' << map.attributes;
-		sdp << eol;
+			append(sdp, ' ', map.attributes);
+		append(sdp, eol);
 	}
 
 	switch (mDirection) {
 	case Direction::SendOnly:
-		sdp << "a=sendonly" << eol;
+		append(sdp, "a=sendonly", eol);
 		break;
 	case Direction::RecvOnly:
-		sdp << "a=recvonly" << eol;
+		append(sdp, "a=recvonly", eol);
 		break;
 	case Direction::SendRecv:
-		sdp << "a=sendrecv" << eol;
+		append(sdp, "a=sendrecv", eol);
 		break;
 	case Direction::Inactive:
-		sdp << "a=inactive" << eol;
+		append(sdp, "a=inactive", eol);
 		break;
 	default:
 		// Ignore
@@ -547,10 +760,8 @@ string Description::Entry::generateSdpLines(string_view eol) const {
 
 	for (const auto &attr : mAttributes) {
 		if (attr.find("extmap") == string::npos && attr.find("rtcp-rsize") == string::npos)
-			sdp << "a=" << attr << eol;
+			append(sdp, "a=", attr, eol);
 	}
-
-	return sdp.str();
 }
 
 void Description::Entry::parseSdpLine(string_view line) {
@@ -577,7 +788,8 @@ void Description::Entry::parseSdpLine(string_view line) {
 		else if (key == "inactive")
 			mDirection = Direction::Inactive;
 		else if (key == "bundle-only") {
-			// always added
+			// always added, a bundle-only entry has port 0 but is not removed
+			mIsRemoved = false;
 		} else
 			mAttributes.emplace_back(line.substr(2));
 	}
@@ -667,24 +879,26 @@ void Description::Media::addSSRC(uint32_t ssrc, optional<string> name, optional<
 		                         trackID.value_or(*msid));
 
 	mSsrcs.emplace_back(ssrc);
+	mSsrcSet.insert(ssrc);
 }
 
 void Description::Media::removeSSRC(uint32_t oldSSRC) {
 	auto it = mAttributes.begin();
 	while (it != mAttributes.end()) {
-		if (match_prefix(*it, "ssrc:" + std::to_string(oldSSRC)))
+		bool remove = match_prefix(*it, "ssrc:" + std::to_string(oldSSRC));
+		if (!remove && match_prefix(*it, "ssrc-group:")) {
+			// Groups including the SSRC are meaningless without it
+			auto group = parse_ssrc_group(string_view(*it).substr(11));
+			remove = std::find(group.begin(), group.end(), oldSSRC) != group.end();
+		}
+		if (remove)
 			it = mAttributes.erase(it);
 		else
 			++it;
 	}
 
-	auto jt = mSsrcs.begin();
-	while (jt != mSsrcs.end()) {
-		if (*jt == oldSSRC)
-			jt = mSsrcs.erase(jt);
-		else
-			++jt;
-	}
+	mSsrcs.erase(std::remove(mSsrcs.begin(), mSsrcs.end(), oldSSRC), mSsrcs.end());
+	mSsrcSet.erase(oldSSRC);
 }
 
 void Description::Media::replaceSSRC(uint32_t oldSSRC, uint32_t ssrc, optional<string> name,
@@ -693,8 +907,81 @@ void Description::Media::replaceSSRC(uint32_t oldSSRC, uint32_t ssrc, optional<s
 	addSSRC(ssrc, std::move(name), std::move(msid), std::move(trackID));
 }
 
-bool Description::Media::hasSSRC(uint32_t ssrc) {
-	return std::find(mSsrcs.begin(), mSsrcs.end(), ssrc) != mSsrcs.end();
+bool Description::Media::hasSSRC(uint32_t ssrc) const { return mSsrcSet.count(ssrc) > 0; }
+
+void Description::Media::addSSRCGroup(const string &semantics, const std::vector<uint32_t> &ssrcs) {
+	string attr = "ssrc-group:" + semantics;
+	for (uint32_t ssrc : ssrcs)
+		attr += ' ' + std::to_string(ssrc);
+
+	mAttributes.emplace_back(std::move(attr));
+}
+
+std::vector<std::vector<uint32_t>>
+Description::Media::getSSRCGroups(const string &semantics) const {
+	std::vector<std::vector<uint32_t>> groups;
+	const string prefix = "ssrc-group:" + semantics + ' ';
+	for (const auto &attr : mAttributes)
+		if (match_prefix(attr, prefix))
+			groups.emplace_back(parse_ssrc_group(string_view(attr).substr(11)));
+
+	return groups;
+}
+
+optional<uint32_t> Description::Media::getRtxSSRC(uint32_t ssrc) const {
+	// The FID group lists the original SSRC then the RTX SSRC (RFC 4588)
+	for (const auto &group : getSSRCGroups("FID"))
+		if (group.size() >= 2 && group[0] == ssrc)
+			return group[1];
+
+	return nullopt;
+}
+
+void Description::Media::addRid(const string &rid, Direction direction) {
+	const bool recv = direction == Direction::RecvOnly;
+	mAttributes.emplace_back("rid:" + rid + (recv ? " recv" : " send"));
+
+	auto it = std::find_if(mAttributes.begin(), mAttributes.end(),
+	                       [](const string &attr) { return match_prefix(attr, "simulcast:"); });
+
+	std::pair<std::vector<string>, std::vector<string>> layers;
+	if (it != mAttributes.end())
+		layers = parse_simulcast(string_view(*it).substr(10));
+
+	(recv ? layers.second : layers.first).push_back(rid);
+	auto attr = generate_simulcast(layers.first, layers.second);
+	if (it != mAttributes.end())
+		*it = std::move(attr);
+	else
+		mAttributes.emplace_back(std::move(attr));
+}
+
+std::vector<string> Description::Media::getRids(Direction direction) const {
+	const bool recv = direction == Direction::RecvOnly;
+	for (const auto &attr : mAttributes) {
+		if (match_prefix(attr, "simulcast:")) {
+			// The simulcast attribute lists the layers in order of preference
+			auto layers = parse_simulcast(string_view(attr).substr(10));
+			return recv ? layers.second : layers.first;
+		}
+	}
+
+	std::vector<string> rids;
+	for (const auto &attr : mAttributes) {
+		if (!match_prefix(attr, "rid:"))
+			continue;
+
+		std::istringstream ss(attr.substr(4));
+		string rid, dir;
+		if (ss >> rid >> dir && (dir == "recv") == recv)
+			rids.push_back(std::move(rid));
+	}
+	return rids;
+}
+
+bool Description::Media::hasSimulcast() const {
+	return std::any_of(mAttributes.begin(), mAttributes.end(),
+	                   [](const string &attr) { return match_prefix(attr, "simulcast:"); });
 }
 
 Description::Application::Application(string mid)
@@ -708,21 +995,22 @@ Description::Application Description::Application::reciprocate() const {
 	Application reciprocated(*this);
 
 	reciprocated.mMaxMessageSize.reset();
+	reciprocated.mDatagrams = false;
 
 	return reciprocated;
 }
 
-string Description::Application::generateSdpLines(string_view eol) const {
-	std::ostringstream sdp;
-	sdp << Entry::generateSdpLines(eol);
+void Description::Application::appendSdpLines(string &sdp, string_view eol) const {
+	Entry::appendSdpLines(sdp, eol);
 
 	if (mSctpPort)
-		sdp << "a=sctp-port:" << *mSctpPort << eol;
+		append(sdp, "a=sctp-port:", *mSctpPort, eol);
 
 	if (mMaxMessageSize)
-		sdp << "a=max-message-size:" << *mMaxMessageSize << eol;
+		append(sdp, "a=max-message-size:", *mMaxMessageSize, eol);
 
-	return sdp.str();
+	if (mDatagrams)
+		append(sdp, "a=x-rtc-datagram", eol);
 }
 
 void Description::Application::parseSdpLine(string_view line) {
@@ -734,6 +1022,8 @@ void Description::Application::parseSdpLine(string_view line) {
 			mSctpPort = to_integer<uint16_t>(value);
 		} else if (key == "max-message-size") {
 			mMaxMessageSize = to_integer<size_t>(value);
+		} else if (key == "x-rtc-datagram") {
+			mDatagrams = true;
 		} else {
 			Entry::parseSdpLine(line);
 		}
@@ -743,16 +1033,7 @@ void Description::Application::parseSdpLine(string_view line) {
 }
 
 Description::Media::Media(const string &sdp) : Entry(sdp, "", Direction::Unknown) {
-	std::istringstream ss(sdp);
-	while (ss) {
-		string line;
-		std::getline(ss, line);
-		trim_end(line);
-		if (line.empty())
-			continue;
-
-		parseSdpLine(line);
-	}
+	for_each_line(sdp, [this](string_view line) { parseSdpLine(line); });
 
 	if (mid().empty())
 		throw std::invalid_argument("Missing mid in media SDP");
@@ -802,15 +1083,19 @@ Description::Media Description::Media::reciprocate() const {
 		}
 	}
 
-	// Clear all ssrc attributes as they are individual
+	// Clear all ssrc attributes as they are individual, and invert simulcast layers
 	auto it = reciprocated.mAttributes.begin();
 	while (it != reciprocated.mAttributes.end()) {
-		if (match_prefix(*it, "ssrc:"))
+		if (match_prefix(*it, "ssrc:") || match_prefix(*it, "ssrc-group:")) {
 			it = reciprocated.mAttributes.erase(it);
-		else
+		} else {
+			if (match_prefix(*it, "rid:") || match_prefix(*it, "simulcast:"))
+				*it = reciprocate_simulcast_attribute(*it);
 			++it;
+		}
 	}
 	reciprocated.mSsrcs.clear();
+	reciprocated.mSsrcSet.clear();
 	reciprocated.mCNameMap.clear();
 
 	return reciprocated;
@@ -909,10 +1194,69 @@ void Description::Media::addRTXCodec(unsigned int payloadType, unsigned int orig
 	addRTPMap(map);
 }
 
+optional<int> Description::Media::getRtxPayloadType(int originalPayloadType) const {
+	for (const auto &[pt, map] : mRtpMap)
+		if (is_rtx_format(map.format) && parse_apt(map.fmtps) == originalPayloadType)
+			return pt;
+
+	return nullopt;
+}
+
+optional<int> Description::Media::getRtxOriginalPayloadType(int rtxPayloadType) const {
+	auto it = mRtpMap.find(rtxPayloadType);
+	if (it == mRtpMap.end() || !is_rtx_format(it->second.format))
+		return nullopt;
+
+	return parse_apt(it->second.fmtps);
+}
+
+void Description::Media::addREDCodec(unsigned int payloadType, unsigned int primaryPayloadType,
+                                     unsigned int redundancy) {
+	const auto &primary = getFormat(int(primaryPayloadType));
+	RTPMap map(std::to_string(payloadType) + " red/" + std::to_string(primary.clockRate) +
+	           (primary.encParams.empty() ? "" : "/" + primary.encParams));
+	if (redundancy > 0) {
+		string blocks = std::to_string(primaryPayloadType);
+		for (unsigned int i = 0; i < redundancy; ++i)
+			blocks += "/" + std::to_string(primaryPayloadType);
+
+		map.fmtps.emplace_back(std::move(blocks));
+	}
+	addRTPMap(map);
+}
+
+void Description::Media::addULPFECCodec(unsigned int payloadType, unsigned int clockRate) {
+	addRTPMap(RTPMap(std::to_string(payloadType) + " ulpfec/" + std::to_string(clockRate)));
+}
+
+optional<int> Description::Media::getRedPayloadType() const {
+	for (const auto &[pt, map] : mRtpMap)
+		if (is_format(map.format, "red"))
+			return pt;
+
+	return nullopt;
+}
+
+optional<int> Description::Media::getUlpfecPayloadType() const {
+	for (const auto &[pt, map] : mRtpMap)
+		if (is_format(map.format, "ulpfec"))
+			return pt;
+
+	return nullopt;
+}
+
 void Description::Video::addH264Codec(int pt, optional<string> profile) {
 	addVideoCodec(pt, "H264", profile);
 }
 
+void Description::Video::addH265Codec(int payloadType) {
+	addVideoCodec(payloadType, "H265", nullopt);
+}
+
+void Description::Video::addAV1Codec(int payloadType) {
+	addVideoCodec(payloadType, "AV1", nullopt);
+}
+
 void Description::Video::addVP8Codec(int payloadType) {
 	addVideoCodec(payloadType, "VP8", nullopt);
 }
@@ -929,32 +1273,29 @@ bool Description::Media::hasPayloadType(int payloadType) const {
 	return mRtpMap.find(payloadType) != mRtpMap.end();
 }
 
-string Description::Media::generateSdpLines(string_view eol) const {
-	std::ostringstream sdp;
+void Description::Media::appendSdpLines(string &sdp, string_view eol) const {
 	if (mBas >= 0)
-		sdp << "b=AS:" << mBas << eol;
+		append(sdp, "b=AS:", mBas, eol);
 
-	sdp << Entry::generateSdpLines(eol);
-	sdp << "a=rtcp-mux" << eol;
+	Entry::appendSdpLines(sdp, eol);
+	append(sdp, "a=rtcp-mux", eol);
 
 	for (auto it = mRtpMap.begin(); it != mRtpMap.end(); ++it) {
 		auto &map = it->second;
 
 		// Create the a=rtpmap
-		sdp << "a=rtpmap:" << map.pt << ' ' << map.format << '/' << map.clockRate;
+		append(sdp, "a=rtpmap:", map.pt, ' ', map.format, '/', map.clockRate);
 		if (!map.encParams.empty())
-			sdp << '/' << map.encParams;
-		sdp << eol;
+			append(sdp, '/', map.encParams);
+		append(sdp, eol);
 
 		for (const auto &val : map.rtcpFbs) {
 			if (val != "transport-cc")
-				sdp << "a=rtcp-fb:" << map.pt << ' ' << val << eol;
+				append(sdp, "a=rtcp-fb:", map.pt, ' ', val, eol);
 		}
 		for (const auto &val : map.fmtps)
-			sdp << "a=fmtp:" << map.pt << ' ' << val << eol;
+			append(sdp, "a=fmtp:", map.pt, ' ', val, eol);
 	}
-
-	return sdp.str();
 }
 
 void Description::Media::parseSdpLine(string_view line) {
@@ -972,6 +1313,11 @@ void Description::Media::parseSdpLine(string_view line) {
 			}
 		} else if (key == "rtcp-fb") {
 			size_t p = value.find(' ');
+			if (value.substr(0, p) == "*") {
+				// Feedback for all payload types is kept as an attribute, e.g. ccfb (RFC 8888)
+				Entry::parseSdpLine(line);
+				return;
+			}
 			int pt = to_integer<int>(value.substr(0, p));
 			auto it = mRtpMap.find(pt);
 			if (it == mRtpMap.end()) {
@@ -989,9 +1335,9 @@ void Description::Media::parseSdpLine(string_view line) {
 			// always added
 		} else if (key == "ssrc") {
 			auto ssrc = to_integer<uint32_t>(value);
-			if (!hasSSRC(ssrc)) {
+			if (mSsrcSet.insert(ssrc).second)
 				mSsrcs.emplace_back(ssrc);
-			}
+
 			auto cnamePos = value.find("cname:");
 			if (cnamePos != string::npos) {
 				auto cname = value.substr(cnamePos + 6);
@@ -1012,7 +1358,7 @@ void Description::Media::addRTPMap(const Description::Media::RTPMap &map) {
 	mRtpMap.emplace(map.pt, map);
 }
 
-std::vector<uint32_t> Description::Media::getSSRCs() { return mSsrcs; }
+std::vector<uint32_t> Description::Media::getSSRCs() const { return mSsrcs; }
 
 optional<string> Description::Media::getCNameForSsrc(uint32_t ssrc) {
 	auto it = mCNameMap.find(ssrc);
@@ -1131,18 +1477,5 @@ std::ostream &operator<<(std::ostream &out, rtc::Description::Type type) {
 }
 
 std::ostream &operator<<(std::ostream &out, rtc::Description::Role role) {
-	using Role = rtc::Description::Role;
-	// Used for SDP generation, do not change
-	switch (role) {
-	case Role::Active:
-		out << "active";
-		break;
-	case Role::Passive:
-		out << "passive";
-		break;
-	default:
-		out << "actpass";
-		break;
-	}
-	return out;
+	return out << role_to_string(role);
 }
@@ -0,0 +1,226 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "framechannel.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace rtc {
+
+namespace {
+
+// Chunk header: frame number, frame size, chunk offset (32 bits each), and frame lifetime in
+// milliseconds (16 bits), all in network order
+const size_t ChunkHeaderSize = 14;
+
+const auto MaxLifetime = std::chrono::milliseconds(0xFFFF);
+
+void writeUint32(byte *p, uint32_t value) {
+	p[0] = byte(value >> 24);
+	p[1] = byte((value >> 16) & 0xFF);
+	p[2] = byte((value >> 8) & 0xFF);
+	p[3] = byte(value & 0xFF);
+}
+
+uint32_t readUint32(const byte *p) {
+	return std::to_integer<uint32_t>(p[0]) << 24 | std::to_integer<uint32_t>(p[1]) << 16 |
+	       std::to_integer<uint32_t>(p[2]) << 8 | std::to_integer<uint32_t>(p[3]);
+}
+
+// Frame numbers wrap around
+bool isNewer(uint32_t number, uint32_t other) { return int32_t(number - other) > 0; }
+
+} // namespace
+
+FrameChannel::FrameChannel(shared_ptr<DataChannel> _channel, Configuration _config)
+    : channel(std::move(_channel)), config(std::move(_config)) {
+	if (!channel)
+		throw std::invalid_argument("DataChannel is null");
+
+	if (config.chunkSize == 0 || config.maxPendingFrames == 0)
+		throw std::invalid_argument("Invalid frame channel configuration");
+
+	channel->onMessage([this](binary chunk) { incoming(std::move(chunk)); }, nullptr);
+}
+
+FrameChannel::~FrameChannel() { channel->onMessage(nullptr); }
+
+bool FrameChannel::sendFrame(const binary &frame, std::chrono::milliseconds deadline) {
+	return sendFrame(frame.data(), frame.size(), deadline);
+}
+
+bool FrameChannel::sendFrame(const byte *data, size_t size, std::chrono::milliseconds deadline) {
+	if (deadline.count() <= 0 || deadline > MaxLifetime)
+		throw std::invalid_argument("Invalid frame deadline");
+
+	if (size > std::numeric_limits<uint32_t>::max())
+		throw std::invalid_argument("Frame is too large");
+
+	const size_t maxMessageSize = channel->maxMessageSize();
+	if (maxMessageSize <= ChunkHeaderSize)
+		throw std::runtime_error("Message size is too small for frame chunks");
+
+	const size_t chunkSize = std::min(config.chunkSize, maxMessageSize - ChunkHeaderSize);
+
+	uint32_t number;
+	{
+		std::lock_guard lock(mutex);
+		number = nextNumber++;
+		++counters.framesSent;
+	}
+
+	// Chunks are abandoned by SCTP once the frame is late, whatever the channel reliability
+	Reliability reliability;
+	reliability.type = Reliability::Type::Timed;
+	reliability.rexmit = deadline;
+	reliability.unordered = channel->reliability().unordered;
+
+	std::vector<message_variant> chunks;
+	chunks.reserve(size / chunkSize + 1);
+	size_t offset = 0;
+	do {
+		const size_t length = std::min(chunkSize, size - offset);
+		binary chunk(ChunkHeaderSize + length);
+		writeUint32(chunk.data(), number);
+		writeUint32(chunk.data() + 4, uint32_t(size));
+		writeUint32(chunk.data() + 8, uint32_t(offset));
+		chunk[12] = byte(deadline.count() >> 8);
+		chunk[13] = byte(deadline.count() & 0xFF);
+		if (length > 0)
+			std::memcpy(chunk.data() + ChunkHeaderSize, data + offset, length);
+
+		chunks.emplace_back(std::move(chunk));
+		offset += length;
+	} while (offset < size);
+
+	return channel->sendBatch(std::move(chunks), reliability);
+}
+
+void FrameChannel::onFrame(frame_callback callback) { frameCallback = std::move(callback); }
+
+FrameChannel::Stats FrameChannel::stats() const {
+	std::lock_guard lock(mutex);
+	return counters;
+}
+
+void FrameChannel::incoming(binary chunk) {
+	if (chunk.size() < ChunkHeaderSize) {
+		LOG_WARNING << "Frame chunk is too short, size=" << chunk.size();
+		return;
+	}
+
+	const uint32_t number = readUint32(chunk.data());
+	const size_t size = readUint32(chunk.data() + 4);
+	const size_t offset = readUint32(chunk.data() + 8);
+	const auto lifetime = std::chrono::milliseconds(std::to_integer<unsigned int>(chunk[12]) << 8 |
+	                                                std::to_integer<unsigned int>(chunk[13]));
+	const size_t length = chunk.size() - ChunkHeaderSize;
+	if (offset > size || length > size - offset) {
+		LOG_WARNING << "Invalid frame chunk";
+		return;
+	}
+
+	const auto now = clock::now();
+	binary frame;
+	{
+		std::lock_guard lock(mutex);
+
+		// Frames past their deadline are dropped along with the previous ones
+		auto expired = std::find_if(pending.rbegin(), pending.rend(),
+		                            [&](const Pending &p) { return p.deadline <= now; });
+		if (expired != pending.rend())
+			dropUntil(expired->number);
+
+		if (floor && !isNewer(number, *floor))
+			return; // late chunk
+
+		if (size > config.maxFrameSize) {
+			LOG_WARNING << "Incoming frame is too large, size=" << size;
+			++counters.framesDropped;
+			floor = number;
+			return;
+		}
+
+		// Pending frames are kept ordered by number
+		auto it = std::find_if(pending.begin(), pending.end(),
+		                       [&](const Pending &p) { return !isNewer(number, p.number); });
+		if (it == pending.end() || it->number != number) {
+			if (pending.size() >= config.maxPendingFrames) {
+				if (it == pending.begin())
+					return; // older than all the frames being reassembled
+
+				dropUntil(pending.front().number);
+				it = std::find_if(pending.begin(), pending.end(),
+				                  [&](const Pending &p) { return !isNewer(number, p.number); });
+			}
+			it = pending.insert(it, Pending{number, acquireBuffer(size), 0, now + lifetime});
+		}
+
+		if (it->buffer.size() != size) {
+			LOG_WARNING << "Frame chunks have inconsistent sizes";
+			return;
+		}
+
+		if (length > 0)
+			std::memcpy(it->buffer.data() + offset, chunk.data() + ChunkHeaderSize, length);
+
+		it->received += length;
+		if (it->received < size)
+			return;
+
+		// The frame is complete, previous incomplete frames are late now
+		frame = std::move(it->buffer);
+		pending.erase(it);
+		dropUntil(number);
+		++counters.framesReceived;
+	}
+
+	frameCallback(frame);
+
+	std::lock_guard lock(mutex);
+	if (freeBuffers.size() < config.maxPendingFrames)
+		freeBuffers.push_back(std::move(frame));
+}
+
+void FrameChannel::dropUntil(uint32_t number) {
+	while (!pending.empty() && !isNewer(pending.front().number, number)) {
+		if (freeBuffers.size() < config.maxPendingFrames)
+			freeBuffers.push_back(std::move(pending.front().buffer));
+
+		pending.erase(pending.begin());
+		++counters.framesDropped;
+	}
+
+	if (!floor || isNewer(number, *floor))
+		floor = number;
+}
+
+binary FrameChannel::acquireBuffer(size_t size) {
+	binary buffer;
+	if (!freeBuffers.empty()) {
+		buffer = std::move(freeBuffers.back());
+		freeBuffers.pop_back();
+	}
+	buffer.resize(size); // no allocation if the recycled capacity is sufficient
+	return buffer;
+}
+
+} // namespace rtc
@@ -26,8 +26,15 @@
 #include "global.hpp"
 
 #include "impl/init.hpp"
+#include "impl/internals.hpp"
+#include "impl/metrics.hpp"
+#include "impl/overloadcontroller.hpp"
+#include "impl/processor.hpp"
+#include "impl/threadpool.hpp"
+#include "impl/threadregistry.hpp"
 
 #include <mutex>
+#include <stdexcept>
 
 #ifdef _WIN32
 #include <codecvt>
@@ -58,6 +65,16 @@ void plogInit(plog::Severity severity, plog::IAppender *appender) {
 
 } // namespace
 
+namespace rtc::impl {
+
+static_assert(LOG_SUBSYSTEM_COUNT == static_cast<size_t>(LogSubsystem::WebSocket) + 1);
+
+std::array<std::atomic<int>, LOG_SUBSYSTEM_COUNT> LogSubsystemLevels = {
+    plog::verbose, plog::verbose, plog::verbose, plog::verbose,
+    plog::verbose, plog::verbose, plog::verbose, plog::verbose};
+
+} // namespace rtc::impl
+
 namespace rtc {
 
 struct LogAppender : public plog::IAppender {
@@ -96,6 +113,20 @@ void InitLogger(LogLevel level, LogCallback callback) {
 	} else {
 		plogInit(severity, nullptr); // log to cout
 	}
+
+#if RTC_STRIP_DEBUG_LOGS
+	if (severity >= plog::debug) {
+		PLOG_INFO << "Debug and verbose logs are not available, they were stripped at compile time";
+	}
+#endif
+}
+
+void SetLogLevel(LogSubsystem subsystem, LogLevel level) {
+	const auto index = static_cast<size_t>(subsystem);
+	if (index >= impl::LOG_SUBSYSTEM_COUNT)
+		throw std::invalid_argument("Invalid log subsystem");
+
+	impl::LogSubsystemLevels[index].store(static_cast<int>(level));
 }
 
 void InitLogger(plog::Severity severity, plog::IAppender *appender) {
@@ -104,9 +135,47 @@ void InitLogger(plog::Severity severity, plog::IAppender *appender) {
 
 void Preload() { Init::Instance().preload(); }
 std::shared_future<void> Cleanup() { return Init::Instance().cleanup(); }
+std::shared_future<void> Cleanup(std::chrono::milliseconds timeout) {
+	return Init::Instance().cleanup(timeout);
+}
 
 void SetSctpSettings(SctpSettings s) { Init::Instance().setSctpSettings(std::move(s)); }
 
+void SetThreadPoolSettings(ThreadPoolSettings s) {
+	Init::Instance().setThreadPoolSettings(std::move(s));
+}
+
+ThreadPoolStats GetThreadPoolStats() {
+	auto stats = impl::ThreadPool::Instance().stats();
+	stats.processorQueuedTasks = impl::Processor::QueuedTasks();
+	return stats;
+}
+
+std::vector<ThreadRoleStats> GetThreadStats() { return impl::ThreadRegistry::Instance().stats(); }
+
+void SetOverloadSettings(OverloadSettings s) { Init::Instance().setOverloadSettings(std::move(s)); }
+
+OverloadState GetOverloadState() { return impl::OverloadController::Instance().state(); }
+
+void SetMetricsSink(shared_ptr<MetricsSink> sink) {
+	impl::MetricsRegistry::Instance().setSink(std::move(sink));
+}
+
+void CollectMetrics() { impl::MetricsRegistry::Instance().collect(); }
+
+int Poll(std::chrono::milliseconds timeout) {
+	return int(impl::ThreadPool::Instance().poll(timeout));
+}
+
+int GetPollHandle() { return impl::ThreadPool::Instance().pollHandle(); }
+
+optional<std::chrono::milliseconds> GetPollTimeout() {
+	if (auto timeout = impl::ThreadPool::Instance().pollTimeout())
+		return std::chrono::ceil<std::chrono::milliseconds>(*timeout);
+
+	return nullopt;
+}
+
 } // namespace rtc
 
 RTC_CPP_EXPORT std::ostream &operator<<(std::ostream &out, rtc::LogLevel level) {
@@ -0,0 +1,217 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "h264rtpdepacketizer.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/logcounter.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace rtc {
+
+static impl::LogCounter COUNTER_BAD_RTP_HEADER(plog::warning, "Number of malformed RTP headers");
+static impl::LogCounter COUNTER_INCOMPLETE_FRAMES(plog::warning,
+                                                  "Number of incomplete H264 access units dropped");
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+const uint8_t StapANalUnitType = 24;
+const uint8_t FuANalUnitType = 28;
+
+} // namespace
+
+bool H264RtpDepacketizer::IsKeyframe(const binary &packet) {
+	if (packet.size() < RtpHeaderMinSize)
+		return false;
+
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet.data());
+	auto payload = reinterpret_cast<const uint8_t *>(rtp->getBody());
+	auto end = reinterpret_cast<const uint8_t *>(packet.data()) + packet.size();
+	if (payload >= end)
+		return false;
+
+	auto isKey = [](uint8_t type) { return type == 5 || type == 7; }; // IDR or SPS
+	const uint8_t type = payload[0] & 0x1F;
+	if (type == StapANalUnitType) {
+		auto p = payload + 1;
+		while (p + 3 <= end) {
+			const size_t size = (size_t(p[0]) << 8) | p[1];
+			if (isKey(p[2] & 0x1F))
+				return true;
+
+			p += 2 + size;
+		}
+		return false;
+	}
+	if (type == FuANalUnitType) // the first fragment starts the unit
+		return payload + 1 < end && (payload[1] & 0x80) && isKey(payload[1] & 0x1F);
+
+	return isKey(type);
+}
+
+H264RtpDepacketizer::H264RtpDepacketizer(Separator separator)
+    : RtpDepacketizer(), MediaHandlerRootElement(), separator(separator) {}
+
+ChainedIncomingProduct
+H264RtpDepacketizer::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	auto frames = make_chained_messages_product();
+	for (const auto &message : *messages) {
+		auto payload = parse(*message);
+		if (!payload) {
+			COUNTER_BAD_RTP_HEADER++;
+			continue;
+		}
+
+		// A missing packet might belong to the current or to the next access unit
+		const auto rtp = payload->header;
+		const bool missing = lastSeqNumber && uint16_t(*lastSeqNumber + 1) != rtp->seqNumber();
+		if (missing)
+			broken = true;
+
+		if (timestamp && *timestamp != rtp->timestamp()) {
+			flush(*frames); // the marker of the previous access unit was lost
+			broken = missing;
+		}
+
+		timestamp = rtp->timestamp();
+		lastSeqNumber = rtp->seqNumber();
+
+		const byte *data = payload->data;
+		const size_t size = payload->size;
+		if (size == 0) {
+			broken = true;
+			continue;
+		}
+
+		NalUnitHeader header{uint8_t(data[0])};
+		const uint8_t type = header.unitType();
+		if (type == FuANalUnitType) {
+			if (size < 2) {
+				broken = true;
+				continue;
+			}
+			NalUnitFragmentHeader fragmentHeader{uint8_t(data[1])};
+			if (fragmentHeader.isStart()) {
+				// Rebuild the NAL unit header from the FU indicator and header
+				NalUnitHeader naluHeader = header;
+				naluHeader.setUnitType(fragmentHeader.unitType());
+				byte first = byte(naluHeader._first);
+				appendNalUnit(&first, data + 2, size - 2);
+				fragmentStart = frame.size() - (size - 2) - 1;
+			} else if (fragmentStart) {
+				frame.insert(frame.end(), data + 2, data + size);
+			} else {
+				broken = true;
+			}
+
+			if (fragmentHeader.isEnd() && fragmentStart) {
+				if (separator == Separator::Length) {
+					// Write the length of the reassembled NAL unit
+					uint32_t length = htonl(uint32_t(frame.size() - *fragmentStart));
+					std::memcpy(frame.data() + *fragmentStart - sizeof(length), &length,
+					            sizeof(length));
+				}
+				fragmentStart.reset();
+			}
+		} else if (type == StapANalUnitType) {
+			size_t offset = 1;
+			while (offset + 2 <= size) {
+				size_t naluSize = (std::to_integer<size_t>(data[offset]) << 8) |
+				                  std::to_integer<size_t>(data[offset + 1]);
+				offset += 2;
+				if (naluSize == 0 || offset + naluSize > size) {
+					broken = true;
+					break;
+				}
+				appendNalUnit(nullptr, data + offset, naluSize);
+				offset += naluSize;
+			}
+		} else if (type > 0 && type < StapANalUnitType) {
+			appendNalUnit(nullptr, data, size);
+		} else {
+			broken = true; // unsupported packet type
+		}
+
+		if (rtp->marker())
+			flush(*frames);
+	}
+
+	if (frames->empty())
+		return {nullptr};
+
+	return {frames};
+}
+
+void H264RtpDepacketizer::appendNalUnit(const byte *header, const byte *data, size_t size) {
+	const size_t naluSize = size + (header ? 1 : 0);
+	switch (separator) {
+	case Separator::Length: {
+		uint32_t length = htonl(uint32_t(naluSize));
+		auto p = reinterpret_cast<const byte *>(&length);
+		frame.insert(frame.end(), p, p + sizeof(length));
+		break;
+	}
+	case Separator::ShortStartSequence:
+		frame.insert(frame.end(), {byte(0), byte(0), byte(1)});
+		break;
+	default:
+		frame.insert(frame.end(), {byte(0), byte(0), byte(0), byte(1)});
+		break;
+	}
+
+	if (header)
+		frame.push_back(*header);
+
+	frame.insert(frame.end(), data, data + size);
+}
+
+void H264RtpDepacketizer::flush(std::vector<binary_ptr> &frames) {
+	if (fragmentStart)
+		broken = true; // the last NAL unit is incomplete
+
+	if (broken) {
+		COUNTER_INCOMPLETE_FRAMES++;
+	} else if (!frame.empty()) {
+		auto output = std::make_shared<binary>();
+		output->swap(frame);
+		frames.push_back(std::move(output));
+	}
+	reset();
+}
+
+void H264RtpDepacketizer::reset() {
+	frame.clear();
+	timestamp.reset();
+	fragmentStart.reset();
+	broken = false;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
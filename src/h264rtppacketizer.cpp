@@ -21,121 +21,91 @@
 #include "h264rtppacketizer.hpp"
 
 #include "impl/internals.hpp"
+#include "impl/nalunitsplitter.hpp"
 
+#include <algorithm>
 #include <cassert>
-
-#ifdef _WIN32
-#include <winsock2.h>
-#else
-#include <arpa/inet.h>
-#endif
+#include <cmath>
+#include <cstring>
 
 namespace rtc {
 
-typedef enum {
-	NUSM_noMatch,
-	NUSM_firstZero,
-	NUSM_secondZero,
-	NUSM_thirdZero,
-	NUSM_shortMatch,
-	NUSM_longMatch
-} NalUnitStartSequenceMatch;
-
-NalUnitStartSequenceMatch StartSequenceMatchSucc(NalUnitStartSequenceMatch match, byte _byte,
-                                                 H264RtpPacketizer::Separator separator) {
-	assert(separator != H264RtpPacketizer::Separator::Length);
-	auto byte = (uint8_t)_byte;
-	auto detectShort = separator == H264RtpPacketizer::Separator::ShortStartSequence ||
-	                   separator == H264RtpPacketizer::Separator::StartSequence;
-	auto detectLong = separator == H264RtpPacketizer::Separator::LongStartSequence ||
-	                  separator == H264RtpPacketizer::Separator::StartSequence;
-	switch (match) {
-	case NUSM_noMatch:
-		if (byte == 0x00) {
-			return NUSM_firstZero;
-		}
-		break;
-	case NUSM_firstZero:
-		if (byte == 0x00) {
-			return NUSM_secondZero;
-		}
-		break;
-	case NUSM_secondZero:
-		if (byte == 0x00 && detectLong) {
-			return NUSM_thirdZero;
-		} else if (byte == 0x01 && detectShort) {
-			return NUSM_shortMatch;
-		}
-		break;
-	case NUSM_thirdZero:
-		if (byte == 0x01 && detectLong) {
-			return NUSM_longMatch;
-		}
-		break;
-	case NUSM_shortMatch:
-		return NUSM_shortMatch;
-	case NUSM_longMatch:
-		return NUSM_longMatch;
+namespace {
+
+const uint8_t StapANalUnitType = 24; // STAP-A
+const uint8_t FuANalUnitType = 28;   // FU-A, as for NalUnitFragmentA
+
+} // namespace
+
+void H264RtpPacketizer::packetizeAggregation(const std::vector<NalUnitRange> &nalus, bool setMark,
+                                             std::vector<binary_ptr> &packets) {
+	// F is set if any unit has it, NRI is the highest of the aggregated units
+	assert(nalus.size() >= 2);
+	NalUnitHeader indicator;
+	indicator.setUnitType(StapANalUnitType);
+	size_t payloadSize = 1;
+	for (const auto &[nalu, size] : nalus) {
+		NalUnitHeader naluHeader{uint8_t(nalu[0])};
+		if (naluHeader.forbiddenBit())
+			indicator.setForbiddenBit(true);
+
+		indicator.setNRI(std::max(indicator.nri(), naluHeader.nri()));
+		payloadSize += 2 + size;
+	}
+
+	auto packet = createPacket(payloadSize, setMark);
+	byte *data = packet->data() + packet->size() - payloadSize;
+	*data++ = byte(indicator._first);
+	for (const auto &[nalu, size] : nalus) {
+		data[0] = byte(size >> 8);
+		data[1] = byte(size & 0xFF);
+		std::memcpy(data + 2, nalu, size);
+		data += 2 + size;
 	}
-	return NUSM_noMatch;
+	packets.push_back(std::move(packet));
 }
 
-shared_ptr<NalUnits> H264RtpPacketizer::splitMessage(binary_ptr message) {
-	auto nalus = std::make_shared<NalUnits>();
-	if (separator == Separator::Length) {
-		size_t index = 0;
-		while (index < message->size()) {
-			assert(index + 4 < message->size());
-			if (index + 4 >= message->size()) {
-				LOG_WARNING << "Invalid NAL Unit data (incomplete length), ignoring!";
-				break;
-			}
-			auto lengthPtr = (uint32_t *)(message->data() + index);
-			uint32_t length = ntohl(*lengthPtr);
-			auto naluStartIndex = index + 4;
-			auto naluEndIndex = naluStartIndex + length;
-
-			assert(naluEndIndex <= message->size());
-			if (naluEndIndex > message->size()) {
-				LOG_WARNING << "Invalid NAL Unit data (incomplete unit), ignoring!";
-				break;
-			}
-			auto begin = message->begin() + naluStartIndex;
-			auto end = message->begin() + naluEndIndex;
-			nalus->push_back(std::make_shared<NalUnit>(begin, end));
-			index = naluEndIndex;
-		}
-	} else {
-		NalUnitStartSequenceMatch match = NUSM_noMatch;
-		size_t index = 0;
-		while (index < message->size()) {
-			match = StartSequenceMatchSucc(match, (*message)[index++], separator);
-			if (match == NUSM_longMatch || match == NUSM_shortMatch) {
-				match = NUSM_noMatch;
-				break;
-			}
+void H264RtpPacketizer::packetizeFragments(const byte *nalu, size_t size, bool setMark,
+                                           std::vector<binary_ptr> &packets) {
+	// Fragment sizes are balanced like NalUnitFragmentA::fragmentsFrom()
+	assert(size > maximumFragmentSize);
+	auto fragmentsCount = std::ceil(double(size) / maximumFragmentSize);
+	auto fragmentSize = uint16_t(int(std::ceil(size / fragmentsCount)));
+
+	// 2 bytes for FU indicator and FU header
+	fragmentSize -= 2;
+
+	NalUnitHeader naluHeader{uint8_t(nalu[0])};
+	NalUnitHeader indicator;
+	indicator.setForbiddenBit(naluHeader.forbiddenBit());
+	indicator.setNRI(naluHeader.nri());
+	indicator.setUnitType(FuANalUnitType);
+
+	const byte *payload = nalu + 1;
+	const size_t payloadSize = size - 1;
+	size_t offset = 0;
+	while (offset < payloadSize) {
+		NalUnitFragmentHeader header;
+		header.setReservedBit6(false);
+		header.setUnitType(naluHeader.unitType());
+		bool isEnd = false;
+		if (offset == 0) {
+			header.setStart(true);
+		} else if (offset + fragmentSize >= payloadSize) {
+			fragmentSize = uint16_t(payloadSize - offset);
+			header.setEnd(true);
+			isEnd = true;
 		}
 
-		size_t naluStartIndex = index;
-
-		while (index < message->size()) {
-			match = StartSequenceMatchSucc(match, (*message)[index], separator);
-			if (match == NUSM_longMatch || match == NUSM_shortMatch) {
-				auto sequenceLength = match == NUSM_longMatch ? 4 : 3;
-				size_t naluEndIndex = index - sequenceLength;
-				match = NUSM_noMatch;
-				auto begin = message->begin() + naluStartIndex;
-				auto end = message->begin() + naluEndIndex + 1;
-				nalus->push_back(std::make_shared<NalUnit>(begin, end));
-				naluStartIndex = index + 1;
-			}
-			index++;
-		}
-		auto begin = message->begin() + naluStartIndex;
-		auto end = message->end();
-		nalus->push_back(std::make_shared<NalUnit>(begin, end));
+		// The payload is copied once, directly into the RTP packet
+		auto packet = createPacket(2 + fragmentSize, setMark && isEnd);
+		byte *data = packet->data() + packet->size() - fragmentSize - 2;
+		data[0] = byte(indicator._first);
+		data[1] = byte(header._first);
+		std::memcpy(data + 2, payload + offset, fragmentSize);
+		packets.push_back(std::move(packet));
+		offset += fragmentSize;
 	}
-	return nalus;
 }
 
 H264RtpPacketizer::H264RtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig,
@@ -152,18 +122,47 @@ H264RtpPacketizer::H264RtpPacketizer(H264RtpPacketizer::Separator separator,
 ChainedOutgoingProduct
 H264RtpPacketizer::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
                                                 message_ptr control) {
-	ChainedMessagesProduct packets = std::make_shared<std::vector<binary_ptr>>();
-	for (auto message : *messages) {
-		auto nalus = splitMessage(message);
-		auto fragments = nalus->generateFragments(maximumFragmentSize);
-		if (fragments.size() == 0) {
+	ChainedMessagesProduct packets = make_chained_messages_product();
+	std::vector<NalUnitRange> pending;
+	for (const auto &message : *messages) {
+		// The message owns the data of the NAL units until they are packetized
+		auto nalus = impl::SplitNalUnits(*message, separator);
+		if (nalus.empty()) {
 			return ChainedOutgoingProduct();
 		}
-		unsigned i = 0;
-		for (; i < fragments.size() - 1; i++) {
-			packets->push_back(packetize(fragments[i], false));
+
+		size_t i = 0;
+		while (i < nalus.size()) {
+			// Aggregate consecutive small units like SPS, PPS, and SEI in a STAP-A packet
+			size_t aggregatedSize = 1;
+			pending.clear();
+			for (size_t j = i; j < nalus.size(); ++j) {
+				if (nalus[j].size == 0 || aggregatedSize + 2 + nalus[j].size > maximumFragmentSize)
+					break;
+
+				aggregatedSize += 2 + nalus[j].size;
+				pending.emplace_back(nalus[j].data, nalus[j].size);
+			}
+
+			if (pending.size() >= 2) {
+				i += pending.size();
+				packetizeAggregation(pending, i == nalus.size(), *packets);
+				continue;
+			}
+
+			const auto &nalu = nalus[i++];
+			const bool setMark = i == nalus.size();
+			if (nalu.size > maximumFragmentSize) {
+				packetizeFragments(nalu.data, nalu.size, setMark, *packets);
+				continue;
+			}
+
+			auto packet = createPacket(nalu.size, setMark);
+			if (nalu.size > 0)
+				std::memcpy(packet->data() + packet->size() - nalu.size, nalu.data, nalu.size);
+
+			packets->push_back(std::move(packet));
 		}
-		packets->push_back(packetize(fragments[i], true));
 	}
 	return {packets, control};
 }
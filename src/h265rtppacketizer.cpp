@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "h265rtppacketizer.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/nalunitsplitter.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace rtc {
+
+namespace {
+
+// RFC 7798 payload header: F (1 bit), Type (6 bits), LayerId (6 bits), TID (3 bits)
+const size_t NalUnitHeaderSize = 2;
+const uint8_t AggregationPacketType = 48;
+const uint8_t FragmentationUnitType = 49;
+
+uint8_t ForbiddenBit(const byte *nalu) { return uint8_t(nalu[0]) >> 7; }
+uint8_t UnitType(const byte *nalu) { return (uint8_t(nalu[0]) >> 1) & 0x3F; }
+uint8_t LayerId(const byte *nalu) {
+	return uint8_t(((uint8_t(nalu[0]) & 0x01) << 5) | (uint8_t(nalu[1]) >> 3));
+}
+uint8_t TemporalId(const byte *nalu) { return uint8_t(nalu[1]) & 0x07; } // TID is never 0
+
+void WritePayloadHeader(byte *data, uint8_t forbidden, uint8_t type, uint8_t layerId,
+                        uint8_t tid) {
+	data[0] = byte(uint8_t(forbidden << 7) | uint8_t(type << 1) | uint8_t(layerId >> 5));
+	data[1] = byte(uint8_t((layerId & 0x1F) << 3) | uint8_t(tid & 0x07));
+}
+
+} // namespace
+
+void H265RtpPacketizer::packetizeAggregation(const std::vector<NalUnitRange> &nalus, bool setMark,
+                                             std::vector<binary_ptr> &packets) {
+	// F is set if any unit has it, LayerId and TID are the lowest of the aggregated units
+	assert(nalus.size() >= 2);
+	uint8_t forbidden = 0, layerId = 0x3F, tid = 0x07;
+	size_t payloadSize = NalUnitHeaderSize;
+	for (const auto &[nalu, size] : nalus) {
+		forbidden |= ForbiddenBit(nalu);
+		layerId = std::min(layerId, LayerId(nalu));
+		tid = std::min(tid, TemporalId(nalu));
+		payloadSize += 2 + size;
+	}
+
+	auto packet = createPacket(payloadSize, setMark);
+	byte *data = packet->data() + packet->size() - payloadSize;
+	WritePayloadHeader(data, forbidden, AggregationPacketType, layerId, tid);
+	data += NalUnitHeaderSize;
+	for (const auto &[nalu, size] : nalus) {
+		data[0] = byte(size >> 8);
+		data[1] = byte(size & 0xFF);
+		std::memcpy(data + 2, nalu, size);
+		data += 2 + size;
+	}
+	packets.push_back(std::move(packet));
+}
+
+void H265RtpPacketizer::packetizeFragments(const byte *nalu, size_t size, bool setMark,
+                                           std::vector<binary_ptr> &packets) {
+	// Fragment sizes are balanced like for H264
+	assert(size > maximumFragmentSize);
+	auto fragmentsCount = std::ceil(double(size) / maximumFragmentSize);
+	auto fragmentSize = uint16_t(int(std::ceil(size / fragmentsCount)));
+
+	// 2 bytes for the payload header and 1 byte for the FU header
+	fragmentSize -= NalUnitHeaderSize + 1;
+
+	const uint8_t type = UnitType(nalu);
+	const byte *payload = nalu + NalUnitHeaderSize;
+	const size_t payloadSize = size - NalUnitHeaderSize;
+	size_t offset = 0;
+	while (offset < payloadSize) {
+		// FU header: S (1 bit), E (1 bit), FuType (6 bits)
+		uint8_t header = type;
+		bool isEnd = false;
+		if (offset == 0) {
+			header |= 0x80;
+		} else if (offset + fragmentSize >= payloadSize) {
+			fragmentSize = uint16_t(payloadSize - offset);
+			header |= 0x40;
+			isEnd = true;
+		}
+
+		// The payload is copied once, directly into the RTP packet
+		auto packet = createPacket(NalUnitHeaderSize + 1 + fragmentSize, setMark && isEnd);
+		byte *data = packet->data() + packet->size() - fragmentSize - NalUnitHeaderSize - 1;
+		WritePayloadHeader(data, ForbiddenBit(nalu), FragmentationUnitType, LayerId(nalu),
+		                   TemporalId(nalu));
+		data[NalUnitHeaderSize] = byte(header);
+		std::memcpy(data + NalUnitHeaderSize + 1, payload + offset, fragmentSize);
+		packets.push_back(std::move(packet));
+		offset += fragmentSize;
+	}
+}
+
+H265RtpPacketizer::H265RtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig,
+                                     uint16_t maximumFragmentSize)
+    : RtpPacketizer(rtpConfig), MediaHandlerRootElement(), maximumFragmentSize(maximumFragmentSize),
+      separator(Separator::Length) {}
+
+H265RtpPacketizer::H265RtpPacketizer(Separator separator,
+                                     shared_ptr<RtpPacketizationConfig> rtpConfig,
+                                     uint16_t maximumFragmentSize)
+    : RtpPacketizer(rtpConfig), MediaHandlerRootElement(), maximumFragmentSize(maximumFragmentSize),
+      separator(separator) {}
+
+ChainedOutgoingProduct
+H265RtpPacketizer::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                message_ptr control) {
+	ChainedMessagesProduct packets = make_chained_messages_product();
+	std::vector<NalUnitRange> pending;
+	for (const auto &message : *messages) {
+		// The message owns the data of the NAL units until they are packetized
+		auto nalus = impl::SplitNalUnits(*message, separator);
+
+		// Units too short to hold a NAL unit header are dropped
+		nalus.erase(std::remove_if(nalus.begin(), nalus.end(),
+		                           [](const auto &nalu) { return nalu.size < NalUnitHeaderSize; }),
+		            nalus.end());
+		if (nalus.empty()) {
+			return ChainedOutgoingProduct();
+		}
+
+		size_t i = 0;
+		while (i < nalus.size()) {
+			// Aggregate as many consecutive units as possible in a single packet
+			size_t aggregatedSize = NalUnitHeaderSize;
+			pending.clear();
+			for (size_t j = i; j < nalus.size(); ++j) {
+				if (aggregatedSize + 2 + nalus[j].size > maximumFragmentSize)
+					break;
+
+				aggregatedSize += 2 + nalus[j].size;
+				pending.emplace_back(nalus[j].data, nalus[j].size);
+			}
+
+			if (pending.size() >= 2) {
+				i += pending.size();
+				packetizeAggregation(pending, i == nalus.size(), *packets);
+				continue;
+			}
+
+			const auto &nalu = nalus[i++];
+			const bool setMark = i == nalus.size();
+			if (nalu.size > maximumFragmentSize) {
+				packetizeFragments(nalu.data, nalu.size, setMark, *packets);
+				continue;
+			}
+
+			auto packet = createPacket(nalu.size, setMark);
+			std::memcpy(packet->data() + packet->size() - nalu.size, nalu.data, nalu.size);
+			packets->push_back(std::move(packet));
+		}
+	}
+	return {packets, control};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
@@ -27,33 +27,33 @@ using std::to_integer;
 string to_base64(const binary &data) {
 	static const char tab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-	string out;
-	out.reserve(3 * ((data.size() + 3) / 4));
-	int i = 0;
+	// The output is written in place, 4 characters per 3-byte group
+	string out(4 * ((data.size() + 2) / 3), '=');
+	char *o = out.data();
+	size_t i = 0;
 	while (data.size() - i >= 3) {
 		auto d0 = to_integer<uint8_t>(data[i]);
 		auto d1 = to_integer<uint8_t>(data[i + 1]);
 		auto d2 = to_integer<uint8_t>(data[i + 2]);
-		out += tab[d0 >> 2];
-		out += tab[((d0 & 3) << 4) | (d1 >> 4)];
-		out += tab[((d1 & 0x0F) << 2) | (d2 >> 6)];
-		out += tab[d2 & 0x3F];
+		*o++ = tab[d0 >> 2];
+		*o++ = tab[((d0 & 3) << 4) | (d1 >> 4)];
+		*o++ = tab[((d1 & 0x0F) << 2) | (d2 >> 6)];
+		*o++ = tab[d2 & 0x3F];
 		i += 3;
 	}
 
-	int left = int(data.size() - i);
+	size_t left = data.size() - i;
 	if (left) {
 		auto d0 = to_integer<uint8_t>(data[i]);
-		out += tab[d0 >> 2];
+		*o++ = tab[d0 >> 2];
 		if (left == 1) {
-			out += tab[(d0 & 3) << 4];
-			out += '=';
+			*o++ = tab[(d0 & 3) << 4];
 		} else { // left == 2
 			auto d1 = to_integer<uint8_t>(data[i + 1]);
-			out += tab[((d0 & 3) << 4) | (d1 >> 4)];
-			out += tab[(d1 & 0x0F) << 2];
+			*o++ = tab[((d0 & 3) << 4) | (d1 >> 4)];
+			*o++ = tab[(d1 & 0x0F) << 2];
 		}
-		out += '=';
+		// Padding is already in place
 	}
 
 	return out;
@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "capturewriter.hpp"
+#include "internals.hpp"
+
+#include <cstring>
+
+namespace rtc::impl {
+
+namespace {
+
+const char CaptureMagic[] = "RTCCAP01";
+const char ChunkMagic[] = "CCHK";
+const size_t ChunkHeaderSize = 12;
+const uint8_t OutgoingFlag = 0x80;
+
+void append(binary &b, const char *magic) {
+	auto p = reinterpret_cast<const byte *>(magic);
+	b.insert(b.end(), p, p + std::strlen(magic));
+}
+
+template <typename T> void append(binary &b, T value) {
+	for (int i = int(sizeof(T)) - 1; i >= 0; --i)
+		b.push_back(byte(uint8_t(value >> (i * 8))));
+}
+
+} // namespace
+
+CaptureWriter::CaptureWriter(const string &path) : mStartTime(clock::now()) {
+	using namespace std::chrono;
+	mFile.open(path, std::ios::binary | std::ios::trunc);
+	if (!mFile)
+		throw std::runtime_error("Unable to open capture file " + path);
+
+	binary header;
+	append(header, CaptureMagic);
+	const auto since = system_clock::now().time_since_epoch();
+	append(header, uint64_t(duration_cast<microseconds>(since).count()));
+	writeChunk(header);
+
+	PLOG_INFO << "Capturing decrypted traffic to " << path;
+}
+
+CaptureWriter::~CaptureWriter() {
+	std::lock_guard lock(mMutex);
+	flushChunk();
+}
+
+void CaptureWriter::record(Type type, bool outgoing, const byte *data, size_t size) {
+	using namespace std::chrono;
+	std::lock_guard lock(mMutex);
+	const auto now = clock::now();
+	if (mChunkCount == 0) {
+		mChunk.reserve(ChunkSize + ChunkHeaderSize);
+		mChunk.resize(ChunkHeaderSize); // filled when flushed
+		mChunkTime = now;
+	}
+
+	append(mChunk, uint64_t(duration_cast<microseconds>(now - mStartTime).count()));
+	append(mChunk, uint8_t(uint8_t(type) | (outgoing ? OutgoingFlag : 0)));
+	append(mChunk, uint32_t(size));
+	mChunk.insert(mChunk.end(), data, data + size);
+	++mChunkCount;
+
+	if (mChunk.size() >= ChunkSize || now - mChunkTime >= ChunkDuration)
+		flushChunk();
+}
+
+void CaptureWriter::flush() {
+	std::lock_guard lock(mMutex);
+	flushChunk();
+}
+
+void CaptureWriter::flushChunk() {
+	if (mChunkCount == 0)
+		return;
+
+	binary header;
+	append(header, ChunkMagic);
+	append(header, uint32_t(mChunk.size() - ChunkHeaderSize));
+	append(header, mChunkCount);
+	std::copy(header.begin(), header.end(), mChunk.begin());
+
+	const size_t size = mChunk.size();
+	if (mPendingSize.load() + size > MaxPendingSize) {
+		if (mDroppedChunks.fetch_add(1) == 0) {
+			PLOG_WARNING << "Capture writing is too slow, dropping chunks";
+		}
+	} else {
+		mPendingSize += size;
+		mProcessor.enqueue([this, chunk = std::move(mChunk)]() {
+			writeChunk(chunk);
+			mPendingSize -= chunk.size();
+		});
+	}
+
+	mChunk = binary();
+	mChunkCount = 0;
+}
+
+void CaptureWriter::writeChunk(const binary &chunk) {
+	mFile.write(reinterpret_cast<const char *>(chunk.data()), std::streamsize(chunk.size()));
+	mFile.flush();
+	if (!mFile) {
+		PLOG_ERROR << "Failed to write capture chunk";
+	}
+}
+
+} // namespace rtc::impl
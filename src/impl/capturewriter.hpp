@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_CAPTURE_WRITER_H
+#define RTC_IMPL_CAPTURE_WRITER_H
+
+#include "common.hpp"
+#include "message.hpp"
+#include "processor.hpp"
+
+#include "rtc/trafficcapture.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+
+namespace rtc::impl {
+
+// Writes the decrypted traffic of a connection to a capture file, see rtc::TrafficCapture
+// Records are buffered in chunks written asynchronously off the network threads, and chunks are
+// dropped when writing falls behind rather than holding an ever-growing backlog.
+class CaptureWriter final {
+public:
+	using Type = TrafficCapture::Type;
+
+	CaptureWriter(const string &path);
+	~CaptureWriter(); // writes the last chunk and waits for pending writes
+
+	void record(Type type, bool outgoing, const byte *data, size_t size);
+	void record(Type type, bool outgoing, const Message &message) {
+		record(type, outgoing, message.data(), message.size());
+	}
+
+	// Writes the current chunk asynchronously
+	void flush();
+
+	size_t droppedChunks() const { return mDroppedChunks.load(std::memory_order_relaxed); }
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	void flushChunk(); // mutex needs to be locked
+	void writeChunk(const binary &chunk);
+
+	static const size_t ChunkSize = 1024 * 1024;
+	static const size_t MaxPendingSize = 64 * 1024 * 1024;
+	static constexpr std::chrono::seconds ChunkDuration{1};
+
+	const clock::time_point mStartTime;
+	std::ofstream mFile;
+
+	binary mChunk; // records of the current chunk
+	uint32_t mChunkCount = 0;
+	clock::time_point mChunkTime; // of the first record of the current chunk
+	std::mutex mMutex;
+
+	std::atomic<size_t> mPendingSize = 0; // of chunks waiting to be written
+	std::atomic<size_t> mDroppedChunks = 0;
+
+	// Declared last so pending writes are done before the file is closed
+	Processor mProcessor;
+};
+
+} // namespace rtc::impl
+
+#endif
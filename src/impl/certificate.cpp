@@ -21,6 +21,7 @@
 
 #include <cassert>
 #include <chrono>
+#include <deque>
 #include <iomanip>
 #include <mutex>
 #include <sstream>
@@ -84,6 +85,13 @@ Certificate Certificate::Generate(CertificateType type, const string &commonName
 		              "Unable to generate RSA key pair");
 		break;
 	}
+	case CertificateType::Ed25519: {
+		gnutls::check(gnutls_x509_privkey_generate(*privkey, GNUTLS_PK_EDDSA_ED25519,
+		                                           GNUTLS_CURVE_TO_BITS(GNUTLS_ECC_CURVE_ED25519),
+		                                           0),
+		              "Unable to generate Ed25519 key pair");
+		break;
+	}
 	default:
 		throw std::invalid_argument("Unknown certificate type");
 	}
@@ -102,7 +110,9 @@ Certificate Certificate::Generate(CertificateType type, const string &commonName
 	gnutls_rnd(GNUTLS_RND_NONCE, serial, serialSize);
 	gnutls_x509_crt_set_serial(*crt, serial, serialSize);
 
-	gnutls::check(gnutls_x509_crt_sign2(*crt, *crt, *privkey, GNUTLS_DIG_SHA256, 0),
+	// Ed25519 only signs with its own digest (RFC 8410)
+	const auto digest = type == CertificateType::Ed25519 ? GNUTLS_DIG_SHA512 : GNUTLS_DIG_SHA256;
+	gnutls::check(gnutls_x509_crt_sign2(*crt, *crt, *privkey, digest, 0),
 	              "Unable to auto-sign certificate");
 
 	return Certificate(*crt, *privkey);
@@ -270,6 +280,21 @@ Certificate Certificate::Generate(CertificateType type, const string &commonName
 
 		break;
 	}
+	case CertificateType::Ed25519: {
+		PLOG_VERBOSE << "Generating Ed25519 key pair";
+
+		unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(
+		    EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, NULL), EVP_PKEY_CTX_free);
+		if (!ctx)
+			throw std::runtime_error("Unable to allocate structure for Ed25519 key pair");
+
+		EVP_PKEY *key = NULL;
+		if (EVP_PKEY_keygen_init(ctx.get()) <= 0 || EVP_PKEY_keygen(ctx.get(), &key) <= 0)
+			throw std::runtime_error("Unable to generate Ed25519 key pair");
+
+		pkey.reset(key, EVP_PKEY_free);
+		break;
+	}
 	default:
 		throw std::invalid_argument("Unknown certificate type");
 	}
@@ -292,7 +317,9 @@ Certificate Certificate::Generate(CertificateType type, const string &commonName
 	    !X509_set_issuer_name(x509.get(), name.get()))
 		throw std::runtime_error("Unable to set certificate properties");
 
-	if (!X509_sign(x509.get(), pkey.get(), EVP_sha256()))
+	// Ed25519 signs without a separate digest (RFC 8410)
+	const EVP_MD *md = type == CertificateType::Ed25519 ? NULL : EVP_sha256();
+	if (!X509_sign(x509.get(), pkey.get(), md))
 		throw std::runtime_error("Unable to auto-sign certificate");
 
 	return Certificate(x509, pkey);
@@ -307,6 +334,13 @@ std::tuple<X509 *, EVP_PKEY *> Certificate::credentials() const {
 	return {mX509.get(), mPKey.get()};
 }
 
+shared_ptr<SSL_CTX>
+Certificate::dtlsContext(const std::function<shared_ptr<SSL_CTX>()> &create) const {
+	// If create() throws, the next caller tries again
+	std::call_once(mDtlsContext->once, [&]() { mDtlsContext->context = create(); });
+	return mDtlsContext->context;
+}
+
 string make_fingerprint(X509 *x509) {
 	const size_t size = 32;
 	unsigned char buffer[size];
@@ -328,10 +362,92 @@ string make_fingerprint(X509 *x509) {
 
 // Common for GnuTLS and OpenSSL
 
-future_certificate_ptr make_certificate(CertificateType type) {
-	return ThreadPool::Instance().enqueue([type]() {
+namespace {
+
+// Number of certificates kept ready per type for connections which don't share certificates
+const size_t CertificatePoolSize = 4;
+
+std::mutex CertificateCacheMutex;
+std::unordered_map<CertificateType, future_certificate_ptr> CertificateCache; // shared
+std::unordered_map<CertificateType, std::deque<future_certificate_ptr>> CertificatePool;
+
+CertificateType normalize(CertificateType type) {
+	return type == CertificateType::Default ? CertificateType::Ecdsa : type;
+}
+
+future_certificate_ptr generate_certificate(CertificateType type) {
+	auto generate = [type]() {
 		return std::make_shared<Certificate>(Certificate::Generate(type, "libdatachannel"));
-	});
+	};
+
+	auto &threadPool = ThreadPool::Crypto();
+	if (!threadPool.external())
+		return threadPool.enqueue(std::move(generate));
+
+	// With an external executor, the task would not run before the application polls, but the
+	// certificate might be waited for on the polling thread, so generate it right away
+	std::promise<certificate_ptr> promise;
+	try {
+		promise.set_value(generate());
+	} catch (const std::exception &e) {
+		PLOG_WARNING << e.what();
+		promise.set_exception(std::current_exception());
+	}
+	return promise.get_future().share();
+}
+
+void refill_pool(CertificateType type) {
+	// CertificateCacheMutex must be locked
+	if (ThreadPool::Crypto().external())
+		return; // generation would block the caller, certificates are generated on demand
+
+	auto &pool = CertificatePool[type];
+	while (pool.size() < CertificatePoolSize)
+		pool.push_back(generate_certificate(type));
+}
+
+} // namespace
+
+future_certificate_ptr make_certificate(CertificateType type, bool shared) {
+	type = normalize(type);
+	std::lock_guard lock(CertificateCacheMutex);
+	if (shared) {
+		// The same certificate may be used for many connections as the peers only check the
+		// fingerprint
+		if (auto it = CertificateCache.find(type); it != CertificateCache.end())
+			return it->second;
+
+		auto future = generate_certificate(type);
+		CertificateCache.emplace(type, future);
+		return future;
+	}
+
+	auto &pool = CertificatePool[type];
+	if (pool.empty())
+		return generate_certificate(type);
+
+	// Take a pre-generated certificate and generate a replacement in the background
+	auto future = std::move(pool.front());
+	pool.pop_front();
+	refill_pool(type);
+	return future;
+}
+
+void PreloadCertificates() {
+	PLOG_DEBUG << "Pre-generating certificates";
+	std::lock_guard lock(CertificateCacheMutex);
+	const auto defaultType = normalize(CertificateType::Default);
+	if (CertificateCache.find(defaultType) == CertificateCache.end())
+		CertificateCache.emplace(defaultType, generate_certificate(defaultType));
+
+	for (auto type : {CertificateType::Ecdsa, CertificateType::Rsa})
+		refill_pool(type);
+}
+
+void CleanupCertificateCache() {
+	std::lock_guard lock(CertificateCacheMutex);
+	CertificateCache.clear();
+	CertificatePool.clear();
 }
 
 } // namespace rtc::impl
@@ -23,7 +23,9 @@
 #include "configuration.hpp" // for CertificateType
 #include "tls.hpp"
 
+#include <functional>
 #include <future>
+#include <mutex>
 #include <tuple>
 
 namespace rtc::impl {
@@ -41,6 +43,9 @@ public:
 #else
 	Certificate(shared_ptr<X509> x509, shared_ptr<EVP_PKEY> pkey);
 	std::tuple<X509 *, EVP_PKEY *> credentials() const;
+
+	// Context set up by the first DTLS transport using the certificate, then shared
+	shared_ptr<SSL_CTX> dtlsContext(const std::function<shared_ptr<SSL_CTX>()> &create) const;
 #endif
 
 	string fingerprint() const;
@@ -52,6 +57,12 @@ private:
 #else
 	const shared_ptr<X509> mX509;
 	const shared_ptr<EVP_PKEY> mPKey;
+
+	struct ContextSlot {
+		std::once_flag once;
+		shared_ptr<SSL_CTX> context;
+	};
+	const shared_ptr<ContextSlot> mDtlsContext = std::make_shared<ContextSlot>();
 #endif
 
 	const string mFingerprint;
@@ -67,7 +78,12 @@ string make_fingerprint(X509 *x509);
 using certificate_ptr = shared_ptr<Certificate>;
 using future_certificate_ptr = std::shared_future<certificate_ptr>;
 
-future_certificate_ptr make_certificate(CertificateType type = CertificateType::Default);
+// If shared is false, the certificate is taken from a pool of pre-generated ones when possible
+future_certificate_ptr make_certificate(CertificateType type = CertificateType::Default,
+                                        bool shared = true);
+
+void PreloadCertificates(); // fill the pool in the background
+void CleanupCertificateCache();
 
 } // namespace rtc::impl
 
@@ -20,6 +20,12 @@
 
 namespace rtc::impl {
 
+namespace {
+
+const size_t MaxBatchedMessages = 1024; // per invocation of the batched callback
+
+}
+
 void Channel::triggerOpen() {
 	mOpenTriggered = true;
 	openCallback();
@@ -48,6 +54,24 @@ void Channel::flushPendingMessages() {
 	if (!mOpenTriggered)
 		return;
 
+	// Batched delivery hands messages over without conversion
+	std::vector<message_ptr> messages;
+	while (messagesCallback) {
+		while (messages.size() < MaxBatchedMessages) {
+			auto message = receiveMessage();
+			if (!message)
+				break;
+
+			messages.push_back(std::move(message));
+		}
+
+		if (messages.empty())
+			return;
+
+		messagesCallback(messages);
+		messages.clear();
+	}
+
 	while (messageCallback) {
 		auto next = receive();
 		if (!next)
@@ -70,6 +94,7 @@ void Channel::resetCallbacks() {
 	availableCallback = nullptr;
 	bufferedAmountLowCallback = nullptr;
 	messageCallback = nullptr;
+	messagesCallback = nullptr;
 }
 
 } // namespace rtc::impl
@@ -24,11 +24,13 @@
 
 #include <atomic>
 #include <functional>
+#include <vector>
 
 namespace rtc::impl {
 
 struct Channel {
 	virtual optional<message_variant> receive() = 0;
+	virtual message_ptr receiveMessage() = 0; // without conversion, null if none available
 	virtual optional<message_variant> peek() = 0;
 	virtual size_t availableAmount() const = 0;
 
@@ -49,6 +51,7 @@ struct Channel {
 	synchronized_stored_callback<> bufferedAmountLowCallback;
 
 	synchronized_callback<message_variant> messageCallback;
+	synchronized_callback<const std::vector<message_ptr> &> messagesCallback; // takes precedence
 
 	std::atomic<size_t> bufferedAmount = 0;
 	std::atomic<size_t> bufferedAmountLowThreshold = 0;
@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "crc32c.hpp"
+
+#include <usrsctp.h>
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define RTC_CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_acle.h>
+#define RTC_CRC32C_ARMV8 1
+#endif
+
+#if RTC_CRC32C_SSE42 && (defined(__GNUC__) || defined(__clang__))
+#define RTC_CRC32C_TARGET __attribute__((target("sse4.2")))
+#else
+#define RTC_CRC32C_TARGET
+#endif
+
+namespace rtc::impl {
+
+namespace {
+
+using Crc32cFunction = uint32_t (*)(const byte *data, size_t size);
+
+uint32_t SoftwareCrc32c(const byte *data, size_t size) {
+	return usrsctp_crc32c(const_cast<byte *>(data), size);
+}
+
+#if RTC_CRC32C_SSE42
+
+RTC_CRC32C_TARGET uint32_t HardwareCrc32c(const byte *data, size_t size) {
+	uint32_t crc = 0xFFFFFFFF;
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t crc64 = crc;
+	while (size >= 8) {
+		uint64_t word;
+		std::memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		size -= 8;
+	}
+	crc = uint32_t(crc64);
+#else
+	while (size >= 4) {
+		uint32_t word;
+		std::memcpy(&word, data, 4);
+		crc = _mm_crc32_u32(crc, word);
+		data += 4;
+		size -= 4;
+	}
+#endif
+	while (size--)
+		crc = _mm_crc32_u8(crc, std::to_integer<uint8_t>(*data++));
+
+	return ~crc;
+}
+
+bool HasHardwareCrc32c() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0; // SSE4.2
+#else
+	__builtin_cpu_init(); // might be called before constructors
+	return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#elif RTC_CRC32C_ARMV8
+
+uint32_t HardwareCrc32c(const byte *data, size_t size) {
+	uint32_t crc = 0xFFFFFFFF;
+	while (size >= 8) {
+		uint64_t word;
+		std::memcpy(&word, data, 8);
+		crc = __crc32cd(crc, word);
+		data += 8;
+		size -= 8;
+	}
+	while (size--)
+		crc = __crc32cb(crc, std::to_integer<uint8_t>(*data++));
+
+	return ~crc;
+}
+
+bool HasHardwareCrc32c() { return true; } // checked at compile time
+
+#endif
+
+Crc32cFunction SelectCrc32c() {
+#if RTC_CRC32C_SSE42 || RTC_CRC32C_ARMV8
+	if (HasHardwareCrc32c())
+		return HardwareCrc32c;
+#endif
+	return SoftwareCrc32c;
+}
+
+const Crc32cFunction Crc32cImplementation = SelectCrc32c();
+
+} // namespace
+
+uint32_t Crc32c(const byte *data, size_t size) { return Crc32cImplementation(data, size); }
+
+} // namespace rtc::impl
@@ -0,0 +1,32 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_CRC32C_H
+#define RTC_IMPL_CRC32C_H
+
+#include "common.hpp"
+
+namespace rtc::impl {
+
+// CRC32c of an SCTP packet, in the byte order expected in the common header (RFC 9260 Appendix B)
+// Uses SSE4.2 or ARMv8 CRC instructions when available, otherwise falls back to usrsctp.
+uint32_t Crc32c(const byte *data, size_t size);
+
+} // namespace rtc::impl
+
+#endif
@@ -22,6 +22,7 @@
 #include "logcounter.hpp"
 #include "peerconnection.hpp"
 #include "sctptransport.hpp"
+#include "threadpool.hpp"
 
 #include "rtc/datachannel.hpp"
 #include "rtc/track.hpp"
@@ -78,12 +79,21 @@ struct CloseMessage {
 LogCounter COUNTER_USERNEG_OPEN_MESSAGE(
     plog::warning, "Number of open messages for a user-negotiated DataChannel received");
 
+LogCounter COUNTER_QUEUE_FULL(plog::warning,
+                              "Number of DataChannel messages dropped due to a full queue");
+
+LogCounter COUNTER_MEMORY_LIMIT(
+    plog::warning, "Number of DataChannel messages received over the connection memory limit");
+
+LogCounter COUNTER_DECOMPRESSION_FAILED(
+    plog::warning, "Number of DataChannel messages which failed to be decompressed");
+
 DataChannel::DataChannel(weak_ptr<PeerConnection> pc, uint16_t stream, string label,
-                         string protocol, Reliability reliability)
-    : mPeerConnection(pc), mStream(stream), mLabel(std::move(label)),
-      mProtocol(std::move(protocol)),
-      mReliability(std::make_shared<Reliability>(std::move(reliability))),
-      mRecvQueue(RECV_QUEUE_LIMIT, message_size_func) {}
+                         string protocol, Reliability reliability, uint16_t priority)
+    : mPeerConnection(pc), mMemoryAccount(memory_account(pc)), mStream(stream),
+      mLabel(std::move(label)), mProtocol(std::move(protocol)),
+      mReliability(std::move(reliability)), mPriority(priority),
+      mRecvQueue(RECV_QUEUE_LIMIT, message_size_func, receive_queues_amount(mMemoryAccount)) {}
 
 DataChannel::~DataChannel() { close(); }
 
@@ -98,7 +108,24 @@ void DataChannel::close() {
 	if (mIsOpen.exchange(false) && transport)
 		transport->closeStream(mStream);
 
+	if (transport && mFragmentCallback)
+		transport->setStreamFragmented(mStream, false);
+
+	failPendingSends(std::make_exception_ptr(std::runtime_error("DataChannel is closed")));
+	releaseRecvOverflow();
 	resetCallbacks();
+	mFragmentCallback = nullptr;
+}
+
+void DataChannel::closeWithError(string error) {
+	if (mIsClosed.exchange(true))
+		return;
+
+	PLOG_WARNING << "Closing DataChannel: " << error;
+	triggerError(std::move(error));
+
+	// Closing resets the stream, which is not done from the transport receiving thread
+	ThreadPool::Instance().post(weak_bind(&DataChannel::close, this));
 }
 
 void DataChannel::remoteClose() {
@@ -106,33 +133,61 @@ void DataChannel::remoteClose() {
 		triggerClosed();
 
 	mIsOpen = false;
+	failPendingSends(std::make_exception_ptr(std::runtime_error("DataChannel is closed")));
+
+	shared_ptr<SctpTransport> transport;
+	{
+		std::shared_lock lock(mMutex);
+		transport = mSctpTransport.lock();
+	}
+
+	if (transport && mFragmentCallback)
+		transport->setStreamFragmented(stream(), false);
 }
 
 optional<message_variant> DataChannel::receive() {
+	if (auto message = receiveMessage())
+		return to_variant(std::move(*message));
+
+	return nullopt;
+}
+
+message_ptr DataChannel::receiveMessage() {
 	while (auto next = mRecvQueue.tryPop()) {
+		drainRecvOverflow();
 		message_ptr message = *next;
-		if (message->type != Message::Control)
-			return to_variant(std::move(*message));
+		if (message->type != Message::Control) {
+#if RTC_ENABLE_LATENCY_TRACING
+			if (message->traceTime) {
+				std::shared_lock lock(mMutex);
+				auto transport = mSctpTransport.lock();
+				if (auto tracer = transport ? transport->latencyTracer() : nullptr)
+					tracer->record(LatencyTracer::Delivery, *message->traceTime);
+			}
+#endif
+			return message;
+		}
 
 		auto raw = reinterpret_cast<const uint8_t *>(message->data());
 		if (!message->empty() && raw[0] == MESSAGE_CLOSE)
 			remoteClose();
 	}
 
-	return nullopt;
+	return nullptr;
 }
 
 optional<message_variant> DataChannel::peek() {
 	while (auto next = mRecvQueue.peek()) {
 		message_ptr message = *next;
 		if (message->type != Message::Control)
-			return to_variant(std::move(*message));
+			return to_variant(*message); // the message stays queued
 
 		auto raw = reinterpret_cast<const uint8_t *>(message->data());
 		if (!message->empty() && raw[0] == MESSAGE_CLOSE)
 			remoteClose();
 
 		mRecvQueue.tryPop();
+		drainRecvOverflow();
 	}
 
 	return nullopt;
@@ -140,6 +195,13 @@ optional<message_variant> DataChannel::peek() {
 
 size_t DataChannel::availableAmount() const { return mRecvQueue.amount(); }
 
+void DataChannel::triggerOpen() {
+	if (auto pc = mPeerConnection.lock())
+		pc->recordDataChannelOpen();
+
+	Channel::triggerOpen();
+}
+
 uint16_t DataChannel::stream() const {
 	std::shared_lock lock(mMutex);
 	return mStream;
@@ -157,7 +219,35 @@ string DataChannel::protocol() const {
 
 Reliability DataChannel::reliability() const {
 	std::shared_lock lock(mMutex);
-	return *mReliability;
+	return mReliability;
+}
+
+uint16_t DataChannel::priority() const {
+	std::shared_lock lock(mMutex);
+	return mPriority;
+}
+
+unsigned int DataChannel::dscp() const { return mDscp; }
+
+void DataChannel::setDscp(unsigned int dscp) {
+	if (dscp > 63)
+		throw std::invalid_argument("Invalid DSCP value");
+
+	mDscp = dscp;
+}
+
+DataChannelStats DataChannel::stats() const {
+	shared_ptr<SctpTransport> transport;
+	uint16_t stream;
+	{
+		std::shared_lock lock(mMutex);
+		transport = mSctpTransport.lock();
+		stream = mStream;
+	}
+
+	DataChannelStats stats = transport ? transport->streamStats(stream) : DataChannelStats{};
+	stats.droppedMessages = mDroppedMessages;
+	return stats;
 }
 
 bool DataChannel::isOpen(void) const { return mIsOpen; }
@@ -175,14 +265,378 @@ void DataChannel::shiftStream() {
 		mStream -= 1;
 }
 
+void DataChannel::setReceiveQueueLimit(optional<size_t> amount) {
+	mRecvQueue.setAmountLimit(amount);
+
+	// A higher limit might allow held back messages to be queued
+	drainRecvOverflow();
+}
+
+void DataChannel::setReceiveWindow(size_t amount) {
+	mRecvWindow = amount;
+
+	// Apply the new window to the messages already held back
+	std::lock_guard lock(mRecvOverflowMutex);
+	setRecvBlocking(!mRecvOverflow.empty() && mRecvHeldAmount >= amount);
+}
+
+bool DataChannel::pushRecv(message_ptr message) {
+	if (!mRecvHeldBack && mRecvQueue.push(message))
+		return true;
+
+	std::lock_guard lock(mRecvOverflowMutex);
+	if (mRecvOverflow.empty() && mRecvQueue.push(message)) // the queue might have been drained
+		return true;
+
+	if (mIsClosed) {
+		COUNTER_QUEUE_FULL++;
+		++mDroppedMessages;
+		return false;
+	}
+
+	// Hold the message back until the application catches up. Other channels keep receiving
+	// while held back messages fit in the window, then a channel with partial reliability drops
+	// messages, while a reliable one blocks SCTP receiving so the SCTP receive window slows the
+	// remote sender down. Messages are dropped by SCTP anyway if the sender abandons them.
+	const size_t size = message_size_func(message);
+	const size_t window = mRecvWindow;
+	if (message->type != Message::Control && mRecvHeldAmount + size > window) {
+		bool reliable;
+		{
+			std::shared_lock lock(mMutex);
+			reliable = mReliability.type == Reliability::Type::Reliable;
+		}
+		if (!reliable) {
+			COUNTER_QUEUE_FULL++;
+			++mDroppedMessages;
+			return false;
+		}
+	}
+
+	mRecvOverflow.push_back(std::move(message));
+	mRecvHeldAmount += size;
+	mRecvHeldBack = true;
+	if (mRecvHeldAmount >= window)
+		setRecvBlocking(true);
+
+	return false;
+}
+
+void DataChannel::drainRecvOverflow() {
+	if (!mRecvHeldBack)
+		return;
+
+	std::lock_guard lock(mRecvOverflowMutex);
+	size_t drained = 0;
+	while (!mRecvOverflow.empty() && mRecvQueue.push(mRecvOverflow.front())) {
+		drained += message_size_func(mRecvOverflow.front());
+		mRecvOverflow.pop_front();
+	}
+
+	// Window update: receiving resumes as soon as the held back messages fit again
+	mRecvHeldAmount -= drained;
+	if (mRecvOverflow.empty())
+		mRecvHeldBack = false;
+
+	if (mRecvOverflow.empty() || mRecvHeldAmount < mRecvWindow)
+		setRecvBlocking(false);
+}
+
+void DataChannel::releaseRecvOverflow() {
+	std::lock_guard lock(mRecvOverflowMutex);
+	mRecvOverflow.clear();
+	mRecvHeldAmount = 0;
+	mRecvHeldBack = false;
+	setRecvBlocking(false);
+}
+
+void DataChannel::setRecvBlocking(bool blocking) {
+	// mRecvOverflowMutex must be locked
+	if (mRecvBlocking == blocking)
+		return;
+
+	mRecvBlocking = blocking;
+	std::shared_lock lock(mMutex);
+	if (auto transport = mSctpTransport.lock())
+		transport->setStreamBlocked(mStream, blocking);
+}
+
+void DataChannel::setSendBudget(optional<size_t> budget) {
+	mSendBudget = budget ? std::min(*budget, UnboundedBudget - 1) : UnboundedBudget;
+
+	// The new budget might allow held back messages to be sent
+	drainPendingSends();
+}
+
+void DataChannel::setFragmentCallback(fragment_callback callback) {
+	const bool enabled = bool(callback);
+	if (enabled && mDeflate)
+		throw std::logic_error("Fragmented receiving is not supported with compression");
+
+	mFragmentCallback = std::move(callback);
+
+	shared_ptr<SctpTransport> transport;
+	uint16_t stream;
+	{
+		std::shared_lock lock(mMutex);
+		transport = mSctpTransport.lock();
+		stream = mStream;
+	}
+
+	if (transport)
+		transport->setStreamFragmented(stream, enabled);
+}
+
+void DataChannel::triggerBufferedAmount(size_t amount) {
+	size_t previous = bufferedAmount.load();
+	Channel::triggerBufferedAmount(amount);
+
+	// This is called synchronously from the transport with its send lock held, so held back
+	// messages are sent from the thread pool instead
+	if (amount < previous && (mSendBudget != UnboundedBudget || mPendingCount > 0) &&
+	    !mDrainScheduled.exchange(true))
+		ThreadPool::Instance().post(weak_bind(&DataChannel::drainPendingSends, this));
+}
+
+void DataChannel::setCompression(string dictionaryName, binary dictionary) {
+	auto pc = mPeerConnection.lock();
+	mMaxDecompressedSize =
+	    pc ? pc->config.maxMessageSize.value_or(DEFAULT_LOCAL_MAX_MESSAGE_SIZE)
+	       : DEFAULT_LOCAL_MAX_MESSAGE_SIZE;
+	mDictionaryName = std::move(dictionaryName);
+	mDeflate = std::make_unique<MessageDeflate>(std::move(dictionary));
+}
+
+bool DataChannel::isCompressed() const { return bool(mDeflate); }
+
+message_ptr DataChannel::compressOutgoing(message_ptr message,
+                                          const optional<Reliability> &reliability) {
+	if (!mDeflate)
+		return message;
+
+	// The context of previous messages is only used if they are all received in order
+	const Reliability &effective = reliability ? *reliability : mReliability;
+	const bool ordered = effective.type == Reliability::Type::Reliable && !effective.unordered;
+	mDeflate->compress(*message, ordered);
+	return message;
+}
+
+bool DataChannel::withinBudget(size_t size, size_t budget) const {
+	const size_t buffered = bufferedAmount;
+
+	// A message is always accepted when nothing is buffered so larger ones can't get stuck
+	return buffered == 0 || (buffered <= budget && size <= budget - buffered);
+}
+
+bool DataChannel::sendFragments(PendingSend &pending) {
+	// Only called by the draining thread, which has exclusive access to the streamed message
+	// Fragments are only read while the buffered amount is low, so the streamed message is never
+	// entirely materialized in memory
+	const size_t budget = std::min(mSendBudget.load(), STREAM_BUFFER_LIMIT);
+	const size_t chunkSize = std::min(STREAM_CHUNK_SIZE, maxMessageSize());
+	while (withinBudget(chunkSize, budget)) {
+		auto message = make_message(chunkSize, Message::Binary);
+		size_t len = pending.reader(message->data(), chunkSize);
+		message->resize(std::min(len, chunkSize));
+		message->incomplete = len > 0; // an empty fragment terminates the message
+
+		auto transport = prepareOutgoing(message);
+		transport->send(message);
+		pending.started = true;
+		if (!message->incomplete)
+			return true;
+	}
+
+	return false;
+}
+
+void DataChannel::sendAssembled(PendingSend &pending) {
+	// Only called by the draining thread, like sendFragments()
+	const size_t limit = maxMessageSize();
+	binary data;
+	size_t len;
+	do {
+		const size_t offset = data.size();
+		data.resize(offset + STREAM_CHUNK_SIZE);
+		len = pending.reader(data.data() + offset, STREAM_CHUNK_SIZE);
+		data.resize(offset + std::min(len, STREAM_CHUNK_SIZE));
+		if (data.size() > limit)
+			throw std::runtime_error("Message size exceeds limit");
+	} while (len > 0);
+
+	auto message = make_message(std::move(data));
+	auto transport = prepareOutgoing(message);
+	transport->send(message);
+	pending.started = true;
+}
+
+void DataChannel::drainPendingSends() {
+	mDrainScheduled = false;
+
+	shared_ptr<SctpTransport> transport;
+	bool transportSet;
+	uint16_t stream;
+	{
+		std::shared_lock lock(mMutex);
+		transport = mSctpTransport.lock();
+		transportSet = mTransportSet;
+		stream = mStream;
+	}
+
+	{
+		std::lock_guard lock(mPendingMutex);
+		if (mDraining) {
+			// The thread currently sending will take another pass
+			mDrainRequested = true;
+			return;
+		}
+
+		if (mPendingSends.empty() || (!transportSet && !mIsClosed))
+			return; // messages will be sent on open
+
+		mDraining = true;
+		mDrainRequested = false;
+	}
+
+	// Messages are moved out of the queue and sent without mPendingMutex locked, as the transport
+	// calls back into the channel with its send lock held. Only one thread drains at a time and
+	// other messages are queued meanwhile, so the order is preserved.
+	std::vector<PendingSend> batch;
+	std::vector<shared_ptr<std::promise<void>>> accepted;
+	size_t current = 0;
+	bool interrupted = false;
+	try {
+		if (!transport || mIsClosed)
+			throw std::runtime_error("DataChannel is closed");
+
+		while (true) {
+			batch.clear();
+			current = 0;
+			{
+				std::lock_guard lock(mPendingMutex);
+				const size_t budget = mSendBudget;
+				size_t batched = 0;
+				while (!mPendingSends.empty()) {
+					auto &pending = mPendingSends.front();
+					if (pending.reader) {
+						// A streamed message is sent alone
+						if (batch.empty()) {
+							batch.push_back(std::move(pending));
+							mPendingSends.pop_front();
+						}
+						break;
+					}
+
+					const size_t size = pending.message->payloadSize();
+					if (budget != UnboundedBudget &&
+					    (batched > budget || size > budget - batched ||
+					     !withinBudget(batched + size, budget)))
+						break;
+
+					batched += size;
+					batch.push_back(std::move(pending));
+					mPendingSends.pop_front();
+				}
+
+				if (batch.empty()) {
+					mDraining = false;
+					break;
+				}
+			}
+
+			bool refused = false;
+			for (; current < batch.size(); ++current) {
+				auto &pending = batch[current];
+				if (pending.reader) {
+					try {
+						// Fragments would block the other streams without interleaving
+						if (!transport->isStreamingSupported()) {
+							sendAssembled(pending);
+						} else if (!sendFragments(pending)) {
+							refused = true;
+							break;
+						}
+					} catch (...) {
+						interrupted = pending.started;
+						throw;
+					}
+				} else {
+					pending.message->stream = stream; // the stream might have shifted before open
+					transport->send(pending.message, pending.reliability);
+				}
+
+				if (pending.promise)
+					accepted.push_back(std::move(pending.promise));
+
+				--mPendingCount;
+			}
+
+			if (refused) {
+				// Requeue the streamed message, it resumes when the buffered amount decreases
+				std::lock_guard lock(mPendingMutex);
+				mPendingSends.push_front(std::move(batch[current]));
+				batch.clear();
+				if (!mDrainRequested) {
+					mDraining = false;
+					break;
+				}
+				mDrainRequested = false;
+			}
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "Failed to send held back messages: " << e.what();
+		{
+			// Requeue what was not sent so it fails along with the rest
+			std::lock_guard lock(mPendingMutex);
+			if (current < batch.size())
+				mPendingSends.insert(mPendingSends.begin(),
+				                     std::make_move_iterator(batch.begin() + current),
+				                     std::make_move_iterator(batch.end()));
+			mDraining = false;
+		}
+		failPendingSends(std::current_exception());
+
+		// A streamed message can't be terminated properly once partially sent
+		if (interrupted)
+			close();
+	}
+
+	for (auto &promise : accepted)
+		promise->set_value();
+}
+
+void DataChannel::failPendingSends(std::exception_ptr error) {
+	std::deque<PendingSend> pendingSends;
+	{
+		std::lock_guard lock(mPendingMutex);
+		std::swap(pendingSends, mPendingSends);
+		mPendingCount = 0;
+	}
+
+	for (auto &pending : pendingSends)
+		if (pending.promise)
+			pending.promise->set_exception(error);
+}
+
 void DataChannel::open(shared_ptr<SctpTransport> transport) {
 	{
 		std::unique_lock lock(mMutex);
 		mSctpTransport = transport;
+		mTransportSet = true;
 	}
 
-	if (!mIsOpen.exchange(true))
+	transport->setStreamPriority(stream(), priority());
+	if (mFragmentCallback)
+		transport->setStreamFragmented(stream(), true);
+
+	if (!mIsOpen.exchange(true)) {
+		applyReliability();
+
+		// Messages sent before open go first, in order
+		drainPendingSends();
 		triggerOpen();
+	}
 }
 
 void DataChannel::processOpenMessage(message_ptr) {
@@ -190,7 +644,153 @@ void DataChannel::processOpenMessage(message_ptr) {
 	COUNTER_USERNEG_OPEN_MESSAGE++;
 }
 
-bool DataChannel::outgoing(message_ptr message) {
+void DataChannel::applyReliability() {
+	// Before the ACK has been received on a DataChannel, all messages must be sent ordered, so the
+	// reliability parameters are set on the stream only once the channel is open
+	std::shared_lock lock(mMutex);
+	if (auto transport = mSctpTransport.lock())
+		transport->setStreamReliability(mStream, mReliability);
+}
+
+#if RTC_ENABLE_LATENCY_TRACING
+void DataChannel::traceOutgoing(const shared_ptr<SctpTransport> &transport,
+                                const message_ptr &message) {
+	auto tracer = transport->latencyTracer();
+	if (tracer && tracer->sample(LatencyTracer::SctpQueue))
+		message->traceTime = LatencyTracer::clock::now();
+}
+#endif
+
+shared_ptr<SctpTransport> DataChannel::prepareOutgoing(const message_ptr &message) {
+	std::shared_lock lock(mMutex);
+	auto transport = mSctpTransport.lock();
+
+	if ((!transport && mTransportSet) || mIsClosed)
+		throw std::runtime_error("DataChannel is closed");
+
+	if (message->payloadSize() > maxMessageSize())
+		throw std::runtime_error("Message size exceeds limit");
+
+	if (mMemoryAccount && mMemoryAccount->exceeded(message->payloadSize()))
+		throw std::runtime_error("Connection memory limit exceeded");
+
+	message->stream = mStream;
+	message->dscp = mDscp;
+	if (message->dscp == 0) {
+		// Set recommended DSCP value for the priority
+		// See https://datatracker.ietf.org/doc/html/rfc8837#section-5
+		if (mPriority >= RTC_PRIORITY_HIGH)
+			message->dscp = 18; // AF21: Assured Forwarding class 2, low drop probability
+		else if (mPriority <= RTC_PRIORITY_VERY_LOW)
+			message->dscp = 8; // CS1: Class Selector 1, lower effort
+		else
+			message->dscp = 10; // AF11: Assured Forwarding class 1, low drop probability
+	}
+#if RTC_ENABLE_LATENCY_TRACING
+	if (transport)
+		traceOutgoing(transport, message);
+#endif
+	return transport;
+}
+
+bool DataChannel::outgoing(message_ptr message, const optional<Reliability> &reliability) {
+	// Compressed messages must be handed over in the order of compression
+	std::unique_lock deflateLock(mDeflateMutex, std::defer_lock);
+	if (mDeflate)
+		deflateLock.lock();
+
+	auto transport = prepareOutgoing(message);
+	if (transport && mSendBudget == UnboundedBudget && mPendingCount == 0)
+		return transport->send(compressOutgoing(std::move(message), reliability), reliability);
+
+	{
+		std::lock_guard lock(mPendingMutex);
+		if (!transport)
+			transport = prepareOutgoing(message); // the channel might have been opened meanwhile
+
+		if (!transport || mDraining || !mPendingSends.empty() ||
+		    !withinBudget(message->payloadSize(), mSendBudget)) {
+			// Hold the message back, it will be sent on open or when the buffered amount decreases
+			mPendingSends.push_back({compressOutgoing(std::move(message), reliability), nullptr,
+			                         nullptr, false, reliability});
+			++mPendingCount;
+			return false;
+		}
+	}
+
+	// The transport must not be called with mPendingMutex locked
+	return transport->send(compressOutgoing(std::move(message), reliability), reliability);
+}
+
+std::future<void> DataChannel::outgoingAsync(message_ptr message) {
+	std::unique_lock deflateLock(mDeflateMutex, std::defer_lock);
+	if (mDeflate)
+		deflateLock.lock();
+
+	auto transport = prepareOutgoing(message);
+	auto promise = std::make_shared<std::promise<void>>();
+	auto future = promise->get_future();
+	{
+		std::lock_guard lock(mPendingMutex);
+		if (!transport)
+			transport = prepareOutgoing(message); // the channel might have been opened meanwhile
+
+		if (!transport || mDraining || !mPendingSends.empty() ||
+		    !withinBudget(message->payloadSize(), mSendBudget)) {
+			mPendingSends.push_back(
+			    {compressOutgoing(std::move(message), nullopt), nullptr, std::move(promise), false,
+			     nullopt});
+			++mPendingCount;
+			return future;
+		}
+	}
+
+	transport->send(compressOutgoing(std::move(message), nullopt));
+	promise->set_value();
+	return future;
+}
+
+std::future<void> DataChannel::outgoingStream(stream_reader reader) {
+	if (!reader)
+		throw std::invalid_argument("Stream reader is null");
+
+	if (mDeflate)
+		throw std::logic_error("Streamed sending is not supported with compression");
+
+	{
+		std::shared_lock lock(mMutex);
+		if ((mSctpTransport.expired() && mTransportSet) || mIsClosed)
+			throw std::runtime_error("DataChannel is closed");
+	}
+
+	auto promise = std::make_shared<std::promise<void>>();
+	auto future = promise->get_future();
+	{
+		std::lock_guard lock(mPendingMutex);
+		mPendingSends.push_back({nullptr, std::move(reader), std::move(promise), false, nullopt});
+		++mPendingCount;
+	}
+
+	// Other messages are held back until the streamed message is complete
+	drainPendingSends();
+	return future;
+}
+
+bool DataChannel::outgoingBatch(std::vector<message_ptr> messages,
+                                const optional<Reliability> &reliability) {
+	if (mSendBudget != UnboundedBudget || mPendingCount > 0 || !mIsOpen) {
+		// Messages might be held back, so each one is handled individually
+		bool sent = true;
+		for (auto &message : messages)
+			sent = outgoing(std::move(message), reliability) && sent;
+
+		return sent;
+	}
+
+	std::unique_lock deflateLock(mDeflateMutex, std::defer_lock);
+	if (mDeflate)
+		deflateLock.lock();
+
 	shared_ptr<SctpTransport> transport;
 	{
 		std::shared_lock lock(mMutex);
@@ -199,15 +799,28 @@ bool DataChannel::outgoing(message_ptr message) {
 		if (!transport || mIsClosed)
 			throw std::runtime_error("DataChannel is closed");
 
-		if (message->size() > maxMessageSize())
-			throw std::runtime_error("Message size exceeds limit");
+		const size_t maxSize = maxMessageSize();
+		size_t total = 0;
+		for (auto &message : messages) {
+			if (message->payloadSize() > maxSize)
+				throw std::runtime_error("Message size exceeds limit");
+
+			total += message->payloadSize();
 
-		// Before the ACK has been received on a DataChannel, all messages must be sent ordered
-		message->reliability = mIsOpen ? mReliability : nullptr;
-		message->stream = mStream;
+			message->stream = mStream;
+#if RTC_ENABLE_LATENCY_TRACING
+			traceOutgoing(transport, message);
+#endif
+		}
+
+		if (mMemoryAccount && mMemoryAccount->exceeded(total))
+			throw std::runtime_error("Connection memory limit exceeded");
 	}
 
-	return transport->send(message);
+	for (auto &message : messages)
+		message = compressOutgoing(std::move(message), reliability);
+
+	return transport->sendBatch(messages, reliability) == messages.size();
 }
 
 void DataChannel::incoming(message_ptr message) {
@@ -225,13 +838,14 @@ void DataChannel::incoming(message_ptr message) {
 			break;
 		case MESSAGE_ACK:
 			if (!mIsOpen.exchange(true)) {
+				applyReliability();
 				triggerOpen();
 			}
 			break;
 		case MESSAGE_CLOSE:
 			// The close message will be processed in-order in receive()
-			mRecvQueue.push(message);
-			triggerAvailable(mRecvQueue.size());
+			if (pushRecv(message))
+				triggerAvailable(mRecvQueue.size());
 			break;
 		default:
 			// Ignore
@@ -241,8 +855,29 @@ void DataChannel::incoming(message_ptr message) {
 	}
 	case Message::String:
 	case Message::Binary:
-		mRecvQueue.push(message);
-		triggerAvailable(mRecvQueue.size());
+		// Decompression happens in receiving order, incoming() is never called concurrently
+		if (mDeflate && !mDeflate->decompress(*message, mMaxDecompressedSize)) {
+			// The message is lost and the context might be out of sync, so the channel can't go on
+			COUNTER_DECOMPRESSION_FAILED++;
+			++mDroppedMessages;
+			closeWithError("Message decompression failed");
+			break;
+		}
+		if (mFragmentCallback) {
+			// Streamed receiving, messages are delivered as fragments without queueing
+			bool last = !message->incomplete;
+			mFragmentCallback(to_variant(std::move(*message)), last);
+			break;
+		}
+		if (mMemoryAccount && mMemoryAccount->exceeded()) {
+			// Messages are never silently dropped, the channel is closed instead
+			COUNTER_MEMORY_LIMIT++;
+			++mDroppedMessages;
+			closeWithError("Connection memory limit exceeded");
+			break;
+		}
+		if (pushRecv(message))
+			triggerAvailable(mRecvQueue.size());
 		break;
 	default:
 		// Ignore
@@ -251,13 +886,16 @@ void DataChannel::incoming(message_ptr message) {
 }
 
 NegotiatedDataChannel::NegotiatedDataChannel(weak_ptr<PeerConnection> pc, uint16_t stream,
-                                             string label, string protocol, Reliability reliability)
-    : DataChannel(pc, stream, std::move(label), std::move(protocol), std::move(reliability)) {}
+                                             string label, string protocol, Reliability reliability,
+                                             uint16_t priority)
+    : DataChannel(pc, stream, std::move(label), std::move(protocol), std::move(reliability),
+                  priority) {}
 
 NegotiatedDataChannel::NegotiatedDataChannel(weak_ptr<PeerConnection> pc,
                                              weak_ptr<SctpTransport> transport, uint16_t stream)
     : DataChannel(pc, stream, "", "", {}) {
 	mSctpTransport = transport;
+	mTransportSet = true;
 }
 
 NegotiatedDataChannel::~NegotiatedDataChannel() {}
@@ -265,18 +903,19 @@ NegotiatedDataChannel::~NegotiatedDataChannel() {}
 void NegotiatedDataChannel::open(shared_ptr<SctpTransport> transport) {
 	std::unique_lock lock(mMutex);
 	mSctpTransport = transport;
+	mTransportSet = true;
 
 	uint8_t channelType;
 	uint32_t reliabilityParameter;
-	switch (mReliability->type) {
+	switch (mReliability.type) {
 	case Reliability::Type::Rexmit:
 		channelType = CHANNEL_PARTIAL_RELIABLE_REXMIT;
-		reliabilityParameter = uint32_t(std::max(std::get<int>(mReliability->rexmit), 0));
+		reliabilityParameter = uint32_t(std::max(std::get<int>(mReliability.rexmit), 0));
 		break;
 
 	case Reliability::Type::Timed:
 		channelType = CHANNEL_PARTIAL_RELIABLE_TIMED;
-		reliabilityParameter = uint32_t(std::get<milliseconds>(mReliability->rexmit).count());
+		reliabilityParameter = uint32_t(std::get<milliseconds>(mReliability.rexmit).count());
 		break;
 
 	default:
@@ -285,26 +924,36 @@ void NegotiatedDataChannel::open(shared_ptr<SctpTransport> transport) {
 		break;
 	}
 
-	if (mReliability->unordered)
+	if (mReliability.unordered)
 		channelType |= 0x80;
 
-	const size_t len = sizeof(OpenMessage) + mLabel.size() + mProtocol.size();
+	// Compression is announced to the remote peer in the protocol
+	const string protocol =
+	    mDeflate ? MessageDeflate::MakeProtocol(mProtocol, mDictionaryName) : mProtocol;
+
+	const size_t len = sizeof(OpenMessage) + mLabel.size() + protocol.size();
 	binary buffer(len, byte(0));
 	auto &open = *reinterpret_cast<OpenMessage *>(buffer.data());
 	open.type = MESSAGE_OPEN;
 	open.channelType = channelType;
-	open.priority = htons(0);
+	open.priority = htons(mPriority);
 	open.reliabilityParameter = htonl(reliabilityParameter);
 	open.labelLength = htons(uint16_t(mLabel.size()));
-	open.protocolLength = htons(uint16_t(mProtocol.size()));
+	open.protocolLength = htons(uint16_t(protocol.size()));
 
 	auto end = reinterpret_cast<char *>(buffer.data() + sizeof(OpenMessage));
 	std::copy(mLabel.begin(), mLabel.end(), end);
-	std::copy(mProtocol.begin(), mProtocol.end(), end + mLabel.size());
+	std::copy(protocol.begin(), protocol.end(), end + mLabel.size());
 
+	const uint16_t priority = mPriority;
 	lock.unlock();
 
+	transport->setStreamPriority(mStream, priority);
+
 	transport->send(make_message(buffer.begin(), buffer.end(), Message::Control, mStream));
+
+	// RFC 8832: Messages may be sent right after the open message, without waiting for the ACK
+	drainPendingSends();
 }
 
 void NegotiatedDataChannel::processOpenMessage(message_ptr message) {
@@ -328,32 +977,51 @@ void NegotiatedDataChannel::processOpenMessage(message_ptr message) {
 	auto end = reinterpret_cast<const char *>(message->data() + sizeof(OpenMessage));
 	mLabel.assign(end, open.labelLength);
 	mProtocol.assign(end + open.labelLength, open.protocolLength);
+	mPriority = open.priority;
+
+	if (auto dictionaryName = MessageDeflate::ParseProtocol(mProtocol)) {
+		auto pc = mPeerConnection.lock();
+		auto dictionary = pc ? pc->compressionDictionary(*dictionaryName) : nullopt;
+		if (!MessageDeflate::IsAvailable() || !dictionary) {
+			PLOG_WARNING << "Unsupported compression for DataChannel \"" << mLabel
+			             << "\", closing";
+			lock.unlock();
+			transport->closeStream(mStream);
+			return;
+		}
+		setCompression(std::move(*dictionaryName), std::move(*dictionary));
+	}
 
-	mReliability->unordered = (open.channelType & 0x80) != 0;
+	mReliability.unordered = (open.channelType & 0x80) != 0;
 	switch (open.channelType & 0x7F) {
 	case CHANNEL_PARTIAL_RELIABLE_REXMIT:
-		mReliability->type = Reliability::Type::Rexmit;
-		mReliability->rexmit = int(open.reliabilityParameter);
+		mReliability.type = Reliability::Type::Rexmit;
+		mReliability.rexmit = int(open.reliabilityParameter);
 		break;
 	case CHANNEL_PARTIAL_RELIABLE_TIMED:
-		mReliability->type = Reliability::Type::Timed;
-		mReliability->rexmit = milliseconds(open.reliabilityParameter);
+		mReliability.type = Reliability::Type::Timed;
+		mReliability.rexmit = milliseconds(open.reliabilityParameter);
 		break;
 	default:
-		mReliability->type = Reliability::Type::Reliable;
-		mReliability->rexmit = int(0);
+		mReliability.type = Reliability::Type::Reliable;
+		mReliability.rexmit = int(0);
 	}
 
+	const uint16_t priority = mPriority;
 	lock.unlock();
 
+	transport->setStreamPriority(mStream, priority);
+
 	binary buffer(sizeof(AckMessage), byte(0));
 	auto &ack = *reinterpret_cast<AckMessage *>(buffer.data());
 	ack.type = MESSAGE_ACK;
 
 	transport->send(make_message(buffer.begin(), buffer.end(), Message::Control, mStream));
 
-	if (!mIsOpen.exchange(true))
+	if (!mIsOpen.exchange(true)) {
+		applyReliability();
 		triggerOpen();
+	}
 }
 
 } // namespace rtc::impl
@@ -21,13 +21,20 @@
 
 #include "channel.hpp"
 #include "common.hpp"
+#include "memoryaccount.hpp"
 #include "message.hpp"
+#include "messagedeflate.hpp"
 #include "peerconnection.hpp"
-#include "queue.hpp"
 #include "reliability.hpp"
+#include "ringqueue.hpp"
 #include "sctptransport.hpp"
 
 #include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <mutex>
 #include <shared_mutex>
 
 namespace rtc::impl {
@@ -35,53 +42,141 @@ namespace rtc::impl {
 struct PeerConnection;
 
 struct DataChannel : Channel, std::enable_shared_from_this<DataChannel> {
+	using stream_reader = std::function<size_t(byte *buffer, size_t size)>;
+	using fragment_callback = std::function<void(message_variant fragment, bool last)>;
+
 	DataChannel(weak_ptr<PeerConnection> pc, uint16_t stream, string label, string protocol,
-	            Reliability reliability);
+	            Reliability reliability, uint16_t priority = RTC_PRIORITY_LOW);
 	virtual ~DataChannel();
 
 	void close();
 	void remoteClose();
-	bool outgoing(message_ptr message);
+	// The reliability overrides the one of the channel for these messages only
+	bool outgoing(message_ptr message, const optional<Reliability> &reliability = nullopt);
+	bool outgoingBatch(std::vector<message_ptr> messages,
+	                   const optional<Reliability> &reliability = nullopt);
+	std::future<void> outgoingAsync(message_ptr message);
+	std::future<void> outgoingStream(stream_reader reader);
 	void incoming(message_ptr message);
 
 	optional<message_variant> receive() override;
+	message_ptr receiveMessage() override;
 	optional<message_variant> peek() override;
 	size_t availableAmount() const override;
 
+	void triggerOpen() override;
+	void triggerBufferedAmount(size_t amount) override;
+
 	uint16_t stream() const;
 	string label() const;
 	string protocol() const;
 	Reliability reliability() const;
+	uint16_t priority() const;
+	unsigned int dscp() const;
+	void setDscp(unsigned int dscp);
+	DataChannelStats stats() const;
 
 	bool isOpen(void) const;
 	bool isClosed(void) const;
 	size_t maxMessageSize() const;
 
 	void shiftStream();
+	void setSendBudget(optional<size_t> budget);
+	void setReceiveQueueLimit(optional<size_t> amount);
+	void setReceiveWindow(size_t amount);
+	void setFragmentCallback(fragment_callback callback);
+	void setCompression(string dictionaryName, binary dictionary); // before the channel is used
+	bool isCompressed() const;
 
 	virtual void open(shared_ptr<SctpTransport> transport);
 	virtual void processOpenMessage(message_ptr);
 
 protected:
+	static const size_t UnboundedBudget = std::numeric_limits<size_t>::max();
+
+	struct PendingSend {
+		message_ptr message;
+		stream_reader reader;                   // for a streamed message instead of message
+		shared_ptr<std::promise<void>> promise; // may be null
+		bool started = false;                   // the streamed message is partially sent
+		optional<Reliability> reliability;      // overrides the one of the channel if set
+	};
+
+	void applyReliability();
+	shared_ptr<SctpTransport> prepareOutgoing(const message_ptr &message); // null if not open yet
+#if RTC_ENABLE_LATENCY_TRACING
+	static void traceOutgoing(const shared_ptr<SctpTransport> &transport,
+	                          const message_ptr &message);
+#endif
+	bool pushRecv(message_ptr message); // false if held back or dropped
+	void drainRecvOverflow();
+	void releaseRecvOverflow();
+	void setRecvBlocking(bool blocking); // pause or resume SCTP receiving for the association
+	bool withinBudget(size_t size, size_t budget) const;
+	message_ptr compressOutgoing(message_ptr message, // mDeflateMutex must be locked
+	                             const optional<Reliability> &reliability);
+	bool sendFragments(PendingSend &pending); // true when the streamed message is complete
+	void sendAssembled(PendingSend &pending); // without streaming support
+	void drainPendingSends();
+	void failPendingSends(std::exception_ptr error);
+	void closeWithError(string error); // may be called from the transport
+
 	const weak_ptr<impl::PeerConnection> mPeerConnection;
+	const shared_ptr<MemoryAccount> mMemoryAccount; // of the PeerConnection
 	weak_ptr<SctpTransport> mSctpTransport;
+	bool mTransportSet = false; // messages are held back until the transport is set
 
 	uint16_t mStream;
 	string mLabel;
 	string mProtocol;
-	shared_ptr<Reliability> mReliability;
+	Reliability mReliability;
+	uint16_t mPriority;
+	std::atomic<unsigned int> mDscp = 0; // 0 for the default value given the priority
 
 	mutable std::shared_mutex mMutex;
 
-	Queue<message_ptr> mRecvQueue;
-
+	RingQueue<message_ptr> mRecvQueue;
+
+	// Messages received while the queue is full, up to the receive window, other channels are
+	// still received meanwhile. SCTP receiving is only blocked once the window is exhausted.
+	// Held back messages are bounded by the window and the SCTP receive buffer, so they are not
+	// charged to the connection memory account, which the incoming messages are checked against.
+	// While held back, the queue is only pushed with mRecvOverflowMutex locked
+	std::mutex mRecvOverflowMutex;
+	std::deque<message_ptr> mRecvOverflow;
+	size_t mRecvHeldAmount = 0; // protected by mRecvOverflowMutex
+	bool mRecvBlocking = false; // same, SCTP receiving is blocked by the channel
+	std::atomic<size_t> mRecvWindow = RECV_WINDOW;
+	std::atomic<bool> mRecvHeldBack = false;
+
+	// Messages held back by the send budget or until open, the mutex is recursive as sending may
+	// trigger user callbacks which send again
+	std::recursive_mutex mPendingMutex;
+	std::deque<PendingSend> mPendingSends;
+	std::atomic<size_t> mPendingCount = 0;
+	std::atomic<size_t> mSendBudget = UnboundedBudget;
+	std::atomic<bool> mDrainScheduled = false;
+	bool mDraining = false;       // protected by mPendingMutex, held back messages are being sent
+	bool mDrainRequested = false; // same, the draining thread must take another pass
+
+	synchronized_callback<message_variant, bool> mFragmentCallback;
+
+	// Messages are compressed in the order they are handed to the transport, and the mutex is
+	// recursive for the same reason as mPendingMutex
+	unique_ptr<MessageDeflate> mDeflate;
+	string mDictionaryName;
+	size_t mMaxDecompressedSize = 0; // local maximum message size
+	std::recursive_mutex mDeflateMutex;
+
+	std::atomic<size_t> mDroppedMessages = 0;
 	std::atomic<bool> mIsOpen = false;
 	std::atomic<bool> mIsClosed = false;
 };
 
 struct NegotiatedDataChannel final : public DataChannel {
 	NegotiatedDataChannel(weak_ptr<PeerConnection> pc, uint16_t stream, string label,
-	                      string protocol, Reliability reliability);
+	                      string protocol, Reliability reliability,
+	                      uint16_t priority = RTC_PRIORITY_LOW);
 	NegotiatedDataChannel(weak_ptr<PeerConnection> pc, weak_ptr<SctpTransport> transport,
 	                      uint16_t stream);
 	~NegotiatedDataChannel();
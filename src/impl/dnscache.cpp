@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "dnscache.hpp"
+#include "internals.hpp"
+#include "mdns.hpp"
+#include "threadpool.hpp"
+#include "threadregistry.hpp"
+
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#endif
+
+namespace rtc::impl {
+
+using namespace std::chrono_literals;
+
+const DnsCache::clock::duration DnsCache::Ttl = 5min;
+const DnsCache::clock::duration DnsCache::NegativeTtl = 10s;
+const size_t DnsCache::MaxResolvers = 4;
+const DnsCache::clock::duration DnsCache::ResolverIdleTimeout = 10s;
+
+DnsCache &DnsCache::Instance() {
+	static DnsCache *instance = new DnsCache;
+	return *instance;
+}
+
+DnsCache::Entry::Entry(string hostname_, bool ipv4Only_)
+    : hostname(std::move(hostname_)), ipv4Only(ipv4Only_), created(clock::now()),
+      addresses(promise.get_future().share()) {}
+
+void DnsCache::prefetch(const string &hostname, bool ipv4Only) { get(hostname, ipv4Only, true); }
+
+optional<std::vector<string>> DnsCache::lookup(const string &hostname, bool ipv4Only) {
+	auto entry = get(hostname, ipv4Only, true);
+	if (entry->addresses.wait_for(0s) != std::future_status::ready)
+		return nullopt;
+
+	return entry->addresses.get();
+}
+
+std::vector<string> DnsCache::resolve(const string &hostname, bool ipv4Only) {
+	auto entry = get(hostname, ipv4Only, false);
+	run(*entry);
+	return entry->addresses.get();
+}
+
+void DnsCache::resolveAsync(const string &hostname, addresses_callback callback, bool ipv4Only) {
+	auto entry = get(hostname, ipv4Only, true);
+	{
+		std::lock_guard lock(mMutex);
+		if (entry->addresses.wait_for(0s) != std::future_status::ready) {
+			entry->waiters.push_back(std::move(callback));
+			return;
+		}
+	}
+
+	ThreadPool::Instance().post(std::move(callback), entry->addresses.get());
+}
+
+void DnsCache::clear() {
+	std::lock_guard lock(mMutex);
+	mEntries.clear();
+}
+
+shared_ptr<DnsCache::Entry> DnsCache::get(const string &hostname, bool ipv4Only,
+                                          bool background) {
+	const string key = (ipv4Only ? "4 " : "* ") + hostname;
+
+	std::lock_guard lock(mMutex);
+	if (auto it = mEntries.find(key); it != mEntries.end()) {
+		auto entry = it->second;
+		if (entry->addresses.wait_for(0s) != std::future_status::ready)
+			return entry; // in progress
+
+		auto ttl = entry->addresses.get().empty() ? NegativeTtl : Ttl;
+		if (clock::now() < entry->created + ttl)
+			return entry;
+	}
+
+	auto entry = std::make_shared<Entry>(hostname, ipv4Only);
+	mEntries[key] = entry;
+
+	if (background)
+		schedule(entry);
+
+	return entry;
+}
+
+void DnsCache::schedule(shared_ptr<Entry> entry) {
+	mPending.push_back(std::move(entry));
+	mCondition.notify_one();
+	if (mPending.size() > mIdleResolvers && mResolvers < MaxResolvers) {
+		// The cache is never destroyed, so resolver threads can be detached
+		std::thread(&DnsCache::runResolver, this).detach();
+		++mResolvers;
+	}
+}
+
+void DnsCache::runResolver() {
+	ThreadRegistry::Registration registration(ThreadRegistry::Role::Resolver);
+	std::unique_lock lock(mMutex);
+	while (true) {
+		if (mPending.empty()) {
+			++mIdleResolvers;
+			mCondition.wait_for(lock, ResolverIdleTimeout, [this]() { return !mPending.empty(); });
+			--mIdleResolvers;
+			if (mPending.empty()) {
+				--mResolvers;
+				return;
+			}
+		}
+
+		auto entry = std::move(mPending.front());
+		mPending.pop_front();
+		lock.unlock();
+		run(*entry);
+		lock.lock();
+	}
+}
+
+void DnsCache::run(Entry &entry) {
+	std::call_once(entry.once, [this, &entry]() {
+		entry.promise.set_value(Resolve(entry.hostname, entry.ipv4Only));
+
+		std::vector<addresses_callback> waiters;
+		{
+			std::lock_guard lock(mMutex);
+			std::swap(waiters, entry.waiters);
+		}
+		for (auto &waiter : waiters)
+			ThreadPool::Instance().post(std::move(waiter), entry.addresses.get());
+	});
+}
+
+std::vector<string> DnsCache::Resolve(const string &hostname, bool ipv4Only) {
+	// Browsers conceal host candidates behind random .local names, which most system resolvers
+	// don't handle, so query the link directly
+	if (IsMdnsHostname(hostname)) {
+		auto addresses = MdnsResolve(hostname, ipv4Only);
+		if (!addresses.empty())
+			return addresses;
+
+		// The system might still resolve it, for instance with nss-mdns or Bonjour
+	}
+
+	PLOG_DEBUG << "Resolving \"" << hostname << "\"";
+
+	struct addrinfo hints = {};
+	hints.ai_family = ipv4Only ? AF_INET : AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	hints.ai_flags = AI_ADDRCONFIG;
+	struct addrinfo *result = nullptr;
+	if (getaddrinfo(hostname.c_str(), nullptr, &hints, &result) != 0) {
+		PLOG_WARNING << "Unable to resolve \"" << hostname << "\"";
+		return {};
+	}
+
+	std::vector<string> addresses;
+	for (auto p = result; p; p = p->ai_next) {
+		if (p->ai_family != AF_INET && p->ai_family != AF_INET6)
+			continue;
+
+		char node[MAX_NUMERICNODE_LEN];
+		if (getnameinfo(p->ai_addr, socklen_t(p->ai_addrlen), node, MAX_NUMERICNODE_LEN, nullptr,
+		                0, NI_NUMERICHOST) == 0)
+			addresses.emplace_back(node);
+	}
+	freeaddrinfo(result);
+
+	PLOG_VERBOSE << "Resolved \"" << hostname << "\" to " << addresses.size() << " address(es)";
+	return addresses;
+}
+
+} // namespace rtc::impl
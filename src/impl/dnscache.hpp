@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_DNS_CACHE_H
+#define RTC_IMPL_DNS_CACHE_H
+
+#include "common.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace rtc::impl {
+
+// Process-wide cache of hostname resolutions, so connections to the same ICE servers or
+// signaling hosts don't each pay for a blocking DNS lookup. getaddrinfo() does not expose record
+// TTLs, so entries expire after a fixed delay. Addresses are returned as numeric host strings.
+// Names in the .local domain, like mDNS host candidates, are resolved with a multicast query.
+// Background resolutions block, so they run on dedicated resolver threads instead of the thread
+// pool, spawned on demand and exiting once idle.
+class DnsCache final {
+public:
+	using clock = std::chrono::steady_clock;
+	using addresses_callback = std::function<void(std::vector<string> addresses)>;
+
+	static DnsCache &Instance();
+
+	DnsCache(const DnsCache &) = delete;
+	DnsCache &operator=(const DnsCache &) = delete;
+
+	// Start resolving in the background if the hostname is not cached
+	void prefetch(const string &hostname, bool ipv4Only = false);
+
+	// Return cached addresses without blocking, a background resolution is started on miss
+	optional<std::vector<string>> lookup(const string &hostname, bool ipv4Only = false);
+
+	// Return addresses, resolving synchronously on miss
+	std::vector<string> resolve(const string &hostname, bool ipv4Only = false);
+
+	// Call back with addresses on the thread pool, right away if they are cached, or else once the
+	// background resolution is done
+	void resolveAsync(const string &hostname, addresses_callback callback, bool ipv4Only = false);
+
+	void clear();
+
+private:
+	DnsCache() = default;
+	~DnsCache() = default;
+
+	static const clock::duration Ttl;
+	static const clock::duration NegativeTtl; // for failed resolutions
+	static const size_t MaxResolvers;
+	static const clock::duration ResolverIdleTimeout;
+
+	// The resolution is run once, either by a pool thread or by the first synchronous caller,
+	// so a caller never waits on a task still queued behind it
+	struct Entry {
+		Entry(string hostname, bool ipv4Only);
+
+		const string hostname;
+		const bool ipv4Only;
+		const clock::time_point created;
+		std::once_flag once;
+		std::promise<std::vector<string>> promise;
+		std::shared_future<std::vector<string>> addresses;
+		std::vector<addresses_callback> waiters; // protected by the cache mutex
+	};
+
+	shared_ptr<Entry> get(const string &hostname, bool ipv4Only, bool background);
+	void run(Entry &entry);
+	void schedule(shared_ptr<Entry> entry); // the mutex must be locked
+	void runResolver();
+	static std::vector<string> Resolve(const string &hostname, bool ipv4Only);
+
+	std::unordered_map<string, shared_ptr<Entry>> mEntries;
+	std::deque<shared_ptr<Entry>> mPending; // background resolutions
+	size_t mResolvers = 0;
+	size_t mIdleResolvers = 0;
+	std::condition_variable mCondition;
+	std::mutex mMutex;
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -16,6 +16,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM Srtp
+
 #include "dtlssrtptransport.hpp"
 #include "logcounter.hpp"
 #include "rtp.hpp"
@@ -23,8 +25,10 @@
 
 #if RTC_ENABLE_MEDIA
 
+#include <algorithm>
 #include <cstring>
 #include <exception>
+#include <thread>
 
 using std::to_integer;
 using std::to_string;
@@ -50,40 +54,129 @@ static LogCounter
 static LogCounter
     COUNTER_SRTP_FAIL(plog::warning,
                       "Number of SRTP packets received that had an unknown libSRTP failure");
+static LogCounter
+    COUNTER_MEDIA_REALLOCATION(plog::debug,
+                               "Number of media packets sent without tailroom for SRTP");
+
+// IANA DTLS-SRTP protection profile identifiers
+// See https://www.iana.org/assignments/srtp-protection/srtp-protection.xhtml
+static const unsigned long SRTP_PROFILE_AES128_CM_HMAC_SHA1_80 = 0x0001;
+static const unsigned long SRTP_PROFILE_AEAD_AES_128_GCM = 0x0007;
+static const unsigned long SRTP_PROFILE_AEAD_AES_256_GCM = 0x0008;
+
+static unsigned int EcnCodepoint(EcnMarking marking) {
+	switch (marking) {
+	case EcnMarking::Classic:
+		return 0x02; // ECT(0)
+	case EcnMarking::L4S:
+		return 0x01; // ECT(1)
+	default:
+		return 0x00; // Not-ECT
+	}
+}
 
-void DtlsSrtpTransport::Init() { srtp_init(); }
+bool DtlsSrtpTransport::GcmSupported = false;
+
+void DtlsSrtpTransport::Init() {
+	srtp_init();
+
+	// libSRTP only provides AES-GCM when built with a crypto backend like OpenSSL, check it by
+	// creating a dummy session
+	unsigned char key[SRTP_AES_GCM_256_KEY_LEN_WSALT] = {};
+	srtp_policy_t policy = {};
+	srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtp);
+	srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtcp);
+	policy.ssrc.type = ssrc_any_outbound;
+	policy.key = key;
+	policy.next = nullptr;
+
+	srtp_t session;
+	GcmSupported = srtp_create(&session, &policy) == srtp_err_status_ok;
+	if (GcmSupported)
+		srtp_dealloc(session);
+
+	PLOG_DEBUG << "SRTP AES-GCM is " << (GcmSupported ? "supported" : "not supported");
+}
 
 void DtlsSrtpTransport::Cleanup() { srtp_shutdown(); }
 
 DtlsSrtpTransport::DtlsSrtpTransport(shared_ptr<IceTransport> lower,
-                                     shared_ptr<Certificate> certificate, optional<size_t> mtu,
+                                     shared_ptr<Certificate> certificate,
+                                     const Configuration &config,
                                      verifier_callback verifierCallback,
                                      message_callback srtpRecvCallback,
                                      state_callback stateChangeCallback)
-    : DtlsTransport(lower, certificate, mtu, std::move(verifierCallback),
+    : DtlsTransport(lower, certificate, config, std::move(verifierCallback),
                     std::move(stateChangeCallback)),
-      mSrtpRecvCallback(std::move(srtpRecvCallback)) { // distinct from Transport recv callback
+      mSrtpRecvCallback(std::move(srtpRecvCallback)), // distinct from Transport recv callback
+      mEcnCodepoint(EcnCodepoint(config.mediaEcn)),
+      mOutbound(std::clamp(std::thread::hardware_concurrency(), 1u, MaxOutboundLanes)) {
 
 	PLOG_DEBUG << "Initializing DTLS-SRTP transport";
 
+	// Offer AEAD_AES_256_GCM and AEAD_AES_128_GCM first as they are cheaper than HMAC-SHA1
+	// See https://www.rfc-editor.org/rfc/rfc7714.html
+	string profiles;
+#if USE_GNUTLS
+	if (GcmSupported) {
+		// Older GnuTLS versions don't know about GCM profiles
+		for (const char *name : {"SRTP_AEAD_AES_256_GCM", "SRTP_AEAD_AES_128_GCM"}) {
+			gnutls_srtp_profile_t profile;
+			if (gnutls_srtp_get_profile_id(name, &profile) == GNUTLS_E_SUCCESS)
+				profiles += string(name) + ':';
+		}
+	}
+	profiles += "SRTP_AES128_CM_HMAC_SHA1_80";
+
+	const char *err_pos = NULL;
+	gnutls::check(gnutls_srtp_set_profile_direct(mSession, profiles.c_str(), &err_pos),
+	              "Failed to set SRTP profiles");
+#else
+#ifdef SRTP_AEAD_AES_128_GCM
+	if (GcmSupported)
+		profiles += "SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:";
+#endif
+	profiles += "SRTP_AES128_CM_SHA1_80";
+
+	// Warning: SSL_set_tlsext_use_srtp() returns 0 on success and 1 on error
+	if (SSL_set_tlsext_use_srtp(mSsl, profiles.c_str()))
+		throw std::runtime_error("Failed to set SRTP profiles: " +
+		                         openssl::error_string(ERR_get_error()));
+#endif
+	PLOG_VERBOSE << "Offered SRTP profiles: " << profiles;
+
+	auto dealloc = [this]() {
+		if (mSrtpIn)
+			srtp_dealloc(mSrtpIn);
+		for (auto &lane : mOutbound)
+			if (lane.session)
+				srtp_dealloc(lane.session);
+	};
+
 	if (srtp_err_status_t err = srtp_create(&mSrtpIn, nullptr)) {
+		mSrtpIn = nullptr;
 		throw std::runtime_error("srtp_create failed, status=" + to_string(static_cast<int>(err)));
 	}
-	if (srtp_err_status_t err = srtp_create(&mSrtpOut, nullptr)) {
-		srtp_dealloc(mSrtpIn);
-		throw std::runtime_error("srtp_create failed, status=" + to_string(static_cast<int>(err)));
+	for (auto &lane : mOutbound) {
+		if (srtp_err_status_t err = srtp_create(&lane.session, nullptr)) {
+			lane.session = nullptr;
+			dealloc();
+			throw std::runtime_error("srtp_create failed, status=" +
+			                         to_string(static_cast<int>(err)));
+		}
 	}
+	PLOG_VERBOSE << "Using " << mOutbound.size() << " outbound SRTP sessions";
 }
 
 DtlsSrtpTransport::~DtlsSrtpTransport() {
 	stop(); // stop before deallocating
 
 	srtp_dealloc(mSrtpIn);
-	srtp_dealloc(mSrtpOut);
+	for (auto &lane : mOutbound)
+		srtp_dealloc(lane.session);
 }
 
 bool DtlsSrtpTransport::sendMedia(message_ptr message) {
-	std::lock_guard lock(sendMutex);
 	if (!message)
 		return false;
 
@@ -92,6 +185,79 @@ bool DtlsSrtpTransport::sendMedia(message_ptr message) {
 		return false;
 	}
 
+	// Sending under the lane lock preserves the order of packets for each SSRC
+	auto &lane = mOutbound[laneIndex(message)];
+	std::lock_guard lock(lane.mutex);
+	protect(lane.session, message);
+	return Transport::outgoing(std::move(message)); // bypass DTLS DSCP marking
+}
+
+size_t DtlsSrtpTransport::sendMedia(const std::vector<message_ptr> &messages) {
+	if (!mInitDone) {
+		PLOG_ERROR << "SRTP media sent before keys are derived";
+		return 0;
+	}
+
+	std::vector<size_t> indices(messages.size());
+	for (size_t i = 0; i < messages.size(); ++i)
+		indices[i] = messages[i] ? laneIndex(messages[i]) : mOutbound.size();
+
+	size_t count = 0;
+	for (size_t l = 0; l < mOutbound.size(); ++l) {
+		auto &lane = mOutbound[l];
+		if (std::find(indices.begin(), indices.end(), l) == indices.end())
+			continue;
+
+		// Protect the packets of the lane first so libSRTP runs over consecutive packets with
+		// the session state hot in cache, then hand the packets to the lower layer
+		std::vector<message_ptr> batch;
+		std::lock_guard lock(lane.mutex);
+		for (size_t i = 0; i < messages.size(); ++i) {
+			if (indices[i] == l) {
+				protect(lane.session, messages[i]);
+				batch.push_back(messages[i]);
+			}
+		}
+
+		count += outgoingBatch(batch); // bypass DTLS DSCP marking
+	}
+
+	return count;
+}
+
+void DtlsSrtpTransport::setEcnFeedback(bool negotiated) {
+	const unsigned int ecn = negotiated ? mEcnCodepoint : 0;
+	if (mEcn.exchange(ecn) != ecn && mEcnCodepoint != 0) {
+		PLOG_DEBUG << "ECN marking of RTP packets " << (ecn ? "enabled" : "disabled");
+	}
+}
+
+size_t DtlsSrtpTransport::laneIndex(const message_ptr &message) const {
+	if (mOutbound.size() == 1 || message->size() < 8)
+		return 0;
+
+	// The SSRC is the packet sender SSRC for RTCP (RFC 3550 section 6.4)
+	auto raw = reinterpret_cast<const uint8_t *>(message->data());
+	const uint8_t payloadType = raw[1] & 0x7F;
+	const size_t offset = payloadType >= 64 && payloadType <= 95 ? 4 : 8;
+	if (message->size() < offset + 4)
+		return 0;
+
+	uint32_t ssrc = (uint32_t(raw[offset]) << 24) | (uint32_t(raw[offset + 1]) << 16) |
+	                (uint32_t(raw[offset + 2]) << 8) | uint32_t(raw[offset + 3]);
+	return ssrc % mOutbound.size();
+}
+
+void DtlsSrtpTransport::protect(srtp_t session, const message_ptr &message) {
+	// The shared tail of a relayed packet is copied once, directly into the output buffer, while
+	// the packet is about to be encrypted in place
+	if (message->tail) {
+		message->reserve(message->packetSize() + SRTP_MAX_TRAILER_LEN);
+		message->insert(message->end(), message->tail->data,
+		                message->tail->data + message->tail->size);
+		message->tail.reset();
+	}
+
 	int size = int(message->size());
 	PLOG_VERBOSE << "Send size=" << size;
 
@@ -102,12 +268,22 @@ bool DtlsSrtpTransport::sendMedia(message_ptr message) {
 
 	// srtp_protect() and srtp_protect_rtcp() assume that they can write SRTP_MAX_TRAILER_LEN (for
 	// the authentication tag) into the location in memory immediately following the RTP packet.
+	// Packets are normally allocated with MediaTailroom so this does not reallocate.
+	static_assert(MediaTailroom >= SRTP_MAX_TRAILER_LEN);
+	if (message->capacity() < size_t(size) + SRTP_MAX_TRAILER_LEN)
+		COUNTER_MEDIA_REALLOCATION++;
+
 	message->resize(size + SRTP_MAX_TRAILER_LEN);
 
 	uint8_t value2 = to_integer<uint8_t>(*(message->begin() + 1)) & 0x7F;
 	PLOG_VERBOSE << "Demultiplexing SRTCP and SRTP with RTP payload type, value="
 	             << unsigned(value2);
 
+	const bool isRtcp = value2 >= 64 && value2 <= 95;
+	if (auto c = capture())
+		c->record(isRtcp ? CaptureWriter::Type::Rtcp : CaptureWriter::Type::Rtp, true,
+		          message->data(), size_t(size));
+
 	// RFC 5761 Multiplexing RTP and RTCP 4. Distinguishable RTP and RTCP Packets
 	// https://tools.ietf.org/html/rfc5761#section-4
 	// It is RECOMMENDED to follow the guidelines in the RTP/AVP profile for the choice of RTP
@@ -115,8 +291,8 @@ bool DtlsSrtpTransport::sendMedia(message_ptr message) {
 	// range 64-95 MUST NOT be used. Specifically, dynamic RTP payload types SHOULD be chosen in
 	// the range 96-127 where possible. Values below 64 MAY be used if that is insufficient
 	// [...]
-	if (value2 >= 64 && value2 <= 95) { // Range 64-95 (inclusive) MUST be RTCP
-		if (srtp_err_status_t err = srtp_protect_rtcp(mSrtpOut, message->data(), &size)) {
+	if (isRtcp) { // Range 64-95 (inclusive) MUST be RTCP
+		if (srtp_err_status_t err = srtp_protect_rtcp(session, message->data(), &size)) {
 			if (err == srtp_err_status_replay_fail)
 				throw std::runtime_error("Outgoing SRTCP packet is a replay");
 			else
@@ -125,7 +301,7 @@ bool DtlsSrtpTransport::sendMedia(message_ptr message) {
 		}
 		PLOG_VERBOSE << "Protected SRTCP packet, size=" << size;
 	} else {
-		if (srtp_err_status_t err = srtp_protect(mSrtpOut, message->data(), &size)) {
+		if (srtp_err_status_t err = srtp_protect(session, message->data(), &size)) {
 			if (err == srtp_err_status_replay_fail)
 				throw std::runtime_error("Outgoing SRTP packet is a replay");
 			else
@@ -133,6 +309,7 @@ bool DtlsSrtpTransport::sendMedia(message_ptr message) {
 				                         to_string(static_cast<int>(err)));
 		}
 		PLOG_VERBOSE << "Protected SRTP packet, size=" << size;
+		message->ecn = mEcn.load(std::memory_order_relaxed); // RTCP is never marked
 	}
 
 	message->resize(size);
@@ -142,14 +319,12 @@ bool DtlsSrtpTransport::sendMedia(message_ptr message) {
 		// See https://datatracker.ietf.org/doc/html/rfc8837#section-5
 		message->dscp = 36; // AF42: Assured Forwarding class 4, medium drop probability
 	}
-
-	return Transport::outgoing(message); // bypass DTLS DSCP marking
 }
 
 void DtlsSrtpTransport::incoming(message_ptr message) {
 	if (!mInitDone) {
-		// Bypas
-		DtlsTransport::incoming(message);
+		// Bypass
+		DtlsTransport::incoming(std::move(message));
 		return;
 	}
 
@@ -168,7 +343,7 @@ void DtlsSrtpTransport::incoming(message_ptr message) {
 
 	if (value1 >= 20 && value1 <= 63) {
 		PLOG_VERBOSE << "Incoming DTLS packet, size=" << size;
-		DtlsTransport::incoming(message);
+		DtlsTransport::incoming(std::move(message));
 
 	} else if (value1 >= 128 && value1 <= 191) {
 		// The RTP header has a minimum size of 12 bytes
@@ -225,7 +400,12 @@ void DtlsSrtpTransport::incoming(message_ptr message) {
 		}
 
 		message->resize(size);
-		mSrtpRecvCallback(message);
+		if (auto c = capture())
+			c->record(message->type == Message::Control ? CaptureWriter::Type::Rtcp
+			                                            : CaptureWriter::Type::Rtp,
+			          false, *message);
+
+		mSrtpRecvCallback(std::move(message));
 
 	} else {
 		COUNTER_UNKNOWN_PACKET_TYPE++;
@@ -237,10 +417,50 @@ void DtlsSrtpTransport::postHandshake() {
 	if (mInitDone)
 		return;
 
-	static_assert(SRTP_AES_ICM_128_KEY_LEN_WSALT == SRTP_AES_128_KEY_LEN + SRTP_SALT_LEN);
+	unsigned long profile;
+#if USE_GNUTLS
+	gnutls_srtp_profile_t srtpProfile;
+	gnutls::check(gnutls_srtp_get_selected_profile(mSession, &srtpProfile),
+	              "Failed to get SRTP profile");
+	profile = static_cast<unsigned long>(srtpProfile);
+#else
+	const SRTP_PROTECTION_PROFILE *srtpProfile = SSL_get_selected_srtp_profile(mSsl);
+	if (!srtpProfile)
+		throw std::runtime_error("Failed to get SRTP profile: " +
+		                         openssl::error_string(ERR_get_error()));
+	profile = srtpProfile->id;
+#endif
+
+	void (*setCryptoPolicy)(srtp_crypto_policy_t *);
+	size_t keySize, saltSize;
+	switch (profile) {
+	case SRTP_PROFILE_AES128_CM_HMAC_SHA1_80:
+		PLOG_INFO << "Using SRTP profile AES128_CM_HMAC_SHA1_80";
+		setCryptoPolicy = srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80;
+		keySize = SRTP_AES_128_KEY_LEN;
+		saltSize = SRTP_SALT_LEN;
+		break;
+	case SRTP_PROFILE_AEAD_AES_128_GCM:
+		PLOG_INFO << "Using SRTP profile AEAD_AES_128_GCM";
+		setCryptoPolicy = srtp_crypto_policy_set_aes_gcm_128_16_auth;
+		keySize = SRTP_AES_128_KEY_LEN;
+		saltSize = SRTP_AEAD_SALT_LEN;
+		break;
+	case SRTP_PROFILE_AEAD_AES_256_GCM:
+		PLOG_INFO << "Using SRTP profile AEAD_AES_256_GCM";
+		setCryptoPolicy = srtp_crypto_policy_set_aes_gcm_256_16_auth;
+		keySize = SRTP_AES_256_KEY_LEN;
+		saltSize = SRTP_AEAD_SALT_LEN;
+		break;
+	default:
+		throw std::logic_error("Unexpected SRTP profile: " + to_string(profile));
+	}
 
-	const size_t materialLen = SRTP_AES_ICM_128_KEY_LEN_WSALT * 2;
-	unsigned char material[materialLen];
+	static_assert(SRTP_AES_256_KEY_LEN + SRTP_AEAD_SALT_LEN <= SRTP_MAX_KEY_LEN);
+	static_assert(SRTP_AES_128_KEY_LEN + SRTP_SALT_LEN <= SRTP_MAX_KEY_LEN);
+
+	unsigned char material[SRTP_MAX_KEY_LEN * 2];
+	const size_t materialLen = (keySize + saltSize) * 2;
 	const unsigned char *clientKey, *clientSalt, *serverKey, *serverSalt;
 
 #if USE_GNUTLS
@@ -251,15 +471,15 @@ void DtlsSrtpTransport::postHandshake() {
 	                                   &clientSaltDatum, &serverKeyDatum, &serverSaltDatum),
 	              "Failed to derive SRTP keys");
 
-	if (clientKeyDatum.size != SRTP_AES_128_KEY_LEN)
+	if (clientKeyDatum.size != keySize)
 		throw std::logic_error("Unexpected SRTP master key length: " +
 		                       to_string(clientKeyDatum.size));
-	if (clientSaltDatum.size != SRTP_SALT_LEN)
+	if (clientSaltDatum.size != saltSize)
 		throw std::logic_error("Unexpected SRTP salt length: " + to_string(clientSaltDatum.size));
-	if (serverKeyDatum.size != SRTP_AES_128_KEY_LEN)
+	if (serverKeyDatum.size != keySize)
 		throw std::logic_error("Unexpected SRTP master key length: " +
 		                       to_string(serverKeyDatum.size));
-	if (serverSaltDatum.size != SRTP_SALT_LEN)
+	if (serverSaltDatum.size != saltSize)
 		throw std::logic_error("Unexpected SRTP salt size: " + to_string(serverSaltDatum.size));
 
 	clientKey = reinterpret_cast<const unsigned char *>(clientKeyDatum.data);
@@ -282,20 +502,20 @@ void DtlsSrtpTransport::postHandshake() {
 
 	// Order is client key, server key, client salt, and server salt
 	clientKey = material;
-	serverKey = clientKey + SRTP_AES_128_KEY_LEN;
-	clientSalt = serverKey + SRTP_AES_128_KEY_LEN;
-	serverSalt = clientSalt + SRTP_SALT_LEN;
+	serverKey = clientKey + keySize;
+	clientSalt = serverKey + keySize;
+	serverSalt = clientSalt + saltSize;
 #endif
 
-	std::memcpy(mClientSessionKey, clientKey, SRTP_AES_128_KEY_LEN);
-	std::memcpy(mClientSessionKey + SRTP_AES_128_KEY_LEN, clientSalt, SRTP_SALT_LEN);
+	std::memcpy(mClientSessionKey, clientKey, keySize);
+	std::memcpy(mClientSessionKey + keySize, clientSalt, saltSize);
 
-	std::memcpy(mServerSessionKey, serverKey, SRTP_AES_128_KEY_LEN);
-	std::memcpy(mServerSessionKey + SRTP_AES_128_KEY_LEN, serverSalt, SRTP_SALT_LEN);
+	std::memcpy(mServerSessionKey, serverKey, keySize);
+	std::memcpy(mServerSessionKey + keySize, serverSalt, saltSize);
 
 	srtp_policy_t inbound = {};
-	srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&inbound.rtp);
-	srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&inbound.rtcp);
+	setCryptoPolicy(&inbound.rtp);
+	setCryptoPolicy(&inbound.rtcp);
 	inbound.ssrc.type = ssrc_any_inbound;
 	inbound.key = mIsClient ? mServerSessionKey : mClientSessionKey;
 	inbound.window_size = 1024;
@@ -307,19 +527,24 @@ void DtlsSrtpTransport::postHandshake() {
 		                         to_string(static_cast<int>(err)));
 
 	srtp_policy_t outbound = {};
-	srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&outbound.rtp);
-	srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&outbound.rtcp);
+	setCryptoPolicy(&outbound.rtp);
+	setCryptoPolicy(&outbound.rtcp);
 	outbound.ssrc.type = ssrc_any_outbound;
 	outbound.key = mIsClient ? mClientSessionKey : mServerSessionKey;
 	outbound.window_size = 1024;
 	outbound.allow_repeat_tx = true;
 	outbound.next = nullptr;
 
-	if (srtp_err_status_t err = srtp_add_stream(mSrtpOut, &outbound))
-		throw std::runtime_error("SRTP add outbound stream failed, status=" +
-		                         to_string(static_cast<int>(err)));
+	// Each outbound session gets the same key, a given SSRC is always protected by the same one
+	for (auto &lane : mOutbound) {
+		std::lock_guard lock(lane.mutex);
+		if (srtp_err_status_t err = srtp_add_stream(lane.session, &outbound))
+			throw std::runtime_error("SRTP add outbound stream failed, status=" +
+			                         to_string(static_cast<int>(err)));
+	}
 
 	mInitDone = true;
+	recordKeysDerived();
 }
 
 } // namespace rtc::impl
@@ -31,6 +31,8 @@
 #endif
 
 #include <atomic>
+#include <mutex>
+#include <vector>
 
 namespace rtc::impl {
 
@@ -40,24 +42,44 @@ public:
 	static void Cleanup();
 
 	DtlsSrtpTransport(shared_ptr<IceTransport> lower, certificate_ptr certificate,
-	                  optional<size_t> mtu, verifier_callback verifierCallback,
+	                  const Configuration &config, verifier_callback verifierCallback,
 	                  message_callback srtpRecvCallback, state_callback stateChangeCallback);
 	~DtlsSrtpTransport();
 
 	bool sendMedia(message_ptr message);
+	size_t sendMedia(const std::vector<message_ptr> &messages); // returns the number sent
+
+	// Outgoing RTP packets are Not-ECT until RFC 8888 feedback is negotiated, as the sender could
+	// not react to congestion otherwise
+	void setEcnFeedback(bool negotiated);
 
 private:
 	void incoming(message_ptr message) override;
 	void postHandshake() override;
 
+	// Outbound SRTP is sharded by SSRC over independent libSRTP sessions, as sessions are not
+	// thread-safe, so streams can be protected in parallel while each SSRC keeps its order
+	struct OutboundLane {
+		std::mutex mutex;
+		srtp_t session = nullptr;
+	};
+
+	size_t laneIndex(const message_ptr &message) const;
+	void protect(srtp_t session, const message_ptr &message); // lane mutex must be locked
+
+	static bool GcmSupported; // AES-GCM requires libSRTP to be built with a crypto backend
+	static const unsigned int MaxOutboundLanes = 8;
+
 	message_callback mSrtpRecvCallback;
+	const unsigned int mEcnCodepoint;  // from the configuration
+	std::atomic<unsigned int> mEcn = 0; // codepoint of outgoing RTP packets
 
-	srtp_t mSrtpIn, mSrtpOut;
+	srtp_t mSrtpIn = nullptr;
+	std::vector<OutboundLane> mOutbound;
 
 	std::atomic<bool> mInitDone = false;
-	unsigned char mClientSessionKey[SRTP_AES_ICM_128_KEY_LEN_WSALT];
-	unsigned char mServerSessionKey[SRTP_AES_ICM_128_KEY_LEN_WSALT];
-	std::mutex sendMutex;
+	unsigned char mClientSessionKey[SRTP_MAX_KEY_LEN];
+	unsigned char mServerSessionKey[SRTP_MAX_KEY_LEN];
 };
 
 } // namespace rtc::impl
@@ -16,10 +16,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM Dtls
+
 #include "dtlstransport.hpp"
 #include "icetransport.hpp"
 #include "internals.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <exception>
@@ -33,24 +36,168 @@
 #endif
 #endif
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define RTC_DTLS_CPU_X86 1
+#elif (defined(__aarch64__) || defined(__arm__)) && defined(__linux__)
+#include <sys/auxv.h>
+#define RTC_DTLS_CPU_ARM_LINUX 1
+#endif
+
 using namespace std::chrono;
 
 namespace rtc::impl {
 
+namespace {
+
+// Without AES instructions, ChaCha20-Poly1305 is several times faster than AES-GCM so it should
+// be preferred for the records. When the CPU can't be checked, keep the usual AES-GCM preference.
+bool HasHardwareAes() {
+#if defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO) ||                                 \
+    (defined(__APPLE__) && defined(__aarch64__))
+	return true; // checked at compile time
+#elif RTC_DTLS_CPU_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 25)) != 0; // AES-NI
+#else
+	__builtin_cpu_init(); // might be called before constructors
+	return __builtin_cpu_supports("aes");
+#endif
+#elif RTC_DTLS_CPU_ARM_LINUX && defined(__aarch64__)
+	return (getauxval(AT_HWCAP) & (1 << 3)) != 0; // HWCAP_AES
+#elif RTC_DTLS_CPU_ARM_LINUX
+	return (getauxval(AT_HWCAP2) & (1 << 0)) != 0; // HWCAP2_AES
+#else
+	return true;
+#endif
+}
+
+} // namespace
+
+bool DtlsTransport::PreferChaCha20() {
+	static const bool prefer = !HasHardwareAes();
+	return prefer;
+}
+
+DtlsTransport::HandshakeTimeline DtlsTransport::handshakeTimeline() const {
+	std::lock_guard lock(mTimelineMutex);
+	return mTimeline;
+}
+
+void DtlsTransport::recordFlight(bool outgoing) {
+	const auto now = SetupTimeline::clock::now();
+	optional<milliseconds> rtt;
+	{
+		std::lock_guard lock(mTimelineMutex);
+		auto &flights = mTimeline.flights;
+		if (!flights.empty() && flights.back().outgoing == outgoing)
+			return;
+
+		// As in Karn's algorithm, ignore round trips for retransmitted flights
+		if (!outgoing && !flights.empty() && !mFlightRetransmitted) {
+			rtt = duration_cast<milliseconds>(now - flights.back().time);
+			mTimeline.rtt = rtt;
+		}
+
+		flights.push_back({now, outgoing});
+		mFlightRetransmitted = false;
+	}
+
+	if (rtt && mAdaptiveRetransmit)
+		adaptRetransmitTimeout(*rtt);
+}
+
+void DtlsTransport::recordRetransmission() {
+	std::lock_guard lock(mTimelineMutex);
+	mFlightRetransmitted = true;
+}
+
+void DtlsTransport::recordHandshakeFinished() {
+	std::lock_guard lock(mTimelineMutex);
+	mTimeline.finished = SetupTimeline::clock::now();
+}
+
+void DtlsTransport::recordKeysDerived() {
+	std::lock_guard lock(mTimelineMutex);
+	mTimeline.keysDerived = SetupTimeline::clock::now();
+}
+
+#if RTC_ENABLE_LATENCY_TRACING
+void DtlsTransport::startEncryptTrace() {
+	auto tracer = latencyTracer();
+	if (tracer && tracer->sample(LatencyTracer::DtlsEncrypt))
+		mEncryptStart = LatencyTracer::clock::now().time_since_epoch().count();
+}
+
+void DtlsTransport::endEncryptTrace() {
+	if (mEncryptStart.load(std::memory_order_relaxed) == 0)
+		return;
+
+	if (auto start = mEncryptStart.exchange(0); start != 0) {
+		const LatencyTracer::clock::time_point time{LatencyTracer::clock::duration(start)};
+		latencyTracer()->record(LatencyTracer::DtlsEncrypt, time);
+	}
+}
+#endif
+
 #if USE_GNUTLS
 
+gnutls_priority_t DtlsTransport::Priorities = NULL;
+std::mutex DtlsTransport::GlobalMutex;
+
 void DtlsTransport::Init() {
+	std::lock_guard lock(GlobalMutex);
+
 	gnutls_global_init(); // optional
+
+	// Parse the priorities once instead of for each session
+	if (!Priorities) {
+		// RFC 8261: SCTP performs segmentation and reassembly based on the path MTU.
+		// Therefore, the DTLS layer MUST NOT use any compression algorithm.
+		// See https://tools.ietf.org/html/rfc8261#section-5
+		string priorities = "SECURE128:-VERS-SSL3.0:-ARCFOUR-128:-COMP-ALL:+COMP-NULL";
+
+		// Move ChaCha20-Poly1305 in front of AES and honor our order as server without AES
+		// instructions, the remote side is usually not the one limited by record encryption
+		if (PreferChaCha20()) {
+			PLOG_INFO << "No AES instructions detected, preferring ChaCha20-Poly1305 for DTLS";
+			priorities += ":-CIPHER-ALL:+CHACHA20-POLY1305:+AES-128-GCM:+AES-256-GCM"
+			              ":+AES-128-CCM:+AES-256-CCM:+AES-128-CBC:+AES-256-CBC:%SERVER_PRECEDENCE";
+		}
+
+		const char *err_pos = NULL;
+		gnutls::check(gnutls_priority_init(&Priorities, priorities.c_str(), &err_pos),
+		              "Failed to initialize TLS priorities");
+	}
 }
 
-void DtlsTransport::Cleanup() { gnutls_global_deinit(); }
+void DtlsTransport::Cleanup() {
+	std::lock_guard lock(GlobalMutex);
+
+	if (Priorities) {
+		gnutls_priority_deinit(Priorities);
+		Priorities = NULL;
+	}
+
+	gnutls_global_deinit();
+}
 
 DtlsTransport::DtlsTransport(shared_ptr<IceTransport> lower, certificate_ptr certificate,
-                             optional<size_t> mtu, verifier_callback verifierCallback,
+                             const Configuration &config, verifier_callback verifierCallback,
                              state_callback stateChangeCallback)
-    : Transport(lower, std::move(stateChangeCallback)), mMtu(mtu), mCertificate(certificate),
+    : Transport(lower, std::move(stateChangeCallback)), mMtu(config.mtu),
+      mMaxRetransmitTimeout(config.dtlsMaxRetransmitTimeout.value_or(60s)),
+      mHandshakeTimeout(config.dtlsHandshakeTimeout.value_or(30s)),
+      mAdaptiveRetransmit(config.dtlsAdaptiveRetransmit), mCertificate(certificate),
       mVerifierCallback(std::move(verifierCallback)),
-      mIsClient(lower->role() == Description::Role::Active), mCurrentDscp(0) {
+      mIsClient(lower->role() == Description::Role::Active),
+      // RFC 6347 recommends an initial retransmission timeout of 1s
+      // See https://www.rfc-editor.org/rfc/rfc6347#section-4.2.4.1
+      mRetransmitTimeout(config.dtlsRetransmitTimeout.value_or(1s)), mCurrentDscp(0) {
 
 	PLOG_DEBUG << "Initializing DTLS transport (GnuTLS)";
 
@@ -60,17 +207,12 @@ DtlsTransport::DtlsTransport(shared_ptr<IceTransport> lower, certificate_ptr cer
 	gnutls_certificate_credentials_t creds = mCertificate->credentials();
 	gnutls_certificate_set_verify_function(creds, CertificateCallback);
 
-	unsigned int flags = GNUTLS_DATAGRAM | (mIsClient ? GNUTLS_CLIENT : GNUTLS_SERVER);
+	unsigned int flags =
+	    GNUTLS_DATAGRAM | GNUTLS_NONBLOCK | (mIsClient ? GNUTLS_CLIENT : GNUTLS_SERVER);
 	gnutls::check(gnutls_init(&mSession, flags));
 
 	try {
-		// RFC 8261: SCTP performs segmentation and reassembly based on the path MTU.
-		// Therefore, the DTLS layer MUST NOT use any compression algorithm.
-		// See https://tools.ietf.org/html/rfc8261#section-5
-		const char *priorities = "SECURE128:-VERS-SSL3.0:-ARCFOUR-128:-COMP-ALL:+COMP-NULL";
-		const char *err_pos = NULL;
-		gnutls::check(gnutls_priority_set_direct(mSession, priorities, &err_pos),
-		              "Failed to set TLS priorities");
+		gnutls::check(gnutls_priority_set(mSession, Priorities), "Failed to set TLS priorities");
 
 		// RFC 8827: The DTLS-SRTP protection profile SRTP_AES128_CM_HMAC_SHA1_80 MUST be supported
 		// See https://tools.ietf.org/html/rfc8827#section-6.5
@@ -79,10 +221,10 @@ DtlsTransport::DtlsTransport(shared_ptr<IceTransport> lower, certificate_ptr cer
 
 		gnutls::check(gnutls_credentials_set(mSession, GNUTLS_CRD_CERTIFICATE, creds));
 
-		gnutls_dtls_set_timeouts(mSession,
-		                         1000,   // 1s retransmission timeout recommended by RFC 6347
-		                         30000); // 30s total timeout
-		gnutls_handshake_set_timeout(mSession, 30000);
+		gnutls_dtls_set_timeouts(mSession, static_cast<unsigned int>(mRetransmitTimeout.count()),
+		                         static_cast<unsigned int>(mHandshakeTimeout.count()));
+		gnutls_handshake_set_timeout(mSession,
+		                             static_cast<unsigned int>(mHandshakeTimeout.count()));
 
 		gnutls_session_set_ptr(mSession, this);
 		gnutls_transport_set_ptr(mSession, this);
@@ -104,20 +246,38 @@ DtlsTransport::~DtlsTransport() {
 
 void DtlsTransport::start() {
 	Transport::start();
+	changeState(State::Connecting);
+
+	try {
+		std::unique_lock lock(mMutex);
+
+		size_t mtu = mMtu.value_or(DEFAULT_MTU) - 8 - 40; // UDP/IPv6
+		gnutls_dtls_set_mtu(mSession, static_cast<unsigned int>(mtu));
+		PLOG_VERBOSE << "SSL MTU set to " << mtu;
 
-	registerIncoming();
+		registerIncoming();
 
-	PLOG_DEBUG << "Starting DTLS recv thread";
-	mRecvThread = std::thread(&DtlsTransport::runRecvLoop, this);
+		// Initiate the handshake
+		handshake();
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "DTLS handshake: " << e.what();
+		finish();
+	}
 }
 
 bool DtlsTransport::stop() {
 	if (!Transport::stop())
 		return false;
 
-	PLOG_DEBUG << "Stopping DTLS recv thread";
-	mIncomingQueue.stop();
-	mRecvThread.join();
+	PLOG_DEBUG << "Stopping DTLS transport";
+	finish();
+
+	std::lock_guard lock(mMutex);
+	if (mHandshakeDone) {
+		std::lock_guard sendLock(mSendMutex);
+		gnutls_bye(mSession, GNUTLS_SHUT_WR);
+	}
 	return true;
 }
 
@@ -131,7 +291,13 @@ bool DtlsTransport::send(message_ptr message) {
 	do {
 		std::lock_guard lock(mSendMutex);
 		mCurrentDscp = message->dscp;
+#if RTC_ENABLE_LATENCY_TRACING
+		startEncryptTrace();
+#endif
 		ret = gnutls_record_send(mSession, message->data(), message->size());
+#if RTC_ENABLE_LATENCY_TRACING
+		mEncryptStart = 0;
+#endif
 	} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
 
 	if (ret == GNUTLS_E_LARGE_PACKET)
@@ -142,18 +308,74 @@ bool DtlsTransport::send(message_ptr message) {
 
 void DtlsTransport::incoming(message_ptr message) {
 	if (!message) {
-		mIncomingQueue.stop();
+		finish();
 		return;
 	}
 
 	PLOG_VERBOSE << "Incoming size=" << message->size();
-	mIncomingQueue.push(message);
+
+	try {
+		std::unique_lock lock(mMutex);
+		if (mClosed)
+			return;
+
+		mIncomingMessage = std::move(message);
+
+		if (!mHandshakeDone) {
+			recordFlight(false);
+			if (!handshake())
+				return;
+
+			lock.unlock();
+			PLOG_INFO << "DTLS handshake finished";
+			changeState(State::Connected);
+			lock.lock();
+		}
+
+#if RTC_ENABLE_LATENCY_TRACING
+		optional<LatencyTracer::clock::time_point> decryptStart;
+		if (auto tracer = latencyTracer(); tracer && tracer->sample(LatencyTracer::DtlsDecrypt))
+			decryptStart = LatencyTracer::clock::now();
+#endif
+
+		// The lock must not be held while passing records up, as the upper layer may send
+		while (!mClosed) {
+			auto record = readRecord();
+			if (!record)
+				break;
+
+#if RTC_ENABLE_LATENCY_TRACING
+			if (decryptStart) {
+				latencyTracer()->record(LatencyTracer::DtlsDecrypt, *decryptStart);
+				decryptStart.reset();
+			}
+#endif
+			lock.unlock();
+			if (!*record) {
+				finish();
+				return;
+			}
+			recv(std::move(*record));
+			lock.lock();
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "DTLS recv: " << e.what();
+		finish();
+	}
 }
 
 bool DtlsTransport::outgoing(message_ptr message) {
 	if (message->dscp == 0)
 		message->dscp = mCurrentDscp;
 
+	if (state() != State::Connected)
+		recordFlight(true);
+#if RTC_ENABLE_LATENCY_TRACING
+	else
+		endEncryptTrace();
+#endif
+
 	return Transport::outgoing(std::move(message));
 }
 
@@ -161,88 +383,102 @@ void DtlsTransport::postHandshake() {
 	// Dummy
 }
 
-void DtlsTransport::runRecvLoop() {
-	const size_t bufferSize = 4096;
-
-	// Handshake loop
-	try {
-		changeState(State::Connecting);
+bool DtlsTransport::handshake() {
+	int ret;
+	do {
+		ret = gnutls_handshake(mSession);
 
-		size_t mtu = mMtu.value_or(DEFAULT_MTU) - 8 - 40; // UDP/IPv6
-		gnutls_dtls_set_mtu(mSession, static_cast<unsigned int>(mtu));
-		PLOG_VERBOSE << "SSL MTU set to " << mtu;
+		if (ret == GNUTLS_E_AGAIN) {
+			// Wait for the next datagram or the retransmission timeout
+			scheduleTimeout(milliseconds(gnutls_dtls_get_timeout(mSession)));
+			return false;
+		}
 
-		int ret;
-		do {
-			ret = gnutls_handshake(mSession);
+		if (ret == GNUTLS_E_LARGE_PACKET)
+			throw std::runtime_error("MTU is too low");
 
-			if (ret == GNUTLS_E_LARGE_PACKET)
-				throw std::runtime_error("MTU is too low");
+	} while (ret == GNUTLS_E_INTERRUPTED || !gnutls::check(ret, "DTLS handshake failed"));
 
-		} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN ||
-		         !gnutls::check(ret, "DTLS handshake failed"));
+	mTimer.cancel();
 
-		// RFC 8261: DTLS MUST support sending messages larger than the current path MTU
-		// See https://tools.ietf.org/html/rfc8261#section-5
-		gnutls_dtls_set_mtu(mSession, bufferSize + 1);
+	// RFC 8261: DTLS MUST support sending messages larger than the current path MTU
+	// See https://tools.ietf.org/html/rfc8261#section-5
+	gnutls_dtls_set_mtu(mSession, BufferSize + 1);
 
-	} catch (const std::exception &e) {
-		PLOG_ERROR << "DTLS handshake: " << e.what();
-		changeState(State::Failed);
-		return;
-	}
+	recordHandshakeFinished();
+	postHandshake();
+	mHandshakeDone = true;
+	return true;
+}
 
-	// Receive loop
-	try {
-		PLOG_INFO << "DTLS handshake finished";
-		postHandshake();
-		changeState(State::Connected);
+optional<message_ptr> DtlsTransport::readRecord() {
+	char buffer[BufferSize];
+	while (true) {
+		ssize_t ret = gnutls_record_recv(mSession, buffer, BufferSize);
+		if (ret == GNUTLS_E_AGAIN)
+			return nullopt;
 
-		char buffer[bufferSize];
+		if (ret == GNUTLS_E_INTERRUPTED)
+			continue;
 
-		while (true) {
-			ssize_t ret;
+		// RFC 8827: Implementations MUST NOT implement DTLS renegotiation and MUST reject it
+		// with a "no_renegotiation" alert if offered.
+		// See https://tools.ietf.org/html/rfc8827#section-6.5
+		if (ret == GNUTLS_E_REHANDSHAKE) {
 			do {
-				ret = gnutls_record_recv(mSession, buffer, bufferSize);
+				std::lock_guard lock(mSendMutex);
+				ret = gnutls_alert_send(mSession, GNUTLS_AL_WARNING, GNUTLS_A_NO_RENEGOTIATION);
 			} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
+			continue;
+		}
 
-			// RFC 8827: Implementations MUST NOT implement DTLS renegotiation and MUST reject it
-			// with a "no_renegotiation" alert if offered.
-			// See https://tools.ietf.org/html/rfc8827#section-6.5
-			if (ret == GNUTLS_E_REHANDSHAKE) {
-				do {
-					std::lock_guard lock(mSendMutex);
-					ret = gnutls_alert_send(mSession, GNUTLS_AL_WARNING, GNUTLS_A_NO_RENEGOTIATION);
-				} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
-				continue;
-			}
-
-			// Consider premature termination as remote closing
-			if (ret == GNUTLS_E_PREMATURE_TERMINATION) {
-				PLOG_DEBUG << "DTLS connection terminated";
-				break;
-			}
+		// Consider premature termination as remote closing
+		if (ret == GNUTLS_E_PREMATURE_TERMINATION) {
+			PLOG_DEBUG << "DTLS connection terminated";
+			return nullptr;
+		}
 
-			if (gnutls::check(ret)) {
-				if (ret == 0) {
-					// Closed
-					PLOG_DEBUG << "DTLS connection cleanly closed";
-					break;
-				}
-				auto *b = reinterpret_cast<byte *>(buffer);
-				recv(make_message(b, b + ret));
+		if (gnutls::check(ret)) {
+			if (ret == 0) {
+				// Closed
+				PLOG_DEBUG << "DTLS connection cleanly closed";
+				return nullptr;
 			}
+			auto *b = reinterpret_cast<byte *>(buffer);
+			return make_message(b, b + ret);
 		}
+	}
+}
+
+void DtlsTransport::handleTimeout() {
+	try {
+		std::unique_lock lock(mMutex);
+		if (mClosed || mHandshakeDone)
+			return;
+
+		// GnuTLS retransmits by itself when the handshake is resumed after the timeout
+		recordRetransmission();
+		if (!handshake())
+			return;
+
+		lock.unlock();
+		PLOG_INFO << "DTLS handshake finished";
+		changeState(State::Connected);
 
 	} catch (const std::exception &e) {
-		PLOG_ERROR << "DTLS recv: " << e.what();
+		PLOG_ERROR << "DTLS handshake: " << e.what();
+		finish();
 	}
+}
 
-	gnutls_bye(mSession, GNUTLS_SHUT_RDWR);
+void DtlsTransport::adaptRetransmitTimeout(milliseconds rtt) {
+	mRetransmitTimeout = std::clamp(rtt * 2, MinRetransmitTimeout, mMaxRetransmitTimeout);
+	PLOG_DEBUG << "DTLS round-trip time is " << rtt.count()
+	           << "ms, setting retransmission timeout to " << mRetransmitTimeout.count() << "ms";
 
-	PLOG_INFO << "DTLS closed";
-	changeState(State::Disconnected);
-	recv(nullptr);
+	// The new timeout applies to the next flights
+	gnutls_dtls_set_timeouts(mSession, static_cast<unsigned int>(mRetransmitTimeout.count()),
+	                         static_cast<unsigned int>(mHandshakeTimeout.count()));
 }
 
 int DtlsTransport::CertificateCallback(gnutls_session_t session) {
@@ -298,17 +534,16 @@ ssize_t DtlsTransport::WriteCallback(gnutls_transport_ptr_t ptr, const void *dat
 ssize_t DtlsTransport::ReadCallback(gnutls_transport_ptr_t ptr, void *data, size_t maxlen) {
 	DtlsTransport *t = static_cast<DtlsTransport *>(ptr);
 	try {
-		if (auto next = t->mIncomingQueue.pop()) {
-			message_ptr message = std::move(*next);
+		// The session is non-blocking, the pending datagram is consumed at most once
+		if (auto message = std::exchange(t->mIncomingMessage, nullptr)) {
 			ssize_t len = std::min(maxlen, message->size());
 			std::memcpy(data, message->data(), len);
 			gnutls_transport_set_errno(t->mSession, 0);
 			return len;
 		}
 
-		// Closed
-		gnutls_transport_set_errno(t->mSession, 0);
-		return 0;
+		gnutls_transport_set_errno(t->mSession, EAGAIN);
+		return -1;
 
 	} catch (const std::exception &e) {
 		PLOG_WARNING << e.what();
@@ -317,17 +552,10 @@ ssize_t DtlsTransport::ReadCallback(gnutls_transport_ptr_t ptr, void *data, size
 	}
 }
 
-int DtlsTransport::TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int ms) {
+int DtlsTransport::TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int /*ms*/) {
 	DtlsTransport *t = static_cast<DtlsTransport *>(ptr);
-	try {
-		bool isReadable = t->mIncomingQueue.wait(
-		    ms != GNUTLS_INDEFINITE_TIMEOUT ? std::make_optional(milliseconds(ms)) : nullopt);
-		return isReadable ? 1 : 0;
-
-	} catch (const std::exception &e) {
-		PLOG_WARNING << e.what();
-		return 1;
-	}
+	// Never block, retransmissions are scheduled with gnutls_dtls_get_timeout()
+	return t->mIncomingMessage ? 1 : 0;
 }
 
 #else // USE_GNUTLS==0
@@ -342,12 +570,13 @@ void DtlsTransport::Init() {
 	openssl::init();
 
 	if (!BioMethods) {
-		BioMethods = BIO_meth_new(BIO_TYPE_BIO, "DTLS writer");
+		BioMethods = BIO_meth_new(BIO_TYPE_BIO, "DTLS datagram");
 		if (!BioMethods)
-			throw std::runtime_error("Failed to create BIO methods for DTLS writer");
+			throw std::runtime_error("Failed to create BIO methods for DTLS");
 		BIO_meth_set_create(BioMethods, BioMethodNew);
 		BIO_meth_set_destroy(BioMethods, BioMethodFree);
 		BIO_meth_set_write(BioMethods, BioMethodWrite);
+		BIO_meth_set_read(BioMethods, BioMethodRead);
 		BIO_meth_set_ctrl(BioMethods, BioMethodCtrl);
 	}
 	if (TransportExIndex < 0) {
@@ -360,67 +589,53 @@ void DtlsTransport::Cleanup() {
 }
 
 DtlsTransport::DtlsTransport(shared_ptr<IceTransport> lower, certificate_ptr certificate,
-                             optional<size_t> mtu, verifier_callback verifierCallback,
+                             const Configuration &config, verifier_callback verifierCallback,
                              state_callback stateChangeCallback)
-    : Transport(lower, std::move(stateChangeCallback)), mMtu(mtu), mCertificate(certificate),
+    : Transport(lower, std::move(stateChangeCallback)), mMtu(config.mtu),
+      mMaxRetransmitTimeout(config.dtlsMaxRetransmitTimeout.value_or(60s)),
+      mHandshakeTimeout(config.dtlsHandshakeTimeout.value_or(30s)),
+      mAdaptiveRetransmit(config.dtlsAdaptiveRetransmit), mCertificate(certificate),
       mVerifierCallback(std::move(verifierCallback)),
-      mIsClient(lower->role() == Description::Role::Active), mCurrentDscp(0) {
+      mIsClient(lower->role() == Description::Role::Active),
+      // RFC 6347 recommends an initial retransmission timeout of 1s
+      // See https://www.rfc-editor.org/rfc/rfc6347#section-4.2.4.1
+      mRetransmitTimeout(config.dtlsRetransmitTimeout.value_or(1s)), mCurrentDscp(0) {
 	PLOG_DEBUG << "Initializing DTLS transport (OpenSSL)";
 
 	if (!mCertificate)
 		throw std::invalid_argument("DTLS certificate is null");
 
 	try {
-		mCtx = SSL_CTX_new(DTLS_method());
-		if (!mCtx)
-			throw std::runtime_error("Failed to create SSL context");
-
-		// RFC 8261: SCTP performs segmentation and reassembly based on the path MTU.
-		// Therefore, the DTLS layer MUST NOT use any compression algorithm.
-		// See https://tools.ietf.org/html/rfc8261#section-5
-		// RFC 8827: Implementations MUST NOT implement DTLS renegotiation
-		// See https://tools.ietf.org/html/rfc8827#section-6.5
-		SSL_CTX_set_options(mCtx, SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_NO_QUERY_MTU |
-		                              SSL_OP_NO_RENEGOTIATION);
+		// Setting up the context is costly, mostly because of the private key check
+		mCtx = mCertificate->dtlsContext([this]() { return CreateContext(*mCertificate); });
 
-		SSL_CTX_set_min_proto_version(mCtx, DTLS1_VERSION);
-		SSL_CTX_set_read_ahead(mCtx, 1);
-		SSL_CTX_set_quiet_shutdown(mCtx, 1);
-		SSL_CTX_set_info_callback(mCtx, InfoCallback);
-
-		SSL_CTX_set_verify(mCtx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
-		                   CertificateCallback);
-		SSL_CTX_set_verify_depth(mCtx, 1);
-
-		openssl::check(SSL_CTX_set_cipher_list(mCtx, "ALL:!LOW:!EXP:!RC4:!MD5:@STRENGTH"),
-		               "Failed to set SSL priorities");
-
-		auto [x509, pkey] = mCertificate->credentials();
-		SSL_CTX_use_certificate(mCtx, x509);
-		SSL_CTX_use_PrivateKey(mCtx, pkey);
-
-		openssl::check(SSL_CTX_check_private_key(mCtx), "SSL local private key check failed");
-
-		mSsl = SSL_new(mCtx);
+		mSsl = SSL_new(mCtx.get());
 		if (!mSsl)
 			throw std::runtime_error("Failed to create SSL instance");
 
 		SSL_set_ex_data(mSsl, TransportExIndex, this);
+		DTLS_set_timer_cb(mSsl, TimerCallback);
 
 		if (mIsClient)
 			SSL_set_connect_state(mSsl);
 		else
 			SSL_set_accept_state(mSsl);
 
-		mInBio = BIO_new(BIO_s_mem());
+		// Incoming datagrams are read directly from the received message instead of being copied
+		// into a memory BIO first
+		mInBio = BIO_new(BioMethods);
 		mOutBio = BIO_new(BioMethods);
 		if (!mInBio || !mOutBio)
 			throw std::runtime_error("Failed to create BIO");
 
-		BIO_set_mem_eof_return(mInBio, BIO_EOF);
+		BIO_set_data(mInBio, this);
 		BIO_set_data(mOutBio, this);
 		SSL_set_bio(mSsl, mInBio, mOutBio);
 
+		// Idle connections don't need to keep record buffers around
+		if (config.compactMemory)
+			SSL_set_mode(mSsl, SSL_MODE_RELEASE_BUFFERS);
+
 		auto ecdh = unique_ptr<EC_KEY, decltype(&EC_KEY_free)>(
 		    EC_KEY_new_by_curve_name(NID_X9_62_prime256v1), EC_KEY_free);
 		SSL_set_options(mSsl, SSL_OP_SINGLE_ECDH_USE);
@@ -436,8 +651,6 @@ DtlsTransport::DtlsTransport(shared_ptr<IceTransport> lower, certificate_ptr cer
 	} catch (...) {
 		if (mSsl)
 			SSL_free(mSsl);
-		if (mCtx)
-			SSL_CTX_free(mCtx);
 		throw;
 	}
 }
@@ -446,25 +659,88 @@ DtlsTransport::~DtlsTransport() {
 	stop();
 
 	SSL_free(mSsl);
-	SSL_CTX_free(mCtx);
+}
+
+shared_ptr<SSL_CTX> DtlsTransport::CreateContext(const Certificate &certificate) {
+	PLOG_VERBOSE << "Creating DTLS context";
+
+	auto ctx = shared_ptr<SSL_CTX>(SSL_CTX_new(DTLS_method()), SSL_CTX_free);
+	if (!ctx)
+		throw std::runtime_error("Failed to create SSL context");
+
+	// RFC 8261: SCTP performs segmentation and reassembly based on the path MTU.
+	// Therefore, the DTLS layer MUST NOT use any compression algorithm.
+	// See https://tools.ietf.org/html/rfc8261#section-5
+	// RFC 8827: Implementations MUST NOT implement DTLS renegotiation
+	// See https://tools.ietf.org/html/rfc8827#section-6.5
+	// Session resumption is useless since the certificate must always be verified against the
+	// fingerprint, so don't spend time issuing tickets or caching sessions
+	SSL_CTX_set_options(ctx.get(), SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_NO_QUERY_MTU |
+	                                   SSL_OP_NO_RENEGOTIATION | SSL_OP_NO_TICKET);
+	SSL_CTX_set_session_cache_mode(ctx.get(), SSL_SESS_CACHE_OFF);
+
+	SSL_CTX_set_min_proto_version(ctx.get(), DTLS1_VERSION);
+	SSL_CTX_set_read_ahead(ctx.get(), 1);
+	SSL_CTX_set_quiet_shutdown(ctx.get(), 1);
+	SSL_CTX_set_info_callback(ctx.get(), InfoCallback);
+
+	SSL_CTX_set_verify(ctx.get(), SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
+	                   CertificateCallback);
+	SSL_CTX_set_verify_depth(ctx.get(), 1);
+
+	// @STRENGTH sorts stably, so the ChaCha20 suites stay in front of the other 256-bit suites
+	// when listed first. Without AES instructions, honor our order as server too since the remote
+	// side is usually not the one limited by record encryption.
+	string ciphers = "ALL:!LOW:!EXP:!RC4:!MD5:@STRENGTH";
+	if (PreferChaCha20()) {
+		PLOG_INFO << "No AES instructions detected, preferring ChaCha20-Poly1305 for DTLS";
+		ciphers = "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:" + ciphers;
+		SSL_CTX_set_options(ctx.get(), SSL_OP_CIPHER_SERVER_PREFERENCE);
+	}
+	openssl::check(SSL_CTX_set_cipher_list(ctx.get(), ciphers.c_str()),
+	               "Failed to set SSL priorities");
+
+	auto [x509, pkey] = certificate.credentials();
+	SSL_CTX_use_certificate(ctx.get(), x509);
+	SSL_CTX_use_PrivateKey(ctx.get(), pkey);
+
+	openssl::check(SSL_CTX_check_private_key(ctx.get()), "SSL local private key check failed");
+
+	return ctx;
 }
 
 void DtlsTransport::start() {
 	Transport::start();
+	changeState(State::Connecting);
+
+	try {
+		std::unique_lock lock(mMutex);
+
+		size_t mtu = mMtu.value_or(DEFAULT_MTU) - 8 - 40; // UDP/IPv6
+		SSL_set_mtu(mSsl, static_cast<unsigned int>(mtu));
+		PLOG_VERBOSE << "SSL MTU set to " << mtu;
+
+		mHandshakeStart = SetupTimeline::clock::now();
+
+		registerIncoming();
 
-	registerIncoming();
+		// Initiate the handshake
+		handshake();
 
-	PLOG_DEBUG << "Starting DTLS recv thread";
-	mRecvThread = std::thread(&DtlsTransport::runRecvLoop, this);
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "DTLS handshake: " << e.what();
+		finish();
+	}
 }
 
 bool DtlsTransport::stop() {
 	if (!Transport::stop())
 		return false;
 
-	PLOG_DEBUG << "Stopping DTLS recv thread";
-	mIncomingQueue.stop();
-	mRecvThread.join();
+	PLOG_DEBUG << "Stopping DTLS transport";
+	finish();
+
+	std::lock_guard lock(mMutex);
 	SSL_shutdown(mSsl);
 	return true;
 }
@@ -475,19 +751,75 @@ bool DtlsTransport::send(message_ptr message) {
 
 	PLOG_VERBOSE << "Send size=" << message->size();
 
+	std::lock_guard lock(mMutex);
 	mCurrentDscp = message->dscp;
+#if RTC_ENABLE_LATENCY_TRACING
+	startEncryptTrace();
+#endif
 	int ret = SSL_write(mSsl, message->data(), int(message->size()));
+#if RTC_ENABLE_LATENCY_TRACING
+	mEncryptStart = 0;
+#endif
 	return openssl::check(mSsl, ret);
 }
 
 void DtlsTransport::incoming(message_ptr message) {
 	if (!message) {
-		mIncomingQueue.stop();
+		finish();
 		return;
 	}
 
 	PLOG_VERBOSE << "Incoming size=" << message->size();
-	mIncomingQueue.push(message);
+
+	try {
+		std::unique_lock lock(mMutex);
+		if (mClosed)
+			return;
+
+		mIncomingMessage = std::move(message);
+
+		if (!mHandshakeDone) {
+			recordFlight(false);
+			if (!handshake())
+				return;
+
+			lock.unlock();
+			PLOG_INFO << "DTLS handshake finished";
+			changeState(State::Connected);
+			lock.lock();
+		}
+
+#if RTC_ENABLE_LATENCY_TRACING
+		optional<LatencyTracer::clock::time_point> decryptStart;
+		if (auto tracer = latencyTracer(); tracer && tracer->sample(LatencyTracer::DtlsDecrypt))
+			decryptStart = LatencyTracer::clock::now();
+#endif
+
+		// The lock must not be held while passing records up, as the upper layer may send
+		while (!mClosed) {
+			auto record = readRecord();
+			if (!record)
+				break;
+
+#if RTC_ENABLE_LATENCY_TRACING
+			if (decryptStart) {
+				latencyTracer()->record(LatencyTracer::DtlsDecrypt, *decryptStart);
+				decryptStart.reset();
+			}
+#endif
+			lock.unlock();
+			if (!*record) {
+				finish();
+				return;
+			}
+			recv(std::move(*record));
+			lock.lock();
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "DTLS recv: " << e.what();
+		finish();
+	}
 }
 
 bool DtlsTransport::outgoing(message_ptr message) {
@@ -501,6 +833,14 @@ bool DtlsTransport::outgoing(message_ptr message) {
 			message->dscp = mCurrentDscp;
 		}
 	}
+
+	if (state() != State::Connected)
+		recordFlight(true);
+#if RTC_ENABLE_LATENCY_TRACING
+	else
+		endEncryptTrace();
+#endif
+
 	return Transport::outgoing(std::move(message));
 }
 
@@ -508,91 +848,85 @@ void DtlsTransport::postHandshake() {
 	// Dummy
 }
 
-void DtlsTransport::runRecvLoop() {
-	const size_t bufferSize = 4096;
-	try {
-		changeState(State::Connecting);
+bool DtlsTransport::handshake() {
+	int ret = SSL_do_handshake(mSsl);
+	if (!openssl::check(mSsl, ret, "Handshake failed") || mAlertReceived)
+		throw std::runtime_error("Connection closed during handshake");
+
+	if (!SSL_is_init_finished(mSsl)) {
+		// Wait for the next datagram or the retransmission timeout
+		struct timeval timeout = {};
+		if (DTLSv1_get_timeout(mSsl, &timeout)) {
+			auto duration = milliseconds(timeout.tv_sec * 1000 + timeout.tv_usec / 1000);
+			// Also handle handshake timeout manually because OpenSSL actually doesn't...
+			auto elapsed =
+			    duration_cast<milliseconds>(SetupTimeline::clock::now() - mHandshakeStart);
+			if (elapsed >= mHandshakeTimeout)
+				throw std::runtime_error("Handshake timeout");
+
+			LOG_VERBOSE << "OpenSSL DTLS retransmit timeout is " << duration.count() << "ms";
+			scheduleTimeout(std::min(duration, mHandshakeTimeout - elapsed));
+		}
+		return false;
+	}
 
-		size_t mtu = mMtu.value_or(DEFAULT_MTU) - 8 - 40; // UDP/IPv6
-		SSL_set_mtu(mSsl, static_cast<unsigned int>(mtu));
-		PLOG_VERBOSE << "SSL MTU set to " << mtu;
+	mTimer.cancel();
 
-		// Initiate the handshake
-		int ret = SSL_do_handshake(mSsl);
-		openssl::check(mSsl, ret, "Handshake failed");
-
-		byte buffer[bufferSize];
-		while (mIncomingQueue.running()) {
-			// Process pending messages
-			while (auto next = mIncomingQueue.tryPop()) {
-				message_ptr message = std::move(*next);
-				BIO_write(mInBio, message->data(), int(message->size()));
-
-				if (state() == State::Connecting) {
-					// Continue the handshake
-					ret = SSL_do_handshake(mSsl);
-					if (!openssl::check(mSsl, ret, "Handshake failed"))
-						break;
-
-					if (SSL_is_init_finished(mSsl)) {
-						// RFC 8261: DTLS MUST support sending messages larger than the current path
-						// MTU See https://tools.ietf.org/html/rfc8261#section-5
-						SSL_set_mtu(mSsl, bufferSize + 1);
-
-						PLOG_INFO << "DTLS handshake finished";
-						postHandshake();
-						changeState(State::Connected);
-					}
-				} else {
-					ret = SSL_read(mSsl, buffer, bufferSize);
-					if (!openssl::check(mSsl, ret))
-						break;
-
-					if (ret > 0)
-						recv(make_message(buffer, buffer + ret));
-				}
-			}
+	// RFC 8261: DTLS MUST support sending messages larger than the current path MTU
+	// See https://tools.ietf.org/html/rfc8261#section-5
+	SSL_set_mtu(mSsl, BufferSize + 1);
 
-			// No more messages pending, retransmit and rearm timeout if connecting
-			optional<milliseconds> duration;
-			if (state() == State::Connecting) {
-				// Warning: This function breaks the usual return value convention
-				ret = DTLSv1_handle_timeout(mSsl);
-				if (ret < 0) {
-					throw std::runtime_error("Handshake timeout"); // write BIO can't fail
-				} else if (ret > 0) {
-					LOG_VERBOSE << "OpenSSL did DTLS retransmit";
-				}
-
-				struct timeval timeout = {};
-				if (state() == State::Connecting && DTLSv1_get_timeout(mSsl, &timeout)) {
-					duration = milliseconds(timeout.tv_sec * 1000 + timeout.tv_usec / 1000);
-					// Also handle handshake timeout manually because OpenSSL actually doesn't...
-					// OpenSSL backs off exponentially in base 2 starting from the recommended 1s
-					// so this allows for 5 retransmissions and fails after roughly 30s.
-					if (duration > 30s) {
-						throw std::runtime_error("Handshake timeout");
-					} else {
-						LOG_VERBOSE << "OpenSSL DTLS retransmit timeout is " << duration->count()
-						            << "ms";
-					}
-				}
-			}
+	recordHandshakeFinished();
+	postHandshake();
+	mHandshakeDone = true;
+	return true;
+}
+
+optional<message_ptr> DtlsTransport::readRecord() {
+	byte buffer[BufferSize];
+	int ret = SSL_read(mSsl, buffer, BufferSize);
+	if (!openssl::check(mSsl, ret) || mAlertReceived)
+		return nullptr; // closed
+
+	if (ret <= 0)
+		return nullopt;
+
+	return make_message(buffer, buffer + ret);
+}
 
-			mIncomingQueue.wait(duration);
+void DtlsTransport::handleTimeout() {
+	try {
+		std::unique_lock lock(mMutex);
+		if (mClosed || mHandshakeDone)
+			return;
+
+		// Warning: This function breaks the usual return value convention
+		int ret = DTLSv1_handle_timeout(mSsl);
+		if (ret < 0) {
+			throw std::runtime_error("Handshake timeout"); // write BIO can't fail
+		} else if (ret > 0) {
+			LOG_VERBOSE << "OpenSSL did DTLS retransmit";
+			recordRetransmission();
 		}
+
+		if (!handshake())
+			return;
+
+		lock.unlock();
+		PLOG_INFO << "DTLS handshake finished";
+		changeState(State::Connected);
+
 	} catch (const std::exception &e) {
-		PLOG_ERROR << "DTLS recv: " << e.what();
+		PLOG_ERROR << "DTLS handshake: " << e.what();
+		finish();
 	}
+}
 
-	if (state() == State::Connected) {
-		PLOG_INFO << "DTLS closed";
-		changeState(State::Disconnected);
-		recv(nullptr);
-	} else {
-		PLOG_ERROR << "DTLS handshake failed";
-		changeState(State::Failed);
-	}
+void DtlsTransport::adaptRetransmitTimeout(milliseconds rtt) {
+	// The new timeout is picked up by TimerCallback for the next flights
+	mRetransmitTimeout = std::clamp(rtt * 2, MinRetransmitTimeout, mMaxRetransmitTimeout);
+	PLOG_DEBUG << "DTLS round-trip time is " << rtt.count()
+	           << "ms, setting retransmission timeout to " << mRetransmitTimeout.count() << "ms";
 }
 
 int DtlsTransport::CertificateCallback(int /*preverify_ok*/, X509_STORE_CTX *ctx) {
@@ -615,10 +949,21 @@ void DtlsTransport::InfoCallback(const SSL *ssl, int where, int ret) {
 		if (ret != 256) { // Close Notify
 			PLOG_ERROR << "DTLS alert: " << SSL_alert_desc_string_long(ret);
 		}
-		t->mIncomingQueue.stop(); // Close the connection
+		t->mAlertReceived = true; // Close the connection
 	}
 }
 
+unsigned int DtlsTransport::TimerCallback(SSL *ssl, unsigned int timerUs) {
+	DtlsTransport *t =
+	    static_cast<DtlsTransport *>(SSL_get_ex_data(ssl, DtlsTransport::TransportExIndex));
+
+	// timerUs is zero when a new flight is sent, otherwise back off exponentially in base 2
+	auto duration = timerUs == 0 ? t->mRetransmitTimeout
+	                             : std::min(duration_cast<milliseconds>(microseconds(timerUs) * 2),
+	                                        t->mMaxRetransmitTimeout);
+	return static_cast<unsigned int>(duration_cast<microseconds>(duration).count());
+}
+
 int DtlsTransport::BioMethodNew(BIO *bio) {
 	BIO_set_init(bio, 1);
 	BIO_set_data(bio, NULL);
@@ -644,6 +989,24 @@ int DtlsTransport::BioMethodWrite(BIO *bio, const char *in, int inl) {
 	return inl; // can't fail
 }
 
+int DtlsTransport::BioMethodRead(BIO *bio, char *out, int outl) {
+	BIO_clear_retry_flags(bio);
+	auto transport = reinterpret_cast<DtlsTransport *>(BIO_get_data(bio));
+	if (!transport || outl <= 0)
+		return -1;
+
+	// Like a datagram socket, the pending datagram is consumed at most once
+	auto message = std::exchange(transport->mIncomingMessage, nullptr);
+	if (!message) {
+		BIO_set_retry_read(bio);
+		return -1;
+	}
+
+	int len = std::min(outl, int(message->size()));
+	std::memcpy(out, message->data(), len);
+	return len;
+}
+
 long DtlsTransport::BioMethodCtrl(BIO * /*bio*/, int cmd, long /*num*/, void * /*ptr*/) {
 	switch (cmd) {
 	case BIO_CTRL_FLUSH:
@@ -661,4 +1024,31 @@ long DtlsTransport::BioMethodCtrl(BIO * /*bio*/, int cmd, long /*num*/, void * /
 
 #endif
 
+void DtlsTransport::scheduleTimeout(milliseconds delay) {
+	mTimer.cancel();
+	mTimer = ThreadPool::Instance().scheduleTimer(delay, [weak_this = weak_from_this()]() {
+		if (auto locked = weak_this.lock())
+			locked->handleTimeout();
+	});
+}
+
+void DtlsTransport::finish() {
+	if (mClosed.exchange(true))
+		return;
+
+	{
+		std::lock_guard lock(mMutex);
+		mTimer.cancel();
+	}
+
+	if (state() == State::Connected) {
+		PLOG_INFO << "DTLS closed";
+		changeState(State::Disconnected);
+		recv(nullptr);
+	} else {
+		PLOG_ERROR << "DTLS handshake failed";
+		changeState(State::Failed);
+	}
+}
+
 } // namespace rtc::impl
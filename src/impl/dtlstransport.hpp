@@ -21,29 +21,35 @@
 
 #include "certificate.hpp"
 #include "common.hpp"
-#include "queue.hpp"
+#include "configuration.hpp"
+#include "threadpool.hpp"
 #include "tls.hpp"
 #include "transport.hpp"
 
+#include "rtc/peerconnection.hpp" // for SetupTimeline
+
 #include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <thread>
 
 namespace rtc::impl {
 
 class IceTransport;
 
-class DtlsTransport : public Transport {
+class DtlsTransport : public Transport, public std::enable_shared_from_this<DtlsTransport> {
 public:
 	static void Init();
 	static void Cleanup();
 
+	// True if the CPU lacks AES instructions, ChaCha20-Poly1305 is then preferred for records
+	static bool PreferChaCha20();
+
 	using verifier_callback = std::function<bool(const std::string &fingerprint)>;
 
-	DtlsTransport(shared_ptr<IceTransport> lower, certificate_ptr certificate, optional<size_t> mtu,
-	              verifier_callback verifierCallback, state_callback stateChangeCallback);
+	DtlsTransport(shared_ptr<IceTransport> lower, certificate_ptr certificate,
+	              const Configuration &config, verifier_callback verifierCallback,
+	              state_callback stateChangeCallback);
 	~DtlsTransport();
 
 	virtual void start() override;
@@ -52,44 +58,97 @@ public:
 
 	bool isClient() const { return mIsClient; }
 
+	struct HandshakeTimeline {
+		std::vector<SetupTimeline::Flight> flights;
+		optional<SetupTimeline::clock::time_point> finished;
+		optional<SetupTimeline::clock::time_point> keysDerived; // DTLS-SRTP only
+		optional<std::chrono::milliseconds> rtt;                // last round trip measured
+	};
+
+	HandshakeTimeline handshakeTimeline() const;
+
 protected:
 	virtual void incoming(message_ptr message) override;
 	virtual bool outgoing(message_ptr message) override;
 	virtual void postHandshake();
-	void runRecvLoop();
+
+	// Records are decrypted inline in incoming(), there is no receive thread. Handshake
+	// retransmissions are driven by a timer on the thread pool.
+	bool handshake();                   // true if finished, mMutex must be locked
+	optional<message_ptr> readRecord(); // nullopt if no more records, nullptr if closed
+	void scheduleTimeout(std::chrono::milliseconds delay);
+	void handleTimeout();
+	void finish();
+	void recordFlight(bool outgoing); // starts a new flight if the direction changed
+	void recordRetransmission();
+	void adaptRetransmitTimeout(std::chrono::milliseconds rtt); // mMutex must be locked
+	void recordHandshakeFinished();
+	void recordKeysDerived();
+
+#if RTC_ENABLE_LATENCY_TRACING
+	void startEncryptTrace(); // the send lock must be held
+	void endEncryptTrace();   // on the first outgoing datagram of the record
+#endif
+
+	static const size_t BufferSize = 4096;
+	static constexpr std::chrono::milliseconds MinRetransmitTimeout{100}; // for adaptive mode
 
 	const optional<size_t> mMtu;
+	const std::chrono::milliseconds mMaxRetransmitTimeout;
+	const std::chrono::milliseconds mHandshakeTimeout;
+	const bool mAdaptiveRetransmit;
 	const certificate_ptr mCertificate;
 	const verifier_callback mVerifierCallback;
 	const bool mIsClient;
 
-	Queue<message_ptr> mIncomingQueue;
-	std::thread mRecvThread;
+	std::mutex mMutex; // protects the session on the receive path
+	TimerHandle mTimer;
+	bool mHandshakeDone = false;
+	std::chrono::milliseconds mRetransmitTimeout; // initial timeout for each flight
+	std::atomic<bool> mClosed = false;
 	std::atomic<unsigned int> mCurrentDscp;
+#if RTC_ENABLE_LATENCY_TRACING
+	std::atomic<LatencyTracer::clock::rep> mEncryptStart = 0; // 0 if the record is not timed
+#endif
+
+	HandshakeTimeline mTimeline;
+	bool mFlightRetransmitted = false; // the last flight can't be used to measure the RTT
+	mutable std::mutex mTimelineMutex;
+
+	message_ptr mIncomingMessage; // datagram pending for the read callback, received in place
 
 #if USE_GNUTLS
 	gnutls_session_t mSession;
 	std::mutex mSendMutex;
 
+	static gnutls_priority_t Priorities;
+	static std::mutex GlobalMutex;
+
 	static int CertificateCallback(gnutls_session_t session);
 	static ssize_t WriteCallback(gnutls_transport_ptr_t ptr, const void *data, size_t len);
 	static ssize_t ReadCallback(gnutls_transport_ptr_t ptr, void *data, size_t maxlen);
 	static int TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int ms);
 #else
-	SSL_CTX *mCtx = NULL;
+	shared_ptr<SSL_CTX> mCtx; // shared by transports with the same certificate
 	SSL *mSsl = NULL;
 	BIO *mInBio, *mOutBio;
+	bool mAlertReceived = false; // set by InfoCallback
+	SetupTimeline::clock::time_point mHandshakeStart;
 
 	static BIO_METHOD *BioMethods;
 	static int TransportExIndex;
 	static std::mutex GlobalMutex;
 
+	static shared_ptr<SSL_CTX> CreateContext(const Certificate &certificate);
+
 	static int CertificateCallback(int preverify_ok, X509_STORE_CTX *ctx);
 	static void InfoCallback(const SSL *ssl, int where, int ret);
+	static unsigned int TimerCallback(SSL *ssl, unsigned int timerUs);
 
 	static int BioMethodNew(BIO *bio);
 	static int BioMethodFree(BIO *bio);
 	static int BioMethodWrite(BIO *bio, const char *in, int inl);
+	static int BioMethodRead(BIO *bio, char *out, int outl);
 	static long BioMethodCtrl(BIO *bio, int cmd, long num, void *ptr);
 #endif
 };
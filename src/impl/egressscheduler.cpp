@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "egressscheduler.hpp"
+#include "internals.hpp"
+#include "logcounter.hpp"
+
+#include <algorithm>
+
+namespace rtc::impl {
+
+static LogCounter COUNTER_QUEUE_FULL(plog::warning,
+                                     "Number of outgoing packets dropped by the egress scheduler");
+
+const std::chrono::milliseconds EgressScheduler::Interval(5);
+const std::chrono::milliseconds EgressScheduler::MaxQueueDelay(200);
+
+namespace {
+
+const double Mtu = 1500; // in bytes, quantum for a weight of 1
+
+}
+
+EgressScheduler::EgressScheduler(unsigned int maxBitrate, unsigned int videoWeight,
+                                 unsigned int dataWeight, send_func send)
+    : mRate(double(std::max(maxBitrate, 8000u)) / 8.0),
+      mQuanta{0, Mtu * std::max(videoWeight, 1u), Mtu * std::max(dataWeight, 1u)},
+      mMaxQueueBytes(std::max(size_t(mRate * std::chrono::duration<double>(MaxQueueDelay).count()),
+                              size_t(64 * 1024))),
+      mSend(std::move(send)), mLastUpdate(clock::now()) {}
+
+EgressScheduler::~EgressScheduler() { stop(); }
+
+EgressScheduler::Class EgressScheduler::Classify(unsigned int dscp) {
+	// See https://datatracker.ietf.org/doc/html/rfc8837#section-5
+	if (dscp >= 40) // CS5, VA, EF, CS6, CS7
+		return Class::Audio;
+	else if (dscp >= 24) // CS3, AF3x, CS4, AF4x
+		return Class::Video;
+	else
+		return Class::Data;
+}
+
+bool EgressScheduler::send(message_ptr message) {
+	{
+		std::lock_guard lock(mMutex);
+		if (!enqueue(std::move(message)))
+			return false;
+	}
+
+	// Send immediately what the budget allows, the rest is sent by the timer
+	process();
+	return true;
+}
+
+size_t EgressScheduler::send(const std::vector<message_ptr> &messages) {
+	size_t count = 0;
+	{
+		std::lock_guard lock(mMutex);
+		for (const auto &message : messages)
+			if (message && enqueue(message))
+				++count;
+	}
+
+	process();
+	return count;
+}
+
+void EgressScheduler::stop() {
+	std::lock_guard sendLock(mSendMutex);
+	std::lock_guard lock(mMutex);
+	mStopped = true;
+	mTimer.cancel();
+	for (auto &queue : mQueues) {
+		queue.messages.clear();
+		queue.bytes = 0;
+	}
+}
+
+size_t EgressScheduler::queuedBytes() const {
+	std::lock_guard lock(mMutex);
+	size_t bytes = 0;
+	for (const auto &queue : mQueues)
+		bytes += queue.bytes;
+
+	return bytes;
+}
+
+bool EgressScheduler::enqueue(message_ptr message) {
+	if (mStopped)
+		return false;
+
+	auto &queue = mQueues[size_t(Classify(message->dscp))];
+	if (queue.bytes + message->size() > mMaxQueueBytes) {
+		// Tail drop, like a router would, so senders see it as loss
+		COUNTER_QUEUE_FULL++;
+		return false;
+	}
+
+	queue.bytes += message->size();
+	queue.messages.push_back(std::move(message));
+	return true;
+}
+
+void EgressScheduler::process() {
+	std::lock_guard sendLock(mSendMutex);
+	{
+		std::lock_guard lock(mMutex);
+		if (mStopped)
+			return;
+
+		const auto now = clock::now();
+		const double elapsed = std::chrono::duration<double>(now - mLastUpdate).count();
+		mLastUpdate = now;
+
+		// The budget is capped to one interval, so an idle period does not allow a burst
+		const double interval = std::chrono::duration<double>(Interval).count();
+		mBudget = std::min(mBudget + mRate * elapsed, std::max(mRate * interval, Mtu));
+
+		auto pop = [this](Queue &queue) {
+			auto &message = queue.messages.front();
+			const double size = double(message->size());
+			mBudget -= size;
+			queue.deficit -= size;
+			queue.bytes -= message->size();
+			mMessages.push_back(std::move(message));
+			queue.messages.pop_front();
+		};
+
+		// Audio has strict priority and is never held back
+		auto &audio = mQueues[size_t(Class::Audio)];
+		while (!audio.messages.empty())
+			pop(audio);
+
+		// Deficit round robin between video and data
+		auto &video = mQueues[size_t(Class::Video)];
+		auto &data = mQueues[size_t(Class::Data)];
+		while (mBudget > 0 && (!video.messages.empty() || !data.messages.empty())) {
+			for (auto c : {Class::Video, Class::Data}) {
+				auto &queue = mQueues[size_t(c)];
+				if (queue.messages.empty()) {
+					queue.deficit = 0; // idle classes don't accumulate credit
+					continue;
+				}
+
+				queue.deficit += mQuanta[size_t(c)];
+				while (!queue.messages.empty() && mBudget > 0 &&
+				       double(queue.messages.front()->size()) <= queue.deficit)
+					pop(queue);
+			}
+		}
+
+		if ((!video.messages.empty() || !data.messages.empty()) && !mTimer.pending()) {
+			auto task = [weak_this = weak_from_this()]() {
+				if (auto locked = weak_this.lock())
+					locked->process();
+			};
+			mTimer = ThreadPool::Instance().scheduleTimer(Interval, std::move(task));
+		}
+	}
+
+	if (mMessages.empty())
+		return;
+
+	try {
+		mSend(mMessages);
+	} catch (const std::exception &e) {
+		PLOG_DEBUG << "Scheduled send failed: " << e.what();
+	}
+	mMessages.clear();
+}
+
+} // namespace rtc::impl
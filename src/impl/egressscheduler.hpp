@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_EGRESS_SCHEDULER_H
+#define RTC_IMPL_EGRESS_SCHEDULER_H
+
+#include "common.hpp"
+#include "message.hpp"
+#include "threadpool.hpp"
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace rtc::impl {
+
+// Schedules the outgoing datagrams of a PeerConnection under a total rate cap
+// Datagrams are classified by DSCP: audio (EF and above) has strict priority and is never held
+// back, while video (CS3 to AF43) and the rest (Data Channels, DTLS) share the remaining rate by
+// weight with deficit round robin, so a bulk transfer can't delay audio nor starve video.
+class EgressScheduler final : public std::enable_shared_from_this<EgressScheduler> {
+public:
+	using clock = std::chrono::steady_clock;
+	using send_func = std::function<size_t(const std::vector<message_ptr> &messages)>;
+
+	enum class Class { Audio = 0, Video = 1, Data = 2 };
+
+	EgressScheduler(unsigned int maxBitrate, unsigned int videoWeight, unsigned int dataWeight,
+	                send_func send);
+	~EgressScheduler();
+
+	bool send(message_ptr message);                        // false if dropped
+	size_t send(const std::vector<message_ptr> &messages); // returns the number not dropped
+	void stop(); // waits for a send in progress, send_func is not called afterwards
+
+	size_t queuedBytes() const;
+
+	static Class Classify(unsigned int dscp);
+
+private:
+	struct Queue {
+		std::deque<message_ptr> messages;
+		size_t bytes = 0;
+		double deficit = 0; // in bytes
+	};
+
+	bool enqueue(message_ptr message); // mMutex must be locked
+	void process();
+
+	static const std::chrono::milliseconds Interval;
+	static const std::chrono::milliseconds MaxQueueDelay;
+
+	const double mRate; // in bytes/s
+	const std::array<double, 3> mQuanta; // in bytes, indexed by class
+	const size_t mMaxQueueBytes; // per class
+	const send_func mSend;
+
+	std::array<Queue, 3> mQueues; // indexed by class
+	double mBudget = 0;           // in bytes, negative when audio was sent over the cap
+	clock::time_point mLastUpdate;
+	TimerHandle mTimer;
+	bool mStopped = false;
+
+	mutable std::mutex mMutex;
+	std::mutex mSendMutex;              // keeps datagrams in order between concurrent senders
+	std::vector<message_ptr> mMessages; // protected by mSendMutex
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,397 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "hpack.hpp"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace rtc::impl::hpack {
+
+namespace {
+
+const size_t EntryOverhead = 32;
+const size_t MaxHeaderListSize = 65536; // decoded
+
+// See https://www.rfc-editor.org/rfc/rfc7541.html#appendix-A
+const std::array<std::pair<const char *, const char *>, 61> StaticTable = {{
+	{":authority", ""},
+	{":method", "GET"},
+	{":method", "POST"},
+	{":path", "/"},
+	{":path", "/index.html"},
+	{":scheme", "http"},
+	{":scheme", "https"},
+	{":status", "200"},
+	{":status", "204"},
+	{":status", "206"},
+	{":status", "304"},
+	{":status", "400"},
+	{":status", "404"},
+	{":status", "500"},
+	{"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""},
+	{"accept-ranges", ""},
+	{"accept", ""},
+	{"access-control-allow-origin", ""},
+	{"age", ""},
+	{"allow", ""},
+	{"authorization", ""},
+	{"cache-control", ""},
+	{"content-disposition", ""},
+	{"content-encoding", ""},
+	{"content-language", ""},
+	{"content-length", ""},
+	{"content-location", ""},
+	{"content-range", ""},
+	{"content-type", ""},
+	{"cookie", ""},
+	{"date", ""},
+	{"etag", ""},
+	{"expect", ""},
+	{"expires", ""},
+	{"from", ""},
+	{"host", ""},
+	{"if-match", ""},
+	{"if-modified-since", ""},
+	{"if-none-match", ""},
+	{"if-range", ""},
+	{"if-unmodified-since", ""},
+	{"last-modified", ""},
+	{"link", ""},
+	{"location", ""},
+	{"max-forwards", ""},
+	{"proxy-authenticate", ""},
+	{"proxy-authorization", ""},
+	{"range", ""},
+	{"referer", ""},
+	{"refresh", ""},
+	{"retry-after", ""},
+	{"server", ""},
+	{"set-cookie", ""},
+	{"strict-transport-security", ""},
+	{"transfer-encoding", ""},
+	{"user-agent", ""},
+	{"vary", ""},
+	{"via", ""},
+	{"www-authenticate", ""},
+}};
+
+struct HuffmanCode {
+	uint32_t code;
+	uint8_t length;
+};
+
+// See https://www.rfc-editor.org/rfc/rfc7541.html#appendix-B
+const std::array<HuffmanCode, 257> HuffmanCodes = {{
+	{0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28},
+	{0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24},
+	{0x3ffffffc, 30}, {0xfffffe9, 28}, {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28},
+	{0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+	{0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28}, {0xffffff4, 28},
+	{0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+	{0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+	{0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8},
+	{0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6}, {0x0, 5}, {0x1, 5}, {0x2, 5},
+	{0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7},
+	{0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+	{0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7},
+	{0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7},
+	{0x6d, 7}, {0x6e, 7}, {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+	{0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6}, {0x7ffd, 15},
+	{0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6}, {0x27, 6},
+	{0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6},
+	{0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7},
+	{0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13},
+	{0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+	{0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22},
+	{0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23},
+	{0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22},
+	{0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+	{0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22},
+	{0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+	{0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23},
+	{0x1fffde, 21}, {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+	{0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21},
+	{0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23}, {0x3fffe1, 22},
+	{0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22},
+	{0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+	{0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22},
+	{0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26},
+	{0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24},
+	{0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+	{0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24}, {0x1fffe4, 21},
+	{0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+	{0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20},
+	{0x1fffe6, 21}, {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+	{0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24},
+	{0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23}, {0x3ffffeb, 26}, {0x7ffffe6, 27},
+	{0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27},
+	{0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+	{0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30}, // EOS
+}};
+
+const uint16_t EndOfString = 256;
+
+// Binary tree for decoding, built once from the codes
+class HuffmanTree {
+public:
+	HuffmanTree() {
+		mNodes.push_back(Node{});
+		for (uint16_t symbol = 0; symbol < HuffmanCodes.size(); ++symbol) {
+			const auto &[code, length] = HuffmanCodes[symbol];
+			size_t node = 0;
+			for (int i = length - 1; i >= 0; --i) {
+				const int bit = (code >> i) & 1;
+				if (mNodes[node].children[bit] == 0) {
+					mNodes[node].children[bit] = uint16_t(mNodes.size());
+					mNodes.push_back(Node{});
+				}
+				node = mNodes[node].children[bit];
+			}
+			mNodes[node].symbol = int16_t(symbol);
+		}
+	}
+
+	string decode(const byte *data, size_t size) const {
+		string result;
+		result.reserve(size * 8 / 5);
+		size_t node = 0;
+		int depth = 0;       // bits since the last symbol
+		bool allOnes = true; // padding must be the most significant bits of EOS
+		for (size_t i = 0; i < size; ++i) {
+			const auto b = uint8_t(data[i]);
+			for (int j = 7; j >= 0; --j) {
+				const int bit = (b >> j) & 1;
+				node = mNodes[node].children[bit];
+				if (node == 0)
+					throw Error("Invalid Huffman code");
+
+				++depth;
+				allOnes = allOnes && bit;
+				if (int16_t symbol = mNodes[node].symbol; symbol >= 0) {
+					if (symbol == EndOfString)
+						throw Error("Huffman-encoded string contains EOS");
+
+					result.push_back(char(symbol));
+					node = 0;
+					depth = 0;
+					allOnes = true;
+				}
+			}
+		}
+
+		if (depth > 7 || !allOnes)
+			throw Error("Invalid Huffman padding");
+
+		return result;
+	}
+
+private:
+	struct Node {
+		std::array<uint16_t, 2> children = {0, 0}; // 0 is the root so it is never a child
+		int16_t symbol = -1;
+	};
+
+	std::vector<Node> mNodes;
+};
+
+const HuffmanTree &Huffman() {
+	static const HuffmanTree tree;
+	return tree;
+}
+
+// See https://www.rfc-editor.org/rfc/rfc7541.html#section-5.1
+uint64_t decodeInteger(const byte *data, size_t size, size_t &pos, int prefixBits) {
+	if (pos >= size)
+		throw Error("Truncated integer");
+
+	const uint8_t mask = uint8_t((1 << prefixBits) - 1);
+	uint64_t value = uint8_t(data[pos++]) & mask;
+	if (value < mask)
+		return value;
+
+	int shift = 0;
+	while (true) {
+		if (pos >= size)
+			throw Error("Truncated integer");
+
+		const auto b = uint8_t(data[pos++]);
+		if (shift > 28)
+			throw Error("Integer overflow");
+
+		value += uint64_t(b & 0x7F) << shift;
+		shift += 7;
+		if (!(b & 0x80))
+			return value;
+	}
+}
+
+void encodeInteger(binary &out, uint64_t value, int prefixBits, uint8_t flags) {
+	const uint8_t mask = uint8_t((1 << prefixBits) - 1);
+	if (value < mask) {
+		out.push_back(byte(flags | value));
+		return;
+	}
+
+	out.push_back(byte(flags | mask));
+	value -= mask;
+	while (value >= 0x80) {
+		out.push_back(byte(0x80 | (value & 0x7F)));
+		value >>= 7;
+	}
+	out.push_back(byte(value));
+}
+
+// See https://www.rfc-editor.org/rfc/rfc7541.html#section-5.2
+string decodeString(const byte *data, size_t size, size_t &pos) {
+	if (pos >= size)
+		throw Error("Truncated string");
+
+	const bool huffman = uint8_t(data[pos]) & 0x80;
+	const uint64_t length = decodeInteger(data, size, pos, 7);
+	if (length > size - pos)
+		throw Error("Truncated string");
+
+	const byte *begin = data + pos;
+	pos += size_t(length);
+	if (huffman)
+		return Huffman().decode(begin, size_t(length));
+
+	return string(reinterpret_cast<const char *>(begin), size_t(length));
+}
+
+void encodeString(binary &out, const string &str) {
+	encodeInteger(out, str.size(), 7, 0x00); // not Huffman-encoded
+	auto data = reinterpret_cast<const byte *>(str.data());
+	out.insert(out.end(), data, data + str.size());
+}
+
+} // namespace
+
+binary encode(const http::HeaderList &headers) {
+	binary out;
+	for (const auto &[name, value] : headers) {
+		// Literal header field without indexing, with the name indexed if it is in the static
+		// table, see https://www.rfc-editor.org/rfc/rfc7541.html#section-6.2.2
+		auto it = std::find_if(StaticTable.begin(), StaticTable.end(),
+		                       [&name = name](const auto &entry) { return name == entry.first; });
+		if (it != StaticTable.end()) {
+			encodeInteger(out, size_t(it - StaticTable.begin()) + 1, 4, 0x00);
+		} else {
+			out.push_back(byte(0x00));
+			encodeString(out, name);
+		}
+		encodeString(out, value);
+	}
+	return out;
+}
+
+Decoder::Decoder(size_t maxTableSize)
+    : mMaxTableSize(maxTableSize), mTableCapacity(maxTableSize) {}
+
+http::HeaderList Decoder::decode(const byte *data, size_t size) {
+	http::HeaderList headers;
+	size_t listSize = 0;
+	size_t pos = 0;
+	while (pos < size) {
+		const auto first = uint8_t(data[pos]);
+		if (first & 0x80) {
+			// Indexed header field
+			const auto index = decodeInteger(data, size, pos, 7);
+			headers.push_back(field(size_t(index)));
+
+		} else if ((first & 0xE0) == 0x20) {
+			// Dynamic table size update
+			const auto capacity = decodeInteger(data, size, pos, 5);
+			if (capacity > mMaxTableSize)
+				throw Error("Invalid dynamic table size update");
+
+			mTableCapacity = size_t(capacity);
+			evict(mTableCapacity);
+			continue;
+
+		} else {
+			// Literal header field, with incremental indexing or not
+			const bool indexing = (first & 0xC0) == 0x40;
+			const auto index = decodeInteger(data, size, pos, indexing ? 6 : 4);
+			string name = index > 0 ? field(size_t(index)).first : decodeString(data, size, pos);
+			string value = decodeString(data, size, pos);
+			if (indexing)
+				insert(name, value);
+
+			headers.emplace_back(std::move(name), std::move(value));
+		}
+
+		listSize += headers.back().first.size() + headers.back().second.size() + EntryOverhead;
+		if (listSize > MaxHeaderListSize)
+			throw Error("Header list is too large");
+	}
+	return headers;
+}
+
+const http::HeaderList::value_type &Decoder::field(size_t index) const {
+	static const auto staticFields = [] {
+		http::HeaderList fields;
+		for (const auto &[name, value] : StaticTable)
+			fields.emplace_back(name, value);
+		return fields;
+	}();
+
+	if (index == 0)
+		throw Error("Invalid header field index 0");
+
+	if (index <= staticFields.size())
+		return staticFields[index - 1];
+
+	index -= staticFields.size() + 1;
+	if (index >= mTable.size())
+		throw Error("Invalid header field index");
+
+	return mTable[index];
+}
+
+void Decoder::insert(string name, string value) {
+	// An entry larger than the table empties it, see
+	// https://www.rfc-editor.org/rfc/rfc7541.html#section-4.4
+	const size_t entrySize = name.size() + value.size() + EntryOverhead;
+	if (entrySize > mTableCapacity) {
+		evict(0);
+		return;
+	}
+
+	evict(mTableCapacity - entrySize);
+	mTable.emplace_front(std::move(name), std::move(value));
+	mTableSize += entrySize;
+}
+
+void Decoder::evict(size_t maxSize) {
+	while (mTableSize > maxSize && !mTable.empty()) {
+		const auto &[name, value] = mTable.back();
+		mTableSize -= name.size() + value.size() + EntryOverhead;
+		mTable.pop_back();
+	}
+}
+
+} // namespace rtc::impl::hpack
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_HPACK_H
+#define RTC_IMPL_HPACK_H
+
+#include "common.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "http.hpp"
+
+#include <deque>
+#include <stdexcept>
+
+namespace rtc::impl::hpack {
+
+// HPACK header compression for HTTP/2 (RFC 7541)
+// See https://www.rfc-editor.org/rfc/rfc7541.html
+
+class Error : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// Header fields are encoded as literals without indexing, so the encoder has no state
+binary encode(const http::HeaderList &headers);
+
+// The dynamic table is shared by all header blocks of a connection, they must be decoded in order
+class Decoder final {
+public:
+	static const size_t DefaultTableSize = 4096;
+
+	Decoder(size_t maxTableSize = DefaultTableSize);
+
+	// Throws Error if the block is malformed, the connection must then be closed
+	http::HeaderList decode(const byte *data, size_t size);
+
+private:
+	const http::HeaderList::value_type &field(size_t index) const;
+	void insert(string name, string value);
+	void evict(size_t maxSize);
+
+	const size_t mMaxTableSize; // from our SETTINGS_HEADER_TABLE_SIZE
+	size_t mTableCapacity;      // updated by the encoder
+	size_t mTableSize = 0;
+	std::deque<http::HeaderList::value_type> mTable; // newest first
+};
+
+} // namespace rtc::impl::hpack
+
+#endif
+
+#endif
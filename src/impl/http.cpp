@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "http.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace rtc::impl::http {
+
+bool iequals(std::string_view a, std::string_view b) {
+	return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+		       return std::tolower(static_cast<unsigned char>(x)) ==
+		              std::tolower(static_cast<unsigned char>(y));
+	       });
+}
+
+std::string_view trim(std::string_view str) {
+	const char *whitespace = " \t";
+	size_t first = str.find_first_not_of(whitespace);
+	if (first == std::string_view::npos)
+		return {};
+
+	size_t last = str.find_last_not_of(whitespace);
+	return str.substr(first, last - first + 1);
+}
+
+std::string_view nextToken(std::string_view &line) {
+	line = trim(line);
+	size_t pos = line.find(' ');
+	auto token = line.substr(0, pos);
+	line = pos != std::string_view::npos ? line.substr(pos + 1) : std::string_view{};
+	return token;
+}
+
+optional<std::string_view> Head::find(std::string_view name) const {
+	for (size_t i = 0; i < count; ++i)
+		if (iequals(headers[i].first, name))
+			return headers[i].second;
+
+	return nullopt;
+}
+
+size_t parseHead(const byte *buffer, size_t size, Head &head) {
+	head.startLine = {};
+	head.count = 0;
+
+	const char *begin = reinterpret_cast<const char *>(buffer);
+	const char *end = begin + std::min(size, MaxHeadSize);
+	const char *cur = begin;
+	bool first = true;
+	while (true) {
+		auto eol = static_cast<const char *>(std::memchr(cur, '\n', end - cur));
+		if (!eol) {
+			if (size >= MaxHeadSize)
+				throw HeadTooLarge("HTTP head is too large");
+
+			return 0;
+		}
+
+		std::string_view line(cur, eol - cur);
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+
+		cur = eol + 1;
+		if (line.empty())
+			break;
+
+		if (std::exchange(first, false)) {
+			head.startLine = line;
+			continue;
+		}
+
+		if (head.count == MaxHeaders)
+			throw HeadTooLarge("HTTP head has too many headers");
+
+		size_t pos = line.find(':');
+		if (pos != std::string_view::npos)
+			head.headers[head.count++] = {line.substr(0, pos), trim(line.substr(pos + 1))};
+		else
+			head.headers[head.count++] = {line, {}};
+	}
+
+	return cur - begin;
+}
+
+string reasonPhrase(int statusCode) {
+	switch (statusCode) {
+	case 200:
+		return "OK";
+	case 201:
+		return "Created";
+	case 204:
+		return "No Content";
+	case 400:
+		return "Bad Request";
+	case 403:
+		return "Forbidden";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	case 413:
+		return "Content Too Large";
+	case 415:
+		return "Unsupported Media Type";
+	case 426:
+		return "Upgrade Required";
+	case 431:
+		return "Request Header Fields Too Large";
+	case 500:
+		return "Internal Server Error";
+	case 501:
+		return "Not Implemented";
+	case 503:
+		return "Service Unavailable";
+	default:
+		return statusCode < 400 ? "OK" : "Error";
+	}
+}
+
+} // namespace rtc::impl::http
+
+#endif
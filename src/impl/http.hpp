@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_HTTP_H
+#define RTC_IMPL_HTTP_H
+
+#include "common.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <array>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace rtc::impl::http {
+
+const size_t MaxHeadSize = 8192; // request or status line and headers
+const size_t MaxHeaders = 32;
+
+bool iequals(std::string_view a, std::string_view b); // case-insensitive
+std::string_view trim(std::string_view str);
+std::string_view nextToken(std::string_view &line); // splits the first space-separated token
+
+// HTTP head parsed in a single pass without allocation, views point into the parsed buffer
+struct Head {
+	std::string_view startLine;
+	std::array<std::pair<std::string_view, std::string_view>, MaxHeaders> headers;
+	size_t count = 0;
+
+	// Header names are case-insensitive, the first header with the name is returned
+	optional<std::string_view> find(std::string_view name) const;
+};
+
+// Header fields of an HTTP/2 message, names are lowercase and pseudo-headers come first
+using HeaderList = std::vector<std::pair<string, string>>;
+
+class HeadTooLarge : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// Returns the length of the head including the final empty line, or 0 if it is incomplete
+// Throws HeadTooLarge if the head exceeds the limits
+size_t parseHead(const byte *buffer, size_t size, Head &head);
+
+string reasonPhrase(int statusCode);
+
+} // namespace rtc::impl::http
+
+#endif
+
+#endif
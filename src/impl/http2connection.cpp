@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_WEBSOCKET
+
+#define RTC_LOG_SUBSYSTEM WebSocket
+
+#include "http2connection.hpp"
+#include "init.hpp"
+#include "internals.hpp"
+#include "threadpool.hpp"
+#include "verifiedtlstransport.hpp"
+
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace rtc::impl {
+
+namespace {
+
+struct Pool {
+	std::unordered_map<string, weak_ptr<Http2Connection>> connections;
+	std::unordered_set<string> unsupported; // servers without WebSockets over HTTP/2
+	std::mutex mutex;
+};
+
+Pool &pool() {
+	static Pool pool;
+	return pool;
+}
+
+} // namespace
+
+shared_ptr<Http2Connection> Http2Connection::Get(const string &hostname, const string &service,
+                                                 bool verify, certificate_ptr certificate) {
+	const string server = hostname + ':' + service;
+	shared_ptr<Http2Connection> connection;
+	{
+		auto &p = pool();
+		std::lock_guard lock(p.mutex);
+		if (p.unsupported.find(server) != p.unsupported.end())
+			return nullptr;
+
+		// Connections with a client certificate are not shared
+		const string key = server + (verify ? "" : "#noverify");
+		if (!certificate) {
+			if (auto it = p.connections.find(key); it != p.connections.end())
+				if (auto existing = it->second.lock(); existing && existing->isUsable())
+					return existing;
+		}
+
+		connection = std::make_shared<Http2Connection>(hostname, service, verify, certificate);
+		if (!certificate) {
+			for (auto it = p.connections.begin(); it != p.connections.end();)
+				it = it->second.expired() ? p.connections.erase(it) : std::next(it);
+
+			p.connections[key] = connection;
+		}
+	}
+
+	connection->open();
+	return connection;
+}
+
+Http2Connection::Http2Connection(string hostname, string service, bool verify,
+                                 certificate_ptr certificate)
+    : mHostname(std::move(hostname)), mService(std::move(service)), mVerify(verify),
+      mCertificate(std::move(certificate)) {
+	PLOG_VERBOSE << "Creating HTTP/2 connection";
+}
+
+Http2Connection::~Http2Connection() {
+	PLOG_VERBOSE << "Destroying HTTP/2 connection";
+
+	// Pass the pointers to a thread, allowing to destroy the connection from a transport thread
+	using array = std::array<shared_ptr<Transport>, 3>;
+	array transports{std::move(mHttp2Transport), std::move(mTlsTransport),
+	                 std::move(mTcpTransport)};
+
+	for (const auto &t : transports)
+		if (t)
+			t->onStateChange(nullptr);
+
+	ThreadPool::Instance().post([transports = std::move(transports)]() mutable {
+		for (const auto &t : transports)
+			if (t)
+				t->stop();
+
+		for (auto &t : transports)
+			t.reset();
+	});
+}
+
+void Http2Connection::whenReady(ready_callback callback) {
+	std::unique_lock lock(mMutex);
+	if (!mResolved) {
+		mCallbacks.push_back(std::move(callback));
+		return;
+	}
+
+	auto ready = mReady;
+	lock.unlock();
+	callback(std::move(ready));
+}
+
+bool Http2Connection::isUsable() const {
+	std::lock_guard lock(mMutex);
+	if (!mResolved)
+		return true;
+
+	return mReady && mReady->state() == Transport::State::Connected && mReady->canOpenStream();
+}
+
+shared_ptr<TcpTransport> Http2Connection::tcpTransport() const {
+	std::lock_guard lock(mMutex);
+	return mTcpTransport;
+}
+
+void Http2Connection::open() {
+	PLOG_DEBUG << "Opening HTTP/2 connection to " << mHostname << ':' << mService;
+	using State = Transport::State;
+	try {
+		auto transport = std::make_shared<TcpTransport>(
+		    mHostname, mService, [weak_this = weak_from_this()](State state) {
+			    auto shared_this = weak_this.lock();
+			    if (!shared_this)
+				    return;
+
+			    if (state == State::Connected)
+				    shared_this->initTlsTransport();
+			    else if (state == State::Failed || state == State::Disconnected)
+				    shared_this->resolve(nullptr);
+		    });
+
+		{
+			std::lock_guard lock(mMutex);
+			mTcpTransport = transport;
+		}
+		transport->start();
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << e.what();
+		resolve(nullptr);
+	}
+}
+
+void Http2Connection::initTlsTransport() {
+	PLOG_VERBOSE << "Starting TLS transport for HTTP/2";
+	using State = Transport::State;
+	try {
+		auto lower = tcpTransport();
+		if (!lower)
+			throw std::logic_error("No underlying TCP transport for TLS transport");
+
+		auto stateChangeCallback = [weak_this = weak_from_this()](State state) {
+			auto shared_this = weak_this.lock();
+			if (!shared_this)
+				return;
+
+			if (state == State::Connected)
+				shared_this->initHttp2Transport();
+			else if (state == State::Failed || state == State::Disconnected)
+				shared_this->resolve(nullptr);
+		};
+
+		Init::Instance().init(Init::Subsystem::Tls);
+
+		shared_ptr<TlsTransport> transport;
+		if (mVerify)
+			transport = std::make_shared<VerifiedTlsTransport>(lower, mHostname, mCertificate,
+			                                                   stateChangeCallback);
+		else
+			transport =
+			    std::make_shared<TlsTransport>(lower, mHostname, mCertificate, stateChangeCallback);
+
+		// HTTP/1.1 is offered too so the server can answer instead of failing the handshake
+		transport->setAlpnProtocols({"h2", "http/1.1"});
+
+		{
+			std::lock_guard lock(mMutex);
+			mTlsTransport = transport;
+		}
+		transport->start();
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << e.what();
+		resolve(nullptr);
+	}
+}
+
+void Http2Connection::initHttp2Transport() {
+	PLOG_VERBOSE << "Starting HTTP/2 transport";
+	using State = Transport::State;
+	try {
+		shared_ptr<TlsTransport> lower;
+		{
+			std::lock_guard lock(mMutex);
+			lower = mTlsTransport;
+		}
+		if (!lower)
+			throw std::logic_error("No underlying TLS transport for HTTP/2 transport");
+
+		if (lower->alpnProtocol().value_or("") != "h2") {
+			PLOG_INFO << "Server " << mHostname << " did not negotiate HTTP/2";
+			markUnsupported();
+			resolve(nullptr);
+			return;
+		}
+
+		auto transport = std::make_shared<Http2Transport>(
+		    lower, [weak_this = weak_from_this()](State state) {
+			    auto shared_this = weak_this.lock();
+			    if (!shared_this)
+				    return;
+
+			    if (state == State::Connected) {
+				    shared_ptr<Http2Transport> ready;
+				    {
+					    std::lock_guard lock(shared_this->mMutex);
+					    ready = shared_this->mHttp2Transport;
+				    }
+				    if (ready && !ready->isConnectProtocolEnabled()) {
+					    PLOG_INFO << "Server " << shared_this->mHostname
+					              << " does not accept WebSockets over HTTP/2";
+					    shared_this->markUnsupported();
+					    ready.reset();
+				    }
+				    shared_this->resolve(std::move(ready));
+
+			    } else if (state == State::Failed || state == State::Disconnected) {
+				    shared_this->resolve(nullptr);
+			    }
+		    });
+
+		{
+			std::lock_guard lock(mMutex);
+			mHttp2Transport = transport;
+		}
+		transport->start();
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << e.what();
+		resolve(nullptr);
+	}
+}
+
+void Http2Connection::resolve(shared_ptr<Http2Transport> transport) {
+	std::vector<ready_callback> callbacks;
+	{
+		std::lock_guard lock(mMutex);
+		if (std::exchange(mResolved, true))
+			return;
+
+		mReady = transport;
+		std::swap(callbacks, mCallbacks);
+	}
+
+	if (transport) {
+		PLOG_INFO << "HTTP/2 connection to " << mHostname << ':' << mService << " open";
+	}
+
+	for (auto &callback : callbacks)
+		callback(transport);
+}
+
+void Http2Connection::markUnsupported() {
+	auto &p = pool();
+	std::lock_guard lock(p.mutex);
+	p.unsupported.insert(mHostname + ':' + mService);
+}
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_HTTP2_CONNECTION_H
+#define RTC_IMPL_HTTP2_CONNECTION_H
+
+#include "certificate.hpp"
+#include "common.hpp"
+#include "http2transport.hpp"
+#include "tcptransport.hpp"
+#include "tlstransport.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace rtc::impl {
+
+// TLS connection to a server shared by the WebSockets opened to it over HTTP/2
+// Connections are pooled per server while they are in use. When the server does not negotiate
+// HTTP/2 or does not accept extended CONNECT, it is remembered and WebSockets to it fall back to
+// a connection of their own with the HTTP/1.1 upgrade.
+class Http2Connection final : public std::enable_shared_from_this<Http2Connection> {
+public:
+	// Returns nullptr if the server is known not to support WebSockets over HTTP/2
+	static shared_ptr<Http2Connection> Get(const string &hostname, const string &service,
+	                                       bool verify, certificate_ptr certificate);
+
+	Http2Connection(string hostname, string service, bool verify, certificate_ptr certificate);
+	~Http2Connection();
+
+	// The callback is called once connected, with nullptr if HTTP/2 is unavailable
+	using ready_callback = std::function<void(shared_ptr<Http2Transport> transport)>;
+	void whenReady(ready_callback callback);
+
+	bool isUsable() const; // new WebSockets may use the connection
+	shared_ptr<TcpTransport> tcpTransport() const;
+
+private:
+	void open();
+	void initTlsTransport();
+	void initHttp2Transport();
+	void resolve(shared_ptr<Http2Transport> transport);
+	void markUnsupported();
+
+	const string mHostname;
+	const string mService;
+	const bool mVerify;
+	const certificate_ptr mCertificate;
+
+	shared_ptr<TcpTransport> mTcpTransport;
+	shared_ptr<TlsTransport> mTlsTransport;
+	shared_ptr<Http2Transport> mHttp2Transport;
+
+	bool mResolved = false;
+	shared_ptr<Http2Transport> mReady; // set if resolved with HTTP/2 available
+	std::vector<ready_callback> mCallbacks; // waiting for the connection
+	mutable std::mutex mMutex;
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
@@ -0,0 +1,755 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_WEBSOCKET
+
+#define RTC_LOG_SUBSYSTEM WebSocket
+
+#include "http2transport.hpp"
+#include "internals.hpp"
+#include "tlstransport.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace rtc::impl {
+
+namespace {
+
+// See https://www.rfc-editor.org/rfc/rfc9113.html#section-3.4
+const char ConnectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+const uint8_t FlagEndStream = 0x1;
+const uint8_t FlagAck = 0x1;
+const uint8_t FlagEndHeaders = 0x4;
+const uint8_t FlagPadded = 0x8;
+const uint8_t FlagPriority = 0x20;
+
+enum Setting : uint16_t {
+	SETTINGS_HEADER_TABLE_SIZE = 0x1,
+	SETTINGS_ENABLE_PUSH = 0x2,
+	SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+	SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+	SETTINGS_MAX_FRAME_SIZE = 0x5,
+	SETTINGS_ENABLE_CONNECT_PROTOCOL = 0x8, // RFC 8441
+};
+
+const int64_t MaxWindowSize = 0x7FFFFFFF;
+const size_t MaxHeaderBlockSize = 65536; // encoded, over CONTINUATION frames
+
+uint32_t readUint32(const byte *p) {
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) |
+	       uint32_t(p[3]);
+}
+
+void writeUint32(byte *p, uint32_t value) {
+	p[0] = byte(value >> 24);
+	p[1] = byte(value >> 16);
+	p[2] = byte(value >> 8);
+	p[3] = byte(value);
+}
+
+void writeFrameHeader(byte *p, size_t length, uint8_t type, uint8_t flags, uint32_t id) {
+	p[0] = byte(length >> 16);
+	p[1] = byte(length >> 8);
+	p[2] = byte(length);
+	p[3] = byte(type);
+	p[4] = byte(flags);
+	writeUint32(p + 5, id & 0x7FFFFFFF);
+}
+
+// Returns the payload without padding
+std::pair<const byte *, size_t> stripPadding(const byte *payload, size_t size, uint8_t flags) {
+	if (!(flags & FlagPadded))
+		return {payload, size};
+
+	if (size < 1 || size_t(payload[0]) >= size)
+		return {nullptr, 0};
+
+	return {payload + 1, size - 1 - size_t(payload[0])};
+}
+
+} // namespace
+
+Http2Transport::ProtocolError::ProtocolError(ErrorCode code_, const string &what)
+    : std::runtime_error(what), code(code_) {}
+
+Http2Transport::Http2Transport(shared_ptr<TlsTransport> lower, state_callback callback)
+    : Transport(lower, std::move(callback)) {
+	PLOG_DEBUG << "Initializing HTTP/2 transport";
+}
+
+Http2Transport::~Http2Transport() { stop(); }
+
+void Http2Transport::start() {
+	Transport::start();
+	registerIncoming();
+	changeState(State::Connecting);
+
+	// The client connection preface is followed by our settings and the connection window,
+	// see https://www.rfc-editor.org/rfc/rfc9113.html#section-3.4
+	const size_t prefaceSize = sizeof(ConnectionPreface) - 1;
+	const std::pair<uint16_t, uint32_t> settings[] = {
+	    {SETTINGS_ENABLE_PUSH, 0},
+	    {SETTINGS_INITIAL_WINDOW_SIZE, StreamWindowSize},
+	    {SETTINGS_MAX_FRAME_SIZE, uint32_t(MaxFrameSize)},
+	};
+
+	binary out(prefaceSize + 2 * FrameHeaderSize + std::size(settings) * 6 + 4);
+	byte *p = out.data();
+	std::memcpy(p, ConnectionPreface, prefaceSize);
+	p += prefaceSize;
+	writeFrameHeader(p, std::size(settings) * 6, SETTINGS, 0, 0);
+	p += FrameHeaderSize;
+	for (auto [id, value] : settings) {
+		p[0] = byte(id >> 8);
+		p[1] = byte(id);
+		writeUint32(p + 2, value);
+		p += 6;
+	}
+	writeFrameHeader(p, 4, WINDOW_UPDATE, 0, 0);
+	writeUint32(p + FrameHeaderSize, ConnectionWindowSize - DefaultWindowSize);
+
+	std::lock_guard lock(mMutex);
+	outgoing(make_message(std::move(out)));
+}
+
+bool Http2Transport::stop() {
+	if (!Transport::stop())
+		return false;
+
+	PLOG_DEBUG << "Stopping HTTP/2 transport";
+	std::vector<Event> events;
+	{
+		std::lock_guard lock(mMutex);
+		if (mSettingsReceived)
+			sendGoAway(NO_ERROR);
+
+		mGoingAway = true;
+		failAll(events);
+	}
+	dispatch(events);
+	return true;
+}
+
+bool Http2Transport::isConnectProtocolEnabled() const {
+	std::lock_guard lock(mMutex);
+	return mConnectProtocolEnabled;
+}
+
+bool Http2Transport::isGoingAway() const {
+	std::lock_guard lock(mMutex);
+	return mGoingAway;
+}
+
+bool Http2Transport::canOpenStream() const {
+	std::lock_guard lock(mMutex);
+	return isStreamAvailable();
+}
+
+void Http2Transport::incoming(message_ptr message) {
+	std::vector<Event> events;
+	if (!message) {
+		PLOG_INFO << "HTTP/2 connection closed";
+		{
+			std::lock_guard lock(mMutex);
+			mGoingAway = true;
+			failAll(events);
+		}
+		dispatch(events);
+		changeState(state() == State::Connected ? State::Disconnected : State::Failed);
+		return;
+	}
+
+	if (message->size() == 0)
+		return;
+
+	bool settingsReceived, failed = false;
+	{
+		std::lock_guard lock(mMutex);
+		const bool wasReceived = mSettingsReceived;
+		mBuffer.insert(mBuffer.end(), message->begin(), message->end());
+		try {
+			processFrames(events);
+
+		} catch (const ProtocolError &e) {
+			PLOG_WARNING << "HTTP/2 protocol error: " << e.what();
+			sendGoAway(e.code);
+			failed = true;
+
+		} catch (const hpack::Error &e) {
+			PLOG_WARNING << "HTTP/2 header compression error: " << e.what();
+			sendGoAway(COMPRESSION_ERROR);
+			failed = true;
+		}
+
+		if (failed) {
+			mGoingAway = true;
+			failAll(events);
+		}
+
+		settingsReceived = mSettingsReceived && !wasReceived;
+	}
+
+	dispatch(events);
+
+	if (failed)
+		changeState(State::Failed);
+	else if (settingsReceived)
+		changeState(State::Connected);
+}
+
+uint32_t Http2Transport::openStream(shared_ptr<Http2Stream> stream,
+                                    const http::HeaderList &headers) {
+	std::lock_guard lock(mMutex);
+	if (!isStreamAvailable())
+		return 0;
+
+	const uint32_t id = mNextStreamId;
+	mNextStreamId += 2;
+	Stream entry;
+	entry.stream = std::move(stream);
+	entry.sendWindow = int64_t(mInitialWindowSize);
+	mStreams.emplace(id, std::move(entry));
+
+	// The header block is split in CONTINUATION frames if it exceeds the frame size
+	const binary block = hpack::encode(headers);
+	size_t offset = 0;
+	do {
+		const size_t size = std::min(block.size() - offset, mMaxFrameSize);
+		const bool last = offset + size == block.size();
+		sendFrame(offset == 0 ? HEADERS : CONTINUATION, last ? FlagEndHeaders : 0, id,
+		          block.data() + offset, size);
+		offset += size;
+	} while (offset < block.size());
+
+	return id;
+}
+
+bool Http2Transport::sendData(uint32_t id, const std::vector<message_ptr> &messages) {
+	std::lock_guard lock(mMutex);
+	auto it = mStreams.find(id);
+	if (it == mStreams.end() || it->second.localEnded)
+		return false;
+
+	auto &stream = it->second;
+	for (const auto &message : messages)
+		if (message && message->payloadSize() > 0)
+			stream.pending.push_back(message);
+
+	flush(id, stream);
+	return true;
+}
+
+void Http2Transport::closeStream(uint32_t id) {
+	std::lock_guard lock(mMutex);
+	auto it = mStreams.find(id);
+	if (it == mStreams.end() || it->second.localEnded)
+		return;
+
+	// The stream is forgotten once END_STREAM is sent, the remote may continue sending data but
+	// the upper layer is already closed
+	it->second.localEnded = true;
+	if (flush(id, it->second))
+		mStreams.erase(it);
+}
+
+void Http2Transport::processFrames(std::vector<Event> &events) {
+	size_t pos = 0;
+	while (mBuffer.size() - pos >= FrameHeaderSize) {
+		const byte *header = mBuffer.data() + pos;
+		const size_t length =
+		    (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | size_t(header[2]);
+		if (length > MaxFrameSize)
+			throw ProtocolError(FRAME_SIZE_ERROR, "Frame size exceeds the maximum");
+
+		if (mBuffer.size() - pos < FrameHeaderSize + length)
+			break;
+
+		const auto type = uint8_t(header[3]);
+		const auto flags = uint8_t(header[4]);
+		const uint32_t id = readUint32(header + 5) & 0x7FFFFFFF;
+		pos += FrameHeaderSize + length;
+
+		// The server connection preface is a SETTINGS frame
+		if (!mSettingsReceived && type != SETTINGS)
+			throw ProtocolError(PROTOCOL_ERROR, "Expected SETTINGS frame");
+
+		// A header block must be contiguous
+		if (mHeaderStream != 0 && (type != CONTINUATION || id != mHeaderStream))
+			throw ProtocolError(PROTOCOL_ERROR, "Expected CONTINUATION frame");
+
+		processFrame(type, flags, id, header + FrameHeaderSize, length, events);
+	}
+
+	mBuffer.erase(mBuffer.begin(), mBuffer.begin() + pos);
+}
+
+void Http2Transport::processFrame(uint8_t type, uint8_t flags, uint32_t id, const byte *payload,
+                                  size_t size, std::vector<Event> &events) {
+	switch (type) {
+	case DATA: {
+		if (id == 0)
+			throw ProtocolError(PROTOCOL_ERROR, "DATA frame on stream 0");
+
+		// Padding counts for flow control, see
+		// https://www.rfc-editor.org/rfc/rfc9113.html#section-6.9.1
+		if (int64_t(size) > mRecvWindow)
+			throw ProtocolError(FLOW_CONTROL_ERROR, "Connection receive window exceeded");
+
+		mRecvWindow -= int64_t(size);
+
+		auto [data, dataSize] = stripPadding(payload, size, flags);
+		if (!data)
+			throw ProtocolError(PROTOCOL_ERROR, "Invalid DATA padding");
+
+		auto it = mStreams.find(id);
+		if (it == mStreams.end()) {
+			// The stream is closed locally, tell the remote to stop sending
+			if (id < mNextStreamId && !(flags & FlagEndStream)) {
+				byte code[4];
+				writeUint32(code, STREAM_CLOSED);
+				sendFrame(RST_STREAM, 0, id, code, 4);
+			}
+			credit(0, size);
+			break;
+		}
+
+		auto &stream = it->second;
+		if (int64_t(size) > stream.recvWindow) {
+			// This is a stream error, the connection window is still valid
+			PLOG_WARNING << "HTTP/2 stream " << id << " receive window exceeded";
+			byte code[4];
+			writeUint32(code, FLOW_CONTROL_ERROR);
+			sendFrame(RST_STREAM, 0, id, code, 4);
+			credit(0, size);
+			endStream(id, events);
+			break;
+		}
+
+		stream.recvWindow -= int64_t(size);
+
+		// Windows are credited once the data is consumed by the stream, in dispatch()
+		if (dataSize > 0)
+			events.push_back(Event{stream.stream.lock(), nullopt,
+			                       make_message(data, data + dataSize), id, size});
+		else
+			credit(id, size);
+
+		if (flags & FlagEndStream)
+			endStream(id, events);
+
+		break;
+	}
+	case HEADERS: {
+		if (id == 0)
+			throw ProtocolError(PROTOCOL_ERROR, "HEADERS frame on stream 0");
+
+		auto [fragment, fragmentSize] = stripPadding(payload, size, flags);
+		if (!fragment)
+			throw ProtocolError(PROTOCOL_ERROR, "Invalid HEADERS padding");
+
+		if (flags & FlagPriority) {
+			if (fragmentSize < 5)
+				throw ProtocolError(FRAME_SIZE_ERROR, "Invalid HEADERS priority");
+
+			fragment += 5;
+			fragmentSize -= 5;
+		}
+
+		mHeaderBlock.assign(fragment, fragment + fragmentSize);
+		mHeaderStream = id;
+		mHeaderEndStream = flags & FlagEndStream;
+		if (flags & FlagEndHeaders)
+			processHeaders(id, mHeaderEndStream, events);
+
+		break;
+	}
+	case CONTINUATION: {
+		if (mHeaderStream == 0)
+			throw ProtocolError(PROTOCOL_ERROR, "Unexpected CONTINUATION frame");
+
+		if (mHeaderBlock.size() + size > MaxHeaderBlockSize)
+			throw ProtocolError(PROTOCOL_ERROR, "Header block is too large");
+
+		mHeaderBlock.insert(mHeaderBlock.end(), payload, payload + size);
+		if (flags & FlagEndHeaders)
+			processHeaders(id, mHeaderEndStream, events);
+
+		break;
+	}
+	case RST_STREAM: {
+		if (id == 0 || size != 4)
+			throw ProtocolError(PROTOCOL_ERROR, "Invalid RST_STREAM frame");
+
+		PLOG_DEBUG << "HTTP/2 stream " << id << " reset, error=" << readUint32(payload);
+		endStream(id, events);
+		break;
+	}
+	case SETTINGS: {
+		if (id != 0)
+			throw ProtocolError(PROTOCOL_ERROR, "SETTINGS frame on a stream");
+
+		if (flags & FlagAck) {
+			if (size != 0)
+				throw ProtocolError(FRAME_SIZE_ERROR, "Invalid SETTINGS acknowledgement");
+
+			break;
+		}
+
+		processSettings(payload, size);
+		sendFrame(SETTINGS, FlagAck, 0);
+		mSettingsReceived = true;
+		break;
+	}
+	case PUSH_PROMISE:
+		throw ProtocolError(PROTOCOL_ERROR, "Unexpected PUSH_PROMISE frame"); // push is disabled
+
+	case PING: {
+		if (id != 0 || size != 8)
+			throw ProtocolError(PROTOCOL_ERROR, "Invalid PING frame");
+
+		if (!(flags & FlagAck))
+			sendFrame(PING, FlagAck, 0, payload, size);
+
+		break;
+	}
+	case GOAWAY: {
+		if (id != 0 || size < 8)
+			throw ProtocolError(PROTOCOL_ERROR, "Invalid GOAWAY frame");
+
+		// Streams above the last one processed by the server can be retried elsewhere
+		const uint32_t lastId = readUint32(payload) & 0x7FFFFFFF;
+		PLOG_INFO << "HTTP/2 connection going away, error=" << readUint32(payload + 4);
+		mGoingAway = true;
+		std::vector<uint32_t> ids;
+		for (const auto &[streamId, stream] : mStreams)
+			if (streamId > lastId)
+				ids.push_back(streamId);
+
+		for (uint32_t streamId : ids)
+			endStream(streamId, events);
+
+		break;
+	}
+	case WINDOW_UPDATE: {
+		if (size != 4)
+			throw ProtocolError(FRAME_SIZE_ERROR, "Invalid WINDOW_UPDATE frame");
+
+		const uint32_t increment = readUint32(payload) & 0x7FFFFFFF;
+		if (increment == 0)
+			throw ProtocolError(PROTOCOL_ERROR, "Invalid window increment");
+
+		if (id == 0) {
+			mSendWindow += increment;
+			if (mSendWindow > MaxWindowSize)
+				throw ProtocolError(FLOW_CONTROL_ERROR, "Connection window overflow");
+
+			flushAll();
+		} else if (auto it = mStreams.find(id); it != mStreams.end()) {
+			it->second.sendWindow += increment;
+			if (it->second.sendWindow > MaxWindowSize)
+				throw ProtocolError(FLOW_CONTROL_ERROR, "Stream window overflow");
+
+			if (flush(id, it->second))
+				mStreams.erase(it);
+		}
+		break;
+	}
+	default:
+		// PRIORITY and unknown frame types are ignored
+		break;
+	}
+}
+
+void Http2Transport::processHeaders(uint32_t id, bool endStream, std::vector<Event> &events) {
+	// The block must be decoded even for an unknown stream to keep the dynamic table in sync
+	auto headers = mDecoder.decode(mHeaderBlock.data(), mHeaderBlock.size());
+	mHeaderBlock.clear();
+	mHeaderStream = 0;
+
+	auto it = mStreams.find(id);
+	if (it == mStreams.end())
+		return;
+
+	// Trailers are ignored
+	if (!std::exchange(it->second.responded, true))
+		events.push_back(Event{it->second.stream.lock(), std::move(headers), nullptr});
+
+	if (endStream)
+		this->endStream(id, events);
+}
+
+void Http2Transport::processSettings(const byte *payload, size_t size) {
+	if (size % 6 != 0)
+		throw ProtocolError(FRAME_SIZE_ERROR, "Invalid SETTINGS frame");
+
+	for (size_t i = 0; i < size; i += 6) {
+		const uint16_t id = uint16_t((uint16_t(payload[i]) << 8) | uint16_t(payload[i + 1]));
+		const uint32_t value = readUint32(payload + i + 2);
+		switch (id) {
+		case SETTINGS_MAX_CONCURRENT_STREAMS:
+			mMaxConcurrentStreams = value;
+			break;
+		case SETTINGS_INITIAL_WINDOW_SIZE: {
+			if (value > uint32_t(MaxWindowSize))
+				throw ProtocolError(FLOW_CONTROL_ERROR, "Invalid initial window size");
+
+			// The change applies to the windows of all open streams
+			const int64_t delta = int64_t(value) - int64_t(mInitialWindowSize);
+			for (auto &[streamId, stream] : mStreams)
+				stream.sendWindow += delta;
+
+			mInitialWindowSize = value;
+			if (delta > 0)
+				flushAll();
+
+			break;
+		}
+		case SETTINGS_MAX_FRAME_SIZE:
+			if (value < MaxFrameSize || value > 0xFFFFFF)
+				throw ProtocolError(PROTOCOL_ERROR, "Invalid maximum frame size");
+
+			mMaxFrameSize = value;
+			break;
+		case SETTINGS_ENABLE_CONNECT_PROTOCOL:
+			if (value > 1)
+				throw ProtocolError(PROTOCOL_ERROR, "Invalid ENABLE_CONNECT_PROTOCOL setting");
+
+			mConnectProtocolEnabled = value == 1;
+			break;
+		default:
+			// Our encoder does not use the dynamic table, so the table size is irrelevant
+			break;
+		}
+	}
+}
+
+void Http2Transport::endStream(uint32_t id, std::vector<Event> &events) {
+	auto it = mStreams.find(id);
+	if (it == mStreams.end())
+		return;
+
+	events.push_back(Event{it->second.stream.lock(), nullopt, nullptr});
+	mStreams.erase(it);
+}
+
+void Http2Transport::failAll(std::vector<Event> &events) {
+	for (auto &[id, stream] : mStreams)
+		events.push_back(Event{stream.stream.lock(), nullopt, nullptr});
+
+	mStreams.clear();
+}
+
+void Http2Transport::dispatch(std::vector<Event> &events) {
+	std::vector<std::pair<uint32_t, size_t>> credits;
+	for (auto &event : events) {
+		// Data for a stream which is already gone is consumed as well
+		if (event.credit > 0)
+			credits.emplace_back(event.id, event.credit);
+
+		if (!event.stream)
+			continue;
+
+		if (event.headers)
+			event.stream->incomingResponse(*event.headers);
+		else
+			event.stream->incoming(std::move(event.data));
+	}
+	events.clear();
+
+	if (credits.empty())
+		return;
+
+	std::lock_guard lock(mMutex);
+	if (mGoingAway && mStreams.empty())
+		return;
+
+	for (auto [id, size] : credits)
+		credit(id, size);
+}
+
+bool Http2Transport::isStreamAvailable() const {
+	return mSettingsReceived && !mGoingAway && mNextStreamId <= uint32_t(MaxWindowSize) &&
+	       (!mMaxConcurrentStreams || mStreams.size() < *mMaxConcurrentStreams);
+}
+
+void Http2Transport::credit(uint32_t id, size_t size) {
+	// WINDOW_UPDATE frames are sent once half of a window is consumed
+	mConsumedSinceUpdate += size;
+	if (mConsumedSinceUpdate >= ConnectionWindowSize / 2) {
+		sendWindowUpdate(0, uint32_t(mConsumedSinceUpdate));
+		mRecvWindow += int64_t(mConsumedSinceUpdate);
+		mConsumedSinceUpdate = 0;
+	}
+
+	if (id == 0)
+		return;
+
+	// Streams ended by the remote don't need more credit
+	auto it = mStreams.find(id);
+	if (it == mStreams.end())
+		return;
+
+	auto &stream = it->second;
+	stream.consumedSinceUpdate += size;
+	if (stream.consumedSinceUpdate >= StreamWindowSize / 2) {
+		sendWindowUpdate(id, uint32_t(stream.consumedSinceUpdate));
+		stream.recvWindow += int64_t(stream.consumedSinceUpdate);
+		stream.consumedSinceUpdate = 0;
+	}
+}
+
+bool Http2Transport::sendFrame(uint8_t type, uint8_t flags, uint32_t id, const byte *payload,
+                               size_t size) {
+	auto message = make_message(FrameHeaderSize + size);
+	writeFrameHeader(message->data(), size, type, flags, id);
+	if (size > 0)
+		std::memcpy(message->data() + FrameHeaderSize, payload, size);
+
+	return outgoing(std::move(message));
+}
+
+bool Http2Transport::sendWindowUpdate(uint32_t id, uint32_t increment) {
+	byte payload[4];
+	writeUint32(payload, increment);
+	return sendFrame(WINDOW_UPDATE, 0, id, payload, 4);
+}
+
+bool Http2Transport::sendGoAway(ErrorCode code) {
+	byte payload[8];
+	writeUint32(payload, 0); // no server-initiated stream is ever processed
+	writeUint32(payload + 4, code);
+	return sendFrame(GOAWAY, 0, 0, payload, 8);
+}
+
+bool Http2Transport::flush(uint32_t id, Stream &stream) {
+	// Pending data is sent in DATA frames as long as both windows allow
+	while (!stream.pending.empty()) {
+		const int64_t window = std::min({stream.sendWindow, mSendWindow, int64_t(mMaxFrameSize)});
+		if (window <= 0)
+			return false;
+
+		auto frame = make_message(FrameHeaderSize);
+		frame->reserve(FrameHeaderSize + size_t(window));
+		while (!stream.pending.empty() && frame->size() - FrameHeaderSize < size_t(window)) {
+			const auto &message = stream.pending.front();
+			const size_t available = message->payloadSize() - stream.pendingOffset;
+			const size_t size =
+			    std::min(available, size_t(window) - (frame->size() - FrameHeaderSize));
+			const byte *data = message->payload() + stream.pendingOffset;
+			frame->insert(frame->end(), data, data + size);
+			stream.pendingOffset += size;
+			if (stream.pendingOffset == message->payloadSize()) {
+				stream.pending.pop_front();
+				stream.pendingOffset = 0;
+			}
+		}
+
+		const size_t size = frame->size() - FrameHeaderSize;
+		const bool end = stream.localEnded && stream.pending.empty();
+		writeFrameHeader(frame->data(), size, DATA, end ? FlagEndStream : 0, id);
+		stream.sendWindow -= int64_t(size);
+		mSendWindow -= int64_t(size);
+		outgoing(std::move(frame));
+		if (end)
+			return true;
+	}
+
+	if (stream.localEnded) {
+		sendFrame(DATA, FlagEndStream, id);
+		return true;
+	}
+
+	return false;
+}
+
+void Http2Transport::flushAll() {
+	auto it = mStreams.begin();
+	while (it != mStreams.end()) {
+		if (flush(it->first, it->second))
+			it = mStreams.erase(it);
+		else
+			++it;
+	}
+}
+
+Http2Stream::Http2Stream(shared_ptr<Http2Transport> connection, state_callback callback)
+    : Transport(nullptr, std::move(callback)), mConnection(std::move(connection)) {
+	PLOG_DEBUG << "Initializing HTTP/2 stream";
+}
+
+Http2Stream::~Http2Stream() { stop(); }
+
+void Http2Stream::start() {
+	Transport::start();
+	changeState(State::Connecting);
+}
+
+bool Http2Stream::stop() {
+	if (!Transport::stop())
+		return false;
+
+	if (uint32_t id = mId.exchange(0))
+		mConnection->closeStream(id);
+
+	return true;
+}
+
+bool Http2Stream::request(const http::HeaderList &headers, response_callback callback) {
+	mResponseCallback = std::move(callback);
+	uint32_t id = mConnection->openStream(shared_from_this(), headers);
+	if (id == 0)
+		return false;
+
+	PLOG_DEBUG << "Opened HTTP/2 stream " << id;
+	mId = id;
+	return true;
+}
+
+bool Http2Stream::send(message_ptr message) {
+	uint32_t id = mId;
+	return id != 0 && mConnection->sendData(id, {std::move(message)});
+}
+
+size_t Http2Stream::sendBatch(const std::vector<message_ptr> &messages) {
+	uint32_t id = mId;
+	return id != 0 && mConnection->sendData(id, messages) ? messages.size() : 0;
+}
+
+void Http2Stream::incoming(message_ptr message) {
+	if (!message) {
+		mId = 0; // already closed by the connection
+		recv(nullptr);
+		changeState(state() == State::Connected ? State::Disconnected : State::Failed);
+		return;
+	}
+
+	recv(std::move(message));
+}
+
+void Http2Stream::incomingResponse(const http::HeaderList &headers) {
+	if (mResponseCallback)
+		mResponseCallback(headers);
+
+	changeState(State::Connected);
+}
+
+} // namespace rtc::impl
+
+#endif
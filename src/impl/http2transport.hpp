@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_HTTP2_TRANSPORT_H
+#define RTC_IMPL_HTTP2_TRANSPORT_H
+
+#include "common.hpp"
+#include "hpack.hpp"
+#include "http.hpp"
+#include "transport.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace rtc::impl {
+
+class TlsTransport;
+class Http2Stream;
+
+// Client side of an HTTP/2 connection (RFC 9113) carrying streams opened with extended CONNECT
+// (RFC 8441), so many WebSockets share a single TLS connection. Streams have their own flow
+// control windows, sent data is queued per stream when a window is exhausted.
+class Http2Transport final : public Transport, public std::enable_shared_from_this<Http2Transport> {
+public:
+	Http2Transport(shared_ptr<TlsTransport> lower, state_callback callback);
+	~Http2Transport();
+
+	void start() override;
+	bool stop() override;
+	void incoming(message_ptr message) override;
+
+	// The connection is Connected once the server settings are received
+	bool isConnectProtocolEnabled() const; // the server accepts extended CONNECT
+	bool isGoingAway() const;              // no new stream can be opened
+	bool canOpenStream() const;            // below the concurrent streams limit
+
+	// For Http2Stream, openStream() returns the stream id, or 0 if no stream can be opened
+	uint32_t openStream(shared_ptr<Http2Stream> stream, const http::HeaderList &headers);
+	bool sendData(uint32_t id, const std::vector<message_ptr> &messages);
+	void closeStream(uint32_t id);
+
+private:
+	enum FrameType : uint8_t {
+		DATA = 0x0,
+		HEADERS = 0x1,
+		PRIORITY = 0x2,
+		RST_STREAM = 0x3,
+		SETTINGS = 0x4,
+		PUSH_PROMISE = 0x5,
+		PING = 0x6,
+		GOAWAY = 0x7,
+		WINDOW_UPDATE = 0x8,
+		CONTINUATION = 0x9,
+	};
+
+	enum ErrorCode : uint32_t {
+		NO_ERROR = 0x0,
+		PROTOCOL_ERROR = 0x1,
+		FLOW_CONTROL_ERROR = 0x3,
+		STREAM_CLOSED = 0x5,
+		FRAME_SIZE_ERROR = 0x6,
+		CANCEL = 0x8,
+		COMPRESSION_ERROR = 0x9,
+	};
+
+	struct Stream {
+		weak_ptr<Http2Stream> stream;
+		int64_t sendWindow;
+		int64_t recvWindow = StreamWindowSize;
+		size_t consumedSinceUpdate = 0;
+		std::deque<message_ptr> pending; // data waiting for the send window
+		size_t pendingOffset = 0;        // in the first pending message
+		bool responded = false;
+		bool localEnded = false; // END_STREAM is sent after pending data
+	};
+
+	// Events are dispatched to streams once the lock is released, as streams may send
+	struct Event {
+		shared_ptr<Http2Stream> stream;
+		optional<http::HeaderList> headers;
+		message_ptr data;  // nullptr with no headers for the end of the stream
+		uint32_t id = 0;   // stream credited once data is consumed
+		size_t credit = 0; // DATA frame size including padding
+	};
+
+	class ProtocolError : public std::runtime_error {
+	public:
+		ProtocolError(ErrorCode code, const string &what);
+		const ErrorCode code;
+	};
+
+	void processFrames(std::vector<Event> &events);
+	void processFrame(uint8_t type, uint8_t flags, uint32_t id, const byte *payload, size_t size,
+	                  std::vector<Event> &events);
+	void processHeaders(uint32_t id, bool endStream, std::vector<Event> &events);
+	void processSettings(const byte *payload, size_t size);
+	void endStream(uint32_t id, std::vector<Event> &events);
+	void failAll(std::vector<Event> &events);
+	void dispatch(std::vector<Event> &events);
+
+	// mMutex must be locked
+	bool isStreamAvailable() const;
+	void credit(uint32_t id, size_t size); // replenishes receive windows with consumed data
+	bool sendFrame(uint8_t type, uint8_t flags, uint32_t id, const byte *payload = nullptr,
+	               size_t size = 0);
+	bool sendWindowUpdate(uint32_t id, uint32_t increment);
+	bool sendGoAway(ErrorCode code);
+	bool flush(uint32_t id, Stream &stream); // returns true if the stream is ended
+	void flushAll();
+
+	static const size_t FrameHeaderSize = 9;
+	static const uint32_t DefaultWindowSize = 65535;
+	static const uint32_t StreamWindowSize = 1024 * 1024;           // advertised per stream
+	static const uint32_t ConnectionWindowSize = 16 * 1024 * 1024; // advertised for all streams
+	static const size_t MaxFrameSize = 16384;                      // advertised, the minimum
+
+	binary mBuffer;             // incoming bytes not yet parsed
+	binary mHeaderBlock;        // fragments of the current header block
+	uint32_t mHeaderStream = 0; // stream of the current header block, 0 if none
+	bool mHeaderEndStream = false;
+	hpack::Decoder mDecoder;
+	bool mSettingsReceived = false;
+
+	// Remote settings
+	bool mConnectProtocolEnabled = false;
+	uint32_t mInitialWindowSize = DefaultWindowSize;
+	size_t mMaxFrameSize = MaxFrameSize;
+	optional<uint32_t> mMaxConcurrentStreams;
+
+	std::unordered_map<uint32_t, Stream> mStreams;
+	uint32_t mNextStreamId = 1; // client-initiated streams are odd
+	int64_t mSendWindow = DefaultWindowSize;
+	int64_t mRecvWindow = ConnectionWindowSize;
+	size_t mConsumedSinceUpdate = 0;
+	bool mGoingAway = false;
+
+	mutable std::mutex mMutex;
+};
+
+// Stream of an Http2Transport, the transport of a WebSocket over HTTP/2
+class Http2Stream final : public Transport, public std::enable_shared_from_this<Http2Stream> {
+public:
+	using response_callback = std::function<void(const http::HeaderList &headers)>;
+
+	Http2Stream(shared_ptr<Http2Transport> connection, state_callback callback);
+	~Http2Stream();
+
+	void start() override;
+	bool stop() override;
+	bool send(message_ptr message) override;
+	size_t sendBatch(const std::vector<message_ptr> &messages) override; // one write for all
+
+	bool isClient() const { return true; }
+
+	// Opens the stream with the request, the callback is called with the response headers
+	// Returns false if the connection can't open more streams
+	bool request(const http::HeaderList &headers, response_callback callback);
+
+	// Called by Http2Transport, the message is nullptr when the remote ends the stream
+	void incoming(message_ptr message) override;
+	void incomingResponse(const http::HeaderList &headers);
+
+private:
+	const shared_ptr<Http2Transport> mConnection;
+	std::atomic<uint32_t> mId = 0;
+	response_callback mResponseCallback;
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
@@ -0,0 +1,732 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define RTC_LOG_SUBSYSTEM Ice
+
+#include "icetcpmux.hpp"
+#include "internals.hpp"
+#include "sha.hpp"
+#include "threadpool.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace rtc::impl {
+
+using namespace std::chrono_literals;
+using std::to_integer;
+
+// Fields of a parsed STUN message, pointing into the message
+struct StunMessage {
+	uint16_t type = 0;
+	const byte *transactionId = nullptr;
+	string_view username;
+	size_t integrityOffset = 0; // 0 if there is no MESSAGE-INTEGRITY
+	bool useCandidate = false;
+};
+
+namespace {
+
+const uint32_t StunMagicCookie = 0x2112A442;
+const uint32_t StunFingerprintXor = 0x5354554E;
+const size_t StunHeaderSize = 20;
+const size_t StunIntegritySize = 20; // HMAC-SHA1
+
+const uint16_t StunBindingRequest = 0x0001;
+const uint16_t StunBindingSuccess = 0x0101;
+const uint16_t StunBindingError = 0x0111;
+
+enum StunAttribute : uint16_t {
+	Username = 0x0006,
+	MessageIntegrity = 0x0008,
+	XorMappedAddress = 0x0020,
+	Priority = 0x0024,
+	UseCandidate = 0x0025,
+	Fingerprint = 0x8028,
+	IceControlled = 0x8029,
+	IceControlling = 0x802A,
+};
+
+// Priority of the peer reflexive candidate in our own requests
+const uint32_t PeerReflexivePriority = (110u << 24) | (((4u << 13) | 8191u) << 8) | 255u;
+
+const auto PendingTimeout = 10s; // for the first request on an incoming connection
+
+uint16_t Read16(const byte *p) {
+	return uint16_t(to_integer<uint16_t>(p[0]) << 8 | to_integer<uint16_t>(p[1]));
+}
+
+uint32_t Read32(const byte *p) { return uint32_t(Read16(p)) << 16 | Read16(p + 2); }
+
+void Write16(byte *p, uint16_t value) {
+	p[0] = byte(value >> 8);
+	p[1] = byte(value & 0xFF);
+}
+
+void Write32(byte *p, uint32_t value) {
+	Write16(p, uint16_t(value >> 16));
+	Write16(p + 2, uint16_t(value & 0xFFFF));
+}
+
+uint32_t Crc32(const byte *data, size_t size) {
+	static const auto table = [] {
+		std::array<uint32_t, 256> t = {};
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			t[i] = c;
+		}
+		return t;
+	}();
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ to_integer<uint32_t>(data[i])) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+bool IsStun(const message_ptr &message) {
+	return message->size() >= StunHeaderSize && (to_integer<uint8_t>((*message)[0]) & 0xC0) == 0 &&
+	       Read32(message->data() + 4) == StunMagicCookie;
+}
+
+bool ParseStun(const message_ptr &message, StunMessage &stun) {
+	if (!IsStun(message))
+		return false;
+
+	const byte *data = message->data();
+	const size_t size = message->size();
+	if (StunHeaderSize + Read16(data + 2) != size || size % 4 != 0)
+		return false;
+
+	stun.type = Read16(data);
+	stun.transactionId = data + 8;
+
+	size_t offset = StunHeaderSize;
+	while (offset + 4 <= size) {
+		const uint16_t type = Read16(data + offset);
+		const size_t length = Read16(data + offset + 2);
+		const byte *value = data + offset + 4;
+		if (offset + 4 + length > size)
+			return false;
+
+		if (type == Fingerprint) {
+			if (length != 4 || offset + 8 != size ||
+			    (Crc32(data, offset) ^ StunFingerprintXor) != Read32(value))
+				return false;
+
+		} else if (stun.integrityOffset == 0) { // attributes after MESSAGE-INTEGRITY are ignored
+			switch (type) {
+			case Username:
+				stun.username = string_view(reinterpret_cast<const char *>(value), length);
+				break;
+			case UseCandidate:
+				stun.useCandidate = true;
+				break;
+			case MessageIntegrity:
+				if (length != StunIntegritySize)
+					return false;
+				stun.integrityOffset = offset;
+				break;
+			default:
+				break;
+			}
+		}
+
+		offset += 4 + ((length + 3) & ~size_t(3));
+	}
+
+	return true;
+}
+
+bool CheckIntegrity(const message_ptr &message, const StunMessage &stun, const string &key) {
+	if (stun.integrityOffset == 0 || key.empty())
+		return false;
+
+	// The HMAC covers the message up to MESSAGE-INTEGRITY, with the length including it
+	binary buffer(message->begin(), message->begin() + stun.integrityOffset);
+	Write16(buffer.data() + 2, uint16_t(buffer.size() + 4 + StunIntegritySize - StunHeaderSize));
+	const auto hmac = HmacSha1(key, buffer.data(), buffer.size());
+	return std::equal(hmac.begin(), hmac.end(), message->begin() + stun.integrityOffset + 4);
+}
+
+binary StunHeader(uint16_t type, const byte *transactionId) {
+	binary buffer(StunHeaderSize);
+	buffer.reserve(128);
+	Write16(buffer.data(), type);
+	Write32(buffer.data() + 4, StunMagicCookie);
+	std::copy(transactionId, transactionId + 12, buffer.begin() + 8);
+	return buffer;
+}
+
+void AppendAttribute(binary &buffer, uint16_t type, const byte *value, size_t length) {
+	const size_t offset = buffer.size();
+	buffer.resize(offset + 4 + ((length + 3) & ~size_t(3)), byte(0));
+	Write16(buffer.data() + offset, type);
+	Write16(buffer.data() + offset + 2, uint16_t(length));
+	if (length > 0)
+		std::memcpy(buffer.data() + offset + 4, value, length);
+
+	Write16(buffer.data() + 2, uint16_t(buffer.size() - StunHeaderSize));
+}
+
+void AppendIntegrity(binary &buffer, const string &key) {
+	Write16(buffer.data() + 2, uint16_t(buffer.size() + 4 + StunIntegritySize - StunHeaderSize));
+	const auto hmac = HmacSha1(key, buffer.data(), buffer.size());
+	AppendAttribute(buffer, MessageIntegrity, hmac.data(), hmac.size());
+}
+
+void AppendFingerprint(binary &buffer) {
+	Write16(buffer.data() + 2, uint16_t(buffer.size() + 8 - StunHeaderSize));
+	byte value[4];
+	Write32(value, Crc32(buffer.data(), buffer.size()) ^ StunFingerprintXor);
+	AppendAttribute(buffer, Fingerprint, value, 4);
+}
+
+// The address is formatted as "host:port"
+bool AppendXorMappedAddress(binary &buffer, const string &address) {
+	const auto separator = address.rfind(':');
+	if (separator == string::npos)
+		return false;
+
+	const string host = address.substr(0, separator);
+	const auto port = uint16_t(std::strtoul(address.c_str() + separator + 1, nullptr, 10));
+
+	// The address is XORed with the magic cookie followed by the transaction ID
+	const byte *mask = buffer.data() + 4;
+	byte value[20] = {};
+	Write16(value + 2, uint16_t(port ^ (StunMagicCookie >> 16)));
+
+	byte addr[16];
+	size_t addrlen;
+	struct in6_addr addr6;
+	struct in_addr addr4;
+	if (::inet_pton(AF_INET6, host.c_str(), &addr6) == 1 && !IN6_IS_ADDR_V4MAPPED(&addr6)) {
+		std::memcpy(addr, &addr6, 16);
+		addrlen = 16;
+		value[1] = byte(0x02);
+	} else {
+		// Addresses on the dual-stack socket might be IPv4-mapped
+		if (::inet_pton(AF_INET6, host.c_str(), &addr6) == 1)
+			std::memcpy(addr, reinterpret_cast<const byte *>(&addr6) + 12, 4);
+		else if (::inet_pton(AF_INET, host.c_str(), &addr4) == 1)
+			std::memcpy(addr, &addr4, 4);
+		else
+			return false;
+
+		addrlen = 4;
+		value[1] = byte(0x01);
+	}
+
+	for (size_t i = 0; i < addrlen; ++i)
+		value[4 + i] = addr[i] ^ mask[i];
+
+	AppendAttribute(buffer, XorMappedAddress, value, 4 + addrlen);
+	return true;
+}
+
+} // namespace
+
+IceTcpConnection::IceTcpConnection(shared_ptr<TcpTransport> lower)
+    : Transport(lower), mTcpTransport(std::move(lower)) {
+
+	PLOG_VERBOSE << "Initializing ICE-TCP connection";
+}
+
+IceTcpConnection::~IceTcpConnection() { stop(); }
+
+void IceTcpConnection::start() {
+	Transport::start();
+	registerIncoming();
+
+	mTcpTransport->onStateChange([weak_this = weak_from_this()](State state) {
+		if (auto locked = weak_this.lock())
+			locked->changeState(state);
+	});
+	mTcpTransport->start();
+}
+
+bool IceTcpConnection::stop() {
+	if (!Transport::stop())
+		return false;
+
+	mTcpTransport->onStateChange(nullptr);
+	mTcpTransport->stop();
+	return true;
+}
+
+bool IceTcpConnection::send(message_ptr message) {
+	return message && sendBatch(std::vector<message_ptr>{std::move(message)}) == 1;
+}
+
+size_t IceTcpConnection::sendBatch(const std::vector<message_ptr> &messages) {
+	if (state() != State::Connected)
+		return 0;
+
+	// Length headers are separate messages, the TCP transport writes them with their payloads in
+	// a single vectored send
+	std::vector<message_ptr> frames;
+	frames.reserve(messages.size() * 2);
+	size_t count = 0;
+	for (const auto &message : messages) {
+		if (!message)
+			continue;
+
+		if (message->size() > MaxFrameSize) {
+			PLOG_WARNING << "Packet too large for ICE-TCP, size=" << message->size();
+			continue;
+		}
+
+		auto header = make_message(2);
+		Write16(header->data(), uint16_t(message->size()));
+		frames.push_back(std::move(header));
+		frames.push_back(message);
+		++count;
+	}
+
+	// Frames not written right away are queued by the TCP transport
+	outgoingBatch(frames);
+	return count;
+}
+
+string IceTcpConnection::remoteAddress() const { return mTcpTransport->remoteAddress(); }
+
+void IceTcpConnection::incoming(message_ptr message) {
+	if (!message) {
+		recv(nullptr); // disconnected
+		return;
+	}
+
+	auto self = weak_from_this().lock(); // the upper layer might drop the connection on recv
+	if (!self)
+		return;
+
+	// A single read usually holds many frames, only an incomplete frame is kept for the next read
+	binary buffer;
+	const byte *data = message->data();
+	size_t size = message->size();
+	if (!mPartial.empty()) {
+		buffer.swap(mPartial);
+		buffer.insert(buffer.end(), message->begin(), message->end());
+		data = buffer.data();
+		size = buffer.size();
+	}
+
+	size_t offset = 0;
+	while (size - offset >= 2) {
+		const size_t length = Read16(data + offset);
+		if (size - offset - 2 < length)
+			break;
+
+		const byte *frame = data + offset + 2;
+		offset += 2 + length;
+		recv(make_message(frame, frame + length));
+	}
+
+	mPartial.assign(data + offset, data + size);
+}
+
+shared_ptr<IceTcpMux> IceTcpMux::Acquire(uint16_t port) {
+	static std::mutex mutex;
+	static std::unordered_map<uint16_t, weak_ptr<IceTcpMux>> instances;
+
+	std::lock_guard lock(mutex);
+	auto &weakInstance = instances[port];
+	auto instance = weakInstance.lock();
+	if (!instance) {
+		instance = std::make_shared<IceTcpMux>(port);
+		instance->start();
+		weakInstance = instance;
+	}
+	return instance;
+}
+
+IceTcpMux::IceTcpMux(uint16_t port) : mServer(std::make_shared<TcpServer>(port)) {
+	PLOG_INFO << "Listening for ICE-TCP on port " << mServer->port();
+}
+
+IceTcpMux::~IceTcpMux() {
+	mServer->close();
+
+	std::unordered_set<shared_ptr<IceTcpConnection>> pending;
+	{
+		std::lock_guard lock(mMutex);
+		std::swap(pending, mPending);
+	}
+	for (const auto &connection : pending)
+		connection->stop();
+}
+
+void IceTcpMux::start() {
+	mServer->start(weak_bind(&IceTcpMux::accept, this, std::placeholders::_1));
+}
+
+uint16_t IceTcpMux::port() const { return mServer->port(); }
+
+void IceTcpMux::add(const string &localUfrag, accept_callback callback) {
+	std::lock_guard lock(mMutex);
+	mCallbacks[localUfrag] = std::move(callback);
+}
+
+void IceTcpMux::remove(const string &localUfrag) {
+	std::lock_guard lock(mMutex);
+	mCallbacks.erase(localUfrag);
+}
+
+void IceTcpMux::accept(shared_ptr<TcpTransport> transport) {
+	auto connection = std::make_shared<IceTcpConnection>(std::move(transport));
+	{
+		std::lock_guard lock(mMutex);
+		if (mPending.size() >= MaxPendingConnections) {
+			PLOG_WARNING << "Too many pending ICE-TCP connections, refusing connection";
+			return;
+		}
+		mPending.insert(connection);
+	}
+
+	weak_ptr<IceTcpConnection> weakConnection = connection;
+	connection->onRecv([weak_this = weak_from_this(), weakConnection](message_ptr message) {
+		if (auto locked = weak_this.lock())
+			locked->process(weakConnection, std::move(message));
+	});
+	connection->start();
+
+	ThreadPool::Instance().scheduleTimer(PendingTimeout, [weak_this = weak_from_this(),
+	                                                      weakConnection]() {
+		if (auto locked = weak_this.lock())
+			if (auto connection = weakConnection.lock())
+				locked->drop(connection);
+	});
+}
+
+void IceTcpMux::process(weak_ptr<IceTcpConnection> weakConnection, message_ptr message) {
+	auto connection = weakConnection.lock();
+	if (!connection)
+		return;
+
+	StunMessage stun;
+	if (!message || !ParseStun(message, stun) || stun.type != StunBindingRequest) {
+		PLOG_DEBUG << "Dropping ICE-TCP connection without binding request";
+		drop(connection);
+		return;
+	}
+
+	// USERNAME is "localUfrag:remoteUfrag" from our side
+	const string localUfrag(stun.username.substr(0, stun.username.find(':')));
+	accept_callback callback;
+	{
+		std::lock_guard lock(mMutex);
+		if (auto it = mCallbacks.find(localUfrag); it != mCallbacks.end())
+			if (mPending.erase(connection))
+				callback = it->second;
+	}
+
+	if (!callback) {
+		PLOG_DEBUG << "No ICE-TCP session for ufrag \"" << localUfrag << "\"";
+		drop(connection);
+		return;
+	}
+
+	callback(std::move(connection), std::move(message));
+}
+
+void IceTcpMux::drop(const shared_ptr<IceTcpConnection> &connection) {
+	{
+		std::lock_guard lock(mMutex);
+		if (!mPending.erase(connection))
+			return;
+	}
+	connection->stop();
+}
+
+IceTcpSession::IceTcpSession(uint16_t port, string localUfrag, string localPwd)
+    : mLocalUfrag(std::move(localUfrag)), mLocalPwd(std::move(localPwd)),
+      mMux(IceTcpMux::Acquire(port)), mGenerator(std::random_device{}()),
+      mTieBreaker(mGenerator()) {}
+
+IceTcpSession::~IceTcpSession() { stop(); }
+
+void IceTcpSession::start(recv_callback recvCallback, selected_callback selectedCallback) {
+	mRecvCallback = std::move(recvCallback);
+	mSelectedCallback = std::move(selectedCallback);
+
+	mMux->add(mLocalUfrag, [weak_this = weak_from_this()](shared_ptr<IceTcpConnection> connection,
+	                                                      message_ptr message) {
+		if (auto locked = weak_this.lock())
+			locked->accept(std::move(connection), std::move(message));
+	});
+}
+
+void IceTcpSession::stop() {
+	mMux->remove(mLocalUfrag);
+	mRecvCallback = nullptr;
+	mSelectedCallback = nullptr;
+
+	std::vector<Entry> entries;
+	{
+		std::lock_guard lock(mMutex);
+		std::swap(entries, mEntries);
+		mSelected.reset();
+	}
+	for (const auto &entry : entries)
+		entry.connection->stop();
+}
+
+void IceTcpSession::setRemoteCredentials(string ufrag, string pwd, bool controlling) {
+	std::lock_guard lock(mMutex);
+	mRemoteUfrag = std::move(ufrag);
+	mRemotePwd = std::move(pwd);
+	mControlling = controlling;
+}
+
+uint16_t IceTcpSession::port() const { return mMux->port(); }
+
+bool IceTcpSession::isSelected() const {
+	std::lock_guard lock(mMutex);
+	return bool(mSelected);
+}
+
+optional<string> IceTcpSession::remoteAddress() const {
+	std::lock_guard lock(mMutex);
+	return mSelected ? std::make_optional(mSelected->remoteAddress()) : nullopt;
+}
+
+bool IceTcpSession::send(message_ptr message) {
+	std::unique_lock lock(mMutex);
+	auto selected = mSelected;
+	lock.unlock();
+	return selected && selected->send(std::move(message));
+}
+
+size_t IceTcpSession::sendBatch(const std::vector<message_ptr> &messages) {
+	std::unique_lock lock(mMutex);
+	auto selected = mSelected;
+	lock.unlock();
+	return selected ? selected->sendBatch(messages) : 0;
+}
+
+void IceTcpSession::accept(shared_ptr<IceTcpConnection> connection, message_ptr message) {
+	// The connection is only kept if its first request is authenticated
+	weak_ptr<IceTcpConnection> weakConnection = connection;
+	connection->onRecv([weak_this = weak_from_this(), weakConnection](message_ptr message) {
+		if (auto locked = weak_this.lock())
+			locked->process(weakConnection, std::move(message));
+	});
+	process(weakConnection, std::move(message));
+}
+
+void IceTcpSession::process(weak_ptr<IceTcpConnection> weakConnection, message_ptr message) {
+	auto connection = weakConnection.lock();
+	if (!connection)
+		return;
+
+	if (!message) {
+		close(std::move(connection));
+		return;
+	}
+
+	if (IsStun(message)) {
+		StunMessage stun;
+		if (!ParseStun(message, stun)) {
+			PLOG_DEBUG << "Ignoring invalid STUN message on ICE-TCP";
+			return;
+		}
+
+		if (stun.type == StunBindingRequest)
+			processRequest(std::move(connection), std::move(message), stun);
+		else if (stun.type == StunBindingSuccess || stun.type == StunBindingError)
+			processResponse(std::move(connection), std::move(message), stun);
+
+		return;
+	}
+
+	// Other packets are only accepted from authenticated connections
+	{
+		std::lock_guard lock(mMutex);
+		if (!findEntry(connection))
+			return;
+	}
+
+	mRecvCallback(std::move(message));
+}
+
+void IceTcpSession::processRequest(shared_ptr<IceTcpConnection> connection, message_ptr message,
+                                   const StunMessage &stun) {
+	// USERNAME is "localUfrag:remoteUfrag" from our side
+	const auto separator = stun.username.find(':');
+	if (separator == string_view::npos || stun.username.substr(0, separator) != mLocalUfrag ||
+	    !CheckIntegrity(message, stun, mLocalPwd)) {
+		PLOG_DEBUG << "Ignoring unauthenticated ICE-TCP binding request";
+		return;
+	}
+
+	message_ptr nomination;
+	bool controlling;
+	{
+		std::lock_guard lock(mMutex);
+		if (!mRemoteUfrag.empty() && stun.username.substr(separator + 1) != mRemoteUfrag) {
+			PLOG_DEBUG << "Ignoring ICE-TCP binding request with unexpected remote ufrag";
+			return;
+		}
+
+		Entry *entry = findEntry(connection);
+		if (!entry) {
+			if (mEntries.size() >= MaxConnections) {
+				PLOG_WARNING << "Too many ICE-TCP connections, ignoring binding request";
+				return;
+			}
+			PLOG_DEBUG << "New ICE-TCP connection from " << connection->remoteAddress();
+			mEntries.push_back(Entry{connection, nullopt});
+			entry = &mEntries.back();
+		}
+
+		// As controlling agent, nominate the first connection that is checked once the remote
+		// credentials are known
+		controlling = mControlling;
+		if (controlling && !mSelected && !entry->nomination && !mRemotePwd.empty()) {
+			TransactionId id;
+			for (size_t i = 0; i < id.size(); ++i)
+				id[i] = byte(mGenerator() & 0xFF);
+
+			entry->nomination = id;
+
+			binary request = StunHeader(StunBindingRequest, id.data());
+			const string username = mRemoteUfrag + ':' + mLocalUfrag;
+			AppendAttribute(request, Username, reinterpret_cast<const byte *>(username.data()),
+			                username.size());
+			byte priority[4];
+			Write32(priority, PeerReflexivePriority);
+			AppendAttribute(request, Priority, priority, 4);
+			byte tieBreaker[8];
+			Write32(tieBreaker, uint32_t(mTieBreaker >> 32));
+			Write32(tieBreaker + 4, uint32_t(mTieBreaker & 0xFFFFFFFF));
+			AppendAttribute(request, IceControlling, tieBreaker, 8);
+			AppendAttribute(request, UseCandidate, nullptr, 0);
+			AppendIntegrity(request, mRemotePwd);
+			AppendFingerprint(request);
+			nomination = make_message(std::move(request));
+		}
+	}
+
+	binary response = StunHeader(StunBindingSuccess, stun.transactionId);
+	if (!AppendXorMappedAddress(response, connection->remoteAddress())) {
+		PLOG_WARNING << "Unable to map ICE-TCP remote address " << connection->remoteAddress();
+		return;
+	}
+	AppendIntegrity(response, mLocalPwd);
+	AppendFingerprint(response);
+	connection->send(make_message(std::move(response)));
+
+	if (nomination) {
+		PLOG_DEBUG << "Nominating ICE-TCP connection";
+		connection->send(std::move(nomination));
+	}
+
+	if (!controlling && stun.useCandidate)
+		select(std::move(connection));
+}
+
+void IceTcpSession::processResponse(shared_ptr<IceTcpConnection> connection, message_ptr message,
+                                    const StunMessage &stun) {
+	string remotePwd;
+	{
+		std::lock_guard lock(mMutex);
+		Entry *entry = findEntry(connection);
+		if (!entry || !entry->nomination ||
+		    !std::equal(entry->nomination->begin(), entry->nomination->end(), stun.transactionId))
+			return;
+
+		// On error, the next request from the remote agent triggers a new nomination
+		entry->nomination.reset();
+		remotePwd = mRemotePwd;
+	}
+
+	if (stun.type != StunBindingSuccess) {
+		PLOG_DEBUG << "ICE-TCP nomination failed";
+		return;
+	}
+
+	if (!CheckIntegrity(message, stun, remotePwd)) {
+		PLOG_DEBUG << "Ignoring unauthenticated ICE-TCP binding response";
+		return;
+	}
+
+	select(std::move(connection));
+}
+
+void IceTcpSession::select(shared_ptr<IceTcpConnection> connection) {
+	{
+		std::lock_guard lock(mMutex);
+		if (mSelected == connection || !findEntry(connection))
+			return;
+
+		const bool wasSelected = bool(mSelected);
+		mSelected = connection;
+		if (wasSelected)
+			return;
+	}
+
+	PLOG_INFO << "ICE-TCP connection selected with " << connection->remoteAddress();
+	mSelectedCallback(true);
+}
+
+void IceTcpSession::close(shared_ptr<IceTcpConnection> connection) {
+	bool wasSelected;
+	{
+		std::lock_guard lock(mMutex);
+		auto it = std::find_if(mEntries.begin(), mEntries.end(),
+		                       [&](const Entry &entry) { return entry.connection == connection; });
+		if (it == mEntries.end())
+			return;
+
+		mEntries.erase(it);
+		wasSelected = mSelected == connection;
+		if (wasSelected)
+			mSelected.reset();
+	}
+
+	connection->stop();
+
+	if (wasSelected) {
+		PLOG_INFO << "ICE-TCP selected connection closed";
+		mSelectedCallback(false);
+	}
+}
+
+IceTcpSession::Entry *IceTcpSession::findEntry(const shared_ptr<IceTcpConnection> &connection) {
+	auto it = std::find_if(mEntries.begin(), mEntries.end(),
+	                       [&](const Entry &entry) { return entry.connection == connection; });
+	return it != mEntries.end() ? &*it : nullptr;
+}
+
+} // namespace rtc::impl
+
+#endif
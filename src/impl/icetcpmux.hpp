@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_ICE_TCP_MUX_H
+#define RTC_IMPL_ICE_TCP_MUX_H
+
+#include "common.hpp"
+#include "tcpserver.hpp"
+#include "tcptransport.hpp"
+#include "transport.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace rtc::impl {
+
+struct StunMessage;
+
+// ICE-TCP connection with RFC 4571 framing, each packet is prefixed with its 16-bit length
+class IceTcpConnection final : public Transport,
+                               public std::enable_shared_from_this<IceTcpConnection> {
+public:
+	static constexpr size_t MaxFrameSize = 65535;
+
+	IceTcpConnection(shared_ptr<TcpTransport> lower);
+	~IceTcpConnection();
+
+	void start() override;
+	bool stop() override;
+	bool send(message_ptr message) override; // false if dropped
+	size_t sendBatch(const std::vector<message_ptr> &messages) override;
+
+	string remoteAddress() const;
+
+private:
+	void incoming(message_ptr message) override;
+
+	const shared_ptr<TcpTransport> mTcpTransport;
+	binary mPartial; // incomplete frame at the end of the previous read
+};
+
+// Passive ICE-TCP listener shared by the sessions on the same port, incoming connections are
+// demultiplexed by the local ufrag in the USERNAME of their first STUN request
+class IceTcpMux final : public std::enable_shared_from_this<IceTcpMux> {
+public:
+	using accept_callback = std::function<void(shared_ptr<IceTcpConnection>, message_ptr)>;
+
+	// The listener is shared while in use, port 0 means any port
+	static shared_ptr<IceTcpMux> Acquire(uint16_t port);
+
+	IceTcpMux(uint16_t port);
+	~IceTcpMux();
+
+	uint16_t port() const;
+
+	// The callback receives the connection with its first request
+	void add(const string &localUfrag, accept_callback callback);
+	void remove(const string &localUfrag);
+
+private:
+	static constexpr size_t MaxPendingConnections = 1024;
+
+	void start();
+	void accept(shared_ptr<TcpTransport> transport);
+	void process(weak_ptr<IceTcpConnection> weakConnection, message_ptr message);
+	void drop(const shared_ptr<IceTcpConnection> &connection);
+
+	const shared_ptr<TcpServer> mServer;
+	std::mutex mMutex;
+	std::unordered_map<string, accept_callback> mCallbacks;
+	std::unordered_set<shared_ptr<IceTcpConnection>> mPending; // waiting for the first request
+};
+
+// Passive ICE-TCP endpoint of an ICE agent: connectivity checks received on the shared listener
+// are answered with the local credentials, and the nominated connection is selected
+class IceTcpSession final : public std::enable_shared_from_this<IceTcpSession> {
+public:
+	using recv_callback = std::function<void(message_ptr)>;
+	using selected_callback = std::function<void(bool selected)>;
+
+	IceTcpSession(uint16_t port, string localUfrag, string localPwd);
+	~IceTcpSession();
+
+	void start(recv_callback recvCallback, selected_callback selectedCallback);
+	void stop();
+
+	// The controlling agent nominates connections itself
+	void setRemoteCredentials(string ufrag, string pwd, bool controlling);
+
+	uint16_t port() const;
+	bool isSelected() const;
+	optional<string> remoteAddress() const;
+
+	bool send(message_ptr message);
+	size_t sendBatch(const std::vector<message_ptr> &messages);
+
+private:
+	static constexpr size_t MaxConnections = 8; // authenticated connections per session
+
+	using TransactionId = std::array<byte, 12>;
+
+	struct Entry {
+		shared_ptr<IceTcpConnection> connection;
+		optional<TransactionId> nomination; // pending request sent with USE-CANDIDATE
+	};
+
+	void accept(shared_ptr<IceTcpConnection> connection, message_ptr message);
+	void process(weak_ptr<IceTcpConnection> weakConnection, message_ptr message);
+	void processRequest(shared_ptr<IceTcpConnection> connection, message_ptr message,
+	                    const StunMessage &stun);
+	void processResponse(shared_ptr<IceTcpConnection> connection, message_ptr message,
+	                     const StunMessage &stun);
+	void select(shared_ptr<IceTcpConnection> connection);
+	void close(shared_ptr<IceTcpConnection> connection);
+
+	Entry *findEntry(const shared_ptr<IceTcpConnection> &connection); // mMutex must be locked
+
+	const string mLocalUfrag, mLocalPwd;
+	const shared_ptr<IceTcpMux> mMux;
+	synchronized_callback<message_ptr> mRecvCallback;
+	synchronized_callback<bool> mSelectedCallback;
+
+	mutable std::mutex mMutex;
+	string mRemoteUfrag, mRemotePwd;
+	bool mControlling = false;
+	std::mt19937_64 mGenerator; // transaction IDs and tie-breaker
+	uint64_t mTieBreaker;
+	std::vector<Entry> mEntries;
+	shared_ptr<IceTcpConnection> mSelected;
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
@@ -16,14 +16,23 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM Ice
+
 #include "icetransport.hpp"
 #include "configuration.hpp"
+#include "dnscache.hpp"
+#include "egressscheduler.hpp"
 #include "internals.hpp"
+#include "threadregistry.hpp"
 #include "transport.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <thread>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -37,6 +46,13 @@
 
 #include <sys/types.h>
 
+#if USE_NICE && defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <netinet/udp.h> // for UDP_SEGMENT
+#include <sys/uio.h>
+#endif
+
 using namespace std::chrono_literals;
 using std::chrono::system_clock;
 
@@ -46,23 +62,36 @@ namespace rtc::impl {
 
 #define MAX_TURN_SERVERS_COUNT 2
 
-IceTransport::IceTransport(const Configuration &config, candidate_callback candidateCallback,
+IceTransport::IceTransport(without_agent_t, const Configuration &config,
+                           candidate_callback candidateCallback,
                            state_callback stateChangeCallback,
                            gathering_state_callback gatheringStateChangeCallback)
-    : Transport(nullptr, std::move(stateChangeCallback)), mRole(Description::Role::ActPass),
-      mMid("0"), mGatheringState(GatheringState::New),
+    : Transport(nullptr, std::move(stateChangeCallback)), mConfig(config),
+      mRole(Description::Role::ActPass), mMid("0"), mGatheringState(GatheringState::New),
       mCandidateCallback(std::move(candidateCallback)),
       mGatheringStateChangeCallback(std::move(gatheringStateChangeCallback)),
       mAgent(nullptr, nullptr) {
+	mScheduler = createScheduler();
+}
+
+IceTransport::IceTransport(const Configuration &config, candidate_callback candidateCallback,
+                           state_callback stateChangeCallback,
+                           gathering_state_callback gatheringStateChangeCallback)
+    : IceTransport(without_agent_t{}, config, std::move(candidateCallback),
+                   std::move(stateChangeCallback), std::move(gatheringStateChangeCallback)) {
 
 	PLOG_DEBUG << "Initializing ICE transport (libjuice)";
+#if !RTC_ENABLE_WEBSOCKET
 	if (config.enableIceTcp) {
-		PLOG_WARNING << "ICE-TCP is not supported with libjuice";
+		PLOG_WARNING << "ICE-TCP requires WebSocket support with libjuice";
+	}
+#endif
+	if (config.enableUdpSegmentation) {
+		PLOG_WARNING << "UDP segmentation offload is not supported with libjuice";
 	}
 
 	juice_log_level_t level;
-	auto logger = plog::get();
-	switch (logger ? logger->getMaxSeverity() : plog::none) {
+	switch (MaxLogSeverity(LogSubsystem::Ice)) {
 	case plog::none:
 		level = JUICE_LOG_LEVEL_NONE;
 		break;
@@ -86,6 +115,15 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 	juice_set_log_handler(IceTransport::LogCallback);
 	juice_set_log_level(level);
 
+	mAgent = createAgent();
+	mCurrentAgent = mAgent.get();
+
+#if RTC_ENABLE_WEBSOCKET
+	mTcpSession = createTcpSession(mAgent.get());
+#endif
+}
+
+IceTransport::agent_ptr IceTransport::createAgent() {
 	juice_config_t jconfig = {};
 	jconfig.cb_state_changed = IceTransport::StateChangeCallback;
 	jconfig.cb_candidate = IceTransport::CandidateCallback;
@@ -93,17 +131,39 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 	jconfig.cb_recv = IceTransport::RecvCallback;
 	jconfig.user_ptr = this;
 
+	// Mux
+	if (mConfig.enableIceUdpMux) {
+		// All agents share one socket, incoming STUN is demultiplexed by ICE ufrag and other
+		// datagrams by remote address
+		PLOG_DEBUG << "Enabling ICE UDP mux";
+		jconfig.concurrency_mode = JUICE_CONCURRENCY_MODE_MUX;
+	} else {
+		jconfig.concurrency_mode = JUICE_CONCURRENCY_MODE_POLL;
+	}
+
 	// Randomize servers order
-	std::vector<IceServer> servers = config.iceServers;
+	std::vector<IceServer> servers = mConfig.iceServers;
 	auto seed = static_cast<unsigned int>(system_clock::now().time_since_epoch().count());
 	std::shuffle(servers.begin(), servers.end(), std::default_random_engine(seed));
 
+	// Substitute cached addresses so the agent doesn't block on DNS, other hostnames are
+	// resolved in the background for the next connections
+	auto useCachedAddress = [](IceServer &server) {
+		if (auto addresses = DnsCache::Instance().lookup(server.hostname);
+		    addresses && !addresses->empty()) {
+			PLOG_VERBOSE << "Using cached address " << addresses->front() << " for \""
+			             << server.hostname << "\"";
+			server.hostname = addresses->front();
+		}
+	};
+
 	// Pick a STUN server
 	for (auto &server : servers) {
 		if (!server.hostname.empty() && server.type == IceServer::Type::Stun) {
 			if (server.port == 0)
 				server.port = 3478; // STUN UDP port
 			PLOG_INFO << "Using STUN server \"" << server.hostname << ":" << server.port << "\"";
+			useCachedAddress(server);
 			jconfig.stun_server_host = server.hostname.c_str();
 			jconfig.stun_server_port = server.port;
 			break;
@@ -114,12 +174,20 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 	std::memset(turn_servers, 0, sizeof(turn_servers));
 
 	// Add TURN servers
+	// libjuice binds a TURN channel for each peer, so relayed data is sent as ChannelData with a
+	// 4-byte header instead of Send indications
 	int k = 0;
 	for (auto &server : servers) {
 		if (!server.hostname.empty() && server.type == IceServer::Type::Turn) {
 			if (server.port == 0)
 				server.port = 3478; // TURN UDP port
+			if (server.relayType != IceServer::RelayType::TurnUdp) {
+				// Servers commonly listen for UDP on the same port, so the server is still used
+				PLOG_WARNING << "TURN over TCP or TLS is not supported with libjuice, falling back "
+				                "to UDP";
+			}
 			PLOG_INFO << "Using TURN server \"" << server.hostname << ":" << server.port << "\"";
+			useCachedAddress(server);
 			turn_servers[k].host = server.hostname.c_str();
 			turn_servers[k].username = server.username.c_str();
 			turn_servers[k].password = server.password.c_str();
@@ -132,21 +200,141 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 	jconfig.turn_servers_count = k;
 
 	// Bind address
-	if (config.bindAddress) {
-		jconfig.bind_address = config.bindAddress->c_str();
+	if (mConfig.bindAddress) {
+		jconfig.bind_address = mConfig.bindAddress->c_str();
 	}
 
 	// Port range
-	if (config.portRangeBegin > 1024 ||
-	    (config.portRangeEnd != 0 && config.portRangeEnd != 65535)) {
-		jconfig.local_port_range_begin = config.portRangeBegin;
-		jconfig.local_port_range_end = config.portRangeEnd;
+	const bool portRangeSet = mConfig.portRangeBegin > 1024 ||
+	                          (mConfig.portRangeEnd != 0 && mConfig.portRangeEnd != 65535);
+	if (mConfig.enableIceUdpMux && portRangeSet &&
+	    mConfig.portRangeEnd > mConfig.portRangeBegin) {
+		// libjuice runs a shared socket with its own thread for each mux port, so spread
+		// connections over one port per core, each thread then receives and decrypts its own
+		// connections from end to end. The default range is not used, as fixed ports from 1024
+		// could collide with other services, a single mux port is used instead.
+		static std::atomic<unsigned int> nextMuxPort = 0; // shared by all connections
+		const unsigned int count =
+		    std::min(unsigned(mConfig.portRangeEnd - mConfig.portRangeBegin) + 1,
+		             std::max(std::thread::hardware_concurrency(), 1u));
+		const auto port = static_cast<uint16_t>(mConfig.portRangeBegin + nextMuxPort++ % count);
+		PLOG_DEBUG << "Using ICE UDP mux port " << port;
+		jconfig.local_port_range_begin = port;
+		jconfig.local_port_range_end = port;
+
+	} else if (portRangeSet) {
+		jconfig.local_port_range_begin = mConfig.portRangeBegin;
+		jconfig.local_port_range_end = mConfig.portRangeEnd;
 	}
 
 	// Create agent
-	mAgent = decltype(mAgent)(juice_create(&jconfig), juice_destroy);
-	if (!mAgent)
+	auto agent = agent_ptr(juice_create(&jconfig), juice_destroy);
+	if (!agent)
 		throw std::runtime_error("Failed to create the ICE agent");
+
+	return agent;
+}
+
+#if RTC_ENABLE_WEBSOCKET
+
+shared_ptr<IceTcpSession> IceTransport::createTcpSession(juice_agent_t *agent) {
+	mTcpPort = 0;
+	mTcpSelected = false;
+	if (!mConfig.enableIceTcp)
+		return nullptr;
+
+	// libjuice only does UDP, connectivity checks on passive TCP candidates are answered on a
+	// listener shared by all transports, with the same ICE credentials as the agent
+	char sdp[JUICE_MAX_SDP_STRING_LEN];
+	if (juice_get_local_description(agent, sdp, JUICE_MAX_SDP_STRING_LEN) < 0)
+		throw std::runtime_error("Failed to generate local SDP");
+
+	Description description{string(sdp)};
+	auto ufrag = description.iceUfrag();
+	auto pwd = description.icePwd();
+	if (!ufrag || !pwd)
+		throw std::runtime_error("Missing local ICE credentials");
+
+	shared_ptr<IceTcpSession> session;
+	try {
+		session = std::make_shared<IceTcpSession>(mConfig.iceTcpPort.value_or(0), std::move(*ufrag),
+		                                          std::move(*pwd));
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "ICE-TCP disabled: " << e.what();
+		return nullptr;
+	}
+
+	session->start(
+	    [this](message_ptr message) {
+		    PLOG_VERBOSE << "Incoming size=" << message->size() << " (TCP)";
+		    recordReceived(message->size());
+		    message->arrivalTime = std::chrono::steady_clock::now();
+		    incoming(std::move(message));
+	    },
+	    [this](bool selected) {
+		    mTcpSelected = selected;
+		    updateState();
+	    });
+
+	mTcpPort = session->port();
+	return session;
+}
+
+optional<Candidate> IceTransport::makeTcpCandidate(const string &candidate) const {
+	const uint16_t port = mTcpPort;
+	if (port == 0)
+		return nullopt;
+
+	Candidate udp(candidate, mMid);
+	if (!udp.resolve(Candidate::ResolveMode::Simple) || udp.type() != Candidate::Type::Host ||
+	    udp.transportType() != Candidate::TransportType::Udp)
+		return nullopt;
+
+	// RFC 6544: the type preference is below UDP host and server reflexive candidates, and the
+	// local preference includes the passive direction preference
+	const uint32_t priority = (80u << 24) | (((4u << 13) | 8191u) << 8) | 255u;
+
+	const auto begin = candidate.find(':') + 1;
+	const string foundation = "tcp" + candidate.substr(begin, candidate.find(' ', begin) - begin);
+	return Candidate("candidate:" + foundation + " 1 TCP " + std::to_string(priority) + " " +
+	                     *udp.address() + " " + std::to_string(port) + " typ host tcptype passive",
+	                 mMid);
+}
+
+bool IceTransport::useTcp() const {
+	const unsigned int state = mAgentState;
+	return mTcpSelected && state != JUICE_STATE_CONNECTED && state != JUICE_STATE_COMPLETED;
+}
+
+#endif
+
+void IceTransport::restart() {
+	PLOG_INFO << "Restarting ICE";
+
+	// libjuice can't restart an agent, so a new one with fresh credentials replaces it, the upper
+	// transports keep running on top of this one
+	auto agent = createAgent();
+#if RTC_ENABLE_WEBSOCKET
+	auto tcpSession = createTcpSession(agent.get());
+#endif
+	{
+		std::unique_lock lock(mAgentMutex);
+		mCurrentAgent = agent.get();
+		std::swap(mAgent, agent);
+#if RTC_ENABLE_WEBSOCKET
+		std::swap(mTcpSession, tcpSession);
+#endif
+	}
+	agent.reset(); // callbacks from the previous agent are ignored until it is destroyed
+#if RTC_ENABLE_WEBSOCKET
+	if (tcpSession)
+		tcpSession->stop();
+#endif
+
+	mAgentState = JUICE_STATE_DISCONNECTED;
+	mGatheringState = GatheringState::New;
+	resetInterleaving();
+	changeState(State::Connecting);
 }
 
 IceTransport::~IceTransport() {
@@ -154,11 +342,25 @@ IceTransport::~IceTransport() {
 	mAgent.reset();
 }
 
-bool IceTransport::stop() { return Transport::stop(); }
+bool IceTransport::stop() {
+	if (mScheduler)
+		mScheduler->stop();
+
+#if RTC_ENABLE_WEBSOCKET
+	std::shared_lock lock(mAgentMutex);
+	auto tcpSession = mTcpSession;
+	lock.unlock(); // stopping waits for callbacks in progress, which might send
+
+	if (tcpSession)
+		tcpSession->stop();
+#endif
+	return Transport::stop();
+}
 
 Description::Role IceTransport::role() const { return mRole; }
 
 Description IceTransport::getLocalDescription(Description::Type type) const {
+	std::shared_lock lock(mAgentMutex);
 	char sdp[JUICE_MAX_SDP_STRING_LEN];
 	if (juice_get_local_description(mAgent.get(), sdp, JUICE_MAX_SDP_STRING_LEN) < 0)
 		throw std::runtime_error("Failed to generate local SDP");
@@ -178,9 +380,19 @@ void IceTransport::setRemoteDescription(const Description &description) {
 		throw std::logic_error("Incompatible roles with remote description");
 
 	mMid = description.bundleMid();
+	std::shared_lock lock(mAgentMutex);
 	if (juice_set_remote_description(mAgent.get(),
 	                                 description.generateApplicationSdp("\r\n").c_str()) < 0)
 		throw std::runtime_error("Failed to parse ICE settings from remote SDP");
+
+#if RTC_ENABLE_WEBSOCKET
+	// The agent receiving the answer is controlling
+	auto ufrag = description.iceUfrag();
+	auto pwd = description.icePwd();
+	if (mTcpSession && ufrag && pwd)
+		mTcpSession->setRemoteCredentials(std::move(*ufrag), std::move(*pwd),
+		                                  description.type() == Description::Type::Answer);
+#endif
 }
 
 bool IceTransport::addRemoteCandidate(const Candidate &candidate) {
@@ -188,21 +400,20 @@ bool IceTransport::addRemoteCandidate(const Candidate &candidate) {
 	if (!candidate.isResolved())
 		return false;
 
-	return juice_add_remote_candidate(mAgent.get(), string(candidate).c_str()) >= 0;
+	const string sdp(interleaveFamilies(candidate));
+	std::shared_lock lock(mAgentMutex);
+	return juice_add_remote_candidate(mAgent.get(), sdp.c_str()) >= 0;
 }
 
-void IceTransport::gatherLocalCandidates(string mid) {
-	mMid = std::move(mid);
-
-	// Change state now as candidates calls can be synchronous
-	changeGatheringState(GatheringState::InProgress);
-
+void IceTransport::startGathering() {
+	std::shared_lock lock(mAgentMutex);
 	if (juice_gather_candidates(mAgent.get()) < 0) {
 		throw std::runtime_error("Failed to gather local ICE candidates");
 	}
 }
 
 optional<string> IceTransport::getLocalAddress() const {
+	std::shared_lock lock(mAgentMutex);
 	char str[JUICE_MAX_ADDRESS_STRING_LEN];
 	if (juice_get_selected_addresses(mAgent.get(), str, JUICE_MAX_ADDRESS_STRING_LEN, NULL, 0) ==
 	    0) {
@@ -211,6 +422,11 @@ optional<string> IceTransport::getLocalAddress() const {
 	return nullopt;
 }
 optional<string> IceTransport::getRemoteAddress() const {
+	std::shared_lock lock(mAgentMutex);
+#if RTC_ENABLE_WEBSOCKET
+	if (mTcpSession && useTcp())
+		return mTcpSession->remoteAddress();
+#endif
 	char str[JUICE_MAX_ADDRESS_STRING_LEN];
 	if (juice_get_selected_addresses(mAgent.get(), NULL, 0, str, JUICE_MAX_ADDRESS_STRING_LEN) ==
 	    0) {
@@ -222,6 +438,7 @@ optional<string> IceTransport::getRemoteAddress() const {
 bool IceTransport::getSelectedCandidatePair(Candidate *local, Candidate *remote) {
 	char sdpLocal[JUICE_MAX_CANDIDATE_SDP_STRING_LEN];
 	char sdpRemote[JUICE_MAX_CANDIDATE_SDP_STRING_LEN];
+	std::shared_lock lock(mAgentMutex);
 	if (juice_get_selected_candidates(mAgent.get(), sdpLocal, JUICE_MAX_CANDIDATE_SDP_STRING_LEN,
 	                                  sdpRemote, JUICE_MAX_CANDIDATE_SDP_STRING_LEN) == 0) {
 		if (local) {
@@ -237,20 +454,75 @@ bool IceTransport::getSelectedCandidatePair(Candidate *local, Candidate *remote)
 	return false;
 }
 
-bool IceTransport::send(message_ptr message) {
+bool IceTransport::transmit(message_ptr message) {
 	auto s = state();
 	if (!message || (s != State::Connected && s != State::Completed))
 		return false;
 
 	PLOG_VERBOSE << "Send size=" << message->size();
-	return outgoing(message);
+
+#if RTC_ENABLE_LATENCY_TRACING
+	if (auto tracer = latencyTracer(); tracer && tracer->sample(LatencyTracer::IceSend)) {
+		const auto start = LatencyTracer::clock::now();
+		bool sent = outgoing(std::move(message));
+		tracer->record(LatencyTracer::IceSend, start);
+		return sent;
+	}
+#endif
+	return outgoing(std::move(message));
 }
 
 bool IceTransport::outgoing(message_ptr message) {
 	// Explicit Congestion Notification takes the least-significant 2 bits of the DS field
-	int ds = int(message->dscp << 2);
-	return juice_send_diffserv(mAgent.get(), reinterpret_cast<const char *>(message->data()),
-	                           message->size(), ds) >= 0;
+	int ds = int(message->dscp << 2 | (message->ecn & 0x03));
+	std::shared_lock lock(mAgentMutex);
+#if RTC_ENABLE_WEBSOCKET
+	if (mTcpSession && useTcp()) {
+		const size_t size = message->size();
+		if (!mTcpSession->send(std::move(message)))
+			return false;
+
+		recordSent(size);
+		return true;
+	}
+#endif
+	if (juice_send_diffserv(mAgent.get(), reinterpret_cast<const char *>(message->data()),
+	                        message->size(), ds) < 0)
+		return false;
+
+	recordSent(message->size());
+	return true;
+}
+
+size_t IceTransport::transmitBatch(const std::vector<message_ptr> &messages) {
+	auto s = state();
+	if (s != State::Connected && s != State::Completed)
+		return 0;
+
+#if RTC_ENABLE_WEBSOCKET
+	{
+		// Over ICE-TCP, the whole batch is framed into a single vectored write
+		std::shared_lock lock(mAgentMutex);
+		if (mTcpSession && useTcp()) {
+			size_t bytes = 0;
+			for (const auto &message : messages)
+				if (message)
+					bytes += message->size();
+
+			const size_t count = mTcpSession->sendBatch(messages);
+			recordSent(bytes, count);
+			return count;
+		}
+	}
+#endif
+
+	// libjuice has no batched send interface, datagrams are sent one by one
+	size_t count = 0;
+	for (const auto &message : messages)
+		if (message && outgoing(message))
+			++count;
+
+	return count;
 }
 
 void IceTransport::changeGatheringState(GatheringState state) {
@@ -259,6 +531,19 @@ void IceTransport::changeGatheringState(GatheringState state) {
 }
 
 void IceTransport::processStateChange(unsigned int state) {
+	mAgentState = state;
+	updateState();
+}
+
+void IceTransport::updateState() {
+	const unsigned int state = mAgentState;
+#if RTC_ENABLE_WEBSOCKET
+	// A selected ICE-TCP connection keeps the transport connected until the agent connects
+	if (useTcp()) {
+		changeState(State::Connected);
+		return;
+	}
+#endif
 	switch (state) {
 	case JUICE_STATE_DISCONNECTED:
 		changeState(State::Disconnected);
@@ -278,14 +563,21 @@ void IceTransport::processStateChange(unsigned int state) {
 	};
 }
 
-void IceTransport::processCandidate(const string &candidate) {
+void IceTransport::reportCandidate(const string &candidate) {
 	mCandidateCallback(Candidate(candidate, mMid));
-}
 
-void IceTransport::processGatheringDone() { changeGatheringState(GatheringState::Complete); }
+#if RTC_ENABLE_WEBSOCKET
+	// Each UDP host candidate gets a passive TCP counterpart on the shared listener
+	if (auto tcpCandidate = makeTcpCandidate(candidate))
+		mCandidateCallback(std::move(*tcpCandidate));
+#endif
+}
 
-void IceTransport::StateChangeCallback(juice_agent_t *, juice_state_t state, void *user_ptr) {
+void IceTransport::StateChangeCallback(juice_agent_t *agent, juice_state_t state, void *user_ptr) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(user_ptr);
+	if (agent != iceTransport->mCurrentAgent)
+		return; // previous agent before restart
+
 	try {
 		iceTransport->processStateChange(static_cast<unsigned int>(state));
 	} catch (const std::exception &e) {
@@ -293,8 +585,11 @@ void IceTransport::StateChangeCallback(juice_agent_t *, juice_state_t state, voi
 	}
 }
 
-void IceTransport::CandidateCallback(juice_agent_t *, const char *sdp, void *user_ptr) {
+void IceTransport::CandidateCallback(juice_agent_t *agent, const char *sdp, void *user_ptr) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(user_ptr);
+	if (agent != iceTransport->mCurrentAgent)
+		return; // previous agent before restart
+
 	try {
 		iceTransport->processCandidate(sdp);
 	} catch (const std::exception &e) {
@@ -302,8 +597,11 @@ void IceTransport::CandidateCallback(juice_agent_t *, const char *sdp, void *use
 	}
 }
 
-void IceTransport::GatheringDoneCallback(juice_agent_t *, void *user_ptr) {
+void IceTransport::GatheringDoneCallback(juice_agent_t *agent, void *user_ptr) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(user_ptr);
+	if (agent != iceTransport->mCurrentAgent)
+		return; // previous agent before restart
+
 	try {
 		iceTransport->processGatheringDone();
 	} catch (const std::exception &e) {
@@ -311,12 +609,21 @@ void IceTransport::GatheringDoneCallback(juice_agent_t *, void *user_ptr) {
 	}
 }
 
-void IceTransport::RecvCallback(juice_agent_t *, const char *data, size_t size, void *user_ptr) {
+void IceTransport::RecvCallback(juice_agent_t *agent, const char *data, size_t size,
+                                void *user_ptr) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(user_ptr);
+	if (agent != iceTransport->mCurrentAgent)
+		return; // previous agent before restart
+
 	try {
 		PLOG_VERBOSE << "Incoming size=" << size;
+		// libjuice receives into its own buffer, this copy into a pooled message is the only one
+		// on the way up as DTLS reads the datagram in place and SRTP unprotects it in place
 		auto b = reinterpret_cast<const byte *>(data);
-		iceTransport->incoming(make_message(b, b + size));
+		auto message = make_message(b, b + size);
+		message->arrivalTime = std::chrono::steady_clock::now();
+		iceTransport->recordReceived(size);
+		iceTransport->incoming(std::move(message));
 	} catch (const std::exception &e) {
 		PLOG_WARNING << e.what();
 	}
@@ -341,21 +648,105 @@ void IceTransport::LogCallback(juice_log_level_t level, const char *message) {
 		severity = plog::verbose; // libjuice debug as verbose
 		break;
 	}
+	if (severity > MaxLogSeverity(LogSubsystem::Ice))
+		return;
+
 	PLOG(severity) << "juice: " << message;
 }
 
 #else // USE_NICE == 1
 
-IceTransport::IceTransport(const Configuration &config, candidate_callback candidateCallback,
+class IceTransport::MainLoop final {
+public:
+	// The loop is started for the first agent and stopped when the last one is destroyed
+	static shared_ptr<MainLoop> Acquire();
+
+	MainLoop();
+	~MainLoop();
+
+	GMainContext *context() const;
+	void sync(); // wait for callbacks currently dispatched on the loop thread
+
+private:
+	unique_ptr<GMainLoop, void (*)(GMainLoop *)> mLoop;
+	std::thread mThread;
+};
+
+shared_ptr<IceTransport::MainLoop> IceTransport::MainLoop::Acquire() {
+	static std::mutex mutex;
+	static weak_ptr<MainLoop> weakInstance;
+
+	std::lock_guard lock(mutex);
+	auto instance = weakInstance.lock();
+	if (!instance) {
+		instance = std::make_shared<MainLoop>();
+		weakInstance = instance;
+	}
+	return instance;
+}
+
+IceTransport::MainLoop::MainLoop() : mLoop(g_main_loop_new(nullptr, FALSE), g_main_loop_unref) {
+	if (!mLoop)
+		throw std::runtime_error("Failed to create the main loop");
+
+	PLOG_DEBUG << "Starting ICE thread";
+	mThread = std::thread([loop = mLoop.get()]() {
+		ThreadRegistry::Registration registration(ThreadRegistry::Role::Ice);
+		g_main_loop_run(loop);
+	});
+}
+
+IceTransport::MainLoop::~MainLoop() {
+	PLOG_DEBUG << "Stopping ICE thread";
+	g_main_loop_quit(mLoop.get());
+
+	// The last agent might be released from a callback
+	if (mThread.get_id() == std::this_thread::get_id())
+		mThread.detach();
+	else
+		mThread.join();
+}
+
+GMainContext *IceTransport::MainLoop::context() const {
+	return g_main_loop_get_context(mLoop.get());
+}
+
+void IceTransport::MainLoop::sync() {
+	if (mThread.get_id() == std::this_thread::get_id())
+		return;
+
+	std::promise<void> promise;
+	auto future = promise.get_future();
+	g_main_context_invoke(
+	    context(),
+	    [](gpointer data) -> gboolean {
+		    static_cast<std::promise<void> *>(data)->set_value();
+		    return G_SOURCE_REMOVE;
+	    },
+	    &promise);
+	future.wait();
+}
+
+IceTransport::IceTransport(without_agent_t, const Configuration &config,
+                           candidate_callback candidateCallback,
                            state_callback stateChangeCallback,
                            gathering_state_callback gatheringStateChangeCallback)
-    : Transport(nullptr, std::move(stateChangeCallback)), mRole(Description::Role::ActPass),
-      mMid("0"), mGatheringState(GatheringState::New),
+    : Transport(nullptr, std::move(stateChangeCallback)), mConfig(config),
+      mRole(Description::Role::ActPass), mMid("0"), mGatheringState(GatheringState::New),
       mCandidateCallback(std::move(candidateCallback)),
       mGatheringStateChangeCallback(std::move(gatheringStateChangeCallback)),
-      mNiceAgent(nullptr, nullptr), mMainLoop(nullptr, nullptr), mOutgoingDscp(0) {
+      mNiceAgent(nullptr, nullptr), mOutgoingDs(0), mUdpSegmentation(false) {
+	mScheduler = createScheduler();
+}
+
+IceTransport::IceTransport(const Configuration &config, candidate_callback candidateCallback,
+                           state_callback stateChangeCallback,
+                           gathering_state_callback gatheringStateChangeCallback)
+    : IceTransport(without_agent_t{}, config, std::move(candidateCallback),
+                   std::move(stateChangeCallback), std::move(gatheringStateChangeCallback)) {
 
 	PLOG_DEBUG << "Initializing ICE transport (libnice)";
+	mMainLoop = MainLoop::Acquire();
 
 	g_log_set_handler("libnice", G_LOG_LEVEL_MASK, LogCallback, this);
 
@@ -363,29 +754,31 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 		nice_debug_enable(false); // do not output STUN debug messages
 	}
 
-	mMainLoop = decltype(mMainLoop)(g_main_loop_new(nullptr, FALSE), g_main_loop_unref);
-	if (!mMainLoop)
-		std::runtime_error("Failed to create the main loop");
-
 	// RFC 5245 was obsoleted by RFC 8445 but this should be OK.
+	// The agent uses aggressive nomination: the first valid pair is selected right away and a
+	// better one replaces it when it succeeds, the upper transports keep running over the stream.
 	mNiceAgent = decltype(mNiceAgent)(
-	    nice_agent_new(g_main_loop_get_context(mMainLoop.get()), NICE_COMPATIBILITY_RFC5245),
-	    g_object_unref);
+	    nice_agent_new(mMainLoop->context(), NICE_COMPATIBILITY_RFC5245), g_object_unref);
 
 	if (!mNiceAgent)
 		throw std::runtime_error("Failed to create the nice agent");
 
-	mMainLoopThread = std::thread(g_main_loop_run, mMainLoop.get());
-
-	mStreamId = nice_agent_add_stream(mNiceAgent.get(), 1);
-	if (!mStreamId)
-		throw std::runtime_error("Failed to add a stream");
-
 	g_object_set(G_OBJECT(mNiceAgent.get()), "controlling-mode", TRUE, nullptr); // decided later
 	g_object_set(G_OBJECT(mNiceAgent.get()), "ice-udp", TRUE, nullptr);
 	g_object_set(G_OBJECT(mNiceAgent.get()), "ice-tcp", config.enableIceTcp ? TRUE : FALSE,
 	             nullptr);
 
+	if (config.enableIceUdpMux)
+		PLOG_WARNING << "ICE UDP mux is not supported with libnice";
+
+#ifdef UDP_SEGMENT
+	mUdpSegmentation = config.enableUdpSegmentation;
+#else
+	mUdpSegmentation = false;
+	if (config.enableUdpSegmentation)
+		PLOG_WARNING << "UDP segmentation offload is not supported on this platform";
+#endif
+
 	// RFC 8445: Agents MUST NOT use an RTO value smaller than 500 ms.
 	g_object_set(G_OBJECT(mNiceAgent.get()), "stun-initial-timeout", 500, nullptr);
 	g_object_set(G_OBJECT(mNiceAgent.get()), "stun-max-retransmissions", 3, nullptr);
@@ -414,8 +807,13 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 	auto seed = static_cast<unsigned int>(system_clock::now().time_since_epoch().count());
 	std::shuffle(servers.begin(), servers.end(), std::default_random_engine(seed));
 
+	// Resolve all servers in parallel, results are cached for the next connections
+	for (const auto &server : servers) {
+		if (!server.hostname.empty())
+			DnsCache::Instance().prefetch(server.hostname, server.type == IceServer::Type::Stun);
+	}
+
 	// Add one STUN server
-	bool success = false;
 	for (auto &server : servers) {
 		if (server.hostname.empty())
 			continue;
@@ -424,42 +822,44 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 		if (server.port == 0)
 			server.port = 3478; // STUN UDP port
 
-		struct addrinfo hints = {};
-		hints.ai_family = AF_INET; // IPv4
-		hints.ai_socktype = SOCK_DGRAM;
-		hints.ai_protocol = IPPROTO_UDP;
-		hints.ai_flags = AI_ADDRCONFIG;
-		struct addrinfo *result = nullptr;
-		if (getaddrinfo(server.hostname.c_str(), std::to_string(server.port).c_str(), &hints,
-		                &result) != 0) {
+		auto addresses = DnsCache::Instance().resolve(server.hostname, true); // IPv4
+		if (addresses.empty()) {
 			PLOG_WARNING << "Unable to resolve STUN server address: " << server.hostname << ':'
 			             << server.port;
 			continue;
 		}
 
-		for (auto p = result; p; p = p->ai_next) {
-			if (p->ai_family == AF_INET) {
-				char nodebuffer[MAX_NUMERICNODE_LEN];
-				char servbuffer[MAX_NUMERICSERV_LEN];
-				if (getnameinfo(p->ai_addr, p->ai_addrlen, nodebuffer, MAX_NUMERICNODE_LEN,
-				                servbuffer, MAX_NUMERICSERV_LEN,
-				                NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
-					PLOG_INFO << "Using STUN server \"" << server.hostname << ":" << server.port
-					          << "\"";
-					g_object_set(G_OBJECT(mNiceAgent.get()), "stun-server", nodebuffer, nullptr);
-					g_object_set(G_OBJECT(mNiceAgent.get()), "stun-server-port",
-					             std::stoul(servbuffer), nullptr);
-					success = true;
-					break;
-				}
-			}
-		}
-
-		freeaddrinfo(result);
-		if (success)
-			break;
+		PLOG_INFO << "Using STUN server \"" << server.hostname << ":" << server.port << "\"";
+		g_object_set(G_OBJECT(mNiceAgent.get()), "stun-server", addresses.front().c_str(),
+		             nullptr);
+		g_object_set(G_OBJECT(mNiceAgent.get()), "stun-server-port", guint(server.port), nullptr);
+		break;
 	}
 
+	g_signal_connect(G_OBJECT(mNiceAgent.get()), "component-state-changed",
+	                 G_CALLBACK(StateChangeCallback), this);
+	g_signal_connect(G_OBJECT(mNiceAgent.get()), "new-candidate-full",
+	                 G_CALLBACK(CandidateCallback), this);
+	g_signal_connect(G_OBJECT(mNiceAgent.get()), "candidate-gathering-done",
+	                 G_CALLBACK(GatheringDoneCallback), this);
+
+	mStreamId = addStream();
+}
+
+uint32_t IceTransport::addStream() {
+	const uint32_t streamId = nice_agent_add_stream(mNiceAgent.get(), 1);
+	if (!streamId)
+		throw std::runtime_error("Failed to add a stream");
+
+	nice_agent_set_stream_name(mNiceAgent.get(), streamId, "application");
+	nice_agent_set_port_range(mNiceAgent.get(), streamId, 1, mConfig.portRangeBegin,
+	                          mConfig.portRangeEnd);
+
+	// Randomize order
+	std::vector<IceServer> servers = mConfig.iceServers;
+	auto seed = static_cast<unsigned int>(system_clock::now().time_since_epoch().count());
+	std::shuffle(servers.begin(), servers.end(), std::default_random_engine(seed));
+
 	// Add TURN servers
 	for (auto &server : servers) {
 		if (server.hostname.empty())
@@ -469,70 +869,74 @@ IceTransport::IceTransport(const Configuration &config, candidate_callback candi
 		if (server.port == 0)
 			server.port = server.relayType == IceServer::RelayType::TurnTls ? 5349 : 3478;
 
-		struct addrinfo hints = {};
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype =
-		    server.relayType == IceServer::RelayType::TurnUdp ? SOCK_DGRAM : SOCK_STREAM;
-		hints.ai_protocol =
-		    server.relayType == IceServer::RelayType::TurnUdp ? IPPROTO_UDP : IPPROTO_TCP;
-		hints.ai_flags = AI_ADDRCONFIG;
-		struct addrinfo *result = nullptr;
-		if (getaddrinfo(server.hostname.c_str(), std::to_string(server.port).c_str(), &hints,
-		                &result) != 0) {
+		auto addresses = DnsCache::Instance().resolve(server.hostname);
+		if (addresses.empty()) {
 			PLOG_WARNING << "Unable to resolve TURN server address: " << server.hostname << ':'
 			             << server.port;
 			continue;
 		}
 
-		for (auto p = result; p; p = p->ai_next) {
-			if (p->ai_family == AF_INET || p->ai_family == AF_INET6) {
-				char nodebuffer[MAX_NUMERICNODE_LEN];
-				char servbuffer[MAX_NUMERICSERV_LEN];
-				if (getnameinfo(p->ai_addr, p->ai_addrlen, nodebuffer, MAX_NUMERICNODE_LEN,
-				                servbuffer, MAX_NUMERICSERV_LEN,
-				                NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
-					PLOG_INFO << "Using TURN server \"" << server.hostname << ":" << server.port
-					          << "\"";
-					NiceRelayType niceRelayType;
-					switch (server.relayType) {
-					case IceServer::RelayType::TurnTcp:
-						niceRelayType = NICE_RELAY_TYPE_TURN_TCP;
-						break;
-					case IceServer::RelayType::TurnTls:
-						niceRelayType = NICE_RELAY_TYPE_TURN_TLS;
-						break;
-					default:
-						niceRelayType = NICE_RELAY_TYPE_TURN_UDP;
-						break;
-					}
-					nice_agent_set_relay_info(mNiceAgent.get(), mStreamId, 1, nodebuffer,
-					                          std::stoul(servbuffer), server.username.c_str(),
-					                          server.password.c_str(), niceRelayType);
-				}
-			}
+		// As with libjuice, channels are bound with the RFC 5766 compatibility, and libnice
+		// prioritizes relayed candidates over UDP above those over TCP and TLS
+		NiceRelayType niceRelayType;
+		switch (server.relayType) {
+		case IceServer::RelayType::TurnTcp:
+			niceRelayType = NICE_RELAY_TYPE_TURN_TCP;
+			break;
+		case IceServer::RelayType::TurnTls:
+			niceRelayType = NICE_RELAY_TYPE_TURN_TLS;
+			break;
+		default:
+			niceRelayType = NICE_RELAY_TYPE_TURN_UDP;
+			break;
 		}
 
-		freeaddrinfo(result);
+		PLOG_INFO << "Using TURN server \"" << server.hostname << ":" << server.port << "\"";
+		for (const auto &address : addresses)
+			nice_agent_set_relay_info(mNiceAgent.get(), streamId, 1, address.c_str(), server.port,
+			                          server.username.c_str(), server.password.c_str(),
+			                          niceRelayType);
 	}
 
-	g_signal_connect(G_OBJECT(mNiceAgent.get()), "component-state-changed",
-	                 G_CALLBACK(StateChangeCallback), this);
-	g_signal_connect(G_OBJECT(mNiceAgent.get()), "new-candidate-full",
-	                 G_CALLBACK(CandidateCallback), this);
-	g_signal_connect(G_OBJECT(mNiceAgent.get()), "candidate-gathering-done",
-	                 G_CALLBACK(GatheringDoneCallback), this);
+	nice_agent_attach_recv(mNiceAgent.get(), streamId, 1, mMainLoop->context(), RecvCallback,
+	                       this);
+	return streamId;
+}
+
+void IceTransport::restart() {
+	PLOG_INFO << "Restarting ICE";
+
+	if (mTimeoutId) {
+		g_source_remove(mTimeoutId);
+		mTimeoutId = 0;
+	}
 
-	nice_agent_set_stream_name(mNiceAgent.get(), mStreamId, "application");
-	nice_agent_set_port_range(mNiceAgent.get(), mStreamId, 1, config.portRangeBegin,
-	                          config.portRangeEnd);
+	// libnice could restart the stream, but it would keep local candidates, which are stale after
+	// a network change, so a new stream with fresh credentials gathers again instead. Stream names
+	// must be unique, so the previous one is removed first.
+	{
+		std::lock_guard lock(mOutgoingMutex);
+		const uint32_t previous = mStreamId;
+		nice_agent_attach_recv(mNiceAgent.get(), previous, 1, mMainLoop->context(), NULL, NULL);
+		nice_agent_remove_stream(mNiceAgent.get(), previous);
+		mStreamId = addStream();
+		mOutgoingDs = 0;
+	}
 
-	nice_agent_attach_recv(mNiceAgent.get(), mStreamId, 1, g_main_loop_get_context(mMainLoop.get()),
-	                       RecvCallback, this);
+	// Callbacks for the previous stream might still be running on the loop thread
+	mMainLoop->sync();
+
+	mGatheringState = GatheringState::New;
+	resetInterleaving();
+	changeState(State::Connecting);
 }
 
 IceTransport::~IceTransport() { stop(); }
 
 bool IceTransport::stop() {
+	if (mScheduler)
+		mScheduler->stop();
+
 	if (mTimeoutId) {
 		g_source_remove(mTimeoutId);
 		mTimeoutId = 0;
@@ -541,12 +945,16 @@ bool IceTransport::stop() {
 	if (!Transport::stop())
 		return false;
 
-	PLOG_DEBUG << "Stopping ICE thread";
-	nice_agent_attach_recv(mNiceAgent.get(), mStreamId, 1, g_main_loop_get_context(mMainLoop.get()),
-	                       NULL, NULL);
+	if (!mNiceAgent)
+		return true;
+
+	PLOG_DEBUG << "Stopping ICE agent";
+	nice_agent_attach_recv(mNiceAgent.get(), mStreamId, 1, mMainLoop->context(), NULL, NULL);
 	nice_agent_remove_stream(mNiceAgent.get(), mStreamId);
-	g_main_loop_quit(mMainLoop.get());
-	mMainLoopThread.join();
+	g_signal_handlers_disconnect_by_data(mNiceAgent.get(), this);
+
+	// The loop thread is shared, so wait for callbacks that might still be running for this agent
+	mMainLoop->sync();
 	return true;
 }
 
@@ -591,7 +999,7 @@ bool IceTransport::addRemoteCandidate(const Candidate &candidate) {
 
 	// Warning: the candidate string must start with "a=candidate:" and it must not end with a
 	// newline or whitespace, else libnice will reject it.
-	string sdp(candidate);
+	string sdp(interleaveFamilies(candidate));
 	NiceCandidate *cand =
 	    nice_agent_parse_remote_candidate_sdp(mNiceAgent.get(), mStreamId, sdp.c_str());
 	if (!cand) {
@@ -606,12 +1014,7 @@ bool IceTransport::addRemoteCandidate(const Candidate &candidate) {
 	return ret > 0;
 }
 
-void IceTransport::gatherLocalCandidates(string mid) {
-	mMid = std::move(mid);
-
-	// Change state now as candidates calls can be synchronous
-	changeGatheringState(GatheringState::InProgress);
-
+void IceTransport::startGathering() {
 	if (!nice_agent_gather_candidates(mNiceAgent.get(), mStreamId)) {
 		throw std::runtime_error("Failed to gather local ICE candidates");
 	}
@@ -635,25 +1038,197 @@ optional<string> IceTransport::getRemoteAddress() const {
 	return nullopt;
 }
 
-bool IceTransport::send(message_ptr message) {
+bool IceTransport::transmit(message_ptr message) {
 	auto s = state();
 	if (!message || (s != State::Connected && s != State::Completed))
 		return false;
 
 	PLOG_VERBOSE << "Send size=" << message->size();
-	return outgoing(message);
+
+#if RTC_ENABLE_LATENCY_TRACING
+	if (auto tracer = latencyTracer(); tracer && tracer->sample(LatencyTracer::IceSend)) {
+		const auto start = LatencyTracer::clock::now();
+		bool sent = outgoing(std::move(message));
+		tracer->record(LatencyTracer::IceSend, start);
+		return sent;
+	}
+#endif
+	return outgoing(std::move(message));
 }
 
 bool IceTransport::outgoing(message_ptr message) {
 	std::lock_guard lock(mOutgoingMutex);
-	if (mOutgoingDscp != message->dscp) {
-		mOutgoingDscp = message->dscp;
+	// Explicit Congestion Notification takes the least-significant 2 bits of the DS field
+	const unsigned int ds = message->dscp << 2 | (message->ecn & 0x03);
+	if (mOutgoingDs != ds) {
+		mOutgoingDs = ds;
+		nice_agent_set_stream_tos(mNiceAgent.get(), mStreamId, int(ds)); // ToS is the legacy name
+	}
+	if (nice_agent_send(mNiceAgent.get(), mStreamId, 1, message->size(),
+	                    reinterpret_cast<const char *>(message->data())) < 0)
+		return false;
+
+	recordSent(message->size());
+	return true;
+}
+
+size_t IceTransport::transmitBatch(const std::vector<message_ptr> &messages) {
+	auto s = state();
+	if (s != State::Connected && s != State::Completed)
+		return 0;
+
+	std::vector<GOutputVector> vectors;
+	std::vector<NiceOutputMessage> outputs;
+	vectors.reserve(messages.size());
+	outputs.reserve(messages.size());
+
+	// libnice sends the messages with sendmmsg() when available, the DS field can only be set for
+	// the whole stream so messages are sent in runs sharing the same value
+	std::lock_guard lock(mOutgoingMutex);
+	std::vector<message_ptr> run;
+	run.reserve(messages.size());
+	size_t count = 0;
+	auto it = messages.begin();
+	while (it != messages.end()) {
+		if (!*it) {
+			++it;
+			continue;
+		}
+
 		// Explicit Congestion Notification takes the least-significant 2 bits of the DS field
-		int ds = int(message->dscp << 2);
-		nice_agent_set_stream_tos(mNiceAgent.get(), mStreamId, ds); // ToS is the legacy name for DS
+		auto dsOf = [](const message_ptr &message) {
+			return message->dscp << 2 | (message->ecn & 0x03);
+		};
+		const unsigned int ds = dsOf(*it);
+		run.clear();
+		while (it != messages.end() && (!*it || dsOf(*it) == ds)) {
+			if (*it)
+				run.push_back(*it);
+			++it;
+		}
+
+		if (mOutgoingDs != ds) {
+			mOutgoingDs = ds;
+			nice_agent_set_stream_tos(mNiceAgent.get(), mStreamId, int(ds));
+		}
+
+		auto recordRun = [this, &run](size_t begin, size_t end) {
+			size_t bytes = 0;
+			for (size_t i = begin; i < end; ++i)
+				bytes += run[i]->size();
+			recordSent(bytes, end - begin);
+		};
+
+		size_t first = mUdpSegmentation ? sendSegmented(run, count) : 0;
+		recordRun(0, first);
+		if (first == run.size())
+			continue;
+
+		vectors.clear();
+		outputs.clear();
+		for (size_t i = first; i < run.size(); ++i)
+			vectors.push_back({run[i]->data(), run[i]->size()});
+		for (auto &vector : vectors)
+			outputs.push_back({&vector, 1});
+
+		gint ret = nice_agent_send_messages_nonblocking(mNiceAgent.get(), mStreamId, 1,
+		                                                outputs.data(), guint(outputs.size()),
+		                                                NULL, NULL);
+		if (ret > 0) {
+			count += size_t(ret);
+			recordRun(first, first + size_t(ret));
+		}
 	}
-	return nice_agent_send(mNiceAgent.get(), mStreamId, 1, message->size(),
-	                       reinterpret_cast<const char *>(message->data())) >= 0;
+
+	return count;
+}
+
+size_t IceTransport::sendSegmented(const std::vector<message_ptr> &messages,
+                                   [[maybe_unused]] size_t &sent) {
+#ifdef UDP_SEGMENT
+	// The socket is only available for direct UDP, not for relayed or TCP candidates
+	GSocket *socket = nice_agent_get_selected_socket(mNiceAgent.get(), mStreamId, 1);
+	if (!socket)
+		return 0;
+
+	unique_ptr<GSocket, decltype(&g_object_unref)> guard(socket, g_object_unref);
+	if (g_socket_get_protocol(socket) != G_SOCKET_PROTOCOL_UDP)
+		return 0;
+
+	NiceCandidate *local = nullptr;
+	NiceCandidate *remote = nullptr;
+	if (!nice_agent_get_selected_pair(mNiceAgent.get(), mStreamId, 1, &local, &remote))
+		return 0;
+
+	struct sockaddr_storage addr = {};
+	nice_address_copy_to_sockaddr(&remote->addr, reinterpret_cast<struct sockaddr *>(&addr));
+	const socklen_t addrLen = addr.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+	                                                     : sizeof(struct sockaddr_in);
+	const int fd = g_socket_get_fd(socket);
+
+	// The kernel accepts up to 64 segments in a datagram of at most 64KiB, all segments must
+	// have the same size except the last one which may be shorter
+	const size_t maxSegments = 64;
+	const size_t maxSize = 65507;
+	std::vector<struct iovec> iov;
+	iov.reserve(maxSegments);
+	size_t i = 0;
+	while (i < messages.size()) {
+		const size_t begin = i;
+		const size_t segmentSize = messages[i]->size();
+		size_t total = 0;
+		iov.clear();
+		while (i < messages.size() && iov.size() < maxSegments) {
+			const size_t size = messages[i]->size();
+			if (size > segmentSize || total + size > maxSize)
+				break;
+
+			iov.push_back({messages[i]->data(), size});
+			total += size;
+			++i;
+			if (size < segmentSize)
+				break; // shorter last segment
+		}
+
+		if (iov.empty())
+			return begin; // oversized datagram
+
+		struct msghdr msg = {};
+		msg.msg_name = &addr;
+		msg.msg_namelen = addrLen;
+		msg.msg_iov = iov.data();
+		msg.msg_iovlen = iov.size();
+
+		char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+		if (iov.size() > 1) {
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t gsoSize = uint16_t(segmentSize);
+			std::memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+		}
+
+		if (::sendmsg(fd, &msg, MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				continue; // dropped
+
+			// EIO means the device does not support segmentation offload
+			PLOG_WARNING << "UDP segmentation offload failed, errno=" << errno
+			             << ", falling back to normal sending";
+			mUdpSegmentation = false;
+			return begin;
+		}
+
+		sent += iov.size();
+	}
+
+	return messages.size();
+#else
+	return 0;
+#endif
 }
 
 void IceTransport::changeGatheringState(GatheringState state) {
@@ -667,12 +1242,10 @@ void IceTransport::processTimeout() {
 	changeState(State::Failed);
 }
 
-void IceTransport::processCandidate(const string &candidate) {
+void IceTransport::reportCandidate(const string &candidate) {
 	mCandidateCallback(Candidate(candidate, mMid));
 }
 
-void IceTransport::processGatheringDone() { changeGatheringState(GatheringState::Complete); }
-
 void IceTransport::processStateChange(unsigned int state) {
 	if (state == NICE_COMPONENT_STATE_FAILED && mTrickleTimeout.count() > 0) {
 		if (mTimeoutId)
@@ -717,6 +1290,9 @@ string IceTransport::AddressToString(const NiceAddress &addr) {
 void IceTransport::CandidateCallback(NiceAgent *agent, NiceCandidate *candidate,
                                      gpointer userData) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(userData);
+	if (candidate->stream_id != iceTransport->mStreamId)
+		return; // previous stream before restart
+
 	gchar *cand = nice_agent_generate_local_candidate_sdp(agent, candidate);
 	try {
 		iceTransport->processCandidate(cand);
@@ -726,9 +1302,12 @@ void IceTransport::CandidateCallback(NiceAgent *agent, NiceCandidate *candidate,
 	g_free(cand);
 }
 
-void IceTransport::GatheringDoneCallback(NiceAgent * /*agent*/, guint /*streamId*/,
+void IceTransport::GatheringDoneCallback(NiceAgent * /*agent*/, guint streamId,
                                          gpointer userData) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(userData);
+	if (streamId != iceTransport->mStreamId)
+		return; // previous stream before restart
+
 	try {
 		iceTransport->processGatheringDone();
 	} catch (const std::exception &e) {
@@ -736,9 +1315,12 @@ void IceTransport::GatheringDoneCallback(NiceAgent * /*agent*/, guint /*streamId
 	}
 }
 
-void IceTransport::StateChangeCallback(NiceAgent * /*agent*/, guint /*streamId*/,
+void IceTransport::StateChangeCallback(NiceAgent * /*agent*/, guint streamId,
                                        guint /*componentId*/, guint state, gpointer userData) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(userData);
+	if (streamId != iceTransport->mStreamId)
+		return; // previous stream before restart
+
 	try {
 		iceTransport->processStateChange(state);
 	} catch (const std::exception &e) {
@@ -746,13 +1328,19 @@ void IceTransport::StateChangeCallback(NiceAgent * /*agent*/, guint /*streamId*/
 	}
 }
 
-void IceTransport::RecvCallback(NiceAgent * /*agent*/, guint /*streamId*/, guint /*componentId*/,
+void IceTransport::RecvCallback(NiceAgent * /*agent*/, guint streamId, guint /*componentId*/,
                                 guint len, gchar *buf, gpointer userData) {
 	auto iceTransport = static_cast<rtc::impl::IceTransport *>(userData);
+	if (streamId != iceTransport->mStreamId)
+		return; // previous stream before restart
+
 	try {
 		PLOG_VERBOSE << "Incoming size=" << len;
 		auto b = reinterpret_cast<byte *>(buf);
-		iceTransport->incoming(make_message(b, b + len));
+		auto message = make_message(b, b + len);
+		message->arrivalTime = std::chrono::steady_clock::now();
+		iceTransport->recordReceived(len);
+		iceTransport->incoming(std::move(message));
 	} catch (const std::exception &e) {
 		PLOG_WARNING << e.what();
 	}
@@ -785,6 +1373,9 @@ void IceTransport::LogCallback(const gchar * /*logDomain*/, GLogLevelFlags logLe
 	else
 		severity = plog::verbose; // libnice debug as verbose
 
+	if (severity > MaxLogSeverity(LogSubsystem::Ice))
+		return;
+
 	PLOG(severity) << "nice: " << message;
 }
 
@@ -812,4 +1403,155 @@ bool IceTransport::getSelectedCandidatePair(Candidate *local, Candidate *remote)
 
 #endif
 
+void IceTransport::gatherLocalCandidates(string mid) {
+	mMid = std::move(mid);
+
+	std::unique_lock lock(mPregatherMutex);
+	if (!mPregathered) {
+		lock.unlock();
+
+		// Change state now as candidates calls can be synchronous
+		changeGatheringState(GatheringState::InProgress);
+		startGathering();
+		return;
+	}
+
+	// Report the candidates gathered in advance with the mid, gathering continues in the
+	// background if it is not done yet
+	auto candidates = std::move(*mPregathered);
+	mPregathered.reset();
+	PLOG_DEBUG << "Using " << candidates.size() << " pre-gathered ICE candidates";
+
+	changeGatheringState(GatheringState::InProgress);
+	for (const auto &candidate : candidates)
+		reportCandidate(candidate);
+
+	if (mPregatherDone)
+		changeGatheringState(GatheringState::Complete);
+}
+
+void IceTransport::pregather() {
+	{
+		std::lock_guard lock(mPregatherMutex);
+		mPregathered.emplace();
+		mPregatherDone = false;
+	}
+	startGathering();
+}
+
+void IceTransport::bind(candidate_callback candidateCallback, state_callback stateChangeCallback,
+                        gathering_state_callback gatheringStateChangeCallback) {
+	std::lock_guard lock(mPregatherMutex);
+	mCandidateCallback = std::move(candidateCallback);
+	mGatheringStateChangeCallback = std::move(gatheringStateChangeCallback);
+	onStateChange(std::move(stateChangeCallback));
+}
+
+void IceTransport::processCandidate(const string &candidate) {
+	std::lock_guard lock(mPregatherMutex);
+	if (mPregathered)
+		mPregathered->push_back(candidate);
+	else
+		reportCandidate(candidate);
+}
+
+void IceTransport::processGatheringDone() {
+	std::lock_guard lock(mPregatherMutex);
+	if (mPregathered)
+		mPregatherDone = true;
+	else
+		changeGatheringState(GatheringState::Complete);
+}
+
+bool IceTransport::send(message_ptr message) {
+	if (!message)
+		return false;
+
+	return mScheduler ? mScheduler->send(std::move(message)) : transmit(std::move(message));
+}
+
+size_t IceTransport::sendBatch(const std::vector<message_ptr> &messages) {
+	return mScheduler ? mScheduler->send(messages) : transmitBatch(messages);
+}
+
+shared_ptr<EgressScheduler> IceTransport::createScheduler() {
+	if (!mConfig.egressMaxBitrate)
+		return nullptr;
+
+	PLOG_DEBUG << "Scheduling egress at " << *mConfig.egressMaxBitrate << " bit/s";
+	return std::make_shared<EgressScheduler>(
+	    *mConfig.egressMaxBitrate, mConfig.egressVideoWeight, mConfig.egressDataWeight,
+	    [this](const std::vector<message_ptr> &messages) { return transmitBatch(messages); });
+}
+
+IceStats IceTransport::stats() {
+	std::lock_guard lock(mRatesMutex);
+	IceStats stats;
+	stats.bytesSent = mBytesSent;
+	stats.bytesReceived = mBytesReceived;
+	stats.packetsSent = mPacketsSent;
+	stats.packetsReceived = mPacketsReceived;
+
+	const auto now = std::chrono::steady_clock::now();
+	const auto elapsed = std::chrono::duration<double>(now - mLastRatesTime).count();
+	if (elapsed < 0.5) {
+		// Too soon to measure again
+		stats.sendRate = mLastStats.sendRate;
+		stats.receiveRate = mLastStats.receiveRate;
+		stats.sendPacketRate = mLastStats.sendPacketRate;
+		stats.receivePacketRate = mLastStats.receivePacketRate;
+		return stats;
+	}
+
+	// Moving average, like SctpTransport throughput
+	auto rate = [elapsed](size_t previousRate, size_t current, size_t last) {
+		return (previousRate + size_t(double(current - last) / elapsed)) / 2;
+	};
+	stats.sendRate = rate(mLastStats.sendRate, stats.bytesSent, mLastStats.bytesSent);
+	stats.receiveRate = rate(mLastStats.receiveRate, stats.bytesReceived, mLastStats.bytesReceived);
+	stats.sendPacketRate =
+	    rate(mLastStats.sendPacketRate, stats.packetsSent, mLastStats.packetsSent);
+	stats.receivePacketRate =
+	    rate(mLastStats.receivePacketRate, stats.packetsReceived, mLastStats.packetsReceived);
+
+	mLastStats = stats;
+	mLastRatesTime = now;
+	return stats;
+}
+
+void IceTransport::recordSent(size_t bytes, size_t packets) {
+	mBytesSent += bytes;
+	mPacketsSent += packets;
+}
+
+void IceTransport::recordReceived(size_t bytes) {
+	mBytesReceived += bytes;
+	++mPacketsReceived;
+}
+
+Candidate IceTransport::interleaveFamilies(Candidate candidate) {
+	const auto type = candidate.type();
+	const auto family = candidate.family();
+	if (!mConfig.enableIceAggressiveNomination || family == Candidate::Family::Unresolved ||
+	    (type != Candidate::Type::Host && type != Candidate::Type::ServerReflexive))
+		return candidate;
+
+	// The priority is made of the type preference (8 bits), the local preference (16 bits), and
+	// 256 minus the component ID (8 bits). Successive candidates of each family get alternating
+	// local preferences, IPv6 first, so the best pairs of both families are checked one after the
+	// other and the first valid one is nominated.
+	const bool ipv4 = family == Candidate::Family::Ipv4;
+	const size_t index = (type == Candidate::Type::Host ? 0 : 2) + (ipv4 ? 1 : 0);
+	const uint32_t rank = std::min(mInterleaved[index]++, 0x7FFFu);
+	const uint32_t localPreference = 0xFFFF - (2 * rank + (ipv4 ? 1 : 0));
+	candidate.changePriority((candidate.priority() & 0xFF0000FF) | localPreference << 8);
+	PLOG_VERBOSE << "Interleaved remote candidate: " << candidate;
+	return candidate;
+}
+
+void IceTransport::resetInterleaving() {
+	for (auto &count : mInterleaved)
+		count = 0;
+}
+
 } // namespace rtc::impl
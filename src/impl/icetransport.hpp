@@ -27,18 +27,25 @@
 #include "transport.hpp"
 
 #if !USE_NICE
+#include "icetcpmux.hpp"
+
 #include <juice/juice.h>
 #else
 #include <nice/agent.h>
 #endif
 
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
+#include <vector>
 
 namespace rtc::impl {
 
+class EgressScheduler;
+
 class IceTransport : public Transport {
 public:
 	enum class GatheringState { New = 0, InProgress = 1, Complete = 2 };
@@ -53,29 +60,66 @@ public:
 
 	Description::Role role() const;
 	GatheringState gatheringState() const;
-	Description getLocalDescription(Description::Type type) const;
-	void setRemoteDescription(const Description &description);
-	bool addRemoteCandidate(const Candidate &candidate);
+	virtual Description getLocalDescription(Description::Type type) const;
+	virtual void setRemoteDescription(const Description &description);
+	virtual bool addRemoteCandidate(const Candidate &candidate);
 	void gatherLocalCandidates(string mid);
 
-	optional<string> getLocalAddress() const;
-	optional<string> getRemoteAddress() const;
+	// Pre-gathering for a candidate pool: the transport is created without callbacks and
+	// candidates are kept until gatherLocalCandidates() is called after bind()
+	void pregather();
+	void bind(candidate_callback candidateCallback, state_callback stateChangeCallback,
+	          gathering_state_callback gatheringStateChangeCallback);
+
+	virtual optional<string> getLocalAddress() const;
+	virtual optional<string> getRemoteAddress() const;
 
 	bool stop() override;
 	bool send(message_ptr message) override; // false if dropped
+	size_t sendBatch(const std::vector<message_ptr> &messages) override;
+
+	virtual bool getSelectedCandidatePair(Candidate *local, Candidate *remote);
+
+	// ICE restart with fresh credentials, the upper transports keep running on top
+	// gatherLocalCandidates() must be called again
+	virtual void restart();
+
+	IceStats stats(); // rtt is not set
 
-	bool getSelectedCandidatePair(Candidate *local, Candidate *remote);
+protected:
+	// For subclasses replacing the agent, like LoopbackTransport
+	struct without_agent_t {};
+	IceTransport(without_agent_t, const Configuration &config,
+	             candidate_callback candidateCallback, state_callback stateChangeCallback,
+	             gathering_state_callback gatheringStateChangeCallback);
 
-private:
 	bool outgoing(message_ptr message) override;
 
+	// Sending bypassing the scheduler
+	bool transmit(message_ptr message);
+	virtual size_t transmitBatch(const std::vector<message_ptr> &messages);
+
+	shared_ptr<EgressScheduler> createScheduler(); // null if egress is not scheduled
+
+	void recordSent(size_t bytes, size_t packets = 1);
+	void recordReceived(size_t bytes);
+
+	// With aggressive nomination, interleave the priorities of remote host and server reflexive
+	// candidates by address family, so IPv4 checks don't wait for IPv6 ones to time out
+	Candidate interleaveFamilies(Candidate candidate);
+	void resetInterleaving();
+
 	void changeGatheringState(GatheringState state);
 
+	virtual void startGathering();
+
 	void processStateChange(unsigned int state);
 	void processCandidate(const string &candidate);
 	void processGatheringDone();
 	void processTimeout();
+	void reportCandidate(const string &candidate); // mPregatherMutex must be locked
 
+	const Configuration mConfig;
 	Description::Role mRole;
 	string mMid;
 	std::chrono::milliseconds mTrickleTimeout;
@@ -84,8 +128,47 @@ private:
 	candidate_callback mCandidateCallback;
 	gathering_state_callback mGatheringStateChangeCallback;
 
+	// Candidates are reported with mPregatherMutex locked, so replaying pre-gathered candidates
+	// can't race with the end of gathering
+	std::mutex mPregatherMutex;
+	optional<std::vector<string>> mPregathered; // set while pre-gathering
+	bool mPregatherDone = false;
+
+	shared_ptr<EgressScheduler> mScheduler; // set in the constructor
+
+	// Stats
+	std::atomic<size_t> mBytesSent = 0, mBytesReceived = 0;
+	std::atomic<size_t> mPacketsSent = 0, mPacketsReceived = 0;
+
+	// Remote candidates interleaved so far, by type and family
+	std::array<std::atomic<unsigned int>, 4> mInterleaved = {};
+
+	// Rates are updated when stats are requested
+	std::mutex mRatesMutex;
+	std::chrono::steady_clock::time_point mLastRatesTime = std::chrono::steady_clock::now();
+	IceStats mLastStats;
+
 #if !USE_NICE
-	unique_ptr<juice_agent_t, void (*)(juice_agent_t *)> mAgent;
+	using agent_ptr = unique_ptr<juice_agent_t, void (*)(juice_agent_t *)>;
+	agent_ptr createAgent();
+
+	agent_ptr mAgent;
+	std::atomic<juice_agent_t *> mCurrentAgent = nullptr; // for callbacks
+	mutable std::shared_mutex mAgentMutex;                // replacing the agent is exclusive
+
+	std::atomic<unsigned int> mAgentState = JUICE_STATE_DISCONNECTED;
+	void updateState();
+
+#if RTC_ENABLE_WEBSOCKET
+	// Passive ICE-TCP alongside the agent, replaced with it on restart
+	shared_ptr<IceTcpSession> createTcpSession(juice_agent_t *agent);
+	optional<Candidate> makeTcpCandidate(const string &candidate) const;
+	bool useTcp() const; // selected over TCP while the agent is not connected
+
+	shared_ptr<IceTcpSession> mTcpSession; // protected by mAgentMutex
+	std::atomic<uint16_t> mTcpPort = 0;
+	std::atomic<bool> mTcpSelected = false;
+#endif
 
 	static void StateChangeCallback(juice_agent_t *agent, juice_state_t state, void *user_ptr);
 	static void CandidateCallback(juice_agent_t *agent, const char *sdp, void *user_ptr);
@@ -93,13 +176,23 @@ private:
 	static void RecvCallback(juice_agent_t *agent, const char *data, size_t size, void *user_ptr);
 	static void LogCallback(juice_log_level_t level, const char *message);
 #else
-	uint32_t mStreamId = 0;
+	uint32_t addStream(); // returns the stream ID
+
+	std::atomic<uint32_t> mStreamId = 0;
+	// All agents share one main loop thread, so connectivity checks and keepalive timers of idle
+	// connections don't wake a thread per connection
+	class MainLoop;
+	shared_ptr<MainLoop> mMainLoop;
 	unique_ptr<NiceAgent, void (*)(gpointer)> mNiceAgent;
-	unique_ptr<GMainLoop, void (*)(GMainLoop *)> mMainLoop;
-	std::thread mMainLoopThread;
 	guint mTimeoutId = 0;
 	std::mutex mOutgoingMutex;
-	unsigned int mOutgoingDscp;
+	unsigned int mOutgoingDs; // DSCP and ECN
+	bool mUdpSegmentation; // protected by mOutgoingMutex
+
+	// Send datagrams with UDP generic segmentation offload, mOutgoingMutex must be locked
+	// Returns the number of messages processed from the beginning, which is less than the total
+	// if segmentation is unavailable, and increments sent for each message actually sent
+	size_t sendSegmented(const std::vector<message_ptr> &messages, size_t &sent);
 
 	static string AddressToString(const NiceAddress &addr);
 
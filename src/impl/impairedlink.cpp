@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "impairedlink.hpp"
+#include "internals.hpp"
+
+#include <algorithm>
+
+namespace rtc::impl {
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+
+ImpairedLink::ImpairedLink(NetworkImpairment impairment, deliver_callback callback,
+                           now_function now)
+    : mImpairment(std::move(impairment)), mDeliverCallback(std::move(callback)),
+      mNow(std::move(now)), mGenerator(mImpairment.seed) {}
+
+ImpairedLink::~ImpairedLink() { stop(); }
+
+void ImpairedLink::send(message_ptr message) {
+	std::lock_guard lock(mMutex);
+	if (mStopped || lose())
+		return;
+
+	const auto now = this->now();
+	auto time = now;
+	if (mImpairment.bitrate && *mImpairment.bitrate > 0) {
+		// The backlog of the bottleneck is what is not transmitted yet
+		const double bitrate = double(*mImpairment.bitrate);
+		const auto start = std::max(now, mLinkFree);
+		const double backlog = duration<double>(start - now).count() * bitrate / 8;
+		if (backlog + double(message->size()) > double(mImpairment.queueSize))
+			return; // tail drop
+
+		mLinkFree = start + duration_cast<clock::duration>(
+		                        duration<double>(double(message->size()) * 8 / bitrate));
+		time = mLinkFree;
+	}
+
+	if (random() >= mImpairment.reorder) {
+		time += mImpairment.delay;
+		if (mImpairment.jitter.count() > 0)
+			time += duration_cast<clock::duration>(
+			    duration<double, std::milli>(mImpairment.jitter) * (2 * random() - 1));
+	}
+
+	mQueue.push_back({time, mOrder++, std::move(message)});
+	std::push_heap(mQueue.begin(), mQueue.end(), Later());
+	deliver(now);
+	schedule();
+}
+
+void ImpairedLink::stop() {
+	std::lock_guard lock(mMutex);
+	mStopped = true;
+	mTimer.cancel();
+	mQueue.clear();
+}
+
+bool ImpairedLink::lose() {
+	const double transition = mBad ? mImpairment.badToGood : mImpairment.goodToBad;
+	if (random() < transition)
+		mBad = !mBad;
+
+	return random() < (mBad ? mImpairment.lossBad : mImpairment.lossGood);
+}
+
+double ImpairedLink::random() {
+	// Not using a standard distribution, which is implementation-defined, so runs are
+	// reproducible on all platforms
+	return double(mGenerator()) / 4294967296.0;
+}
+
+void ImpairedLink::poll() {
+	std::lock_guard lock(mMutex);
+	if (mStopped)
+		return;
+
+	deliver(now());
+	schedule();
+}
+
+ImpairedLink::clock::time_point ImpairedLink::now() const {
+	return mNow ? mNow() : clock::now();
+}
+
+void ImpairedLink::deliver(clock::time_point now) {
+	while (!mQueue.empty() && mQueue.front().time <= now) {
+		std::pop_heap(mQueue.begin(), mQueue.end(), Later());
+		auto message = std::move(mQueue.back().message);
+		mQueue.pop_back();
+		mDeliverCallback(std::move(message));
+	}
+}
+
+void ImpairedLink::schedule() {
+	if (mQueue.empty() || mNow) // with a virtual clock, delivery is driven by poll()
+		return;
+
+	const auto next = mQueue.front().time;
+	if (mTimer.pending() && mTimerTime <= next)
+		return;
+
+	mTimer.cancel();
+	mTimerTime = next;
+	auto task = [weak_this = weak_from_this()]() {
+		if (auto locked = weak_this.lock())
+			locked->poll();
+	};
+	mTimer = ThreadPool::Instance().scheduleTimer(next, std::move(task));
+}
+
+} // namespace rtc::impl
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_IMPAIRED_LINK_H
+#define RTC_IMPL_IMPAIRED_LINK_H
+
+#include "common.hpp"
+#include "configuration.hpp"
+#include "message.hpp"
+#include "threadpool.hpp"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace rtc::impl {
+
+// Emulates a network path for the in-process loopback, see NetworkImpairment
+// Datagrams are lost, queued at the bottleneck, and delayed, then delivered in order of arrival
+// time with a timer on the thread pool.
+class ImpairedLink final : public std::enable_shared_from_this<ImpairedLink> {
+public:
+	using clock = std::chrono::steady_clock;
+	using deliver_callback = std::function<void(message_ptr message)>;
+	using now_function = std::function<clock::time_point()>;
+
+	// The callback is called with the mutex locked, so it is not called anymore once stopped
+	// With a virtual clock, no timer is scheduled and datagrams are delivered by poll(), so
+	// tests are reproducible including timing.
+	ImpairedLink(NetworkImpairment impairment, deliver_callback callback,
+	             now_function now = nullptr);
+	~ImpairedLink();
+
+	void send(message_ptr message); // the datagram might be lost
+	void poll();                    // delivers datagrams which have arrived
+	void stop();
+
+private:
+	struct Entry {
+		clock::time_point time;
+		uint64_t order; // keeps datagrams arriving at the same time in order
+		message_ptr message;
+	};
+
+	struct Later {
+		bool operator()(const Entry &a, const Entry &b) const {
+			return a.time != b.time ? a.time > b.time : a.order > b.order;
+		}
+	};
+
+	bool lose();
+	double random(); // uniform in [0, 1)
+	clock::time_point now() const;
+	void deliver(clock::time_point now); // mMutex must be locked
+	void schedule();                     // mMutex must be locked
+
+	const NetworkImpairment mImpairment;
+	const deliver_callback mDeliverCallback;
+	const now_function mNow; // null for the real clock
+
+	std::mt19937 mGenerator;
+	bool mBad = false;           // state of the Gilbert-Elliott model
+	clock::time_point mLinkFree; // end of transmission of the last datagram on the bottleneck
+	uint64_t mOrder = 0;
+	std::vector<Entry> mQueue; // heap ordered by arrival time
+	TimerHandle mTimer;
+	clock::time_point mTimerTime;
+	bool mStopped = false;
+
+	std::mutex mMutex;
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -20,12 +20,15 @@
 #include "internals.hpp"
 
 #include "impl/certificate.hpp"
+#include "impl/dnscache.hpp"
 #include "impl/dtlstransport.hpp"
+#include "impl/overloadcontroller.hpp"
 #include "impl/sctptransport.hpp"
 #include "impl/threadpool.hpp"
-#include "impl/tls.hpp"
+#include "impl/threadregistry.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
+#include "impl/pollservice.hpp"
 #include "impl/tlstransport.hpp"
 #endif
 
@@ -49,6 +52,7 @@ struct Init::TokenPayload {
 	~TokenPayload() {
 		std::thread t(
 		    [](std::promise<void> promise) {
+			    impl::ThreadRegistry::Registration registration(impl::ThreadRegistry::Role::Cleanup);
 			    try {
 				    Init::Instance().doCleanup();
 				    promise.set_value();
@@ -93,22 +97,51 @@ void Init::preload() {
 		mGlobal = std::make_shared<TokenPayload>(&mCleanupFuture);
 		mWeak = *mGlobal;
 	}
+
+	// Preloading is meant to pay the initialization cost upfront
+	for (auto subsystem : {Subsystem::Sctp, Subsystem::Dtls, Subsystem::Srtp, Subsystem::Tls,
+	                       Subsystem::PollService})
+		doInitSubsystem(subsystem);
+
+	impl::PreloadCertificates();
 }
 
-std::shared_future<void> Init::cleanup() {
+std::shared_future<void> Init::cleanup(optional<std::chrono::milliseconds> timeout) {
 	std::lock_guard lock(mMutex);
+	if (timeout) {
+		// Connections closing from now on abort their SCTP association at the deadline
+		mCleanupDeadline = std::chrono::steady_clock::now() + *timeout;
+		impl::SctpTransport::SetGlobalShutdownDeadline(mCleanupDeadline);
+	}
+
 	mGlobal.reset();
 	return mCleanupFuture;
 }
 
 void Init::setSctpSettings(SctpSettings s) {
 	std::lock_guard lock(mMutex);
-	if (mGlobal)
+	if (mSubsystems.count(Subsystem::Sctp))
 		impl::SctpTransport::SetSettings(s);
 
 	mCurrentSctpSettings = std::move(s); // store for next init
 }
 
+void Init::init(Subsystem subsystem) {
+	std::lock_guard lock(mMutex);
+	if (mInitialized)
+		doInitSubsystem(subsystem);
+}
+
+void Init::setThreadPoolSettings(ThreadPoolSettings s) {
+	std::lock_guard lock(mMutex);
+	mCurrentThreadPoolSettings = std::move(s); // store for next init
+}
+
+void Init::setOverloadSettings(OverloadSettings s) {
+	std::lock_guard lock(mMutex);
+	mCurrentOverloadSettings = std::move(s); // store for next init
+}
+
 void Init::doInit() {
 	// mMutex needs to be locked
 
@@ -123,23 +156,71 @@ void Init::doInit() {
 		throw std::runtime_error("WSAStartup failed, error=" + std::to_string(WSAGetLastError()));
 #endif
 
-	impl::ThreadPool::Instance().spawn(THREADPOOL_SIZE);
+	const auto &poolSettings = mCurrentThreadPoolSettings;
+	const int workersCount = int(std::max(poolSettings.workersCount.value_or(THREADPOOL_SIZE), 2u));
+	const int cryptoWorkersCount = int(poolSettings.cryptoWorkersCount.value_or(0));
+	impl::ThreadPool::Instance().setExternal(poolSettings.external);
+	if (poolSettings.external) {
+		// The application runs tasks itself with Poll()
+		PLOG_DEBUG << "Using an external executor, no thread pool worker is spawned";
+	} else {
+		impl::ThreadPool::Instance().setPinning(poolSettings.pinWorkers);
+		impl::ThreadPool::Instance().spawn(workersCount);
+		if (cryptoWorkersCount > 0) {
+			impl::ThreadPool::SetCryptoEnabled(true);
+			impl::ThreadPool::Crypto().setPinning(poolSettings.pinWorkers);
+			impl::ThreadPool::Crypto().spawn(cryptoWorkersCount);
+		}
+	}
+
+	impl::OverloadController::Instance().start(mCurrentOverloadSettings);
+
+	// Other subsystems are initialized on first use, so for instance a process opening only a
+	// WebSocket never initializes usrsctp nor libSRTP
+}
+
+void Init::doInitSubsystem(Subsystem subsystem) {
+	// mMutex needs to be locked
+
+	if (mSubsystems.count(subsystem))
+		return;
+
+	switch (subsystem) {
+	case Subsystem::Sctp:
+		// Media-only processes never start the usrsctp thread and timers
+		PLOG_DEBUG << "SCTP initialization";
+		impl::SctpTransport::Init(mCurrentSctpSettings);
+		impl::SctpTransport::SetSettings(mCurrentSctpSettings);
+		break;
+
+	case Subsystem::Dtls:
+		PLOG_DEBUG << "DTLS initialization";
+		impl::DtlsTransport::Init();
+		break;
 
-#if USE_GNUTLS
-	// Nothing to do
-#else
-	openssl::init();
+	case Subsystem::Srtp:
+#if RTC_ENABLE_MEDIA
+		doInitSubsystem(Subsystem::Dtls);
+		PLOG_DEBUG << "SRTP initialization";
+		impl::DtlsSrtpTransport::Init();
 #endif
+		break;
 
-	impl::SctpTransport::Init();
-	impl::SctpTransport::SetSettings(mCurrentSctpSettings);
-	impl::DtlsTransport::Init();
+	case Subsystem::Tls:
 #if RTC_ENABLE_WEBSOCKET
-	impl::TlsTransport::Init();
+		PLOG_DEBUG << "TLS initialization";
+		impl::TlsTransport::Init();
 #endif
-#if RTC_ENABLE_MEDIA
-	impl::DtlsSrtpTransport::Init();
+		break;
+
+	case Subsystem::PollService:
+#if RTC_ENABLE_WEBSOCKET
+		impl::PollService::Instance().start();
 #endif
+		break;
+	}
+
+	mSubsystems.insert(subsystem);
 }
 
 void Init::doCleanup() {
@@ -152,16 +233,50 @@ void Init::doCleanup() {
 
 	PLOG_DEBUG << "Global cleanup";
 
+#if RTC_ENABLE_WEBSOCKET
+	if (mSubsystems.count(Subsystem::PollService))
+		impl::PollService::Instance().join();
+#endif
+
+	impl::OverloadController::Instance().stop();
+
+	if (&impl::ThreadPool::Crypto() != &impl::ThreadPool::Instance()) {
+		impl::ThreadPool::Crypto().join();
+		impl::ThreadPool::SetCryptoEnabled(false);
+	}
 	impl::ThreadPool::Instance().join();
 
-	impl::SctpTransport::Cleanup();
-	impl::DtlsTransport::Cleanup();
+	impl::CleanupCertificateCache();
+	impl::DnsCache::Instance().clear();
+	// If usrsctp can't be cleaned up in time, it stays initialized for the next initialization.
+	// Aborted associations are freed by usrsctp timers, so leave them a moment past the deadline.
+	bool sctpInitialized = false;
+	auto sctpDeadline = mCleanupDeadline;
+	if (sctpDeadline)
+		sctpDeadline = std::max(*sctpDeadline,
+		                        std::chrono::steady_clock::now() + std::chrono::seconds(1));
+
+	if (mSubsystems.count(Subsystem::Sctp) && !impl::SctpTransport::Cleanup(sctpDeadline)) {
+		PLOG_WARNING << "SCTP cleanup timed out";
+		sctpInitialized = true;
+	}
+
+	if (mSubsystems.count(Subsystem::Dtls))
+		impl::DtlsTransport::Cleanup();
 #if RTC_ENABLE_WEBSOCKET
-	impl::TlsTransport::Cleanup();
+	if (mSubsystems.count(Subsystem::Tls))
+		impl::TlsTransport::Cleanup();
 #endif
 #if RTC_ENABLE_MEDIA
-	impl::DtlsSrtpTransport::Cleanup();
+	if (mSubsystems.count(Subsystem::Srtp))
+		impl::DtlsSrtpTransport::Cleanup();
 #endif
+	mSubsystems.clear();
+	if (sctpInitialized)
+		mSubsystems.insert(Subsystem::Sctp);
+
+	mCleanupDeadline.reset();
+	impl::SctpTransport::SetGlobalShutdownDeadline(nullopt);
 
 #ifdef _WIN32
 	WSACleanup();
@@ -20,11 +20,12 @@
 #define RTC_IMPL_INIT_H
 
 #include "common.hpp"
-#include "global.hpp" // for SctpSettings
+#include "global.hpp" // for SctpSettings, ThreadPoolSettings and OverloadSettings
 
 #include <chrono>
-#include <mutex>
 #include <future>
+#include <mutex>
+#include <set>
 
 namespace rtc {
 
@@ -34,6 +35,9 @@ class Init {
 public:
 	static Init &Instance();
 
+	// Subsystems are initialized on first use only and cleaned up independently
+	enum class Subsystem { Sctp, Dtls, Srtp, Tls, PollService };
+
 	Init(const Init &) = delete;
 	Init &operator=(const Init &) = delete;
 	Init(Init &&) = delete;
@@ -41,22 +45,30 @@ public:
 
 	init_token token();
 	void preload();
-	std::shared_future<void> cleanup();
+	std::shared_future<void> cleanup(optional<std::chrono::milliseconds> timeout = nullopt);
 	void setSctpSettings(SctpSettings s);
+	void init(Subsystem subsystem); // no-op if already initialized
+	void setThreadPoolSettings(ThreadPoolSettings s);
+	void setOverloadSettings(OverloadSettings s);
 
 private:
 	Init();
 	~Init();
 
 	void doInit();
+	void doInitSubsystem(Subsystem subsystem);
 	void doCleanup();
 
 	std::optional<shared_ptr<void>> mGlobal;
 	weak_ptr<void> mWeak;
 	bool mInitialized = false;
+	std::set<Subsystem> mSubsystems; // initialized
 	SctpSettings mCurrentSctpSettings = {};
+	ThreadPoolSettings mCurrentThreadPoolSettings = {};
+	OverloadSettings mCurrentOverloadSettings = {};
 	std::mutex mMutex;
 	std::shared_future<void> mCleanupFuture;
+	optional<std::chrono::steady_clock::time_point> mCleanupDeadline;
 
 	struct TokenPayload;
 };
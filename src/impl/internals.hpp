@@ -20,6 +20,12 @@
 #define RTC_IMPL_INTERNALS_H
 
 #include "common.hpp"
+#include "global.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 
 // Disable warnings before including plog
 #if defined(__GNUC__) || defined(__clang__)
@@ -37,6 +43,68 @@
 #pragma warning(pop)
 #endif
 
+// Debug and verbose statements are compiled out entirely when stripping is enabled
+#ifndef RTC_STRIP_DEBUG_LOGS
+#define RTC_STRIP_DEBUG_LOGS 0
+#endif
+
+// Source files may define RTC_LOG_SUBSYSTEM before any include to attach their logs to a
+// subsystem, so that its level can be set at runtime with SetLogLevel()
+#ifndef RTC_LOG_SUBSYSTEM
+#define RTC_LOG_SUBSYSTEM General
+#endif
+
+#define RTC_IF_LOG(severity)                                                                      \
+	if (!rtc::impl::IsLogEnabled(rtc::LogSubsystem::RTC_LOG_SUBSYSTEM, severity)) {              \
+	} else
+
+#undef PLOG_VERBOSE
+#undef PLOG_DEBUG
+#undef PLOG_INFO
+#undef PLOG_WARNING
+
+#if RTC_STRIP_DEBUG_LOGS
+#define PLOG_VERBOSE                                                                              \
+	if (true) {                                                                                   \
+	} else                                                                                        \
+		PLOG(plog::verbose)
+#define PLOG_DEBUG                                                                                \
+	if (true) {                                                                                   \
+	} else                                                                                        \
+		PLOG(plog::debug)
+#else
+#define PLOG_VERBOSE RTC_IF_LOG(plog::verbose) PLOG(plog::verbose)
+#define PLOG_DEBUG RTC_IF_LOG(plog::debug) PLOG(plog::debug)
+#endif
+#define PLOG_INFO RTC_IF_LOG(plog::info) PLOG(plog::info)
+#define PLOG_WARNING RTC_IF_LOG(plog::warning) PLOG(plog::warning)
+
+namespace rtc::impl {
+
+const size_t LOG_SUBSYSTEM_COUNT = 8; // Number of LogSubsystem values
+
+// Runtime levels set with SetLogLevel(), they default to verbose
+extern std::array<std::atomic<int>, LOG_SUBSYSTEM_COUNT> LogSubsystemLevels;
+
+inline bool IsLogEnabled(LogSubsystem subsystem, plog::Severity severity) {
+	const auto &level = LogSubsystemLevels[static_cast<size_t>(subsystem)];
+	return static_cast<int>(severity) <= level.load(std::memory_order_relaxed);
+}
+
+// Most verbose severity which can currently be output for the subsystem, for external libraries
+inline plog::Severity MaxLogSeverity(LogSubsystem subsystem) {
+	auto logger = plog::get();
+	auto severity = logger ? logger->getMaxSeverity() : plog::none;
+	const auto &level = LogSubsystemLevels[static_cast<size_t>(subsystem)];
+	severity = std::min(severity, static_cast<plog::Severity>(level.load()));
+#if RTC_STRIP_DEBUG_LOGS
+	severity = std::min(severity, plog::info);
+#endif
+	return severity;
+}
+
+} // namespace rtc::impl
+
 namespace rtc {
 
 const size_t MAX_NUMERICNODE_LEN = 48; // Max IPv6 string representation length
@@ -48,10 +116,21 @@ const size_t DEFAULT_LOCAL_MAX_MESSAGE_SIZE = 256 * 1024; // Default local max m
 const size_t DEFAULT_MAX_MESSAGE_SIZE = 65536; // Remote max message size if not specified in SDP
 
 const size_t RECV_QUEUE_LIMIT = 1024 * 1024; // Max per-channel queue size
+const size_t RECV_WINDOW = 1024 * 1024;      // Default per-channel held back amount over the limit
+
+const uint16_t COMPACT_SCTP_STREAMS = 256;        // SCTP streams negotiated with compactMemory
+const size_t COMPACT_SCTP_BUFFER_SIZE = 64 * 1024; // Initial SCTP buffers with compactMemory
+const size_t SCTP_REASSEMBLY_RESERVE = 64 * 1024;  // Initial reservation for partial messages
+
+const size_t STREAM_CHUNK_SIZE = 65536;         // Max fragment size for streamed messages
+const size_t STREAM_BUFFER_LIMIT = 1024 * 1024; // Max amount buffered by a streamed message
+
+const std::chrono::milliseconds DEFAULT_WS_PING_INTERVAL(10000); // WebSocket keepalive when idle
 
 const int THREADPOOL_SIZE = 4; // Number of threads in the global thread pool (>= 2)
 
 const size_t DEFAULT_MTU = RTC_DEFAULT_MTU; // defined in rtc.h
+const size_t MAX_PATH_MTU = 1500;           // Standard Ethernet, upper bound for discovery
 
 } // namespace rtc
 
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "iouring.hpp"
+#include "internals.hpp"
+
+#if RTC_ENABLE_WEBSOCKET && USE_IO_URING && defined(__linux__)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace rtc::impl {
+
+namespace {
+
+int io_uring_setup(unsigned int entries, struct io_uring_params *params) {
+	return int(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags,
+                   const void *arg, size_t argSize) {
+	return int(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+template <typename T> T *offset(void *base, uint32_t off) {
+	return reinterpret_cast<T *>(static_cast<char *>(base) + off);
+}
+
+} // namespace
+
+IoUring::IoUring(unsigned int entries) {
+	struct io_uring_params params = {};
+	mFd = io_uring_setup(entries, &params);
+	if (mFd < 0)
+		throw std::runtime_error("io_uring setup failed, errno=" + std::to_string(errno));
+
+	try {
+		// Waiting with a timeout needs EXT_ARG (Linux 5.11), and completions for many sockets must
+		// not be dropped if the completion ring overflows
+		if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+			throw std::runtime_error("io_uring features are missing, the kernel is too old");
+
+		mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMmap)
+			mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+
+		mSqRing = ::mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                 mFd, IORING_OFF_SQ_RING);
+		if (mSqRing == MAP_FAILED) {
+			mSqRing = nullptr;
+			throw std::runtime_error("io_uring submission ring mapping failed");
+		}
+
+		if (singleMmap) {
+			mCqRing = mSqRing;
+		} else {
+			mCqRing = ::mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE,
+			                 MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+			if (mCqRing == MAP_FAILED) {
+				mCqRing = nullptr;
+				throw std::runtime_error("io_uring completion ring mapping failed");
+			}
+		}
+
+		mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		void *sqes = ::mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                    mFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			throw std::runtime_error("io_uring submission entries mapping failed");
+
+		mSqes = static_cast<struct io_uring_sqe *>(sqes);
+
+	} catch (...) {
+		if (mCqRing && mCqRing != mSqRing)
+			::munmap(mCqRing, mCqRingSize);
+		if (mSqRing)
+			::munmap(mSqRing, mSqRingSize);
+		::close(mFd);
+		throw;
+	}
+
+	mSqHead = offset<unsigned>(mSqRing, params.sq_off.head);
+	mSqTail = offset<unsigned>(mSqRing, params.sq_off.tail);
+	mSqMask = offset<unsigned>(mSqRing, params.sq_off.ring_mask);
+	mSqArray = offset<unsigned>(mSqRing, params.sq_off.array);
+	mSqEntries = params.sq_entries;
+	mCqHead = offset<unsigned>(mCqRing, params.cq_off.head);
+	mCqTail = offset<unsigned>(mCqRing, params.cq_off.tail);
+	mCqMask = offset<unsigned>(mCqRing, params.cq_off.ring_mask);
+	mCqes = offset<struct io_uring_cqe>(mCqRing, params.cq_off.cqes);
+
+	PLOG_VERBOSE << "io_uring created, entries=" << params.sq_entries;
+}
+
+IoUring::~IoUring() {
+	::munmap(mSqes, mSqesSize);
+	if (mCqRing != mSqRing)
+		::munmap(mCqRing, mCqRingSize);
+	::munmap(mSqRing, mSqRingSize);
+	::close(mFd);
+}
+
+void IoUring::pollAdd(int fd, uint32_t events, uint64_t userData) {
+	auto *sqe = nextSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	events = (events << 16) | (events >> 16); // the kernel expects swapped half-words
+#endif
+	sqe->poll32_events = events;
+	sqe->user_data = userData;
+	pushSqe();
+}
+
+void IoUring::pollRemove(uint64_t target, uint64_t userData) {
+	auto *sqe = nextSqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = userData;
+	pushSqe();
+}
+
+void IoUring::submit() {
+	while (mQueued > 0) {
+		int ret = io_uring_enter(mFd, unsigned(mQueued), 0, 0, nullptr, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EBUSY)
+				return; // out of resources, retry on next submission
+
+			throw std::runtime_error("io_uring submission failed, errno=" + std::to_string(errno));
+		}
+		mQueued -= std::min(mQueued, size_t(ret));
+	}
+}
+
+void IoUring::wait(optional<std::chrono::nanoseconds> timeout) {
+	struct __kernel_timespec ts = {};
+	struct io_uring_getevents_arg arg = {};
+	if (timeout) {
+		const auto ns = std::max(timeout->count(), std::chrono::nanoseconds::rep(0));
+		ts.tv_sec = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+
+	int ret = io_uring_enter(mFd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+	                         sizeof(arg));
+	if (ret < 0 && errno != ETIME && errno != EINTR)
+		throw std::runtime_error("io_uring wait failed, errno=" + std::to_string(errno));
+}
+
+size_t IoUring::reap(const completion_callback &callback) {
+	unsigned head = *mCqHead; // only written by us
+	const unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+	size_t count = 0;
+	while (head != tail) {
+		const auto &cqe = mCqes[head & *mCqMask];
+		callback(cqe.user_data, cqe.res);
+		++head;
+		++count;
+	}
+	__atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+struct io_uring_sqe *IoUring::nextSqe() {
+	unsigned tail = *mSqTail; // only written by us
+	if (tail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mSqEntries) {
+		submit();
+		if (tail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mSqEntries)
+			throw std::runtime_error("io_uring submission ring is full");
+	}
+
+	const unsigned index = tail & *mSqMask;
+	auto *sqe = &mSqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	mSqArray[index] = index;
+	return sqe;
+}
+
+void IoUring::pushSqe() {
+	__atomic_store_n(mSqTail, *mSqTail + 1, __ATOMIC_RELEASE);
+	++mQueued;
+}
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_IO_URING_H
+#define RTC_IMPL_IO_URING_H
+
+#include "common.hpp"
+
+#if RTC_ENABLE_WEBSOCKET && USE_IO_URING && defined(__linux__)
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace rtc::impl {
+
+// Minimal io_uring instance over the raw system calls, for the poll service
+// Submission is not thread-safe and completions must be reaped by a single thread, however
+// waiting for completions may happen concurrently with submission.
+class IoUring final {
+public:
+	using completion_callback = std::function<void(uint64_t userData, int32_t res)>;
+
+	IoUring(unsigned int entries); // throws if io_uring is not available
+	~IoUring();
+
+	IoUring(const IoUring &) = delete;
+	IoUring &operator=(const IoUring &) = delete;
+
+	// Requests are queued until the next submit()
+	void pollAdd(int fd, uint32_t events, uint64_t userData); // one-shot
+	void pollRemove(uint64_t target, uint64_t userData);
+
+	size_t queued() const { return mQueued; }
+	void submit();
+
+	// Wait for at least one completion, or until the timeout
+	void wait(optional<std::chrono::nanoseconds> timeout);
+	size_t reap(const completion_callback &callback);
+
+private:
+	io_uring_sqe *nextSqe(); // must be followed by pushSqe() once filled
+	void pushSqe();
+
+	int mFd = -1;
+	void *mSqRing = nullptr, *mCqRing = nullptr;
+	size_t mSqRingSize = 0, mCqRingSize = 0;
+	io_uring_sqe *mSqes = nullptr;
+	size_t mSqesSize = 0;
+
+	unsigned *mSqHead, *mSqTail, *mSqMask, *mSqArray;
+	unsigned mSqEntries;
+	unsigned *mCqHead, *mCqTail, *mCqMask;
+	io_uring_cqe *mCqes;
+
+	size_t mQueued = 0;
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "latencytracer.hpp"
+
+#include <algorithm>
+
+namespace rtc::impl {
+
+LatencyTracer::LatencyTracer(unsigned int sampleInterval)
+    : mSampleInterval(std::max(sampleInterval, 1u)) {}
+
+bool LatencyTracer::sample(Stage stage) {
+	if (mSampleInterval == 1)
+		return true;
+
+	auto &counter = mHistograms[stage].sampleCounter;
+	return counter.fetch_add(1, std::memory_order_relaxed) % mSampleInterval == 0;
+}
+
+void LatencyTracer::record(Stage stage, clock::duration duration) {
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	size_t index = LatencyHistogram::BucketIndex(uint64_t(std::max(ns, decltype(ns)(0))));
+	mHistograms[stage].counts[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+LatencyStats LatencyTracer::stats() const {
+	LatencyStats s;
+	read(SctpQueue, s.sctpQueue);
+	read(DtlsEncrypt, s.dtlsEncrypt);
+	read(IceSend, s.iceSend);
+	read(DtlsDecrypt, s.dtlsDecrypt);
+	read(SctpInput, s.sctpInput);
+	read(Delivery, s.delivery);
+	return s;
+}
+
+void LatencyTracer::clear() {
+	for (auto &histogram : mHistograms)
+		for (auto &count : histogram.counts)
+			count.store(0, std::memory_order_relaxed);
+}
+
+void LatencyTracer::read(Stage stage, LatencyHistogram &histogram) const {
+	const auto &counts = mHistograms[stage].counts;
+	histogram.count = 0;
+	for (size_t i = 0; i < LatencyHistogram::BucketCount; ++i) {
+		histogram.counts[i] = counts[i].load(std::memory_order_relaxed);
+		histogram.count += histogram.counts[i];
+	}
+}
+
+} // namespace rtc::impl
@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_LATENCY_TRACER_H
+#define RTC_IMPL_LATENCY_TRACER_H
+
+#include "common.hpp"
+#include "rtc/peerconnection.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+namespace rtc::impl {
+
+// Per-connection latency histograms at transport layer boundaries
+// Only one event out of the sample interval is timed for each stage, recording is lock-free.
+class LatencyTracer final {
+public:
+	using clock = std::chrono::steady_clock;
+
+	enum Stage : int {
+		SctpQueue = 0,
+		DtlsEncrypt,
+		IceSend,
+		DtlsDecrypt,
+		SctpInput,
+		Delivery,
+		StageCount
+	};
+
+	LatencyTracer(unsigned int sampleInterval);
+
+	bool sample(Stage stage); // true once every sample interval for the stage
+	void record(Stage stage, clock::duration duration);
+	void record(Stage stage, clock::time_point since) { record(stage, clock::now() - since); }
+
+	LatencyStats stats() const;
+	void clear();
+
+private:
+	// Stages are recorded from different threads, so they are kept on separate cache lines
+	struct alignas(64) Histogram {
+		std::atomic<unsigned int> sampleCounter = 0;
+		std::array<std::atomic<uint64_t>, LatencyHistogram::BucketCount> counts = {};
+	};
+
+	void read(Stage stage, LatencyHistogram &histogram) const;
+
+	const unsigned int mSampleInterval;
+	std::array<Histogram, StageCount> mHistograms;
+};
+
+} // namespace rtc::impl
+
+#endif
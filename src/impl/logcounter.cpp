@@ -29,8 +29,13 @@ LogCounter::LogCounter(plog::Severity severity, const std::string &text,
 }
 
 LogCounter &LogCounter::operator++(int) {
+	// Don't bother counting if the summary would be filtered anyway
+	auto logger = plog::get();
+	if (!logger || !logger->checkSeverity(mData->mSeverity))
+		return *this;
+
 	if (mData->mCount++ == 0) {
-		ThreadPool::Instance().schedule(
+		ThreadPool::Instance().scheduleTimer(
 		    mData->mDuration,
 		    [](weak_ptr<LogData> data) {
 			    if (auto ptr = data.lock()) {
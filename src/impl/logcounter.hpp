@@ -48,4 +48,11 @@ public:
 
 } // namespace rtc::impl
 
+// Count a hot-path event with a function-local LogCounter instead of logging each occurrence
+#define PLOG_COUNTED(severity, text)                                                              \
+	do {                                                                                          \
+		static rtc::impl::LogCounter counter(severity, text);                                     \
+		counter++;                                                                                \
+	} while (0)
+
 #endif // RTC_SERVER_LOGCOUNTER_HPP
@@ -0,0 +1,280 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define RTC_LOG_SUBSYSTEM Ice
+
+#include "loopbacktransport.hpp"
+#include "internals.hpp"
+#include "threadpool.hpp"
+
+#include <random>
+
+namespace rtc::impl {
+
+namespace {
+
+const size_t QueueLimit = 4096; // datagrams, the excess is dropped like by a full socket buffer
+
+} // namespace
+
+std::mutex LoopbackTransport::RegistryMutex;
+std::unordered_map<string, LoopbackTransport *> LoopbackTransport::Registry;
+
+LoopbackTransport::LoopbackTransport(const Configuration &config,
+                                     candidate_callback candidateCallback,
+                                     state_callback stateChangeCallback,
+                                     gathering_state_callback gatheringStateChangeCallback)
+    : IceTransport(without_agent_t{}, config, std::move(candidateCallback),
+                   std::move(stateChangeCallback), std::move(gatheringStateChangeCallback)),
+      mUfrag(GenerateCredential(16)), mPwd(GenerateCredential(24)), mQueue(QueueLimit) {
+
+	PLOG_DEBUG << "Initializing in-process loopback transport";
+	if (config.loopbackImpairment) {
+		PLOG_INFO << "Impairing datagrams sent over the in-process loopback";
+		// The link is stopped before destruction, so it never calls back afterwards
+		auto callback = [this](message_ptr message) { deliver(std::move(message)); };
+		mLink = std::make_shared<ImpairedLink>(*config.loopbackImpairment, std::move(callback));
+	}
+
+	std::lock_guard lock(RegistryMutex);
+	Registry.emplace(mUfrag, this);
+}
+
+LoopbackTransport::~LoopbackTransport() { stop(); }
+
+Description LoopbackTransport::getLocalDescription(Description::Type type) const {
+	string sdp;
+	{
+		std::lock_guard lock(RegistryMutex);
+		sdp = "a=ice-ufrag:" + mUfrag + "\r\na=ice-pwd:" + mPwd + "\r\n";
+	}
+
+	// RFC 5763: The endpoint that is the offerer MUST use the setup attribute value of
+	// setup:actpass.
+	return Description(sdp, type,
+	                   type == Description::Type::Offer ? Description::Role::ActPass : mRole);
+}
+
+void LoopbackTransport::setRemoteDescription(const Description &description) {
+	if (mRole == Description::Role::ActPass)
+		mRole = description.role() == Description::Role::Active ? Description::Role::Passive
+		                                                        : Description::Role::Active;
+	if (mRole == description.role())
+		throw std::logic_error("Incompatible roles with remote description");
+
+	mMid = description.bundleMid();
+
+	auto ufrag = description.iceUfrag();
+	if (!ufrag)
+		throw std::invalid_argument("Remote description has no ICE credentials");
+
+	shared_ptr<LoopbackTransport> peer;
+	{
+		std::lock_guard lock(RegistryMutex);
+		if (mRemoteUfrag == ufrag)
+			return; // renegotiation
+
+		auto it = Registry.find(*ufrag);
+		if (it == Registry.end())
+			throw std::runtime_error("Remote peer for in-process loopback not found");
+
+		// The transport setting its remote description last connects both
+		mRemoteUfrag = std::move(ufrag);
+		if (it->second->mRemoteUfrag == mUfrag)
+			peer = it->second->weak_from_this().lock();
+	}
+
+	changeState(State::Connecting);
+	if (peer)
+		connect(std::move(peer));
+}
+
+bool LoopbackTransport::addRemoteCandidate(const Candidate &) { return true; }
+
+optional<string> LoopbackTransport::getLocalAddress() const { return nullopt; }
+
+optional<string> LoopbackTransport::getRemoteAddress() const { return nullopt; }
+
+bool LoopbackTransport::getSelectedCandidatePair(Candidate *, Candidate *) { return false; }
+
+void LoopbackTransport::restart() {
+	PLOG_INFO << "Restarting in-process loopback";
+
+	// Like a new agent, fresh credentials are paired again, the peer is kept until then
+	{
+		std::lock_guard lock(RegistryMutex);
+		Registry.erase(mUfrag);
+		mUfrag = GenerateCredential(16);
+		mPwd = GenerateCredential(24);
+		mRemoteUfrag.reset();
+		Registry.emplace(mUfrag, this);
+	}
+
+	mGatheringState = GatheringState::New;
+	changeState(State::Connecting);
+}
+
+bool LoopbackTransport::stop() {
+	{
+		std::lock_guard lock(RegistryMutex);
+		if (auto it = Registry.find(mUfrag); it != Registry.end() && it->second == this)
+			Registry.erase(it);
+	}
+
+	if (mLink)
+		mLink->stop(); // no more deliveries once stopped
+
+	disconnect();
+	mQueue.stop();
+	return IceTransport::stop();
+}
+
+bool LoopbackTransport::outgoing(message_ptr message) {
+	// Datagrams lost on the impaired link count as sent, like on a real network
+	const size_t size = message->size();
+	if (mLink)
+		mLink->send(std::move(message));
+	else if (!deliver(std::move(message)))
+		return false;
+
+	recordSent(size);
+	return true;
+}
+
+bool LoopbackTransport::deliver(message_ptr message) {
+	std::lock_guard lock(mPeerMutex);
+	auto peer = mPeer.lock();
+	if (!peer)
+		return false;
+
+	// Datagrams are handed over without copy, the sender never touches them once sent
+	if (!peer->mQueue.push(std::move(message)))
+		return false;
+
+	peer->schedule();
+	return true;
+}
+
+size_t LoopbackTransport::transmitBatch(const std::vector<message_ptr> &messages) {
+	auto s = state();
+	if (s != State::Connected && s != State::Completed)
+		return 0;
+
+	size_t count = 0;
+	for (const auto &message : messages)
+		if (message && outgoing(message))
+			++count;
+
+	return count;
+}
+
+void LoopbackTransport::startGathering() {
+	// There is no candidate to gather
+	processGatheringDone();
+}
+
+void LoopbackTransport::connect(shared_ptr<LoopbackTransport> peer) {
+	PLOG_DEBUG << "In-process loopback connected";
+	{
+		std::lock_guard lock(mPeerMutex);
+		mPeer = peer;
+	}
+	{
+		std::lock_guard lock(peer->mPeerMutex);
+		peer->mPeer = weak_from_this();
+	}
+
+	// State changes are reported asynchronously like from an agent, then datagrams received in
+	// the meantime are delivered
+	for (auto transport : {shared_from_this(), std::move(peer)}) {
+		auto task = [weak_transport = weak_ptr(transport)]() {
+			if (auto locked = weak_transport.lock()) {
+				locked->changeState(State::Connected);
+				locked->schedule();
+			}
+		};
+		ThreadPool::Instance().post(Task(std::move(task)), ThreadPool::Affinity(transport.get()));
+	}
+}
+
+void LoopbackTransport::disconnect() {
+	shared_ptr<LoopbackTransport> peer;
+	{
+		std::lock_guard lock(mPeerMutex);
+		peer = mPeer.lock();
+		mPeer.reset();
+	}
+	if (!peer)
+		return;
+
+	{
+		std::lock_guard lock(peer->mPeerMutex);
+		peer->mPeer.reset();
+	}
+
+	// The peer is disconnected right away instead of after a consent timeout
+	auto task = [weak_peer = weak_ptr(peer)]() {
+		if (auto locked = weak_peer.lock())
+			locked->changeState(State::Disconnected);
+	};
+	ThreadPool::Instance().post(Task(std::move(task)), ThreadPool::Affinity(peer.get()));
+}
+
+void LoopbackTransport::schedule() {
+	if (mDraining.exchange(true))
+		return;
+
+	auto task = [weak_this = weak_from_this()]() {
+		if (auto locked = weak_this.lock())
+			locked->drain();
+	};
+	ThreadPool::Instance().post(Task(std::move(task)), ThreadPool::Affinity(this));
+}
+
+void LoopbackTransport::drain() {
+	// Datagrams wait in the queue until connected, so the first ones are not lost
+	auto s = state();
+	if (s != State::Connected && s != State::Completed) {
+		mDraining = false;
+		return;
+	}
+
+	do {
+		while (auto message = mQueue.tryPop()) {
+			PLOG_VERBOSE << "Incoming size=" << (*message)->size() << " (loopback)";
+			recordReceived((*message)->size());
+			incoming(std::move(*message));
+		}
+		mDraining = false;
+
+		// A datagram might have been pushed after the queue was found empty
+	} while (!mQueue.empty() && !mDraining.exchange(true));
+}
+
+string LoopbackTransport::GenerateCredential(size_t length) {
+	static const char Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::random_device device;
+	std::uniform_int_distribution<size_t> distribution(0, sizeof(Chars) - 2);
+	string credential(length, '\0');
+	for (auto &c : credential)
+		c = Chars[distribution(device)];
+
+	return credential;
+}
+
+} // namespace rtc::impl
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_LOOPBACK_TRANSPORT_H
+#define RTC_IMPL_LOOPBACK_TRANSPORT_H
+
+#include "common.hpp"
+#include "icetransport.hpp"
+#include "impairedlink.hpp"
+#include "init.hpp"
+#include "ringqueue.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace rtc::impl {
+
+// In-process replacement for the ICE agent, see Configuration::enableInProcessLoopback
+// Transports are paired by ICE credentials once both descriptions are set, then datagrams are
+// pushed to the queue of the peer and delivered on the thread pool, like received from a socket.
+// With an impairment, outgoing datagrams go through an emulated network path first.
+class LoopbackTransport final : public IceTransport,
+                                public std::enable_shared_from_this<LoopbackTransport> {
+public:
+	LoopbackTransport(const Configuration &config, candidate_callback candidateCallback,
+	                  state_callback stateChangeCallback,
+	                  gathering_state_callback gatheringStateChangeCallback);
+	~LoopbackTransport();
+
+	Description getLocalDescription(Description::Type type) const override;
+	void setRemoteDescription(const Description &description) override;
+	bool addRemoteCandidate(const Candidate &candidate) override;
+
+	optional<string> getLocalAddress() const override;
+	optional<string> getRemoteAddress() const override;
+	bool getSelectedCandidatePair(Candidate *local, Candidate *remote) override;
+
+	void restart() override;
+	bool stop() override;
+
+private:
+	bool outgoing(message_ptr message) override;
+	size_t transmitBatch(const std::vector<message_ptr> &messages) override;
+	void startGathering() override;
+
+	bool deliver(message_ptr message); // to the peer
+	void connect(shared_ptr<LoopbackTransport> peer);
+	void disconnect();
+	void schedule();
+	void drain();
+
+	static string GenerateCredential(size_t length);
+
+	static std::mutex RegistryMutex;
+	static std::unordered_map<string, LoopbackTransport *> Registry; // by local ICE ufrag
+
+	// Keep an init token, deliveries are posted to the thread pool
+	const init_token mInitToken = Init::Instance().token();
+
+	// Credentials and pairing are protected by the mutex of the registry
+	string mUfrag;
+	string mPwd;
+	optional<string> mRemoteUfrag;
+
+	std::mutex mPeerMutex; // serializes pushes to the queue of the peer, which has one producer
+	weak_ptr<LoopbackTransport> mPeer;
+
+	RingQueue<message_ptr> mQueue; // incoming datagrams
+	std::atomic<bool> mDraining = false;
+
+	shared_ptr<ImpairedLink> mLink; // outgoing, null without impairment
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,262 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "mdns.hpp"
+#include "internals.hpp"
+#include "socket.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <random>
+
+namespace rtc::impl {
+
+using namespace std::chrono;
+
+namespace {
+
+const char *const MdnsGroup = "224.0.0.251";
+const uint16_t MdnsPort = 5353;
+const uint16_t TypeA = 1;
+const uint16_t TypeAAAA = 28;
+const uint16_t ClassIn = 1;
+const uint16_t UnicastResponseBit = 0x8000; // QU bit in the question class (RFC 6762 5.4)
+const size_t HeaderSize = 12;
+const size_t MaxPacketSize = 9000; // RFC 6762 17
+const int Attempts = 2;
+
+uint16_t read16(const char *p) {
+	return uint16_t((uint8_t(p[0]) << 8) | uint8_t(p[1]));
+}
+
+void write16(string &out, uint16_t value) {
+	out.push_back(char(value >> 8));
+	out.push_back(char(value & 0xFF));
+}
+
+bool equalsIgnoreCase(const string &a, const string &b) {
+	return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+		       return std::tolower(uint8_t(x)) == std::tolower(uint8_t(y));
+	       });
+}
+
+string makeQuery(uint16_t id, const string &hostname, bool ipv4Only) {
+	string query;
+	write16(query, id);
+	write16(query, 0);                // flags
+	write16(query, ipv4Only ? 1 : 2); // questions
+	write16(query, 0);                // answers
+	write16(query, 0);                // authority records
+	write16(query, 0);                // additional records
+
+	string name;
+	size_t begin = 0;
+	while (begin < hostname.size()) {
+		size_t end = std::min(hostname.find('.', begin), hostname.size());
+		if (end == begin || end - begin > 63)
+			throw std::invalid_argument("Invalid mDNS hostname: " + hostname);
+
+		name.push_back(char(end - begin));
+		name.append(hostname, begin, end - begin);
+		begin = end + 1;
+	}
+	name.push_back('\0');
+
+	for (uint16_t type : {TypeA, TypeAAAA}) {
+		if (type == TypeAAAA && ipv4Only)
+			break;
+
+		query += name;
+		write16(query, type);
+		write16(query, ClassIn | UnicastResponseBit);
+	}
+	return query;
+}
+
+// Reads a possibly compressed name at offset, which is moved past it
+optional<string> readName(const char *data, size_t size, size_t &offset) {
+	string name;
+	size_t pos = offset;
+	bool jumped = false;
+	int jumps = 0;
+	while (true) {
+		if (pos >= size)
+			return nullopt;
+
+		uint8_t len = uint8_t(data[pos]);
+		if ((len & 0xC0) == 0xC0) { // compression pointer
+			if (pos + 1 >= size || ++jumps > 16)
+				return nullopt;
+
+			if (!jumped)
+				offset = pos + 2;
+
+			jumped = true;
+			pos = read16(data + pos) & 0x3FFF;
+			continue;
+		}
+
+		if (len == 0) {
+			if (!jumped)
+				offset = pos + 1;
+
+			return name;
+		}
+
+		if (len > 63 || pos + 1 + len > size)
+			return nullopt;
+
+		if (!name.empty())
+			name.push_back('.');
+
+		name.append(data + pos + 1, len);
+		pos += 1 + len;
+	}
+}
+
+std::vector<string> parseResponse(const char *data, size_t size, uint16_t id,
+                                  const string &hostname, bool ipv4Only) {
+	std::vector<string> addresses;
+	if (size < HeaderSize || read16(data) != id || !(read16(data + 2) & 0x8000))
+		return addresses; // not a response to our query
+
+	size_t questions = read16(data + 4);
+	size_t records = size_t(read16(data + 6)) + read16(data + 8) + read16(data + 10);
+	size_t offset = HeaderSize;
+	while (questions--) {
+		if (!readName(data, size, offset) || offset + 4 > size)
+			return addresses;
+
+		offset += 4;
+	}
+
+	while (records--) {
+		auto name = readName(data, size, offset);
+		if (!name || offset + 10 > size)
+			break;
+
+		uint16_t type = read16(data + offset);
+		uint16_t cls = read16(data + offset + 2) & 0x7FFF; // ignore the cache-flush bit
+		size_t length = read16(data + offset + 8);
+		offset += 10;
+		if (offset + length > size)
+			break;
+
+		if (cls == ClassIn && equalsIgnoreCase(*name, hostname)) {
+			char buffer[INET6_ADDRSTRLEN];
+			if (type == TypeA && length == 4) {
+				if (inet_ntop(AF_INET, data + offset, buffer, INET6_ADDRSTRLEN))
+					addresses.emplace_back(buffer);
+			} else if (type == TypeAAAA && length == 16 && !ipv4Only) {
+				if (inet_ntop(AF_INET6, data + offset, buffer, INET6_ADDRSTRLEN))
+					addresses.emplace_back(buffer);
+			}
+		}
+		offset += length;
+	}
+	return addresses;
+}
+
+} // namespace
+
+bool IsMdnsHostname(const string &hostname) {
+	string name = hostname;
+	if (!name.empty() && name.back() == '.')
+		name.pop_back();
+
+	const string suffix = ".local";
+	return name.size() > suffix.size() &&
+	       equalsIgnoreCase(name.substr(name.size() - suffix.size()), suffix);
+}
+
+std::vector<string> MdnsResolve(const string &hostname, bool ipv4Only, milliseconds timeout) {
+	PLOG_DEBUG << "Resolving \"" << hostname << "\" with mDNS";
+
+	string name = hostname;
+	if (!name.empty() && name.back() == '.')
+		name.pop_back();
+
+	std::random_device device;
+	const uint16_t id = std::uniform_int_distribution<uint16_t>()(device);
+	const string query = makeQuery(id, name, ipv4Only);
+
+	socket_t sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock == INVALID_SOCKET) {
+		PLOG_WARNING << "Unable to create mDNS socket, errno=" << sockerrno;
+		return {};
+	}
+
+	struct sockaddr_in group = {};
+	group.sin_family = AF_INET;
+	group.sin_port = htons(MdnsPort);
+	inet_pton(AF_INET, MdnsGroup, &group.sin_addr);
+
+	// Responses are only accepted from the link (RFC 6762 11)
+	int ttl = 255;
+	::setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, reinterpret_cast<const char *>(&ttl),
+	             sizeof(ttl));
+
+	std::vector<string> addresses;
+	std::vector<char> buffer(MaxPacketSize);
+	for (int attempt = 0; attempt < Attempts && addresses.empty(); ++attempt) {
+		if (::sendto(sock, query.data(), int(query.size()), 0,
+		             reinterpret_cast<const struct sockaddr *>(&group), sizeof(group)) < 0) {
+			PLOG_WARNING << "Unable to send mDNS query, errno=" << sockerrno;
+			break;
+		}
+
+		const auto deadline = steady_clock::now() + timeout / Attempts;
+		while (addresses.empty()) {
+			auto left = duration_cast<milliseconds>(deadline - steady_clock::now());
+			if (left.count() <= 0)
+				break;
+
+			struct pollfd pfd = {};
+			pfd.fd = sock;
+			pfd.events = POLLIN;
+			int ret = ::poll(&pfd, 1, int(left.count()));
+			if (ret < 0) {
+				if (sockerrno == SEINTR || sockerrno == SEAGAIN)
+					continue;
+
+				PLOG_WARNING << "mDNS poll failed, errno=" << sockerrno;
+				attempt = Attempts;
+				break;
+			}
+			if (ret == 0)
+				break;
+
+			int len = ::recv(sock, buffer.data(), int(buffer.size()), 0);
+			if (len > 0)
+				addresses = parseResponse(buffer.data(), size_t(len), id, name, ipv4Only);
+		}
+	}
+
+	::closesocket(sock);
+
+	if (addresses.empty()) {
+		PLOG_DEBUG << "No mDNS answer for \"" << hostname << "\"";
+	} else {
+		PLOG_VERBOSE << "Resolved \"" << hostname << "\" with mDNS to " << addresses.size()
+		             << " address(es)";
+	}
+	return addresses;
+}
+
+} // namespace rtc::impl
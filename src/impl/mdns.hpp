@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_MDNS_H
+#define RTC_IMPL_MDNS_H
+
+#include "common.hpp"
+
+#include <chrono>
+#include <vector>
+
+namespace rtc::impl {
+
+// True for names in the .local domain, which browsers use to hide host candidate addresses
+bool IsMdnsHostname(const string &hostname);
+
+// One-shot multicast DNS query (RFC 6762 5.1), sent from an ephemeral port so responders answer
+// directly by unicast. Blocks until an answer is received or the timeout expires, returns numeric
+// addresses, or an empty vector if nobody answered.
+std::vector<string>
+MdnsResolve(const string &hostname, bool ipv4Only = false,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(1500));
+
+} // namespace rtc::impl
+
+#endif
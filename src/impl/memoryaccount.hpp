@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_MEMORY_ACCOUNT_H
+#define RTC_IMPL_MEMORY_ACCOUNT_H
+
+#include "common.hpp"
+
+#include <atomic>
+
+namespace rtc::impl {
+
+// Bytes held in the queues and buffers of a PeerConnection, updated by its channels and SCTP
+// transport as they grow and shrink, so checking the limit is only a few relaxed loads
+struct MemoryAccount final {
+	explicit MemoryAccount(optional<size_t> limit_) : limit(limit_) {}
+
+	size_t total() const {
+		const auto relaxed = std::memory_order_relaxed;
+		return receiveQueues.load(relaxed) + sendQueue.load(relaxed) + reassembly.load(relaxed);
+	}
+
+	bool exceeded(size_t extra = 0) const { return limit && total() + extra > *limit; }
+
+	const optional<size_t> limit;
+
+	// Shared pointers to the counters are obtained with the aliasing constructor
+	std::atomic<size_t> receiveQueues = 0; // DataChannel and Track receive queues
+	std::atomic<size_t> sendQueue = 0;     // SCTP send queue
+	std::atomic<size_t> reassembly = 0;    // SCTP partial messages, by capacity
+};
+
+inline shared_ptr<std::atomic<size_t>> receive_queues_amount(shared_ptr<MemoryAccount> account) {
+	if (!account)
+		return nullptr;
+
+	auto *counter = &account->receiveQueues;
+	return shared_ptr<std::atomic<size_t>>(std::move(account), counter);
+}
+
+} // namespace rtc::impl
+
+#endif
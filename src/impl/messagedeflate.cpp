@@ -0,0 +1,265 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "messagedeflate.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace rtc::impl {
+
+namespace {
+
+// Each compressed message ends with an empty stored block which is not transmitted
+const byte Tail[4] = {byte{0x00}, byte{0x00}, byte{0xFF}, byte{0xFF}};
+
+} // namespace
+
+const string MessageDeflate::ProtocolToken = ";rtc-deflate";
+
+optional<string> MessageDeflate::ParseProtocol(string &protocol) {
+	const size_t pos = protocol.rfind(ProtocolToken);
+	if (pos == string::npos)
+		return nullopt;
+
+	string parameter = protocol.substr(pos + ProtocolToken.size());
+	if (!parameter.empty() && parameter[0] != '=')
+		return nullopt;
+
+	protocol.resize(pos);
+	return !parameter.empty() ? parameter.substr(1) : string();
+}
+
+string MessageDeflate::MakeProtocol(const string &protocol, const string &dictionaryName) {
+	return protocol + ProtocolToken + (!dictionaryName.empty() ? "=" + dictionaryName : "");
+}
+
+#if USE_ZLIB
+
+bool MessageDeflate::IsAvailable() { return true; }
+
+MessageDeflate::MessageDeflate(binary dictionary) : mDictionary(std::move(dictionary)) {
+	std::memset(&mDeflateStream, 0, sizeof(mDeflateStream));
+	if (deflateInit2(&mDeflateStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+	                 Z_DEFAULT_STRATEGY) != Z_OK)
+		throw std::runtime_error("Failed to initialize deflate stream");
+
+	std::memset(&mInflateStream, 0, sizeof(mInflateStream));
+	if (inflateInit2(&mInflateStream, -15) != Z_OK) {
+		deflateEnd(&mDeflateStream);
+		throw std::runtime_error("Failed to initialize inflate stream");
+	}
+
+	if (!mDictionary.empty()) {
+		auto dict = reinterpret_cast<const Bytef *>(mDictionary.data());
+		deflateSetDictionary(&mDeflateStream, dict, uInt(mDictionary.size()));
+		inflateSetDictionary(&mInflateStream, dict, uInt(mDictionary.size()));
+	}
+}
+
+MessageDeflate::~MessageDeflate() {
+	deflateEnd(&mDeflateStream);
+	inflateEnd(&mInflateStream);
+	if (mStandaloneDeflateInit)
+		deflateEnd(&mStandaloneDeflate);
+	if (mStandaloneInflateInit)
+		inflateEnd(&mStandaloneInflate);
+}
+
+void MessageDeflate::compress(Message &message, bool ordered) {
+	const byte *data = message.payload();
+	const size_t size = message.payloadSize();
+	binary result;
+	if (size < MinSize || mSkipCount > 0) {
+		if (mSkipCount > 0)
+			--mSkipCount;
+
+		result.reserve(size + 1);
+		result.push_back(byte(Raw));
+		result.insert(result.end(), data, data + size);
+
+	} else if (ordered) {
+		// The context must be kept in sync with the receiver, so the message is sent compressed
+		// even if it is not smaller
+		result = deflateWith(mDeflateStream, data, size);
+		result[0] = byte(Streamed);
+		if (result.size() > size)
+			mSkipCount = SkipCount;
+
+	} else {
+		initStandaloneDeflate();
+		deflateReset(&mStandaloneDeflate);
+		if (!mDictionary.empty())
+			deflateSetDictionary(&mStandaloneDeflate,
+			                     reinterpret_cast<const Bytef *>(mDictionary.data()),
+			                     uInt(mDictionary.size()));
+
+		result = deflateWith(mStandaloneDeflate, data, size);
+		if (result.size() > size) {
+			mSkipCount = SkipCount;
+			result.resize(1);
+			result[0] = byte(Raw);
+			result.insert(result.end(), data, data + size);
+		} else {
+			result[0] = byte(Standalone);
+		}
+	}
+
+	static_cast<binary &>(message) = std::move(result);
+	message.view.reset();
+}
+
+bool MessageDeflate::decompress(Message &message, size_t maxSize) {
+	if (message.empty())
+		return false;
+
+	const byte *data = message.data() + 1;
+	const size_t size = message.size() - 1;
+	binary result;
+	switch (uint8_t(message[0])) {
+	case Raw:
+		message.erase(message.begin());
+		return true;
+
+	case Standalone:
+		initStandaloneInflate();
+		inflateReset(&mStandaloneInflate);
+		if (!mDictionary.empty())
+			inflateSetDictionary(&mStandaloneInflate,
+			                     reinterpret_cast<const Bytef *>(mDictionary.data()),
+			                     uInt(mDictionary.size()));
+
+		if (!inflateWith(mStandaloneInflate, data, size, maxSize, result))
+			return false;
+		break;
+
+	case Streamed:
+		if (!inflateWith(mInflateStream, data, size, maxSize, result))
+			return false;
+		break;
+
+	default:
+		return false;
+	}
+
+	static_cast<binary &>(message) = std::move(result);
+	return true;
+}
+
+void MessageDeflate::initStandaloneDeflate() {
+	if (mStandaloneDeflateInit)
+		return;
+
+	std::memset(&mStandaloneDeflate, 0, sizeof(mStandaloneDeflate));
+	if (deflateInit2(&mStandaloneDeflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+	                 Z_DEFAULT_STRATEGY) != Z_OK)
+		throw std::runtime_error("Failed to initialize deflate stream");
+
+	mStandaloneDeflateInit = true;
+}
+
+void MessageDeflate::initStandaloneInflate() {
+	if (mStandaloneInflateInit)
+		return;
+
+	std::memset(&mStandaloneInflate, 0, sizeof(mStandaloneInflate));
+	if (inflateInit2(&mStandaloneInflate, -15) != Z_OK)
+		throw std::runtime_error("Failed to initialize inflate stream");
+
+	mStandaloneInflateInit = true;
+}
+
+// The result starts with a byte reserved for the header
+binary MessageDeflate::deflateWith(z_stream &stream, const byte *data, size_t size) {
+	binary result(deflateBound(&stream, uLong(size)) + 16);
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<byte *>(data));
+	stream.avail_in = uInt(size);
+	size_t len = 1;
+	while (true) {
+		stream.next_out = reinterpret_cast<Bytef *>(result.data() + len);
+		stream.avail_out = uInt(result.size() - len);
+		if (deflate(&stream, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+			throw std::runtime_error("DataChannel message compression failed");
+
+		len = result.size() - stream.avail_out;
+		if (stream.avail_out > 0)
+			break; // flushed
+
+		result.resize(result.size() * 2);
+	}
+
+	if (len >= 5 && std::equal(Tail, Tail + 4, result.data() + len - 4))
+		len -= 4;
+
+	result.resize(len);
+	return result;
+}
+
+bool MessageDeflate::inflateWith(z_stream &stream, const byte *data, size_t size, size_t maxSize,
+                                 binary &result) {
+	binary input;
+	input.reserve(size + 4);
+	input.insert(input.end(), data, data + size);
+	input.insert(input.end(), Tail, Tail + 4);
+
+	result.resize(std::max(size * 4, size_t(1024)));
+	stream.next_in = reinterpret_cast<Bytef *>(input.data());
+	stream.avail_in = uInt(input.size());
+	size_t len = 0;
+	while (true) {
+		stream.next_out = reinterpret_cast<Bytef *>(result.data() + len);
+		stream.avail_out = uInt(result.size() - len);
+		int ret = inflate(&stream, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return false; // the stream never ends, so Z_STREAM_END is an error too
+
+		len = result.size() - stream.avail_out;
+		if (len > maxSize)
+			return false;
+
+		if (stream.avail_in == 0 && stream.avail_out > 0)
+			break;
+
+		if (ret == Z_BUF_ERROR && stream.avail_out > 0)
+			return false; // truncated
+
+		result.resize(result.size() * 2);
+	}
+
+	result.resize(len);
+	return true;
+}
+
+#else
+
+bool MessageDeflate::IsAvailable() { return false; }
+
+MessageDeflate::MessageDeflate(binary dictionary) : mDictionary(std::move(dictionary)) {
+	throw std::logic_error("DataChannel compression support is disabled");
+}
+
+MessageDeflate::~MessageDeflate() {}
+
+void MessageDeflate::compress(Message &, bool) {}
+
+bool MessageDeflate::decompress(Message &, size_t) { return false; }
+
+#endif
+
+} // namespace rtc::impl
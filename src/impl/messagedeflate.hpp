@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_MESSAGE_DEFLATE_H
+#define RTC_IMPL_MESSAGE_DEFLATE_H
+
+#include "common.hpp"
+#include "message.hpp"
+
+#include <limits>
+
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace rtc::impl {
+
+// Data Channel message compression with deflate, announced in the channel protocol
+// Each message starts with a header byte telling if it is raw, compressed with the preset
+// dictionary only, or compressed with the context of the previous messages, which is only used for
+// messages sent reliably and in order. Compression is skipped for a while when it does not pay off.
+// Compressing and decompressing may run concurrently, but each one is not thread-safe.
+class MessageDeflate final {
+public:
+	static bool IsAvailable();
+
+	// Protocol suffix announcing compression, followed by '=' and the dictionary name if any
+	static const string ProtocolToken;
+
+	// Splits the protocol announced on the wire into the user protocol and the dictionary name,
+	// returns nullopt if compression is not announced
+	static optional<string> ParseProtocol(string &protocol);
+	static string MakeProtocol(const string &protocol, const string &dictionaryName);
+
+	MessageDeflate(binary dictionary);
+	~MessageDeflate();
+
+	MessageDeflate(const MessageDeflate &) = delete;
+	MessageDeflate &operator=(const MessageDeflate &) = delete;
+
+	void compress(Message &message, bool ordered); // in place, ordered if sent reliably in order
+	bool decompress(Message &message,              // in place, false if invalid
+	                size_t maxSize = std::numeric_limits<size_t>::max());
+
+private:
+	enum Header : uint8_t { Raw = 0, Standalone = 1, Streamed = 2 };
+
+	static const size_t MinSize = 32;        // smaller messages are sent raw
+	static const unsigned int SkipCount = 32; // messages sent raw after an inefficient one
+
+	const binary mDictionary;
+	unsigned int mSkipCount = 0;
+
+#if USE_ZLIB
+	void initStandaloneDeflate();
+	void initStandaloneInflate();
+	binary deflateWith(z_stream &stream, const byte *data, size_t size);
+	bool inflateWith(z_stream &stream, const byte *data, size_t size, size_t maxSize,
+	                 binary &result);
+
+	z_stream mDeflateStream;     // with context takeover
+	z_stream mInflateStream;     // same
+	z_stream mStandaloneDeflate; // reset for each message, initialized on first use
+	z_stream mStandaloneInflate; // same
+	bool mStandaloneDeflateInit = false;
+	bool mStandaloneInflateInit = false;
+#endif
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ * Copyright (c) 2020 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "messagepool.hpp"
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace rtc::impl {
+
+namespace {
+
+// Bounded per-thread free list backed by a global depot
+// Objects are exchanged with the depot in batches, which keeps the lock off the fast path while
+// letting objects flow from consumer threads back to producer threads.
+template <typename T> class FreeList final {
+public:
+	static T *Acquire() {
+		if (tExiting)
+			return nullptr;
+
+		auto &items = Local().items;
+		if (items.empty())
+			GetDepot().take(items, BatchSize);
+
+		if (items.empty())
+			return nullptr;
+
+		T *item = items.back();
+		items.pop_back();
+		return item;
+	}
+
+	static void Release(T *item) {
+		if (tExiting) {
+			GetDepot().put(item);
+			return;
+		}
+
+		auto &items = Local().items;
+		if (items.size() >= LocalLimit)
+			GetDepot().give(items, BatchSize);
+
+		items.push_back(item);
+	}
+
+private:
+	static const size_t BatchSize = 64;
+	static const size_t LocalLimit = 4 * BatchSize;
+	static const size_t DepotLimit = 64 * BatchSize;
+
+	class Depot {
+	public:
+		void take(std::vector<T *> &items, size_t count) {
+			std::lock_guard lock(mMutex);
+			while (count-- && !mItems.empty()) {
+				items.push_back(mItems.back());
+				mItems.pop_back();
+			}
+		}
+
+		void give(std::vector<T *> &items, size_t count) {
+			std::lock_guard lock(mMutex);
+			while (count-- && !items.empty()) {
+				T *item = items.back();
+				items.pop_back();
+				if (mItems.size() < DepotLimit)
+					mItems.push_back(item);
+				else
+					delete item;
+			}
+		}
+
+		void put(T *item) {
+			std::lock_guard lock(mMutex);
+			if (mItems.size() < DepotLimit)
+				mItems.push_back(item);
+			else
+				delete item;
+		}
+
+	private:
+		std::mutex mMutex;
+		std::vector<T *> mItems;
+	};
+
+	struct LocalItems {
+		std::vector<T *> items;
+
+		~LocalItems() {
+			tExiting = true;
+			GetDepot().give(items, items.size());
+		}
+	};
+
+	static LocalItems &Local() {
+		thread_local LocalItems local;
+		return local;
+	}
+
+	static Depot &GetDepot() {
+		// Intentionally leaked, objects may be released during static destruction
+		static Depot *depot = new Depot;
+		return *depot;
+	}
+
+	static thread_local bool tExiting;
+};
+
+template <typename T> thread_local bool FreeList<T>::tExiting = false;
+
+template <size_t Size> struct Block {
+	alignas(std::max_align_t) unsigned char data[Size];
+};
+
+// Allocator for shared_ptr control blocks
+template <typename T> struct PoolAllocator {
+	using value_type = T;
+
+	PoolAllocator() = default;
+	template <typename U> PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+	T *allocate(size_t n) {
+		static_assert(alignof(T) <= alignof(std::max_align_t), "Unsupported alignment");
+		if (n != 1)
+			return std::allocator<T>().allocate(n);
+
+		using B = Block<sizeof(T)>;
+		B *block = FreeList<B>::Acquire();
+		return reinterpret_cast<T *>(block ? block : new B);
+	}
+
+	void deallocate(T *p, size_t n) noexcept {
+		if (n != 1) {
+			std::allocator<T>().deallocate(p, n);
+			return;
+		}
+
+		using B = Block<sizeof(T)>;
+		FreeList<B>::Release(reinterpret_cast<B *>(p));
+	}
+
+	template <typename U> bool operator==(const PoolAllocator<U> &) const { return true; }
+	template <typename U> bool operator!=(const PoolAllocator<U> &) const { return false; }
+};
+
+} // namespace
+
+message_ptr MessagePool::Acquire() {
+	Message *message = FreeList<Message>::Acquire();
+	if (!message)
+		message = new Message(0);
+
+	return message_ptr(message, Recycler(), PoolAllocator<Message>());
+}
+
+message_ptr MessagePool::Adopt(binary_ptr packet) {
+	if (!packet || !std::get_deleter<Recycler>(packet))
+		return nullptr;
+
+	auto message = std::static_pointer_cast<Message>(std::move(packet));
+	if (message->view || message->tail)
+		return nullptr;
+
+	message->type = Message::Binary;
+	message->stream = 0;
+	message->incomplete = false;
+	message->arrivalTime.reset();
+#if RTC_ENABLE_LATENCY_TRACING
+	message->traceTime.reset();
+#endif
+	return message;
+}
+
+const Message *MessagePool::Peek(const binary_ptr &packet) {
+	if (!packet || !std::get_deleter<Recycler>(packet))
+		return nullptr;
+
+	return static_cast<const Message *>(packet.get());
+}
+
+void MessagePool::Recycler::operator()(Message *message) const {
+	if (message->capacity() > MaxRecycledCapacity)
+		binary().swap(*message);
+	else
+		message->clear();
+
+	message->type = Message::Binary;
+	message->stream = 0;
+	message->dscp = 0;
+	message->ecn = 0;
+	message->view.reset();
+	message->tail.reset();
+	message->incomplete = false;
+	message->arrivalTime.reset();
+#if RTC_ENABLE_LATENCY_TRACING
+	message->traceTime.reset();
+#endif
+
+	FreeList<Message>::Release(message);
+}
+
+} // namespace rtc::impl
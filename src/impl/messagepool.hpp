@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2020 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_MESSAGE_POOL_H
+#define RTC_IMPL_MESSAGE_POOL_H
+
+#include "common.hpp"
+#include "message.hpp"
+
+namespace rtc::impl {
+
+// Per-thread pool of messages
+// Messages are recycled along with their payload storage when the last reference drops, and
+// shared_ptr control blocks are pooled too, so steady-state allocation does not hit malloc.
+// Objects released on another thread than the one which acquired them go through a shared depot.
+class MessagePool final {
+public:
+	static message_ptr Acquire(); // empty binary message
+
+	// Return the packet as a binary message if it was acquired from the pool, nullptr otherwise
+	// The packet must not be referenced elsewhere.
+	static message_ptr Adopt(binary_ptr packet);
+
+	// Return the packet as a message if it was acquired from the pool, nullptr otherwise
+	static const Message *Peek(const binary_ptr &packet);
+
+private:
+	struct Recycler {
+		void operator()(Message *message) const;
+	};
+
+	static const size_t MaxRecycledCapacity = 65536; // larger payloads are freed
+};
+
+} // namespace rtc::impl
+
+#endif
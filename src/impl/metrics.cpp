@@ -0,0 +1,333 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "metrics.hpp"
+#include "datachannel.hpp"
+#include "dtlstransport.hpp"
+#include "icetransport.hpp"
+#include "internals.hpp"
+#include "peerconnection.hpp"
+#include "sctptransport.hpp"
+#include "track.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+#include "websocket.hpp"
+#endif
+
+#include <algorithm>
+
+namespace rtc {
+
+void MetricsSink::histogram(const string &, const MetricLabels &, const std::vector<double> &,
+                            const std::vector<uint64_t> &) {}
+
+void MetricsSink::span(const string &, const MetricLabels &, clock::time_point, clock::time_point,
+                       bool) {}
+
+} // namespace rtc
+
+namespace rtc::impl {
+
+namespace {
+
+double seconds(std::chrono::nanoseconds duration) {
+	return std::chrono::duration<double>(duration).count();
+}
+
+MetricLabels with(MetricLabels labels, string key, string value) {
+	labels.emplace_back(std::move(key), std::move(value));
+	return labels;
+}
+
+void histogram(MetricsSink &sink, const string &name, const MetricLabels &labels,
+               const ThreadPoolStats::Histogram &histogram) {
+	// Bucket i counts durations below 2^i us
+	std::vector<double> bounds(ThreadPoolStats::HistogramSize - 1);
+	for (size_t i = 0; i < bounds.size(); ++i)
+		bounds[i] = double(uint64_t(1) << i) * 1e-6;
+
+	sink.histogram(name, labels, bounds, std::vector<uint64_t>(histogram.begin(), histogram.end()));
+}
+
+#if RTC_ENABLE_LATENCY_TRACING
+void histogram(MetricsSink &sink, const string &name, const MetricLabels &labels,
+               const LatencyHistogram &histogram) {
+	std::vector<double> bounds(LatencyHistogram::BucketCount - 1);
+	for (size_t i = 0; i < bounds.size(); ++i)
+		bounds[i] = double(LatencyHistogram::BucketUpperBound(i)) * 1e-9;
+
+	sink.histogram(name, labels, bounds,
+	               std::vector<uint64_t>(histogram.counts.begin(), histogram.counts.end()));
+}
+#endif
+
+} // namespace
+
+MetricsRegistry &MetricsRegistry::Instance() {
+	static MetricsRegistry *instance = new MetricsRegistry;
+	return *instance;
+}
+
+uint64_t MetricsRegistry::NextId() {
+	static std::atomic<uint64_t> next = 0;
+	return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MetricsRegistry::setSink(shared_ptr<MetricsSink> sink) {
+	std::lock_guard lock(mMutex);
+	mHasSink.store(sink != nullptr, std::memory_order_relaxed);
+	mSink = std::move(sink);
+}
+
+shared_ptr<MetricsSink> MetricsRegistry::sink() const {
+	std::lock_guard lock(mMutex);
+	return mSink;
+}
+
+void MetricsRegistry::add(weak_ptr<PeerConnection> peerConnection) {
+	std::lock_guard lock(mMutex);
+	Prune(mPeerConnections);
+	mPeerConnections.push_back(std::move(peerConnection));
+}
+
+#if RTC_ENABLE_WEBSOCKET
+void MetricsRegistry::add(weak_ptr<WebSocket> webSocket) {
+	std::lock_guard lock(mMutex);
+	Prune(mWebSockets);
+	mWebSockets.push_back(std::move(webSocket));
+}
+#endif
+
+void MetricsRegistry::collect() {
+	shared_ptr<MetricsSink> sink;
+	std::vector<shared_ptr<PeerConnection>> peerConnections;
+#if RTC_ENABLE_WEBSOCKET
+	std::vector<shared_ptr<WebSocket>> webSockets;
+#endif
+	{
+		std::lock_guard lock(mMutex);
+		if (!mSink)
+			return;
+
+		sink = mSink;
+		peerConnections = Lock(mPeerConnections);
+#if RTC_ENABLE_WEBSOCKET
+		webSockets = Lock(mWebSockets);
+#endif
+	}
+
+	// The sink is called without holding the lock, so it may create or destroy objects
+	CollectThreadPool(*sink);
+	CollectThreads(*sink);
+
+	for (auto &peerConnection : peerConnections)
+		CollectPeerConnection(*sink, *peerConnection);
+
+#if RTC_ENABLE_WEBSOCKET
+	for (auto &webSocket : webSockets)
+		CollectWebSocket(*sink, *webSocket);
+#endif
+}
+
+void MetricsRegistry::reportSetup(const PeerConnection &peerConnection, bool success) {
+	auto sink = this->sink();
+	if (!sink)
+		return;
+
+	const MetricLabels labels = {{"peer_connection", std::to_string(peerConnection.metricsId)}};
+	const auto timeline = peerConnection.setupTimeline();
+	const auto now = SetupTimeline::clock::now();
+
+	// Each step starts when the previous one finished, the first unfinished step is failed and
+	// ends the sequence
+	auto start = timeline.created;
+	bool finished = true;
+	auto step = [&](const string &name, optional<SetupTimeline::clock::time_point> end) {
+		if (!finished)
+			return;
+
+		finished = end.has_value();
+		const auto stop = end.value_or(now);
+		sink->span(name, labels, start, stop, finished);
+		start = stop;
+	};
+
+	step("rtc.setup.ice", timeline.iceConnected);
+	step("rtc.setup.dtls", timeline.dtlsConnected);
+	if (timeline.srtpKeysDerived)
+		step("rtc.setup.srtp", timeline.srtpKeysDerived);
+	if (timeline.sctpConnected || peerConnection.getSctpTransport())
+		step("rtc.setup.sctp", timeline.sctpConnected);
+
+	sink->span("rtc.setup", labels, timeline.created, now, success);
+}
+
+template <typename T> void MetricsRegistry::Prune(std::vector<weak_ptr<T>> &list) {
+	list.erase(std::remove_if(list.begin(), list.end(), [](auto &w) { return w.expired(); }),
+	           list.end());
+}
+
+template <typename T>
+std::vector<shared_ptr<T>> MetricsRegistry::Lock(std::vector<weak_ptr<T>> &list) {
+	Prune(list);
+	std::vector<shared_ptr<T>> locked;
+	locked.reserve(list.size());
+	for (auto &weak : list)
+		if (auto ptr = weak.lock())
+			locked.push_back(std::move(ptr));
+
+	return locked;
+}
+
+void MetricsRegistry::CollectThreadPool(MetricsSink &sink) {
+	const auto stats = GetThreadPoolStats();
+	const MetricLabels labels;
+	sink.gauge("rtc.thread_pool.workers", labels, stats.workers);
+	sink.gauge("rtc.thread_pool.busy_workers", labels, stats.busyWorkers);
+	sink.gauge("rtc.thread_pool.queued_tasks", labels, double(stats.queuedTasks));
+	sink.gauge("rtc.thread_pool.pending_timers", labels, double(stats.pendingTimers));
+	sink.gauge("rtc.thread_pool.processor_queued_tasks", labels,
+	           double(stats.processorQueuedTasks));
+	sink.counter("rtc.thread_pool.tasks_run", labels, stats.tasksRun);
+	sink.counter("rtc.thread_pool.lock_contentions", labels, stats.lockContentions);
+	sink.gauge("rtc.thread_pool.lock_wait_time", labels, seconds(stats.lockWaitTime));
+	histogram(sink, "rtc.thread_pool.queue_latency", labels, stats.queueLatency);
+	histogram(sink, "rtc.thread_pool.run_time", labels, stats.runTime);
+
+	const auto overload = GetOverloadState();
+	sink.gauge("rtc.overload.level", labels, double(int(overload.level)));
+	sink.gauge("rtc.overload.queue_latency", labels, seconds(overload.queueLatency));
+	sink.counter("rtc.overload.level_changes", labels, overload.levelChanges);
+}
+
+void MetricsRegistry::CollectThreads(MetricsSink &sink) {
+	for (const auto &stats : GetThreadStats()) {
+		const MetricLabels labels = {{"role", stats.role}};
+		sink.gauge("rtc.threads.running", labels, stats.threads);
+		sink.gauge("rtc.threads.cpu_time", labels, seconds(stats.cpuTime));
+	}
+}
+
+void MetricsRegistry::CollectPeerConnection(MetricsSink &sink, PeerConnection &peerConnection) {
+	const MetricLabels labels = {{"peer_connection", std::to_string(peerConnection.metricsId)}};
+	sink.gauge("rtc.peer_connection.state", labels, double(peerConnection.state.load()));
+
+	const auto memory = peerConnection.memoryStats();
+	sink.gauge("rtc.memory.receive_queues", labels, double(memory.receiveQueues));
+	sink.gauge("rtc.memory.send_queue", labels, double(memory.sendQueue));
+	sink.gauge("rtc.memory.reassembly", labels, double(memory.reassembly));
+	sink.gauge("rtc.memory.nack_storage", labels, double(memory.nackStorage));
+
+	if (auto iceTransport = peerConnection.getIceTransport()) {
+		const auto stats = iceTransport->stats();
+		sink.counter("rtc.ice.bytes_sent", labels, stats.bytesSent);
+		sink.counter("rtc.ice.bytes_received", labels, stats.bytesReceived);
+		sink.counter("rtc.ice.packets_sent", labels, stats.packetsSent);
+		sink.counter("rtc.ice.packets_received", labels, stats.packetsReceived);
+	}
+
+	if (auto dtlsTransport = peerConnection.getDtlsTransport()) {
+		const auto timeline = dtlsTransport->handshakeTimeline();
+		sink.counter("rtc.dtls.handshake_flights", labels, timeline.flights.size());
+		if (timeline.rtt)
+			sink.gauge("rtc.dtls.handshake_rtt", labels, seconds(*timeline.rtt));
+	}
+
+	if (auto sctpTransport = peerConnection.getSctpTransport()) {
+		sink.counter("rtc.sctp.bytes_sent", labels, sctpTransport->bytesSent());
+		sink.counter("rtc.sctp.bytes_received", labels, sctpTransport->bytesReceived());
+		if (auto stats = sctpTransport->stats()) {
+			sink.gauge("rtc.sctp.congestion_window", labels, double(stats->congestionWindow));
+			sink.gauge("rtc.sctp.peer_receive_window", labels, double(stats->peerReceiveWindow));
+			sink.gauge("rtc.sctp.unacked_chunks", labels, stats->unackedChunks);
+			sink.gauge("rtc.sctp.pending_chunks", labels, stats->pendingChunks);
+			sink.gauge("rtc.sctp.mtu", labels, double(stats->mtu));
+			sink.gauge("rtc.sctp.rtt", labels, seconds(stats->rtt));
+			sink.gauge("rtc.sctp.rto", labels, seconds(stats->rto));
+			sink.gauge("rtc.sctp.queued_messages", labels, double(stats->queuedMessages));
+			sink.gauge("rtc.sctp.buffered_amount", labels, double(stats->bufferedAmount));
+			sink.counter("rtc.sctp.abandoned_unsent", labels, stats->abandonedUnsent);
+			sink.counter("rtc.sctp.abandoned_sent", labels, stats->abandonedSent);
+			sink.counter("rtc.sctp.abandoned_queued", labels, stats->abandonedQueued);
+		}
+	}
+
+	peerConnection.iterateDataChannels([&](shared_ptr<DataChannel> channel) {
+		auto channelLabels = with(labels, "stream", std::to_string(channel->stream()));
+		channelLabels.emplace_back("label", channel->label());
+		const auto stats = channel->stats();
+		sink.gauge("rtc.data_channel.queued_messages", channelLabels, double(stats.queuedMessages));
+		sink.gauge("rtc.data_channel.buffered_amount", channelLabels, double(stats.bufferedAmount));
+		sink.counter("rtc.data_channel.dropped_messages", channelLabels, stats.droppedMessages);
+		sink.counter("rtc.data_channel.abandoned_unsent", channelLabels, stats.abandonedUnsent);
+		sink.counter("rtc.data_channel.abandoned_sent", channelLabels, stats.abandonedSent);
+		sink.counter("rtc.data_channel.abandoned_queued", channelLabels, stats.abandonedQueued);
+	});
+
+	peerConnection.iterateTracks([&](shared_ptr<Track> track) {
+		const auto trackLabels = with(labels, "mid", track->mid());
+		for (const auto &stats : track->statsCounters()) {
+			const auto streamLabels = with(trackLabels, "ssrc", std::to_string(stats.ssrc));
+			sink.counter("rtc.rtp.packets_sent", streamLabels, stats.packetsSent);
+			sink.counter("rtc.rtp.bytes_sent", streamLabels, stats.bytesSent);
+			sink.counter("rtc.rtp.retransmitted_packets", streamLabels, stats.retransmittedPackets);
+			sink.counter("rtc.rtp.retransmitted_bytes", streamLabels, stats.retransmittedBytes);
+			sink.counter("rtc.rtp.nacks_received", streamLabels, stats.nacksReceived);
+			sink.counter("rtc.rtp.keyframe_requests_received", streamLabels,
+			             stats.keyframeRequestsReceived);
+			sink.counter("rtc.rtp.packets_received", streamLabels, stats.packetsReceived);
+			sink.counter("rtc.rtp.bytes_received", streamLabels, stats.bytesReceived);
+			sink.counter("rtc.rtp.nacks_sent", streamLabels, stats.nacksSent);
+			sink.counter("rtc.rtp.keyframe_requests_sent", streamLabels,
+			             stats.keyframeRequestsSent);
+			sink.gauge("rtc.rtp.packets_lost", streamLabels, double(stats.packetsLost));
+			sink.gauge("rtc.rtp.jitter", streamLabels, stats.jitter);
+			if (stats.rtt)
+				sink.gauge("rtc.rtp.rtt", streamLabels, seconds(*stats.rtt));
+		}
+	});
+
+#if RTC_ENABLE_LATENCY_TRACING
+	const auto latency = peerConnection.latencyTracer->stats();
+	auto stage = [&](const string &name, const LatencyHistogram &h) {
+		histogram(sink, "rtc.latency", with(labels, "stage", name), h);
+	};
+	stage("sctp_queue", latency.sctpQueue);
+	stage("dtls_encrypt", latency.dtlsEncrypt);
+	stage("ice_send", latency.iceSend);
+	stage("dtls_decrypt", latency.dtlsDecrypt);
+	stage("sctp_input", latency.sctpInput);
+	stage("delivery", latency.delivery);
+#endif
+}
+
+#if RTC_ENABLE_WEBSOCKET
+void MetricsRegistry::CollectWebSocket(MetricsSink &sink, WebSocket &webSocket) {
+	const auto relaxed = std::memory_order_relaxed;
+	const MetricLabels labels = {{"websocket", std::to_string(webSocket.metricsId)}};
+	sink.gauge("rtc.websocket.state", labels, double(webSocket.state.load()));
+	sink.gauge("rtc.websocket.buffered_amount", labels, double(webSocket.bufferedAmount.load()));
+	sink.counter("rtc.websocket.messages_sent", labels, webSocket.messagesSent.load(relaxed));
+	sink.counter("rtc.websocket.messages_received", labels,
+	             webSocket.messagesReceived.load(relaxed));
+	sink.counter("rtc.websocket.bytes_sent", labels, webSocket.bytesSent.load(relaxed));
+	sink.counter("rtc.websocket.bytes_received", labels, webSocket.bytesReceived.load(relaxed));
+}
+#endif
+
+} // namespace rtc::impl
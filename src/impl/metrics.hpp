@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_METRICS_H
+#define RTC_IMPL_METRICS_H
+
+#include "common.hpp"
+#include "rtc/metrics.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace rtc::impl {
+
+struct PeerConnection;
+struct WebSocket;
+
+// Keeps track of live objects so their counters can be read when the sink collects metrics
+class MetricsRegistry final {
+public:
+	static MetricsRegistry &Instance();
+	static uint64_t NextId(); // process-unique, used as label value
+
+	void setSink(shared_ptr<MetricsSink> sink);
+	bool hasSink() const { return mHasSink.load(std::memory_order_relaxed); }
+
+	void add(weak_ptr<PeerConnection> peerConnection);
+#if RTC_ENABLE_WEBSOCKET
+	void add(weak_ptr<WebSocket> webSocket);
+#endif
+
+	void collect();
+	void reportSetup(const PeerConnection &peerConnection, bool success);
+
+private:
+	MetricsRegistry() = default;
+
+	shared_ptr<MetricsSink> sink() const;
+
+	template <typename T> static void Prune(std::vector<weak_ptr<T>> &list);
+	template <typename T> static std::vector<shared_ptr<T>> Lock(std::vector<weak_ptr<T>> &list);
+
+	static void CollectThreadPool(MetricsSink &sink);
+	static void CollectThreads(MetricsSink &sink);
+	static void CollectPeerConnection(MetricsSink &sink, PeerConnection &peerConnection);
+#if RTC_ENABLE_WEBSOCKET
+	static void CollectWebSocket(MetricsSink &sink, WebSocket &webSocket);
+#endif
+
+	mutable std::mutex mMutex;
+	shared_ptr<MetricsSink> mSink;
+	std::atomic<bool> mHasSink = false;
+	std::vector<weak_ptr<PeerConnection>> mPeerConnections;
+#if RTC_ENABLE_WEBSOCKET
+	std::vector<weak_ptr<WebSocket>> mWebSockets;
+#endif
+};
+
+} // namespace rtc::impl
+
+#endif
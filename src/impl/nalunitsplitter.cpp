@@ -0,0 +1,218 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "nalunitsplitter.hpp"
+
+#if RTC_ENABLE_MEDIA
+
+#include "internals.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RTC_START_SEQUENCE_SSE2 1
+#elif defined(__ARM_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_neon.h>
+#define RTC_START_SEQUENCE_NEON 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace rtc::impl {
+
+namespace {
+
+typedef enum {
+	NUSM_noMatch,
+	NUSM_firstZero,
+	NUSM_secondZero,
+	NUSM_thirdZero,
+	NUSM_shortMatch,
+	NUSM_longMatch
+} NalUnitStartSequenceMatch;
+
+NalUnitStartSequenceMatch StartSequenceMatchSucc(NalUnitStartSequenceMatch match, byte _byte,
+                                                 NalUnitSeparator separator) {
+	assert(separator != NalUnitSeparator::Length);
+	auto byte = (uint8_t)_byte;
+	auto detectShort = separator == NalUnitSeparator::ShortStartSequence ||
+	                   separator == NalUnitSeparator::StartSequence;
+	auto detectLong = separator == NalUnitSeparator::LongStartSequence ||
+	                  separator == NalUnitSeparator::StartSequence;
+	switch (match) {
+	case NUSM_noMatch:
+		if (byte == 0x00) {
+			return NUSM_firstZero;
+		}
+		break;
+	case NUSM_firstZero:
+		if (byte == 0x00) {
+			return NUSM_secondZero;
+		}
+		break;
+	case NUSM_secondZero:
+		if (byte == 0x00 && detectLong) {
+			return NUSM_thirdZero;
+		} else if (byte == 0x01 && detectShort) {
+			return NUSM_shortMatch;
+		}
+		break;
+	case NUSM_thirdZero:
+		if (byte == 0x01 && detectLong) {
+			return NUSM_longMatch;
+		}
+		break;
+	case NUSM_shortMatch:
+		return NUSM_shortMatch;
+	case NUSM_longMatch:
+		return NUSM_longMatch;
+	}
+	return NUSM_noMatch;
+}
+
+// Return the index of the first pair of zero bytes at or after index, or size if there is none
+// Start sequences begin with such a pair, so the bytes in between can be skipped.
+size_t FindZeroPair(const byte *data, size_t index, size_t size) {
+#if RTC_START_SEQUENCE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	while (index + 17 <= size) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index + 1));
+		unsigned int mask = unsigned(_mm_movemask_epi8(
+		    _mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero))));
+		if (mask) {
+#ifdef _MSC_VER
+			unsigned long first;
+			_BitScanForward(&first, mask);
+			return index + first;
+#else
+			return index + unsigned(__builtin_ctz(mask));
+#endif
+		}
+		index += 16;
+	}
+#elif RTC_START_SEQUENCE_NEON
+	while (index + 17 <= size) {
+		auto p = reinterpret_cast<const uint8_t *>(data + index);
+		uint8x16_t pairs = vandq_u8(vceqq_u8(vld1q_u8(p), vdupq_n_u8(0)),
+		                            vceqq_u8(vld1q_u8(p + 1), vdupq_n_u8(0)));
+		if (vmaxvq_u8(pairs))
+			break; // the scalar loop below finds the exact index
+		index += 16;
+	}
+#else
+	// Check 8 pairs at a time, a zero byte in the OR of both words means a pair of zeros
+	const uint64_t lows = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	while (index + 9 <= size) {
+		uint64_t a, b;
+		std::memcpy(&a, data + index, sizeof(a));
+		std::memcpy(&b, data + index + 1, sizeof(b));
+		uint64_t v = a | b;
+		if ((v - lows) & ~v & highs)
+			break; // the scalar loop below finds the exact index
+		index += 8;
+	}
+#endif
+	while (index + 1 < size) {
+		if (data[index] == byte(0) && data[index + 1] == byte(0))
+			return index;
+		++index;
+	}
+	return size;
+}
+
+// Return the index of the last byte of the next start sequence at or after index
+optional<size_t> FindStartSequence(const binary &message, size_t index,
+                                   NalUnitSeparator separator,
+                                   size_t &sequenceLength) {
+	const byte *data = message.data();
+	const size_t size = message.size();
+	NalUnitStartSequenceMatch match = NUSM_noMatch;
+	while (index < size) {
+		if (match == NUSM_noMatch) {
+			// Without a pair of zeros, the state machine would stay without a match
+			index = FindZeroPair(data, index, size);
+			if (index >= size)
+				break;
+		}
+		match = StartSequenceMatchSucc(match, data[index], separator);
+		if (match == NUSM_longMatch || match == NUSM_shortMatch) {
+			sequenceLength = match == NUSM_longMatch ? 4 : 3;
+			return index;
+		}
+		++index;
+	}
+	return nullopt;
+}
+
+} // namespace
+
+std::vector<NalUnitSpan> SplitNalUnits(const binary &message, NalUnitSeparator separator) {
+	std::vector<NalUnitSpan> nalus;
+	if (separator == NalUnitSeparator::Length) {
+		size_t index = 0;
+		while (index < message.size()) {
+			assert(index + 4 < message.size());
+			if (index + 4 >= message.size()) {
+				LOG_WARNING << "Invalid NAL Unit data (incomplete length), ignoring!";
+				break;
+			}
+			uint32_t length;
+			std::memcpy(&length, message.data() + index, sizeof(length));
+			length = ntohl(length);
+			auto naluStartIndex = index + 4;
+			auto naluEndIndex = naluStartIndex + length;
+
+			assert(naluEndIndex <= message.size());
+			if (naluEndIndex > message.size()) {
+				LOG_WARNING << "Invalid NAL Unit data (incomplete unit), ignoring!";
+				break;
+			}
+			nalus.push_back({message.data() + naluStartIndex, length});
+			index = naluEndIndex;
+		}
+	} else {
+		// Data before the first start sequence is ignored
+		size_t sequenceLength = 0;
+		auto first = FindStartSequence(message, 0, separator, sequenceLength);
+		size_t naluStartIndex = first ? *first + 1 : message.size();
+
+		while (auto last = FindStartSequence(message, naluStartIndex, separator, sequenceLength)) {
+			size_t naluEndIndex = *last + 1 - sequenceLength;
+			nalus.push_back({message.data() + naluStartIndex, naluEndIndex - naluStartIndex});
+			naluStartIndex = *last + 1;
+		}
+		nalus.push_back({message.data() + naluStartIndex, message.size() - naluStartIndex});
+	}
+	return nalus;
+}
+
+} // namespace rtc::impl
+
+#endif /* RTC_ENABLE_MEDIA */
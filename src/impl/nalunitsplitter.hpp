@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_NAL_UNIT_SPLITTER_H
+#define RTC_IMPL_NAL_UNIT_SPLITTER_H
+
+#include "common.hpp"
+
+#if RTC_ENABLE_MEDIA
+
+#include "h264rtppacketizer.hpp"
+
+#include <vector>
+
+namespace rtc::impl {
+
+using NalUnitSeparator = H264RtpPacketizer::Separator;
+
+// NAL unit inside an access unit, the data is not copied
+struct NalUnitSpan {
+	const byte *data;
+	size_t size;
+};
+
+// Split an access unit into NAL units, identically for H264 and H265
+// Data before the first start sequence is ignored, and units are empty between two sequences.
+std::vector<NalUnitSpan> SplitNalUnits(const binary &message, NalUnitSeparator separator);
+
+} // namespace rtc::impl
+
+#endif /* RTC_ENABLE_MEDIA */
+
+#endif
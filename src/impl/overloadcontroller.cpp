@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "overloadcontroller.hpp"
+#include "internals.hpp"
+#include "threadregistry.hpp"
+
+#include <algorithm>
+
+namespace rtc::impl {
+
+namespace {
+
+const char *LevelName(OverloadLevel level) {
+	switch (level) {
+	case OverloadLevel::Normal:
+		return "normal";
+	case OverloadLevel::DeferHandshakes:
+		return "deferring handshakes";
+	case OverloadLevel::PauseVideoLayers:
+		return "pausing video layers";
+	case OverloadLevel::ReduceSctpBuffers:
+		return "reducing SCTP buffers";
+	case OverloadLevel::RejectUpgrades:
+		return "rejecting upgrades";
+	default:
+		return "unknown";
+	}
+}
+
+} // namespace
+
+const double OverloadController::SmoothingFactor = 0.25;
+
+OverloadController &OverloadController::Instance() {
+	static OverloadController *instance = new OverloadController;
+	return *instance;
+}
+
+void OverloadController::start(OverloadSettings settings) {
+	std::lock_guard lock(mMutex);
+	if (mRunning)
+		return;
+
+	mSettings = std::move(settings);
+	mSettings.sampleInterval = std::max(mSettings.sampleInterval, std::chrono::milliseconds(1));
+	mSmoothedLatency = 0;
+	mLatency.store(0);
+	mLevel.store(OverloadLevel::Normal);
+	mLevelChanges.store(0);
+	if (!mSettings.enabled)
+		return;
+
+	PLOG_DEBUG << "Starting overload protection, sample interval "
+	           << mSettings.sampleInterval.count() << "ms";
+	mRunning = true;
+	mThread = std::thread(&OverloadController::run, this);
+}
+
+void OverloadController::stop() {
+	{
+		std::lock_guard lock(mMutex);
+		if (!std::exchange(mRunning, false))
+			return;
+
+		mCondition.notify_all();
+	}
+
+	mThread.join();
+	mLevel.store(OverloadLevel::Normal);
+}
+
+OverloadState OverloadController::state() const {
+	OverloadState s;
+	s.level = level();
+	s.queueLatency = std::chrono::microseconds(mLatency.load(std::memory_order_relaxed));
+	s.levelChanges = mLevelChanges.load(std::memory_order_relaxed);
+	return s;
+}
+
+std::chrono::milliseconds OverloadController::maxHandshakeDeferral() const {
+	std::lock_guard lock(mMutex);
+	return mSettings.maxHandshakeDeferral;
+}
+
+void OverloadController::run() {
+	ThreadRegistry::Registration registration(ThreadRegistry::Role::Overload);
+	std::unique_lock lock(mMutex);
+	while (!mCondition.wait_for(lock, mSettings.sampleInterval, [this]() { return !mRunning; }))
+		sample();
+}
+
+void OverloadController::sample() {
+	const auto delay = ThreadPool::Instance().queueDelay();
+	const double latency = std::chrono::duration<double, std::micro>(delay).count();
+	mSmoothedLatency += SmoothingFactor * (latency - mSmoothedLatency);
+	mLatency.store(int64_t(mSmoothedLatency), std::memory_order_relaxed);
+
+	const auto current = mLevel.load();
+	if (auto next = evaluate(current, mSmoothedLatency); next != current) {
+		mLevel.store(next);
+		++mLevelChanges;
+		if (next > current) {
+			PLOG_WARNING << "Overload: " << LevelName(next) << ", queue latency "
+			             << int64_t(mSmoothedLatency / 1000) << "ms";
+		} else {
+			PLOG_INFO << "Overload: " << LevelName(next) << ", queue latency "
+			          << int64_t(mSmoothedLatency / 1000) << "ms";
+		}
+	}
+}
+
+OverloadLevel OverloadController::evaluate(OverloadLevel current, double latency) const {
+	using us = std::chrono::duration<double, std::micro>;
+	const double thresholds[] = {
+	    us(mSettings.deferHandshakesThreshold).count(),
+	    us(mSettings.pauseVideoLayersThreshold).count(),
+	    us(mSettings.reduceSctpBuffersThreshold).count(),
+	    us(mSettings.rejectUpgradesThreshold).count(),
+	};
+
+	// Enter higher levels at their threshold, leave lower ones at half of it
+	int level = int(current);
+	while (level < 4 && latency >= thresholds[level])
+		++level;
+	while (level > 0 && latency < 0.5 * thresholds[level - 1])
+		--level;
+
+	return OverloadLevel(level);
+}
+
+} // namespace rtc::impl
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_OVERLOAD_CONTROLLER_H
+#define RTC_IMPL_OVERLOAD_CONTROLLER_H
+
+#include "common.hpp"
+#include "global.hpp"
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace rtc::impl {
+
+// Process-wide load shedding, driven by the latency of the thread pool. Samples are taken on a
+// dedicated thread, as a saturated pool would delay them, from the waiting time of the oldest ready
+// task or expired timer. Components check the level to shed their work.
+class OverloadController final {
+public:
+	using clock = ThreadPool::clock;
+
+	static OverloadController &Instance();
+
+	OverloadController(const OverloadController &) = delete;
+	OverloadController &operator=(const OverloadController &) = delete;
+
+	void start(OverloadSettings settings); // no-op if disabled
+	void stop();
+
+	OverloadLevel level() const { return mLevel.load(std::memory_order_relaxed); }
+	bool atLeast(OverloadLevel level) const { return this->level() >= level; }
+	OverloadState state() const;
+	std::chrono::milliseconds maxHandshakeDeferral() const;
+
+private:
+	OverloadController() = default;
+	~OverloadController() = default;
+
+	void run();
+	void sample(); // requires mMutex to be locked
+	OverloadLevel evaluate(OverloadLevel current, double latency) const; // in microseconds
+
+	static const double SmoothingFactor;
+
+	OverloadSettings mSettings;
+	bool mRunning = false;
+	std::thread mThread;
+	std::condition_variable mCondition;
+	double mSmoothedLatency = 0; // in microseconds
+	mutable std::mutex mMutex;
+
+	std::atomic<OverloadLevel> mLevel = OverloadLevel::Normal;
+	std::atomic<int64_t> mLatency = 0; // smoothed, in microseconds, for lock-free reads
+	std::atomic<uint64_t> mLevelChanges = 0;
+};
+
+} // namespace rtc::impl
+
+#endif
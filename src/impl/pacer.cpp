@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "pacer.hpp"
+
+#if RTC_ENABLE_MEDIA
+
+#include "dtlssrtptransport.hpp"
+#include "internals.hpp"
+
+#include <algorithm>
+
+namespace rtc::impl {
+
+const std::chrono::milliseconds Pacer::Interval(5);
+const std::chrono::milliseconds Pacer::MaxQueueDelay(500);
+
+Pacer::Pacer(unsigned int targetBitrate, double factor)
+    : mFactor(std::max(factor, 1.0)), mTargetBitrate(double(targetBitrate)),
+      mLastUpdate(clock::now()) {}
+
+Pacer::~Pacer() { stop(); }
+
+bool Pacer::send(message_ptr message, shared_ptr<DtlsSrtpTransport> transport,
+                 shared_ptr<MediaHandler> handler, Priority priority) {
+	{
+		std::lock_guard lock(mMutex);
+		if (mStopped)
+			return false;
+
+		mQueuedBytes += message->packetSize();
+		mQueues[size_t(priority)].push_back(
+		    Entry{std::move(message), std::move(transport), std::move(handler)});
+	}
+
+	// Send immediately what the budget allows, the rest is sent by the timer
+	process();
+	return true;
+}
+
+bool Pacer::send(std::vector<message_ptr> messages, shared_ptr<DtlsSrtpTransport> transport,
+                 shared_ptr<MediaHandler> handler, Priority priority) {
+	{
+		std::lock_guard lock(mMutex);
+		if (mStopped)
+			return false;
+
+		auto &queue = mQueues[size_t(priority)];
+		for (auto &message : messages) {
+			mQueuedBytes += message->packetSize();
+			queue.push_back(Entry{std::move(message), transport, handler});
+		}
+	}
+
+	process();
+	return true;
+}
+
+void Pacer::setTargetBitrate(const shared_ptr<DtlsSrtpTransport> &transport,
+                             unsigned int bitrate) {
+	std::lock_guard lock(mMutex);
+	auto &bitrates = mTransportBitrates;
+	bitrates.erase(std::remove_if(bitrates.begin(), bitrates.end(),
+	                              [](const auto &entry) { return entry.first.expired(); }),
+	               bitrates.end());
+
+	auto it = std::find_if(bitrates.begin(), bitrates.end(), [&transport](const auto &entry) {
+		return entry.first.lock() == transport;
+	});
+	if (it != bitrates.end())
+		it->second = double(bitrate);
+	else
+		bitrates.emplace_back(transport, double(bitrate));
+
+	mTargetBitrate = 0;
+	for (const auto &entry : bitrates)
+		mTargetBitrate += entry.second;
+}
+
+void Pacer::stop() {
+	std::lock_guard lock(mMutex);
+	mStopped = true;
+	mTimer.cancel();
+	for (auto &queue : mQueues)
+		queue.clear();
+
+	mQueuedBytes = 0;
+}
+
+size_t Pacer::queuedBytes() const {
+	std::lock_guard lock(mMutex);
+	return mQueuedBytes;
+}
+
+void Pacer::process() {
+	std::lock_guard sendLock(mSendMutex);
+	{
+		std::lock_guard lock(mMutex);
+		const auto now = clock::now();
+		const double elapsed = std::chrono::duration<double>(now - mLastUpdate).count();
+		mLastUpdate = now;
+
+		// Drain faster if packets would be queued for too long
+		const double maxQueueDelay = std::chrono::duration<double>(MaxQueueDelay).count();
+		const double rate = std::max(mFactor * mTargetBitrate, mQueuedBytes * 8.0 / maxQueueDelay);
+
+		// The budget is capped to one interval, so an idle period does not allow a burst
+		const double interval = std::chrono::duration<double>(Interval).count();
+		mBudget = std::min(mBudget + rate * elapsed / 8.0, rate * interval / 8.0);
+
+		for (size_t p = 0; p < mQueues.size(); ++p) {
+			auto &queue = mQueues[p];
+			while (!queue.empty() && (p == size_t(Priority::High) || mBudget > 0)) {
+				auto &entry = queue.front();
+				mBudget -= double(entry.message->packetSize());
+				mQueuedBytes -= entry.message->packetSize();
+				mBatch.push_back(std::move(entry));
+				queue.pop_front();
+			}
+		}
+
+		if (!mStopped && mQueuedBytes > 0 && !mTimer.pending()) {
+			auto task = [weak_this = weak_from_this()]() {
+				if (auto locked = weak_this.lock())
+					locked->process();
+			};
+			mTimer = ThreadPool::Instance().scheduleTimer(Interval, std::move(task));
+		}
+	}
+
+	// Packets for the same transport are sent in batches
+	size_t i = 0;
+	while (i < mBatch.size()) {
+		auto transport = mBatch[i].transport;
+		while (i < mBatch.size() && mBatch[i].transport == transport) {
+			auto &entry = mBatch[i++];
+			// Notify before sending as the transport encrypts in place
+			if (entry.handler)
+				entry.handler->sent(entry.message);
+
+			mMessages.push_back(std::move(entry.message));
+		}
+
+		try {
+			transport->sendMedia(mMessages);
+		} catch (const std::exception &e) {
+			PLOG_DEBUG << "Paced media send failed: " << e.what();
+		}
+		mMessages.clear();
+	}
+	mBatch.clear();
+}
+
+} // namespace rtc::impl
+
+#endif
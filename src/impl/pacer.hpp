@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_PACER_H
+#define RTC_IMPL_PACER_H
+
+#include "common.hpp"
+#include "mediahandler.hpp"
+#include "message.hpp"
+#include "threadpool.hpp"
+
+#if RTC_ENABLE_MEDIA
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace rtc::impl {
+
+class DtlsSrtpTransport;
+
+// Paces outgoing media packets of all tracks of a PeerConnection
+// Packets are released at a multiple of the target bitrate with a leaky bucket, so large frames
+// are spread over time instead of being sent in a burst. High priority packets (audio) are sent
+// first and are never held back by the budget. The media handler of a packet, if any, is notified
+// when the packet is released, so send times used for congestion control exclude queuing.
+class Pacer final : public std::enable_shared_from_this<Pacer> {
+public:
+	using clock = std::chrono::steady_clock;
+
+	enum class Priority { High = 0, Low = 1 };
+
+	Pacer(unsigned int targetBitrate, double factor);
+	~Pacer();
+
+	// Returns false if the pacer is stopped and the messages were dropped
+	bool send(message_ptr message, shared_ptr<DtlsSrtpTransport> transport,
+	          shared_ptr<MediaHandler> handler, Priority priority);
+	bool send(std::vector<message_ptr> messages, shared_ptr<DtlsSrtpTransport> transport,
+	          shared_ptr<MediaHandler> handler, Priority priority);
+
+	// Estimates are transport-wide, so the latest one for a transport replaces the previous one,
+	// and the target bitrate is the sum over transports
+	void setTargetBitrate(const shared_ptr<DtlsSrtpTransport> &transport, unsigned int bitrate);
+	void stop();
+
+	size_t queuedBytes() const;
+
+private:
+	struct Entry {
+		message_ptr message;
+		shared_ptr<DtlsSrtpTransport> transport;
+		shared_ptr<MediaHandler> handler;
+	};
+
+	void process();
+
+	static const std::chrono::milliseconds Interval;
+	static const std::chrono::milliseconds MaxQueueDelay;
+
+	const double mFactor;
+	double mTargetBitrate;
+	std::vector<std::pair<weak_ptr<DtlsSrtpTransport>, double>> mTransportBitrates;
+
+	std::array<std::deque<Entry>, 2> mQueues; // indexed by priority
+	size_t mQueuedBytes = 0;
+	double mBudget = 0; // in bytes, negative when packets were sent in advance
+	clock::time_point mLastUpdate;
+	TimerHandle mTimer;
+	bool mStopped = false;
+
+	mutable std::mutex mMutex;
+	std::mutex mSendMutex;              // keeps packets in order between concurrent senders
+	std::vector<Entry> mBatch;          // protected by mSendMutex
+	std::vector<message_ptr> mMessages; // protected by mSendMutex
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
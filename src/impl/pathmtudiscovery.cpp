@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "pathmtudiscovery.hpp"
+#include "internals.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace rtc::impl {
+
+// RFC 8899 recommends a probe timer larger than 15s, however it MUST NOT be smaller than 1s and
+// probes are small and rare, so a shorter value keeps the search from taking minutes.
+const PathMtuDiscovery::clock::duration PathMtuDiscovery::ProbeTimeout = std::chrono::seconds(2);
+const PathMtuDiscovery::clock::duration PathMtuDiscovery::ConfirmationInterval =
+    std::chrono::seconds(30);
+const PathMtuDiscovery::clock::duration PathMtuDiscovery::RaiseInterval =
+    std::chrono::seconds(600); // PMTU_RAISE_TIMER
+const int PathMtuDiscovery::MaxProbes = 3; // MAX_PROBES
+
+PathMtuDiscovery::PathMtuDiscovery(size_t baseMtu, size_t maxMtu, probe_callback probeCallback,
+                                   mtu_callback mtuCallback)
+    : mBaseMtu(baseMtu), mProbeCallback(std::move(probeCallback)),
+      mMtuCallback(std::move(mtuCallback)), mMtu(baseMtu) {
+	// Common MTUs on the Internet: tunnels, PPPoE, and Ethernet
+	static const std::array<size_t, 5> candidates = {1400, 1448, 1480, 1492, 1500};
+	for (size_t size : candidates)
+		if (size > baseMtu && size <= maxMtu)
+			mProbeSizes.push_back(size);
+
+	if (maxMtu > baseMtu && (mProbeSizes.empty() || mProbeSizes.back() < maxMtu))
+		mProbeSizes.push_back(maxMtu);
+}
+
+PathMtuDiscovery::~PathMtuDiscovery() { stop(); }
+
+void PathMtuDiscovery::start() {
+	optional<Probe> probe;
+	{
+		std::lock_guard lock(mMutex);
+		if (mState != State::Disabled)
+			return;
+
+		PLOG_DEBUG << "Starting path MTU discovery, base MTU is " << mBaseMtu;
+		mState = State::Searching;
+		mNextProbeIndex = 0;
+		probe = probeNext();
+	}
+	send(std::move(probe), nullopt);
+}
+
+void PathMtuDiscovery::stop() {
+	std::lock_guard lock(mMutex);
+	mState = State::Disabled;
+	mTimer.cancel();
+}
+
+void PathMtuDiscovery::acknowledge(uint32_t id) {
+	optional<Probe> probe;
+	optional<size_t> mtu;
+	{
+		std::lock_guard lock(mMutex);
+		if (id != mProbeId || (mState != State::Searching && mState != State::Confirming))
+			return;
+
+		mTimer.cancel();
+		if (mState == State::Searching) {
+			mMtu = mProbeSizes[mNextProbeIndex++];
+			mtu = mMtu;
+			probe = probeNext();
+		} else {
+			complete();
+		}
+	}
+	send(std::move(probe), std::move(mtu));
+}
+
+size_t PathMtuDiscovery::mtu() const {
+	std::lock_guard lock(mMutex);
+	return mMtu;
+}
+
+PathMtuDiscovery::State PathMtuDiscovery::state() const {
+	std::lock_guard lock(mMutex);
+	return mState;
+}
+
+optional<PathMtuDiscovery::Probe> PathMtuDiscovery::probeNext() {
+	if (mNextProbeIndex >= mProbeSizes.size()) {
+		complete();
+		return nullopt;
+	}
+
+	mProbeCount = 1;
+	arm(ProbeTimeout, ++mProbeId);
+	return Probe{mProbeId, mProbeSizes[mNextProbeIndex]};
+}
+
+optional<PathMtuDiscovery::Probe> PathMtuDiscovery::probeCurrent() {
+	mState = State::Confirming;
+	mProbeCount = 1;
+	arm(ProbeTimeout, ++mProbeId);
+	return Probe{mProbeId, mMtu};
+}
+
+void PathMtuDiscovery::complete() {
+	PLOG_DEBUG << "Path MTU search complete, MTU is " << mMtu;
+	mState = State::SearchComplete;
+	mSearchTime = clock::now();
+	arm(ConfirmationInterval, mProbeId);
+}
+
+void PathMtuDiscovery::arm(clock::duration delay, uint32_t id) {
+	mTimer.cancel();
+	mTimer = ThreadPool::Instance().scheduleTimer(delay, [weak_this = weak_from_this(), id]() {
+		if (auto locked = weak_this.lock())
+			locked->timeout(id);
+	});
+}
+
+void PathMtuDiscovery::timeout(uint32_t id) {
+	optional<Probe> probe;
+	optional<size_t> mtu;
+	{
+		std::lock_guard lock(mMutex);
+		if (id != mProbeId)
+			return;
+
+		switch (mState) {
+		case State::Searching:
+			if (++mProbeCount <= MaxProbes) {
+				arm(ProbeTimeout, id);
+				probe = Probe{id, mProbeSizes[mNextProbeIndex]};
+			} else {
+				PLOG_DEBUG << "Path MTU probe of size " << mProbeSizes[mNextProbeIndex]
+				           << " failed";
+				complete();
+			}
+			break;
+
+		case State::Confirming:
+			if (++mProbeCount <= MaxProbes) {
+				arm(ProbeTimeout, id);
+				probe = Probe{id, mMtu};
+			} else {
+				// Black hole, fall back to the base MTU and search again later
+				PLOG_WARNING << "Path MTU of " << mMtu << " is not confirmed anymore";
+				mMtu = mBaseMtu;
+				mtu = mMtu;
+				mNextProbeIndex = 0;
+				complete();
+			}
+			break;
+
+		case State::SearchComplete:
+			if (clock::now() - mSearchTime >= RaiseInterval) {
+				// The path might have changed, resume the search after the last failed size
+				mState = State::Searching;
+				probe = probeNext();
+			} else if (mMtu > mBaseMtu) {
+				probe = probeCurrent();
+			} else {
+				arm(ConfirmationInterval, id);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+	send(std::move(probe), std::move(mtu));
+}
+
+void PathMtuDiscovery::send(optional<Probe> probe, optional<size_t> mtu) {
+	// Callbacks are called without the lock
+	if (mtu) {
+		PLOG_INFO << "Path MTU set to " << *mtu;
+		mMtuCallback(*mtu);
+	}
+
+	if (probe) {
+		PLOG_VERBOSE << "Sending path MTU probe, size=" << probe->size;
+		mProbeCallback(probe->id, probe->size);
+	}
+}
+
+} // namespace rtc::impl
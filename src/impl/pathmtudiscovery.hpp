@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_PATH_MTU_DISCOVERY_H
+#define RTC_IMPL_PATH_MTU_DISCOVERY_H
+
+#include "common.hpp"
+#include "threadpool.hpp"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace rtc::impl {
+
+// Packetization Layer Path MTU Discovery (RFC 8899)
+// The search raises the MTU from a base value assumed to work, one probe size at a time. Probes
+// are padding packets sent by the owner and acknowledged by the peer, so a lost probe never loses
+// data. Once the search is complete, the MTU is confirmed periodically to detect black holes and
+// the search is restarted from time to time in case the path changed.
+// See https://www.rfc-editor.org/rfc/rfc8899.html
+class PathMtuDiscovery final : public std::enable_shared_from_this<PathMtuDiscovery> {
+public:
+	using clock = std::chrono::steady_clock;
+
+	enum class State { Disabled, Searching, SearchComplete, Confirming };
+
+	// Sizes are MTUs including IP headers, the owner accounts for its own overhead
+	using probe_callback = std::function<void(uint32_t id, size_t size)>;
+	using mtu_callback = std::function<void(size_t mtu)>;
+
+	PathMtuDiscovery(size_t baseMtu, size_t maxMtu, probe_callback probeCallback,
+	                 mtu_callback mtuCallback);
+	~PathMtuDiscovery();
+
+	void start();
+	void stop();
+	void acknowledge(uint32_t id); // a probe was received by the peer
+
+	size_t mtu() const;
+	State state() const;
+
+private:
+	struct Probe {
+		uint32_t id;
+		size_t size;
+	};
+
+	optional<Probe> probeNext();    // requires mMutex to be locked
+	optional<Probe> probeCurrent(); // same
+	void complete();                // same
+	void arm(clock::duration delay, uint32_t id);
+	void timeout(uint32_t id);
+	void send(optional<Probe> probe, optional<size_t> mtu);
+
+	static const clock::duration ProbeTimeout;
+	static const clock::duration ConfirmationInterval;
+	static const clock::duration RaiseInterval;
+	static const int MaxProbes;
+
+	const size_t mBaseMtu;
+	const probe_callback mProbeCallback;
+	const mtu_callback mMtuCallback;
+	std::vector<size_t> mProbeSizes; // increasing, above the base MTU
+
+	State mState = State::Disabled;
+	size_t mMtu;
+	size_t mNextProbeIndex = 0;
+	uint32_t mProbeId = 0; // id of the outstanding probe
+	int mProbeCount = 0;   // transmissions of the outstanding probe
+	clock::time_point mSearchTime;
+	TimerHandle mTimer;
+
+	mutable std::mutex mMutex;
+};
+
+} // namespace rtc::impl
+
+#endif
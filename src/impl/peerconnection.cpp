@@ -20,10 +20,14 @@
 #include "peerconnection.hpp"
 #include "certificate.hpp"
 #include "common.hpp"
+#include "dnscache.hpp"
 #include "dtlstransport.hpp"
 #include "icetransport.hpp"
 #include "internals.hpp"
 #include "logcounter.hpp"
+#include "loopbacktransport.hpp"
+#include "metrics.hpp"
+#include "overloadcontroller.hpp"
 #include "peerconnection.hpp"
 #include "processor.hpp"
 #include "rtp.hpp"
@@ -34,10 +38,9 @@
 #include "dtlssrtptransport.hpp"
 #endif
 
+#include <algorithm>
 #include <array>
 #include <iomanip>
-#include <set>
-#include <thread>
 
 using namespace std::placeholders;
 
@@ -53,11 +56,64 @@ static LogCounter
     COUNTER_UNKNOWN_PACKET_TYPE(plog::warning,
                                 "Number of unknown RTCP packet types over past second");
 
+#if RTC_ENABLE_MEDIA
+// RFC 8888 congestion control feedback is negotiated with a=rtcp-fb:<pt or *> ack ccfb, see
+// https://www.rfc-editor.org/rfc/rfc8888.html#section-6
+static bool HasCongestionControlFeedback(Description &description) {
+	for (unsigned int i = 0; i < description.mediaCount(); ++i) {
+		auto entry = description.media(i);
+		auto media = std::get_if<Description::Media *>(&entry);
+		if (!media)
+			continue;
+
+		if (std::any_of((*media)->beginAttributes(), (*media)->endAttributes(),
+		                [](const string &attr) { return attr == "rtcp-fb:* ack ccfb"; }))
+			return true;
+
+		for (auto it = (*media)->beginMaps(); it != (*media)->endMaps(); ++it) {
+			const auto &fbs = it->second.rtcpFbs;
+			if (std::find(fbs.begin(), fbs.end(), "ack ccfb") != fbs.end())
+				return true;
+		}
+	}
+	return false;
+}
+#endif
+
 PeerConnection::PeerConnection(Configuration config_)
-    : config(std::move(config_)), mCertificate(make_certificate(config.certificateType)),
-      mProcessor(std::make_unique<Processor>()) {
+    : PeerConnection(std::move(config_), future_certificate_ptr()) {
+	ValidateConfiguration(config);
+}
+
+PeerConnection::PeerConnection(Configuration config_, future_certificate_ptr certificate)
+    : config(std::move(config_)),
+#if RTC_ENABLE_LATENCY_TRACING
+      latencyTracer(std::make_shared<LatencyTracer>(config.latencySampleInterval)),
+#endif
+      metricsId(MetricsRegistry::NextId()),
+      memoryAccount(std::make_shared<MemoryAccount>(config.memoryLimit)),
+      capture(config.capturePath ? std::make_shared<CaptureWriter>(*config.capturePath)
+                                 : nullptr),
+      mCertificate(certificate.valid()
+                       ? std::move(certificate)
+                       : make_certificate(config.certificateType, config.shareCertificate)),
+      mProcessor(std::make_unique<Processor>(0, ThreadPool::Affinity(this))) {
 	PLOG_VERBOSE << "Creating PeerConnection";
 
+	mSetupTimeline.created = SetupTimeline::clock::now();
+
+#if RTC_ENABLE_MEDIA
+	if (config.enableMediaPacing)
+		mPacer = std::make_shared<Pacer>(config.mediaPacingBitrate, config.mediaPacingFactor);
+#endif
+}
+
+PeerConnection::~PeerConnection() {
+	PLOG_VERBOSE << "Destroying PeerConnection";
+	mProcessor->join();
+}
+
+void PeerConnection::ValidateConfiguration(const Configuration &config) {
 	if (config.portRangeEnd && config.portRangeBegin > config.portRangeEnd)
 		throw std::invalid_argument("Invalid port range");
 
@@ -73,11 +129,6 @@ PeerConnection::PeerConnection(Configuration config_)
 	}
 }
 
-PeerConnection::~PeerConnection() {
-	PLOG_VERBOSE << "Destroying PeerConnection";
-	mProcessor->join();
-}
-
 void PeerConnection::close() {
 	PLOG_VERBOSE << "Closing PeerConnection";
 
@@ -89,6 +140,16 @@ void PeerConnection::close() {
 	closeTransports();
 }
 
+void PeerConnection::onReclaimed(std::function<void()> callback) {
+	std::unique_lock lock(mReclamation->mutex);
+	if (!mReclamation->done) {
+		mReclamation->callbacks.push_back(std::move(callback));
+		return;
+	}
+	lock.unlock();
+	ThreadPool::Instance().post(std::move(callback));
+}
+
 optional<Description> PeerConnection::localDescription() const {
 	std::lock_guard lock(mLocalDescriptionMutex);
 	return mLocalDescription;
@@ -116,9 +177,24 @@ size_t PeerConnection::remoteMaxMessageSize() const {
 	return std::min(remoteMax, localMax);
 }
 
+optional<binary> PeerConnection::compressionDictionary(const string &name) const {
+	if (name.empty())
+		return binary();
+
+	auto it = config.compressionDictionaries.find(name);
+	if (it == config.compressionDictionaries.end())
+		return nullopt;
+
+	return it->second;
+}
+
 // Helper for PeerConnection::initXTransport methods: start and emplace the transport
 template <typename T>
 shared_ptr<T> emplaceTransport(PeerConnection *pc, shared_ptr<T> *member, shared_ptr<T> transport) {
+#if RTC_ENABLE_LATENCY_TRACING
+	transport->setLatencyTracer(pc->latencyTracer);
+#endif
+	transport->setCapture(pc->capture);
 	transport->start();
 	std::atomic_store(member, transport);
 	if (pc->state.load() == PeerConnection::State::Closed) {
@@ -136,8 +212,9 @@ shared_ptr<IceTransport> PeerConnection::initIceTransport() {
 
 		PLOG_VERBOSE << "Starting ICE transport";
 
-		auto transport = std::make_shared<IceTransport>(
-		    config, weak_bind(&PeerConnection::processLocalCandidate, this, _1),
+		auto candidateCallback = weak_bind(&PeerConnection::processLocalCandidate, this, _1);
+
+		auto stateChangeCallback =
 		    [this, weak_this = weak_from_this()](IceTransport::State transportState) {
 			    auto shared_this = weak_this.lock();
 			    if (!shared_this)
@@ -145,12 +222,32 @@ shared_ptr<IceTransport> PeerConnection::initIceTransport() {
 			    switch (transportState) {
 			    case IceTransport::State::Connecting:
 				    changeState(State::Connecting);
+				    ThreadPool::Instance().post(
+				        weak_bind(&PeerConnection::prepareTransports, this));
 				    break;
 			    case IceTransport::State::Failed:
 				    changeState(State::Failed);
 				    break;
 			    case IceTransport::State::Connected:
-				    initDtlsTransport();
+				    if (std::lock_guard lock(mSetupTimelineMutex); !mSetupTimeline.iceConnected)
+					    mSetupTimeline.iceConnected = SetupTimeline::clock::now();
+
+				    // Under overload, the handshake of a new connection waits for the workers
+				    if (!std::atomic_load(&mDtlsTransport) &&
+				        OverloadController::Instance().atLeast(OverloadLevel::DeferHandshakes)) {
+					    PLOG_DEBUG << "Deferring DTLS handshake under overload";
+					    const auto deferral = OverloadController::Instance().maxHandshakeDeferral();
+					    deferDtlsTransport(std::chrono::steady_clock::now() + deferral);
+					    break;
+				    }
+
+				    // After an ICE restart, the upper transports are still connected
+				    if (auto dtlsTransport = initDtlsTransport();
+				        dtlsTransport && dtlsTransport->state() == Transport::State::Connected) {
+					    auto sctpTransport = std::atomic_load(&mSctpTransport);
+					    if (!sctpTransport || sctpTransport->state() == Transport::State::Connected)
+						    changeState(State::Connected);
+				    }
 				    break;
 			    case IceTransport::State::Disconnected:
 				    changeState(State::Disconnected);
@@ -159,7 +256,9 @@ shared_ptr<IceTransport> PeerConnection::initIceTransport() {
 				    // Ignore
 				    break;
 			    }
-		    },
+		    };
+
+		auto gatheringStateChangeCallback =
 		    [this, weak_this = weak_from_this()](IceTransport::GatheringState gatheringState) {
 			    auto shared_this = weak_this.lock();
 			    if (!shared_this)
@@ -167,8 +266,15 @@ shared_ptr<IceTransport> PeerConnection::initIceTransport() {
 			    switch (gatheringState) {
 			    case IceTransport::GatheringState::InProgress:
 				    changeGatheringState(GatheringState::InProgress);
+				    if (config.iceGatheringTimeout)
+					    mGatheringTimer = ThreadPool::Instance().scheduleTimer(
+					        *config.iceGatheringTimeout, [weak_this]() {
+						        if (auto locked = weak_this.lock())
+							        locked->gatheringTimeout();
+					        });
 				    break;
 			    case IceTransport::GatheringState::Complete:
+				    mGatheringTimer.cancel();
 				    endLocalCandidates();
 				    changeGatheringState(GatheringState::Complete);
 				    break;
@@ -176,7 +282,22 @@ shared_ptr<IceTransport> PeerConnection::initIceTransport() {
 				    // Ignore
 				    break;
 			    }
-		    });
+		    };
+
+		// A transport from the candidate pool of a factory already has its candidates
+		auto transport = std::atomic_exchange(&mPregatheredIceTransport,
+		                                      decltype(mPregatheredIceTransport)(nullptr));
+		if (transport)
+			transport->bind(std::move(candidateCallback), std::move(stateChangeCallback),
+			                std::move(gatheringStateChangeCallback));
+		else if (config.enableInProcessLoopback)
+			transport = std::make_shared<LoopbackTransport>(config, std::move(candidateCallback),
+			                                                std::move(stateChangeCallback),
+			                                                std::move(gatheringStateChangeCallback));
+		else
+			transport = std::make_shared<IceTransport>(config, std::move(candidateCallback),
+			                                           std::move(stateChangeCallback),
+			                                           std::move(gatheringStateChangeCallback));
 
 		return emplaceTransport(this, &mIceTransport, std::move(transport));
 
@@ -187,6 +308,10 @@ shared_ptr<IceTransport> PeerConnection::initIceTransport() {
 	}
 }
 
+void PeerConnection::setPregatheredIceTransport(shared_ptr<IceTransport> transport) {
+	std::atomic_store(&mPregatheredIceTransport, std::move(transport));
+}
+
 shared_ptr<DtlsTransport> PeerConnection::initDtlsTransport() {
 	try {
 		if (auto transport = std::atomic_load(&mDtlsTransport))
@@ -194,58 +319,16 @@ shared_ptr<DtlsTransport> PeerConnection::initDtlsTransport() {
 
 		PLOG_VERBOSE << "Starting DTLS transport";
 
-		auto lower = std::atomic_load(&mIceTransport);
-		if (!lower)
-			throw std::logic_error("No underlying ICE transport for DTLS transport");
-
-		auto certificate = mCertificate.get();
-		auto verifierCallback = weak_bind(&PeerConnection::checkFingerprint, this, _1);
-		auto dtlsStateChangeCallback =
-		    [this, weak_this = weak_from_this()](DtlsTransport::State transportState) {
-			    auto shared_this = weak_this.lock();
-			    if (!shared_this)
-				    return;
-
-			    switch (transportState) {
-			    case DtlsTransport::State::Connected:
-				    if (auto remote = remoteDescription(); remote && remote->hasApplication())
-					    initSctpTransport();
-				    else
-					    changeState(State::Connected);
-
-				    mProcessor->enqueue(&PeerConnection::openTracks, this);
-				    break;
-			    case DtlsTransport::State::Failed:
-				    changeState(State::Failed);
-				    break;
-			    case DtlsTransport::State::Disconnected:
-				    changeState(State::Disconnected);
-				    break;
-			    default:
-				    // Ignore
-				    break;
-			    }
-		    };
-
 		shared_ptr<DtlsTransport> transport;
-		if (auto local = localDescription(); local && local->hasAudioOrVideo()) {
-#if RTC_ENABLE_MEDIA
-			PLOG_INFO << "This connection requires media support";
-
-			// DTLS-SRTP
-			transport = std::make_shared<DtlsSrtpTransport>(
-			    lower, certificate, config.mtu, verifierCallback,
-			    weak_bind(&PeerConnection::forwardMedia, this, _1), dtlsStateChangeCallback);
-#else
-			PLOG_WARNING << "Ignoring media support (not compiled with media support)";
-#endif
+		{
+			std::lock_guard lock(mPreparedTransportsMutex);
+			transport = std::exchange(mPreparedDtlsTransport, nullptr);
+			if (!transport)
+				mPreparedSctpTransport.reset(); // it would not be on top of the new one
 		}
 
-		if (!transport) {
-			// DTLS only
-			transport = std::make_shared<DtlsTransport>(lower, certificate, config.mtu,
-			                                            verifierCallback, dtlsStateChangeCallback);
-		}
+		if (!transport)
+			transport = createDtlsTransport();
 
 		return emplaceTransport(this, &mDtlsTransport, std::move(transport));
 
@@ -256,52 +339,52 @@ shared_ptr<DtlsTransport> PeerConnection::initDtlsTransport() {
 	}
 }
 
+void PeerConnection::deferDtlsTransport(std::chrono::steady_clock::time_point deadline) {
+	using namespace std::chrono_literals;
+	const auto now = std::chrono::steady_clock::now();
+	if (now < deadline && OverloadController::Instance().atLeast(OverloadLevel::DeferHandshakes)) {
+		mDeferralTimer = ThreadPool::Instance().scheduleTimer(
+		    std::min(now + 100ms, deadline), [weak_this = weak_from_this(), deadline]() {
+			    if (auto locked = weak_this.lock())
+				    locked->deferDtlsTransport(deadline);
+		    });
+		return;
+	}
+
+	auto iceTransport = std::atomic_load(&mIceTransport);
+	if (state == State::Closed || !iceTransport)
+		return;
+
+	const auto iceState = iceTransport->state();
+	if (iceState == Transport::State::Connected || iceState == Transport::State::Completed)
+		initDtlsTransport();
+}
+
 shared_ptr<SctpTransport> PeerConnection::initSctpTransport() {
 	try {
 		if (auto transport = std::atomic_load(&mSctpTransport))
 			return transport;
 
+		if (config.disableDataChannels)
+			throw std::logic_error("Starting SCTP transport with Data Channels disabled");
+
 		PLOG_VERBOSE << "Starting SCTP transport";
 
 		auto lower = std::atomic_load(&mDtlsTransport);
 		if (!lower)
 			throw std::logic_error("No underlying DTLS transport for SCTP transport");
 
-		auto remote = remoteDescription();
-		if (!remote || !remote->application())
-			throw std::logic_error("Starting SCTP transport without application description");
-
-		uint16_t sctpPort = remote->application()->sctpPort().value_or(DEFAULT_SCTP_PORT);
-
 		// This is the last occasion to ensure the stream numbers are coherent with the role
 		shiftDataChannels();
 
-		auto transport = std::make_shared<SctpTransport>(
-		    lower, config, sctpPort, weak_bind(&PeerConnection::forwardMessage, this, _1),
-		    weak_bind(&PeerConnection::forwardBufferedAmount, this, _1, _2),
-		    [this, weak_this = weak_from_this()](SctpTransport::State transportState) {
-			    auto shared_this = weak_this.lock();
-			    if (!shared_this)
-				    return;
-			    switch (transportState) {
-			    case SctpTransport::State::Connected:
-				    changeState(State::Connected);
-				    mProcessor->enqueue(&PeerConnection::openDataChannels, this);
-				    break;
-			    case SctpTransport::State::Failed:
-				    LOG_WARNING << "SCTP transport failed";
-				    changeState(State::Failed);
-				    mProcessor->enqueue(&PeerConnection::remoteCloseDataChannels, this);
-				    break;
-			    case SctpTransport::State::Disconnected:
-				    changeState(State::Disconnected);
-				    mProcessor->enqueue(&PeerConnection::remoteCloseDataChannels, this);
-				    break;
-			    default:
-				    // Ignore
-				    break;
-			    }
-		    });
+		shared_ptr<SctpTransport> transport;
+		{
+			std::lock_guard lock(mPreparedTransportsMutex);
+			transport = std::exchange(mPreparedSctpTransport, nullptr);
+		}
+
+		if (!transport)
+			transport = createSctpTransport(std::move(lower));
 
 		return emplaceTransport(this, &mSctpTransport, std::move(transport));
 
@@ -312,6 +395,145 @@ shared_ptr<SctpTransport> PeerConnection::initSctpTransport() {
 	}
 }
 
+shared_ptr<DtlsTransport> PeerConnection::createDtlsTransport() {
+	auto lower = std::atomic_load(&mIceTransport);
+	if (!lower)
+		throw std::logic_error("No underlying ICE transport for DTLS transport");
+
+	auto certificate = mCertificate.get();
+	auto verifierCallback = weak_bind(&PeerConnection::checkFingerprint, this, _1);
+	auto dtlsStateChangeCallback =
+	    [this, weak_this = weak_from_this()](DtlsTransport::State transportState) {
+		    auto shared_this = weak_this.lock();
+		    if (!shared_this)
+			    return;
+
+		    switch (transportState) {
+		    case DtlsTransport::State::Connected:
+			    if (std::lock_guard lock(mSetupTimelineMutex); !mSetupTimeline.dtlsConnected)
+				    mSetupTimeline.dtlsConnected = SetupTimeline::clock::now();
+
+			    if (auto remote = remoteDescription();
+			        remote && remote->hasApplication() && !config.disableDataChannels)
+				    initSctpTransport();
+			    else
+				    changeState(State::Connected);
+
+			    mProcessor->enqueue(&PeerConnection::openTracks, this);
+			    break;
+		    case DtlsTransport::State::Failed:
+			    changeState(State::Failed);
+			    break;
+		    case DtlsTransport::State::Disconnected:
+			    changeState(State::Disconnected);
+			    break;
+		    default:
+			    // Ignore
+			    break;
+		    }
+	    };
+
+	shared_ptr<DtlsTransport> transport;
+	if (auto local = localDescription(); local && local->hasAudioOrVideo()) {
+#if RTC_ENABLE_MEDIA
+		PLOG_INFO << "This connection requires media support";
+
+		// DTLS-SRTP
+		Init::Instance().init(Init::Subsystem::Srtp);
+		auto srtpTransport = std::make_shared<DtlsSrtpTransport>(
+		    lower, certificate, config, verifierCallback,
+		    weak_bind(&PeerConnection::forwardMedia, this, _1), dtlsStateChangeCallback);
+		auto remote = remoteDescription();
+		srtpTransport->setEcnFeedback(remote && HasCongestionControlFeedback(*local) &&
+		                              HasCongestionControlFeedback(*remote));
+		transport = std::move(srtpTransport);
+#else
+		PLOG_WARNING << "Ignoring media support (not compiled with media support)";
+#endif
+	}
+
+	if (!transport) {
+		// DTLS only
+		Init::Instance().init(Init::Subsystem::Dtls);
+		transport = std::make_shared<DtlsTransport>(lower, certificate, config,
+		                                            verifierCallback, dtlsStateChangeCallback);
+	}
+
+	return transport;
+}
+
+shared_ptr<SctpTransport> PeerConnection::createSctpTransport(shared_ptr<DtlsTransport> lower) {
+	auto remote = remoteDescription();
+	if (!remote || !remote->application())
+		throw std::logic_error("Starting SCTP transport without application description");
+
+	uint16_t sctpPort = remote->application()->sctpPort().value_or(DEFAULT_SCTP_PORT);
+
+	Init::Instance().init(Init::Subsystem::Sctp);
+
+	auto transport = std::make_shared<SctpTransport>(
+	    lower, config, sctpPort, weak_bind(&PeerConnection::forwardMessage, this, _1),
+	    weak_bind(&PeerConnection::forwardBufferedAmount, this, _1, _2),
+	    [this, weak_this = weak_from_this()](SctpTransport::State transportState) {
+		    auto shared_this = weak_this.lock();
+		    if (!shared_this)
+			    return;
+		    switch (transportState) {
+		    case SctpTransport::State::Connected:
+			    if (std::lock_guard lock(mSetupTimelineMutex); !mSetupTimeline.sctpConnected)
+				    mSetupTimeline.sctpConnected = SetupTimeline::clock::now();
+
+			    changeState(State::Connected);
+			    mProcessor->enqueue(&PeerConnection::openDataChannels, this);
+			    break;
+		    case SctpTransport::State::Failed:
+			    LOG_WARNING << "SCTP transport failed";
+			    changeState(State::Failed);
+			    mProcessor->enqueue(&PeerConnection::remoteCloseDataChannels, this);
+			    break;
+		    case SctpTransport::State::Disconnected:
+			    changeState(State::Disconnected);
+			    mProcessor->enqueue(&PeerConnection::remoteCloseDataChannels, this);
+			    break;
+		    default:
+			    // Ignore
+			    break;
+		    }
+	    },
+	    ThreadPool::Affinity(this)); // same worker as the PeerConnection processor
+
+	transport->setMemoryAccount(memoryAccount);
+	if (config.enableDatagrams)
+		transport->onDatagram(weak_bind(&PeerConnection::forwardDatagram, this, _1));
+
+	return transport;
+}
+
+void PeerConnection::prepareTransports() {
+	// Create the DTLS session and the SCTP socket while ICE checks are running, so the handshake
+	// starts as soon as ICE is connected and SCTP as soon as DTLS is
+	std::lock_guard lock(mPreparedTransportsMutex);
+	if (mPreparedDtlsTransport || std::atomic_load(&mDtlsTransport) || state == State::Closed)
+		return;
+
+	try {
+		PLOG_VERBOSE << "Preparing DTLS and SCTP transports";
+		auto dtlsTransport = createDtlsTransport();
+
+		shared_ptr<SctpTransport> sctpTransport;
+		if (auto remote = remoteDescription();
+		    remote && remote->hasApplication() && !config.disableDataChannels)
+			sctpTransport = createSctpTransport(dtlsTransport);
+
+		mPreparedDtlsTransport = std::move(dtlsTransport);
+		mPreparedSctpTransport = std::move(sctpTransport);
+
+	} catch (const std::exception &e) {
+		// They will be created again when needed
+		PLOG_WARNING << "Failed to prepare transports: " << e.what();
+	}
+}
+
 shared_ptr<IceTransport> PeerConnection::getIceTransport() const {
 	return std::atomic_load(&mIceTransport);
 }
@@ -324,6 +546,72 @@ shared_ptr<SctpTransport> PeerConnection::getSctpTransport() const {
 	return std::atomic_load(&mSctpTransport);
 }
 
+size_t PeerConnection::pathMtu() const {
+	if (auto sctpTransport = getSctpTransport())
+		if (auto mtu = sctpTransport->pathMtu())
+			return *mtu;
+
+	return config.mtu.value_or(DEFAULT_MTU);
+}
+
+bool PeerConnection::datagramsNegotiated() const {
+	auto local = localDescription();
+	auto remote = remoteDescription();
+	return config.enableDatagrams && local && local->application() &&
+	       local->application()->datagrams() && remote && remote->application() &&
+	       remote->application()->datagrams();
+}
+
+size_t PeerConnection::maxDatagramSize() const {
+	// IPv6 header, UDP header, DTLS overhead, and datagram header
+	const size_t overhead = 40 + 8 + 48 + 2;
+	return pathMtu() - overhead;
+}
+
+bool PeerConnection::sendDatagram(binary data) {
+	if (!config.enableDatagrams)
+		throw std::logic_error("Datagrams are not enabled");
+
+	if (data.size() > maxDatagramSize())
+		throw std::invalid_argument("Datagram size exceeds limit");
+
+	auto transport = getSctpTransport();
+	if (!transport || !datagramsNegotiated())
+		return false;
+
+	if (config.datagramMaxBitrate) {
+		// Token bucket allowing bursts of 20ms at the maximum bitrate
+		using namespace std::chrono;
+		const double rate = double(*config.datagramMaxBitrate) / 8; // bytes/s
+		const double burst = std::max(rate * 0.020, double(maxDatagramSize()));
+
+		std::lock_guard lock(mDatagramMutex);
+		auto now = steady_clock::now();
+		if (mDatagramLastRefill == steady_clock::time_point())
+			mDatagramTokens = burst;
+		else
+			mDatagramTokens =
+			    std::min(burst, mDatagramTokens +
+			                        rate * duration<double>(now - mDatagramLastRefill).count());
+
+		mDatagramLastRefill = now;
+		if (mDatagramTokens < double(data.size())) {
+			PLOG_VERBOSE << "Dropping datagram over the maximum bitrate";
+			return false;
+		}
+		mDatagramTokens -= double(data.size());
+	}
+
+	return transport->sendDatagram(data);
+}
+
+void PeerConnection::forwardDatagram(message_ptr message) {
+	if (!message)
+		return;
+
+	datagramCallback(binary(message->begin(), message->end()));
+}
+
 void PeerConnection::closeTransports() {
 	PLOG_VERBOSE << "Closing transports";
 
@@ -334,7 +622,20 @@ void PeerConnection::closeTransports() {
 	// Reset callbacks now that state is changed
 	resetCallbacks();
 
+#if RTC_ENABLE_MEDIA
+	if (mPacer)
+		mPacer->stop();
+#endif
+
 	// Pass the pointers to a thread, allowing to terminate a transport from its own thread
+	{
+		// Transports that were never started are simply destroyed
+		std::lock_guard lock(mPreparedTransportsMutex);
+		mPreparedSctpTransport.reset();
+		mPreparedDtlsTransport.reset();
+	}
+	std::atomic_store(&mPregatheredIceTransport, decltype(mPregatheredIceTransport)(nullptr));
+
 	auto sctp = std::atomic_exchange(&mSctpTransport, decltype(mSctpTransport)(nullptr));
 	auto dtls = std::atomic_exchange(&mDtlsTransport, decltype(mDtlsTransport)(nullptr));
 	auto ice = std::atomic_exchange(&mIceTransport, decltype(mIceTransport)(nullptr));
@@ -345,21 +646,53 @@ void PeerConnection::closeTransports() {
 	}
 
 	using array = std::array<shared_ptr<Transport>, 3>;
-	array transports{std::move(sctp), std::move(dtls), std::move(ice)};
+	array transports{sctp, std::move(dtls), std::move(ice)};
 
 	for (const auto &t : transports)
 		if (t)
 			t->onStateChange(nullptr);
 
+	// Transports are stopped once the SCTP association is gracefully closed, or at the deadline
+	// where it is aborted instead. Waiting is asynchronous so many connections close in parallel.
+	struct Teardown {
+		array transports;
+		TimerHandle timer;
+		std::mutex mutex;
+	};
+	auto teardown = std::make_shared<Teardown>();
+	teardown->transports = std::move(transports);
+	auto stop = [teardown, capture = capture, reclamation = mReclamation]() {
+		std::lock_guard lock(teardown->mutex);
+		teardown->timer.cancel();
+		for (const auto &t : teardown->transports)
+			if (t)
+				t->stop();
+
+		for (auto &t : teardown->transports)
+			t.reset();
+
+		if (capture)
+			capture->flush(); // the last packets of the connection
+
+		std::vector<std::function<void()>> callbacks;
+		{
+			std::lock_guard reclamationLock(reclamation->mutex);
+			reclamation->done = true;
+			std::swap(callbacks, reclamation->callbacks);
+		}
+		for (auto &callback : callbacks)
+			ThreadPool::Instance().post(std::move(callback));
+	};
+
 	// Initiate transport stop on the processor after closing the data channels
-	mProcessor->enqueue([transports = std::move(transports)]() {
-		ThreadPool::Instance().enqueue([transports = std::move(transports)]() mutable {
-			for (const auto &t : transports)
-				if (t)
-					t->stop();
-
-			for (auto &t : transports)
-				t.reset();
+	mProcessor->enqueue([sctp = std::move(sctp), stop = std::move(stop), teardown]() mutable {
+		ThreadPool::Instance().post([sctp = std::move(sctp), stop = std::move(stop), teardown]() {
+			std::lock_guard lock(teardown->mutex);
+			if (sctp && sctp->shutdownGracefully(stop))
+				teardown->timer =
+				    ThreadPool::Instance().scheduleTimer(SctpTransport::ShutdownDeadline(), stop);
+			else
+				ThreadPool::Instance().post(stop);
 		});
 	});
 }
@@ -370,6 +703,24 @@ void PeerConnection::endLocalCandidates() {
 		mLocalDescription->endCandidates();
 }
 
+void PeerConnection::restartIce() {
+	auto iceTransport = std::atomic_load(&mIceTransport);
+	if (!iceTransport)
+		return; // nothing to restart
+
+	// The DTLS session and the SCTP association are kept, only ICE starts over
+	iceTransport->restart();
+
+	{
+		// Candidates from the previous ICE session must not be carried over
+		std::lock_guard lock(mLocalDescriptionMutex);
+		if (mLocalDescription)
+			mLocalDescription->extractCandidates();
+	}
+
+	changeGatheringState(GatheringState::New);
+}
+
 void PeerConnection::rollbackLocalDescription() {
 	PLOG_DEBUG << "Rolling back pending local description";
 
@@ -383,6 +734,9 @@ void PeerConnection::rollbackLocalDescription() {
 		mLocalDescription->addCandidates(std::move(existingCandidates));
 		mCurrentLocalDescription.reset();
 	}
+	lock.unlock();
+
+	updateTracksBySsrc(SsrcSource::Local);
 }
 
 bool PeerConnection::checkFingerprint(const std::string &fingerprint) const {
@@ -423,7 +777,11 @@ void PeerConnection::forwardMessage(message_ptr message) {
 			                                  weak_ptr<DataChannel>{channel});
 
 			std::unique_lock lock(mDataChannelsMutex); // we are going to emplace
-			mDataChannels.emplace(stream, channel);
+			if (stream >= mDataChannels.size())
+				mDataChannels.resize(size_t(stream) + 1);
+
+			if (mDataChannels[stream].expired())
+				mDataChannels[stream] = channel;
 		} else {
 			// Invalid, close the DataChannel
 			sctpTransport->closeStream(message->stream);
@@ -438,65 +796,14 @@ void PeerConnection::forwardMedia(message_ptr message) {
 	if (!message)
 		return;
 
-	// Browsers like to compound their packets with a random SSRC.
-	// we have to do this monstrosity to distribute the report blocks
-	if (message->type == Message::Control) {
-		std::set<uint32_t> ssrcs;
-		size_t offset = 0;
-		while ((sizeof(RtcpHeader) + offset) <= message->size()) {
-			auto header = reinterpret_cast<RtcpHeader *>(message->data() + offset);
-			if (header->lengthInBytes() > message->size() - offset) {
-				COUNTER_MEDIA_TRUNCATED++;
-				break;
-			}
-			offset += header->lengthInBytes();
-			if (header->payloadType() == 205 || header->payloadType() == 206) {
-				auto rtcpfb = reinterpret_cast<RtcpFbHeader *>(header);
-				ssrcs.insert(rtcpfb->packetSenderSSRC());
-				ssrcs.insert(rtcpfb->mediaSourceSSRC());
-
-			} else if (header->payloadType() == 200 || header->payloadType() == 201) {
-				auto rtcpsr = reinterpret_cast<RtcpSr *>(header);
-				ssrcs.insert(rtcpsr->senderSSRC());
-				for (int i = 0; i < rtcpsr->header.reportCount(); ++i)
-					ssrcs.insert(rtcpsr->getReportBlock(i)->getSSRC());
-			} else if (header->payloadType() == 202) {
-				auto sdes = reinterpret_cast<RtcpSdes *>(header);
-				if (!sdes->isValid()) {
-					PLOG_WARNING << "RTCP SDES packet is invalid";
-					continue;
-				}
-				for (unsigned int i = 0; i < sdes->chunksCount(); i++) {
-					auto chunk = sdes->getChunk(i);
-					ssrcs.insert(chunk->ssrc());
-				}
-			} else {
-				// PT=207 == Extended Report
-				if (header->payloadType() != 207) {
-					COUNTER_UNKNOWN_PACKET_TYPE++;
-				}
-			}
-		}
-
-		if (!ssrcs.empty()) {
-			for (uint32_t ssrc : ssrcs) {
-				if (auto mid = getMidFromSsrc(ssrc)) {
-					std::shared_lock lock(mTracksMutex); // read-only
-					if (auto it = mTracks.find(*mid); it != mTracks.end())
-						if (auto track = it->second.lock())
-							track->incoming(message);
-				}
-			}
-			return;
-		}
-	}
+	// Browsers like to compound their packets with a random SSRC, each packet of the compound is
+	// dispatched only to the tracks it concerns
+	if (message->type == Message::Control && forwardCompoundRtcp(message))
+		return;
 
 	uint32_t ssrc = uint32_t(message->stream);
-	if (auto mid = getMidFromSsrc(ssrc)) {
-		std::shared_lock lock(mTracksMutex); // read-only
-		if (auto it = mTracks.find(*mid); it != mTracks.end())
-			if (auto track = it->second.lock())
-				track->incoming(message);
+	if (auto track = findTrack(ssrc)) {
+		track->incoming(std::move(message));
 	} else {
 		/*
 		 * TODO: So the problem is that when stop sending streams, we stop getting report blocks for
@@ -509,54 +816,239 @@ void PeerConnection::forwardMedia(message_ptr message) {
 	}
 }
 
-optional<std::string> PeerConnection::getMidFromSsrc(uint32_t ssrc) {
-	if (auto it = mMidFromSsrc.find(ssrc); it != mMidFromSsrc.end())
-		return it->second;
+bool PeerConnection::forwardCompoundRtcp(message_ptr message) {
+	auto table = std::atomic_load(&mTracksBySsrc);
 
-	{
-		std::lock_guard lock(mRemoteDescriptionMutex);
-		if (!mRemoteDescription)
-			return nullopt;
-		for (unsigned int i = 0; i < mRemoteDescription->mediaCount(); ++i) {
-			if (auto found =
-			        std::visit(rtc::overloaded{[&](Description::Application *) -> optional<string> {
-				                                   return std::nullopt;
-			                                   },
-			                                   [&](Description::Media *media) -> optional<string> {
-				                                   return media->hasSSRC(ssrc)
-				                                              ? std::make_optional(media->mid())
-				                                              : nullopt;
-			                                   }},
-			                   mRemoteDescription->media(i))) {
-
-				mMidFromSsrc.emplace(ssrc, *found);
-				return *found;
+	static const size_t MaxParts = 16;
+	static const size_t MaxTracks = 32; // bits in the mask
+	struct Part {
+		size_t offset = 0;
+		size_t size = 0;
+		uint32_t mask = 0; // concerned tracks
+	};
+	std::array<Part, MaxParts> parts;
+	std::array<shared_ptr<Track>, MaxTracks> tracks;
+	size_t partsCount = 0;
+	size_t tracksCount = 0;
+	bool referenced = false; // at least one SSRC was found
+
+	auto lookup = [&](uint32_t ssrc) -> uint32_t {
+		referenced = true;
+		if (!table)
+			return 0;
+
+		auto it = table->find(ssrc);
+		if (it == table->end())
+			return 0;
+
+		auto track = it->second.lock();
+		if (!track)
+			return 0;
+
+		for (size_t t = 0; t < tracksCount; ++t)
+			if (tracks[t] == track)
+				return uint32_t(1) << t;
+
+		if (tracksCount == MaxTracks)
+			return 0;
+
+		tracks[tracksCount] = std::move(track);
+		return uint32_t(1) << tracksCount++;
+	};
+
+	size_t offset = 0;
+	while ((sizeof(RtcpHeader) + offset) <= message->size()) {
+		auto header = reinterpret_cast<RtcpHeader *>(message->data() + offset);
+		const size_t size = header->lengthInBytes();
+		if (size > message->size() - offset) {
+			COUNTER_MEDIA_TRUNCATED++;
+			break;
+		}
+
+		uint32_t mask = 0;
+		const uint8_t payloadType = header->payloadType();
+		if (payloadType == 205 || payloadType == 206) {
+			// Feedback concerns the media source, REMB has none and goes to the sender
+			auto rtcpfb = reinterpret_cast<RtcpFbHeader *>(header);
+			if (size >= sizeof(RtcpFbHeader))
+				if (mask = lookup(rtcpfb->mediaSourceSSRC()); mask == 0)
+					mask = lookup(rtcpfb->packetSenderSSRC());
+
+		} else if (payloadType == 200) {
+			auto rtcpsr = reinterpret_cast<RtcpSr *>(header);
+			if (size >= RtcpSr::Size(header->reportCount())) {
+				mask = lookup(rtcpsr->senderSSRC());
+				for (int r = 0; r < header->reportCount(); ++r)
+					mask |= lookup(rtcpsr->getReportBlock(r)->getSSRC());
+			}
+		} else if (payloadType == 201) {
+			auto rtcprr = reinterpret_cast<RtcpRr *>(header);
+			if (size >= RtcpRr::SizeWithReportBlocks(header->reportCount())) {
+				mask = lookup(rtcprr->senderSSRC());
+				for (int r = 0; r < header->reportCount(); ++r)
+					mask |= lookup(rtcprr->getReportBlock(r)->getSSRC());
+			}
+		} else if (payloadType == 202) {
+			auto sdes = reinterpret_cast<RtcpSdes *>(header);
+			if (sdes->isValid()) {
+				for (unsigned int c = 0; c < sdes->chunksCount(); c++)
+					mask |= lookup(sdes->getChunk(c)->ssrc());
+			} else {
+				PLOG_COUNTED(plog::warning, "Number of invalid RTCP SDES packets received");
+			}
+		} else {
+			// BYE, APP, and Extended Report start with the sender SSRC
+			if (payloadType < 203 || payloadType > 207)
+				COUNTER_UNKNOWN_PACKET_TYPE++;
+			else if (size >= sizeof(RtcpHeader) + sizeof(uint32_t))
+				mask = lookup(reinterpret_cast<RtcpRr *>(header)->senderSSRC());
+		}
+
+		if (mask != 0) {
+			if (partsCount < MaxParts) {
+				parts[partsCount++] = Part{offset, size, mask};
+			} else {
+				// Merge the remaining packets into the last part
+				auto &last = parts[MaxParts - 1];
+				last.size = offset + size - last.offset;
+				last.mask |= mask;
 			}
 		}
+		offset += size;
 	}
-	{
+
+	if (!referenced)
+		return false;
+
+	for (size_t t = 0; t < tracksCount; ++t) {
+		const uint32_t bit = uint32_t(1) << t;
+		size_t total = 0;
+		for (size_t p = 0; p < partsCount; ++p)
+			if (parts[p].mask & bit)
+				total += parts[p].size;
+
+		if (total == message->size()) {
+			// The whole compound concerns the track
+			tracks[t]->incoming(message);
+			continue;
+		}
+
+		auto sub = make_message(size_t(0), Message::Control, message->stream);
+		sub->arrivalTime = message->arrivalTime;
+		sub->reserve(total);
+		for (size_t p = 0; p < partsCount; ++p)
+			if (parts[p].mask & bit)
+				sub->insert(sub->end(), message->begin() + parts[p].offset,
+				            message->begin() + parts[p].offset + parts[p].size);
+
+		tracks[t]->incoming(std::move(sub));
+	}
+	return true;
+}
+
+shared_ptr<Track> PeerConnection::findTrack(uint32_t ssrc) const {
+	auto tracks = std::atomic_load(&mTracksBySsrc);
+	if (!tracks)
+		return nullptr;
+
+	auto it = tracks->find(ssrc);
+	return it != tracks->end() ? it->second.lock() : nullptr;
+}
+
+void PeerConnection::updateTracksBySsrc(SsrcSource source) {
+	// Collect SSRCs by mid, which is a cheap walk compared to rebuilding the whole table
+	std::unordered_map<string, std::vector<uint32_t>> ssrcs;
+	auto collect = [&ssrcs](const Description &description) {
+		for (unsigned int i = 0; i < description.mediaCount(); ++i) {
+			auto entry = description.media(i);
+			if (auto media = std::get_if<const Description::Media *>(&entry))
+				if (auto list = (*media)->getSSRCs(); !list.empty())
+					ssrcs.emplace((*media)->mid(), std::move(list));
+		}
+	};
+	if (source == SsrcSource::Remote) {
+		std::lock_guard lock(mRemoteDescriptionMutex);
+		if (mRemoteDescription)
+			collect(*mRemoteDescription);
+	} else {
 		std::lock_guard lock(mLocalDescriptionMutex);
-		if (!mLocalDescription)
-			return nullopt;
-		for (unsigned int i = 0; i < mLocalDescription->mediaCount(); ++i) {
-			if (auto found =
-			        std::visit(rtc::overloaded{[&](Description::Application *) -> optional<string> {
-				                                   return std::nullopt;
-			                                   },
-			                                   [&](Description::Media *media) -> optional<string> {
-				                                   return media->hasSSRC(ssrc)
-				                                              ? std::make_optional(media->mid())
-				                                              : nullopt;
-			                                   }},
-			                   mLocalDescription->media(i))) {
-
-				mMidFromSsrc.emplace(ssrc, *found);
-				return *found;
-			}
+		if (mLocalDescription)
+			collect(*mLocalDescription);
+	}
+
+	std::lock_guard lock(mSsrcTablesMutex);
+	std::vector<uint32_t> changed;
+	diffSsrcTable(source == SsrcSource::Remote ? mRemoteSsrcs : mLocalSsrcs, std::move(ssrcs),
+	              changed);
+	applyTracksBySsrc(changed);
+}
+
+void PeerConnection::updateTracksBySsrc(const string &mid) {
+	std::lock_guard lock(mSsrcTablesMutex);
+	std::vector<uint32_t> changed;
+	for (const SsrcTable *table : {&mRemoteSsrcs, &mLocalSsrcs})
+		if (auto it = table->ssrcs.find(mid); it != table->ssrcs.end())
+			changed.insert(changed.end(), it->second.begin(), it->second.end());
+
+	applyTracksBySsrc(changed);
+}
+
+void PeerConnection::diffSsrcTable(SsrcTable &table,
+                                   std::unordered_map<string, std::vector<uint32_t>> ssrcs,
+                                   std::vector<uint32_t> &changed) {
+	// Unchanged media lines are skipped, so renegotiation does not scale with the session size
+	for (const auto &[mid, list] : table.ssrcs) {
+		if (auto it = ssrcs.find(mid); it != ssrcs.end() && it->second == list)
+			continue;
+
+		for (uint32_t ssrc : list) {
+			if (auto jt = table.mids.find(ssrc); jt != table.mids.end() && jt->second == mid)
+				table.mids.erase(jt);
+
+			changed.push_back(ssrc);
+		}
+	}
+
+	for (const auto &[mid, list] : ssrcs) {
+		if (auto it = table.ssrcs.find(mid); it != table.ssrcs.end() && it->second == list)
+			continue;
+
+		for (uint32_t ssrc : list) {
+			table.mids.emplace(ssrc, mid);
+			changed.push_back(ssrc);
 		}
 	}
 
-	return nullopt;
+	table.ssrcs = std::move(ssrcs);
+}
+
+void PeerConnection::applyTracksBySsrc(const std::vector<uint32_t> &ssrcs) {
+	// Requires mSsrcTablesMutex to be locked
+	if (ssrcs.empty())
+		return;
+
+	auto previous = std::atomic_load(&mTracksBySsrc);
+	auto tracks = previous ? std::make_shared<TracksBySsrc>(*previous)
+	                       : std::make_shared<TracksBySsrc>();
+	{
+		std::shared_lock lock(mTracksMutex); // read-only
+		for (uint32_t ssrc : ssrcs) {
+			// Remote SSRCs take precedence over local ones
+			const string *mid = nullptr;
+			if (auto it = mRemoteSsrcs.mids.find(ssrc); it != mRemoteSsrcs.mids.end())
+				mid = &it->second;
+			else if (auto jt = mLocalSsrcs.mids.find(ssrc); jt != mLocalSsrcs.mids.end())
+				mid = &jt->second;
+
+			auto it = mid ? mTracks.find(*mid) : mTracks.end();
+			if (it != mTracks.end())
+				(*tracks)[ssrc] = it->second;
+			else
+				tracks->erase(ssrc);
+		}
+	}
+
+	std::atomic_store(&mTracksBySsrc, shared_ptr<const TracksBySsrc>(std::move(tracks)));
 }
 
 void PeerConnection::forwardBufferedAmount(uint16_t stream, size_t amount) {
@@ -565,12 +1057,16 @@ void PeerConnection::forwardBufferedAmount(uint16_t stream, size_t amount) {
 }
 
 shared_ptr<DataChannel> PeerConnection::emplaceDataChannel(string label, DataChannelInit init) {
-	cleanupDataChannels();
+	if (config.disableDataChannels)
+		throw std::logic_error("Data Channels are disabled");
+
 	std::unique_lock lock(mDataChannelsMutex); // we are going to emplace
+	const unsigned int streams =
+	    config.compactMemory && !config.sctpDynamicStreams ? COMPACT_SCTP_STREAMS : 65535;
 	uint16_t stream;
 	if (init.id) {
 		stream = *init.id;
-		if (stream == 65535)
+		if (stream >= streams)
 			throw std::invalid_argument("Invalid DataChannel id");
 	} else {
 		// RFC 5763: The answerer MUST use either a setup attribute value of setup:active or
@@ -585,33 +1081,39 @@ shared_ptr<DataChannel> PeerConnection::emplaceDataChannel(string label, DataCha
 		// as the DTLS client, it MUST choose an even stream identifier; if the side is acting as
 		// the DTLS server, it MUST choose an odd one.
 		// See https://tools.ietf.org/html/rfc8832#section-6
-		stream = (role == Description::Role::Active) ? 0 : 1;
-		while (mDataChannels.find(stream) != mDataChannels.end()) {
-			if (stream >= 65535 - 2)
-				throw std::runtime_error("Too many DataChannels");
-
-			stream += 2;
-		}
+		stream = allocateDataChannelStream(role == Description::Role::Active ? 0 : 1, streams);
 	}
 	// If the DataChannel is user-negotiated, do not negociate it here
 	auto channel =
 	    init.negotiated
 	        ? std::make_shared<DataChannel>(weak_from_this(), stream, std::move(label),
-	                                        std::move(init.protocol), std::move(init.reliability))
+	                                        std::move(init.protocol), std::move(init.reliability),
+	                                        init.priority)
 	        : std::make_shared<NegotiatedDataChannel>(weak_from_this(), stream, std::move(label),
 	                                                  std::move(init.protocol),
-	                                                  std::move(init.reliability));
-	mDataChannels.emplace(std::make_pair(stream, channel));
+	                                                  std::move(init.reliability), init.priority);
+	if (init.compression) {
+		auto dictionary = compressionDictionary(init.compressionDictionary);
+		if (!dictionary)
+			throw std::invalid_argument("Unknown compression dictionary \"" +
+			                            init.compressionDictionary + "\"");
+
+		channel->setCompression(std::move(init.compressionDictionary), std::move(*dictionary));
+	}
+
+	if (stream >= mDataChannels.size())
+		mDataChannels.resize(size_t(stream) + 1);
+
+	if (mDataChannels[stream].expired())
+		mDataChannels[stream] = channel;
+
 	return channel;
 }
 
 shared_ptr<DataChannel> PeerConnection::findDataChannel(uint16_t stream) {
+	// Called for every incoming message, stream IDs are dense so this is a direct lookup
 	std::shared_lock lock(mDataChannelsMutex); // read-only
-	if (auto it = mDataChannels.find(stream); it != mDataChannels.end())
-		if (auto channel = it->second.lock())
-			return channel;
-
-	return nullptr;
+	return stream < mDataChannels.size() ? mDataChannels[stream].lock() : nullptr;
 }
 
 void PeerConnection::shiftDataChannels() {
@@ -620,14 +1122,19 @@ void PeerConnection::shiftDataChannels() {
 	if (!sctpTransport && iceTransport && iceTransport->role() == Description::Role::Active) {
 		std::unique_lock lock(mDataChannelsMutex); // we are going to swap the container
 		decltype(mDataChannels) newDataChannels;
-		auto it = mDataChannels.begin();
-		while (it != mDataChannels.end()) {
-			auto channel = it->second.lock();
+		newDataChannels.resize(mDataChannels.size());
+		for (auto &weakChannel : mDataChannels) {
+			auto channel = weakChannel.lock();
+			if (!channel)
+				continue;
+
 			channel->shiftStream();
-			newDataChannels.emplace(channel->stream(), channel);
-			++it;
+			auto &slot = newDataChannels[channel->stream()]; // shifting never increases the ID
+			if (slot.expired())
+				slot = channel;
 		}
 		std::swap(mDataChannels, newDataChannels);
+		cleanupDataChannels();
 	}
 }
 
@@ -637,13 +1144,10 @@ void PeerConnection::iterateDataChannels(
 	{
 		std::shared_lock lock(mDataChannelsMutex); // read-only
 		locked.reserve(mDataChannels.size());
-		auto it = mDataChannels.begin();
-		while (it != mDataChannels.end()) {
-			auto channel = it->second.lock();
+		for (auto &weakChannel : mDataChannels) {
+			auto channel = weakChannel.lock();
 			if (channel && !channel->isClosed())
 				locked.push_back(std::move(channel));
-
-			++it;
 		}
 	}
 
@@ -651,17 +1155,76 @@ void PeerConnection::iterateDataChannels(
 		func(std::move(channel));
 }
 
+void PeerConnection::iterateTracks(std::function<void(shared_ptr<Track> track)> func) {
+	std::vector<shared_ptr<Track>> locked;
+	{
+		std::shared_lock lock(mTracksMutex); // read-only
+		locked.reserve(mTrackLines.size());
+		for (auto &weakTrack : mTrackLines) {
+			auto track = weakTrack.lock();
+			if (track && !track->isClosed())
+				locked.push_back(std::move(track));
+		}
+	}
+
+	for (auto &track : locked)
+		func(std::move(track));
+}
+
 void PeerConnection::cleanupDataChannels() {
-	std::unique_lock lock(mDataChannelsMutex); // we are going to erase
-	auto it = mDataChannels.begin();
-	while (it != mDataChannels.end()) {
-		if (!it->second.lock()) {
-			it = mDataChannels.erase(it);
-			continue;
+	// Requires mDataChannelsMutex to be locked exclusively
+	// Expired entries are already ignored by lookups, this only releases them and shrinks the table
+	for (auto &weakChannel : mDataChannels)
+		if (weakChannel.expired())
+			weakChannel.reset();
+
+	while (!mDataChannels.empty() && mDataChannels.back().expired())
+		mDataChannels.pop_back();
+
+	// Released ids are listed by parity, lowest last
+	for (auto &free : mFreeStreams)
+		free.clear();
+
+	mLiveAtCleanup = mDataChannels.size();
+	for (size_t i = mDataChannels.size(); i-- > 0;) {
+		if (mDataChannels[i].expired()) {
+			mFreeStreams[i % 2].push_back(uint16_t(i));
+			--mLiveAtCleanup;
+		}
+	}
+	mAllocatedSinceCleanup = 0;
+}
+
+uint16_t PeerConnection::allocateDataChannelStream(unsigned int parity, unsigned int streams) {
+	// Requires mDataChannelsMutex to be locked exclusively
+	// Scanning the table for every new channel is quadratic with thousands of channels, so ids of
+	// closed channels are reclaimed in batches, after allocating half as many ids as there were
+	// channels the last time, and allocation is amortized constant time.
+	auto &free = mFreeStreams[parity];
+	const size_t threshold = std::max(mLiveAtCleanup / 2, size_t(16));
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		if (free.empty() && (mAllocatedSinceCleanup >= threshold || attempt > 0))
+			cleanupDataChannels();
+
+		while (!free.empty()) {
+			uint16_t stream = free.back();
+			free.pop_back();
+			// The id might have been taken by a remote or negotiated channel since
+			if (stream < mDataChannels.size() && mDataChannels[stream].expired()) {
+				++mAllocatedSinceCleanup;
+				return stream;
+			}
 		}
 
-		++it;
+		// Slots past the end of the table are free
+		size_t stream = mDataChannels.size() + (mDataChannels.size() % 2 != parity ? 1 : 0);
+		if (stream < streams) {
+			++mAllocatedSinceCleanup;
+			return uint16_t(stream);
+		}
 	}
+
+	throw std::runtime_error("Too many DataChannels");
 }
 
 void PeerConnection::openDataChannels() {
@@ -678,6 +1241,7 @@ void PeerConnection::remoteCloseDataChannels() {
 }
 
 shared_ptr<Track> PeerConnection::emplaceTrack(Description::Media description) {
+	std::unique_lock lock(mTracksMutex); // we are going to emplace
 	shared_ptr<Track> track;
 	if (auto it = mTracks.find(description.mid()); it != mTracks.end())
 		if (track = it->second.lock(); track)
@@ -685,10 +1249,13 @@ shared_ptr<Track> PeerConnection::emplaceTrack(Description::Media description) {
 
 	if (!track) {
 		track = std::make_shared<Track>(weak_from_this(), std::move(description));
-		mTracks.emplace(std::make_pair(track->mid(), track));
+		mTracks[track->mid()] = track;
 		mTrackLines.emplace_back(track);
 	}
+	const string mid = track->mid();
+	lock.unlock();
 
+	updateTracksBySsrc(mid);
 	return track;
 }
 
@@ -703,6 +1270,10 @@ void PeerConnection::incomingTrack(Description::Media description) {
 		auto track = std::make_shared<Track>(weak_from_this(), std::move(description));
 		mTracks.emplace(std::make_pair(track->mid(), track));
 		mTrackLines.emplace_back(track);
+		lock.unlock();
+
+		// Remote SSRCs might already be known for the mid
+		updateTracksBySsrc(track->mid());
 		triggerTrack(track);
 	}
 }
@@ -715,11 +1286,25 @@ void PeerConnection::openTracks() {
 		for (auto it = mTracks.begin(); it != mTracks.end(); ++it)
 			if (auto track = it->second.lock())
 				if (!track->isOpen())
-					track->open(srtpTransport);
+					track->open(srtpTransport, mPacer);
 	}
 #endif
 }
 
+void PeerConnection::updateEcnFeedback() {
+#if RTC_ENABLE_MEDIA
+	auto srtpTransport =
+	    std::dynamic_pointer_cast<DtlsSrtpTransport>(std::atomic_load(&mDtlsTransport));
+	if (!srtpTransport)
+		return;
+
+	auto local = localDescription();
+	auto remote = remoteDescription();
+	srtpTransport->setEcnFeedback(local && remote && HasCongestionControlFeedback(*local) &&
+	                              HasCongestionControlFeedback(*remote));
+#endif
+}
+
 void PeerConnection::validateRemoteDescription(const Description &description) {
 	if (!description.iceUfrag())
 		throw std::invalid_argument("Remote description has no ICE user fragment");
@@ -768,11 +1353,30 @@ void PeerConnection::processLocalDescription(Description description) {
 			    rtc::overloaded{
 			        [&](Description::Application *remoteApp) {
 				        std::shared_lock lock(mDataChannelsMutex);
+				        if (config.disableDataChannels ||
+				            (remoteApp->isRemoved() && mDataChannels.empty())) {
+					        // Reject the application, so the remote peer does not start SCTP
+					        auto rejected = remoteApp->reciprocate();
+					        rejected.markRemoved();
+
+					        PLOG_DEBUG << "Rejecting application in local description, mid=\""
+					                   << rejected.mid() << "\"";
+
+					        description.addMedia(std::move(rejected));
+					        return;
+				        }
+
+				        // Datagrams are offered if enabled, and accepted only if offered
+				        bool datagrams = config.enableDatagrams &&
+				                         (description.type() == Description::Type::Offer ||
+				                          remoteApp->datagrams());
+
 				        if (!mDataChannels.empty()) {
 					        // Prefer local description
 					        Description::Application app(remoteApp->mid());
 					        app.setSctpPort(localSctpPort);
 					        app.setMaxMessageSize(localMaxMessageSize);
+					        app.setDatagrams(datagrams);
 
 					        PLOG_DEBUG << "Adding application to local description, mid=\""
 					                   << app.mid() << "\"";
@@ -784,6 +1388,7 @@ void PeerConnection::processLocalDescription(Description description) {
 				        auto reciprocated = remoteApp->reciprocate();
 				        reciprocated.hintSctpPort(localSctpPort);
 				        reciprocated.setMaxMessageSize(localMaxMessageSize);
+				        reciprocated.setDatagrams(datagrams);
 
 				        PLOG_DEBUG << "Reciprocating application in local description, mid=\""
 				                   << reciprocated.mid() << "\"";
@@ -842,13 +1447,14 @@ void PeerConnection::processLocalDescription(Description description) {
 		// Add application for data channels
 		if (!description.hasApplication()) {
 			std::shared_lock lock(mDataChannelsMutex);
-			if (!mDataChannels.empty()) {
+			if (!mDataChannels.empty() || config.enableDatagrams) {
 				unsigned int m = 0;
 				while (description.hasMid(std::to_string(m)))
 					++m;
 				Description::Application app(std::to_string(m));
 				app.setSctpPort(localSctpPort);
 				app.setMaxMessageSize(localMaxMessageSize);
+				app.setDatagrams(config.enableDatagrams);
 
 				PLOG_DEBUG << "Adding application to local description, mid=\"" << app.mid()
 				           << "\"";
@@ -905,6 +1511,9 @@ void PeerConnection::processLocalDescription(Description description) {
 		mLocalDescription->addCandidates(std::move(existingCandidates));
 	}
 
+	updateTracksBySsrc(SsrcSource::Local);
+	updateEcnFeedback();
+
 	mProcessor->enqueue(localDescriptionCallback.wrap(), std::move(description));
 
 	// Reciprocated tracks might need to be open
@@ -924,6 +1533,12 @@ void PeerConnection::processLocalCandidate(Candidate candidate) {
 		return;
 	}
 
+	// Gathering may have been declared complete on timeout while the ICE agent is still gathering
+	if (gatheringState == GatheringState::Complete) {
+		PLOG_VERBOSE << "Not issuing local candidate gathered after completion: " << candidate;
+		return;
+	}
+
 	PLOG_VERBOSE << "Issuing local candidate: " << candidate;
 
 	candidate.resolve(Candidate::ResolveMode::Simple);
@@ -933,18 +1548,33 @@ void PeerConnection::processLocalCandidate(Candidate candidate) {
 }
 
 void PeerConnection::processRemoteDescription(Description description) {
+	bool iceRestart = false;
 	{
 		// Set as remote description
 		std::lock_guard lock(mRemoteDescriptionMutex);
 
+		// RFC 8445: ICE restart is signaled by new credentials, previous candidates are discarded
 		std::vector<Candidate> existingCandidates;
-		if (mRemoteDescription)
-			existingCandidates = mRemoteDescription->extractCandidates();
+		if (mRemoteDescription) {
+			iceRestart = mRemoteDescription->iceUfrag() != description.iceUfrag() ||
+			             mRemoteDescription->icePwd() != description.icePwd();
+			if (!iceRestart)
+				existingCandidates = mRemoteDescription->extractCandidates();
+		}
 
 		mRemoteDescription.emplace(description);
 		mRemoteDescription->addCandidates(std::move(existingCandidates));
 	}
 
+	updateTracksBySsrc(SsrcSource::Remote);
+	updateEcnFeedback();
+
+	// Follow a restart initiated by the remote peer, a local restart was already done otherwise
+	if (iceRestart && description.type() == Description::Type::Offer) {
+		PLOG_INFO << "Remote peer initiated an ICE restart";
+		restartIce();
+	}
+
 	auto iceTransport = initIceTransport();
 	if (!iceTransport)
 		return; // closed
@@ -955,7 +1585,7 @@ void PeerConnection::processRemoteDescription(Description description) {
 	// numbers from odd to even.
 	shiftDataChannels();
 
-	if (description.hasApplication()) {
+	if (description.hasApplication() && !config.disableDataChannels) {
 		auto dtlsTransport = std::atomic_load(&mDtlsTransport);
 		auto sctpTransport = std::atomic_load(&mSctpTransport);
 		if (!sctpTransport && dtlsTransport &&
@@ -986,18 +1616,30 @@ void PeerConnection::processRemoteCandidate(Candidate candidate) {
 
 	if (candidate.isResolved()) {
 		iceTransport->addRemoteCandidate(std::move(candidate));
-	} else {
-		// We might need a lookup, do it asynchronously
-		// We don't use the thread pool because we have no control on the timeout
-		if ((iceTransport = std::atomic_load(&mIceTransport))) {
-			weak_ptr<IceTransport> weakIceTransport{iceTransport};
-			std::thread t([weakIceTransport, candidate = std::move(candidate)]() mutable {
-				if (candidate.resolve(Candidate::ResolveMode::Lookup))
-					if (auto iceTransport = weakIceTransport.lock())
-						iceTransport->addRemoteCandidate(std::move(candidate));
-			});
-			t.detach();
-		}
+	} else if ((iceTransport = std::atomic_load(&mIceTransport))) {
+		// Hostname and mDNS candidates are resolved in the background with the shared cache, so
+		// checks go on with the other candidates meanwhile
+		weak_ptr<IceTransport> weakIceTransport{iceTransport};
+		auto hostname = candidate.node();
+		DnsCache::Instance().resolveAsync(
+		    hostname, [weakIceTransport, candidate = std::move(candidate)](
+		                  std::vector<string> addresses) {
+			    auto iceTransport = weakIceTransport.lock();
+			    if (!iceTransport)
+				    return;
+
+			    if (addresses.empty()) {
+				    PLOG_WARNING << "Unable to resolve remote candidate: " << candidate;
+				    return;
+			    }
+
+			    for (auto &address : addresses) {
+				    Candidate resolved = candidate;
+				    resolved.changeAddress(std::move(address));
+				    PLOG_VERBOSE << "Adding resolved remote candidate: " << resolved;
+				    iceTransport->addRemoteCandidate(std::move(resolved));
+			    }
+		    });
 	}
 }
 
@@ -1071,6 +1713,10 @@ bool PeerConnection::changeState(State newState) {
 	s << newState;
 	PLOG_INFO << "Changed state to " << s.str();
 
+	if (newState == State::Connected || newState == State::Failed)
+		if (MetricsRegistry::Instance().hasSink() && !mSetupReported.exchange(true))
+			MetricsRegistry::Instance().reportSetup(*this, newState == State::Connected);
+
 	if (newState == State::Closed)
 		// This is the last state change, so we may steal the callback
 		mProcessor->enqueue([cb = std::move(stateChangeCallback)]() { cb(State::Closed); });
@@ -1080,6 +1726,16 @@ bool PeerConnection::changeState(State newState) {
 	return true;
 }
 
+void PeerConnection::gatheringTimeout() {
+	if (gatheringState != GatheringState::InProgress)
+		return;
+
+	// Candidates gathered from now on are not reported anymore, see processLocalCandidate()
+	PLOG_DEBUG << "Gathering timeout, reporting gathering as complete";
+	endLocalCandidates();
+	changeGatheringState(GatheringState::Complete);
+}
+
 bool PeerConnection::changeGatheringState(GatheringState newState) {
 	if (gatheringState.exchange(newState) == newState)
 		return false;
@@ -1109,6 +1765,43 @@ void PeerConnection::resetCallbacks() {
 	localCandidateCallback = nullptr;
 	stateChangeCallback = nullptr;
 	gatheringStateChangeCallback = nullptr;
+	datagramCallback = nullptr;
+}
+
+SetupTimeline PeerConnection::setupTimeline() const {
+	SetupTimeline timeline;
+	{
+		std::lock_guard lock(mSetupTimelineMutex);
+		timeline = mSetupTimeline;
+	}
+
+	if (auto transport = getDtlsTransport()) {
+		auto handshake = transport->handshakeTimeline();
+		timeline.dtlsFlights = std::move(handshake.flights);
+		timeline.srtpKeysDerived = handshake.keysDerived;
+	}
+
+	return timeline;
+}
+
+MemoryStats PeerConnection::memoryStats() {
+	MemoryStats stats;
+	stats.receiveQueues = memoryAccount->receiveQueues.load();
+	stats.sendQueue = memoryAccount->sendQueue.load();
+	stats.reassembly = memoryAccount->reassembly.load();
+
+	iterateTracks([&stats](shared_ptr<Track> track) {
+		if (auto handler = track->getMediaHandler())
+			stats.nackStorage += handler->memoryUsage();
+	});
+
+	return stats;
+}
+
+void PeerConnection::recordDataChannelOpen() {
+	std::lock_guard lock(mSetupTimelineMutex);
+	if (!mSetupTimeline.dataChannelOpen)
+		mSetupTimeline.dataChannelOpen = SetupTimeline::clock::now();
 }
 
 } // namespace rtc::impl
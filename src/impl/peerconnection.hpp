@@ -23,11 +23,16 @@
 #include "datachannel.hpp"
 #include "dtlstransport.hpp"
 #include "icetransport.hpp"
+#include "memoryaccount.hpp"
+#include "queue.hpp"
 #include "sctptransport.hpp"
+#include "threadpool.hpp"
 #include "track.hpp"
 
 #include "rtc/peerconnection.hpp"
 
+#include <array>
+#include <chrono>
 #include <mutex>
 #include <shared_mutex>
 #include <unordered_map>
@@ -41,35 +46,61 @@ struct PeerConnection : std::enable_shared_from_this<PeerConnection> {
 	using SignalingState = rtc::PeerConnection::SignalingState;
 
 	PeerConnection(Configuration config_);
+	// The configuration must already be validated, see PeerConnectionFactory
+	PeerConnection(Configuration config_, future_certificate_ptr certificate);
 	~PeerConnection();
 
+	static void ValidateConfiguration(const Configuration &config);
+
 	void close();
 
+	// Call back on the thread pool once closed and all transports are stopped and released
+	void onReclaimed(std::function<void()> callback);
+
 	optional<Description> localDescription() const;
 	optional<Description> remoteDescription() const;
 	size_t remoteMaxMessageSize() const;
+	optional<binary> compressionDictionary(const string &name) const; // empty name for none
 
 	shared_ptr<IceTransport> initIceTransport();
+	void setPregatheredIceTransport(shared_ptr<IceTransport> transport); // before negotiation
 	shared_ptr<DtlsTransport> initDtlsTransport();
+	void deferDtlsTransport(std::chrono::steady_clock::time_point deadline); // under overload
 	shared_ptr<SctpTransport> initSctpTransport();
+	shared_ptr<DtlsTransport> createDtlsTransport(); // not started
+	shared_ptr<SctpTransport> createSctpTransport(shared_ptr<DtlsTransport> lower);
+	void prepareTransports(); // create DTLS and SCTP transports in advance during ICE checks
 	shared_ptr<IceTransport> getIceTransport() const;
 	shared_ptr<DtlsTransport> getDtlsTransport() const;
 	shared_ptr<SctpTransport> getSctpTransport() const;
+	size_t pathMtu() const; // discovered over SCTP if enabled, configured otherwise
+	bool datagramsNegotiated() const;
+	size_t maxDatagramSize() const;
+	bool sendDatagram(binary data); // false if not sent or dropped by rate limiting
 	void closeTransports();
 
 	void endLocalCandidates();
+	void restartIce(); // signalingMutex must be locked
 	void rollbackLocalDescription();
 	bool checkFingerprint(const std::string &fingerprint) const;
 	void forwardMessage(message_ptr message);
 	void forwardMedia(message_ptr message);
 	void forwardBufferedAmount(uint16_t stream, size_t amount);
-	optional<string> getMidFromSsrc(uint32_t ssrc);
+	void forwardDatagram(message_ptr message);
+	bool forwardCompoundRtcp(message_ptr message); // false if no SSRC is referenced
+	shared_ptr<Track> findTrack(uint32_t ssrc) const;
+
+	// Incremental updates of mTracksBySsrc, only SSRCs of changed media lines are touched
+	enum class SsrcSource { Local, Remote };
+	void updateTracksBySsrc(SsrcSource source); // after the description has changed
+	void updateTracksBySsrc(const string &mid); // after the track for the mid has changed
 
 	shared_ptr<DataChannel> emplaceDataChannel(string label, DataChannelInit init);
 	shared_ptr<DataChannel> findDataChannel(uint16_t stream);
 	void shiftDataChannels();
 	void iterateDataChannels(std::function<void(shared_ptr<DataChannel> channel)> func);
-	void cleanupDataChannels();
+	void cleanupDataChannels(); // requires mDataChannelsMutex to be locked exclusively
+	uint16_t allocateDataChannelStream(unsigned int parity, unsigned int streams); // same
 	void openDataChannels();
 	void closeDataChannels();
 	void remoteCloseDataChannels();
@@ -77,6 +108,8 @@ struct PeerConnection : std::enable_shared_from_this<PeerConnection> {
 	shared_ptr<Track> emplaceTrack(Description::Media description);
 	void incomingTrack(Description::Media description);
 	void openTracks();
+	void updateEcnFeedback(); // ECN marking requires RFC 8888 feedback on both sides
+	void iterateTracks(std::function<void(shared_ptr<Track> track)> func);
 
 	void validateRemoteDescription(const Description &description);
 	void processLocalDescription(Description description);
@@ -96,13 +129,24 @@ struct PeerConnection : std::enable_shared_from_this<PeerConnection> {
 
 	bool changeState(State newState);
 	bool changeGatheringState(GatheringState newState);
+	void gatheringTimeout();
 	bool changeSignalingState(SignalingState newState);
 
 	void resetCallbacks();
 
 	void outgoingMedia(message_ptr message);
 
+	SetupTimeline setupTimeline() const;
+	void recordDataChannelOpen();
+	MemoryStats memoryStats();
+
 	const Configuration config;
+#if RTC_ENABLE_LATENCY_TRACING
+	const shared_ptr<LatencyTracer> latencyTracer; // shared with transports
+#endif
+	const uint64_t metricsId;
+	const shared_ptr<MemoryAccount> memoryAccount; // shared with channels and transports
+	const shared_ptr<CaptureWriter> capture;       // shared with transports, null if disabled
 	std::atomic<State> state = State::New;
 	std::atomic<GatheringState> gatheringState = GatheringState::New;
 	std::atomic<SignalingState> signalingState = SignalingState::Stable;
@@ -116,31 +160,79 @@ struct PeerConnection : std::enable_shared_from_this<PeerConnection> {
 	synchronized_callback<GatheringState> gatheringStateChangeCallback;
 	synchronized_callback<SignalingState> signalingStateChangeCallback;
 	synchronized_callback<shared_ptr<rtc::Track>> trackCallback;
+	synchronized_callback<binary> datagramCallback;
 
 private:
 	const init_token mInitToken = Init::Instance().token();
 	const future_certificate_ptr mCertificate;
 	const unique_ptr<Processor> mProcessor;
 
+	// Shared with the transport teardown, which may outlive the connection
+	struct Reclamation {
+		std::mutex mutex;
+		bool done = false;
+		std::vector<std::function<void()>> callbacks;
+	};
+	const shared_ptr<Reclamation> mReclamation = std::make_shared<Reclamation>();
+
 	optional<Description> mLocalDescription, mRemoteDescription;
 	optional<Description> mCurrentLocalDescription;
 	mutable std::mutex mLocalDescriptionMutex, mRemoteDescriptionMutex;
 
+	TimerHandle mGatheringTimer;
+	TimerHandle mDeferralTimer;
+
+#if RTC_ENABLE_MEDIA
+	shared_ptr<Pacer> mPacer; // shared by tracks, null if pacing is disabled
+#endif
+
 	shared_ptr<IceTransport> mIceTransport;
+	shared_ptr<IceTransport> mPregatheredIceTransport; // from a candidate pool, not bound yet
 	shared_ptr<DtlsTransport> mDtlsTransport;
 	shared_ptr<SctpTransport> mSctpTransport;
-
-	std::unordered_map<uint16_t, weak_ptr<DataChannel>> mDataChannels; // by stream ID
-	std::unordered_map<string, weak_ptr<Track>> mTracks;               // by mid
-	std::vector<weak_ptr<Track>> mTrackLines;                          // by SDP order
+	shared_ptr<DtlsTransport> mPreparedDtlsTransport; // created but not started yet
+	shared_ptr<SctpTransport> mPreparedSctpTransport;
+	std::mutex mPreparedTransportsMutex;
+
+	double mDatagramTokens = 0; // rate limiting of datagrams
+	std::chrono::steady_clock::time_point mDatagramLastRefill;
+	std::mutex mDatagramMutex;
+
+	std::vector<weak_ptr<DataChannel>> mDataChannels;    // indexed by stream ID
+	std::array<std::vector<uint16_t>, 2> mFreeStreams;   // released IDs by parity, lowest last
+	size_t mAllocatedSinceCleanup = 0, mLiveAtCleanup = 0;
+	std::unordered_map<string, weak_ptr<Track>> mTracks; // by mid
+	std::vector<weak_ptr<Track>> mTrackLines;            // by SDP order
 	std::shared_mutex mDataChannelsMutex, mTracksMutex;
 
 	Queue<shared_ptr<DataChannel>> mPendingDataChannels;
 	Queue<shared_ptr<Track>> mPendingTracks;
 
-	std::unordered_map<uint32_t, string> mMidFromSsrc; // cache
+	// Immutable table for media demultiplexing, replaced when descriptions or tracks change
+	using TracksBySsrc = std::unordered_map<uint32_t, weak_ptr<Track>>;
+	shared_ptr<const TracksBySsrc> mTracksBySsrc;
+
+	// SSRCs of the last processed descriptions, diffed against new ones
+	struct SsrcTable {
+		std::unordered_map<string, std::vector<uint32_t>> ssrcs; // by mid
+		std::unordered_map<uint32_t, string> mids;               // by SSRC
+	};
+	SsrcTable mLocalSsrcs, mRemoteSsrcs;
+	std::mutex mSsrcTablesMutex;
+	void diffSsrcTable(SsrcTable &table, std::unordered_map<string, std::vector<uint32_t>> ssrcs,
+	                   std::vector<uint32_t> &changed);
+	void applyTracksBySsrc(const std::vector<uint32_t> &ssrcs); // mSsrcTablesMutex locked
+
+	SetupTimeline mSetupTimeline; // DTLS flights are taken from the transport
+	mutable std::mutex mSetupTimelineMutex;
+	std::atomic<bool> mSetupReported = false; // setup spans are reported once
 };
 
+inline shared_ptr<MemoryAccount> memory_account(const weak_ptr<PeerConnection> &pc) {
+	auto locked = pc.lock();
+	return locked ? locked->memoryAccount : nullptr;
+}
+
 } // namespace rtc::impl
 
 #endif
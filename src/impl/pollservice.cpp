@@ -0,0 +1,599 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "pollservice.hpp"
+#include "internals.hpp"
+#include "threadregistry.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <algorithm>
+#include <cassert>
+
+namespace rtc::impl {
+
+using std::chrono::milliseconds;
+
+PollService &PollService::Instance() {
+	static PollService *instance = new PollService;
+	return *instance;
+}
+
+uint32_t PollService::nextGeneration() {
+	if (++mNextGeneration == 0)
+		++mNextGeneration;
+
+	return mNextGeneration;
+}
+
+void PollService::Invoke(calls_list &calls) {
+	for (auto &[callback, event] : calls) {
+		try {
+			callback(event);
+		} catch (const std::exception &e) {
+			PLOG_WARNING << "Poll service callback: " << e.what();
+		}
+	}
+}
+
+#if RTC_POLL_SERVICE_EPOLL
+
+namespace {
+
+uint64_t toEpollData(socket_t sock, uint32_t generation) {
+	return uint64_t(generation) << 32 | uint32_t(sock);
+}
+
+uint32_t toEpollEvents(PollService::Direction direction) {
+	switch (direction) {
+	case PollService::Direction::In:
+		return EPOLLIN | EPOLLRDHUP;
+	case PollService::Direction::Out:
+		return EPOLLOUT;
+	default:
+		return EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+	}
+}
+
+#if RTC_POLL_SERVICE_IO_URING
+const unsigned int UringEntries = 4096;
+const uint64_t InterrupterKey = ~uint64_t(0);
+const uint64_t IgnoredKey = 0; // for removal requests
+#endif
+
+} // namespace
+
+PollService::PollService() {
+	mEpollFd = ::epoll_create1(EPOLL_CLOEXEC);
+	if (mEpollFd < 0)
+		throw std::runtime_error("Failed to create epoll instance");
+
+	// The interrupter is only needed to stop the loop or to wake it up for an earlier deadline,
+	// as sockets are registered directly with epoll
+	struct pollfd pfd;
+	mInterrupter.prepare(pfd);
+	mInterrupterFd = pfd.fd;
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u64 = toEpollData(mInterrupterFd, 0);
+	if (::epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mInterrupterFd, &ev) < 0)
+		throw std::runtime_error("Failed to register interrupter with epoll");
+
+#if RTC_POLL_SERVICE_IO_URING
+	try {
+		mUring = std::make_unique<IoUring>(UringEntries);
+		mUring->pollAdd(mInterrupterFd, POLLIN, InterrupterKey);
+		mUring->submit();
+		PLOG_DEBUG << "Poll service using io_uring";
+	} catch (const std::exception &e) {
+		PLOG_INFO << "Poll service falling back to epoll: " << e.what();
+		mUring.reset();
+	}
+#endif
+}
+
+PollService::~PollService() { ::close(mEpollFd); }
+
+#else
+
+PollService::PollService() {}
+
+PollService::~PollService() {}
+
+#endif
+
+void PollService::start() {
+	std::lock_guard lock(mMutex);
+	if (!std::exchange(mStopped, false))
+		return;
+
+	PLOG_DEBUG << "Starting poll service thread";
+	mThread = std::thread([this]() {
+		ThreadRegistry::Registration registration(ThreadRegistry::Role::Poll);
+		runLoop();
+	});
+}
+
+void PollService::join() {
+	{
+		std::lock_guard lock(mMutex);
+		if (std::exchange(mStopped, true))
+			return;
+
+		mInterrupter.interrupt();
+	}
+
+	PLOG_DEBUG << "Waiting for poll service thread";
+	mThread.join();
+
+	std::lock_guard lock(mMutex);
+#if RTC_POLL_SERVICE_IO_URING
+	if (mUring) {
+		for (auto &[sock, entry] : mSocks)
+			disarm(entry);
+
+		submit();
+	}
+#endif
+#if RTC_POLL_SERVICE_EPOLL
+	for (const auto &[sock, entry] : mSocks)
+		::epoll_ctl(mEpollFd, EPOLL_CTL_DEL, sock, nullptr);
+
+	mDeadlines.clear();
+	mWaitUntil.reset();
+#endif
+	mSocks.clear();
+}
+
+void PollService::add(socket_t sock, Params params) {
+	assert(params.callback);
+
+	std::lock_guard lock(mMutex);
+	PLOG_VERBOSE << "Registering socket in poll service, direction=" << int(params.direction);
+	auto until = params.timeout ? std::make_optional(clock::now() + *params.timeout) : nullopt;
+
+#if RTC_POLL_SERVICE_EPOLL
+	auto [it, inserted] = mSocks.try_emplace(sock);
+	it->second.params = std::move(params);
+	it->second.generation = nextGeneration();
+	setDeadline(sock, it->second, until);
+
+#if RTC_POLL_SERVICE_IO_URING
+	if (mUring) {
+		try {
+			disarm(it->second);
+			arm(sock, it->second);
+			submit();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << "Failed to register socket with io_uring: " << e.what();
+			setDeadline(sock, it->second, nullopt);
+			mSocks.erase(it);
+			throw std::runtime_error("Failed to register socket in poll service");
+		}
+
+		if (until && (!mWaitUntil || *until < *mWaitUntil))
+			mInterrupter.interrupt();
+
+		return;
+	}
+#endif
+
+	struct epoll_event ev = {};
+	ev.events = toEpollEvents(it->second.params.direction);
+	ev.data.u64 = toEpollData(sock, it->second.generation);
+
+	// A socket closed without being removed is implicitly dropped by epoll, and its descriptor
+	// might have been reused since, so fall back on the other operation
+	if (::epoll_ctl(mEpollFd, inserted ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, sock, &ev) < 0 &&
+	    ::epoll_ctl(mEpollFd, inserted ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, sock, &ev) < 0) {
+		PLOG_WARNING << "Failed to register socket with epoll, errno=" << errno;
+		setDeadline(sock, it->second, nullopt);
+		mSocks.erase(it);
+		throw std::runtime_error("Failed to register socket in poll service");
+	}
+
+	if (until && (!mWaitUntil || *until < *mWaitUntil))
+		mInterrupter.interrupt();
+#else
+	mSocks[sock] = SocketEntry{std::move(params), std::move(until), nextGeneration()};
+	mInterrupter.interrupt();
+#endif
+}
+
+void PollService::remove(socket_t sock) {
+	std::lock_guard lock(mMutex);
+	PLOG_VERBOSE << "Unregistering socket in poll service";
+#if RTC_POLL_SERVICE_EPOLL
+	if (auto it = mSocks.find(sock); it != mSocks.end()) {
+		setDeadline(sock, it->second, nullopt);
+#if RTC_POLL_SERVICE_IO_URING
+		if (mUring) {
+			// The armed request holds a reference to the socket, so it must be removed for the
+			// socket to be closed
+			disarm(it->second);
+			mSocks.erase(it);
+			submit();
+			return;
+		}
+#endif
+		mSocks.erase(it);
+		::epoll_ctl(mEpollFd, EPOLL_CTL_DEL, sock, nullptr); // might fail if already closed
+	}
+#else
+	mSocks.erase(sock);
+	mInterrupter.interrupt();
+#endif
+}
+
+#if RTC_POLL_SERVICE_EPOLL
+
+void PollService::setDeadline(socket_t sock, SocketEntry &entry,
+                              optional<clock::time_point> until) {
+	// mMutex must be locked
+	if (entry.until)
+		mDeadlines.erase(std::make_pair(*entry.until, sock));
+
+	entry.until = std::move(until);
+	if (entry.until)
+		mDeadlines.emplace(*entry.until, sock);
+}
+
+void PollService::expire(clock::time_point now, calls_list &calls) {
+	// mMutex must be locked
+	// Expired idle timeouts, deadlines are reset by any event so these sockets were idle
+	std::vector<socket_t> expired;
+	for (auto it = mDeadlines.begin(); it != mDeadlines.end() && it->first <= now; ++it)
+		expired.push_back(it->second);
+
+	for (socket_t sock : expired) {
+		auto &entry = mSocks.at(sock);
+		calls.emplace_back(entry.params.callback, Event::Timeout);
+		setDeadline(sock, entry, now + *entry.params.timeout);
+	}
+}
+
+void PollService::process(const struct epoll_event *events, int count) {
+	calls_list calls;
+	{
+		std::lock_guard lock(mMutex);
+		const auto now = clock::now();
+		for (int i = 0; i < count; ++i) {
+			const uint64_t data = events[i].data.u64;
+			const auto sock = socket_t(data & 0xFFFFFFFF);
+			if (sock == mInterrupterFd) {
+				struct pollfd pfd;
+				mInterrupter.prepare(pfd); // drain
+				continue;
+			}
+
+			// The descriptor might have been closed and reused since the wait returned
+			auto it = mSocks.find(sock);
+			if (it == mSocks.end() || it->second.generation != uint32_t(data >> 32))
+				continue; // removed or replaced in the meantime
+
+			auto &entry = it->second;
+			const auto &params = entry.params;
+			const uint32_t revents = events[i].events;
+			if (revents & EPOLLERR) {
+				calls.emplace_back(params.callback, Event::Error);
+				setDeadline(sock, entry, nullopt);
+				mSocks.erase(it);
+				::epoll_ctl(mEpollFd, EPOLL_CTL_DEL, sock, nullptr);
+				continue;
+			}
+
+			// A hangup is reported as readability so the reader gets the end of stream
+			if (revents & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
+				calls.emplace_back(params.callback, Event::In);
+
+			if (revents & EPOLLOUT)
+				calls.emplace_back(params.callback, Event::Out);
+
+			if (params.timeout)
+				setDeadline(sock, entry, now + *params.timeout);
+		}
+
+		expire(now, calls);
+	}
+
+	Invoke(calls);
+}
+
+void PollService::runLoop() {
+#if RTC_POLL_SERVICE_IO_URING
+	if (mUring) {
+		runUringLoop();
+		return;
+	}
+#endif
+	try {
+		PLOG_DEBUG << "Poll service started";
+
+		const int maxEvents = 256;
+		std::vector<struct epoll_event> events(maxEvents);
+		while (true) {
+			optional<clock::time_point> next;
+			{
+				std::lock_guard lock(mMutex);
+				if (mStopped)
+					break;
+
+				if (!mDeadlines.empty())
+					next = mDeadlines.begin()->first;
+
+				mWaitUntil = next;
+			}
+
+			int ret;
+			do {
+				int timeout = -1;
+				if (next) {
+					auto duration = std::chrono::ceil<milliseconds>(*next - clock::now());
+					timeout = int(std::max(duration.count(), milliseconds::rep(0)));
+				}
+				ret = ::epoll_wait(mEpollFd, events.data(), maxEvents, timeout);
+
+			} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+			if (ret < 0)
+				throw std::runtime_error("Failed to wait for socket events");
+
+			process(events.data(), ret);
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_FATAL << "Poll service failed: " << e.what();
+	}
+
+	PLOG_DEBUG << "Poll service stopped";
+}
+
+#if RTC_POLL_SERVICE_IO_URING
+
+void PollService::arm(socket_t sock, SocketEntry &entry) {
+	// mMutex must be locked
+	// The generation tells completions of previous requests for the same descriptor apart
+	entry.key = uint64_t(nextGeneration()) << 32 | uint32_t(sock);
+	mUring->pollAdd(sock, toEpollEvents(entry.params.direction), entry.key);
+}
+
+void PollService::disarm(SocketEntry &entry) {
+	// mMutex must be locked
+	if (entry.key != 0)
+		mUring->pollRemove(std::exchange(entry.key, 0), IgnoredKey);
+}
+
+void PollService::submit() {
+	// mMutex must be locked
+	// Requests from callbacks are submitted all at once before the loop waits again
+	if (std::this_thread::get_id() != mThread.get_id())
+		mUring->submit();
+}
+
+void PollService::processCompletions() {
+	calls_list calls;
+	{
+		std::lock_guard lock(mMutex);
+		const auto now = clock::now();
+		mUring->reap([&](uint64_t key, int32_t res) {
+			if (key == IgnoredKey)
+				return;
+
+			if (key == InterrupterKey) {
+				struct pollfd pfd;
+				mInterrupter.prepare(pfd); // drain
+				mUring->pollAdd(mInterrupterFd, POLLIN, InterrupterKey);
+				return;
+			}
+
+			const auto sock = socket_t(key & 0xFFFFFFFF);
+			auto it = mSocks.find(sock);
+			if (it == mSocks.end() || it->second.key != key)
+				return; // removed or replaced in the meantime
+
+			auto &entry = it->second;
+			entry.key = 0; // requests are one-shot
+			const auto &params = entry.params;
+			const uint32_t revents = res >= 0 ? uint32_t(res) : EPOLLERR;
+			if (revents & (EPOLLERR | POLLNVAL)) {
+				calls.emplace_back(params.callback, Event::Error);
+				setDeadline(sock, entry, nullopt);
+				mSocks.erase(it);
+				return;
+			}
+
+			// A hangup is reported as readability so the reader gets the end of stream
+			if (revents & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
+				calls.emplace_back(params.callback, Event::In);
+
+			if (revents & EPOLLOUT)
+				calls.emplace_back(params.callback, Event::Out);
+
+			if (params.timeout)
+				setDeadline(sock, entry, now + *params.timeout);
+
+			arm(sock, entry);
+		});
+
+		expire(now, calls);
+	}
+
+	Invoke(calls);
+}
+
+void PollService::runUringLoop() {
+	try {
+		PLOG_DEBUG << "Poll service started with io_uring";
+
+		while (true) {
+			optional<clock::time_point> next;
+			{
+				std::lock_guard lock(mMutex);
+				if (mStopped)
+					break;
+
+				if (!mDeadlines.empty())
+					next = mDeadlines.begin()->first;
+
+				mWaitUntil = next;
+
+				// Submit the requests queued since the last wait in a single call
+				mUring->submit();
+			}
+
+			optional<std::chrono::nanoseconds> timeout;
+			if (next)
+				timeout = *next - clock::now();
+
+			mUring->wait(timeout);
+			processCompletions();
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_FATAL << "Poll service failed: " << e.what();
+	}
+
+	PLOG_DEBUG << "Poll service stopped";
+}
+
+#endif
+
+#else
+
+void PollService::prepare(std::vector<struct pollfd> &pfds, std::vector<uint32_t> &generations,
+                          optional<clock::time_point> &next) {
+	// mMutex must be locked
+	pfds.resize(1 + mSocks.size());
+	generations.resize(pfds.size());
+	next.reset();
+
+	auto it = pfds.begin();
+	mInterrupter.prepare(*it);
+	it->revents = 0;
+	++it;
+
+	auto gt = generations.begin() + 1;
+	for (const auto &[sock, entry] : mSocks) {
+		*gt++ = entry.generation;
+		it->fd = sock;
+		switch (entry.params.direction) {
+		case Direction::In:
+			it->events = POLLIN;
+			break;
+		case Direction::Out:
+			it->events = POLLOUT;
+			break;
+		default:
+			it->events = POLLIN | POLLOUT;
+			break;
+		}
+		it->revents = 0;
+
+		if (entry.until)
+			next = next ? std::min(*next, *entry.until) : *entry.until;
+
+		++it;
+	}
+}
+
+void PollService::process(std::vector<struct pollfd> &pfds,
+                          const std::vector<uint32_t> &generations) {
+	calls_list calls;
+	{
+		std::lock_guard lock(mMutex);
+		const auto now = clock::now();
+		for (auto it = pfds.begin() + 1; it != pfds.end(); ++it) {
+			// The descriptor might have been closed and reused since the poll returned
+			auto jt = mSocks.find(it->fd);
+			if (jt == mSocks.end() || jt->second.generation != generations[it - pfds.begin()])
+				continue; // removed or replaced in the meantime
+
+			auto &entry = jt->second;
+			const auto &params = entry.params;
+			const auto revents = it->revents;
+			const size_t count = calls.size();
+			if (revents & POLLNVAL || revents & POLLERR) {
+				calls.emplace_back(params.callback, Event::Error);
+			} else {
+				// A hangup is reported as readability so the reader gets the end of stream
+				if (revents & POLLIN || revents & POLLHUP)
+					calls.emplace_back(params.callback, Event::In);
+
+				if (revents & POLLOUT)
+					calls.emplace_back(params.callback, Event::Out);
+
+				if (calls.size() == count && entry.until && now >= *entry.until)
+					calls.emplace_back(params.callback, Event::Timeout);
+			}
+
+			if (calls.size() > count && params.timeout)
+				entry.until = now + *params.timeout;
+
+			if (revents & POLLNVAL || revents & POLLERR)
+				mSocks.erase(jt);
+		}
+	}
+
+	Invoke(calls);
+}
+
+void PollService::runLoop() {
+	try {
+		PLOG_DEBUG << "Poll service started";
+
+		std::vector<struct pollfd> pfds;
+		std::vector<uint32_t> generations;
+		optional<clock::time_point> next;
+		while (true) {
+			{
+				std::lock_guard lock(mMutex);
+				if (mStopped)
+					break;
+
+				prepare(pfds, generations, next);
+			}
+
+			int ret;
+			do {
+				int timeout = -1;
+				if (next) {
+					auto duration = std::chrono::ceil<milliseconds>(*next - clock::now());
+					timeout = int(std::max(duration.count(), milliseconds::rep(0)));
+				}
+				ret = ::poll(pfds.data(), nfds_t(pfds.size()), timeout);
+
+			} while (ret < 0 && (sockerrno == SEINTR || sockerrno == SEAGAIN));
+
+			if (ret < 0)
+				throw std::runtime_error("Failed to wait for socket events");
+
+			process(pfds, generations);
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_FATAL << "Poll service failed: " << e.what();
+	}
+
+	PLOG_DEBUG << "Poll service stopped";
+}
+
+#endif
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_POLL_SERVICE_H
+#define RTC_IMPL_POLL_SERVICE_H
+
+#include "common.hpp"
+#include "pollinterrupter.hpp"
+#include "socket.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#define RTC_POLL_SERVICE_EPOLL 1 // poll() does not scale to many thousands of idle sockets
+#include <sys/epoll.h>
+#else
+#define RTC_POLL_SERVICE_EPOLL 0
+#endif
+
+#if RTC_POLL_SERVICE_EPOLL && USE_IO_URING
+#define RTC_POLL_SERVICE_IO_URING 1 // batches poll requests, falls back to epoll if unavailable
+#include "iouring.hpp"
+#else
+#define RTC_POLL_SERVICE_IO_URING 0
+#endif
+
+namespace rtc::impl {
+
+// Shared poll loop for TCP sockets, so transports don't need a thread each.
+// Callbacks are called on the poll thread without the service lock held, so they may add or
+// remove sockets, but they must not block.
+class PollService final {
+public:
+	using clock = std::chrono::steady_clock;
+
+	static PollService &Instance();
+
+	PollService(const PollService &) = delete;
+	PollService &operator=(const PollService &) = delete;
+
+	void start();
+	void join();
+
+	enum class Direction { Both, In, Out };
+	enum class Event { None, Error, Timeout, In, Out };
+
+	struct Params {
+		Direction direction;
+		optional<clock::duration> timeout; // idle timeout, reset on each event
+		std::function<void(Event)> callback;
+	};
+
+	void add(socket_t sock, Params params); // replaces previous params for the socket
+	void remove(socket_t sock);
+
+private:
+	PollService();
+	~PollService();
+
+	struct SocketEntry {
+		Params params;
+		optional<clock::time_point> until;
+		uint32_t generation = 0; // tells events of a previous registration of the descriptor apart
+#if RTC_POLL_SERVICE_IO_URING
+		uint64_t key = 0; // user data of the armed poll request, 0 if none
+#endif
+	};
+
+	using calls_list = std::vector<std::pair<std::function<void(Event)>, Event>>;
+
+#if RTC_POLL_SERVICE_EPOLL
+	void setDeadline(socket_t sock, SocketEntry &entry, optional<clock::time_point> until);
+	void expire(clock::time_point now, calls_list &calls);
+	void process(const struct epoll_event *events, int count);
+
+	int mEpollFd = -1;
+	int mInterrupterFd = -1;
+	std::set<std::pair<clock::time_point, socket_t>> mDeadlines; // ordered idle timeouts
+	optional<clock::time_point> mWaitUntil; // deadline the loop is currently waiting for
+
+#if RTC_POLL_SERVICE_IO_URING
+	void arm(socket_t sock, SocketEntry &entry);
+	void disarm(SocketEntry &entry);
+	void submit(); // deferred to the loop when called from the poll thread
+	void processCompletions();
+	void runUringLoop();
+
+	unique_ptr<IoUring> mUring; // null if io_uring is not available
+#endif
+#else
+	void prepare(std::vector<struct pollfd> &pfds, std::vector<uint32_t> &generations,
+	             optional<clock::time_point> &next);
+	void process(std::vector<struct pollfd> &pfds, const std::vector<uint32_t> &generations);
+#endif
+	void runLoop();
+	uint32_t nextGeneration(); // mMutex must be locked, never 0
+	static void Invoke(calls_list &calls);
+
+	std::unordered_map<socket_t, SocketEntry> mSocks;
+	PollInterrupter mInterrupter;
+	std::mutex mMutex;
+	std::thread mThread;
+	bool mStopped = true;
+	uint32_t mNextGeneration = 0;
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
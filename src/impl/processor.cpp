@@ -20,19 +20,81 @@
 
 namespace rtc::impl {
 
-Processor::Processor(size_t limit) : mTasks(limit) {}
+namespace {
+
+std::atomic<size_t> TotalQueuedTasks = 0;
+
+} // namespace
+
+size_t Processor::QueuedTasks() { return TotalQueuedTasks; }
+
+Processor::Processor(size_t limit, optional<size_t> affinity)
+    : mLimit(limit), mAffinity(std::move(affinity)) {}
 
 Processor::~Processor() { join(); }
 
+template <class Predicate>
+void Processor::wait(std::unique_lock<std::mutex> &lock, Predicate pred) {
+	auto &pool = ThreadPool::Instance();
+	if (!pool.external()) {
+		mCondition.wait(lock, std::move(pred));
+		return;
+	}
+
+	// With an external executor, no worker would run the pending tasks while the application
+	// thread is blocked here, so run them meanwhile
+	while (!pred()) {
+		lock.unlock();
+		pool.poll(std::chrono::milliseconds(10));
+		lock.lock();
+	}
+}
+
 void Processor::join() {
 	std::unique_lock lock(mMutex);
-	mCondition.wait(lock, [this]() { return !mPending && mTasks.empty(); });
+	wait(lock, [this]() { return !mPending && mTasks.empty(); });
+}
+
+void Processor::push(std::unique_lock<std::mutex> &lock, Task task) {
+	if (mLimit > 0)
+		wait(lock, [this]() { return mTasks.size() < mLimit; });
+
+	mTasks.emplace(std::move(task));
+	++TotalQueuedTasks;
+
+	// A single pool task is pending at any time, so queued tasks run in order
+	if (!std::exchange(mPending, true))
+		post();
+}
+
+void Processor::post() {
+	// No future is needed, the init token is held by the Processor
+	Task runner = [this]() { run(); };
+	if (mAffinity)
+		ThreadPool::Instance().post(std::move(runner), *mAffinity);
+	else
+		ThreadPool::Instance().post(std::move(runner));
+}
+
+void Processor::run() {
+	Task task;
+	{
+		std::unique_lock lock(mMutex);
+		task = std::move(mTasks.front());
+		mTasks.pop();
+		--TotalQueuedTasks;
+		if (mLimit > 0)
+			mCondition.notify_all();
+	}
+
+	scope_guard guard([this]() { schedule(); }); // chain the next task
+	task();
 }
 
 void Processor::schedule() {
 	std::unique_lock lock(mMutex);
-	if (auto next = mTasks.tryPop()) {
-		ThreadPool::Instance().enqueue(std::move(*next));
+	if (!mTasks.empty()) {
+		post();
 	} else {
 		// No more tasks
 		mPending = false;
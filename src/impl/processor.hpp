@@ -21,11 +21,11 @@
 
 #include "common.hpp"
 #include "init.hpp"
-#include "queue.hpp"
+#include "task.hpp"
 #include "threadpool.hpp"
 
 #include <condition_variable>
-#include <future>
+#include <iterator>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -33,9 +33,12 @@
 namespace rtc::impl {
 
 // Processed tasks in order by delegating them to the thread pool
+// With an affinity hint, tasks are preferably run by the same worker for cache locality.
 class Processor final {
 public:
-	Processor(size_t limit = 0);
+	static size_t QueuedTasks(); // tasks waiting in all processors, for stats
+
+	Processor(size_t limit = 0, optional<size_t> affinity = nullopt);
 	~Processor();
 
 	Processor(const Processor &) = delete;
@@ -47,13 +50,23 @@ public:
 
 	template <class F, class... Args> void enqueue(F &&f, Args &&...args);
 
+	// Enqueue a range of callables, moved from the range, with a single lock and wakeup
+	template <class Iterator> void enqueueBatch(Iterator first, Iterator last);
+
 protected:
+	void push(std::unique_lock<std::mutex> &lock, Task task);
+	template <class Predicate> void wait(std::unique_lock<std::mutex> &lock, Predicate pred);
+	void post();
+	void run();
 	void schedule();
 
 	// Keep an init token
 	const init_token mInitToken = Init::Instance().token();
 
-	Queue<std::function<void()>> mTasks;
+	const size_t mLimit;
+	const optional<size_t> mAffinity;
+
+	std::queue<Task> mTasks;
 	bool mPending = false; // true iff a task is pending in the thread pool
 
 	mutable std::mutex mMutex;
@@ -61,19 +74,15 @@ protected:
 };
 
 template <class F, class... Args> void Processor::enqueue(F &&f, Args &&...args) {
-	std::unique_lock lock(mMutex);
 	auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-	auto task = [this, bound = std::move(bound)]() mutable {
-		scope_guard guard(std::bind(&Processor::schedule, this)); // chain the next task
-		return bound();
-	};
-
-	if (!mPending) {
-		ThreadPool::Instance().enqueue(std::move(task));
-		mPending = true;
-	} else {
-		mTasks.push(std::move(task));
-	}
+	std::unique_lock lock(mMutex);
+	push(lock, std::move(bound));
+}
+
+template <class Iterator> void Processor::enqueueBatch(Iterator first, Iterator last) {
+	std::unique_lock lock(mMutex);
+	for (; first != last; ++first)
+		push(lock, std::move(*first));
 }
 
 } // namespace rtc::impl
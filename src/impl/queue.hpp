@@ -52,10 +52,11 @@ public:
 private:
 	void pushImpl(T element);
 	optional<T> popImpl();
+	size_t sizeImpl() const { return mQueue ? mQueue->size() : 0; }
 
 	const size_t mLimit;
 	size_t mAmount;
-	std::queue<T> mQueue;
+	unique_ptr<std::queue<T>> mQueue; // allocated on first push, most queues stay empty
 	std::condition_variable mPopCondition, mPushCondition;
 	amount_function mAmountFunction;
 	bool mStopping = false;
@@ -82,22 +83,22 @@ template <typename T> void Queue<T>::stop() {
 
 template <typename T> bool Queue<T>::running() const {
 	std::lock_guard lock(mMutex);
-	return !mQueue.empty() || !mStopping;
+	return sizeImpl() > 0 || !mStopping;
 }
 
 template <typename T> bool Queue<T>::empty() const {
 	std::lock_guard lock(mMutex);
-	return mQueue.empty();
+	return sizeImpl() == 0;
 }
 
 template <typename T> bool Queue<T>::full() const {
 	std::lock_guard lock(mMutex);
-	return mQueue.size() >= mLimit;
+	return sizeImpl() >= mLimit;
 }
 
 template <typename T> size_t Queue<T>::size() const {
 	std::lock_guard lock(mMutex);
-	return mQueue.size();
+	return sizeImpl();
 }
 
 template <typename T> size_t Queue<T>::amount() const {
@@ -107,13 +108,13 @@ template <typename T> size_t Queue<T>::amount() const {
 
 template <typename T> void Queue<T>::push(T element) {
 	std::unique_lock lock(mMutex);
-	mPushCondition.wait(lock, [this]() { return !mLimit || mQueue.size() < mLimit || mStopping; });
+	mPushCondition.wait(lock, [this]() { return !mLimit || sizeImpl() < mLimit || mStopping; });
 	pushImpl(std::move(element));
 }
 
 template <typename T> optional<T> Queue<T>::pop() {
 	std::unique_lock lock(mMutex);
-	mPopCondition.wait(lock, [this]() { return !mQueue.empty() || mStopping; });
+	mPopCondition.wait(lock, [this]() { return sizeImpl() > 0 || mStopping; });
 	return popImpl();
 }
 
@@ -124,15 +125,15 @@ template <typename T> optional<T> Queue<T>::tryPop() {
 
 template <typename T> optional<T> Queue<T>::peek() {
 	std::unique_lock lock(mMutex);
-	return !mQueue.empty() ? std::make_optional(mQueue.front()) : nullopt;
+	return sizeImpl() > 0 ? std::make_optional(mQueue->front()) : nullopt;
 }
 
 template <typename T> optional<T> Queue<T>::exchange(T element) {
 	std::unique_lock lock(mMutex);
-	if (mQueue.empty())
+	if (sizeImpl() == 0)
 		return nullopt;
 
-	std::swap(mQueue.front(), element);
+	std::swap(mQueue->front(), element);
 	return std::make_optional(std::move(element));
 }
 
@@ -140,9 +141,9 @@ template <typename T> bool Queue<T>::wait(const optional<std::chrono::millisecon
 	std::unique_lock lock(mMutex);
 	if (duration) {
 		return mPopCondition.wait_for(lock, *duration,
-		                              [this]() { return !mQueue.empty() || mStopping; });
+		                              [this]() { return sizeImpl() > 0 || mStopping; });
 	} else {
-		mPopCondition.wait(lock, [this]() { return !mQueue.empty() || mStopping; });
+		mPopCondition.wait(lock, [this]() { return sizeImpl() > 0 || mStopping; });
 		return true;
 	}
 }
@@ -151,18 +152,21 @@ template <typename T> void Queue<T>::pushImpl(T element) {
 	if (mStopping)
 		return;
 
+	if (!mQueue)
+		mQueue = std::make_unique<std::queue<T>>();
+
 	mAmount += mAmountFunction(element);
-	mQueue.emplace(std::move(element));
+	mQueue->emplace(std::move(element));
 	mPopCondition.notify_one();
 }
 
 template <typename T> optional<T> Queue<T>::popImpl() {
-	if (mQueue.empty())
+	if (sizeImpl() == 0)
 		return nullopt;
 
-	mAmount -= mAmountFunction(mQueue.front());
-	optional<T> element{std::move(mQueue.front())};
-	mQueue.pop();
+	mAmount -= mAmountFunction(mQueue->front());
+	optional<T> element{std::move(mQueue->front())};
+	mQueue->pop();
 	return element;
 }
 
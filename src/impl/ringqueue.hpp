@@ -0,0 +1,223 @@
+/**
+ * Copyright (c) 2019 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_RING_QUEUE_H
+#define RTC_IMPL_RING_QUEUE_H
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+namespace rtc::impl {
+
+// Bounded lock-free queue for a single producer
+// The producer never blocks nor takes a lock, consumers are serialized among themselves only.
+// Storage is a list of small chunks allocated on demand and released once consumed, so an idle
+// queue costs at most a couple of chunks whatever the limit.
+template <typename T> class RingQueue {
+public:
+	using amount_function = std::function<size_t(const T &element)>;
+
+	// If sharedAmount is set, the amount is also accounted there, for instance per connection
+	RingQueue(size_t limit, amount_function func = nullptr,
+	          shared_ptr<std::atomic<size_t>> sharedAmount = nullptr);
+	~RingQueue();
+
+	RingQueue(const RingQueue &) = delete;
+	RingQueue &operator=(const RingQueue &) = delete;
+
+	void stop();
+	// Limit on the amount in addition to the one on elements, an element exceeding it is still
+	// accepted if the queue is empty
+	void setAmountLimit(optional<size_t> limit);
+	bool running() const;
+	bool empty() const;
+	bool full() const;
+	size_t size() const;   // elements
+	size_t amount() const; // amount
+	bool push(T element);  // single producer only, returns false if full or stopped
+	optional<T> tryPop();
+	optional<T> peek();
+
+private:
+	static const size_t ChunkSize = 64;
+
+	struct Chunk {
+		std::array<optional<T>, ChunkSize> slots;
+		std::atomic<Chunk *> next = nullptr;
+	};
+
+	Chunk *headChunk(); // requires mPopMutex to be locked
+
+	const size_t mLimit;
+	amount_function mAmountFunction;
+	const shared_ptr<std::atomic<size_t>> mSharedAmount;
+
+	std::atomic<Chunk *> mFirstChunk = nullptr; // published by the producer on first push
+	Chunk *mTailChunk = nullptr;                // owned by the producer
+	Chunk *mHeadChunk = nullptr;                // owned by consumers
+
+	alignas(64) std::atomic<size_t> mHead = 0; // written by consumers
+	alignas(64) std::atomic<size_t> mTail = 0; // written by the producer
+	std::atomic<size_t> mAmount = 0;
+	std::atomic<size_t> mAmountLimit = std::numeric_limits<size_t>::max();
+	std::atomic<bool> mStopping = false;
+
+	std::mutex mPopMutex;
+};
+
+template <typename T>
+RingQueue<T>::RingQueue(size_t limit, amount_function func,
+                        shared_ptr<std::atomic<size_t>> sharedAmount)
+    : mLimit(std::max(limit, size_t(1))), mSharedAmount(std::move(sharedAmount)) {
+	mAmountFunction = func ? func : [](const T &element) -> size_t {
+		static_cast<void>(element);
+		return 1;
+	};
+}
+
+template <typename T> RingQueue<T>::~RingQueue() {
+	stop();
+	if (mSharedAmount)
+		mSharedAmount->fetch_sub(mAmount.load(std::memory_order_acquire),
+		                         std::memory_order_relaxed);
+
+	Chunk *chunk = mHeadChunk ? mHeadChunk : mFirstChunk.load(std::memory_order_acquire);
+	while (chunk) {
+		Chunk *next = chunk->next.load(std::memory_order_acquire);
+		delete chunk;
+		chunk = next;
+	}
+}
+
+template <typename T> void RingQueue<T>::stop() {
+	mStopping.store(true, std::memory_order_release);
+}
+
+template <typename T> void RingQueue<T>::setAmountLimit(optional<size_t> limit) {
+	mAmountLimit.store(limit.value_or(std::numeric_limits<size_t>::max()),
+	                   std::memory_order_release);
+}
+
+template <typename T> bool RingQueue<T>::running() const {
+	return !empty() || !mStopping.load(std::memory_order_acquire);
+}
+
+template <typename T> bool RingQueue<T>::empty() const { return size() == 0; }
+
+template <typename T> bool RingQueue<T>::full() const {
+	return size() >= mLimit || amount() >= mAmountLimit.load(std::memory_order_acquire);
+}
+
+template <typename T> size_t RingQueue<T>::size() const {
+	const size_t head = mHead.load(std::memory_order_acquire);
+	const size_t tail = mTail.load(std::memory_order_acquire);
+	return tail >= head ? tail - head : 0;
+}
+
+template <typename T> size_t RingQueue<T>::amount() const {
+	return mAmount.load(std::memory_order_acquire);
+}
+
+template <typename T> bool RingQueue<T>::push(T element) {
+	if (mStopping.load(std::memory_order_acquire))
+		return false;
+
+	const size_t tail = mTail.load(std::memory_order_relaxed);
+	const size_t count = tail - mHead.load(std::memory_order_acquire);
+	if (count >= mLimit)
+		return false;
+
+	const size_t amount = mAmountFunction(element);
+	if (count > 0 && mAmount.load(std::memory_order_acquire) + amount >
+	                     mAmountLimit.load(std::memory_order_acquire))
+		return false;
+
+	if (!mTailChunk) {
+		mTailChunk = new Chunk;
+		mFirstChunk.store(mTailChunk, std::memory_order_release);
+	}
+
+	Chunk *chunk = mTailChunk;
+	const size_t index = tail % ChunkSize;
+	if (index == ChunkSize - 1) {
+		// Link the next chunk before publishing the last slot, so the consumer releasing this
+		// chunk always finds its successor
+		mTailChunk = new Chunk;
+		chunk->next.store(mTailChunk, std::memory_order_release);
+	}
+
+	mAmount.fetch_add(amount, std::memory_order_relaxed);
+	if (mSharedAmount)
+		mSharedAmount->fetch_add(amount, std::memory_order_relaxed);
+
+	chunk->slots[index].emplace(std::move(element));
+	mTail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T> optional<T> RingQueue<T>::tryPop() {
+	std::lock_guard lock(mPopMutex);
+	const size_t head = mHead.load(std::memory_order_relaxed);
+	if (head == mTail.load(std::memory_order_acquire))
+		return nullopt;
+
+	Chunk *chunk = headChunk();
+	auto &slot = chunk->slots[head % ChunkSize];
+	optional<T> element{std::move(*slot)};
+	slot.reset();
+	const size_t amount = mAmountFunction(*element);
+	mAmount.fetch_sub(amount, std::memory_order_relaxed);
+	if (mSharedAmount)
+		mSharedAmount->fetch_sub(amount, std::memory_order_relaxed);
+
+	// Release the chunk once fully consumed, the producer has already moved to the next one
+	if ((head + 1) % ChunkSize == 0) {
+		mHeadChunk = chunk->next.load(std::memory_order_acquire);
+		delete chunk;
+	}
+
+	mHead.store(head + 1, std::memory_order_release);
+	return element;
+}
+
+template <typename T> optional<T> RingQueue<T>::peek() {
+	std::lock_guard lock(mPopMutex);
+	const size_t head = mHead.load(std::memory_order_relaxed);
+	if (head == mTail.load(std::memory_order_acquire))
+		return nullopt;
+
+	return headChunk()->slots[head % ChunkSize];
+}
+
+template <typename T> typename RingQueue<T>::Chunk *RingQueue<T>::headChunk() {
+	// The first chunk is published before the first element, so it is set if the queue is not empty
+	if (!mHeadChunk)
+		mHeadChunk = mFirstChunk.load(std::memory_order_acquire);
+
+	return mHeadChunk;
+}
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,355 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtpstatscollector.hpp"
+#include "internals.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace rtc::impl {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+const size_t RtcpHeaderSize = 4;
+const size_t ReportBlockSize = 24;
+
+bool IsRtcp(const binary &packet) {
+	// RFC 5761 4. Distinguishable RTP and RTCP Packets
+	const uint8_t payloadType = std::to_integer<uint8_t>(packet[1]) & 0x7F;
+	return payloadType >= 64 && payloadType <= 95;
+}
+
+uint32_t ReadUint32(const binary &packet, size_t offset) {
+	uint32_t value;
+	std::memcpy(&value, packet.data() + offset, sizeof(value));
+	return ntohl(value);
+}
+
+int64_t NowMicroseconds() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Reception time of an incoming packet, or now if it was not recorded
+int64_t ArrivalMicroseconds(const Message &message) {
+	using namespace std::chrono;
+	if (!message.arrivalTime)
+		return NowMicroseconds();
+
+	return duration_cast<microseconds>(message.arrivalTime->time_since_epoch()).count();
+}
+
+} // namespace
+
+void RtpStatsCollector::setDescription(Description::Media description) {
+	std::unique_lock lock(mMutex);
+	mClockRates.fill(0);
+	mRtxPayloadTypes.fill(false);
+	for (auto it = description.beginMaps(); it != description.endMaps(); ++it) {
+		const int pt = it->first;
+		if (pt < 0 || pt >= int(mClockRates.size()))
+			continue;
+
+		mClockRates[pt] = uint32_t(std::max(it->second.clockRate, 0));
+		mRtxPayloadTypes[pt] = description.getRtxOriginalPayloadType(pt).has_value();
+	}
+
+	mRtxSsrcs.clear();
+	for (const auto &group : description.getSSRCGroups("FID"))
+		if (group.size() >= 2)
+			mRtxSsrcs[group[1]] = group[0];
+}
+
+void RtpStatsCollector::outgoing(const message_ptr &message) {
+	if (message->size() < RtpHeaderMinSize || message->type == Message::Control ||
+	    IsRtcp(*message)) {
+		if (message->size() >= RtcpHeaderSize)
+			outgoingRtcp(*message);
+
+		return;
+	}
+
+	auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+	SSRC ssrc = rtp->ssrc();
+	bool retransmission;
+	uint32_t clockRate;
+	{
+		std::shared_lock lock(mMutex);
+		retransmission = mRtxPayloadTypes[rtp->payloadType()];
+		if (auto it = mRtxSsrcs.find(ssrc); it != mRtxSsrcs.end()) {
+			ssrc = it->second;
+			retransmission = true;
+		}
+		clockRate = mClockRates[rtp->payloadType()];
+	}
+
+	auto stream = find(ssrc);
+	if (!stream)
+		return;
+
+	if (retransmission) {
+		stream->retransmittedPackets.fetch_add(1, std::memory_order_relaxed);
+		stream->retransmittedBytes.fetch_add(message->packetSize(), std::memory_order_relaxed);
+	} else {
+		stream->packetsSent.fetch_add(1, std::memory_order_relaxed);
+		stream->bytesSent.fetch_add(message->packetSize(), std::memory_order_relaxed);
+		if (clockRate)
+			stream->clockRate.store(clockRate, std::memory_order_relaxed);
+	}
+}
+
+void RtpStatsCollector::incoming(const message_ptr &message) {
+	if (message->size() < RtpHeaderMinSize || message->type == Message::Control ||
+	    IsRtcp(*message)) {
+		if (message->size() >= RtcpHeaderSize)
+			incomingRtcp(*message, ArrivalMicroseconds(*message));
+
+		return;
+	}
+
+	auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+	uint32_t clockRate;
+	{
+		std::shared_lock lock(mMutex);
+		clockRate = mClockRates[rtp->payloadType()];
+	}
+
+	auto stream = find(rtp->ssrc());
+	if (!stream)
+		return;
+
+	const auto relaxed = std::memory_order_relaxed;
+	stream->bytesReceived.fetch_add(message->size(), relaxed);
+	const bool first = stream->packetsReceived.fetch_add(1, relaxed) == 0;
+
+	// Only the receiving thread updates the sequence state
+	const uint16_t seq = rtp->seqNumber();
+	if (!stream->receiving.load(relaxed)) {
+		stream->baseSeq.store(seq, relaxed);
+		stream->maxSeq.store(seq, relaxed);
+		stream->receiving.store(true, relaxed);
+	} else {
+		const uint16_t maxSeq = stream->maxSeq.load(relaxed);
+		if (uint16_t(seq - maxSeq) < 0x8000) { // in order, possibly after a gap
+			if (seq < maxSeq)
+				stream->cycles.fetch_add(1 << 16, relaxed);
+
+			stream->maxSeq.store(seq, relaxed);
+		}
+	}
+
+	if (clockRate) {
+		stream->clockRate.store(clockRate, relaxed);
+		const auto arrival = uint32_t(ArrivalMicroseconds(*message) * clockRate / 1000000);
+		const uint32_t transit = arrival - rtp->timestamp();
+		if (!first) {
+			const double d = std::abs(double(int32_t(transit - stream->lastTransit.load(relaxed))));
+			const double jitter = stream->jitter.load(relaxed);
+			stream->jitter.store(jitter + (d - jitter) / 16.0, relaxed);
+		}
+		stream->lastTransit.store(transit, relaxed);
+	}
+}
+
+std::vector<RtpStreamStats> RtpStatsCollector::stats() const {
+	std::lock_guard statsLock(mStatsMutex);
+	std::shared_lock lock(mMutex);
+	const auto now = clock::now();
+	std::vector<RtpStreamStats> result;
+	result.reserve(mStreams.size());
+	for (auto &[ssrc, stream] : mStreams)
+		result.push_back(makeStats(ssrc, *stream, now));
+
+	return result;
+}
+
+optional<RtpStreamStats> RtpStatsCollector::stats(SSRC ssrc) const {
+	std::lock_guard statsLock(mStatsMutex);
+	std::shared_lock lock(mMutex);
+	auto it = mStreams.find(ssrc);
+	if (it == mStreams.end())
+		return nullopt;
+
+	return makeStats(ssrc, *it->second, clock::now());
+}
+
+std::vector<RtpStreamStats> RtpStatsCollector::counters() const {
+	std::shared_lock lock(mMutex);
+	std::vector<RtpStreamStats> result;
+	result.reserve(mStreams.size());
+	for (auto &[ssrc, stream] : mStreams)
+		result.push_back(makeStats(ssrc, *stream, nullopt));
+
+	return result;
+}
+
+RtpStatsCollector::Stream *RtpStatsCollector::find(SSRC ssrc, bool create) {
+	{
+		std::shared_lock lock(mMutex);
+		if (auto it = mStreams.find(ssrc); it != mStreams.end())
+			return it->second.get(); // streams are never removed
+	}
+
+	if (!create)
+		return nullptr;
+
+	std::unique_lock lock(mMutex);
+	if (auto it = mStreams.find(ssrc); it != mStreams.end())
+		return it->second.get();
+
+	if (mStreams.size() >= MaxStreams)
+		return nullptr;
+
+	return mStreams.emplace(ssrc, std::make_unique<Stream>()).first->second.get();
+}
+
+void RtpStatsCollector::outgoingRtcp(const binary &packet) {
+	size_t offset = 0;
+	while (offset + RtcpHeaderSize <= packet.size()) {
+		auto header = reinterpret_cast<const RtcpHeader *>(packet.data() + offset);
+		const size_t size = header->lengthInBytes();
+		if (size < RtcpHeaderSize || size > packet.size() - offset)
+			break;
+
+		const uint8_t payloadType = header->payloadType();
+		const uint8_t format = header->reportCount();
+		if (payloadType == 200 && size >= 28) { // SR, remember it to compute the RTT
+			const uint32_t ntp = (ReadUint32(packet, offset + 8) << 16) |
+			                     (ReadUint32(packet, offset + 12) >> 16);
+			if (auto stream = find(ReadUint32(packet, offset + 4))) {
+				stream->lastSrNtp.store(ntp, std::memory_order_relaxed);
+				stream->lastSrTime.store(NowMicroseconds(), std::memory_order_relaxed);
+			}
+		} else if (payloadType == 205 && format == 1 && size >= 12) { // NACK
+			if (auto stream = find(ReadUint32(packet, offset + 8), false))
+				stream->nacksSent.fetch_add(1, std::memory_order_relaxed);
+		} else if (payloadType == 206 && (format == 1 || format == 4) && size >= 12) {
+			// PLI, or FIR which targets the SSRC in the FCI
+			const size_t target = format == 4 && size >= 16 ? offset + 12 : offset + 8;
+			if (auto stream = find(ReadUint32(packet, target), false))
+				stream->keyframeRequestsSent.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		offset += size;
+	}
+}
+
+void RtpStatsCollector::incomingRtcp(const binary &packet, int64_t arrival) {
+	const auto relaxed = std::memory_order_relaxed;
+	size_t offset = 0;
+	while (offset + RtcpHeaderSize <= packet.size()) {
+		auto header = reinterpret_cast<const RtcpHeader *>(packet.data() + offset);
+		const size_t size = header->lengthInBytes();
+		if (size < RtcpHeaderSize || size > packet.size() - offset)
+			break;
+
+		const uint8_t payloadType = header->payloadType();
+		const uint8_t format = header->reportCount();
+		if (payloadType == 200 || payloadType == 201) { // SR or RR
+			size_t block = offset + (payloadType == 200 ? 28 : 8);
+			for (uint8_t i = 0; i < format && block + ReportBlockSize <= offset + size; ++i) {
+				if (auto stream = find(ReadUint32(packet, block), false)) {
+					// The cumulative number of packets lost is a signed 24-bit value
+					const uint32_t lost = ReadUint32(packet, block + 4) & 0xFFFFFF;
+					stream->remoteLost.store(int32_t(lost << 8) >> 8, relaxed);
+					stream->remoteJitter.store(ReadUint32(packet, block + 12), relaxed);
+					stream->reported.store(true, relaxed);
+
+					const uint32_t lsr = ReadUint32(packet, block + 16);
+					const uint32_t dlsr = ReadUint32(packet, block + 20);
+					if (lsr != 0 && lsr == stream->lastSrNtp.load(relaxed)) {
+						const int64_t rtt = arrival - stream->lastSrTime.load(relaxed) -
+						                    int64_t(dlsr) * 1000000 / 65536;
+						if (rtt >= 0)
+							stream->rtt.store(rtt, relaxed);
+					}
+				}
+				block += ReportBlockSize;
+			}
+		} else if (payloadType == 205 && format == 1 && size >= 12) { // NACK
+			if (auto stream = find(ReadUint32(packet, offset + 8), false))
+				stream->nacksReceived.fetch_add(1, relaxed);
+		} else if (payloadType == 206 && (format == 1 || format == 4) && size >= 12) {
+			const size_t target = format == 4 && size >= 16 ? offset + 12 : offset + 8;
+			if (auto stream = find(ReadUint32(packet, target), false))
+				stream->keyframeRequestsReceived.fetch_add(1, relaxed);
+		}
+
+		offset += size;
+	}
+}
+
+RtpStreamStats RtpStatsCollector::makeStats(SSRC ssrc, Stream &stream,
+                                            optional<clock::time_point> now) const {
+	const auto relaxed = std::memory_order_relaxed;
+	RtpStreamStats stats;
+	stats.ssrc = ssrc;
+	stats.packetsSent = stream.packetsSent.load(relaxed);
+	stats.bytesSent = stream.bytesSent.load(relaxed);
+	stats.retransmittedPackets = stream.retransmittedPackets.load(relaxed);
+	stats.retransmittedBytes = stream.retransmittedBytes.load(relaxed);
+	stats.nacksReceived = stream.nacksReceived.load(relaxed);
+	stats.keyframeRequestsReceived = stream.keyframeRequestsReceived.load(relaxed);
+	stats.packetsReceived = stream.packetsReceived.load(relaxed);
+	stats.bytesReceived = stream.bytesReceived.load(relaxed);
+	stats.nacksSent = stream.nacksSent.load(relaxed);
+	stats.keyframeRequestsSent = stream.keyframeRequestsSent.load(relaxed);
+
+	const double clockRate = double(stream.clockRate.load(relaxed));
+	if (stream.reported.load(relaxed)) {
+		stats.packetsLost = stream.remoteLost.load(relaxed);
+		if (clockRate > 0)
+			stats.jitter = double(stream.remoteJitter.load(relaxed)) / clockRate;
+
+		if (int64_t rtt = stream.rtt.load(relaxed); rtt >= 0)
+			stats.rtt = std::chrono::milliseconds(rtt / 1000);
+
+	} else if (stream.receiving.load(relaxed)) {
+		const uint32_t extendedMax = stream.cycles.load(relaxed) + stream.maxSeq.load(relaxed);
+		const int64_t expected = int64_t(extendedMax) - stream.baseSeq.load(relaxed) + 1;
+		stats.packetsLost = expected - int64_t(stats.packetsReceived);
+		if (clockRate > 0)
+			stats.jitter = stream.jitter.load(relaxed) / clockRate;
+	}
+
+	if (!now)
+		return stats;
+
+	// Bitrates are averaged since the previous call, which requires mStatsMutex
+	const double elapsed = std::chrono::duration<double>(*now - stream.previousTime).count();
+	if (elapsed > 0) {
+		stats.bitrateSent =
+		    unsigned(double(stats.bytesSent - stream.previousBytesSent) * 8 / elapsed);
+		stats.bitrateReceived =
+		    unsigned(double(stats.bytesReceived - stream.previousBytesReceived) * 8 / elapsed);
+	}
+	stream.previousBytesSent = stats.bytesSent;
+	stream.previousBytesReceived = stats.bytesReceived;
+	stream.previousTime = *now;
+	return stats;
+}
+
+} // namespace rtc::impl
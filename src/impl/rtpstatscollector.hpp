@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_RTP_STATS_COLLECTOR_H
+#define RTC_IMPL_RTP_STATS_COLLECTOR_H
+
+#include "common.hpp"
+#include "description.hpp"
+#include "message.hpp"
+
+#include "rtc/rtp.hpp"
+#include "rtc/track.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace rtc::impl {
+
+// Collects statistics of the RTP streams of a track from the packets it sends and receives
+// Counters are relaxed atomics, so the hot path only takes a shared lock to find the stream.
+// Reception state is updated by a single thread, the one delivering incoming packets.
+class RtpStatsCollector final {
+public:
+	using clock = std::chrono::steady_clock;
+
+	RtpStatsCollector() = default;
+	RtpStatsCollector(const RtpStatsCollector &) = delete;
+	RtpStatsCollector &operator=(const RtpStatsCollector &) = delete;
+
+	void setDescription(Description::Media description); // payload types and RTX SSRCs
+
+	void outgoing(const message_ptr &message);
+	void incoming(const message_ptr &message);
+
+	std::vector<RtpStreamStats> stats() const;
+	optional<RtpStreamStats> stats(SSRC ssrc) const;
+	std::vector<RtpStreamStats> counters() const; // without bitrates, leaves them untouched
+
+private:
+	struct Stream {
+		std::atomic<uint64_t> packetsSent = 0;
+		std::atomic<uint64_t> bytesSent = 0;
+		std::atomic<uint64_t> retransmittedPackets = 0;
+		std::atomic<uint64_t> retransmittedBytes = 0;
+		std::atomic<uint64_t> nacksReceived = 0;
+		std::atomic<uint64_t> keyframeRequestsReceived = 0;
+		std::atomic<uint64_t> packetsReceived = 0;
+		std::atomic<uint64_t> bytesReceived = 0;
+		std::atomic<uint64_t> nacksSent = 0;
+		std::atomic<uint64_t> keyframeRequestsSent = 0;
+		std::atomic<uint32_t> clockRate = 0;
+
+		// Reception (RFC 3550 A.1 and A.8)
+		std::atomic<bool> receiving = false;
+		std::atomic<uint16_t> baseSeq = 0;
+		std::atomic<uint16_t> maxSeq = 0;
+		std::atomic<uint32_t> cycles = 0; // shifted count of sequence number cycles
+		std::atomic<uint32_t> lastTransit = 0;
+		std::atomic<double> jitter = 0; // in timestamp units
+
+		// Latest receiver report for a sent stream
+		std::atomic<bool> reported = false;
+		std::atomic<int32_t> remoteLost = 0;
+		std::atomic<uint32_t> remoteJitter = 0;
+		std::atomic<uint32_t> lastSrNtp = 0; // middle 32 bits of the last SR sent
+		std::atomic<int64_t> lastSrTime = 0; // in microseconds on the steady clock
+		std::atomic<int64_t> rtt = -1;       // in microseconds, -1 if unknown
+
+		// Previous call to stats(), protected by mStatsMutex
+		uint64_t previousBytesSent = 0;
+		uint64_t previousBytesReceived = 0;
+		clock::time_point previousTime = clock::now();
+	};
+
+	Stream *find(SSRC ssrc, bool create = true);
+	void outgoingRtcp(const binary &packet);
+	void incomingRtcp(const binary &packet, int64_t arrival); // arrival time in us
+	RtpStreamStats makeStats(SSRC ssrc, Stream &stream, optional<clock::time_point> now) const;
+
+	static const size_t MaxStreams = 64; // bound the state created by unknown SSRCs
+
+	std::unordered_map<SSRC, std::unique_ptr<Stream>> mStreams;
+	std::unordered_map<SSRC, SSRC> mRtxSsrcs; // RTX SSRC to original SSRC
+	std::array<uint32_t, 128> mClockRates = {}; // by payload type
+	std::array<bool, 128> mRtxPayloadTypes = {};
+	mutable std::shared_mutex mMutex;
+	mutable std::mutex mStatsMutex;
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -16,33 +16,41 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM Sctp
+
 #include "sctptransport.hpp"
+#include "crc32c.hpp"
 #include "dtlstransport.hpp"
 #include "internals.hpp"
 #include "logcounter.hpp"
+#include "overloadcontroller.hpp"
+#include "pathmtudiscovery.hpp"
+#include "threadregistry.hpp"
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <iostream>
 #include <limits>
 #include <shared_mutex>
 #include <thread>
-#include <unordered_set>
 #include <vector>
 
 // RFC 8831: SCTP MUST support performing Path MTU discovery without relying on ICMP or ICMPv6 as
 // specified in [RFC4821] by using probing messages specified in [RFC4820].
 // See https://tools.ietf.org/html/rfc8831#section-5
 //
-// However, usrsctp does not implement Path MTU discovery, so we need to disable it for now.
+// However, usrsctp does not implement Path MTU discovery, so its own is disabled and we perform
+// Packetization Layer Path MTU Discovery (RFC 8899) with probes injected under usrsctp instead.
 // See https://github.com/sctplab/usrsctp/issues/205
-#define USE_PMTUD 0
-
-// TODO: When Path MTU discovery is supported, it needs to be enabled with libjuice as ICE backend
-// on all platforms except Mac OS where the Don't Fragment (DF) flag can't be set:
-/*
+//
+// Probes must not be fragmented, so it is only enabled with libjuice as ICE backend on all
+// platforms except Mac OS where the Don't Fragment (DF) flag can't be set.
 #if !USE_NICE
 #ifndef __APPLE__
 // libjuice enables Linux path MTU discovery or sets the DF flag
@@ -54,7 +62,6 @@
 #else // USE_NICE == 1
 #define USE_PMTUD 0
 #endif
-*/
 
 using namespace std::chrono_literals;
 using namespace std::chrono;
@@ -89,33 +96,158 @@ static LogCounter
 static LogCounter COUNTER_BAD_SCTP_STATUS(plog::warning,
                                           "Number of SCTP packets received with a bad status");
 
-class SctpTransport::InstancesSet {
+namespace {
+
+// SCTP packets are carried in DTLS records over UDP, the MTU includes the IP header
+const size_t SctpPacketOverhead = 48 + 8 + 40; // DTLS/UDP/IPv6
+const size_t SctpHeaderSize = 12;
+
+// RFC 8899 6.2.1: Probes are a HEARTBEAT chunk bundled with a PAD chunk (RFC 4820) to reach the
+// probe size. The peer answers with a HEARTBEAT ACK echoing the Heartbeat Info, which carries a
+// magic value, so it can be told apart from the acknowledgements of usrsctp heartbeats.
+const uint8_t SctpChunkHeartbeat = 4;
+const uint8_t SctpChunkHeartbeatAck = 5;
+const uint8_t SctpChunkPad = 0x84;
+const uint16_t SctpHeartbeatInfo = 1;
+const uint32_t ProbeMagic = 0x504D5455; // "PMTU"
+const size_t ProbeChunkSize = 4 + 4 + 8; // chunk header, parameter header, magic and id
+
+// Datagrams are prefixed with a zero source port, which is invalid for SCTP (RFC 9260 3.1), so
+// they can't be mistaken for SCTP packets
+const size_t DatagramHeaderSize = 2;
+
+// Peers which don't support adding streams (RFC 6525) might never answer the request
+const milliseconds AddStreamsTimeout = 5s;
+
+// When timers are offloaded, usrsctp timers are run by our own thread, so packets written while
+// they run can be told apart and handed over to the worker of the association
+const milliseconds TimerTick = 10ms;
+
+// Period of the checks for expired messages deep in blocked send queues
+const milliseconds ExpiryCheckInterval = 50ms;
+
+// The timer thread is never destroyed, as it keeps running if the cleanup times out or is never
+// called, and destroying a joinable std::thread on exit would terminate the process
+std::thread *TimerThread = nullptr;
+std::atomic<bool> TimerThreadStopped = true;
+thread_local bool tRunningTimers = false;
+
+void RunTimers() {
+	ThreadRegistry::Registration registration(ThreadRegistry::Role::SctpTimer);
+	tRunningTimers = true;
+	auto last = steady_clock::now();
+	while (!TimerThreadStopped) {
+		std::this_thread::sleep_for(TimerTick);
+		const auto now = steady_clock::now();
+		const auto elapsed = std::chrono::duration_cast<milliseconds>(now - last);
+		last += elapsed;
+		usrsctp_handle_timers(uint32_t(elapsed.count()));
+	}
+}
+
+// Set the CRC32 ourselves as we have enabled CRC32 offloading
+void SetChecksum(byte *data, size_t len) {
+	if (len >= 12) {
+		uint32_t *checksum = reinterpret_cast<uint32_t *>(data) + 2;
+		*checksum = 0;
+		*checksum = Crc32c(data, len);
+	}
+}
+
+} // namespace
+
+// Handles are recycled instead of freed since usrsctp might still call back with a handle after
+// the socket is closed (sctplab/usrsctp#405). Each one has its own lock, aligned to a cache line,
+// so callbacks for different associations don't contend.
+class alignas(64) SctpTransport::Handle final {
 public:
-	void insert(SctpTransport *instance) {
-		std::unique_lock lock(mMutex);
-		mSet.insert(instance);
+	static Handle *Acquire(SctpTransport *transport) {
+		Handle *handle;
+		{
+			auto &free = Free();
+			std::lock_guard lock(free.mutex);
+			if (free.handles.size() > MinFreeHandles) {
+				// Reuse the least recently released handle
+				handle = free.handles.front();
+				free.handles.pop_front();
+			} else {
+				handle = new Handle;
+			}
+		}
+		std::unique_lock lock(handle->mMutex);
+		handle->mTransport = transport;
+		++handle->mGeneration;
+		return handle;
 	}
 
-	void erase(SctpTransport *instance) {
-		std::unique_lock lock(mMutex);
-		mSet.erase(instance);
+	static void Release(Handle *handle) {
+		{
+			// Wait for running callbacks
+			std::unique_lock lock(handle->mMutex);
+			handle->mTransport = nullptr;
+		}
+		auto &free = Free();
+		std::lock_guard lock(free.mutex);
+		free.handles.push_back(handle);
 	}
 
 	using shared_lock = std::shared_lock<std::shared_mutex>;
-	optional<shared_lock> lock(SctpTransport *instance) {
+
+	// The transport can't be destroyed while the returned lock is held
+	optional<shared_lock> lock() {
+		shared_lock lock(mMutex);
+		return mTransport ? std::make_optional(std::move(lock)) : nullopt;
+	}
+
+	// Same, but fails if the handle has been reused since the generation was read
+	optional<shared_lock> lock(uint64_t generation) {
 		shared_lock lock(mMutex);
-		return mSet.find(instance) != mSet.end() ? std::make_optional(std::move(lock)) : nullopt;
+		return mTransport && mGeneration == generation ? std::make_optional(std::move(lock))
+		                                               : nullopt;
 	}
 
+	// The following must be called with the handle locked
+	SctpTransport *transport() const { return mTransport; }
+	uint64_t generation() const { return mGeneration; }
+
 private:
-	std::unordered_set<SctpTransport *> mSet;
+	Handle() = default;
+
+	// Keep released handles aside for a while so late callbacks are most likely dropped
+	static const size_t MinFreeHandles = 64;
+
 	std::shared_mutex mMutex;
+	SctpTransport *mTransport = nullptr;
+	uint64_t mGeneration = 0;
+
+	struct FreeList {
+		std::mutex mutex;
+		std::deque<Handle *> handles;
+	};
+
+	// Like handles, the list is never destroyed, usrsctp might call back during static destruction
+	static FreeList &Free() {
+		static auto *list = new FreeList;
+		return *list;
+	}
 };
 
-SctpTransport::InstancesSet *SctpTransport::Instances = new InstancesSet;
-
-void SctpTransport::Init() {
-	usrsctp_init(0, SctpTransport::WriteCallback, SctpTransport::DebugCallback);
+std::atomic<bool> SctpTransport::InterleavingEnabled = true;
+std::atomic<milliseconds::rep> SctpTransport::ShutdownTimeout = 1000;
+std::atomic<steady_clock::rep> SctpTransport::GlobalShutdownDeadline =
+    steady_clock::time_point::max().time_since_epoch().count();
+
+void SctpTransport::Init(const SctpSettings &s) {
+	if (s.offloadTimerOutput.value_or(false)) {
+		PLOG_DEBUG << "Running SCTP timers with output offloaded to workers";
+		usrsctp_init_nothreads(0, SctpTransport::WriteCallback, SctpTransport::DebugCallback);
+		if (!TimerThread) { // might still be running after a cleanup timeout
+			TimerThreadStopped = false;
+			TimerThread = new std::thread(RunTimers);
+		}
+	} else {
+		usrsctp_init(0, SctpTransport::WriteCallback, SctpTransport::DebugCallback);
+	}
 	usrsctp_enable_crc32c_offload();       // We'll compute CRC32 only for outgoing packets
 	usrsctp_sysctl_set_sctp_pr_enable(1);  // Enable Partial Reliability Extension (RFC 3758)
 	usrsctp_sysctl_set_sctp_ecn_enable(0); // Disable Explicit Congestion Notification
@@ -171,31 +303,66 @@ void SctpTransport::SetSettings(const SctpSettings &s) {
 	// Heartbeat interval
 	usrsctp_sysctl_set_sctp_heartbeat_interval_default(
 	    to_uint32(s.heartbeatInterval.value_or(10000ms).count()));
+
+	// Message interleaving is negotiated per association, it is enabled on sockets at creation
+	InterleavingEnabled = s.messageInterleaving.value_or(true);
+
+	ShutdownTimeout = s.shutdownTimeout.value_or(1000ms).count();
+}
+
+bool SctpTransport::Cleanup(optional<steady_clock::time_point> deadline) {
+	// usrsctp_finish() fails as long as associations remain
+	while (usrsctp_finish() != 0) {
+		if (deadline && steady_clock::now() >= *deadline)
+			return false;
+
+		std::this_thread::sleep_for(10ms);
+	}
+
+	if (TimerThread) {
+		TimerThreadStopped = true;
+		TimerThread->join();
+		delete TimerThread;
+		TimerThread = nullptr;
+	}
+	return true;
+}
+
+steady_clock::time_point SctpTransport::ShutdownDeadline() {
+	const auto global = steady_clock::time_point(steady_clock::duration(GlobalShutdownDeadline));
+	return std::min(steady_clock::now() + milliseconds(ShutdownTimeout), global);
 }
 
-void SctpTransport::Cleanup() {
-	while (usrsctp_finish() != 0)
-		std::this_thread::sleep_for(100ms);
+void SctpTransport::SetGlobalShutdownDeadline(optional<steady_clock::time_point> deadline) {
+	GlobalShutdownDeadline =
+	    deadline.value_or(steady_clock::time_point::max()).time_since_epoch().count();
 }
 
 SctpTransport::SctpTransport(shared_ptr<Transport> lower, const Configuration &config,
                              uint16_t port, message_callback recvCallback,
                              amount_callback bufferedAmountCallback,
-                             state_callback stateChangeCallback)
+                             state_callback stateChangeCallback, optional<size_t> affinity)
     : Transport(lower, std::move(stateChangeCallback)), mPort(port),
-      mSendQueue(0, message_size_func), mBufferedAmountCallback(std::move(bufferedAmountCallback)) {
+      mMaxMessageSize(config.maxMessageSize.value_or(DEFAULT_LOCAL_MAX_MESSAGE_SIZE)),
+      mCompactMemory(config.compactMemory), mDynamicStreams(config.sctpDynamicStreams),
+      mHandle(Handle::Acquire(this)),
+      mProcessor(0, affinity),
+      mBufferedAmountCallback(std::move(bufferedAmountCallback)),
+      mAutoBufferSize(config.sctpAutoBufferSize || config.compactMemory),
+      mTargetBitrate(config.sctpTargetBitrate),
+      mMaxBufferSize(config.sctpMaxBufferSize.value_or(16 * 1024 * 1024)),
+      mLastTuningTime(steady_clock::now()) {
 	onRecv(std::move(recvCallback));
 
 	PLOG_DEBUG << "Initializing SCTP transport";
 
-	usrsctp_register_address(this);
-	Instances->insert(this);
+	usrsctp_register_address(mHandle);
 
 	mSock = usrsctp_socket(AF_CONN, SOCK_STREAM, IPPROTO_SCTP, nullptr, nullptr, 0, nullptr);
 	if (!mSock)
 		throw std::runtime_error("Could not create SCTP socket, errno=" + std::to_string(errno));
 
-	usrsctp_set_upcall(mSock, &SctpTransport::UpcallCallback, this);
+	usrsctp_set_upcall(mSock, &SctpTransport::UpcallCallback, mHandle);
 
 	if (usrsctp_set_non_blocking(mSock, 1))
 		throw std::runtime_error("Unable to set non-blocking mode, errno=" + std::to_string(errno));
@@ -208,9 +375,10 @@ SctpTransport::SctpTransport(shared_ptr<Transport> lower, const Configuration &c
 		throw std::runtime_error("Could not set socket option SO_LINGER, errno=" +
 		                         std::to_string(errno));
 
+	// Adding streams is accepted up to the maximum number of inbound streams negotiated in INIT
 	struct sctp_assoc_value av = {};
 	av.assoc_id = SCTP_ALL_ASSOC;
-	av.assoc_value = 1;
+	av.assoc_value = SCTP_ENABLE_RESET_STREAM_REQ | SCTP_ENABLE_CHANGE_ASSOC_REQ;
 	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_ENABLE_STREAM_RESET, &av, sizeof(av)))
 		throw std::runtime_error("Could not set socket option SCTP_ENABLE_STREAM_RESET, errno=" +
 		                         std::to_string(errno));
@@ -234,6 +402,10 @@ SctpTransport::SctpTransport(shared_ptr<Transport> lower, const Configuration &c
 	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_EVENT, &se, sizeof(se)))
 		throw std::runtime_error("Could not subscribe to event SCTP_STREAM_RESET_EVENT, errno=" +
 		                         std::to_string(errno));
+	se.se_type = SCTP_STREAM_CHANGE_EVENT;
+	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_EVENT, &se, sizeof(se)))
+		throw std::runtime_error("Could not subscribe to event SCTP_STREAM_CHANGE_EVENT, errno=" +
+		                         std::to_string(errno));
 
 	// RFC 8831 6.6. Transferring User Data on a Data Channel
 	// The sender SHOULD disable the Nagle algorithm (see [RFC1122) to minimize the latency
@@ -255,47 +427,101 @@ SctpTransport::SctpTransport(shared_ptr<Transport> lower, const Configuration &c
 	// path MTU has to be used by the SCTP stack. It is RECOMMENDED that the safe value not exceed
 	// 1200 bytes.
 	// See https://tools.ietf.org/html/rfc8261#section-5
-#if USE_PMTUD
-	if (!config.mtu.has_value()) {
-#else
-	if (false) {
-#endif
-		// Enable SCTP path MTU discovery
-		spp.spp_flags |= SPP_PMTUD_ENABLE;
-		PLOG_VERBOSE << "Path MTU discovery enabled";
-
-	} else {
-		// Fall back to a safe MTU value.
-		spp.spp_flags |= SPP_PMTUD_DISABLE;
-		// The MTU value provided specifies the space available for chunks in the
-		// packet, so we also subtract the SCTP header size.
-		size_t pmtu = config.mtu.value_or(DEFAULT_MTU) - 12 - 48 - 8 - 40; // SCTP/DTLS/UDP/IPv6
-		spp.spp_pathmtu = to_uint32(pmtu);
-		PLOG_VERBOSE << "Path MTU discovery disabled, SCTP MTU set to " << pmtu;
-	}
+	// Start from a safe MTU value, it is raised later by path MTU discovery if enabled.
+	spp.spp_flags |= SPP_PMTUD_DISABLE;
+	// The MTU value provided specifies the space available for chunks in the
+	// packet, so we also subtract the SCTP header size.
+	size_t pmtu = config.mtu.value_or(DEFAULT_MTU) - SctpHeaderSize - SctpPacketOverhead;
+	spp.spp_pathmtu = to_uint32(pmtu);
+	PLOG_VERBOSE << "SCTP MTU set to " << pmtu;
 
 	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_PEER_ADDR_PARAMS, &spp, sizeof(spp)))
 		throw std::runtime_error("Could not set socket option SCTP_PEER_ADDR_PARAMS, errno=" +
 		                         std::to_string(errno));
 
+#if USE_PMTUD
+	if (!config.mtu.has_value()) {
+		// Callbacks are called from the thread pool or the lower layer
+		mPathMtuDiscovery = std::make_shared<PathMtuDiscovery>(
+		    DEFAULT_MTU, MAX_PATH_MTU,
+		    [handle = mHandle](uint32_t id, size_t size) {
+			    if (auto locked = handle->lock())
+				    handle->transport()->sendMtuProbe(id, size);
+		    },
+		    [handle = mHandle](size_t mtu) {
+			    if (auto locked = handle->lock())
+				    handle->transport()->setPathMtu(mtu);
+		    });
+		PLOG_VERBOSE << "Path MTU discovery enabled";
+	}
+#endif
+
 	// RFC 8831 6.2. SCTP Association Management
 	// The number of streams negotiated during SCTP association setup SHOULD be 65535, which is the
 	// maximum number of streams that can be negotiated during the association setup.
 	// See https://tools.ietf.org/html/rfc8831#section-6.2
+	// However, usrsctp allocates per-stream state for the association upfront, which dominates the
+	// footprint of an idle connection, so the compact profile negotiates fewer streams.
+	// With dynamic streams, few outgoing streams are negotiated and more are added on demand, while
+	// all inbound streams are accepted so the peer may add streams too.
+	const uint16_t streams = mCompactMemory && !mDynamicStreams ? COMPACT_SCTP_STREAMS : 65535;
 	struct sctp_initmsg sinit = {};
-	sinit.sinit_num_ostreams = 65535;
-	sinit.sinit_max_instreams = 65535;
+	sinit.sinit_num_ostreams = mDynamicStreams ? COMPACT_SCTP_STREAMS : streams;
+	sinit.sinit_max_instreams = streams;
 	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_INITMSG, &sinit, sizeof(sinit)))
 		throw std::runtime_error("Could not set socket option SCTP_INITMSG, errno=" +
 		                         std::to_string(errno));
 
-	// Prevent fragmented interleave of messages (i.e. level 0), see RFC 6458 section 8.1.20.
-	// Unless the user has set the fragmentation interleave level to 0, notifications
-	// may also be interleaved with partially delivered messages.
-	int level = 0;
-	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &level, sizeof(level)))
-		throw std::runtime_error("Could not disable SCTP fragmented interleave, errno=" +
-		                         std::to_string(errno));
+	if (config.sctpMaxBurst) {
+		struct sctp_assoc_value av = {};
+		av.assoc_id = SCTP_FUTURE_ASSOC;
+		av.assoc_value = to_uint32(*config.sctpMaxBurst);
+		if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_MAX_BURST, &av, sizeof(av)))
+			throw std::runtime_error("Could not set socket option SCTP_MAX_BURST, errno=" +
+			                         std::to_string(errno));
+	}
+
+	// RFC 8260: Stream Schedulers and User Message Interleaving for SCTP
+	// With I-DATA chunks, a large message does not block messages on other streams. usrsctp
+	// requires fragmented interleave level 2 (i.e. interleave between streams) to enable it, see
+	// RFC 6458 section 8.1.20. If the peer does not support I-DATA, DATA chunks are used instead.
+	// See https://tools.ietf.org/html/rfc8260
+	bool interleaving = false;
+	if (InterleavingEnabled) {
+		int level = 2;
+		struct sctp_assoc_value av = {};
+		av.assoc_id = SCTP_FUTURE_ASSOC;
+		av.assoc_value = 1;
+		if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &level,
+		                       sizeof(level)) == 0 &&
+		    usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_INTERLEAVING_SUPPORTED, &av,
+		                       sizeof(av)) == 0) {
+			interleaving = true;
+		} else {
+			PLOG_WARNING << "SCTP message interleaving is not supported, errno=" << errno;
+		}
+	}
+
+	if (!interleaving) {
+		// Prevent fragmented interleave of messages (i.e. level 0), see RFC 6458 section 8.1.20.
+		// Unless the user has set the fragmentation interleave level to 0, notifications
+		// may also be interleaved with partially delivered messages.
+		int level = 0;
+		if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &level,
+		                       sizeof(level)))
+			throw std::runtime_error("Could not disable SCTP fragmented interleave, errno=" +
+			                         std::to_string(errno));
+	}
+
+	// Schedule streams by priority, streams with the same priority are scheduled in a round-robin
+	// fashion so bulk transfers on a stream don't starve others. Without I-DATA, streams are only
+	// interleaved at message boundaries.
+	struct sctp_assoc_value ss = {};
+	ss.assoc_id = SCTP_FUTURE_ASSOC;
+	ss.assoc_value = SCTP_SS_PRIORITY;
+	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_PLUGGABLE_SS, &ss, sizeof(ss))) {
+		PLOG_WARNING << "Could not set SCTP stream scheduler, errno=" << errno;
+	}
 
 	int rcvBuf = 0;
 	socklen_t rcvBufLen = sizeof(rcvBuf);
@@ -308,11 +534,16 @@ SctpTransport::SctpTransport(shared_ptr<Transport> lower, const Configuration &c
 		throw std::runtime_error("Could not get SCTP send buffer size, errno=" +
 		                         std::to_string(errno));
 
-	// Ensure the buffer is also large enough to accomodate the largest messages
-	const size_t maxMessageSize = config.maxMessageSize.value_or(DEFAULT_LOCAL_MAX_MESSAGE_SIZE);
-	const int minBuf = int(std::min(maxMessageSize, size_t(std::numeric_limits<int>::max())));
-	rcvBuf = std::max(rcvBuf, minBuf);
-	sndBuf = std::max(sndBuf, minBuf);
+	if (mCompactMemory) {
+		// Start small, buffers grow with the measured traffic, and the send buffer grows to fit
+		// larger messages when they are sent (incoming ones are partially delivered anyway)
+		rcvBuf = sndBuf = int(COMPACT_SCTP_BUFFER_SIZE);
+	} else {
+		// Ensure the buffer is also large enough to accomodate the largest messages
+		const int minBuf = int(std::min(mMaxMessageSize, size_t(std::numeric_limits<int>::max())));
+		rcvBuf = std::max(rcvBuf, minBuf);
+		sndBuf = std::max(sndBuf, minBuf);
+	}
 
 	if (usrsctp_setsockopt(mSock, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)))
 		throw std::runtime_error("Could not set SCTP recv buffer size, errno=" +
@@ -321,14 +552,22 @@ SctpTransport::SctpTransport(shared_ptr<Transport> lower, const Configuration &c
 	if (usrsctp_setsockopt(mSock, SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf)))
 		throw std::runtime_error("Could not set SCTP send buffer size, errno=" +
 		                         std::to_string(errno));
+
+	mRecvBufferSize = size_t(rcvBuf);
+	mSendBufferSize = size_t(sndBuf);
 }
 
 SctpTransport::~SctpTransport() {
 	stop();
 	close();
 
-	usrsctp_deregister_address(this);
-	Instances->erase(this);
+	if (mMemoryAccount) {
+		mMemoryAccount->sendQueue = 0;
+		mMemoryAccount->reassembly = 0;
+	}
+
+	usrsctp_deregister_address(mHandle);
+	Handle::Release(mHandle);
 }
 
 void SctpTransport::start() {
@@ -344,18 +583,67 @@ bool SctpTransport::stop() {
 	mWrittenOnce = true;
 	mWrittenCondition.notify_all();
 
+	{
+		std::lock_guard lock(mShutdownMutex);
+		mShutdownCallback = nullptr;
+	}
+
 	if (!Transport::stop())
 		return false;
 
-	mSendQueue.stop();
+	if (mPathMtuDiscovery)
+		mPathMtuDiscovery->stop();
+
+	{
+		std::lock_guard lock(mSendMutex);
+		mSendQueueStopped = true;
+	}
 	flush();
 	shutdown();
 	return true;
 }
 
+bool SctpTransport::shutdownGracefully(std::function<void()> callback) {
+	if (!mSock || state() != State::Connected)
+		return false;
+
+	{
+		std::lock_guard lock(mSendMutex);
+		mSendQueueStopped = true;
+	}
+	flush();
+
+	std::lock_guard lock(mShutdownMutex);
+	mShutdownCallback = std::move(callback);
+
+	// Only shut down the sending side so the socket still receives the association change
+	// notification. The SHUTDOWN chunk is sent once all outstanding data is acknowledged.
+	if (usrsctp_shutdown(mSock, SHUT_WR) != 0) {
+		PLOG_WARNING << "SCTP graceful shutdown failed, errno=" << errno;
+		mShutdownCallback = nullptr;
+		return false;
+	}
+
+	PLOG_DEBUG << "SCTP graceful shutdown initiated";
+	return true;
+}
+
 void SctpTransport::close() {
 	if (mSock) {
 		mProcessor.join();
+
+		// Otherwise, the association would linger in usrsctp until it times out, since the
+		// lower transports are stopped right after, and prevent usrsctp_finish() from succeeding
+		if (!mAssociationClosed) {
+			PLOG_DEBUG << "Aborting SCTP association";
+			struct linger sol = {};
+			sol.l_onoff = 1;
+			sol.l_linger = 0;
+			if (usrsctp_setsockopt(mSock, SOL_SOCKET, SO_LINGER, &sol, sizeof(sol))) {
+				PLOG_WARNING << "Could not set socket option SO_LINGER, errno=" << errno;
+			}
+		}
+
 		usrsctp_close(mSock);
 		mSock = nullptr;
 	}
@@ -371,7 +659,7 @@ void SctpTransport::connect() {
 	struct sockaddr_conn sconn = {};
 	sconn.sconn_family = AF_CONN;
 	sconn.sconn_port = htons(mPort);
-	sconn.sconn_addr = this;
+	sconn.sconn_addr = mHandle;
 #ifdef HAVE_SCONN_LEN
 	sconn.sconn_len = sizeof(sconn);
 #endif
@@ -404,23 +692,57 @@ void SctpTransport::shutdown() {
 	mWrittenCondition.notify_all();
 }
 
-bool SctpTransport::send(message_ptr message) {
+bool SctpTransport::send(message_ptr message) { return send(std::move(message), nullopt); }
+
+bool SctpTransport::send(message_ptr message, const optional<Reliability> &reliability) {
+	const auto sr = reliability ? std::make_optional(ToStreamReliability(*reliability)) : nullopt;
 	std::lock_guard lock(mSendMutex);
 
 	if (!message)
 		return trySendQueue();
 
-	PLOG_VERBOSE << "Send size=" << message->size();
+	PLOG_VERBOSE << "Send size=" << message->payloadSize();
 
 	// Flush the queue, and if nothing is pending, try to send directly
-	if (trySendQueue() && trySendMessage(message))
+	if (trySendQueue() && trySendMessage(message, sr))
 		return true;
 
-	mSendQueue.push(message);
+	enqueue(message, sr);
 	updateBufferedAmount(to_uint16(message->stream), ptrdiff_t(message_size_func(message)));
 	return false;
 }
 
+size_t SctpTransport::sendBatch(const std::vector<message_ptr> &messages) {
+	return sendBatch(messages, nullopt);
+}
+
+size_t SctpTransport::sendBatch(const std::vector<message_ptr> &messages,
+                                const optional<Reliability> &reliability) {
+	const auto sr = reliability ? std::make_optional(ToStreamReliability(*reliability)) : nullopt;
+	std::lock_guard lock(mSendMutex);
+
+	PLOG_VERBOSE << "Send batch count=" << messages.size();
+
+	// Flush the queue once, then send directly until a message needs to be buffered
+	bool direct = trySendQueue();
+	size_t count = 0;
+	for (const auto &message : messages) {
+		if (!message)
+			continue;
+
+		if (direct && trySendMessage(message, sr)) {
+			++count;
+			continue;
+		}
+
+		// Following messages are buffered too to keep the order
+		direct = false;
+		enqueue(message, sr);
+		updateBufferedAmount(to_uint16(message->stream), ptrdiff_t(message_size_func(message)));
+	}
+	return count;
+}
+
 bool SctpTransport::flush() {
 	try {
 		std::lock_guard lock(mSendMutex);
@@ -437,7 +759,7 @@ void SctpTransport::closeStream(unsigned int stream) {
 	std::lock_guard lock(mSendMutex);
 
 	// This method must not call the buffered callback synchronously
-	mSendQueue.push(make_message(0, Message::Reset, to_uint16(stream)));
+	enqueue(make_message(0, Message::Reset, to_uint16(stream)));
 	mProcessor.enqueue(&SctpTransport::flush, this);
 }
 
@@ -459,13 +781,39 @@ void SctpTransport::incoming(message_ptr message) {
 
 	PLOG_VERBOSE << "Incoming size=" << message->size();
 
-	usrsctp_conninput(this, message->data(), message->size(), 0);
+	if (mPathMtuDiscovery && processMtuProbeAck(*message))
+		return;
+
+	if (message->size() >= DatagramHeaderSize && message->at(0) == byte(0) &&
+	    message->at(1) == byte(0)) {
+		if (mDatagramCallback)
+			mDatagramCallback(make_message(message->begin() + DatagramHeaderSize, message->end()));
+
+		return;
+	}
+
+	if (auto c = capture())
+		c->record(CaptureWriter::Type::Sctp, false, *message);
+
+#if RTC_ENABLE_LATENCY_TRACING
+	if (auto tracer = latencyTracer(); tracer && tracer->sample(LatencyTracer::SctpInput)) {
+		const auto start = LatencyTracer::clock::now();
+		usrsctp_conninput(mHandle, message->data(), message->size(), 0);
+		tracer->record(LatencyTracer::SctpInput, start);
+		return;
+	}
+#endif
+	usrsctp_conninput(mHandle, message->data(), message->size(), 0);
 }
 
 bool SctpTransport::outgoing(message_ptr message) {
-	// Set recommended medium-priority DSCP value
+	// Packets are marked like the last message sent by a Data Channel, as they might bundle
+	// chunks of several streams, otherwise set recommended medium-priority DSCP value
 	// See https://datatracker.ietf.org/doc/html/rfc8837#section-5
-	message->dscp = 10; // AF11: Assured Forwarding class 1, low drop probability
+	message->dscp = mOutgoingDscp;
+	if (message->dscp == 0)
+		message->dscp = 10; // AF11: Assured Forwarding class 1, low drop probability
+
 	return Transport::outgoing(std::move(message));
 }
 
@@ -473,7 +821,7 @@ void SctpTransport::doRecv() {
 	std::lock_guard lock(mRecvMutex);
 	--mPendingRecvCount;
 	try {
-		while (state() != State::Disconnected && state() != State::Failed) {
+		while (!mRecvBlocked && state() != State::Disconnected && state() != State::Failed) {
 			const size_t bufferSize = 65536;
 			byte buffer[bufferSize];
 			socklen_t fromlen = 0;
@@ -506,18 +854,49 @@ void SctpTransport::doRecv() {
 				}
 			} else {
 				// SCTP message
-				mPartialMessage.insert(mPartialMessage.end(), buffer, buffer + len);
+				if (infotype != SCTP_RECVV_RCVINFO)
+					throw std::runtime_error("Missing SCTP recv info");
+
+				// With interleaving, partial messages on different streams may be interleaved
+				auto it = mPartialMessages.find(info.rcv_sid);
 				if (flags & MSG_EOR) {
 					// Message is complete, process it
-					if (infotype != SCTP_RECVV_RCVINFO)
-						throw std::runtime_error("Missing SCTP recv info");
-
-					processData(std::move(mPartialMessage), info.rcv_sid,
-					            PayloadId(ntohl(info.rcv_ppid)));
-					mPartialMessage.clear();
+					if (it == mPartialMessages.end()) {
+						processData(binary(buffer, buffer + len), info.rcv_sid,
+						            PayloadId(ntohl(info.rcv_ppid)));
+					} else {
+						binary data = std::move(it->second);
+						mPartialMessages.erase(it);
+						data.insert(data.end(), buffer, buffer + len);
+						processData(std::move(data), info.rcv_sid, PayloadId(ntohl(info.rcv_ppid)));
+					}
+				} else if (it == mPartialMessages.end() && isStreamFragmented(info.rcv_sid)) {
+					// Streamed message, deliver the fragment right away
+					processData(binary(buffer, buffer + len), info.rcv_sid,
+					            PayloadId(ntohl(info.rcv_ppid)), true);
+				} else {
+					// Reserve a bounded first chunk, the buffer then grows geometrically so
+					// reassembly copies less than the message size again in total
+					auto &partial = mPartialMessages[info.rcv_sid];
+					if (partial.empty() && !mCompactMemory)
+						partial.reserve(std::min(mMaxMessageSize,
+						                         std::max(SCTP_REASSEMBLY_RESERVE, size_t(len))));
+
+					partial.insert(partial.end(), buffer, buffer + len);
 				}
 			}
 		}
+
+		if (mMemoryAccount) {
+			size_t reassembly = mPartialNotification.capacity() + mPartialStringData.capacity() +
+			                    mPartialBinaryData.capacity();
+			for (const auto &[sid, partial] : mPartialMessages)
+				reassembly += partial.capacity();
+
+			mMemoryAccount->reassembly = reassembly;
+		}
+
+		tune();
 	} catch (const std::exception &e) {
 		PLOG_WARNING << e.what();
 	}
@@ -528,6 +907,7 @@ void SctpTransport::doFlush() {
 	--mPendingFlushCount;
 	try {
 		trySendQueue();
+		tune();
 	} catch (const std::exception &e) {
 		PLOG_WARNING << e.what();
 	}
@@ -535,18 +915,186 @@ void SctpTransport::doFlush() {
 
 bool SctpTransport::trySendQueue() {
 	// Requires mSendMutex to be locked
-	while (auto next = mSendQueue.peek()) {
-		message_ptr message = std::move(*next);
-		if (!trySendMessage(message))
-			return false;
+	// Queues are drained by decreasing priority, so low priority messages buffered by a bulk
+	// transfer don't delay higher priority ones
+	// Sent amounts are accumulated per stream so the buffered amount is updated, and the callback
+	// called, once per stream for the whole drain instead of once per message.
+	released_map sent;
+	auto updateSent = [&]() {
+		for (auto [streamId, amount] : sent)
+			updateBufferedAmount(streamId, -ptrdiff_t(amount));
+	};
+
+	releaseHeldStreams();
+
+	const auto now = steady_clock::now();
+	auto it = mSendQueues.begin();
+	while (it != mSendQueues.end()) {
+		auto &queue = it->second;
+		while (!queue.empty()) {
+			auto &queued = queue.front();
+			if (isExpired(queued, now)) {
+				dropMessage(queued.message, sent);
+				queue.pop_front();
+				continue;
+			}
+
+			if (holdForStream(queued)) {
+				queue.pop_front();
+				continue;
+			}
 
-		mSendQueue.pop();
-		updateBufferedAmount(to_uint16(message->stream), -ptrdiff_t(message_size_func(message)));
+			message_ptr message = queued.message;
+			if (!trySendMessage(message, queued.reliability)) {
+				// While blocked, expired messages further in the queues are released too
+				if (now - mLastExpiryCheck >= ExpiryCheckInterval)
+					dropExpired(now, sent);
+
+				updateSent();
+				return false;
+			}
+
+			queue.pop_front();
+			sent[to_uint16(message->stream)] += message_size_func(message);
+		}
+		it = mSendQueues.erase(it);
 	}
+
+	updateSent();
+	return true;
+}
+
+bool SctpTransport::holdForStream(QueuedMessage &queued) {
+	// Requires mSendMutex to be locked
+	const uint16_t streamId = to_uint16(queued.message->stream);
+	if (mOutgoingStreams == 0 || streamId < mOutgoingStreams || mAddStreamsRefused)
+		return false;
+
+	addOutgoingStreams(streamId);
+	if (mAddStreamsRefused)
+		return false; // the message is dropped on sending
+
+	// Following messages of the stream are held too, which keeps the order on the stream
+	mHeldStreams[streamId].push_back(std::move(queued));
 	return true;
 }
 
-bool SctpTransport::trySendMessage(message_ptr message) {
+void SctpTransport::releaseHeldStreams() {
+	// Requires mSendMutex to be locked
+	if (mHeldStreams.empty())
+		return;
+
+	// Retry a deferred request, or give up on one which timed out
+	if (!mAddStreamsRefused)
+		addOutgoingStreams(mHeldStreams.rbegin()->first);
+
+	auto it = mHeldStreams.begin();
+	while (it != mHeldStreams.end()) {
+		auto &[streamId, held] = *it;
+		if (streamId >= mOutgoingStreams && !mAddStreamsRefused) {
+			++it;
+			continue;
+		}
+
+		// Later messages of the stream are still queued behind, so held ones go first
+		auto &queue = mSendQueues[queuePriority(streamId)];
+		queue.insert(queue.begin(), std::make_move_iterator(held.begin()),
+		             std::make_move_iterator(held.end()));
+		it = mHeldStreams.erase(it);
+	}
+}
+
+void SctpTransport::enqueue(message_ptr message, optional<StreamReliability> reliability) {
+	// Requires mSendMutex to be locked
+	if (mSendQueueStopped)
+		return;
+
+	const uint16_t priority = queuePriority(to_uint16(message->stream));
+	mSendQueues[priority].push_back({std::move(message), steady_clock::now(), reliability});
+}
+
+uint16_t SctpTransport::queuePriority(uint16_t streamId) {
+	// Requires mSendMutex to be locked
+	auto it = mStreamPriorities.find(streamId);
+	const uint16_t priority = it != mStreamPriorities.end() ? it->second : RTC_PRIORITY_LOW;
+
+	// After a priority change, messages of the stream keep going to the previous queue while it
+	// still holds some of them, so the new priority never reorders the stream
+	auto pit = mPreviousPriorities.find(streamId);
+	if (pit == mPreviousPriorities.end())
+		return priority;
+
+	if (auto qit = mSendQueues.find(pit->second); qit != mSendQueues.end()) {
+		const auto &queue = qit->second;
+		// The latest messages are the most likely to belong to the stream
+		if (std::any_of(queue.rbegin(), queue.rend(), [streamId](const QueuedMessage &queued) {
+			    return to_uint16(queued.message->stream) == streamId;
+		    }))
+			return pit->second;
+	}
+
+	mPreviousPriorities.erase(pit);
+	return priority;
+}
+
+bool SctpTransport::isExpired(const QueuedMessage &queued, steady_clock::time_point now) const {
+	// Requires mSendMutex to be locked
+	// Only a timed lifetime can expire before sending, as a message with limited retransmissions
+	// must still be transmitted once. Streamed messages are never cut short.
+	const auto &message = queued.message;
+	if (message->type != Message::Binary && message->type != Message::String)
+		return false;
+
+	const uint16_t streamId = to_uint16(message->stream);
+	if (message->incomplete || mIncompleteStreams.count(streamId))
+		return false;
+
+	StreamReliability reliability;
+	if (queued.reliability)
+		reliability = *queued.reliability;
+	else if (streamId < mStreamReliabilities.size())
+		reliability = mStreamReliabilities[streamId];
+
+	return reliability.policy == SCTP_PR_SCTP_TTL && reliability.value > 0 &&
+	       now - queued.time > milliseconds(reliability.value);
+}
+
+void SctpTransport::dropExpired(steady_clock::time_point now, released_map &released) {
+	// Requires mSendMutex to be locked
+	mLastExpiryCheck = now;
+	for (auto &[priority, queue] : mSendQueues) {
+		// The end of a streamed message must follow its fragments
+		std::set<uint16_t> streaming;
+		auto expired = [&](const QueuedMessage &queued) {
+			const uint16_t streamId = to_uint16(queued.message->stream);
+			if (queued.message->incomplete)
+				streaming.insert(streamId);
+			else if (streaming.count(streamId))
+				return false;
+
+			if (!isExpired(queued, now))
+				return false;
+
+			dropMessage(queued.message, released);
+			return true;
+		};
+		queue.erase(std::remove_if(queue.begin(), queue.end(), expired), queue.end());
+	}
+}
+
+void SctpTransport::dropMessage(const message_ptr &message, released_map &released) {
+	// Requires mSendMutex to be locked
+	// Stale data never reaches usrsctp, so it takes neither the congestion window nor a TSN which
+	// would have to be skipped with FORWARD-TSN
+	const uint16_t streamId = to_uint16(message->stream);
+	PLOG_VERBOSE << "SCTP message expired in queue, stream=" << streamId;
+	++mAbandonedQueued[streamId];
+	++mTotalAbandonedQueued;
+	released[streamId] += message_size_func(message);
+}
+
+bool SctpTransport::trySendMessage(message_ptr message,
+                                   const optional<StreamReliability> &messageReliability) {
 	// Requires mSendMutex to be locked
 	if (!mSock || state() != State::Connected)
 		return false;
@@ -554,10 +1102,10 @@ bool SctpTransport::trySendMessage(message_ptr message) {
 	uint32_t ppid;
 	switch (message->type) {
 	case Message::String:
-		ppid = !message->empty() ? PPID_STRING : PPID_STRING_EMPTY;
+		ppid = message->payloadSize() > 0 ? PPID_STRING : PPID_STRING_EMPTY;
 		break;
 	case Message::Binary:
-		ppid = !message->empty() ? PPID_BINARY : PPID_BINARY_EMPTY;
+		ppid = message->payloadSize() > 0 ? PPID_BINARY : PPID_BINARY_EMPTY;
 		break;
 	case Message::Control:
 		ppid = PPID_CONTROL;
@@ -570,12 +1118,54 @@ bool SctpTransport::trySendMessage(message_ptr message) {
 		return true;
 	}
 
-	PLOG_VERBOSE << "SCTP try send size=" << message->size();
+	const uint16_t streamId = uint16_t(message->stream);
+	if (mOutgoingStreams > 0 && streamId >= mOutgoingStreams) {
+		if (!mAddStreamsRefused)
+			addOutgoingStreams(streamId);
 
-	// TODO: Implement SCTP ndata specification draft when supported everywhere
-	// See https://tools.ietf.org/html/draft-ietf-tsvwg-sctp-ndata-08
+		// Following messages wait for the streams to be added, to keep the order
+		if (!mAddStreamsRefused)
+			return false;
 
-	const Reliability reliability = message->reliability ? *message->reliability : Reliability();
+		// The channel can't be used, close it like if the peer had reset the stream
+		PLOG_WARNING << "Dropping message on SCTP stream " << streamId << " beyond the "
+		             << mOutgoingStreams << " available streams";
+		if (mUnavailableStreams.insert(streamId).second)
+			mProcessor.enqueue([this, streamId]() {
+				const byte dataChannelCloseMessage{0x04};
+				recv(make_message(&dataChannelCloseMessage, &dataChannelCloseMessage + 1,
+				                  Message::Control, streamId));
+			});
+
+		return true;
+	}
+
+	if (message->incomplete && !mExplicitEor)
+		throw std::logic_error("Streamed messages require SCTP message interleaving");
+
+	// A streamed message must not be terminated early by an empty message PPID
+	const bool continued = mIncompleteStreams.count(uint16_t(message->stream)) > 0;
+	if (message->incomplete || continued) {
+		if (message->payloadSize() == 0 && message->incomplete)
+			return true; // nothing to send
+
+		if (ppid == PPID_STRING_EMPTY)
+			ppid = PPID_STRING;
+		else if (ppid == PPID_BINARY_EMPTY)
+			ppid = PPID_BINARY;
+	}
+
+	PLOG_VERBOSE << "SCTP try send size=" << message->payloadSize();
+
+	// Control messages are always sent reliably and in order, the reliability given for a message
+	// overrides the one of its stream
+	StreamReliability reliability;
+	if (message->type != Message::Control) {
+		if (messageReliability)
+			reliability = *messageReliability;
+		else if (streamId < mStreamReliabilities.size())
+			reliability = mStreamReliabilities[streamId];
+	}
 
 	struct sctp_sendv_spa spa = {};
 
@@ -583,33 +1173,29 @@ bool SctpTransport::trySendMessage(message_ptr message) {
 	spa.sendv_flags |= SCTP_SEND_SNDINFO_VALID;
 	spa.sendv_sndinfo.snd_sid = uint16_t(message->stream);
 	spa.sendv_sndinfo.snd_ppid = htonl(ppid);
-	spa.sendv_sndinfo.snd_flags |= SCTP_EOR; // implicit here
+	if (!message->incomplete)
+		spa.sendv_sndinfo.snd_flags |= SCTP_EOR;
 
 	// set prinfo
 	spa.sendv_flags |= SCTP_SEND_PRINFO_VALID;
-	if (reliability.unordered)
-		spa.sendv_sndinfo.snd_flags |= SCTP_UNORDERED;
+	spa.sendv_sndinfo.snd_flags |= reliability.flags;
+	spa.sendv_prinfo.pr_policy = reliability.policy;
+	spa.sendv_prinfo.pr_value = reliability.value;
 
-	switch (reliability.type) {
-	case Reliability::Type::Rexmit:
-		spa.sendv_flags |= SCTP_SEND_PRINFO_VALID;
-		spa.sendv_prinfo.pr_policy = SCTP_PR_SCTP_RTX;
-		spa.sendv_prinfo.pr_value = to_uint32(std::get<int>(reliability.rexmit));
-		break;
-	case Reliability::Type::Timed:
-		spa.sendv_flags |= SCTP_SEND_PRINFO_VALID;
-		spa.sendv_prinfo.pr_policy = SCTP_PR_SCTP_TTL;
-		spa.sendv_prinfo.pr_value = to_uint32(std::get<milliseconds>(reliability.rexmit).count());
-		break;
-	default:
-		spa.sendv_prinfo.pr_policy = SCTP_PR_SCTP_NONE;
-		break;
-	}
+	if (mCompactMemory)
+		growSendBuffer(message->payloadSize());
+
+	if (message->type != Message::Control)
+		mOutgoingDscp = message->dscp;
 
 	ssize_t ret;
-	if (!message->empty()) {
-		ret = usrsctp_sendv(mSock, message->data(), message->size(), nullptr, 0, &spa, sizeof(spa),
-		                    SCTP_SENDV_SPA, 0);
+	if (message->payloadSize() > 0) {
+		// The payload may be an external buffer, usrsctp copies it to its own chunks
+		ret = usrsctp_sendv(mSock, message->payload(), message->payloadSize(), nullptr, 0, &spa,
+		                    sizeof(spa), SCTP_SENDV_SPA, 0);
+	} else if (continued) {
+		// Terminate the streamed message
+		ret = usrsctp_sendv(mSock, nullptr, 0, nullptr, 0, &spa, sizeof(spa), SCTP_SENDV_SPA, 0);
 	} else {
 		const char zero = 0;
 		ret = usrsctp_sendv(mSock, &zero, 1, nullptr, 0, &spa, sizeof(spa), SCTP_SENDV_SPA, 0);
@@ -625,9 +1211,20 @@ bool SctpTransport::trySendMessage(message_ptr message) {
 		throw std::runtime_error("Sending failed, errno=" + std::to_string(errno));
 	}
 
-	PLOG_VERBOSE << "SCTP sent size=" << message->size();
+	if (message->incomplete)
+		mIncompleteStreams.insert(uint16_t(message->stream));
+	else if (continued)
+		mIncompleteStreams.erase(uint16_t(message->stream));
+
+	PLOG_VERBOSE << "SCTP sent size=" << message->payloadSize();
 	if (message->type == Message::Binary || message->type == Message::String)
-		mBytesSent += message->size();
+		mBytesSent += message->payloadSize();
+
+#if RTC_ENABLE_LATENCY_TRACING
+	if (message->traceTime)
+		if (auto tracer = latencyTracer())
+			tracer->record(LatencyTracer::SctpQueue, *message->traceTime);
+#endif
 	return true;
 }
 
@@ -637,12 +1234,17 @@ void SctpTransport::updateBufferedAmount(uint16_t streamId, ptrdiff_t delta) {
 	if (delta == 0)
 		return;
 
-	auto it = mBufferedAmount.insert(std::make_pair(streamId, 0)).first;
-	size_t amount = size_t(std::max(ptrdiff_t(it->second) + delta, ptrdiff_t(0)));
-	if (amount == 0)
-		mBufferedAmount.erase(it);
-	else
-		it->second = amount;
+	// Stream ids are allocated densely from 0, so a flat table stays small
+	if (streamId >= mBufferedAmount.size())
+		mBufferedAmount.resize(size_t(streamId) + 1, 0);
+
+	size_t &current = mBufferedAmount[streamId];
+	size_t amount = size_t(std::max(ptrdiff_t(current) + delta, ptrdiff_t(0)));
+	mTotalBufferedAmount += amount - current; // modular arithmetic handles decreases
+	if (mMemoryAccount)
+		mMemoryAccount->sendQueue += amount - current;
+
+	current = amount;
 
 	// Synchronously call the buffered amount callback
 	triggerBufferedAmount(streamId, amount);
@@ -656,8 +1258,107 @@ void SctpTransport::triggerBufferedAmount(uint16_t streamId, size_t amount) {
 	}
 }
 
+void SctpTransport::setStreamPriority(uint16_t stream, uint16_t priority) {
+	std::lock_guard lock(mSendMutex);
+	// Queued messages are not moved, the new priority applies to messages enqueued afterwards
+	const uint16_t previous = queuePriority(stream);
+	if (previous != priority && mSendQueues.count(previous))
+		mPreviousPriorities[stream] = previous;
+	else
+		mPreviousPriorities.erase(stream);
+
+	if (priority != RTC_PRIORITY_LOW)
+		mStreamPriorities[stream] = priority;
+	else
+		mStreamPriorities.erase(stream);
+
+	if (!mSock)
+		return;
+
+	// The usrsctp priority scheduler sends streams with lower values first
+	struct sctp_stream_value sv = {};
+	sv.stream_id = stream;
+	sv.stream_value = uint16_t(0xFFFF - priority);
+	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_SS_VALUE, &sv, sizeof(sv))) {
+		PLOG_WARNING << "Could not set SCTP priority for stream " << stream << ", errno=" << errno;
+	}
+}
+
+SctpTransport::StreamReliability
+SctpTransport::ToStreamReliability(const Reliability &reliability) {
+	StreamReliability sr;
+	sr.flags = reliability.unordered ? SCTP_UNORDERED : 0;
+	switch (reliability.type) {
+	case Reliability::Type::Rexmit:
+		sr.policy = SCTP_PR_SCTP_RTX;
+		sr.value = to_uint32(std::max(std::get<int>(reliability.rexmit), 0));
+		break;
+	case Reliability::Type::Timed:
+		sr.policy = SCTP_PR_SCTP_TTL;
+		sr.value = to_uint32(std::get<milliseconds>(reliability.rexmit).count());
+		break;
+	default:
+		sr.policy = SCTP_PR_SCTP_NONE;
+		sr.value = 0;
+		break;
+	}
+	return sr;
+}
+
+void SctpTransport::setStreamReliability(uint16_t stream, const Reliability &reliability) {
+	const StreamReliability sr = ToStreamReliability(reliability);
+	std::lock_guard lock(mSendMutex);
+	if (stream >= mStreamReliabilities.size())
+		mStreamReliabilities.resize(size_t(stream) + 1);
+
+	mStreamReliabilities[stream] = sr;
+}
+
+void SctpTransport::setStreamFragmented(uint16_t stream, bool enabled) {
+	std::lock_guard lock(mFragmentedMutex);
+	if (enabled)
+		mFragmentedStreams.insert(stream);
+	else
+		mFragmentedStreams.erase(stream);
+}
+
+void SctpTransport::setStreamBlocked(uint16_t stream, bool blocked) {
+	std::lock_guard lock(mBlockedMutex);
+	if (blocked) {
+		if (mBlockedStreams.insert(stream).second) {
+			PLOG_DEBUG << "SCTP receiving blocked by stream " << stream;
+		}
+
+		mRecvBlocked = true;
+		return;
+	}
+
+	if (mBlockedStreams.erase(stream) == 0 || !mBlockedStreams.empty())
+		return;
+
+	PLOG_DEBUG << "SCTP receiving unblocked";
+	mRecvBlocked = false;
+
+	// Data might be waiting in the socket without any new upcall
+	if (mPendingRecvCount == 0) {
+		++mPendingRecvCount;
+		mProcessor.enqueue(&SctpTransport::doRecv, this);
+	}
+}
+
+bool SctpTransport::isStreamFragmented(uint16_t streamId) {
+	std::lock_guard lock(mFragmentedMutex);
+	return mFragmentedStreams.count(streamId) > 0;
+}
+
 void SctpTransport::sendReset(uint16_t streamId) {
 	// Requires mSendMutex to be locked
+	mStreamPriorities.erase(streamId);
+	mIncompleteStreams.erase(streamId);
+	mAbandonedQueued.erase(streamId);
+	if (streamId < mStreamReliabilities.size())
+		mStreamReliabilities[streamId] = StreamReliability{};
+
 	if (!mSock || state() != State::Connected)
 		return;
 
@@ -683,6 +1384,46 @@ void SctpTransport::sendReset(uint16_t streamId) {
 	}
 }
 
+void SctpTransport::addOutgoingStreams(uint16_t streamId) {
+	// Requires mSendMutex to be locked
+	const auto now = steady_clock::now();
+	if (mAddingStreamsSince) {
+		if (now - *mAddingStreamsSince < AddStreamsTimeout)
+			return; // already in flight
+
+		PLOG_WARNING << "SCTP adding streams timed out";
+		mAddingStreamsSince.reset();
+		mAddStreamsRefused = true;
+		return;
+	}
+
+	// Double the count to amortize the round trips when many channels are opened
+	const unsigned int target =
+	    std::min(std::max(unsigned(streamId) + 1, 2 * unsigned(mOutgoingStreams)), 65535u);
+
+	PLOG_DEBUG << "SCTP adding " << (target - mOutgoingStreams) << " outgoing streams";
+
+	struct sctp_add_streams sas = {};
+	sas.sas_outstrms = uint16_t(target - mOutgoingStreams);
+	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_ADD_STREAMS, &sas, sizeof(sas)) == 0) {
+		mAddingStreamsSince = now;
+
+		// Waiting messages must not stay blocked if the request is never answered
+		auto retry = [handle = mHandle, generation = mHandle->generation()]() {
+			if (auto locked = handle->lock(generation))
+				handle->transport()->flush();
+		};
+		ThreadPool::Instance().schedule(AddStreamsTimeout + TimerTick, std::move(retry));
+	} else if (errno == EBUSY || errno == EALREADY) {
+		// Only one reconfiguration request may be in flight, try again when the reset is done
+		PLOG_VERBOSE << "SCTP adding streams deferred";
+		mAddStreamsDeferred = true;
+	} else {
+		PLOG_WARNING << "SCTP adding streams failed, errno=" << errno;
+		mAddStreamsRefused = true;
+	}
+}
+
 void SctpTransport::handleUpcall() {
 	if (!mSock)
 		return;
@@ -691,15 +1432,21 @@ void SctpTransport::handleUpcall() {
 
 	int events = usrsctp_get_events(mSock);
 
+	// Hand all resulting tasks to the processor at once
+	std::array<Task, 2> tasks;
+	size_t count = 0;
+
 	if (events & SCTP_EVENT_READ && mPendingRecvCount == 0) {
 		++mPendingRecvCount;
-		mProcessor.enqueue(&SctpTransport::doRecv, this);
+		tasks[count++] = [this]() { doRecv(); };
 	}
 
 	if (events & SCTP_EVENT_WRITE && mPendingFlushCount == 0) {
 		++mPendingFlushCount;
-		mProcessor.enqueue(&SctpTransport::doFlush, this);
+		tasks[count++] = [this]() { doFlush(); };
 	}
+
+	mProcessor.enqueueBatch(tasks.begin(), tasks.begin() + count);
 }
 
 int SctpTransport::handleWrite(byte *data, size_t len, uint8_t /*tos*/, uint8_t /*set_df*/) {
@@ -707,6 +1454,16 @@ int SctpTransport::handleWrite(byte *data, size_t len, uint8_t /*tos*/, uint8_t
 		std::unique_lock lock(mWriteMutex);
 		PLOG_VERBOSE << "Handle write, len=" << len;
 
+		if (len >= SctpHeaderSize) {
+			uint32_t tag; // in network byte order
+			std::memcpy(&tag, data + 4, sizeof(tag));
+			if (tag != 0) // INIT chunks have no verification tag
+				mRemoteVerificationTag = tag;
+		}
+
+		if (auto c = capture())
+			c->record(CaptureWriter::Type::Sctp, true, data, len);
+
 		if (!outgoing(make_message(data, data + len)))
 			return -1;
 
@@ -721,7 +1478,124 @@ int SctpTransport::handleWrite(byte *data, size_t len, uint8_t /*tos*/, uint8_t
 	return 0; // success
 }
 
-void SctpTransport::processData(binary &&data, uint16_t sid, PayloadId ppid) {
+void SctpTransport::sendMtuProbe(uint32_t id, size_t size) {
+	const uint32_t tag = mRemoteVerificationTag;
+	if (state() != State::Connected || tag == 0)
+		return;
+
+	// The probe is padded to a multiple of 4 bytes
+	const size_t len = (size - SctpPacketOverhead) & ~size_t(3);
+	binary packet(len, byte(0));
+	auto write16 = [&packet](size_t offset, uint16_t value) {
+		value = htons(value);
+		std::memcpy(packet.data() + offset, &value, sizeof(value));
+	};
+	auto write32 = [&packet](size_t offset, uint32_t value) {
+		value = htonl(value);
+		std::memcpy(packet.data() + offset, &value, sizeof(value));
+	};
+
+	// Common header
+	write16(0, mPort);
+	write16(2, mPort);
+	std::memcpy(packet.data() + 4, &tag, sizeof(tag));
+
+	// HEARTBEAT chunk
+	size_t offset = SctpHeaderSize;
+	packet[offset] = byte(SctpChunkHeartbeat);
+	write16(offset + 2, uint16_t(ProbeChunkSize));
+	write16(offset + 4, SctpHeartbeatInfo);
+	write16(offset + 6, uint16_t(ProbeChunkSize - 4));
+	write32(offset + 8, ProbeMagic);
+	write32(offset + 12, id);
+
+	// PAD chunk
+	offset += ProbeChunkSize;
+	packet[offset] = byte(SctpChunkPad);
+	write16(offset + 2, uint16_t(len - offset));
+
+	const uint32_t checksum = Crc32c(packet.data(), packet.size());
+	std::memcpy(packet.data() + 8, &checksum, sizeof(checksum));
+
+	std::lock_guard lock(mWriteMutex);
+	outgoing(make_message(std::move(packet)));
+}
+
+bool SctpTransport::sendDatagram(const binary &data) {
+	if (state() != State::Connected)
+		return false;
+
+	auto message = make_message(DatagramHeaderSize + data.size());
+	std::copy(data.begin(), data.end(), message->begin() + DatagramHeaderSize);
+
+	std::lock_guard lock(mWriteMutex);
+	return outgoing(std::move(message));
+}
+
+bool SctpTransport::processMtuProbeAck(const binary &packet) {
+	// Returns true if the packet only contains acknowledgements of our probes
+	auto read16 = [&packet](size_t offset) {
+		uint16_t value;
+		std::memcpy(&value, packet.data() + offset, sizeof(value));
+		return ntohs(value);
+	};
+	auto read32 = [&packet](size_t offset) {
+		uint32_t value;
+		std::memcpy(&value, packet.data() + offset, sizeof(value));
+		return ntohl(value);
+	};
+
+	bool acknowledged = false, other = false;
+	size_t offset = SctpHeaderSize;
+	while (offset + 4 <= packet.size()) {
+		const uint16_t length = read16(offset + 2);
+		if (length < 4 || offset + length > packet.size())
+			break;
+
+		if (std::to_integer<uint8_t>(packet[offset]) == SctpChunkHeartbeatAck &&
+		    length == ProbeChunkSize && read16(offset + 4) == SctpHeartbeatInfo &&
+		    read32(offset + 8) == ProbeMagic) {
+			mPathMtuDiscovery->acknowledge(read32(offset + 12));
+			acknowledged = true;
+		} else {
+			other = true;
+		}
+
+		offset += (size_t(length) + 3) & ~size_t(3);
+	}
+	return acknowledged && !other;
+}
+
+void SctpTransport::setPathMtu(size_t mtu) {
+	if (!mSock)
+		return;
+
+	struct sctp_paddrparams spp = {};
+	spp.spp_flags = SPP_PMTUD_DISABLE;
+	spp.spp_pathmtu = to_uint32(mtu - SctpHeaderSize - SctpPacketOverhead);
+	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_PEER_ADDR_PARAMS, &spp, sizeof(spp))) {
+		PLOG_WARNING << "Could not set SCTP path MTU, errno=" << errno;
+		return;
+	}
+
+	PLOG_DEBUG << "SCTP MTU set to " << spp.spp_pathmtu;
+}
+
+optional<size_t> SctpTransport::pathMtu() const {
+	if (!mPathMtuDiscovery)
+		return nullopt;
+
+	return mPathMtuDiscovery->mtu();
+}
+
+#if RTC_ENABLE_LATENCY_TRACING
+void SctpTransport::traceDelivery(const message_ptr &message) {
+	if (auto tracer = latencyTracer(); tracer && tracer->sample(LatencyTracer::Delivery))
+		message->traceTime = LatencyTracer::clock::now();
+}
+#endif
+
+void SctpTransport::processData(binary &&data, uint16_t sid, PayloadId ppid, bool incomplete) {
 	PLOG_VERBOSE << "Process data, size=" << data.size();
 
 	// RFC 8831: The usage of the PPIDs "WebRTC String Partial" and "WebRTC Binary Partial" is
@@ -741,7 +1615,12 @@ void SctpTransport::processData(binary &&data, uint16_t sid, PayloadId ppid) {
 	case PPID_STRING:
 		if (mPartialStringData.empty()) {
 			mBytesReceived += data.size();
-			recv(make_message(std::move(data), Message::String, sid));
+			auto message = make_message(std::move(data), Message::String, sid);
+			message->incomplete = incomplete;
+#if RTC_ENABLE_LATENCY_TRACING
+			traceDelivery(message);
+#endif
+			recv(std::move(message));
 		} else {
 			mPartialStringData.insert(mPartialStringData.end(), data.begin(), data.end());
 			mBytesReceived += mPartialStringData.size();
@@ -762,7 +1641,12 @@ void SctpTransport::processData(binary &&data, uint16_t sid, PayloadId ppid) {
 	case PPID_BINARY:
 		if (mPartialBinaryData.empty()) {
 			mBytesReceived += data.size();
-			recv(make_message(std::move(data), Message::Binary, sid));
+			auto message = make_message(std::move(data), Message::Binary, sid);
+			message->incomplete = incomplete;
+#if RTC_ENABLE_LATENCY_TRACING
+			traceDelivery(message);
+#endif
+			recv(std::move(message));
 		} else {
 			mPartialBinaryData.insert(mPartialBinaryData.end(), data.begin(), data.end());
 			mBytesReceived += mPartialBinaryData.size();
@@ -784,6 +1668,28 @@ void SctpTransport::processData(binary &&data, uint16_t sid, PayloadId ppid) {
 	}
 }
 
+void SctpTransport::enableExplicitEor(sctp_assoc_t assocId) {
+	// Messages are terminated explicitly, so streamed messages can be sent in fragments. Without
+	// I-DATA, a partial message would block the other streams until it is complete.
+	struct sctp_assoc_value av = {};
+	av.assoc_id = assocId;
+	socklen_t len = sizeof(av);
+	if (usrsctp_getsockopt(mSock, IPPROTO_SCTP, SCTP_INTERLEAVING_SUPPORTED, &av, &len) != 0 ||
+	    !av.assoc_value) {
+		PLOG_DEBUG << "SCTP message interleaving is not negotiated, streaming is disabled";
+		return;
+	}
+
+	int explicitEor = 1;
+	if (usrsctp_setsockopt(mSock, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &explicitEor,
+	                       sizeof(explicitEor))) {
+		PLOG_WARNING << "Could not set socket option SCTP_EXPLICIT_EOR, errno=" << errno;
+		return;
+	}
+
+	mExplicitEor = true;
+}
+
 void SctpTransport::processNotification(const union sctp_notification *notify, size_t len) {
 	if (len != size_t(notify->sn_header.sn_length)) {
 		COUNTER_BAD_NOTIF_LEN++;
@@ -798,7 +1704,14 @@ void SctpTransport::processNotification(const union sctp_notification *notify, s
 		const struct sctp_assoc_change &assoc_change = notify->sn_assoc_change;
 		if (assoc_change.sac_state == SCTP_COMM_UP) {
 			PLOG_INFO << "SCTP connected";
+			{
+				std::lock_guard lock(mSendMutex);
+				mOutgoingStreams = assoc_change.sac_outbound_streams;
+			}
+			enableExplicitEor(assoc_change.sac_assoc_id);
 			changeState(State::Connected);
+			if (mPathMtuDiscovery)
+				mPathMtuDiscovery->start();
 		} else {
 			if (state() == State::Connecting) {
 				PLOG_ERROR << "SCTP connection failed";
@@ -807,7 +1720,15 @@ void SctpTransport::processNotification(const union sctp_notification *notify, s
 				PLOG_INFO << "SCTP disconnected";
 				changeState(State::Disconnected);
 			}
+			mAssociationClosed = true;
 			mWrittenCondition.notify_all();
+
+			// Stopping joins the processor running this, so the callback must be posted
+			std::unique_lock lock(mShutdownMutex);
+			if (auto callback = std::exchange(mShutdownCallback, nullptr)) {
+				lock.unlock();
+				ThreadPool::Instance().post(std::move(callback));
+			}
 		}
 		break;
 	}
@@ -857,10 +1778,34 @@ void SctpTransport::processNotification(const union sctp_notification *notify, s
 			const byte dataChannelCloseMessage{0x04};
 			for (int i = 0; i < count; ++i) {
 				uint16_t streamId = reset_event.strreset_stream_list[i];
+				mPartialMessages.erase(streamId);
 				recv(make_message(&dataChannelCloseMessage, &dataChannelCloseMessage + 1,
 				                  Message::Control, streamId));
 			}
 		}
+
+		if (mAddStreamsDeferred.exchange(false))
+			flush();
+
+		break;
+	}
+
+	case SCTP_STREAM_CHANGE_EVENT: {
+		const struct sctp_stream_change_event &change_event = notify->sn_strchange_event;
+		const uint16_t flags = change_event.strchange_flags;
+		PLOG_DEBUG << "SCTP streams changed, incoming=" << change_event.strchange_instrms
+		           << ", outgoing=" << change_event.strchange_outstrms;
+		{
+			std::lock_guard lock(mSendMutex);
+			mAddingStreamsSince.reset();
+			mOutgoingStreams = change_event.strchange_outstrms;
+			if (flags & (SCTP_STREAM_CHANGE_DENIED | SCTP_STREAM_CHANGE_FAILED)) {
+				PLOG_WARNING << "SCTP peer refused to add streams";
+				mAddStreamsRefused = true;
+			}
+		}
+		// Send the messages waiting for the streams, or drop them if refused
+		flush();
 		break;
 	}
 
@@ -879,6 +1824,175 @@ size_t SctpTransport::bytesSent() { return mBytesSent; }
 
 size_t SctpTransport::bytesReceived() { return mBytesReceived; }
 
+size_t SctpTransport::bufferedAmount() const { return mTotalBufferedAmount; }
+
+size_t SctpTransport::sendThroughput() {
+	tune();
+	return mSendThroughput;
+}
+
+size_t SctpTransport::receiveThroughput() {
+	tune();
+	return mReceiveThroughput;
+}
+
+optional<SctpStats> SctpTransport::stats() {
+	if (!mSock || state() != State::Connected)
+		return nullopt;
+
+	struct sctp_status status = {};
+	socklen_t len = sizeof(status);
+	if (usrsctp_getsockopt(mSock, IPPROTO_SCTP, SCTP_STATUS, &status, &len)) {
+		COUNTER_BAD_SCTP_STATUS++;
+		return nullopt;
+	}
+
+	SctpStats stats;
+	stats.congestionWindow = status.sstat_primary.spinfo_cwnd;
+	stats.peerReceiveWindow = status.sstat_rwnd;
+	stats.unackedChunks = status.sstat_unackdata;
+	stats.pendingChunks = status.sstat_penddata;
+	stats.mtu = status.sstat_primary.spinfo_mtu;
+	stats.rtt = milliseconds(status.sstat_primary.spinfo_srtt);
+	stats.rto = milliseconds(status.sstat_primary.spinfo_rto);
+
+	struct sctp_prstatus prstatus = {};
+	prstatus.sprstat_policy = SCTP_PR_SCTP_ALL;
+	len = sizeof(prstatus);
+	if (usrsctp_getsockopt(mSock, IPPROTO_SCTP, SCTP_PR_ASSOC_STATUS, &prstatus, &len) == 0) {
+		stats.abandonedUnsent = prstatus.sprstat_abandoned_unsent;
+		stats.abandonedSent = prstatus.sprstat_abandoned_sent;
+	}
+
+	struct sctpstat global = {};
+	usrsctp_get_stat(&global);
+	stats.retransmissions = global.sctps_markedretrans;
+
+	std::lock_guard lock(mSendMutex);
+	for (const auto &[priority, queue] : mSendQueues)
+		stats.queuedMessages += queue.size();
+
+	for (const auto &[streamId, held] : mHeldStreams)
+		stats.queuedMessages += held.size();
+
+	stats.abandonedQueued = mTotalAbandonedQueued;
+
+	stats.bufferedAmount = mTotalBufferedAmount;
+	return stats;
+}
+
+DataChannelStats SctpTransport::streamStats(uint16_t stream) {
+	DataChannelStats stats;
+	if (mSock && state() == State::Connected) {
+		struct sctp_prstatus prstatus = {};
+		prstatus.sprstat_sid = stream;
+		prstatus.sprstat_policy = SCTP_PR_SCTP_ALL;
+		socklen_t len = sizeof(prstatus);
+		if (usrsctp_getsockopt(mSock, IPPROTO_SCTP, SCTP_PR_STREAM_STATUS, &prstatus, &len) ==
+		    0) {
+			stats.abandonedUnsent = prstatus.sprstat_abandoned_unsent;
+			stats.abandonedSent = prstatus.sprstat_abandoned_sent;
+		}
+	}
+
+	std::lock_guard lock(mSendMutex);
+	auto it = mStreamPriorities.find(stream);
+	auto qit = mSendQueues.find(it != mStreamPriorities.end() ? it->second : RTC_PRIORITY_LOW);
+	if (qit != mSendQueues.end()) {
+		// Queues are not indexed by stream, but they are short unless the association is blocked
+		const auto &queue = qit->second;
+		stats.queuedMessages = size_t(
+		    std::count_if(queue.begin(), queue.end(), [stream](const QueuedMessage &queued) {
+			    return queued.message->stream == stream;
+		    }));
+	}
+
+	if (auto hit = mHeldStreams.find(stream); hit != mHeldStreams.end())
+		stats.queuedMessages += hit->second.size();
+
+	if (auto ait = mAbandonedQueued.find(stream); ait != mAbandonedQueued.end())
+		stats.abandonedQueued = ait->second;
+
+	stats.bufferedAmount = stream < mBufferedAmount.size() ? mBufferedAmount[stream] : 0;
+	return stats;
+}
+
+void SctpTransport::tune() {
+	std::unique_lock lock(mTuningMutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return; // already tuning
+
+	const auto now = steady_clock::now();
+	const auto elapsed = duration<double>(now - mLastTuningTime).count();
+	if (elapsed < 0.5)
+		return;
+
+	// Measure throughput with a moving average, stats might have been cleared
+	auto rate = [elapsed](size_t current, size_t last) {
+		return current >= last ? size_t(double(current - last) / elapsed) : 0;
+	};
+	const size_t sent = mBytesSent, received = mBytesReceived;
+	mSendThroughput = (mSendThroughput + rate(sent, mLastBytesSent)) / 2;
+	mReceiveThroughput = (mReceiveThroughput + rate(received, mLastBytesReceived)) / 2;
+	mLastBytesSent = sent;
+	mLastBytesReceived = received;
+	mLastTuningTime = now;
+
+	if (!mAutoBufferSize && !mTargetBitrate)
+		return;
+
+	auto currentRtt = rtt();
+	if (!currentRtt || currentRtt->count() == 0)
+		return;
+
+	// Buffers must be at least the bandwidth-delay product to keep the link busy, use twice that
+	// to accommodate retransmissions. When a transfer is limited by the buffer, the measured
+	// throughput is the buffer size per RTT, so sizing from it doubles the buffer at each step.
+	const double rttSeconds = duration<double>(*currentRtt).count();
+	size_t sendTarget = 0, recvTarget = 0;
+	if (mTargetBitrate)
+		sendTarget = recvTarget = size_t(2 * double(*mTargetBitrate) / 8 * rttSeconds);
+
+	if (mAutoBufferSize) {
+		sendTarget = std::max(sendTarget, size_t(2 * double(mSendThroughput) * rttSeconds));
+		recvTarget = std::max(recvTarget, size_t(2 * double(mReceiveThroughput) * rttSeconds));
+	}
+
+	// Under overload, buffers grow half as much, so less data waits for the workers
+	if (OverloadController::Instance().atLeast(OverloadLevel::ReduceSctpBuffers)) {
+		sendTarget /= 2;
+		recvTarget /= 2;
+	}
+
+	setBufferSize(SO_SNDBUF, mSendBufferSize, sendTarget);
+	setBufferSize(SO_RCVBUF, mRecvBufferSize, recvTarget);
+}
+
+void SctpTransport::setBufferSize(int option, size_t &current, size_t target) {
+	// Requires mTuningMutex to be locked
+	// Buffers are only grown, shrinking them while data is in flight is pointless
+	target = std::min(target, mMaxBufferSize);
+	if (target <= current)
+		return;
+
+	int size = int(std::min(target, size_t(std::numeric_limits<int>::max())));
+	if (usrsctp_setsockopt(mSock, SOL_SOCKET, option, &size, sizeof(size))) {
+		PLOG_WARNING << "Could not resize SCTP buffer, errno=" << errno;
+		return;
+	}
+
+	PLOG_DEBUG << "SCTP " << (option == SO_SNDBUF ? "send" : "recv")
+	           << " buffer size set to " << size;
+	current = target;
+}
+
+void SctpTransport::growSendBuffer(size_t size) {
+	// usrsctp rejects messages larger than the send buffer
+	std::lock_guard lock(mTuningMutex);
+	if (size > mSendBufferSize)
+		setBufferSize(SO_SNDBUF, mSendBufferSize, std::max(size, 2 * mSendBufferSize));
+}
+
 optional<milliseconds> SctpTransport::rtt() {
 	if (!mSock || state() != State::Connected)
 		return nullopt;
@@ -894,28 +2008,39 @@ optional<milliseconds> SctpTransport::rtt() {
 }
 
 void SctpTransport::UpcallCallback(struct socket *, void *arg, int /* flags */) {
-	auto *transport = static_cast<SctpTransport *>(arg);
+	auto *handle = static_cast<Handle *>(arg);
 
-	if (auto locked = Instances->lock(transport))
-		transport->handleUpcall();
+	if (auto locked = handle->lock())
+		handle->transport()->handleUpcall();
 }
 
 int SctpTransport::WriteCallback(void *ptr, void *data, size_t len, uint8_t tos, uint8_t set_df) {
-	auto *transport = static_cast<SctpTransport *>(ptr);
-
-	// Set the CRC32 ourselves as we have enabled CRC32 offloading
-	if (len >= 12) {
-		uint32_t *checksum = reinterpret_cast<uint32_t *>(data) + 2;
-		*checksum = 0;
-		*checksum = usrsctp_crc32c(data, len);
-	}
+	auto *handle = static_cast<Handle *>(ptr);
 
 	// Workaround for sctplab/usrsctp#405: Send callback is invoked on already closed socket
 	// https://github.com/sctplab/usrsctp/issues/405
-	if (auto locked = Instances->lock(transport))
-		return transport->handleWrite(static_cast<byte *>(data), len, tos, set_df);
-	else
+	auto locked = handle->lock();
+	if (!locked)
 		return -1;
+
+	auto *transport = handle->transport();
+	if (tRunningTimers) {
+		// Leave the checksum and the lower layers to the worker of the association, the handle
+		// generation makes sure the packet is not sent by a transport which reused the handle
+		auto bytes = static_cast<const byte *>(data);
+		transport->mProcessor.enqueue(
+		    [handle, generation = handle->generation(), packet = binary(bytes, bytes + len), tos,
+		     set_df]() mutable {
+			    if (auto alive = handle->lock(generation)) {
+				    SetChecksum(packet.data(), packet.size());
+				    handle->transport()->handleWrite(packet.data(), packet.size(), tos, set_df);
+			    }
+		    });
+		return 0;
+	}
+
+	SetChecksum(static_cast<byte *>(data), len);
+	return transport->handleWrite(static_cast<byte *>(data), len, tos, set_df);
 }
 
 void SctpTransport::DebugCallback(const char *format, ...) {
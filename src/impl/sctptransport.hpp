@@ -21,47 +21,96 @@
 
 #include "common.hpp"
 #include "configuration.hpp"
+#include "memoryaccount.hpp"
 #include "processor.hpp"
-#include "queue.hpp"
 #include "transport.hpp"
 
+#include "rtc/peerconnection.hpp" // for SctpStats and DataChannelStats
+
 #include <condition_variable>
 #include <functional>
 #include <map>
 #include <mutex>
+#include <set>
+#include <deque>
+#include <vector>
 
 #include "usrsctp.h"
 
 namespace rtc::impl {
 
+class PathMtuDiscovery;
+
 class SctpTransport final : public Transport {
 public:
-	static void Init();
+	static void Init(const SctpSettings &s);
 	static void SetSettings(const SctpSettings &s);
-	static void Cleanup();
+	// Returns false if associations remain at the deadline
+	static bool Cleanup(optional<std::chrono::steady_clock::time_point> deadline);
+
+	// Graceful shutdowns are aborted at the deadline, or sooner if a global one is set for cleanup
+	static std::chrono::steady_clock::time_point ShutdownDeadline();
+	static void SetGlobalShutdownDeadline(optional<std::chrono::steady_clock::time_point> deadline);
 
 	using amount_callback = std::function<void(uint16_t streamId, size_t amount)>;
 
 	SctpTransport(shared_ptr<Transport> lower, const Configuration &config, uint16_t port,
 	              message_callback recvCallback, amount_callback bufferedAmountCallback,
-	              state_callback stateChangeCallback);
+	              state_callback stateChangeCallback, optional<size_t> affinity = nullopt);
 	~SctpTransport();
 
 	void start() override;
 	bool stop() override;
+
+	// Initiate a graceful shutdown, the callback is called once the association is closed, or
+	// never if it returns false. stop() must still be called, it aborts an unfinished shutdown.
+	bool shutdownGracefully(std::function<void()> callback);
 	bool send(message_ptr message) override; // false if buffered
+	size_t sendBatch(const std::vector<message_ptr> &messages) override; // count not buffered
+
+	// The reliability overrides the one of the stream for these messages only
+	bool send(message_ptr message, const optional<Reliability> &reliability);
+	size_t sendBatch(const std::vector<message_ptr> &messages,
+	                 const optional<Reliability> &reliability);
 	bool flush();
 	void closeStream(unsigned int stream);
+	void setStreamPriority(uint16_t stream, uint16_t priority); // higher is sent first
+	void setStreamReliability(uint16_t stream, const Reliability &reliability);
+	void setStreamFragmented(uint16_t stream, bool enabled); // deliver fragments as they arrive
+
+	// Incomplete messages can only be sent once interleaving is negotiated, otherwise a streamed
+	// message would block the other streams until it is complete
+	bool isStreamingSupported() const { return mExplicitEor; }
+
+	// Receive backpressure: reading is paused while any stream is blocked, so the receive window
+	// fills up and the remote sender slows down instead of messages being dropped
+	void setStreamBlocked(uint16_t stream, bool blocked);
 
 	void onBufferedAmount(amount_callback callback) {
 		mBufferedAmountCallback = std::move(callback);
 	}
 
+	void setMemoryAccount(shared_ptr<MemoryAccount> account) { // before start()
+		mMemoryAccount = std::move(account);
+	}
+
+	// Datagrams bypass SCTP and are sent directly to the lower layer
+	void onDatagram(message_callback callback) { // before start()
+		mDatagramCallback = std::move(callback);
+	}
+	bool sendDatagram(const binary &data); // false if not connected
+
 	// Stats
 	void clearStats();
 	size_t bytesSent();
 	size_t bytesReceived();
+	size_t bufferedAmount() const; // total over all streams
+	size_t sendThroughput();       // in bytes/s
+	size_t receiveThroughput();    // in bytes/s
+	optional<SctpStats> stats();
+	DataChannelStats streamStats(uint16_t stream);
 	optional<std::chrono::milliseconds> rtt();
+	optional<size_t> pathMtu() const; // discovered MTU, nullopt if discovery is disabled
 
 private:
 	// Order seems wrong but these are the actual values
@@ -76,6 +125,22 @@ private:
 		PPID_BINARY_EMPTY = 57
 	};
 
+	// SCTP send parameters of a stream, the default is reliable and ordered
+	struct StreamReliability {
+		uint16_t flags = 0;  // SCTP_UNORDERED or 0
+		uint16_t policy = 0; // SCTP_PR_SCTP_*
+		uint32_t value = 0;
+	};
+
+	struct QueuedMessage {
+		message_ptr message;
+		std::chrono::steady_clock::time_point time; // of the enqueuing, for message lifetimes
+		optional<StreamReliability> reliability;     // overrides the one of the stream if set
+	};
+	using released_map = std::map<uint16_t, size_t>; // amounts leaving the queues by stream
+
+	static StreamReliability ToStreamReliability(const Reliability &reliability);
+
 	void connect();
 	void shutdown();
 	void close();
@@ -85,18 +150,49 @@ private:
 	void doRecv();
 	void doFlush();
 	bool trySendQueue();
-	bool trySendMessage(message_ptr message);
+	bool trySendMessage(message_ptr message,
+	                    const optional<StreamReliability> &reliability = nullopt);
 	void updateBufferedAmount(uint16_t streamId, ptrdiff_t delta);
 	void triggerBufferedAmount(uint16_t streamId, size_t amount);
 	void sendReset(uint16_t streamId);
+	void addOutgoingStreams(uint16_t streamId);
+	bool holdForStream(QueuedMessage &queued); // true if held until the stream is added
+	void releaseHeldStreams();
+	void enqueue(message_ptr message, optional<StreamReliability> reliability = nullopt);
+	uint16_t queuePriority(uint16_t streamId);
+	bool isExpired(const QueuedMessage &queued, std::chrono::steady_clock::time_point now) const;
+	void dropExpired(std::chrono::steady_clock::time_point now, released_map &released);
+	void dropMessage(const message_ptr &message, released_map &released);
+
+	void tune();
+	void setBufferSize(int option, size_t &current, size_t target);
+	void growSendBuffer(size_t size);
 
 	void handleUpcall();
 	int handleWrite(byte *data, size_t len, uint8_t tos, uint8_t set_df);
 
-	void processData(binary &&data, uint16_t streamId, PayloadId ppid);
+	void sendMtuProbe(uint32_t id, size_t size);
+	bool processMtuProbeAck(const binary &packet);
+	void setPathMtu(size_t mtu);
+
+	void processData(binary &&data, uint16_t streamId, PayloadId ppid, bool incomplete = false);
+#if RTC_ENABLE_LATENCY_TRACING
+	void traceDelivery(const message_ptr &message);
+#endif
+	bool isStreamFragmented(uint16_t streamId);
 	void processNotification(const union sctp_notification *notify, size_t len);
+	void enableExplicitEor(sctp_assoc_t assocId);
 
 	const uint16_t mPort;
+	const size_t mMaxMessageSize; // local
+	const bool mCompactMemory;
+	const bool mDynamicStreams;
+
+	// Passed to usrsctp in place of the transport pointer, so callbacks check that the transport is
+	// alive without taking a process-wide lock
+	class Handle;
+	Handle *const mHandle;
+
 	struct socket *mSock;
 
 	Processor mProcessor;
@@ -104,27 +200,73 @@ private:
 	std::atomic<int> mPendingFlushCount = 0;
 	std::mutex mRecvMutex;
 	std::recursive_mutex mSendMutex; // buffered amount callback is synchronous
-	Queue<message_ptr> mSendQueue;
-	std::map<uint16_t, size_t> mBufferedAmount;
+	// Send queues by decreasing priority, messages of a given stream are always in the same queue
+	std::map<uint16_t, std::deque<QueuedMessage>, std::greater<uint16_t>> mSendQueues;
+	std::chrono::steady_clock::time_point mLastExpiryCheck; // of the whole queues
+	std::map<uint16_t, uint64_t> mAbandonedQueued;          // expired in the queues, by stream
+	std::atomic<uint64_t> mTotalAbandonedQueued = 0;
+	std::map<uint16_t, uint16_t> mStreamPriorities; // streams with non-default priority
+	std::map<uint16_t, uint16_t> mPreviousPriorities; // until the stream leaves the previous queue
+	bool mSendQueueStopped = false;
+	std::set<uint16_t> mIncompleteStreams; // streams with a streamed message being sent
+	std::atomic<bool> mExplicitEor = false; // enabled once interleaving is negotiated
+	std::vector<size_t> mBufferedAmount;   // indexed by stream id, grown on demand
+	std::vector<StreamReliability> mStreamReliabilities; // same
+	std::atomic<size_t> mTotalBufferedAmount = 0;
+	uint16_t mOutgoingStreams = 0; // negotiated, grown on demand with RFC 6525 Add Streams
+	optional<std::chrono::steady_clock::time_point> mAddingStreamsSince; // request in flight
+	bool mAddStreamsRefused = false;
+	std::atomic<bool> mAddStreamsDeferred = false; // another reconfiguration was in flight
+	std::set<uint16_t> mUnavailableStreams;        // beyond the streams the peer refused to add
+	// Messages waiting for their stream to be added, so other streams are still sent meanwhile
+	std::map<uint16_t, std::deque<QueuedMessage>> mHeldStreams;
+	shared_ptr<MemoryAccount> mMemoryAccount; // set before start
 	amount_callback mBufferedAmountCallback;
 
 	std::mutex mWriteMutex;
 	std::condition_variable mWrittenCondition;
 	std::atomic<bool> mWritten = false;     // written outside lock
 	std::atomic<bool> mWrittenOnce = false; // same
+	std::atomic<unsigned int> mOutgoingDscp = 0; // of the last message sent, 0 for the default
+	std::atomic<uint32_t> mRemoteVerificationTag = 0; // in network byte order, learnt on write
+
+	shared_ptr<PathMtuDiscovery> mPathMtuDiscovery; // null if disabled
+	message_callback mDatagramCallback;             // set before start
 
-	binary mPartialMessage, mPartialNotification;
+	std::atomic<bool> mAssociationClosed = false; // not closed associations are aborted on close
+	std::function<void()> mShutdownCallback;
+	std::mutex mShutdownMutex;
+
+	std::map<uint16_t, binary> mPartialMessages; // partial messages may interleave between streams
+	std::set<uint16_t> mFragmentedStreams;       // streams where messages are not reassembled
+	std::mutex mFragmentedMutex;
+
+	std::set<uint16_t> mBlockedStreams; // streams whose receiver can't keep up
+	std::mutex mBlockedMutex;
+	std::atomic<bool> mRecvBlocked = false;
+	binary mPartialNotification;
 	binary mPartialStringData, mPartialBinaryData;
 
 	// Stats
 	std::atomic<size_t> mBytesSent = 0, mBytesReceived = 0;
 
+	// Throughput measurement and buffer tuning
+	const bool mAutoBufferSize;
+	const optional<uint64_t> mTargetBitrate;
+	const size_t mMaxBufferSize;
+	std::mutex mTuningMutex;
+	std::chrono::steady_clock::time_point mLastTuningTime;
+	size_t mLastBytesSent = 0, mLastBytesReceived = 0;
+	std::atomic<size_t> mSendThroughput = 0, mReceiveThroughput = 0;
+	size_t mSendBufferSize = 0, mRecvBufferSize = 0;
+
 	static void UpcallCallback(struct socket *sock, void *arg, int flags);
 	static int WriteCallback(void *sctp_ptr, void *data, size_t len, uint8_t tos, uint8_t set_df);
 	static void DebugCallback(const char *format, ...);
 
-	class InstancesSet;
-	static InstancesSet *Instances;
+	static std::atomic<bool> InterleavingEnabled;
+	static std::atomic<std::chrono::milliseconds::rep> ShutdownTimeout;
+	static std::atomic<std::chrono::steady_clock::rep> GlobalShutdownDeadline; // since epoch
 };
 
 } // namespace rtc::impl
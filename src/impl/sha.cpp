@@ -21,8 +21,10 @@
 #if RTC_ENABLE_WEBSOCKET
 
 #if USE_GNUTLS
+#include <nettle/hmac.h>
 #include <nettle/sha1.h>
 #else
+#include <openssl/hmac.h>
 #include <openssl/sha.h>
 #endif
 
@@ -60,6 +62,31 @@ binary Sha1(const string &input) {
 	return Sha1(reinterpret_cast<const byte *>(input.data()), input.size());
 }
 
+binary HmacSha1(const string &key, const byte *data, size_t size) {
+#if USE_GNUTLS
+
+	binary output(SHA1_DIGEST_SIZE);
+	struct hmac_sha1_ctx ctx;
+	hmac_sha1_set_key(&ctx, key.size(), reinterpret_cast<const uint8_t *>(key.data()));
+	hmac_sha1_update(&ctx, size, reinterpret_cast<const uint8_t *>(data));
+	hmac_sha1_digest(&ctx, SHA1_DIGEST_SIZE, reinterpret_cast<uint8_t *>(output.data()));
+	return output;
+
+#else // USE_GNUTLS==0
+
+	binary output(SHA_DIGEST_LENGTH);
+	unsigned int len = 0;
+	if (!HMAC(EVP_sha1(), key.data(), int(key.size()),
+	          reinterpret_cast<const unsigned char *>(data), size,
+	          reinterpret_cast<unsigned char *>(output.data()), &len))
+		throw std::runtime_error("HMAC-SHA1 computation failed");
+
+	output.resize(len);
+	return output;
+
+#endif
+}
+
 } // namespace rtc::impl
 
 #endif
@@ -27,6 +27,7 @@ namespace rtc::impl {
 
 binary Sha1(const binary &input);
 binary Sha1(const string &input);
+binary HmacSha1(const string &key, const byte *data, size_t size);
 
 } // namespace rtc::impl
 
@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2019 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_TASK_H
+#define RTC_IMPL_TASK_H
+
+#include "common.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace rtc::impl {
+
+// Move-only callable wrapper for void() tasks with small buffer optimization
+// Unlike std::function, it accepts move-only callables and stores usual tasks (a callback with a
+// few bound arguments) inline, without heap allocation.
+class Task final {
+public:
+	Task() noexcept {}
+	Task(std::nullptr_t) noexcept {}
+	Task(Task &&other) noexcept { *this = std::move(other); }
+	~Task() { reset(); }
+
+	template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task> &&
+	                                                  !std::is_same_v<std::decay_t<F>, std::nullptr_t>>>
+	Task(F &&f) {
+		using T = std::decay_t<F>;
+		if constexpr (IsInline<T>) {
+			new (mStorage) T(std::forward<F>(f));
+			mOperations = &Inline<T>::operations;
+		} else {
+			*reinterpret_cast<T **>(mStorage) = new T(std::forward<F>(f));
+			mOperations = &Heap<T>::operations;
+		}
+	}
+
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	Task &operator=(Task &&other) noexcept {
+		if (this != &other) {
+			reset();
+			if (other.mOperations) {
+				other.mOperations->move(mStorage, other.mStorage);
+				mOperations = std::exchange(other.mOperations, nullptr);
+			}
+		}
+		return *this;
+	}
+
+	Task &operator=(std::nullptr_t) noexcept {
+		reset();
+		return *this;
+	}
+
+	void operator()() {
+		if (!mOperations)
+			throw std::bad_function_call();
+
+		mOperations->invoke(mStorage);
+	}
+
+	explicit operator bool() const noexcept { return mOperations != nullptr; }
+
+	void reset() noexcept {
+		if (mOperations)
+			std::exchange(mOperations, nullptr)->destroy(mStorage);
+	}
+
+private:
+	static const size_t StorageSize = 112;
+
+	template <typename T>
+	static constexpr bool IsInline = sizeof(T) <= StorageSize &&
+	                                 alignof(T) <= alignof(std::max_align_t) &&
+	                                 std::is_nothrow_move_constructible_v<T>;
+
+	struct Operations {
+		void (*invoke)(void *storage);
+		void (*move)(void *dst, void *src) noexcept;
+		void (*destroy)(void *storage) noexcept;
+	};
+
+	template <typename T> struct Inline {
+		static void invoke(void *storage) { (*static_cast<T *>(storage))(); }
+		static void move(void *dst, void *src) noexcept {
+			new (dst) T(std::move(*static_cast<T *>(src)));
+			static_cast<T *>(src)->~T();
+		}
+		static void destroy(void *storage) noexcept { static_cast<T *>(storage)->~T(); }
+		static constexpr Operations operations = {invoke, move, destroy};
+	};
+
+	template <typename T> struct Heap {
+		static void invoke(void *storage) { (**static_cast<T **>(storage))(); }
+		static void move(void *dst, void *src) noexcept {
+			*static_cast<T **>(dst) = *static_cast<T **>(src);
+		}
+		static void destroy(void *storage) noexcept { delete *static_cast<T **>(storage); }
+		static constexpr Operations operations = {invoke, move, destroy};
+	};
+
+	alignas(std::max_align_t) unsigned char mStorage[StorageSize];
+	const Operations *mOperations = nullptr;
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -17,6 +17,7 @@
  */
 
 #include "tcpserver.hpp"
+#include "init.hpp"
 #include "internals.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
@@ -29,75 +30,92 @@
 #include <unistd.h>
 #endif
 
+#include <vector>
+
 namespace rtc::impl {
 
-TcpServer::TcpServer(uint16_t port) {
+TcpServer::TcpServer(uint16_t port, optional<int> backlog, bool reusePort) {
 	PLOG_DEBUG << "Initializing TCP server";
-	listen(port);
+	listen(port, backlog.value_or(SOMAXCONN), reusePort);
 }
 
 TcpServer::~TcpServer() { close(); }
 
-shared_ptr<TcpTransport> TcpServer::accept() {
-	while (true) {
-		std::unique_lock lock(mSockMutex);
+void TcpServer::start(accept_callback callback) {
+	std::unique_lock lock(mSockMutex);
+	if (mSock == INVALID_SOCKET)
+		throw std::logic_error("TCP server is closed");
 
-		if (mSock == INVALID_SOCKET)
-			break;
+	mAcceptCallback = std::move(callback);
+	Init::Instance().init(Init::Subsystem::PollService);
 
-		struct pollfd pfd[2];
-		pfd[0].fd = mSock;
-		pfd[0].events = POLLIN;
-		mInterrupter.prepare(pfd[1]);
-		lock.unlock();
-		int ret = ::poll(pfd, 2, -1);
-		lock.lock();
+	PollService::Params params;
+	params.direction = PollService::Direction::In;
+	params.callback = weak_bind(&TcpServer::process, this, std::placeholders::_1);
+	PollService::Instance().add(mSock, std::move(params));
+}
 
-		if (mSock == INVALID_SOCKET)
-			break;
+void TcpServer::close() {
+	std::unique_lock lock(mSockMutex);
+	if (mSock != INVALID_SOCKET) {
+		PLOG_DEBUG << "Closing TCP server socket";
+		PollService::Instance().remove(mSock);
+		::closesocket(mSock);
+		mSock = INVALID_SOCKET;
+	}
+}
 
-		if (ret < 0) {
-			if (sockerrno == SEINTR || sockerrno == SEAGAIN) // interrupted
-				continue;
-			else
-				throw std::runtime_error("Failed to wait for socket connection");
-		}
+void TcpServer::process(PollService::Event event) {
+	const int maxAccepts = 64; // per event, so other sockets are not starved
+
+	std::vector<shared_ptr<TcpTransport>> accepted;
+	accept_callback callback;
+	try {
+		std::unique_lock lock(mSockMutex);
+		if (mSock == INVALID_SOCKET)
+			return;
 
-		if (pfd[0].revents & POLLNVAL || pfd[0].revents & POLLERR) {
+		if (event == PollService::Event::Error)
 			throw std::runtime_error("Error while waiting for socket connection");
-		}
 
-		if (pfd[0].revents & POLLIN) {
+		if (event != PollService::Event::In)
+			return;
+
+		callback = mAcceptCallback;
+		for (int i = 0; i < maxAccepts; ++i) {
 			struct sockaddr_storage addr;
 			socklen_t addrlen = sizeof(addr);
 			socket_t incomingSock = ::accept(mSock, (struct sockaddr *)&addr, &addrlen);
+			if (incomingSock == INVALID_SOCKET) {
+				if (sockerrno == SEAGAIN || sockerrno == SEWOULDBLOCK)
+					break;
 
-			if (incomingSock != INVALID_SOCKET) {
-				return std::make_shared<TcpTransport>(incomingSock, nullptr); // no state callback
-
-			} else if (sockerrno != SEAGAIN && sockerrno != SEWOULDBLOCK) {
 				PLOG_ERROR << "TCP server failed, errno=" << sockerrno;
 				throw std::runtime_error("TCP server failed");
 			}
+
+			accepted.push_back(std::make_shared<TcpTransport>(incomingSock, nullptr));
 		}
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "TCP server: " << e.what();
+		close();
 	}
 
-	PLOG_DEBUG << "TCP server closed";
-	return nullptr;
-}
+	// The callback is called without the lock held since it might close the server
+	for (auto &incoming : accepted) {
+		try {
+			if (callback)
+				callback(std::move(incoming));
 
-void TcpServer::close() {
-	std::unique_lock lock(mSockMutex);
-	if (mSock != INVALID_SOCKET) {
-		PLOG_DEBUG << "Closing TCP server socket";
-		::closesocket(mSock);
-		mSock = INVALID_SOCKET;
-		mInterrupter.interrupt();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << "TCP server accept callback: " << e.what();
+		}
 	}
 }
 
-void TcpServer::listen(uint16_t port) {
-	PLOG_DEBUG << "Listening on port " << port;
+void TcpServer::listen(uint16_t port, int backlog, bool reusePort) {
+	PLOG_DEBUG << "Listening on port " << port << ", backlog=" << backlog;
 
 	struct addrinfo hints = {};
 	hints.ai_family = AF_UNSPEC;
@@ -136,6 +154,18 @@ void TcpServer::listen(uint16_t port) {
 			::setsockopt(mSock, IPPROTO_IPV6, IPV6_V6ONLY,
 			             reinterpret_cast<const char *>(&disabled), sizeof(disabled));
 
+		// Allow several servers to listen on the same port, the kernel balances connections
+		if (reusePort) {
+#ifdef SO_REUSEPORT
+			const sockopt_t enabled = 1;
+			if (::setsockopt(mSock, SOL_SOCKET, SO_REUSEPORT,
+			                 reinterpret_cast<const char *>(&enabled), sizeof(enabled)) < 0)
+				throw std::runtime_error("Failed to set SO_REUSEPORT on TCP server socket");
+#else
+			PLOG_WARNING << "SO_REUSEPORT is not supported on this platform";
+#endif
+		}
+
 		// Set non-blocking
 		ctl_t b = 1;
 		if (::ioctlsocket(mSock, FIONBIO, &b) < 0)
@@ -149,7 +179,6 @@ void TcpServer::listen(uint16_t port) {
 		}
 
 		// Listen
-		const int backlog = 10;
 		if (::listen(mSock, backlog) < 0) {
 			PLOG_WARNING << "TCP server socket listening failed, errno=" << sockerrno;
 			throw std::runtime_error("TCP server socket listening failed");
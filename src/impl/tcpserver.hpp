@@ -20,32 +20,39 @@
 #define RTC_IMPL_TCP_SERVER_H
 
 #include "common.hpp"
-#include "pollinterrupter.hpp"
-#include "queue.hpp"
+#include "pollservice.hpp"
 #include "socket.hpp"
 #include "tcptransport.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
 
+#include <functional>
+#include <mutex>
+
 namespace rtc::impl {
 
-class TcpServer {
+class TcpServer final : public std::enable_shared_from_this<TcpServer> {
 public:
-	TcpServer(uint16_t port);
+	using accept_callback = std::function<void(shared_ptr<TcpTransport>)>;
+
+	// The backlog is the system maximum if unset, reusePort allows to share the port if supported
+	TcpServer(uint16_t port, optional<int> backlog = nullopt, bool reusePort = false);
 	~TcpServer();
 
-	shared_ptr<TcpTransport> accept();
+	// Connections are accepted on the shared PollService, there is no thread per server
+	void start(accept_callback callback);
 	void close();
 
 	uint16_t port() const { return mPort; }
 
 private:
-	void listen(uint16_t port);
+	void listen(uint16_t port, int backlog, bool reusePort);
+	void process(PollService::Event event);
 
 	uint16_t mPort;
 	socket_t mSock = INVALID_SOCKET;
 	std::mutex mSockMutex;
-	PollInterrupter mInterrupter;
+	accept_callback mAcceptCallback;
 };
 
 } // namespace rtc::impl
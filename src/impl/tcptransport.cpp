@@ -16,17 +16,35 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM Tcp
+
 #include "tcptransport.hpp"
+#include "dnscache.hpp"
+#include "init.hpp"
 #include "internals.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
 
 #ifndef _WIN32
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <linux/tls.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstring>
 
 namespace rtc::impl {
 
@@ -68,22 +86,39 @@ TcpTransport::TcpTransport(socket_t sock, state_callback callback)
 	mService = serv;
 }
 
-TcpTransport::~TcpTransport() { stop(); }
+TcpTransport::~TcpTransport() {
+	stop();
+	close(); // the socket of a passive transport might have never been started
+}
 
 void TcpTransport::start() {
 	Transport::start();
-
-	PLOG_DEBUG << "Starting TCP recv thread";
-	mThread = std::thread(&TcpTransport::runLoop, this);
+	Init::Instance().init(Init::Subsystem::PollService);
+	changeState(State::Connecting);
+
+	if (mSock == INVALID_SOCKET) {
+		PLOG_DEBUG << "Resolving " << mHostname << ":" << mService;
+
+		// Resolution goes through the shared cache, so simultaneous connections to the same host
+		// don't each block a thread on DNS
+		DnsCache::Instance().resolveAsync(
+		    mHostname, [weak_this = weak_from_this()](std::vector<string> addresses) {
+			    if (auto locked = weak_this.lock())
+				    locked->resolve(addresses);
+		    });
+	} else {
+		// The passive socket is already connected, it will be reported writable right away
+		std::lock_guard lock(mSockMutex);
+		setPoll(PollService::Direction::Out);
+	}
 }
 
 bool TcpTransport::stop() {
 	if (!Transport::stop())
 		return false;
 
-	PLOG_DEBUG << "Waiting for TCP recv thread";
+	PLOG_DEBUG << "Stopping TCP transport";
 	close();
-	mThread.join();
 	return true;
 }
 
@@ -98,8 +133,37 @@ bool TcpTransport::send(message_ptr message) {
 	if (!message)
 		return trySendQueue();
 
-	PLOG_VERBOSE << "Send size=" << (message ? message->size() : 0);
-	return outgoing(message);
+	PLOG_VERBOSE << "Send size=" << message->payloadSize();
+	return outgoing(std::move(message));
+}
+
+size_t TcpTransport::sendBatch(const std::vector<message_ptr> &messages) {
+	std::unique_lock lock(mSockMutex);
+	if (state() == State::Connecting)
+		throw std::runtime_error("Connection is not open");
+
+	if (state() != State::Connected)
+		return 0;
+
+	// Messages are written with vectored sends, so a frame header and its payload do not need to
+	// be concatenated beforehand
+	const size_t pending = mSendQueue.size();
+	size_t count = 0;
+	for (const auto &message : messages) {
+		if (message) {
+			mSendQueue.push_back(message);
+			++count;
+		}
+	}
+
+	if (trySendQueue())
+		return count;
+
+	if (pending == 0)
+		setPoll(PollService::Direction::Both); // wait for writability
+
+	const size_t sent = pending + count - mSendQueue.size();
+	return sent > pending ? sent - pending : 0;
 }
 
 void TcpTransport::incoming(message_ptr message) {
@@ -112,60 +176,129 @@ void TcpTransport::incoming(message_ptr message) {
 
 bool TcpTransport::outgoing(message_ptr message) {
 	// mSockMutex must be locked
-	// Flush the queue, and if nothing is pending, try to send directly
-	if (trySendQueue() && trySendMessage(message))
+	// Queue the message and flush the queue, pending messages are sent first
+	const bool wasEmpty = mSendQueue.empty();
+	mSendQueue.push_back(std::move(message));
+	if (trySendQueue())
 		return true;
 
-	mSendQueue.push(message);
-	mInterrupter.interrupt(); // so the thread waits for writability
+	if (wasEmpty)
+		setPoll(PollService::Direction::Both); // wait for writability
+
 	return false;
 }
 
 string TcpTransport::remoteAddress() const { return mHostname + ':' + mService; }
 
-void TcpTransport::connect(const string &hostname, const string &service) {
-	PLOG_DEBUG << "Connecting to " << hostname << ":" << service;
+bool TcpTransport::enableKernelTls([[maybe_unused]] const void *cryptoInfo) {
+#ifdef __linux__
+	const auto *info = static_cast<const struct tls_crypto_info *>(cryptoInfo);
+	socklen_t size;
+	switch (info->cipher_type) {
+	case TLS_CIPHER_AES_GCM_128:
+		size = sizeof(struct tls12_crypto_info_aes_gcm_128);
+		break;
+	case TLS_CIPHER_AES_GCM_256:
+		size = sizeof(struct tls12_crypto_info_aes_gcm_256);
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		size = sizeof(struct tls12_crypto_info_chacha20_poly1305);
+		break;
+#endif
+	default:
+		return false;
+	}
+
+	std::lock_guard lock(mSockMutex);
+	if (mSock == INVALID_SOCKET || mKernelTls || !mSendQueue.empty())
+		return false;
 
-	struct addrinfo hints = {};
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_flags = AI_ADDRCONFIG;
+	if (::setsockopt(mSock, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+		PLOG_DEBUG << "Kernel TLS is unavailable, errno=" << sockerrno;
+		return false;
+	}
 
-	struct addrinfo *result = nullptr;
-	if (getaddrinfo(hostname.c_str(), service.c_str(), &hints, &result))
-		throw std::runtime_error("Resolution failed for \"" + hostname + ":" + service + "\"");
+	// Without keys, the upper layer protocol passes data through unchanged
+	if (::setsockopt(mSock, SOL_TLS, TLS_TX, info, size) != 0) {
+		PLOG_WARNING << "Failed to set kernel TLS transmit keys, errno=" << sockerrno;
+		return false;
+	}
+
+	mKernelTls = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void TcpTransport::resolve(const std::vector<string> &nodes) {
+	if (nodes.empty()) {
+		PLOG_WARNING << "Resolution failed for \"" << mHostname << ":" << mService << "\"";
+		changeState(State::Failed);
+		return;
+	}
+
+	std::unique_lock lock(mSockMutex);
+	for (const auto &node : nodes) {
+		// Nodes are numeric, so this does not block
+		struct addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_flags = AI_NUMERICHOST;
+
+		struct addrinfo *result = nullptr;
+		if (getaddrinfo(node.c_str(), mService.c_str(), &hints, &result))
+			continue;
 
-	try {
 		for (auto p = result; p; p = p->ai_next) {
-			try {
-				connect(p->ai_addr, socklen_t(p->ai_addrlen));
-
-				PLOG_INFO << "Connected to " << hostname << ":" << service;
-				freeaddrinfo(result);
-				return;
-
-			} catch (const std::runtime_error &e) {
-				if (p->ai_next) {
-					PLOG_DEBUG << e.what();
-				} else {
-					PLOG_WARNING << e.what();
-				}
-			}
+			Address address = {};
+			std::memcpy(&address.addr, p->ai_addr, p->ai_addrlen);
+			address.addrlen = socklen_t(p->ai_addrlen);
+			mAddresses.push_back(std::move(address));
 		}
+		freeaddrinfo(result);
+	}
 
-		std::ostringstream msg;
-		msg << "Connection to " << hostname << ":" << service << " failed";
-		throw std::runtime_error(msg.str());
+	if (mClosed || attempt())
+		return;
 
-	} catch (...) {
-		freeaddrinfo(result);
-		throw;
+	lock.unlock();
+	changeState(State::Failed);
+}
+
+bool TcpTransport::attempt() {
+	// mSockMutex must be locked
+	if (mSock != INVALID_SOCKET) {
+		PollService::Instance().remove(mSock);
+		::closesocket(mSock);
+		mSock = INVALID_SOCKET;
 	}
+
+	while (!mAddresses.empty()) {
+		Address address = std::move(mAddresses.front());
+		mAddresses.pop_front();
+		try {
+			connect(reinterpret_cast<const sockaddr *>(&address.addr), address.addrlen);
+			setPoll(PollService::Direction::Out); // wait for connection
+			return true;
+
+		} catch (const std::runtime_error &e) {
+			if (!mAddresses.empty()) {
+				PLOG_DEBUG << e.what();
+			} else {
+				PLOG_WARNING << e.what();
+			}
+		}
+	}
+
+	PLOG_WARNING << "Connection to " << mHostname << ":" << mService << " failed";
+	return false;
 }
 
 void TcpTransport::connect(const sockaddr *addr, socklen_t addrlen) {
-	std::unique_lock lock(mSockMutex);
+	// mSockMutex must be locked
 	try {
 		char node[MAX_NUMERICNODE_LEN];
 		char serv[MAX_NUMERICSERV_LEN];
@@ -193,7 +326,7 @@ void TcpTransport::connect(const sockaddr *addr, socklen_t addrlen) {
 			throw std::runtime_error("Failed to disable SIGPIPE for socket");
 #endif
 
-		// Initiate connection
+		// Initiate connection, completion is reported by the poll service
 		int ret = ::connect(mSock, addr, addrlen);
 		if (ret < 0 && sockerrno != SEINPROGRESS && sockerrno != SEWOULDBLOCK) {
 			std::ostringstream msg;
@@ -201,194 +334,218 @@ void TcpTransport::connect(const sockaddr *addr, socklen_t addrlen) {
 			throw std::runtime_error(msg.str());
 		}
 
-		// Wait for connection
-		struct pollfd pfd[1];
-		pfd[0].fd = mSock;
-		pfd[0].events = POLLOUT;
-
-		using clock = std::chrono::steady_clock;
-		auto end = clock::now() + 10s; // TODO: Make the timeout configurable
-
-		do {
-			auto timeout = std::max(clock::duration::zero(), end - clock::now());
-			ret = ::poll(pfd, 1, int(duration_cast<milliseconds>(timeout).count()));
-
-		} while (ret < 0 && (sockerrno == SEINTR || sockerrno == SEAGAIN));
-
-		if (ret < 0)
-			throw std::runtime_error("Failed to wait for socket connection");
-
-		if (!(pfd[0].revents & POLLOUT)) {
-			std::ostringstream msg;
-			msg << "TCP connection to " << node << ":" << serv << " timed out";
-			throw std::runtime_error(msg.str());
+	} catch (...) {
+		if (mSock != INVALID_SOCKET) {
+			::closesocket(mSock);
+			mSock = INVALID_SOCKET;
 		}
+		throw;
+	}
+}
 
-		int err = 0;
-		socklen_t errlen = sizeof(err);
-		if (::getsockopt(mSock, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen) != 0)
-			throw std::runtime_error("Failed to get socket error code");
+void TcpTransport::setPoll(PollService::Direction direction) {
+	// mSockMutex must be locked
+	// The timeout is only the connection timeout, there are no idle wakeups once connected as
+	// keepalive is handled by the upper layer with its own timer
+	optional<PollService::clock::duration> timeout;
+	if (state() == State::Connecting)
+		timeout = 10s;
 
-		if (err != 0) {
-			std::ostringstream msg;
-			msg << "TCP connection to " << node << ":" << serv << " failed, errno=" << err;
-			throw std::runtime_error(msg.str());
-		}
+	PollService::Instance().add(mSock, {direction, timeout,
+	                                    weak_bind(&TcpTransport::process, this,
+	                                              std::placeholders::_1)});
+}
 
-		PLOG_DEBUG << "TCP connection to " << node << ":" << serv << " succeeded";
+void TcpTransport::close() {
+	{
+		std::lock_guard lock(mSockMutex);
+		if (std::exchange(mClosed, true))
+			return;
 
-	} catch (...) {
+		mAddresses.clear();
 		if (mSock != INVALID_SOCKET) {
+			PLOG_DEBUG << "Closing TCP socket";
+			PollService::Instance().remove(mSock);
 			::closesocket(mSock);
 			mSock = INVALID_SOCKET;
 		}
-		throw;
 	}
-}
 
-void TcpTransport::close() {
-	std::unique_lock lock(mSockMutex);
-	if (mSock != INVALID_SOCKET) {
-		PLOG_DEBUG << "Closing TCP socket";
-		::closesocket(mSock);
-		mSock = INVALID_SOCKET;
+	if (state() == State::Connected) {
+		PLOG_INFO << "TCP disconnected";
+		changeState(State::Disconnected);
+		recv(nullptr);
+	} else if (state() != State::Failed) {
+		changeState(State::Disconnected);
 	}
-	changeState(State::Disconnected);
-	mInterrupter.interrupt();
 }
 
 bool TcpTransport::trySendQueue() {
 	// mSockMutex must be locked
-	while (auto next = mSendQueue.peek()) {
-		message_ptr message = std::move(*next);
-		if (!trySendMessage(message)) {
-			mSendQueue.exchange(message);
-			return false;
+	// Queued messages are written many at a time, the front message may be partially sent already
+	const size_t maxBuffers = 64;
+	while (!mSendQueue.empty()) {
+		size_t count = std::min(mSendQueue.size(), maxBuffers);
+		size_t offset = mSendOffset;
+
+#ifdef _WIN32
+		std::array<WSABUF, maxBuffers> buffers;
+		for (size_t i = 0; i < count; ++i) {
+			const auto &message = mSendQueue[i];
+			auto data = const_cast<byte *>(message->payload()) + offset;
+			buffers[i].buf = reinterpret_cast<char *>(data);
+			buffers[i].len = ULONG(message->payloadSize() - offset);
+			offset = 0;
 		}
-		mSendQueue.pop();
-	}
-	return true;
-}
-
-bool TcpTransport::trySendMessage(message_ptr &message) {
-	// mSockMutex must be locked
-	auto data = reinterpret_cast<const char *>(message->data());
-	auto size = message->size();
-	while (size) {
-#if defined(__APPLE__) || defined(_WIN32)
+		DWORD written = 0;
+		long len = ::WSASend(mSock, buffers.data(), DWORD(count), &written, 0, NULL, NULL) == 0
+		               ? long(written)
+		               : -1;
+#else
+		std::array<struct iovec, maxBuffers> buffers;
+		for (size_t i = 0; i < count; ++i) {
+			const auto &message = mSendQueue[i];
+			buffers[i].iov_base = const_cast<byte *>(message->payload()) + offset;
+			buffers[i].iov_len = message->payloadSize() - offset;
+			offset = 0;
+		}
+		struct msghdr msg = {};
+		msg.msg_iov = buffers.data();
+		msg.msg_iovlen = decltype(msg.msg_iovlen)(count);
+#ifdef __APPLE__
 		int flags = 0;
 #else
 		int flags = MSG_NOSIGNAL;
 #endif
-		int len = ::send(mSock, data, int(size), flags);
+		long len = long(::sendmsg(mSock, &msg, flags));
+#endif
 		if (len < 0) {
-			if (sockerrno == SEAGAIN || sockerrno == SEWOULDBLOCK) {
-				message = make_message(message->end() - size, message->end());
+			if (sockerrno == SEAGAIN || sockerrno == SEWOULDBLOCK)
 				return false;
-			} else {
-				PLOG_ERROR << "Connection closed, errno=" << sockerrno;
-				throw std::runtime_error("Connection closed");
-			}
+
+			PLOG_ERROR << "Connection closed, errno=" << sockerrno;
+			throw std::runtime_error("Connection closed");
 		}
 
-		data += len;
-		size -= len;
+		// Pop fully sent messages and keep the offset in the partially sent one
+		size_t left = size_t(len);
+		while (!mSendQueue.empty()) {
+			const size_t remaining = mSendQueue.front()->payloadSize() - mSendOffset;
+			if (left < remaining) {
+				mSendOffset += left;
+				break;
+			}
+			left -= remaining;
+			mSendQueue.pop_front();
+			mSendOffset = 0;
+		}
 	}
-	message = nullptr;
 	return true;
 }
 
-void TcpTransport::runLoop() {
-	const size_t bufferSize = 4096;
+void TcpTransport::process(PollService::Event event) {
+	const int maxReads = 16; // per event, so other sockets are not starved
 
-	// Connect
 	try {
-		changeState(State::Connecting);
+		std::unique_lock lock(mSockMutex);
 		if (mSock == INVALID_SOCKET)
-			connect(mHostname, mService);
-
-	} catch (const std::exception &e) {
-		PLOG_ERROR << "TCP connect: " << e.what();
-		changeState(State::Failed);
-		return;
-	}
-
-	// Receive loop
-	try {
-		PLOG_INFO << "TCP connected";
-		changeState(State::Connected);
-
-		while (true) {
-			std::unique_lock lock(mSockMutex);
-
-			if (mSock == INVALID_SOCKET)
-				break;
-
-			struct pollfd pfd[2];
-			pfd[0].fd = mSock;
-			pfd[0].events = !mSendQueue.empty() ? (POLLIN | POLLOUT) : POLLIN;
-			mInterrupter.prepare(pfd[1]);
-
-			using clock = std::chrono::steady_clock;
-			auto end = clock::now() + 10s;
-
-			int ret;
-			lock.unlock();
-			do {
-				auto timeout = std::max(clock::duration::zero(), end - clock::now());
-				ret = ::poll(pfd, 2, int(duration_cast<milliseconds>(timeout).count()));
-
-			} while (ret < 0 && (sockerrno == SEINTR || sockerrno == SEAGAIN));
-			lock.lock();
-
-			if (mSock == INVALID_SOCKET)
-				break;
+			return;
+
+		if (state() == State::Connecting) {
+			if (event == PollService::Event::Out) {
+				int err = 0;
+				socklen_t errlen = sizeof(err);
+				if (::getsockopt(mSock, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen) != 0)
+					throw std::runtime_error("Failed to get socket error code");
+
+				if (err == 0) {
+					// Poll for input once connected since the upper layer might send on state
+					// change
+					lock.unlock();
+					PLOG_INFO << "TCP connected";
+					changeState(State::Connected);
+
+					lock.lock();
+					if (mSock != INVALID_SOCKET)
+						setPoll(mSendQueue.empty() ? PollService::Direction::In
+						                           : PollService::Direction::Both);
+					return;
+				}
 
-			if (ret < 0)
-				throw std::runtime_error("Failed to wait on socket");
+				PLOG_DEBUG << "TCP connection failed, errno=" << err;
 
-			if (ret == 0) {
-				PLOG_VERBOSE << "TCP is idle";
-				lock.unlock(); // unlock now since the upper layer might send on incoming
-				incoming(make_message(0));
-				continue;
-			}
-
-			if (pfd[0].revents & POLLNVAL || pfd[0].revents & POLLERR) {
-				throw std::runtime_error("Error while waiting for socket connection");
+			} else if (event == PollService::Event::Timeout) {
+				PLOG_DEBUG << "TCP connection timed out";
+			} else {
+				PLOG_DEBUG << "TCP connection failed";
 			}
 
-			if (pfd[0].revents & POLLOUT) {
-				trySendQueue();
+			// Try the next address
+			if (!mIsActive || !attempt()) {
+				lock.unlock();
+				changeState(State::Failed);
+				close();
 			}
+			return;
+		}
 
-			if (pfd[0].revents & POLLIN) {
-				char buffer[bufferSize];
-				int len = ::recv(mSock, buffer, bufferSize, 0);
+		switch (event) {
+		case PollService::Event::Error:
+			throw std::runtime_error("Error while waiting for socket connection");
+
+		case PollService::Event::Out:
+			if (trySendQueue())
+				setPoll(PollService::Direction::In);
+			return;
+
+		case PollService::Event::In: {
+			for (int i = 0; i < maxReads; ++i) {
+				// Read directly into a pooled message, its storage is recycled once consumed
+				auto message = make_message(mReadSize);
+				auto buffer = reinterpret_cast<char *>(message->data());
+				int len = ::recv(mSock, buffer, int(mReadSize), 0);
 				if (len < 0) {
-					if (sockerrno == SEAGAIN || sockerrno == SEWOULDBLOCK) {
-						continue;
-					} else {
-						PLOG_WARNING << "TCP connection lost";
-						break;
-					}
+					if (sockerrno == SEAGAIN || sockerrno == SEWOULDBLOCK)
+						return;
+
+					PLOG_WARNING << "TCP connection lost";
+					break;
 				}
 
 				if (len == 0)
 					break; // clean close
 
+				// Grow the read size while reads fill the buffer, shrink it back when traffic is
+				// sparse so idle connections do not hold large buffers
+				if (size_t(len) == mReadSize)
+					mReadSize = std::min(mReadSize * 2, MaxReadSize);
+				else if (size_t(len) < mReadSize / 4)
+					mReadSize = std::max(mReadSize / 2, MinReadSize);
+
+				message->resize(size_t(len));
+
 				lock.unlock(); // unlock now since the upper layer might send on incoming
-				auto *b = reinterpret_cast<byte *>(buffer);
-				incoming(make_message(b, b + len));
+				incoming(std::move(message));
+
+				lock.lock();
+				if (mSock == INVALID_SOCKET)
+					return;
+
+				if (i == maxReads - 1)
+					return; // continue on the next event
 			}
+			break;
 		}
+
+		default:
+			return;
+		}
+
 	} catch (const std::exception &e) {
 		PLOG_ERROR << "TCP recv: " << e.what();
 	}
 
-	PLOG_INFO << "TCP disconnected";
-	changeState(State::Disconnected);
-	recv(nullptr);
+	close();
 }
 
 } // namespace rtc::impl
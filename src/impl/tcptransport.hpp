@@ -20,19 +20,20 @@
 #define RTC_IMPL_TCP_TRANSPORT_H
 
 #include "common.hpp"
-#include "queue.hpp"
-#include "pollinterrupter.hpp"
+#include "pollservice.hpp"
 #include "socket.hpp"
 #include "transport.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
 
+#include <deque>
+#include <list>
 #include <mutex>
-#include <thread>
+#include <vector>
 
 namespace rtc::impl {
 
-class TcpTransport : public Transport {
+class TcpTransport : public Transport, public std::enable_shared_from_this<TcpTransport> {
 public:
 	TcpTransport(string hostname, string service, state_callback callback); // active
 	TcpTransport(socket_t sock, state_callback callback);                   // passive
@@ -41,6 +42,7 @@ public:
 	void start() override;
 	bool stop() override;
 	bool send(message_ptr message) override;
+	size_t sendBatch(const std::vector<message_ptr> &messages) override;
 
 	void incoming(message_ptr message) override;
 	bool outgoing(message_ptr message) override;
@@ -49,24 +51,43 @@ public:
 
 	string remoteAddress() const;
 
+	// Install TLS transmit keys in the kernel (Linux only), cryptoInfo points to the kernel
+	// structure for the cipher. Fails if data is still queued as it would be encrypted again.
+	// Afterwards, everything sent is application data encrypted by the kernel.
+	bool enableKernelTls(const void *cryptoInfo);
+
 private:
-	void connect(const string &hostname, const string &service);
+	void resolve(const std::vector<string> &nodes);
+	bool attempt();
 	void connect(const sockaddr *addr, socklen_t addrlen);
+	void setPoll(PollService::Direction direction);
 	void close();
 
-	bool trySendQueue();
-	bool trySendMessage(message_ptr &message);
+	bool trySendQueue(); // true if the queue is empty
 
-	void runLoop();
+	// Socket events are processed by the shared PollService, there is no thread per transport
+	void process(PollService::Event event);
 
 	const bool mIsActive;
 	string mHostname, mService;
 
+	struct Address {
+		struct sockaddr_storage addr;
+		socklen_t addrlen;
+	};
+	std::list<Address> mAddresses; // remaining addresses to try
+
+	// Adaptive read size, larger payloads would not be recycled by the message pool
+	static constexpr size_t MinReadSize = 4096;
+	static constexpr size_t MaxReadSize = 65536;
+	size_t mReadSize = MinReadSize;
+
 	socket_t mSock = INVALID_SOCKET;
+	bool mClosed = false;
 	std::mutex mSockMutex;
-	std::thread mThread;
-	PollInterrupter mInterrupter;
-	Queue<message_ptr> mSendQueue;
+	std::deque<message_ptr> mSendQueue; // protected by mSockMutex
+	size_t mSendOffset = 0;             // bytes of the front message already sent
+	bool mKernelTls = false;
 };
 
 } // namespace rtc::impl
@@ -17,27 +17,117 @@
  */
 
 #include "threadpool.hpp"
+#include "threadregistry.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#endif
+
+#include <cerrno>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace rtc::impl {
 
+namespace {
+
+// Pool and index of the queue owned by the current worker, or null if the thread is not a worker
+thread_local const ThreadPool *tPool = nullptr;
+thread_local int tQueueIndex = -1;
+
+std::atomic<bool> CryptoEnabled = false;
+
+const ThreadPool::clock::rep NoTimer = std::numeric_limits<ThreadPool::clock::rep>::max();
+
+void pinCurrentThread(size_t index) {
+#ifdef __linux__
+	const unsigned int cpus = std::thread::hardware_concurrency();
+	if (cpus == 0)
+		return;
+
+	const unsigned int cpu = unsigned(index % cpus);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+		PLOG_WARNING << "Failed to pin thread pool worker to CPU " << cpu << ", error=" << err;
+	}
+#else
+	static_cast<void>(index);
+	PLOG_WARNING << "Pinning thread pool workers is not supported on this platform";
+#endif
+}
+
+} // namespace
+
 ThreadPool &ThreadPool::Instance() {
 	static ThreadPool *instance = new ThreadPool;
 	return *instance;
 }
 
-ThreadPool::ThreadPool() {}
+ThreadPool &ThreadPool::Crypto() {
+	static ThreadPool *instance = new ThreadPool;
+	return CryptoEnabled ? *instance : Instance();
+}
 
-ThreadPool::~ThreadPool() {}
+void ThreadPool::SetCryptoEnabled(bool enabled) { CryptoEnabled = enabled; }
+
+ThreadPool::ThreadPool()
+    : mQueuesCount(std::max(size_t(std::thread::hardware_concurrency()), size_t(THREADPOOL_SIZE))),
+      mQueues(new WorkQueue[mQueuesCount]), mNextTimer(NoTimer) {}
+
+ThreadPool::~ThreadPool() {
+#ifndef _WIN32
+	if (mSignalFds[0] >= 0)
+		::close(mSignalFds[0]);
+	if (mSignalFds[1] >= 0 && mSignalFds[1] != mSignalFds[0])
+		::close(mSignalFds[1]);
+#endif
+}
+
+size_t ThreadPool::Affinity(const void *key) {
+	// Fibonacci hashing, as low bits of addresses are not significant
+	return size_t((uint64_t(reinterpret_cast<uintptr_t>(key)) * 0x9E3779B97F4A7C15ull) >> 32);
+}
 
 int ThreadPool::count() const {
 	std::unique_lock lock(mWorkersMutex);
 	return int(mWorkers.size());
 }
 
+void ThreadPool::setPinning(bool enabled) {
+	std::unique_lock lock(mWorkersMutex);
+	mPinning = enabled;
+}
+
+void ThreadPool::setExternal(bool enabled) { mExternal = enabled; }
+
+bool ThreadPool::external() const { return mExternal; }
+
 void ThreadPool::spawn(int count) {
 	std::unique_lock lock(mWorkersMutex);
-	while (count-- > 0)
-		mWorkers.emplace_back(std::bind(&ThreadPool::run, this));
+	while (count-- > 0) {
+		size_t number = mWorkers.size();
+		int index = int(number % mQueuesCount);
+		mWorkers.emplace_back([this, index, number, pinning = mPinning]() {
+			using Role = ThreadRegistry::Role;
+			ThreadRegistry::Registration registration(
+			    this == &Instance() ? Role::Worker : Role::CryptoWorker, number);
+
+			if (pinning)
+				pinCurrentThread(number);
+
+			tPool = this;
+			tQueueIndex = index;
+			run();
+		});
+	}
+	mActiveQueues = std::min(mWorkers.size(), mQueuesCount);
 }
 
 void ThreadPool::join() {
@@ -45,7 +135,9 @@ void ThreadPool::join() {
 		std::unique_lock lock(mMutex);
 		mWaitingCondition.wait(lock, [&]() { return mBusyWorkers == 0; });
 		mJoining = true;
-		mTasksCondition.notify_all();
+		for (size_t i = 0; i < mQueuesCount; ++i)
+			mQueues[i].condition.notify_all();
+		mTimerCondition.notify_all();
 	}
 
 	std::unique_lock lock(mWorkersMutex);
@@ -53,6 +145,7 @@ void ThreadPool::join() {
 		w.join();
 
 	mWorkers.clear();
+	mActiveQueues = 0;
 
 	mJoining = false;
 }
@@ -66,34 +159,386 @@ void ThreadPool::run() {
 
 bool ThreadPool::runOne() {
 	if (auto task = dequeue()) {
-		task();
+		runTask(task);
 		return true;
 	}
 	return false;
 }
 
-std::function<void()> ThreadPool::dequeue() {
-	std::unique_lock lock(mMutex);
+size_t ThreadPool::poll(clock::duration timeout) {
+	drainHandle();
+
+	const auto deadline = clock::now() + timeout;
+	size_t count = 0;
 	while (!mJoining) {
-		std::optional<clock::time_point> time;
-		if (!mTasks.empty()) {
-			time = mTasks.top().time;
-			if (*time <= clock::now()) {
-				auto func = std::move(mTasks.top().func);
-				mTasks.pop();
-				return func;
-			}
+		while (auto task = tryDequeue()) {
+			runTask(task);
+			++count;
+		}
+
+		if (count > 0 || clock::now() >= deadline)
+			break;
+
+		std::unique_lock lock(mMutex);
+		++mIdleWorkers;
+		scope_guard idleGuard([&]() { --mIdleWorkers; });
+
+		// Check again now that we are counted as idle, a task might have been pushed meanwhile
+		if (mPendingTasks > 0 || mJoining)
+			continue;
+
+		auto until = deadline;
+		clock::rep nextTimer = mNextTimer;
+		if (nextTimer != NoTimer)
+			until = std::min(until, clock::time_point(clock::duration(nextTimer)));
+
+		if (until <= clock::now())
+			continue;
+
+		// Wait as a tasks waiter, timer insertions also wake up one of those
+		auto &queue = mQueues[ownQueueIndex().value_or(0)];
+		++mTasksWaiters;
+		++queue.waiters;
+		queue.condition.wait_until(lock, until);
+		--queue.waiters;
+		--mTasksWaiters;
+	}
+	return count;
+}
+
+int ThreadPool::pollHandle() {
+	std::unique_lock lock(mWorkersMutex);
+	if (!mSignaling) {
+#if defined(__linux__)
+		int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("Failed to create eventfd, errno=" + std::to_string(errno));
+
+		mSignalFds[0] = mSignalFds[1] = fd;
+#elif !defined(_WIN32)
+		if (::pipe(mSignalFds) < 0)
+			throw std::runtime_error("Failed to create pipe, errno=" + std::to_string(errno));
+
+		for (int fd : mSignalFds) {
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			::fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+#else
+		return -1;
+#endif
+		mSignaling = true;
+		if (mPendingTasks > 0)
+			signalHandle();
+	}
+	return mSignalFds[0];
+}
+
+optional<ThreadPool::clock::duration> ThreadPool::pollTimeout() {
+	if (mPendingTasks > 0)
+		return clock::duration::zero();
+
+	clock::rep nextTimer = mNextTimer;
+	if (nextTimer == NoTimer)
+		return nullopt;
+
+	auto delay = clock::time_point(clock::duration(nextTimer)) - clock::now();
+	return std::max(delay, clock::duration::zero());
+}
+
+void ThreadPool::signalHandle() {
+#ifndef _WIN32
+	if (!mSignaling)
+		return;
+
+	// The descriptor is non-blocking, if it can't be written then it is already readable
+	uint64_t value = 1;
+	[[maybe_unused]] auto ret = ::write(mSignalFds[1], &value,
+	                                    mSignalFds[0] == mSignalFds[1] ? sizeof(value) : 1);
+#endif
+}
+
+void ThreadPool::drainHandle() {
+#ifndef _WIN32
+	if (!mSignaling)
+		return;
+
+	uint64_t value;
+	while (::read(mSignalFds[0], &value, sizeof(value)) > 0) {
+	}
+#endif
+}
+
+void ThreadPool::runTask(task_func &task) {
+	++mCounters.runningWorkers;
+	const auto start = clock::now();
+	try {
+		task();
+	} catch (const std::exception &e) {
+		PLOG_WARNING << e.what();
+	}
+	Record(mCounters.runTime, clock::now() - start);
+	mCounters.tasksRun.fetch_add(1, std::memory_order_relaxed);
+	--mCounters.runningWorkers;
+}
+
+ThreadPoolStats ThreadPool::stats() const {
+	ThreadPoolStats s;
+	{
+		std::unique_lock lock(mWorkersMutex);
+		s.workers = unsigned(mWorkers.size());
+	}
+	{
+		std::lock_guard lock(mTimersMutex);
+		s.pendingTimers = mTimers.size();
+	}
+	s.busyWorkers = unsigned(std::max(mCounters.runningWorkers.load(), 0));
+	s.queuedTasks = mPendingTasks;
+	s.tasksRun = mCounters.tasksRun;
+	s.lockContentions = mCounters.lockContentions;
+	s.lockWaitTime = std::chrono::nanoseconds(mCounters.lockWaitTime.load());
+	for (size_t i = 0; i < ThreadPoolStats::HistogramSize; ++i) {
+		s.queueLatency[i] = mCounters.queueLatency[i];
+		s.runTime[i] = mCounters.runTime[i];
+	}
+	return s;
+}
+
+void ThreadPool::Record(std::array<std::atomic<uint64_t>, ThreadPoolStats::HistogramSize> &histogram,
+                        clock::duration duration) {
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+	size_t index = 0;
+	while (us > 0 && index < ThreadPoolStats::HistogramSize - 1) {
+		us >>= 1;
+		++index;
+	}
+	histogram[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::post(Task task) { push(std::move(task)); }
+
+void ThreadPool::post(Task task, size_t affinity) {
+	const size_t active = std::max(mActiveQueues.load(), size_t(1));
+	push(std::move(task), affinity % active);
+}
+
+ThreadPool::clock::duration ThreadPool::queueDelay() const {
+	// Plain locks, so monitoring does not count as contention
+	const auto now = clock::now();
+	const size_t active = std::max(mActiveQueues.load(), size_t(1));
+	clock::duration delay = clock::duration::zero();
+	if (const clock::rep nextTimer = mNextTimer; nextTimer < now.time_since_epoch().count())
+		delay = now - clock::time_point(clock::duration(nextTimer));
+
+	for (size_t i = 0; i < active && mPendingTasks > 0; ++i) {
+		auto &queue = mQueues[i];
+		std::lock_guard lock(queue.mutex);
+		if (!queue.tasks.empty())
+			delay = std::max(delay, now - queue.tasks.front().time);
+	}
+	return delay;
+}
+
+void ThreadPool::push(task_func func) { push(std::move(func), localQueueIndex()); }
+
+void ThreadPool::push(task_func func, size_t index) {
+	auto &queue = mQueues[index];
+	{
+		auto lock = acquire(queue.mutex);
+		queue.tasks.emplace_back(std::move(func));
+	}
+	notifyPushed(index, 1);
+}
+
+void ThreadPool::notifyPushed(size_t index, size_t count) {
+	// The increment must happen before reading the idle count, as sleeping workers increment the
+	// idle count before reading the pending count, so at least one of them sees the other.
+	mPendingTasks += count;
+	signalHandle();
+	if (mIdleWorkers > 0) {
+		auto lock = acquire(mMutex);
+		// Prefer waking up the owner of the queue, other workers will steal the tasks otherwise
+		if (notifyTasksWaiters(index, count) == 0 && mTimerWaiter)
+			mTimerCondition.notify_one();
+	}
+}
+
+size_t ThreadPool::notifyTasksWaiters(size_t preferred, size_t count) {
+	// Requires mMutex to be locked
+	size_t notified = 0;
+	for (size_t i = 0; i < mQueuesCount && notified < count && mTasksWaiters > 0; ++i) {
+		auto &queue = mQueues[(preferred + i) % mQueuesCount];
+		for (int w = 0; w < queue.waiters && notified < count; ++w) {
+			queue.condition.notify_one();
+			++notified;
 		}
+	}
+	return notified;
+}
+
+TimerWheel::entry_ptr ThreadPool::push(clock::time_point time, task_func func) {
+	TimerWheel::entry_ptr entry;
+	{
+		auto lock = acquire(mTimersMutex);
+		const clock::rep previous = mNextTimer;
+		entry = mTimers.insert(time, std::move(func));
+		updateNextTimer();
+		if (mNextTimer >= previous)
+			return entry; // the next expiration did not change, no need to wake up a worker
+	}
+
+	signalHandle(); // the poll timeout changed
+
+	std::lock_guard lock(mMutex);
+	if (mTimerWaiter)
+		mTimerCondition.notify_one(); // the timer waiter needs to wait for the new deadline
+	else
+		notifyTasksWaiters(0, 1); // one idle worker must become the timer waiter
+
+	return entry;
+}
+
+bool ThreadPool::cancel(const TimerHandle &handle) {
+	auto entry = handle.mEntry.lock();
+	if (!entry)
+		return false;
+
+	std::lock_guard lock(mTimersMutex);
+	if (!mTimers.erase(entry))
+		return false;
+
+	// A spurious wakeup of the timer waiter is harmless
+	updateNextTimer();
+	return true;
+}
+
+bool ThreadPool::pending(const TimerHandle &handle) {
+	auto entry = handle.mEntry.lock();
+	if (!entry)
+		return false;
+
+	std::lock_guard lock(mTimersMutex);
+	return entry->linked;
+}
+
+ThreadPool::task_func ThreadPool::dequeue() {
+	while (!mJoining) {
+		if (auto func = tryDequeue())
+			return func;
+
+		std::unique_lock lock(mMutex);
+		++mIdleWorkers;
+		scope_guard idleGuard([&]() { --mIdleWorkers; });
+
+		// Check again now that we are counted as idle, a task might have been pushed meanwhile
+		if (mPendingTasks > 0 || mJoining)
+			continue;
+
+		clock::rep nextTimer = mNextTimer;
+		if (nextTimer != NoTimer && nextTimer <= clock::now().time_since_epoch().count())
+			continue;
 
 		--mBusyWorkers;
-		scope_guard guard([&]() { ++mBusyWorkers; });
+		scope_guard busyGuard([&]() { ++mBusyWorkers; });
 		mWaitingCondition.notify_all();
-		if (time)
-			mTasksCondition.wait_until(lock, *time);
-		else
-			mTasksCondition.wait(lock);
+
+		// Only one idle worker waits for the next timer, the others wait for tasks
+		if (nextTimer != NoTimer && !mTimerWaiter) {
+			mTimerWaiter = true;
+			mTimerCondition.wait_until(lock, clock::time_point(clock::duration(nextTimer)));
+			mTimerWaiter = false;
+		} else {
+			auto &queue = mQueues[ownQueueIndex().value_or(0)];
+			++mTasksWaiters;
+			++queue.waiters;
+			queue.condition.wait(lock);
+			--queue.waiters;
+			--mTasksWaiters;
+		}
+	}
+	return nullptr;
+}
+
+ThreadPool::task_func ThreadPool::tryDequeue() {
+	if (auto func = popTimer())
+		return func;
+
+	size_t index = localQueueIndex();
+	if (auto func = popLocal(index))
+		return func;
+
+	return steal(index);
+}
+
+ThreadPool::task_func ThreadPool::popLocal(size_t index) {
+	auto &queue = mQueues[index];
+	auto lock = acquire(queue.mutex);
+	if (queue.tasks.empty())
+		return nullptr;
+
+	auto &front = queue.tasks.front();
+	auto func = std::move(front.func);
+	const auto time = front.time;
+	queue.tasks.pop_front();
+	--mPendingTasks;
+	lock.unlock();
+
+	Record(mCounters.queueLatency, clock::now() - time);
+	return func;
+}
+
+ThreadPool::task_func ThreadPool::steal(size_t index) {
+	const size_t active = std::max(mActiveQueues.load(), size_t(1));
+	for (size_t i = 1; i < active && mPendingTasks > 0; ++i) {
+		// Steal the oldest task to keep latency low
+		if (auto func = popLocal((index + i) % active))
+			return func;
 	}
 	return nullptr;
 }
 
+ThreadPool::task_func ThreadPool::popTimer() {
+	// Check the earliest timer without locking first
+	if (mNextTimer > clock::now().time_since_epoch().count())
+		return nullptr;
+
+	auto lock = acquire(mTimersMutex);
+	auto func = mTimers.popExpired(clock::now());
+	updateNextTimer();
+	if (!func)
+		return nullptr;
+
+	// If another timer is already due, wake up an idle worker to process it
+	if (mNextTimer <= clock::now().time_since_epoch().count() && mIdleWorkers > 0) {
+		std::lock_guard idleLock(mMutex);
+		notifyTasksWaiters(localQueueIndex(), 1);
+	}
+	return func;
+}
+
+void ThreadPool::updateNextTimer() {
+	// Requires mTimersMutex to be locked
+	auto next = mTimers.next();
+	mNextTimer = next ? next->time_since_epoch().count() : NoTimer;
+}
+
+size_t ThreadPool::localQueueIndex() {
+	if (auto index = ownQueueIndex())
+		return *index;
+
+	// External threads distribute tasks over active queues
+	const size_t active = std::max(mActiveQueues.load(), size_t(1));
+	return mNextQueue++ % active;
+}
+
+optional<size_t> ThreadPool::ownQueueIndex() const {
+	if (tPool != this || tQueueIndex < 0)
+		return nullopt;
+
+	return size_t(tQueueIndex);
+}
+
+bool TimerHandle::cancel() { return mPool ? mPool->cancel(*this) : false; }
+
+bool TimerHandle::pending() const { return mPool ? mPool->pending(*this) : false; }
+
 } // namespace rtc::impl
@@ -22,15 +22,17 @@
 #include "common.hpp"
 #include "init.hpp"
 #include "internals.hpp"
+#include "task.hpp"
+#include "timerwheel.hpp"
 
+#include <array>
 #include <chrono>
 #include <condition_variable>
 #include <deque>
-#include <functional>
 #include <future>
+#include <limits>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <stdexcept>
 #include <thread>
 #include <vector>
@@ -40,11 +42,37 @@ namespace rtc::impl {
 template <class F, class... Args>
 using invoke_future_t = std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
 
+class ThreadPool;
+
+// Handle to a delayed task scheduled with ThreadPool::scheduleTimer()
+class TimerHandle final {
+public:
+	TimerHandle() = default;
+
+	bool cancel();        // false if the task already ran or was cancelled
+	bool pending() const; // true if the task is still waiting to run
+
+private:
+	TimerHandle(ThreadPool *pool, weak_ptr<TimerWheel::Entry> entry)
+	    : mPool(pool), mEntry(std::move(entry)) {}
+
+	ThreadPool *mPool = nullptr;
+	weak_ptr<TimerWheel::Entry> mEntry;
+
+	friend class ThreadPool;
+};
+
+// Work-stealing thread pool: each worker has its own task queue, idle workers steal tasks from
+// the queues of busy workers, and delayed tasks are kept in a separate timer structure.
+// Tasks may be posted with an affinity hint to be preferably run by the same worker.
 class ThreadPool final {
 public:
 	using clock = std::chrono::steady_clock;
 
-	static ThreadPool &Instance();
+	static ThreadPool &Instance(); // general pool, used for message dispatch
+	static ThreadPool &Crypto();   // pool for crypto-heavy tasks, same as Instance() if disabled
+	static void SetCryptoEnabled(bool enabled);
+	static size_t Affinity(const void *key); // affinity hint from an object address
 
 	ThreadPool(const ThreadPool &) = delete;
 	ThreadPool &operator=(const ThreadPool &) = delete;
@@ -52,45 +80,173 @@ public:
 	ThreadPool &operator=(ThreadPool &&) = delete;
 
 	int count() const;
+	void setPinning(bool enabled);   // pin workers spawned afterwards to CPUs
+	void setExternal(bool enabled);  // no worker runs tasks, the application polls instead
+	bool external() const;
 	void spawn(int count = 1);
 	void join();
 	void run();
 	bool runOne();
 
+	// Event-loop integration, for an application running tasks on its own threads
+	size_t poll(clock::duration timeout);      // run ready tasks, or wait for some until timeout
+	int pollHandle();                          // readable when tasks are pushed, -1 if unsupported
+	optional<clock::duration> pollTimeout();   // time until a task is ready, nullopt if none
+
+	ThreadPoolStats stats() const;
+
 	template <class F, class... Args>
 	auto enqueue(F &&f, Args &&...args) -> invoke_future_t<F, Args...>;
 
+	// Enqueue a task without future, exceptions are logged
+	template <class F, class... Args> void post(F &&f, Args &&...args);
+	void post(Task task); // no init token is taken, the caller must hold one
+	void post(Task task, size_t affinity);
+
+	// Enqueue a range of callables without futures, moved from the range, with a single lock
+	// No init token is taken, the caller must hold one
+	template <class Iterator> void enqueueBatch(Iterator first, Iterator last);
+
 	template <class F, class... Args>
 	auto schedule(clock::duration delay, F &&f, Args &&...args) -> invoke_future_t<F, Args...>;
 
 	template <class F, class... Args>
 	auto schedule(clock::time_point time, F &&f, Args &&...args) -> invoke_future_t<F, Args...>;
 
+	// Schedule a delayed task without future, it can be cancelled with the returned handle
+	template <class F, class... Args>
+	TimerHandle scheduleTimer(clock::duration delay, F &&f, Args &&...args);
+
+	template <class F, class... Args>
+	TimerHandle scheduleTimer(clock::time_point time, F &&f, Args &&...args);
+
+	clock::duration queueDelay() const; // waiting time of the oldest ready task or expired timer
+
 private:
+	using task_func = Task;
+
 	ThreadPool();
 	~ThreadPool();
 
-	std::function<void()> dequeue(); // returns null function if joining
+	template <class F, class... Args>
+	auto prepare(F &&f, Args &&...args) -> std::pair<task_func, invoke_future_t<F, Args...>>;
+
+	template <class F, class... Args> task_func bind(F &&f, Args &&...args);
+
+	void push(task_func func);
+	void push(task_func func, size_t index);
+	void notifyPushed(size_t index, size_t count);
+	void signalHandle();
+	void drainHandle();
+	void runTask(task_func &task);
+
+	// Lock the mutex, accounting for the wait time if it is contended
+	template <class Mutex> std::unique_lock<Mutex> acquire(Mutex &mutex);
+	size_t notifyTasksWaiters(size_t preferred, size_t count); // requires mMutex to be locked
+	TimerWheel::entry_ptr push(clock::time_point time, task_func func);
+	bool cancel(const TimerHandle &handle);
+	bool pending(const TimerHandle &handle);
+	task_func dequeue();    // returns null function if joining
+	task_func tryDequeue(); // returns null function if no task is ready
+	task_func popLocal(size_t index);
+	task_func steal(size_t index);
+	task_func popTimer();
+	void updateNextTimer(); // requires mTimersMutex to be locked
+	size_t localQueueIndex();
+	optional<size_t> ownQueueIndex() const; // index of the queue of the current worker
+
+	struct QueuedTask {
+		QueuedTask(task_func f) : func(std::move(f)), time(clock::now()) {}
+
+		task_func func;
+		clock::time_point time; // of the enqueuing
+	};
+
+	struct WorkQueue {
+		std::deque<QueuedTask> tasks;
+		std::mutex mutex;
+
+		// Owners of the queue waiting for tasks, protected by mMutex
+		std::condition_variable condition;
+		int waiters = 0;
+	};
+	const size_t mQueuesCount;
+	const unique_ptr<WorkQueue[]> mQueues; // fixed, workers beyond the count share queues
+	std::atomic<size_t> mActiveQueues = 0; // queues owned by a worker
+	std::atomic<size_t> mNextQueue = 0;    // for tasks pushed by external threads
+	std::atomic<size_t> mPendingTasks = 0; // ready tasks in all queues
+
+	TimerWheel mTimers;
+	std::atomic<clock::rep> mNextTimer; // time of the next timer expiration, for lock-free checks
+	mutable std::mutex mTimersMutex;
 
 	std::vector<std::thread> mWorkers;
 	std::atomic<int> mBusyWorkers = 0;
+	std::atomic<int> mIdleWorkers = 0;
 	std::atomic<bool> mJoining = false;
+	std::atomic<bool> mExternal = false;
+	bool mPinning = false;     // protected by mWorkersMutex
 
-	struct Task {
-		clock::time_point time;
-		std::function<void()> func;
-		bool operator>(const Task &other) const { return time > other.time; }
-		bool operator<(const Task &other) const { return time < other.time; }
+	// Poll handle, created on demand
+	std::atomic<bool> mSignaling = false;
+	int mSignalFds[2] = {-1, -1}; // read and write ends, the same descriptor for an eventfd
+	int mTasksWaiters = 0;     // protected by mMutex
+	bool mTimerWaiter = false; // protected by mMutex
+
+	// Counters for stats
+	struct Counters {
+		std::atomic<int> runningWorkers = 0;
+		std::atomic<uint64_t> tasksRun = 0;
+		std::atomic<uint64_t> lockContentions = 0;
+		std::atomic<uint64_t> lockWaitTime = 0; // in nanoseconds
+		std::array<std::atomic<uint64_t>, ThreadPoolStats::HistogramSize> queueLatency = {};
+		std::array<std::atomic<uint64_t>, ThreadPoolStats::HistogramSize> runTime = {};
 	};
-	std::priority_queue<Task, std::deque<Task>, std::greater<Task>> mTasks;
+	Counters mCounters;
+	static void Record(std::array<std::atomic<uint64_t>, ThreadPoolStats::HistogramSize> &histogram,
+	                   clock::duration duration);
 
-	std::condition_variable mTasksCondition, mWaitingCondition;
+	std::condition_variable mTimerCondition, mWaitingCondition;
 	mutable std::mutex mMutex, mWorkersMutex;
+
+	friend class TimerHandle;
 };
 
 template <class F, class... Args>
 auto ThreadPool::enqueue(F &&f, Args &&...args) -> invoke_future_t<F, Args...> {
-	return schedule(clock::now(), std::forward<F>(f), std::forward<Args>(args)...);
+	auto [task, result] = prepare(std::forward<F>(f), std::forward<Args>(args)...);
+	push(std::move(task));
+	return std::move(result);
+}
+
+template <class F, class... Args> void ThreadPool::post(F &&f, Args &&...args) {
+	push(bind(std::forward<F>(f), std::forward<Args>(args)...));
+}
+
+template <class Iterator> void ThreadPool::enqueueBatch(Iterator first, Iterator last) {
+	const size_t index = localQueueIndex();
+	size_t count = 0;
+	{
+		auto &queue = mQueues[index];
+		auto lock = acquire(queue.mutex);
+		for (; first != last; ++first, ++count)
+			queue.tasks.emplace_back(std::move(*first));
+	}
+
+	if (count > 0)
+		notifyPushed(index, count);
+}
+
+template <class Mutex> std::unique_lock<Mutex> ThreadPool::acquire(Mutex &mutex) {
+	std::unique_lock lock(mutex, std::try_to_lock);
+	if (!lock.owns_lock()) {
+		const auto start = clock::now();
+		lock.lock();
+		const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+		mCounters.lockContentions.fetch_add(1, std::memory_order_relaxed);
+		mCounters.lockWaitTime.fetch_add(uint64_t(wait.count()), std::memory_order_relaxed);
+	}
+	return lock;
 }
 
 template <class F, class... Args>
@@ -102,10 +258,31 @@ auto ThreadPool::schedule(clock::duration delay, F &&f, Args &&...args)
 template <class F, class... Args>
 auto ThreadPool::schedule(clock::time_point time, F &&f, Args &&...args)
     -> invoke_future_t<F, Args...> {
-	std::unique_lock lock(mMutex);
+	auto [task, result] = prepare(std::forward<F>(f), std::forward<Args>(args)...);
+	if (time <= clock::now())
+		push(std::move(task));
+	else
+		push(time, std::move(task));
+
+	return std::move(result);
+}
+
+template <class F, class... Args>
+TimerHandle ThreadPool::scheduleTimer(clock::duration delay, F &&f, Args &&...args) {
+	return scheduleTimer(clock::now() + delay, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <class F, class... Args>
+TimerHandle ThreadPool::scheduleTimer(clock::time_point time, F &&f, Args &&...args) {
+	return TimerHandle(this, push(time, bind(std::forward<F>(f), std::forward<Args>(args)...)));
+}
+
+template <class F, class... Args>
+auto ThreadPool::prepare(F &&f, Args &&...args)
+    -> std::pair<task_func, invoke_future_t<F, Args...>> {
 	using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
 	auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-	auto task = std::make_shared<std::packaged_task<R()>>([bound = std::move(bound)]() mutable {
+	std::packaged_task<R()> task([bound = std::move(bound)]() mutable {
 		try {
 			return bound();
 		} catch (const std::exception &e) {
@@ -113,11 +290,17 @@ auto ThreadPool::schedule(clock::time_point time, F &&f, Args &&...args)
 			throw;
 		}
 	});
-	std::future<R> result = task->get_future();
+	std::future<R> result = task.get_future();
+	task_func func = [task = std::move(task), token = Init::Instance().token()]() mutable {
+		task();
+	};
+	return std::make_pair(std::move(func), std::move(result));
+}
 
-	mTasks.push({time, [task = std::move(task), token = Init::Instance().token()]() { return (*task)(); }});
-	mTasksCondition.notify_one();
-	return result;
+template <class F, class... Args> ThreadPool::task_func ThreadPool::bind(F &&f, Args &&...args) {
+	// Exceptions are caught and logged by the worker
+	auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+	return [bound = std::move(bound), token = Init::Instance().token()]() mutable { bound(); };
 }
 
 } // namespace rtc::impl
@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "threadregistry.hpp"
+#include "internals.hpp"
+
+#include <algorithm>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#ifdef __linux__
+#include <ctime>
+#endif
+
+namespace rtc::impl {
+
+namespace {
+
+void setCurrentThreadName(const string &name) {
+	// Linux limits names to 15 characters
+#if defined(__linux__)
+	pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#elif defined(__APPLE__)
+	pthread_setname_np(name.c_str());
+#else
+	static_cast<void>(name); // not supported
+#endif
+}
+
+#ifdef __linux__
+std::chrono::nanoseconds readCpuClock(clockid_t clock) {
+	struct timespec ts;
+	if (clock_gettime(clock, &ts) != 0)
+		return std::chrono::nanoseconds::zero();
+
+	return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+#endif
+
+} // namespace
+
+ThreadRegistry &ThreadRegistry::Instance() {
+	static ThreadRegistry *instance = new ThreadRegistry;
+	return *instance;
+}
+
+ThreadRegistry::Registration::Registration(Role role, optional<size_t> index)
+    : mRole(role), mId(Instance().add(role)) {
+	string name = string("rtc-") + RoleName(role);
+	if (index)
+		name += '-' + std::to_string(*index);
+
+	setCurrentThreadName(name);
+}
+
+ThreadRegistry::Registration::~Registration() { Instance().remove(mId, mRole); }
+
+std::vector<ThreadRoleStats> ThreadRegistry::stats() const {
+	std::lock_guard lock(mMutex);
+	std::vector<ThreadRoleStats> result(size_t(Role::Count));
+	for (size_t i = 0; i < result.size(); ++i) {
+		result[i].role = RoleName(Role(i));
+		result[i].cpuTime = mExitedCpuTime[i];
+	}
+
+	// Threads remove themselves under the lock before exiting, so their clocks are valid
+	for (const auto &thread : mThreads) {
+		auto &s = result[size_t(thread.role)];
+		++s.threads;
+#ifdef __linux__
+		if (thread.clock)
+			s.cpuTime += readCpuClock(*thread.clock);
+#endif
+	}
+	return result;
+}
+
+const char *ThreadRegistry::RoleName(Role role) {
+	switch (role) {
+	case Role::Worker:
+		return "worker";
+	case Role::CryptoWorker:
+		return "crypto";
+	case Role::Poll:
+		return "poll";
+	case Role::Ice:
+		return "ice";
+	case Role::SctpTimer:
+		return "sctp-timer";
+	case Role::Cleanup:
+		return "cleanup";
+	case Role::Overload:
+		return "overload";
+	case Role::Resolver:
+		return "resolver";
+	default:
+		return "unknown";
+	}
+}
+
+uint64_t ThreadRegistry::add(Role role) {
+	Thread thread;
+	thread.role = role;
+#ifdef __linux__
+	clockid_t clock;
+	if (pthread_getcpuclockid(pthread_self(), &clock) == 0)
+		thread.clock = clock;
+#endif
+
+	std::lock_guard lock(mMutex);
+	thread.id = mNextId++;
+	mThreads.push_back(thread);
+	return thread.id;
+}
+
+void ThreadRegistry::remove(uint64_t id, Role role) {
+	std::lock_guard lock(mMutex);
+#ifdef __linux__
+	mExitedCpuTime[size_t(role)] += readCpuClock(CLOCK_THREAD_CPUTIME_ID);
+#else
+	static_cast<void>(role);
+#endif
+	mThreads.erase(std::remove_if(mThreads.begin(), mThreads.end(),
+	                              [id](const Thread &t) { return t.id == id; }),
+	               mThreads.end());
+}
+
+} // namespace rtc::impl
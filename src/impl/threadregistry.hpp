@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_THREAD_REGISTRY_H
+#define RTC_IMPL_THREAD_REGISTRY_H
+
+#include "common.hpp"
+
+#include "rtc/global.hpp"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace rtc::impl {
+
+// Threads created by the library register with their role for the lifetime of the thread. The
+// thread is named after the role, so it can be told apart in top, perf, or a debugger, and its
+// CPU time is accounted per role.
+class ThreadRegistry final {
+public:
+	enum class Role : size_t {
+		Worker,       // thread pool
+		CryptoWorker, // crypto thread pool
+		Poll,         // poll service
+		Ice,          // libnice main loop
+		SctpTimer,    // usrsctp timers
+		Cleanup,      // global cleanup
+		Overload,     // overload controller
+		Resolver,     // DNS and mDNS resolutions
+		Count,
+	};
+
+	static ThreadRegistry &Instance();
+
+	// Registers the current thread until destroyed, which must happen on the same thread
+	class Registration final {
+	public:
+		Registration(Role role, optional<size_t> index = nullopt); // index is added to the name
+		~Registration();
+
+		Registration(const Registration &) = delete;
+		Registration &operator=(const Registration &) = delete;
+
+	private:
+		const Role mRole;
+		const uint64_t mId;
+	};
+
+	std::vector<ThreadRoleStats> stats() const;
+
+private:
+	ThreadRegistry() = default;
+
+	struct Thread {
+		uint64_t id;
+		Role role;
+#ifdef __linux__
+		optional<clockid_t> clock; // CPU clock of the thread
+#endif
+	};
+
+	static const char *RoleName(Role role);
+
+	uint64_t add(Role role);
+	void remove(uint64_t id, Role role);
+
+	std::vector<Thread> mThreads;
+	uint64_t mNextId = 0;
+	std::array<std::chrono::nanoseconds, size_t(Role::Count)> mExitedCpuTime = {};
+	mutable std::mutex mMutex;
+};
+
+} // namespace rtc::impl
+
+#endif
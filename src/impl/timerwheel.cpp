@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "timerwheel.hpp"
+
+#include <algorithm>
+
+namespace rtc::impl {
+
+TimerWheel::TimerWheel(clock::time_point start) : mStart(start) {}
+
+TimerWheel::~TimerWheel() {}
+
+TimerWheel::entry_ptr TimerWheel::insert(clock::time_point time, task_func func) {
+	auto entry = std::make_shared<Entry>();
+	entry->tick = toTick(time);
+	entry->func = std::move(func);
+	place(entry);
+	++mSize;
+	return entry;
+}
+
+bool TimerWheel::erase(const entry_ptr &entry) {
+	if (!entry || !entry->linked)
+		return false;
+
+	if (entry->level >= 0) {
+		slot(entry->level, entry->index).erase(entry->it);
+		--mCounts[entry->level];
+	} else {
+		mExpired.erase(entry->it);
+	}
+	entry->linked = false;
+	--mSize;
+	return true;
+}
+
+TimerWheel::task_func TimerWheel::popExpired(clock::time_point now) {
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - mStart);
+	advance(uint64_t(std::max(elapsed.count(), decltype(elapsed.count())(0))));
+
+	if (mExpired.empty())
+		return nullptr;
+
+	auto entry = std::move(mExpired.front());
+	mExpired.pop_front();
+	entry->linked = false;
+	--mSize;
+	return std::move(entry->func);
+}
+
+optional<TimerWheel::clock::time_point> TimerWheel::next() const {
+	if (mSize == 0)
+		return nullopt;
+
+	auto toTime = [this](uint64_t tick) { return mStart + std::chrono::milliseconds(tick); };
+
+	if (!mExpired.empty())
+		return toTime(mCurrent);
+
+	optional<uint64_t> result;
+
+	// Entries on level 0 expire within the current window
+	for (size_t k = 0; k < Level0Size; ++k) {
+		if (!mLevel0[(mCurrent + k) & mask(0)].empty()) {
+			result = mCurrent + k;
+			break;
+		}
+	}
+
+	// Entries on other levels need to be cascaded first
+	for (int level = 1; level < LevelsCount; ++level) {
+		const uint64_t base = mCurrent >> shift(level);
+		for (size_t k = 1; k <= LevelSize; ++k) {
+			if (!mLevels[level - 1][(base + k) & mask(level)].empty()) {
+				uint64_t tick = (base + k) << shift(level);
+				result = result ? std::min(*result, tick) : tick;
+				break;
+			}
+		}
+	}
+
+	return result ? std::make_optional(toTime(*result)) : nullopt;
+}
+
+bool TimerWheel::empty() const { return mSize == 0; }
+
+size_t TimerWheel::size() const { return mSize; }
+
+uint64_t TimerWheel::toTick(clock::time_point time) const {
+	if (time <= mStart)
+		return 0;
+
+	// Round up so entries never expire early
+	auto elapsed = std::chrono::ceil<std::chrono::milliseconds>(time - mStart);
+	return uint64_t(elapsed.count());
+}
+
+TimerWheel::list &TimerWheel::slot(int level, size_t index) {
+	return level > 0 ? mLevels[level - 1][index] : mLevel0[index];
+}
+
+void TimerWheel::place(const entry_ptr &entry) {
+	const uint64_t tick = std::max(entry->tick, mCurrent);
+	const uint64_t delta = tick - mCurrent;
+
+	int level = 0;
+	while (level < LevelsCount - 1 && delta >= (uint64_t(1) << shift(level + 1)))
+		++level;
+
+	// Entries beyond the range of the last level are placed in its farthest slot and will be
+	// placed again when cascaded
+	const uint64_t maxTick = mCurrent + (uint64_t(1) << (shift(LevelsCount - 1) + LevelBits)) - 1;
+	const size_t index = size_t(std::min(tick, maxTick) >> shift(level)) & mask(level);
+
+	auto &l = slot(level, index);
+	entry->level = level;
+	entry->index = index;
+	entry->it = l.insert(l.end(), entry);
+	entry->linked = true;
+	++mCounts[level];
+}
+
+void TimerWheel::advance(uint64_t target) {
+	while (true) {
+		// Expire the current slot
+		auto &current = mLevel0[mCurrent & mask(0)];
+		for (auto &entry : current)
+			entry->level = -1;
+
+		mCounts[0] -= current.size();
+		mExpired.splice(mExpired.end(), current);
+
+		if (mCurrent >= target)
+			break;
+
+		if (mSize == mExpired.size()) {
+			// Nothing left in the wheel, jump directly to the target
+			mCurrent = target;
+			continue;
+		}
+
+		// Skip empty slots up to the next boundary
+		uint64_t next = mCurrent + 1;
+		const uint64_t boundary = (mCurrent | mask(0)) + 1;
+		if (mCounts[0] == 0)
+			next = std::min(boundary, target);
+
+		while (next < boundary && next < target && mLevel0[next & mask(0)].empty())
+			++next;
+
+		mCurrent = next;
+		if ((mCurrent & mask(0)) == 0)
+			cascade(1);
+	}
+}
+
+void TimerWheel::cascade(int level) {
+	if (level >= LevelsCount)
+		return;
+
+	const size_t index = size_t(mCurrent >> shift(level)) & mask(level);
+	if (index == 0)
+		cascade(level + 1); // higher level entries must be placed first
+
+	list entries;
+	entries.splice(entries.end(), slot(level, index));
+	mCounts[level] -= entries.size();
+	for (auto &entry : entries)
+		place(entry);
+}
+
+} // namespace rtc::impl
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_TIMER_WHEEL_H
+#define RTC_IMPL_TIMER_WHEEL_H
+
+#include "common.hpp"
+#include "task.hpp"
+
+#include <array>
+#include <chrono>
+#include <list>
+
+namespace rtc::impl {
+
+// Hierarchical timing wheel with a resolution of 1ms
+// Insertion and removal are O(1), entries are cascaded to lower levels as time advances.
+// The wheel is not thread-safe, the caller is responsible for synchronization.
+class TimerWheel final {
+public:
+	using clock = std::chrono::steady_clock;
+	using task_func = Task;
+
+	struct Entry;
+	using entry_ptr = shared_ptr<Entry>;
+
+	TimerWheel(clock::time_point start = clock::now());
+	~TimerWheel();
+
+	TimerWheel(const TimerWheel &) = delete;
+	TimerWheel &operator=(const TimerWheel &) = delete;
+
+	entry_ptr insert(clock::time_point time, task_func func);
+	bool erase(const entry_ptr &entry); // false if already expired or erased
+	task_func popExpired(clock::time_point now); // returns null function if nothing expired
+	optional<clock::time_point> next() const;    // time when the next entry might expire
+
+	bool empty() const;
+	size_t size() const;
+
+private:
+	using list = std::list<entry_ptr>;
+
+	static const int Level0Bits = 8;
+	static const int LevelBits = 6;
+	static const int LevelsCount = 4; // 2^26 ms, around 18 hours
+	static const size_t Level0Size = size_t(1) << Level0Bits;
+	static const size_t LevelSize = size_t(1) << LevelBits;
+
+	static int shift(int level) { return level > 0 ? Level0Bits + (level - 1) * LevelBits : 0; }
+	static size_t mask(int level) { return (level > 0 ? LevelSize : Level0Size) - 1; }
+
+	uint64_t toTick(clock::time_point time) const; // rounded up
+	list &slot(int level, size_t index);
+	void place(const entry_ptr &entry);
+	void advance(uint64_t target);
+	void cascade(int level);
+
+	const clock::time_point mStart;
+	uint64_t mCurrent = 0; // current tick
+	size_t mSize = 0;
+	std::array<size_t, LevelsCount> mCounts = {}; // entries per level
+
+	std::array<list, Level0Size> mLevel0;
+	std::array<std::array<list, LevelSize>, LevelsCount - 1> mLevels;
+	list mExpired;
+};
+
+struct TimerWheel::Entry {
+	uint64_t tick = 0;
+	task_func func;
+
+	// Location in the wheel
+	bool linked = false;
+	int level = -1; // -1 means expired
+	size_t index = 0;
+	list::iterator it;
+};
+
+} // namespace rtc::impl
+
+#endif
@@ -60,6 +60,7 @@ gnutls_datum_t make_datum(char *data, size_t size);
 #include <openssl/ec.h>
 #include <openssl/err.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
 
@@ -67,6 +68,13 @@ gnutls_datum_t make_datum(char *data, size_t size);
 #define BIO_EOF -1
 #endif
 
+// Kernel TLS transmit offload is Linux only, keys are derived with the OpenSSL 3 KDF API
+#if defined(__linux__) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+#define RTC_TLS_KERNEL_OFFLOAD 1
+#else
+#define RTC_TLS_KERNEL_OFFLOAD 0
+#endif
+
 namespace rtc::openssl {
 
 void init();
@@ -16,24 +16,132 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM Tls
+
 #include "tlstransport.hpp"
 #include "tcptransport.hpp"
+#include "threadpool.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
 
+#include <array>
 #include <chrono>
 #include <cstring>
 #include <exception>
 #include <iostream>
+#include <map>
+
+#if RTC_TLS_KERNEL_OFFLOAD
+#include <linux/tls.h>
+#include <openssl/core_names.h>
+#include <openssl/kdf.h>
+#endif
 
 using namespace std::chrono;
 
 namespace rtc::impl {
 
+namespace {
+
+// Process-wide cache of client sessions, keyed by remote address
+// Entries are taken out when used since TLS 1.3 tickets should not be reused, the server sends
+// fresh tickets on the resumed connection.
+template <typename T> class SessionCache {
+public:
+	void put(const string &key, T session) {
+		std::lock_guard lock(mMutex);
+		if (mSessions.size() >= MaxEntries && mSessions.find(key) == mSessions.end()) {
+			// Evict the oldest entry
+			auto oldest = mSessions.begin();
+			for (auto it = mSessions.begin(); it != mSessions.end(); ++it)
+				if (it->second.second < oldest->second.second)
+					oldest = it;
+
+			mSessions.erase(oldest);
+		}
+		mSessions[key] = std::make_pair(std::move(session), ++mCounter);
+	}
+
+	optional<T> take(const string &key) {
+		std::lock_guard lock(mMutex);
+		auto it = mSessions.find(key);
+		if (it == mSessions.end())
+			return nullopt;
+
+		T session = std::move(it->second.first);
+		mSessions.erase(it);
+		return session;
+	}
+
+	void clear() {
+		std::lock_guard lock(mMutex);
+		mSessions.clear();
+	}
+
+private:
+	static const size_t MaxEntries = 256;
+
+	std::mutex mMutex;
+	std::map<string, std::pair<T, uint64_t>> mSessions;
+	uint64_t mCounter = 0;
+};
+
+} // namespace
+
+void TlsTransport::incoming(message_ptr message) {
+	if (mOffloading) {
+		std::lock_guard lock(mOffloadMutex);
+		if (mOffloading) {
+			mOffloadedQueue.push(std::move(message));
+			if (!std::exchange(mOffloadScheduled, true))
+				ThreadPool::Crypto().post(weak_bind(&TlsTransport::processOffloaded, this));
+
+			return;
+		}
+	}
+
+	processIncoming(std::move(message));
+}
+
+void TlsTransport::processOffloaded() {
+	std::unique_lock lock(mOffloadMutex);
+	while (!mOffloadedQueue.empty()) {
+		auto message = std::move(mOffloadedQueue.front());
+		mOffloadedQueue.pop();
+		lock.unlock();
+		processIncoming(std::move(message));
+		lock.lock();
+	}
+
+	// Once the handshake is done, records are decrypted inline again
+	if (state() != State::Connecting)
+		mOffloading = false;
+
+	mOffloadScheduled = false;
+}
+
 #if USE_GNUTLS
 
 namespace {
 
+SessionCache<binary> &session_cache() {
+	static SessionCache<binary> cache;
+	return cache;
+}
+
+// Servers share a single ticket key so sessions can be resumed across connections
+const gnutls_datum_t *session_ticket_key() {
+	static std::mutex mutex;
+	static gnutls_datum_t key = {nullptr, 0};
+
+	std::lock_guard lock(mutex);
+	if (!key.data)
+		gnutls::check(gnutls_session_ticket_key_generate(&key),
+		              "Failed to generate TLS session ticket key");
+
+	return &key;
+}
+
 gnutls_certificate_credentials_t default_certificate_credentials() {
 	static std::mutex mutex;
 	static shared_ptr<gnutls_certificate_credentials_t> creds;
@@ -53,17 +161,24 @@ void TlsTransport::Init() {
 	// Nothing to do
 }
 
-void TlsTransport::Cleanup() {
-	// Nothing to do
-}
+void TlsTransport::Cleanup() { session_cache().clear(); }
 
 TlsTransport::TlsTransport(shared_ptr<TcpTransport> lower, optional<string> host,
-                           certificate_ptr certificate, state_callback callback)
-    : Transport(lower, std::move(callback)), mHost(std::move(host)), mIsClient(lower->isActive()) {
+                           certificate_ptr certificate, state_callback callback, bool kernelTls)
+    : Transport(lower, std::move(callback)), mHost(std::move(host)), mIsClient(lower->isActive()),
+      mOffloading(!mIsClient) {
 
 	PLOG_DEBUG << "Initializing TLS transport (GnuTLS)";
 
-	gnutls::check(gnutls_init(&mSession, mIsClient ? GNUTLS_CLIENT : GNUTLS_SERVER));
+	if (kernelTls) {
+		PLOG_WARNING << "Kernel TLS is not supported with GnuTLS";
+	}
+
+	if (mIsClient)
+		mSessionKey = lower->remoteAddress();
+
+	gnutls::check(
+	    gnutls_init(&mSession, GNUTLS_NONBLOCK | (mIsClient ? GNUTLS_CLIENT : GNUTLS_SERVER)));
 
 	try {
 		const char *priorities = "SECURE128:-VERS-SSL3.0:-ARCFOUR-128";
@@ -80,6 +195,14 @@ TlsTransport::TlsTransport(shared_ptr<TcpTransport> lower, optional<string> host
 			gnutls_server_name_set(mSession, GNUTLS_NAME_DNS, mHost->data(), mHost->size());
 		}
 
+		// Early data is never enabled, resumed sessions only skip the full handshake
+		if (mIsClient)
+			gnutls_handshake_set_hook_function(mSession, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET,
+			                                   GNUTLS_HOOK_POST, TicketCallback);
+		else
+			gnutls::check(gnutls_session_ticket_enable_server(mSession, session_ticket_key()),
+			              "Failed to enable TLS session tickets");
+
 		gnutls_session_set_ptr(mSession, this);
 		gnutls_transport_set_ptr(mSession, this);
 		gnutls_transport_set_push_function(mSession, WriteCallback);
@@ -100,111 +223,248 @@ TlsTransport::~TlsTransport() {
 
 void TlsTransport::start() {
 	Transport::start();
+	changeState(State::Connecting);
+
+	try {
+		std::unique_lock lock(mMutex);
+		registerIncoming();
+		restoreSession();
 
-	registerIncoming();
+		// Initiate the handshake
+		handshake();
 
-	PLOG_DEBUG << "Starting TLS recv thread";
-	mRecvThread = std::thread(&TlsTransport::runRecvLoop, this);
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "TLS handshake: " << e.what();
+		finish();
+	}
 }
 
 bool TlsTransport::stop() {
 	if (!Transport::stop())
 		return false;
 
-	PLOG_DEBUG << "Stopping TLS recv thread";
-	mIncomingQueue.stop();
-	mRecvThread.join();
+	PLOG_DEBUG << "Stopping TLS transport";
+	finish();
+
+	std::lock_guard lock(mMutex);
+	if (mHandshakeDone) {
+		std::lock_guard sendLock(mSendMutex);
+		gnutls_bye(mSession, GNUTLS_SHUT_WR);
+	}
+
 	return true;
 }
 
+void TlsTransport::setAlpnProtocols(std::vector<string> protocols) {
+	std::vector<gnutls_datum_t> data;
+	data.reserve(protocols.size());
+	for (const auto &protocol : protocols)
+		data.push_back(gnutls_datum_t{reinterpret_cast<unsigned char *>(const_cast<char *>(
+		                                  protocol.data())),
+		                              unsigned(protocol.size())});
+
+	std::lock_guard lock(mMutex);
+	gnutls::check(gnutls_alpn_set_protocols(mSession, data.data(), unsigned(data.size()), 0),
+	              "Failed to set ALPN protocols");
+}
+
+optional<string> TlsTransport::alpnProtocol() {
+	std::lock_guard lock(mMutex);
+	gnutls_datum_t protocol;
+	if (gnutls_alpn_get_selected_protocol(mSession, &protocol) != GNUTLS_E_SUCCESS)
+		return nullopt;
+
+	return string(reinterpret_cast<const char *>(protocol.data), protocol.size);
+}
+
 bool TlsTransport::send(message_ptr message) {
 	if (!message || state() != State::Connected)
 		return false;
 
-	PLOG_VERBOSE << "Send size=" << message->size();
+	PLOG_VERBOSE << "Send size=" << message->payloadSize();
 
-	if (message->size() == 0)
+	if (message->payloadSize() == 0)
 		return true;
 
+	std::lock_guard lock(mSendMutex);
 	ssize_t ret;
 	do {
-		ret = gnutls_record_send(mSession, message->data(), message->size());
+		ret = gnutls_record_send(mSession, message->payload(), message->payloadSize());
 	} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
 
 	return gnutls::check(ret);
 }
 
-void TlsTransport::incoming(message_ptr message) {
+size_t TlsTransport::sendBatch(const std::vector<message_ptr> &messages) {
+	if (state() != State::Connected)
+		return 0;
+
+	// Corking makes GnuTLS pack the messages into as few records as possible, the cork is held for
+	// the whole batch so concurrent sends can't be appended to it or flush it partially
+	std::lock_guard lock(mSendMutex);
+	gnutls_record_cork(mSession);
+	size_t count = 0;
+	for (const auto &message : messages) {
+		if (!message)
+			continue;
+
+		if (message->payloadSize() > 0) {
+			ssize_t ret;
+			do {
+				ret = gnutls_record_send(mSession, message->payload(), message->payloadSize());
+			} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
+
+			if (ret < 0) {
+				gnutls_record_uncork(mSession, 0);
+				gnutls::check(ret);
+				break;
+			}
+		}
+		++count;
+	}
+
+	int ret;
+	do {
+		ret = gnutls_record_uncork(mSession, GNUTLS_RECORD_WAIT);
+	} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
+
+	return gnutls::check(ret) ? count : 0;
+}
+
+void TlsTransport::processIncoming(message_ptr message) {
 	if (!message) {
-		mIncomingQueue.stop();
+		finish();
 		return;
 	}
 
 	PLOG_VERBOSE << "Incoming size=" << message->size();
-	mIncomingQueue.push(message);
+
+	try {
+		std::unique_lock lock(mMutex);
+		if (mClosed)
+			return;
+
+		if (message->size() == 0) {
+			// Pass zero-sized messages through
+			if (mHandshakeDone) {
+				lock.unlock();
+				recv(message);
+			}
+			return;
+		}
+
+		mIncomingMessage = std::move(message);
+		mIncomingMessagePosition = 0;
+
+		if (!mHandshakeDone) {
+			if (!handshake())
+				return;
+
+			lock.unlock();
+			PLOG_INFO << "TLS handshake finished";
+			changeState(State::Connected);
+			lock.lock();
+		}
+
+		// The lock must not be held while passing records up, as the upper layer may send
+		while (!mClosed) {
+			auto record = readRecord();
+			if (!record)
+				break;
+
+			lock.unlock();
+			if (!*record) {
+				finish();
+				return;
+			}
+			recv(std::move(*record));
+			lock.lock();
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "TLS recv: " << e.what();
+		finish();
+	}
 }
 
 void TlsTransport::postHandshake() {
 	// Dummy
 }
 
-void TlsTransport::runRecvLoop() {
-	const size_t bufferSize = 4096;
-	char buffer[bufferSize];
+bool TlsTransport::handshake() {
+	int ret;
+	do {
+		ret = gnutls_handshake(mSession);
+		if (ret == GNUTLS_E_AGAIN)
+			return false; // wait for more data
 
-	// Handshake loop
-	try {
-		changeState(State::Connecting);
+	} while (ret == GNUTLS_E_INTERRUPTED || !gnutls::check(ret, "TLS handshake failed"));
 
-		int ret;
-		do {
-			ret = gnutls_handshake(mSession);
-		} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN ||
-		         !gnutls::check(ret, "TLS handshake failed"));
+	if (gnutls_session_is_resumed(mSession)) {
+		PLOG_DEBUG << "TLS session resumed";
+	}
 
-	} catch (const std::exception &e) {
-		PLOG_ERROR << "TLS handshake: " << e.what();
-		changeState(State::Failed);
+	// With TLS 1.3, tickets are received after the handshake and stored by TicketCallback
+	if (gnutls_protocol_get_version(mSession) != GNUTLS_TLS1_3)
+		storeSession();
+
+	postHandshake();
+	mHandshakeDone = true;
+	return true;
+}
+
+void TlsTransport::restoreSession() {
+	if (!mSessionKey)
 		return;
+
+	if (auto data = session_cache().take(*mSessionKey)) {
+		PLOG_VERBOSE << "Resuming TLS session for " << *mSessionKey;
+		int ret = gnutls_session_set_data(mSession, data->data(), data->size());
+		if (ret != GNUTLS_E_SUCCESS) {
+			PLOG_DEBUG << "Failed to restore TLS session: " << gnutls_strerror(ret);
+		}
 	}
+}
 
-	// Receive loop
-	try {
-		PLOG_INFO << "TLS handshake finished";
-		changeState(State::Connected);
-		postHandshake();
+void TlsTransport::storeSession() {
+	if (!mSessionKey)
+		return;
 
-		while (true) {
-			ssize_t ret;
-			do {
-				ret = gnutls_record_recv(mSession, buffer, bufferSize);
-			} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
+	gnutls_datum_t data = {nullptr, 0};
+	if (gnutls_session_get_data2(mSession, &data) != GNUTLS_E_SUCCESS)
+		return;
 
-			// Consider premature termination as remote closing
-			if (ret == GNUTLS_E_PREMATURE_TERMINATION) {
-				PLOG_DEBUG << "TLS connection terminated";
-				break;
-			}
+	auto b = reinterpret_cast<const byte *>(data.data);
+	session_cache().put(*mSessionKey, binary(b, b + data.size));
+	gnutls_free(data.data);
+}
+
+optional<message_ptr> TlsTransport::readRecord() {
+	char buffer[BufferSize];
+	while (true) {
+		ssize_t ret = gnutls_record_recv(mSession, buffer, BufferSize);
+		if (ret == GNUTLS_E_AGAIN)
+			return nullopt;
+
+		if (ret == GNUTLS_E_INTERRUPTED)
+			continue;
 
-			if (gnutls::check(ret)) {
-				if (ret == 0) {
-					// Closed
-					PLOG_DEBUG << "TLS connection cleanly closed";
-					break;
-				}
-				auto *b = reinterpret_cast<byte *>(buffer);
-				recv(make_message(b, b + ret));
+		// Consider premature termination as remote closing
+		if (ret == GNUTLS_E_PREMATURE_TERMINATION) {
+			PLOG_DEBUG << "TLS connection terminated";
+			return nullptr;
+		}
+
+		if (gnutls::check(ret)) {
+			if (ret == 0) {
+				// Closed
+				PLOG_DEBUG << "TLS connection cleanly closed";
+				return nullptr;
 			}
+			auto *b = reinterpret_cast<byte *>(buffer);
+			return make_message(b, b + ret);
 		}
-	} catch (const std::exception &e) {
-		PLOG_ERROR << "TLS recv: " << e.what();
 	}
-
-	gnutls_bye(mSession, GNUTLS_SHUT_RDWR);
-
-	PLOG_INFO << "TLS closed";
-	changeState(State::Disconnected);
-	recv(nullptr);
 }
 
 ssize_t TlsTransport::WriteCallback(gnutls_transport_ptr_t ptr, const void *data, size_t len) {
@@ -227,23 +487,13 @@ ssize_t TlsTransport::WriteCallback(gnutls_transport_ptr_t ptr, const void *data
 ssize_t TlsTransport::ReadCallback(gnutls_transport_ptr_t ptr, void *data, size_t maxlen) {
 	TlsTransport *t = static_cast<TlsTransport *>(ptr);
 	try {
+		// The session is non-blocking, only the pending message is consumed
 		message_ptr &message = t->mIncomingMessage;
 		size_t &position = t->mIncomingMessagePosition;
 
 		if (message && position >= message->size())
 			message.reset();
 
-		if (!message) {
-			position = 0;
-			while (auto next = t->mIncomingQueue.pop()) {
-				message = *next;
-				if (message->size() > 0)
-					break;
-				else
-					t->recv(message); // Pass zero-sized messages through
-			}
-		}
-
 		if (message) {
 			size_t available = message->size() - position;
 			ssize_t len = std::min(maxlen, available);
@@ -251,12 +501,11 @@ ssize_t TlsTransport::ReadCallback(gnutls_transport_ptr_t ptr, void *data, size_
 			position += len;
 			gnutls_transport_set_errno(t->mSession, 0);
 			return len;
-		} else {
-			// Closed
-			gnutls_transport_set_errno(t->mSession, 0);
-			return 0;
 		}
 
+		gnutls_transport_set_errno(t->mSession, EAGAIN);
+		return -1;
+
 	} catch (const std::exception &e) {
 		PLOG_WARNING << e.what();
 		gnutls_transport_set_errno(t->mSession, ECONNRESET);
@@ -264,21 +513,57 @@ ssize_t TlsTransport::ReadCallback(gnutls_transport_ptr_t ptr, void *data, size_
 	}
 }
 
-int TlsTransport::TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int ms) {
+int TlsTransport::TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int /*ms*/) {
 	TlsTransport *t = static_cast<TlsTransport *>(ptr);
-	try {
-		bool isReadable = t->mIncomingQueue.wait(
-		    ms != GNUTLS_INDEFINITE_TIMEOUT ? std::make_optional(milliseconds(ms)) : nullopt);
-		return isReadable ? 1 : 0;
+	// Never block, the handshake is resumed when more data is received
+	const message_ptr &message = t->mIncomingMessage;
+	return message && t->mIncomingMessagePosition < message->size() ? 1 : 0;
+}
 
-	} catch (const std::exception &e) {
-		PLOG_WARNING << e.what();
-		return 1;
-	}
+int TlsTransport::TicketCallback(gnutls_session_t session, unsigned int /*htype*/,
+                                 unsigned int /*when*/, unsigned int incoming,
+                                 const gnutls_datum_t * /*msg*/) {
+	TlsTransport *t = static_cast<TlsTransport *>(gnutls_session_get_ptr(session));
+	// Called from gnutls_record_recv() with mMutex locked
+	if (incoming && gnutls_protocol_get_version(session) == GNUTLS_TLS1_3)
+		t->storeSession();
+
+	return 0;
 }
 
 #else // USE_GNUTLS==0
 
+namespace {
+
+struct SessionDeleter {
+	void operator()(SSL_SESSION *session) { SSL_SESSION_free(session); }
+};
+
+using session_ptr = shared_ptr<SSL_SESSION>;
+
+SessionCache<session_ptr> &session_cache() {
+	static SessionCache<session_ptr> cache;
+	return cache;
+}
+
+// Servers share a single set of ticket keys so sessions can be resumed across connections, as
+// each transport has its own context
+std::array<unsigned char, 80> session_ticket_keys() { // name, HMAC secret, and AES key
+	static std::mutex mutex;
+	static optional<std::array<unsigned char, 80>> keys;
+
+	std::lock_guard lock(mutex);
+	if (!keys) {
+		std::array<unsigned char, 80> generated;
+		openssl::check(RAND_bytes(generated.data(), int(generated.size())),
+		               "Failed to generate TLS session ticket keys");
+		keys.emplace(generated);
+	}
+	return *keys;
+}
+
+} // namespace
+
 int TlsTransport::TransportExIndex = -1;
 
 void TlsTransport::Init() {
@@ -289,16 +574,27 @@ void TlsTransport::Init() {
 	}
 }
 
-void TlsTransport::Cleanup() {
-	// Nothing to do
-}
+void TlsTransport::Cleanup() { session_cache().clear(); }
 
 TlsTransport::TlsTransport(shared_ptr<TcpTransport> lower, optional<string> host,
-                           certificate_ptr certificate, state_callback callback)
-    : Transport(lower, std::move(callback)), mHost(std::move(host)), mIsClient(lower->isActive()) {
+                           certificate_ptr certificate, state_callback callback, bool kernelTls)
+    : Transport(lower, std::move(callback)), mHost(std::move(host)), mIsClient(lower->isActive()),
+      mOffloading(!mIsClient) {
 
 	PLOG_DEBUG << "Initializing TLS transport (OpenSSL)";
 
+	if (mIsClient)
+		mSessionKey = lower->remoteAddress();
+
+#if RTC_TLS_KERNEL_OFFLOAD
+	if (kernelTls)
+		mKernelTlsLower = lower;
+#else
+	if (kernelTls) {
+		PLOG_WARNING << "Kernel TLS is not supported";
+	}
+#endif
+
 	try {
 		if (!(mCtx = SSL_CTX_new(SSLv23_method()))) // version-flexible
 			throw std::runtime_error("Failed to create SSL context");
@@ -323,6 +619,18 @@ TlsTransport::TlsTransport(shared_ptr<TcpTransport> lower, optional<string> host
 		SSL_CTX_set_info_callback(mCtx, InfoCallback);
 		SSL_CTX_set_verify(mCtx, SSL_VERIFY_NONE, NULL);
 
+		// Early data is never enabled, resumed sessions only skip the full handshake
+		if (mIsClient) {
+			SSL_CTX_set_session_cache_mode(mCtx, SSL_SESS_CACHE_CLIENT |
+			                                         SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(mCtx, NewSessionCallback);
+		} else {
+			auto keys = session_ticket_keys();
+			if (SSL_CTX_set_tlsext_ticket_keys(mCtx, keys.data(), long(keys.size())) != 1) {
+				PLOG_WARNING << "Failed to set TLS session ticket keys";
+			}
+		}
+
 		if (!(mSsl = SSL_new(mCtx)))
 			throw std::runtime_error("Failed to create SSL instance");
 
@@ -341,6 +649,12 @@ TlsTransport::TlsTransport(shared_ptr<TcpTransport> lower, optional<string> host
 		else
 			SSL_set_accept_state(mSsl);
 
+#if RTC_TLS_KERNEL_OFFLOAD
+		// Once the kernel owns the transmit keys, OpenSSL must not write records anymore
+		if (mKernelTlsLower)
+			SSL_set_options(mSsl, SSL_OP_NO_RENEGOTIATION);
+#endif
+
 		if (!(mInBio = BIO_new(BIO_s_mem())) || !(mOutBio = BIO_new(BIO_s_mem())))
 			throw std::runtime_error("Failed to create BIO");
 
@@ -371,117 +685,269 @@ TlsTransport::~TlsTransport() {
 
 void TlsTransport::start() {
 	Transport::start();
+	changeState(State::Connecting);
+
+	try {
+		std::unique_lock lock(mMutex);
+		registerIncoming();
+		restoreSession();
 
-	registerIncoming();
+		// Initiate the handshake
+		handshake();
 
-	PLOG_DEBUG << "Starting TLS recv thread";
-	mRecvThread = std::thread(&TlsTransport::runRecvLoop, this);
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "TLS handshake: " << e.what();
+		finish();
+	}
 }
 
 bool TlsTransport::stop() {
 	if (!Transport::stop())
 		return false;
 
-	PLOG_DEBUG << "Stopping TLS recv thread";
-	mIncomingQueue.stop();
-	mRecvThread.join();
+	PLOG_DEBUG << "Stopping TLS transport";
+	finish();
+
+	std::lock_guard lock(mMutex);
 	SSL_shutdown(mSsl);
 	return true;
 }
 
+void TlsTransport::setAlpnProtocols(std::vector<string> protocols) {
+	// Protocols are sent as length-prefixed strings
+	std::vector<unsigned char> wire;
+	for (const auto &protocol : protocols) {
+		if (protocol.empty() || protocol.size() > 255)
+			throw std::invalid_argument("Invalid ALPN protocol");
+
+		wire.push_back(static_cast<unsigned char>(protocol.size()));
+		wire.insert(wire.end(), protocol.begin(), protocol.end());
+	}
+
+	std::lock_guard lock(mMutex);
+	// Unlike most OpenSSL functions, this one returns 0 on success
+	if (SSL_set_alpn_protos(mSsl, wire.data(), unsigned(wire.size())) != 0)
+		throw std::runtime_error("Failed to set ALPN protocols");
+}
+
+optional<string> TlsTransport::alpnProtocol() {
+	std::lock_guard lock(mMutex);
+	const unsigned char *data = nullptr;
+	unsigned int size = 0;
+	SSL_get0_alpn_selected(mSsl, &data, &size);
+	if (!data || size == 0)
+		return nullopt;
+
+	return string(reinterpret_cast<const char *>(data), size);
+}
+
 bool TlsTransport::send(message_ptr message) {
 	if (!message || state() != State::Connected)
 		return false;
 
-	PLOG_VERBOSE << "Send size=" << message->size();
+	PLOG_VERBOSE << "Send size=" << message->payloadSize();
 
-	if (message->size() == 0)
+	if (message->payloadSize() == 0)
 		return true;
 
-	int ret = SSL_write(mSsl, message->data(), int(message->size()));
+#if RTC_TLS_KERNEL_OFFLOAD
+	// Set before the state changed to connected, the kernel encrypts the plaintext
+	if (mKernelTlsEnabled)
+		return outgoing(std::move(message));
+#endif
+
+	std::lock_guard lock(mMutex);
+	int ret = SSL_write(mSsl, message->payload(), int(message->payloadSize()));
 	if (!openssl::check(mSsl, ret))
 		return false;
 
-	const size_t bufferSize = 4096;
-	byte buffer[bufferSize];
-	while ((ret = BIO_read(mOutBio, buffer, bufferSize)) > 0)
-		outgoing(make_message(buffer, buffer + ret));
-
+	flushOutput();
 	return true;
 }
 
-void TlsTransport::incoming(message_ptr message) {
-	if (!message) {
-		mIncomingQueue.stop();
-		return;
+size_t TlsTransport::sendBatch(const std::vector<message_ptr> &messages) {
+	if (state() != State::Connected)
+		return 0;
+
+#if RTC_TLS_KERNEL_OFFLOAD
+	if (mKernelTlsEnabled)
+		return outgoingBatch(messages);
+#endif
+
+	// OpenSSL has no corking, so the messages are gathered to be written as a single record
+	binary buffer;
+	size_t count = 0;
+	for (const auto &message : messages) {
+		if (!message)
+			continue;
+
+		auto data = message->payload();
+		buffer.insert(buffer.end(), data, data + message->payloadSize());
+		++count;
 	}
 
-	PLOG_VERBOSE << "Incoming size=" << message->size();
-	mIncomingQueue.push(message);
-}
+	if (buffer.empty())
+		return count;
 
-void TlsTransport::postHandshake() {
-	// Dummy
+	std::lock_guard lock(mMutex);
+	int ret = SSL_write(mSsl, buffer.data(), int(buffer.size()));
+	if (!openssl::check(mSsl, ret))
+		return 0;
+
+	flushOutput();
+	return count;
 }
 
-void TlsTransport::runRecvLoop() {
-	const size_t bufferSize = 4096;
-	byte buffer[bufferSize];
+void TlsTransport::processIncoming(message_ptr message) {
+	if (!message) {
+		finish();
+		return;
+	}
+
+	PLOG_VERBOSE << "Incoming size=" << message->size();
 
 	try {
-		changeState(State::Connecting);
-
-		int ret;
-		while (true) {
-			if (state() == State::Connecting) {
-				// Initiate or continue the handshake
-				ret = SSL_do_handshake(mSsl);
-				if (!openssl::check(mSsl, ret, "Handshake failed"))
-					break;
-
-				// Output
-				while ((ret = BIO_read(mOutBio, buffer, bufferSize)) > 0)
-					outgoing(make_message(buffer, buffer + ret));
-
-				if (SSL_is_init_finished(mSsl)) {
-					PLOG_INFO << "TLS handshake finished";
-					changeState(State::Connected);
-					postHandshake();
-				}
+		std::unique_lock lock(mMutex);
+		if (mClosed)
+			return;
+
+		if (message->size() == 0) {
+			// Pass zero-sized messages through
+			if (mHandshakeDone) {
+				lock.unlock();
+				recv(message);
 			}
+			return;
+		}
 
-			if (state() == State::Connected) {
-				// Input
-				while ((ret = SSL_read(mSsl, buffer, bufferSize)) > 0)
-					recv(make_message(buffer, buffer + ret));
+		BIO_write(mInBio, message->data(), int(message->size()));
 
-				if (!openssl::check(mSsl, ret))
-					break;
-			}
+		if (!mHandshakeDone) {
+			if (!handshake())
+				return;
 
-			auto next = mIncomingQueue.pop();
-			if (!next)
+			lock.unlock();
+			PLOG_INFO << "TLS handshake finished";
+			changeState(State::Connected);
+			lock.lock();
+		}
+
+		// The lock must not be held while passing records up, as the upper layer may send
+		while (!mClosed) {
+			auto record = readRecord();
+			if (!record)
 				break;
 
-			message_ptr message = std::move(*next);
-			if (message->size() > 0)
-				BIO_write(mInBio, message->data(), int(message->size())); // Input
-			else
-				recv(message); // Pass zero-sized messages through
+			lock.unlock();
+			if (!*record) {
+				finish();
+				return;
+			}
+			recv(std::move(*record));
+			lock.lock();
 		}
 
 	} catch (const std::exception &e) {
 		PLOG_ERROR << "TLS recv: " << e.what();
+		finish();
 	}
+}
 
-	if (state() == State::Connected) {
-		PLOG_INFO << "TLS closed";
-		recv(nullptr);
-	} else {
-		PLOG_ERROR << "TLS handshake failed";
+void TlsTransport::postHandshake() {
+	// Dummy
+}
+
+bool TlsTransport::handshake() {
+	// Initiate or continue the handshake
+	int ret = SSL_do_handshake(mSsl);
+	bool success = openssl::check(mSsl, ret, "Handshake failed");
+	flushOutput();
+
+	if (!success || mAlertReceived)
+		throw std::runtime_error("Connection closed during handshake");
+
+	if (!SSL_is_init_finished(mSsl))
+		return false; // wait for more data
+
+	if (SSL_session_reused(mSsl)) {
+		PLOG_DEBUG << "TLS session resumed";
+
+		// Before TLS 1.3, the resumed session may be used again
+		if (SSL_version(mSsl) < TLS1_3_VERSION)
+			storeSession();
+	}
+
+#if RTC_TLS_KERNEL_OFFLOAD
+	if (mKernelTlsLower)
+		enableKernelTls();
+#endif
+
+	postHandshake();
+	mHandshakeDone = true;
+	return true;
+}
+
+void TlsTransport::restoreSession() {
+	if (!mSessionKey)
+		return;
+
+	if (auto session = session_cache().take(*mSessionKey)) {
+		if (!SSL_SESSION_is_resumable(session->get()))
+			return;
+
+		PLOG_VERBOSE << "Resuming TLS session for " << *mSessionKey;
+		if (SSL_set_session(mSsl, session->get()) != 1) {
+			PLOG_DEBUG << "Failed to restore TLS session";
+		}
 	}
 }
 
+void TlsTransport::storeSession() {
+	if (!mSessionKey)
+		return;
+
+	if (auto session = SSL_get1_session(mSsl))
+		session_cache().put(*mSessionKey, session_ptr(session, SessionDeleter()));
+}
+
+optional<message_ptr> TlsTransport::readRecord() {
+	byte buffer[BufferSize];
+	int ret = SSL_read(mSsl, buffer, BufferSize);
+	bool success = openssl::check(mSsl, ret);
+	flushOutput(); // SSL_read might need to write, for instance for a key update
+
+	if (!success || mAlertReceived)
+		return nullptr; // closed
+
+	if (ret <= 0)
+		return nullopt;
+
+	return make_message(buffer, buffer + ret);
+}
+
+void TlsTransport::flushOutput() {
+	// Pending output is handed to the TCP transport at once so it can be sent in a vectored write
+	std::vector<message_ptr> messages;
+	byte buffer[BufferSize];
+	int ret;
+	while ((ret = BIO_read(mOutBio, buffer, BufferSize)) > 0)
+		messages.push_back(make_message(buffer, buffer + ret));
+
+#if RTC_TLS_KERNEL_OFFLOAD
+	if (mKernelTlsEnabled && !messages.empty()) {
+		// The kernel would encrypt the record again, for instance an alert
+		PLOG_WARNING << "Unexpected TLS record with kernel TLS, closing";
+		mAlertReceived = true; // Close the connection
+		return;
+	}
+#endif
+
+	if (messages.size() == 1)
+		outgoing(std::move(messages.front()));
+	else if (!messages.empty())
+		outgoingBatch(messages);
+}
+
 void TlsTransport::InfoCallback(const SSL *ssl, int where, int ret) {
 	TlsTransport *t =
 	    static_cast<TlsTransport *>(SSL_get_ex_data(ssl, TlsTransport::TransportExIndex));
@@ -490,12 +956,165 @@ void TlsTransport::InfoCallback(const SSL *ssl, int where, int ret) {
 		if (ret != 256) { // Close Notify
 			PLOG_ERROR << "TLS alert: " << SSL_alert_desc_string_long(ret);
 		}
-		t->mIncomingQueue.stop(); // Close the connection
+		t->mAlertReceived = true; // Close the connection
+	}
+}
+
+int TlsTransport::NewSessionCallback(SSL *ssl, SSL_SESSION *session) {
+	TlsTransport *t =
+	    static_cast<TlsTransport *>(SSL_get_ex_data(ssl, TlsTransport::TransportExIndex));
+
+	// Called during the handshake or when receiving a TLS 1.3 ticket, with mMutex locked
+	if (!t->mSessionKey)
+		return 0;
+
+	// Returning 1 takes ownership of the reference
+	session_cache().put(*t->mSessionKey, session_ptr(session, SessionDeleter()));
+	return 1;
+}
+
+#if RTC_TLS_KERNEL_OFFLOAD
+
+void TlsTransport::enableKernelTls() {
+	// With TLS 1.3, the peer may send a KeyUpdate at any time, and the transmit keys could not be
+	// handed back from the kernel to OpenSSL to answer it, so the session stays in user space
+	if (SSL_version(mSsl) != TLS1_2_VERSION) {
+		PLOG_DEBUG << "Kernel TLS is only used with TLS 1.2, encrypting in user space";
+		return;
+	}
+
+	const SSL_CIPHER *cipher = SSL_get_current_cipher(mSsl);
+	const int nid = cipher ? SSL_CIPHER_get_cipher_nid(cipher) : NID_undef;
+	size_t keySize, ivSize;
+	switch (nid) {
+	case NID_aes_128_gcm:
+		keySize = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+		ivSize = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+		break;
+	case NID_aes_256_gcm:
+		keySize = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+		ivSize = TLS_CIPHER_AES_GCM_256_SALT_SIZE;
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case NID_chacha20_poly1305:
+		keySize = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+		ivSize = TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE;
+		break;
+#endif
+	default:
+		PLOG_DEBUG << "Cipher is not supported by kernel TLS, encrypting in user space";
+		return;
+	}
+
+	// The key block is derived from the master secret as in RFC 5246 section 6.3:
+	// client write key, server write key, client write IV, server write IV
+	unsigned char secret[SSL_MAX_MASTER_KEY_LENGTH];
+	const size_t secretSize =
+	    SSL_SESSION_get_master_key(SSL_get_session(mSsl), secret, sizeof(secret));
+
+	const string label = "key expansion";
+	std::vector<unsigned char> seed(label.begin(), label.end());
+	seed.resize(label.size() + 2 * SSL3_RANDOM_SIZE);
+	SSL_get_server_random(mSsl, seed.data() + label.size(), SSL3_RANDOM_SIZE);
+	SSL_get_client_random(mSsl, seed.data() + label.size() + SSL3_RANDOM_SIZE, SSL3_RANDOM_SIZE);
+
+	const EVP_MD *md = SSL_CIPHER_get_handshake_digest(cipher);
+	auto kdf = unique_ptr<EVP_KDF, decltype(&EVP_KDF_free)>(
+	    EVP_KDF_fetch(NULL, OSSL_KDF_NAME_TLS1_PRF, NULL), EVP_KDF_free);
+	auto ctx = unique_ptr<EVP_KDF_CTX, decltype(&EVP_KDF_CTX_free)>(
+	    kdf ? EVP_KDF_CTX_new(kdf.get()) : nullptr, EVP_KDF_CTX_free);
+
+	OSSL_PARAM params[] = {
+	    OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST,
+	                                     const_cast<char *>(md ? EVP_MD_get0_name(md) : ""), 0),
+	    OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SECRET, secret, secretSize),
+	    OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SEED, seed.data(), seed.size()),
+	    OSSL_PARAM_construct_end()};
+
+	std::vector<unsigned char> block(2 * (keySize + ivSize));
+	const bool derived = md && secretSize > 0 && ctx &&
+	                     EVP_KDF_derive(ctx.get(), block.data(), block.size(), params) == 1;
+	OPENSSL_cleanse(secret, sizeof(secret));
+	if (!derived) {
+		PLOG_WARNING << "Failed to derive kernel TLS keys, encrypting in user space";
+		return;
 	}
+
+	const unsigned char *key = block.data() + (mIsClient ? 0 : keySize);
+	const unsigned char *iv = block.data() + 2 * keySize + (mIsClient ? 0 : ivSize);
+
+	// The Finished message was the first record with these keys, so the next sequence number is 1
+	unsigned char seq[TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE] = {};
+	seq[sizeof(seq) - 1] = 1;
+
+	union {
+		struct tls_crypto_info info;
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+		struct tls12_crypto_info_chacha20_poly1305 chacha20;
+#endif
+	} crypto = {};
+	crypto.info.version = TLS_1_2_VERSION;
+
+	// For GCM, the explicit nonce only has to be unique, the sequence number is used (RFC 5288)
+	switch (nid) {
+	case NID_aes_128_gcm:
+		crypto.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		std::memcpy(crypto.aes128.key, key, keySize);
+		std::memcpy(crypto.aes128.salt, iv, ivSize);
+		std::memcpy(crypto.aes128.iv, seq, sizeof(seq));
+		std::memcpy(crypto.aes128.rec_seq, seq, sizeof(seq));
+		break;
+	case NID_aes_256_gcm:
+		crypto.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		std::memcpy(crypto.aes256.key, key, keySize);
+		std::memcpy(crypto.aes256.salt, iv, ivSize);
+		std::memcpy(crypto.aes256.iv, seq, sizeof(seq));
+		std::memcpy(crypto.aes256.rec_seq, seq, sizeof(seq));
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	default:
+		crypto.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		std::memcpy(crypto.chacha20.key, key, keySize);
+		std::memcpy(crypto.chacha20.iv, iv, ivSize);
+		std::memcpy(crypto.chacha20.rec_seq, seq, sizeof(seq));
+		break;
+#endif
+	}
+
+	const bool enabled = mKernelTlsLower->enableKernelTls(&crypto);
+	OPENSSL_cleanse(block.data(), block.size());
+	OPENSSL_cleanse(&crypto, sizeof(crypto));
+
+	// The TCP transport refuses if handshake records are still queued
+	if (!enabled) {
+		PLOG_DEBUG << "Kernel TLS is unavailable, encrypting in user space";
+		return;
+	}
+
+	PLOG_DEBUG << "Kernel TLS transmit offload enabled";
+	mKernelTlsEnabled = true;
 }
 
 #endif
 
+#endif
+
+void TlsTransport::finish() {
+	if (mClosed.exchange(true))
+		return;
+
+	if (state() == State::Connected) {
+		PLOG_INFO << "TLS closed";
+		changeState(State::Disconnected);
+		recv(nullptr);
+	} else {
+		PLOG_ERROR << "TLS handshake failed";
+		changeState(State::Failed);
+	}
+}
+
 } // namespace rtc::impl
 
 #endif
@@ -21,46 +21,75 @@
 
 #include "certificate.hpp"
 #include "common.hpp"
-#include "queue.hpp"
 #include "tls.hpp"
 #include "transport.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
 
-#include <thread>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <vector>
 
 namespace rtc::impl {
 
 class TcpTransport;
 
-class TlsTransport : public Transport {
+class TlsTransport : public Transport, public std::enable_shared_from_this<TlsTransport> {
 public:
 	static void Init();
 	static void Cleanup();
 
 	TlsTransport(shared_ptr<TcpTransport> lower, optional<string> host, certificate_ptr certificate,
-	             state_callback callback);
+	             state_callback callback, bool kernelTls = false);
 	virtual ~TlsTransport();
 
 	void start() override;
 	bool stop() override;
 	bool send(message_ptr message) override;
+	size_t sendBatch(const std::vector<message_ptr> &messages) override; // one flush for all
 
 	bool isClient() const { return mIsClient; }
 
+	// Protocols offered with ALPN, must be set before the transport is started
+	void setAlpnProtocols(std::vector<string> protocols);
+	optional<string> alpnProtocol(); // negotiated, only valid once connected
+
 protected:
 	virtual void incoming(message_ptr message) override;
 	virtual void postHandshake();
-	void runRecvLoop();
+
+	// Records are decrypted inline in incoming(), there is no receive thread
+	// On the server side, messages are processed on the crypto pool until the handshake is done,
+	// so handshakes of many clients don't serialize on the poll thread.
+	void processIncoming(message_ptr message);
+	void processOffloaded();
+	bool handshake();                   // true if finished, mMutex must be locked
+	optional<message_ptr> readRecord(); // nullopt if no more records, nullptr if closed
+	void finish();
+
+	// Client sessions are cached per remote address and resumed on the next connection
+	void restoreSession(); // mMutex must be locked
+	void storeSession();   // mMutex must be locked
+
+	static const size_t BufferSize = 4096;
 
 	const optional<string> mHost;
 	const bool mIsClient;
+	optional<string> mSessionKey; // set for clients only
+
+	std::mutex mMutex; // protects the session on the receive path
+	bool mHandshakeDone = false;
+	std::atomic<bool> mClosed = false;
 
-	Queue<message_ptr> mIncomingQueue;
-	std::thread mRecvThread;
+	std::queue<message_ptr> mOffloadedQueue; // messages waiting for the handshake task
+	std::mutex mOffloadMutex;
+	std::atomic<bool> mOffloading; // initially true for servers
+	bool mOffloadScheduled = false;
 
 #if USE_GNUTLS
 	gnutls_session_t mSession;
+	std::mutex mSendMutex; // a corked batch must not be mixed with records of other senders
 
 	message_ptr mIncomingMessage;
 	size_t mIncomingMessagePosition = 0;
@@ -68,15 +97,30 @@ protected:
 	static ssize_t WriteCallback(gnutls_transport_ptr_t ptr, const void *data, size_t len);
 	static ssize_t ReadCallback(gnutls_transport_ptr_t ptr, void *data, size_t maxlen);
 	static int TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int ms);
+	static int TicketCallback(gnutls_session_t session, unsigned int htype, unsigned int when,
+	                          unsigned int incoming, const gnutls_datum_t *msg);
 #else
 	SSL_CTX *mCtx;
 	SSL *mSsl;
 	BIO *mInBio, *mOutBio;
+	bool mAlertReceived = false; // set by InfoCallback
 
 	static int TransportExIndex;
 
+	void flushOutput(); // mMutex must be locked
+
 	static int CertificateCallback(int preverify_ok, X509_STORE_CTX *ctx);
 	static void InfoCallback(const SSL *ssl, int where, int ret);
+	static int NewSessionCallback(SSL *ssl, SSL_SESSION *session);
+
+#if RTC_TLS_KERNEL_OFFLOAD
+	// With kernel TLS, TLS 1.2 transmit keys are installed on the socket after the handshake,
+	// then application data is written in plaintext to the TCP transport
+	shared_ptr<TcpTransport> mKernelTlsLower;
+	bool mKernelTlsEnabled = false;
+
+	void enableKernelTls(); // mMutex must be locked
+#endif
 #endif
 };
 
@@ -19,7 +19,16 @@
 #include "track.hpp"
 #include "internals.hpp"
 #include "logcounter.hpp"
+#include "overloadcontroller.hpp"
 #include "peerconnection.hpp"
+#include "rtp.hpp"
+#include "threadpool.hpp"
+
+#if RTC_ENABLE_MEDIA
+#include "h264rtpdepacketizer.hpp"
+#endif
+
+#include <algorithm>
 
 namespace rtc::impl {
 
@@ -27,10 +36,38 @@ static LogCounter COUNTER_MEDIA_BAD_DIRECTION(plog::warning,
                                               "Number of media packets sent in invalid directions");
 static LogCounter COUNTER_QUEUE_FULL(plog::warning,
                                      "Number of media packets dropped due to a full queue");
+static LogCounter COUNTER_FORWARD_FAILED(plog::warning,
+                                         "Number of media packets which failed to be forwarded");
+static LogCounter COUNTER_FORWARD_RTX_DROPPED(plog::info,
+                                              "Number of RTX packets which could not be forwarded");
+static LogCounter COUNTER_FORWARD_PAUSED(plog::info,
+                                         "Number of media packets not forwarded under overload");
+static LogCounter
+    COUNTER_MEMORY_LIMIT(plog::warning,
+                         "Number of media packets received over the connection memory limit");
+
+static const size_t RtpHeaderMinSize = 12;
+
+// Keyframe requests are repeated while forwarding waits to resume after an overload
+static const auto KeyframeRequestInterval = std::chrono::milliseconds(1000);
+
+static bool IsKeyframe(const rtc::Track::ForwardingRules &rules, const binary &packet) {
+	if (rules.isKeyframe)
+		return rules.isKeyframe(packet);
+#if RTC_ENABLE_MEDIA
+	return H264RtpDepacketizer::IsKeyframe(packet);
+#else
+	return true; // no detector, resume on the next frame
+#endif
+}
 
 Track::Track(weak_ptr<PeerConnection> pc, Description::Media description)
-    : mPeerConnection(pc), mMediaDescription(std::move(description)),
-      mRecvQueue(RECV_QUEUE_LIMIT, message_size_func) {}
+    : mPeerConnection(pc), mMemoryAccount(memory_account(pc)),
+      mMediaDescription(std::move(description)),
+      mRecvQueue(RECV_QUEUE_LIMIT, message_size_func, receive_queues_amount(mMemoryAccount)) {
+	mStats.setDescription(mMediaDescription);
+	updateRtxMapping();
+}
 
 string Track::mid() const {
 	std::shared_lock lock(mMutex);
@@ -53,25 +90,56 @@ void Track::setDescription(Description::Media description) {
 		throw std::logic_error("Media description mid does not match track mid");
 
 	mMediaDescription = std::move(description);
+	mStats.setDescription(mMediaDescription);
+	updateRtxMapping();
 }
 
+void Track::updateRtxMapping() {
+	for (size_t pt = 0; pt < mRtxOriginalPayloadTypes.size(); ++pt) {
+		auto original = mMediaDescription.getRtxOriginalPayloadType(int(pt));
+		mRtxOriginalPayloadTypes[pt] =
+		    original && *original >= 0 && *original < 128 ? optional<uint8_t>(uint8_t(*original))
+		                                                  : nullopt;
+	}
+
+	// The FID group lists the original SSRC then the RTX SSRC
+	mRtxOriginalSsrcs.clear();
+	for (const auto &group : mMediaDescription.getSSRCGroups("FID"))
+		if (group.size() >= 2)
+			mRtxOriginalSsrcs.emplace_back(group[1], group[0]);
+}
+
+std::vector<RtpStreamStats> Track::stats() const { return mStats.stats(); }
+
+optional<RtpStreamStats> Track::stats(SSRC ssrc) const { return mStats.stats(ssrc); }
+
+std::vector<RtpStreamStats> Track::statsCounters() const { return mStats.counters(); }
+
 void Track::close() {
 	mIsClosed = true;
 
 	setMediaHandler(nullptr);
 	resetCallbacks();
+	targetBitrateCallback = nullptr;
 }
 
 optional<message_variant> Track::receive() {
-	if (auto next = mRecvQueue.tryPop())
-		return to_variant(std::move(**next));
+	if (auto message = receiveMessage())
+		return to_variant(std::move(*message));
 
 	return nullopt;
 }
 
+message_ptr Track::receiveMessage() {
+	if (auto next = mRecvQueue.tryPop())
+		return std::move(*next);
+
+	return nullptr;
+}
+
 optional<message_variant> Track::peek() {
 	if (auto next = mRecvQueue.peek())
-		return to_variant(std::move(**next));
+		return to_variant(**next); // the message stays queued
 
 	return nullopt;
 }
@@ -90,18 +158,19 @@ bool Track::isOpen(void) const {
 bool Track::isClosed(void) const { return mIsClosed; }
 
 size_t Track::maxMessageSize() const {
-	optional<size_t> mtu;
+	size_t mtu = DEFAULT_MTU;
 	if (auto pc = mPeerConnection.lock())
-		mtu = pc->config.mtu;
+		mtu = pc->pathMtu();
 
-	return mtu.value_or(DEFAULT_MTU) - 12 - 8 - 40; // SRTP/UDP/IPv6
+	return mtu - 12 - 8 - 40; // SRTP/UDP/IPv6
 }
 
 #if RTC_ENABLE_MEDIA
-void Track::open(shared_ptr<DtlsSrtpTransport> transport) {
+void Track::open(shared_ptr<DtlsSrtpTransport> transport, shared_ptr<Pacer> pacer) {
 	{
 		std::lock_guard lock(mMutex);
 		mDtlsSrtpTransport = transport;
+		mPacer = std::move(pacer);
 	}
 
 	triggerOpen();
@@ -120,23 +189,288 @@ void Track::incoming(message_ptr message) {
 		return;
 	}
 
-	if (auto handler = getMediaHandler()) {
+	mStats.incoming(message);
+
+	// Forwarded packets still go through the media handler but are not delivered to the user
+	const bool forwarded = mIsForwarding && message->type == Message::Binary;
+	auto handler = getMediaHandler();
+	if (forwarded)
+		forward(message, !handler); // handlers may rewrite the packet in place
+
+	if (handler) {
 		message = handler->incoming(message);
 		if (!message)
 			return;
 	}
 
-	// Tail drop if queue is full
-	if (mRecvQueue.full()) {
-		COUNTER_QUEUE_FULL++;
+	if (forwarded && message->type == Message::Binary)
 		return;
+
+	enqueue(message);
+}
+
+void Track::forwardTo(shared_ptr<Track> target, rtc::Track::ForwardingRules rules) {
+	std::lock_guard lock(mForwardingMutex);
+	auto it = std::find_if(mForwardings.begin(), mForwardings.end(),
+	                       [&](const Forwarding &f) { return f.target.lock() == target; });
+	// The forwarding state is reset with the rules
+	Forwarding forwarding;
+	forwarding.target = target;
+	forwarding.rules = std::move(rules);
+	if (it != mForwardings.end())
+		*it = std::move(forwarding);
+	else
+		mForwardings.push_back(std::move(forwarding));
+
+	mIsForwarding = true;
+}
+
+void Track::stopForwarding(shared_ptr<Track> target) {
+	std::lock_guard lock(mForwardingMutex);
+	mForwardings.erase(std::remove_if(mForwardings.begin(), mForwardings.end(),
+	                                  [&](const Forwarding &f) {
+		                                  auto t = f.target.lock();
+		                                  return !t || t == target;
+	                                  }),
+	                   mForwardings.end());
+	mIsForwarding = !mForwardings.empty();
+}
+
+message_ptr Track::unwrapRtx(const message_ptr &message, optional<SSRC> &ssrc) const {
+	auto rtx = reinterpret_cast<const RtpRtx *>(message->data());
+	optional<uint8_t> payloadType;
+	{
+		std::shared_lock lock(mMutex);
+		payloadType = mRtxOriginalPayloadTypes[rtx->header.payloadType()];
+		if (!payloadType)
+			return message; // not an RTX packet
+
+		for (const auto &[rtxSsrc, original] : mRtxOriginalSsrcs)
+			if (rtxSsrc == rtx->header.ssrc())
+				ssrc = original;
+	}
+
+	const size_t bodyOffset = rtx->header.getBody() - reinterpret_cast<const char *>(rtx);
+	if (bodyOffset > message->size())
+		return nullptr; // truncated
+
+	// Padding comes after the original payload, so it is removed before unwrapping
+	size_t size = message->size();
+	if (rtx->header.padding()) {
+		const size_t paddingSize = std::to_integer<size_t>(message->back());
+		if (paddingSize == 0 || bodyOffset + paddingSize > size)
+			return nullptr; // invalid padding
+
+		size -= paddingSize;
+	}
+
+	if (bodyOffset + sizeof(uint16_t) > size)
+		return nullptr; // padding-only packet, used for bandwidth probing
+
+	auto unwrapped = make_message(size_t(0), Message::Binary, message->stream);
+	unwrapped->reserve(size + MediaTailroom);
+	unwrapped->assign(message->begin(), message->begin() + size);
+	auto copy = reinterpret_cast<RtpRtx *>(unwrapped->data());
+	copy->header.setPadding(false);
+	const SSRC originalSsrc = ssrc.value_or(copy->header.ssrc());
+	unwrapped->resize(copy->normalizePacket(size, originalSsrc, *payloadType));
+	return unwrapped;
+}
+
+void Track::forward(const message_ptr &source, bool sharePayload) {
+	if (source->size() < RtpHeaderMinSize)
+		return;
+
+	// RTX packets are forwarded as the original packets, since retransmissions on the RTX stream
+	// of the source would be misinterpreted on the primary stream of the target
+	optional<SSRC> originalSsrc;
+	auto message = unwrapRtx(source, originalSsrc);
+	if (!message) {
+		COUNTER_FORWARD_RTX_DROPPED++;
+		return;
+	}
+
+	const bool isRtx = message != source;
+	if (isRtx)
+		sharePayload = true; // the unwrapped copy is not seen by the media handler
+
+	// Rules only rewrite the fixed header, CSRCs are kept with it
+	const size_t headerSize = reinterpret_cast<const RtpHeader *>(message->data())->getSize();
+	if (headerSize > message->size())
+		return;
+
+	const bool overloaded =
+	    OverloadController::Instance().atLeast(OverloadLevel::PauseVideoLayers);
+	const auto now = std::chrono::steady_clock::now();
+	const bool marker = reinterpret_cast<const RtpHeader *>(message->data())->marker();
+	bool requestKeyframe = false;
+
+	std::unique_lock lock(mForwardingMutex);
+	for (auto &forwarding : mForwardings) {
+		auto target = forwarding.target.lock();
+		if (!target || !target->isOpen())
+			continue;
+
+		if (isRtx && !originalSsrc && !forwarding.rules.ssrc) {
+			// The original SSRC is unknown and would not be rewritten
+			COUNTER_FORWARD_RTX_DROPPED++;
+			continue;
+		}
+
+		if (forwarding.rules.pauseOnOverload) {
+			// Pause only between frames, so the receiver never gets a truncated frame
+			if (overloaded && !forwarding.midFrame && !forwarding.paused) {
+				forwarding.paused = true;
+				forwarding.keyframeRequested.reset();
+			}
+
+			if (forwarding.paused) {
+				// Resume on a keyframe, as the receiver could not decode frames referencing the
+				// skipped ones
+				if (!overloaded && forwarding.keyframeRequested &&
+				    IsKeyframe(forwarding.rules, *message)) {
+					forwarding.paused = false;
+					// Renumbered packets leave no gap for the skipped frames
+					if (forwarding.seqOffset)
+						*forwarding.seqOffset -= forwarding.skipped;
+
+					forwarding.skipped = 0;
+
+				} else {
+					const auto &requested = forwarding.keyframeRequested;
+					if (!overloaded &&
+					    (!requested || now - *requested >= KeyframeRequestInterval)) {
+						forwarding.keyframeRequested = now;
+						requestKeyframe = true;
+					}
+					++forwarding.skipped;
+					COUNTER_FORWARD_PAUSED++;
+					continue;
+				}
+			}
+
+			forwarding.midFrame = !marker;
+		}
+
+		auto dir = target->direction();
+		if (dir == Description::Direction::RecvOnly || dir == Description::Direction::Inactive) {
+			COUNTER_MEDIA_BAD_DIRECTION++;
+			continue;
+		}
+
+		// Each target protects its own copy with its SRTP context, however only the header is
+		// copied here, the payload is shared by the targets until protection. The whole packet is
+		// copied if the media handler might modify it afterwards.
+		auto copy = make_message(size_t(0), Message::Binary, message->stream);
+		if (sharePayload) {
+			copy->reserve(headerSize + MediaTailroom);
+			copy->assign(message->begin(), message->begin() + headerSize);
+			copy->tail.emplace(Message::View{message->data() + headerSize,
+			                                 message->size() - headerSize, message});
+		} else {
+			copy->reserve(message->size() + MediaTailroom);
+			copy->assign(message->begin(), message->end());
+		}
+
+		auto rtp = reinterpret_cast<RtpHeader *>(copy->data());
+		const auto &rules = forwarding.rules;
+		if (rules.ssrc)
+			rtp->setSsrc(*rules.ssrc);
+
+		if (rules.payloadType)
+			rtp->setPayloadType(*rules.payloadType);
+
+		if (rules.firstSequenceNumber) {
+			if (!forwarding.seqOffset)
+				forwarding.seqOffset = uint16_t(*rules.firstSequenceNumber - rtp->seqNumber());
+
+			rtp->setSeqNumber(uint16_t(rtp->seqNumber() + *forwarding.seqOffset));
+		}
+		copy->stream = rtp->ssrc();
+
+		try {
+			target->transportSend(std::move(copy));
+
+		} catch (const std::exception &e) {
+			// The target track was closed concurrently
+			PLOG_VERBOSE << "Forwarding failed: " << e.what();
+			COUNTER_FORWARD_FAILED++;
+		}
+	}
+	lock.unlock();
+
+	if (requestKeyframe)
+		if (auto handler = getMediaHandler())
+			handler->requestKeyframe();
+}
+
+void Track::enqueue(message_ptr message) {
+	if (mMemoryAccount && mMemoryAccount->exceeded()) {
+		// Media can't be slowed down, so the track is closed instead of silently losing packets
+		COUNTER_MEMORY_LIMIT++;
+		if (!mIsClosed.exchange(true)) {
+			PLOG_WARNING << "Connection memory limit exceeded, closing track";
+			triggerError("Connection memory limit exceeded");
+			// The media handler can't be reset from its own callback
+			ThreadPool::Instance().post(weak_bind(&Track::close, this));
+		}
+		return;
+	}
+
+	// Drop the oldest packets if the queue is full, as late media is worthless, this thread acts
+	// as a consumer too so it never waits for the application
+	while (!mRecvQueue.push(message)) {
+		if (!mRecvQueue.tryPop())
+			return; // stopped
+
+		COUNTER_QUEUE_FULL++;
 	}
 
-	mRecvQueue.push(message);
 	triggerAvailable(mRecvQueue.size());
 }
 
+void Track::setReceiveQueueLimit(optional<size_t> amount) { mRecvQueue.setAmountLimit(amount); }
+
 bool Track::outgoing(message_ptr message) {
+	if (!canSend())
+		return false;
+
+	if (auto handler = getMediaHandler()) {
+		// The handler might output several packets, like a packetizer for a frame
+		std::vector<message_ptr> batch;
+		handler->outgoingBatch(std::move(message), batch);
+		if (batch.empty())
+			return false;
+
+		if (batch.size() > 1)
+			return transportSendBatch(std::move(batch));
+
+		message = std::move(batch.front());
+	}
+
+	return transportSend(message);
+}
+
+bool Track::outgoingBatch(std::vector<message_ptr> messages) {
+	if (!canSend())
+		return false;
+
+	if (auto handler = getMediaHandler()) {
+		std::vector<message_ptr> batch;
+		batch.reserve(messages.size());
+		for (auto &message : messages)
+			handler->outgoingBatch(std::move(message), batch);
+
+		messages = std::move(batch);
+	}
+
+	if (messages.empty())
+		return false;
+
+	return transportSendBatch(std::move(messages));
+}
+
+bool Track::canSend() const {
 	if (mIsClosed)
 		throw std::runtime_error("Track is closed");
 
@@ -146,30 +480,59 @@ bool Track::outgoing(message_ptr message) {
 		return false;
 	}
 
-	if (auto handler = getMediaHandler()) {
-		message = handler->outgoing(message);
-		if (!message)
-			return false;
-	}
+	return true;
+}
 
-	return transportSend(message);
+unsigned int Track::dscp() const { return mDscp; }
+
+void Track::setDscp(unsigned int dscp) {
+	if (dscp > 63)
+		throw std::invalid_argument("Invalid DSCP value");
+
+	mDscp = dscp;
+}
+
+unsigned int Track::outgoingDscp(bool isAudio) const {
+	if (unsigned int dscp = mDscp)
+		return dscp;
+
+	// Set recommended medium-priority DSCP value
+	// See https://datatracker.ietf.org/doc/html/rfc8837#section-5
+	if (isAudio)
+		return 46; // EF: Expedited Forwarding
+	else
+		return 36; // AF42: Assured Forwarding class 4, medium drop probability
 }
 
 bool Track::transportSend([[maybe_unused]] message_ptr message) {
 #if RTC_ENABLE_MEDIA
 	shared_ptr<DtlsSrtpTransport> transport;
+	shared_ptr<Pacer> pacer;
+	shared_ptr<MediaHandler> handler;
+	bool isAudio;
 	{
 		std::shared_lock lock(mMutex);
 		transport = mDtlsSrtpTransport.lock();
 		if (!transport)
 			throw std::runtime_error("Track is closed");
 
-		// Set recommended medium-priority DSCP value
-		// See https://datatracker.ietf.org/doc/html/rfc8837#section-5
-		if (mMediaDescription.type() == "audio")
-			message->dscp = 46; // EF: Expedited Forwarding
-		else
-			message->dscp = 36; // AF42: Assured Forwarding class 4, medium drop probability
+		isAudio = mMediaDescription.type() == "audio";
+		message->dscp = outgoingDscp(isAudio);
+		pacer = mPacer;
+		handler = mMediaHandler;
+	}
+
+	mStats.outgoing(message);
+
+	if (message->type == Message::Binary) {
+		// RTCP is never paced
+		if (pacer) {
+			return pacer->send(std::move(message), std::move(transport), std::move(handler),
+			                   isAudio ? Pacer::Priority::High : Pacer::Priority::Low);
+		}
+
+		if (handler)
+			handler->sent(message);
 	}
 
 	return transport->sendMedia(message);
@@ -179,17 +542,93 @@ bool Track::transportSend([[maybe_unused]] message_ptr message) {
 #endif
 }
 
+bool Track::transportSendBatch([[maybe_unused]] std::vector<message_ptr> messages) {
+#if RTC_ENABLE_MEDIA
+	shared_ptr<DtlsSrtpTransport> transport;
+	shared_ptr<Pacer> pacer;
+	shared_ptr<MediaHandler> handler;
+	bool isAudio;
+	{
+		std::shared_lock lock(mMutex);
+		transport = mDtlsSrtpTransport.lock();
+		if (!transport)
+			throw std::runtime_error("Track is closed");
+
+		isAudio = mMediaDescription.type() == "audio";
+		pacer = mPacer;
+		handler = mMediaHandler;
+	}
+
+	const unsigned int dscp = outgoingDscp(isAudio);
+	for (auto &message : messages) {
+		message->dscp = dscp;
+		mStats.outgoing(message);
+	}
+
+	if (pacer) {
+		// RTCP is never paced
+		std::vector<message_ptr> control;
+		auto it = std::stable_partition(messages.begin(), messages.end(), [](const auto &message) {
+			return message->type == Message::Binary;
+		});
+		control.assign(std::make_move_iterator(it), std::make_move_iterator(messages.end()));
+		messages.erase(it, messages.end());
+
+		bool sent = true;
+		if (!messages.empty())
+			sent = pacer->send(std::move(messages), transport, std::move(handler),
+			                   isAudio ? Pacer::Priority::High : Pacer::Priority::Low);
+
+		return (control.empty() || transport->sendMedia(control) == control.size()) && sent;
+	}
+
+	if (handler) {
+		for (const auto &message : messages)
+			if (message->type == Message::Binary)
+				handler->sent(message);
+	}
+
+	return transport->sendMedia(messages) == messages.size();
+#else
+	PLOG_WARNING << "Ignoring track send (not compiled with media support)";
+	return false;
+#endif
+}
+
 void Track::setMediaHandler(shared_ptr<MediaHandler> handler) {
 	{
 		std::unique_lock lock(mMutex);
-		if (mMediaHandler)
+		if (mMediaHandler) {
 			mMediaHandler->onOutgoing(nullptr);
+			mMediaHandler->onIncoming(nullptr);
+			mMediaHandler->onTargetBitrate(nullptr);
+		}
 
 		mMediaHandler = handler;
 	}
 
-	if (handler)
+	if (handler) {
 		handler->onOutgoing(std::bind(&Track::transportSend, this, std::placeholders::_1));
+		handler->onIncoming(std::bind(&Track::enqueue, this, std::placeholders::_1));
+		handler->onTargetBitrate(
+		    std::bind(&Track::updateTargetBitrate, this, std::placeholders::_1));
+	}
+}
+
+void Track::updateTargetBitrate(unsigned int bitrate) {
+#if RTC_ENABLE_MEDIA
+	shared_ptr<Pacer> pacer;
+	shared_ptr<DtlsSrtpTransport> transport;
+	{
+		std::shared_lock lock(mMutex);
+		pacer = mPacer;
+		transport = mDtlsSrtpTransport.lock();
+	}
+	if (pacer && transport)
+		pacer->setTargetBitrate(transport, bitrate);
+#endif
+
+	targetBitrateCallback(bitrate);
 }
 
 shared_ptr<MediaHandler> Track::getMediaHandler() {
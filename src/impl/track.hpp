@@ -23,14 +23,22 @@
 #include "common.hpp"
 #include "description.hpp"
 #include "mediahandler.hpp"
-#include "queue.hpp"
+#include "memoryaccount.hpp"
+#include "ringqueue.hpp"
+#include "rtpstatscollector.hpp"
+
+#include "rtc/track.hpp"
 
 #if RTC_ENABLE_MEDIA
 #include "dtlssrtptransport.hpp"
+#include "pacer.hpp"
 #endif
 
+#include <array>
 #include <atomic>
+#include <mutex>
 #include <shared_mutex>
+#include <vector>
 
 namespace rtc::impl {
 
@@ -44,8 +52,10 @@ public:
 	void close();
 	void incoming(message_ptr message);
 	bool outgoing(message_ptr message);
+	bool outgoingBatch(std::vector<message_ptr> messages);
 
 	optional<message_variant> receive() override;
+	message_ptr receiveMessage() override;
 	optional<message_variant> peek() override;
 	size_t availableAmount() const override;
 
@@ -58,29 +68,73 @@ public:
 	Description::Media description() const;
 	void setDescription(Description::Media description);
 
+	std::vector<RtpStreamStats> stats() const;
+	optional<RtpStreamStats> stats(SSRC ssrc) const;
+	std::vector<RtpStreamStats> statsCounters() const; // for metrics, bitrates are not set
+
 	shared_ptr<MediaHandler> getMediaHandler();
 	void setMediaHandler(shared_ptr<MediaHandler> handler);
 
+	void forwardTo(shared_ptr<Track> target, rtc::Track::ForwardingRules rules);
+	void stopForwarding(shared_ptr<Track> target);
+
+	unsigned int dscp() const;
+	void setDscp(unsigned int dscp);
+
+	void setReceiveQueueLimit(optional<size_t> amount);
+
+	synchronized_callback<unsigned int> targetBitrateCallback;
+
 #if RTC_ENABLE_MEDIA
-	void open(shared_ptr<DtlsSrtpTransport> transport);
+	void open(shared_ptr<DtlsSrtpTransport> transport, shared_ptr<Pacer> pacer = nullptr);
 #endif
 
 private:
+	bool canSend() const;
 	bool transportSend(message_ptr message);
+	bool transportSendBatch(std::vector<message_ptr> messages);
+	void enqueue(message_ptr message);
+	void updateTargetBitrate(unsigned int bitrate);
+	void forward(const message_ptr &message, bool sharePayload);
+	message_ptr unwrapRtx(const message_ptr &message, optional<SSRC> &ssrc) const;
+	void updateRtxMapping(); // mMutex must be locked
+	unsigned int outgoingDscp(bool isAudio) const;
 
 	const weak_ptr<PeerConnection> mPeerConnection;
+	const shared_ptr<MemoryAccount> mMemoryAccount; // of the PeerConnection
 #if RTC_ENABLE_MEDIA
 	weak_ptr<DtlsSrtpTransport> mDtlsSrtpTransport;
+	shared_ptr<Pacer> mPacer;
 #endif
 
 	Description::Media mMediaDescription;
 	shared_ptr<MediaHandler> mMediaHandler;
 
+	// RTX streams of the description, by RTX payload type and RTX SSRC (RFC 4588)
+	std::array<optional<uint8_t>, 128> mRtxOriginalPayloadTypes;
+	std::vector<std::pair<SSRC, SSRC>> mRtxOriginalSsrcs;
+
 	mutable std::shared_mutex mMutex;
 
 	std::atomic<bool> mIsClosed = false;
-
-	Queue<message_ptr> mRecvQueue;
+	std::atomic<unsigned int> mDscp = 0; // 0 for the default value
+
+	RingQueue<message_ptr> mRecvQueue;
+	RtpStatsCollector mStats;
+
+	struct Forwarding {
+		weak_ptr<Track> target;
+		rtc::Track::ForwardingRules rules;
+		optional<uint16_t> seqOffset; // set on the first packet if renumbering
+		bool midFrame = false;        // the last forwarded packet did not end a frame
+		bool paused = false;          // frames are skipped until a keyframe
+		optional<std::chrono::steady_clock::time_point> keyframeRequested;
+		uint16_t skipped = 0; // packets skipped while paused
+	};
+
+	std::vector<Forwarding> mForwardings;
+	std::atomic<bool> mIsForwarding = false;
+	std::mutex mForwardingMutex;
 };
 
 } // namespace rtc::impl
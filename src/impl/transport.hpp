@@ -21,11 +21,17 @@
 
 #include "common.hpp"
 #include "internals.hpp"
+#include "capturewriter.hpp"
 #include "message.hpp"
 
+#if RTC_ENABLE_LATENCY_TRACING
+#include "latencytracer.hpp"
+#endif
+
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <thread>
 
 namespace rtc::impl {
 
@@ -48,15 +54,16 @@ public:
 		// We don't want incoming() to be called by the lower layer anymore
 		if (mLower) {
 			PLOG_VERBOSE << "Unregistering incoming callback";
-			mLower->onRecv(nullptr);
+			mLower->setUpper(nullptr);
 		}
 		return true;
 	}
 
+	// The lower layer then calls incoming() directly instead of its recv callback
 	void registerIncoming() {
 		if (mLower) {
 			PLOG_VERBOSE << "Registering incoming callback";
-			mLower->onRecv(std::bind(&Transport::incoming, this, std::placeholders::_1));
+			mLower->setUpper(this);
 		}
 	}
 
@@ -64,12 +71,33 @@ public:
 	void onStateChange(state_callback callback) { mStateChangeCallback = std::move(callback); }
 	State state() const { return mState; }
 
-	virtual bool send(message_ptr message) { return outgoing(message); }
+#if RTC_ENABLE_LATENCY_TRACING
+	// Must be set before the transport is started
+	void setLatencyTracer(shared_ptr<LatencyTracer> tracer) { mLatencyTracer = std::move(tracer); }
+	LatencyTracer *latencyTracer() const { return mLatencyTracer.get(); }
+#endif
+
+	// Must be set before the transport is started, null if traffic is not captured
+	void setCapture(shared_ptr<CaptureWriter> capture) { mCapture = std::move(capture); }
+	CaptureWriter *capture() const { return mCapture.get(); }
+
+	virtual bool send(message_ptr message) { return outgoing(std::move(message)); }
+
+	// Send several messages at once, returns the number sent
+	virtual size_t sendBatch(const std::vector<message_ptr> &messages) {
+		size_t count = 0;
+		for (const auto &message : messages)
+			if (message && send(message))
+				++count;
+
+		return count;
+	}
 
 protected:
 	void recv(message_ptr message) {
 		try {
-			mRecvCallback(message);
+			if (!forward(message))
+				mRecvCallback(std::move(message));
 		} catch (const std::exception &e) {
 			PLOG_WARNING << e.what();
 		}
@@ -83,21 +111,77 @@ protected:
 		}
 	}
 
-	virtual void incoming(message_ptr message) { recv(message); }
+	virtual void incoming(message_ptr message) { recv(std::move(message)); }
 	virtual bool outgoing(message_ptr message) {
 		if (mLower)
-			return mLower->send(message);
+			return mLower->send(std::move(message));
 		else
 			return false;
 	}
+	size_t outgoingBatch(const std::vector<message_ptr> &messages) {
+		return mLower ? mLower->sendBatch(messages) : 0;
+	}
 
 private:
+	// Received datagrams go up the stack with a virtual call per layer, without the
+	// synchronized_callback of the recv callback, which copies a shared pointer for each call.
+	// Unregistering waits for calls in progress on other threads in the same way.
+	struct Dispatch {
+		Dispatch(const Transport *t) : transport(t), previous(Current) {
+			transport->mUpperCalls.fetch_add(1);
+			Current = this;
+		}
+		~Dispatch() {
+			Current = previous;
+			transport->mUpperCalls.fetch_sub(1);
+		}
+
+		const Transport *const transport;
+		const Dispatch *const previous;
+
+		inline static thread_local const Dispatch *Current = nullptr;
+	};
+
+	bool forward(message_ptr &message) {
+		if (!mUpper.load(std::memory_order_relaxed))
+			return false;
+
+		Dispatch dispatch(this);
+		Transport *upper = mUpper.load(); // after the increment, see setUpper()
+		if (!upper)
+			return false;
+
+		upper->incoming(std::move(message));
+		return true;
+	}
+
+	void setUpper(Transport *upper) {
+		mUpper.store(upper);
+		if (upper)
+			return;
+
+		size_t own = 0;
+		for (auto *d = Dispatch::Current; d; d = d->previous)
+			if (d->transport == this)
+				++own;
+
+		while (mUpperCalls.load() > own)
+			std::this_thread::yield();
+	}
+
 	const shared_ptr<Transport> mLower;
 	synchronized_callback<State> mStateChangeCallback;
 	synchronized_callback<message_ptr> mRecvCallback;
+	std::atomic<Transport *> mUpper = nullptr;
+	mutable std::atomic<size_t> mUpperCalls = 0;
 
 	std::atomic<State> mState = State::Disconnected;
 	std::atomic<bool> mStopped = true;
+
+#if RTC_ENABLE_LATENCY_TRACING
+	shared_ptr<LatencyTracer> mLatencyTracer;
+#endif
+	shared_ptr<CaptureWriter> mCapture;
 };
 
 } // namespace rtc::impl
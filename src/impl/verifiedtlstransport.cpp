@@ -24,8 +24,14 @@
 namespace rtc::impl {
 
 VerifiedTlsTransport::VerifiedTlsTransport(shared_ptr<TcpTransport> lower, string host,
-                                           certificate_ptr certificate, state_callback callback)
-    : TlsTransport(std::move(lower), std::move(host), std::move(certificate), std::move(callback)) {
+                                           certificate_ptr certificate, state_callback callback,
+                                           bool kernelTls)
+    : TlsTransport(std::move(lower), std::move(host), std::move(certificate), std::move(callback),
+                   kernelTls) {
+
+	// Sessions established without verification must never be resumed by a verified transport
+	if (mSessionKey)
+		*mSessionKey += "#verified";
 
 #if USE_GNUTLS
 	PLOG_DEBUG << "Setting up TLS certificate verification";
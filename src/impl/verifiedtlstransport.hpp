@@ -28,7 +28,7 @@ namespace rtc::impl {
 class VerifiedTlsTransport final : public TlsTransport {
 public:
 	VerifiedTlsTransport(shared_ptr<TcpTransport> lower, string host, certificate_ptr certificate,
-	                     state_callback callback);
+	                     state_callback callback, bool kernelTls = false);
 	~VerifiedTlsTransport();
 };
 
@@ -18,9 +18,12 @@
 
 #if RTC_ENABLE_WEBSOCKET
 
+#define RTC_LOG_SUBSYSTEM WebSocket
+
 #include "websocket.hpp"
 #include "common.hpp"
 #include "internals.hpp"
+#include "metrics.hpp"
 #include "threadpool.hpp"
 
 #include "tcptransport.hpp"
@@ -41,7 +44,8 @@ using namespace std::placeholders;
 
 WebSocket::WebSocket(optional<Configuration> optConfig, certificate_ptr certificate)
     : config(optConfig ? std::move(*optConfig) : Configuration()),
-      mCertificate(std::move(certificate)), mIsSecure(mCertificate != nullptr),
+      metricsId(MetricsRegistry::NextId()), mCertificate(std::move(certificate)),
+      mIsSecure(mCertificate != nullptr),
       mRecvQueue(RECV_QUEUE_LIMIT, message_size_func) {
 	PLOG_VERBOSE << "Creating WebSocket";
 }
@@ -99,10 +103,45 @@ void WebSocket::open(const string &url) {
 		path += "?" + query;
 
 	mHostname = hostname; // for TLS SNI
-	std::atomic_store(&mWsHandshake, std::make_shared<WsHandshake>(host, path, config.protocols));
+	std::atomic_store(&mWsHandshake, std::make_shared<WsHandshake>(host, path, config.protocols,
+	                                                                config.deflate));
 
 	changeState(State::Connecting);
-	setTcpTransport(std::make_shared<TcpTransport>(hostname, service, nullptr));
+	if (mIsSecure && config.http2)
+		openHttp2(hostname, service);
+	else
+		setTcpTransport(std::make_shared<TcpTransport>(hostname, service, nullptr));
+}
+
+void WebSocket::openHttp2(const string &hostname, const string &service) {
+	auto connection = Http2Connection::Get(hostname, service, isTlsVerified(), mCertificate);
+	if (!connection) {
+		PLOG_DEBUG << "HTTP/2 is not supported by " << hostname << ", using HTTP/1.1";
+		setTcpTransport(std::make_shared<TcpTransport>(hostname, service, nullptr));
+		return;
+	}
+
+	std::atomic_store(&mHttp2Connection, connection);
+	connection->whenReady([this, weak_this = weak_from_this(), hostname,
+	                       service](shared_ptr<Http2Transport> transport) {
+		auto shared_this = weak_this.lock();
+		if (!shared_this || state != State::Connecting)
+			return;
+
+		try {
+			if (transport && transport->canOpenStream()) {
+				initHttp2Stream(std::move(transport));
+				return;
+			}
+
+			PLOG_DEBUG << "HTTP/2 is unavailable for WebSocket, falling back to HTTP/1.1";
+			std::atomic_store(&mHttp2Connection, decltype(mHttp2Connection)(nullptr));
+			setTcpTransport(std::make_shared<TcpTransport>(hostname, service, nullptr));
+
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what();
+		}
+	});
 }
 
 void WebSocket::close() {
@@ -110,6 +149,7 @@ void WebSocket::close() {
 	if (s == State::Connecting || s == State::Open) {
 		PLOG_VERBOSE << "Closing WebSocket";
 		changeState(State::Closing);
+		notifyRecvSpace(); // messages are not waited for anymore
 		if (auto transport = std::atomic_load(&mWsTransport))
 			transport->close();
 		else
@@ -131,39 +171,93 @@ bool WebSocket::isClosed() const { return state == State::Closed; }
 size_t WebSocket::maxMessageSize() const { return DEFAULT_MAX_MESSAGE_SIZE; }
 
 optional<message_variant> WebSocket::receive() {
+	if (auto message = receiveMessage())
+		return to_variant(std::move(*message));
+
+	return nullopt;
+}
+
+message_ptr WebSocket::receiveMessage() {
 	while (auto next = mRecvQueue.tryPop()) {
+		notifyRecvSpace();
 		message_ptr message = *next;
 		if (message->type != Message::Control)
-			return to_variant(std::move(*message));
+			return message;
 	}
-	return nullopt;
+	return nullptr;
 }
 
 optional<message_variant> WebSocket::peek() {
 	while (auto next = mRecvQueue.peek()) {
 		message_ptr message = *next;
 		if (message->type != Message::Control)
-			return to_variant(std::move(*message));
+			return to_variant(*message); // the message stays queued
 
 		mRecvQueue.tryPop();
+		notifyRecvSpace();
 	}
 	return nullopt;
 }
 
 size_t WebSocket::availableAmount() const { return mRecvQueue.amount(); }
 
-bool WebSocket::changeState(State newState) { return state.exchange(newState) != newState; }
+bool WebSocket::changeState(State newState) {
+	if (newState != State::Connecting && std::atomic_load(&mConnectingToken))
+		std::atomic_store(&mConnectingToken, shared_ptr<void>());
+
+	return state.exchange(newState) != newState;
+}
+
+void WebSocket::holdWhileConnecting(shared_ptr<void> token) {
+	if (state == State::Connecting)
+		std::atomic_store(&mConnectingToken, std::move(token));
+}
 
 bool WebSocket::outgoing(message_ptr message) {
 	if (state != State::Open || !mWsTransport)
 		throw std::runtime_error("WebSocket is not open");
 
-	if (message->size() > maxMessageSize())
+	if (message->payloadSize() > maxMessageSize())
 		throw std::runtime_error("Message size exceeds limit");
 
+	messagesSent.fetch_add(1, std::memory_order_relaxed);
+	bytesSent.fetch_add(message->payloadSize(), std::memory_order_relaxed);
 	return mWsTransport->send(message);
 }
 
+size_t WebSocket::Broadcast(const std::vector<shared_ptr<WebSocket>> &webSockets,
+                            message_ptr message) {
+	// The frame is built once on first use, then shared by uncompressed server-side WebSockets
+	message_ptr frame;
+	size_t count = 0;
+	for (const auto &webSocket : webSockets) {
+		if (!webSocket || webSocket->state != State::Open)
+			continue;
+
+		auto transport = webSocket->getWsTransport();
+		if (!transport || message->payloadSize() > webSocket->maxMessageSize())
+			continue;
+
+		webSocket->messagesSent.fetch_add(1, std::memory_order_relaxed);
+		webSocket->bytesSent.fetch_add(message->payloadSize(), std::memory_order_relaxed);
+
+		bool sent;
+		if (transport->canSendFrame()) {
+			if (!frame)
+				frame = WsTransport::BuildFrame(message);
+
+			sent = transport->sendBuiltFrame(frame);
+		} else {
+			sent = transport->send(message);
+		}
+
+		if (sent)
+			++count;
+	}
+
+	return count;
+}
+
 void WebSocket::incoming(message_ptr message) {
 	if (!message) {
 		remoteClose();
@@ -171,11 +265,43 @@ void WebSocket::incoming(message_ptr message) {
 	}
 
 	if (message->type == Message::String || message->type == Message::Binary) {
-		mRecvQueue.push(message);
+		messagesReceived.fetch_add(1, std::memory_order_relaxed);
+		bytesReceived.fetch_add(message->size(), std::memory_order_relaxed);
+		// Block while the queue is full, so TCP backpressure slows the sender down
+		waitRecvSpace();
+		if (!mRecvQueue.push(message)) {
+			PLOG_DEBUG << "WebSocket is closing, dropping message";
+			return;
+		}
 		triggerAvailable(mRecvQueue.size());
 	}
 }
 
+void WebSocket::waitRecvSpace() {
+	if (!mRecvQueue.full())
+		return;
+
+	std::unique_lock lock(mRecvSpaceMutex);
+	mRecvWaiting = true;
+	// Pairs with the fence in notifyRecvSpace(), so either the consumer sees the waiting flag or
+	// the wait below sees the popped element
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	mRecvSpaceCondition.wait(lock, [this]() {
+		auto s = state.load();
+		return !mRecvQueue.full() || (s != State::Connecting && s != State::Open);
+	});
+	mRecvWaiting = false;
+}
+
+void WebSocket::notifyRecvSpace() {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!mRecvWaiting)
+		return;
+
+	std::lock_guard lock(mRecvSpaceMutex);
+	mRecvSpaceCondition.notify_all();
+}
+
 // Helper for WebSocket::initXTransport methods: start and emplace the transport
 template <typename T>
 shared_ptr<T> emplaceTransport(WebSocket *ws, shared_ptr<T> *member, shared_ptr<T> transport) {
@@ -265,21 +391,15 @@ shared_ptr<TlsTransport> WebSocket::initTlsTransport() {
 			}
 		};
 
-		bool verify = mHostname.has_value() && !config.disableTlsVerification;
-
-#ifdef _WIN32
-		if (std::exchange(verify, false)) {
-			PLOG_WARNING << "TLS certificate verification with root CA is not supported on Windows";
-		}
-#endif
+		Init::Instance().init(Init::Subsystem::Tls);
 
 		shared_ptr<TlsTransport> transport;
-		if (verify)
-			transport = std::make_shared<VerifiedTlsTransport>(lower, mHostname.value(),
-			                                                   mCertificate, stateChangeCallback);
+		if (isTlsVerified())
+			transport = std::make_shared<VerifiedTlsTransport>(
+			    lower, mHostname.value(), mCertificate, stateChangeCallback, config.kernelTls);
 		else
-			transport =
-			    std::make_shared<TlsTransport>(lower, mHostname, mCertificate, stateChangeCallback);
+			transport = std::make_shared<TlsTransport>(lower, mHostname, mCertificate,
+			                                           stateChangeCallback, config.kernelTls);
 
 		return emplaceTransport(this, &mTlsTransport, std::move(transport));
 
@@ -290,6 +410,39 @@ shared_ptr<TlsTransport> WebSocket::initTlsTransport() {
 	}
 }
 
+bool WebSocket::isTlsVerified() const {
+	bool verify = mHostname.has_value() && !config.disableTlsVerification;
+
+#ifdef _WIN32
+	if (std::exchange(verify, false)) {
+		PLOG_WARNING << "TLS certificate verification with root CA is not supported on Windows";
+	}
+#endif
+
+	return verify;
+}
+
+shared_ptr<Http2Stream> WebSocket::initHttp2Stream(shared_ptr<Http2Transport> connection) {
+	PLOG_VERBOSE << "Starting HTTP/2 stream";
+	try {
+		if (auto stream = std::atomic_load(&mHttp2Stream))
+			return stream;
+
+		// The WebSocket transport is notified when the stream ends, no state callback is needed
+		auto transport = std::make_shared<Http2Stream>(std::move(connection), nullptr);
+		auto stream = emplaceTransport(this, &mHttp2Stream, std::move(transport));
+		if (stream)
+			initWsTransport();
+
+		return stream;
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << e.what();
+		remoteClose();
+		throw std::runtime_error("HTTP/2 stream initialization failed");
+	}
+}
+
 shared_ptr<WsTransport> WebSocket::initWsTransport() {
 	PLOG_VERBOSE << "Starting WebSocket transport";
 	using State = WsTransport::State;
@@ -297,8 +450,10 @@ shared_ptr<WsTransport> WebSocket::initWsTransport() {
 		if (auto transport = std::atomic_load(&mWsTransport))
 			return transport;
 
-		variant<shared_ptr<TcpTransport>, shared_ptr<TlsTransport>> lower;
-		if (mIsSecure) {
+		variant<shared_ptr<TcpTransport>, shared_ptr<TlsTransport>, shared_ptr<Http2Stream>> lower;
+		if (auto stream = std::atomic_load(&mHttp2Stream)) {
+			lower = stream;
+		} else if (mIsSecure) {
 			auto transport = std::atomic_load(&mTlsTransport);
 			if (!transport)
 				throw std::logic_error("No underlying TLS transport for WebSocket transport");
@@ -313,7 +468,7 @@ shared_ptr<WsTransport> WebSocket::initWsTransport() {
 		}
 
 		if (!atomic_load(&mWsHandshake))
-			atomic_store(&mWsHandshake, std::make_shared<WsHandshake>());
+			atomic_store(&mWsHandshake, std::make_shared<WsHandshake>(config.deflate));
 
 		auto stateChangeCallback = [this, weak_this = weak_from_this()](State transportState) {
 			auto shared_this = weak_this.lock();
@@ -340,8 +495,29 @@ shared_ptr<WsTransport> WebSocket::initWsTransport() {
 			}
 		};
 
-		auto transport = std::make_shared<WsTransport>(
-		    lower, mWsHandshake, weak_bind(&WebSocket::incoming, this, _1), stateChangeCallback);
+		auto transport = std::make_shared<WsTransport>(lower, mWsHandshake, config.pingInterval,
+		                                               weak_bind(&WebSocket::incoming, this, _1),
+		                                               stateChangeCallback);
+
+		if (config.maxIncomingMessageSize)
+			transport->setMaxMessageSize(*config.maxIncomingMessageSize);
+
+		if (config.maxIncomingFrameSize)
+			transport->setMaxFrameSize(*config.maxIncomingFrameSize);
+
+		if (fragmentCallback)
+			transport->onFragment(
+			    [this, weak_this = weak_from_this()](message_ptr fragment, bool last) {
+				    auto shared_this = weak_this.lock();
+				    if (!shared_this)
+					    return;
+
+				    bytesReceived.fetch_add(fragment->size(), std::memory_order_relaxed);
+				    if (last)
+					    messagesReceived.fetch_add(1, std::memory_order_relaxed);
+
+				    fragmentCallback(binary(fragment->begin(), fragment->end()), last);
+			    });
 
 		return emplaceTransport(this, &mWsTransport, std::move(transport));
 
@@ -353,7 +529,12 @@ shared_ptr<WsTransport> WebSocket::initWsTransport() {
 }
 
 shared_ptr<TcpTransport> WebSocket::getTcpTransport() const {
-	return std::atomic_load(&mTcpTransport);
+	if (auto transport = std::atomic_load(&mTcpTransport))
+		return transport;
+
+	// Over HTTP/2, the TCP transport is the one of the shared connection
+	auto connection = std::atomic_load(&mHttp2Connection);
+	return connection ? connection->tcpTransport() : nullptr;
 }
 
 shared_ptr<TlsTransport> WebSocket::getTlsTransport() const {
@@ -374,29 +555,37 @@ void WebSocket::closeTransports() {
 	if (!changeState(State::Closed))
 		return; // already closed
 
+	notifyRecvSpace();
+
 	// Pass the pointers to a thread, allowing to terminate a transport from its own thread
 	auto ws = std::atomic_exchange(&mWsTransport, decltype(mWsTransport)(nullptr));
+	auto stream = std::atomic_exchange(&mHttp2Stream, decltype(mHttp2Stream)(nullptr));
 	auto tls = std::atomic_exchange(&mTlsTransport, decltype(mTlsTransport)(nullptr));
 	auto tcp = std::atomic_exchange(&mTcpTransport, decltype(mTcpTransport)(nullptr));
+	auto http2 = std::atomic_exchange(&mHttp2Connection, decltype(mHttp2Connection)(nullptr));
 
 	if (ws)
 		ws->onRecv(nullptr);
 
-	using array = std::array<shared_ptr<Transport>, 3>;
-	array transports{std::move(ws), std::move(tls), std::move(tcp)};
+	using array = std::array<shared_ptr<Transport>, 4>;
+	array transports{std::move(ws), std::move(stream), std::move(tls), std::move(tcp)};
 
 	for (const auto &t : transports)
 		if (t)
 			t->onStateChange(nullptr);
 
-	ThreadPool::Instance().enqueue([transports = std::move(transports)]() mutable {
-		for (const auto &t : transports)
-			if (t)
-				t->stop();
+	// The shared HTTP/2 connection is released after the stream is closed
+	ThreadPool::Instance().post(
+	    [transports = std::move(transports), http2 = std::move(http2)]() mutable {
+		    for (const auto &t : transports)
+			    if (t)
+				    t->stop();
 
-		for (auto &t : transports)
-			t.reset();
-	});
+		    for (auto &t : transports)
+			    t.reset();
+
+		    http2.reset();
+	    });
 
 	triggerClosed();
 }
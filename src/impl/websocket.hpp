@@ -23,9 +23,10 @@
 
 #include "channel.hpp"
 #include "common.hpp"
+#include "http2connection.hpp"
 #include "init.hpp"
 #include "message.hpp"
-#include "queue.hpp"
+#include "ringqueue.hpp"
 #include "tcptransport.hpp"
 #include "tlstransport.hpp"
 #include "wstransport.hpp"
@@ -33,6 +34,8 @@
 #include "rtc/websocket.hpp"
 
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 namespace rtc::impl {
@@ -47,9 +50,12 @@ struct WebSocket final : public Channel, public std::enable_shared_from_this<Web
 	void open(const string &url);
 	void close();
 	bool outgoing(message_ptr message);
+	static size_t Broadcast(const std::vector<shared_ptr<WebSocket>> &webSockets,
+	                        message_ptr message); // returns the number of WebSockets sent to
 	void incoming(message_ptr message);
 
 	optional<message_variant> receive() override;
+	message_ptr receiveMessage() override;
 	optional<message_variant> peek() override;
 	size_t availableAmount() const override;
 
@@ -60,8 +66,12 @@ struct WebSocket final : public Channel, public std::enable_shared_from_this<Web
 	bool changeState(State state);
 	void remoteClose();
 
+	// The token is released when the WebSocket leaves the Connecting state
+	void holdWhileConnecting(shared_ptr<void> token);
+
 	shared_ptr<TcpTransport> setTcpTransport(shared_ptr<TcpTransport> transport);
 	shared_ptr<TlsTransport> initTlsTransport();
+	shared_ptr<Http2Stream> initHttp2Stream(shared_ptr<Http2Transport> connection);
 	shared_ptr<WsTransport> initWsTransport();
 	shared_ptr<TcpTransport> getTcpTransport() const;
 	shared_ptr<TlsTransport> getTlsTransport() const;
@@ -72,11 +82,25 @@ struct WebSocket final : public Channel, public std::enable_shared_from_this<Web
 
 	const Configuration config;
 
+	synchronized_callback<binary, bool> fragmentCallback; // streaming receive
+
 	std::atomic<State> state = State::Closed;
 
+	// For metrics
+	const uint64_t metricsId;
+	std::atomic<uint64_t> messagesSent = 0;
+	std::atomic<uint64_t> messagesReceived = 0;
+	std::atomic<uint64_t> bytesSent = 0;
+	std::atomic<uint64_t> bytesReceived = 0;
+
 private:
 	const init_token mInitToken = Init::Instance().token();
 
+	void openHttp2(const string &hostname, const string &service);
+	bool isTlsVerified() const;
+	void waitRecvSpace();
+	void notifyRecvSpace();
+
 	const certificate_ptr mCertificate;
 	bool mIsSecure;
 
@@ -86,8 +110,16 @@ private:
 	shared_ptr<TlsTransport> mTlsTransport;
 	shared_ptr<WsTransport> mWsTransport;
 	shared_ptr<WsHandshake> mWsHandshake;
+	shared_ptr<Http2Connection> mHttp2Connection; // shared with other WebSockets
+	shared_ptr<Http2Stream> mHttp2Stream;        // instead of TCP and TLS transports
+	shared_ptr<void> mConnectingToken;
+
+	RingQueue<message_ptr> mRecvQueue;
 
-	Queue<message_ptr> mRecvQueue;
+	// The transport thread waits for space in the receive queue, for TCP backpressure
+	std::atomic<bool> mRecvWaiting = false;
+	std::mutex mRecvSpaceMutex;
+	std::condition_variable mRecvSpaceCondition;
 };
 
 } // namespace rtc::impl
@@ -18,6 +18,8 @@
 
 #if RTC_ENABLE_WEBSOCKET
 
+#define RTC_LOG_SUBSYSTEM WebSocket
+
 #include "websocketserver.hpp"
 #include "common.hpp"
 #include "internals.hpp"
@@ -28,8 +30,9 @@ namespace rtc::impl {
 using namespace std::placeholders;
 
 WebSocketServer::WebSocketServer(Configuration config_)
-    : config(std::move(config_)), tcpServer(std::make_unique<TcpServer>(config.port)),
-      mStopped(false) {
+    : config(std::move(config_)),
+      tcpServer(std::make_shared<TcpServer>(config.port, config.backlog, config.reusePort)),
+      mStopped(false), mPendingHandshakes(std::make_shared<std::atomic<size_t>>(0)) {
 	PLOG_VERBOSE << "Creating WebSocketServer";
 
 	if (config.enableTls) {
@@ -45,8 +48,6 @@ WebSocketServer::WebSocketServer(Configuration config_)
 			    "Either none or both certificate and key PEM files must be specified");
 		}
 	}
-
-	mThread = std::thread(&WebSocketServer::runLoop, this);
 }
 
 WebSocketServer::~WebSocketServer() {
@@ -54,38 +55,72 @@ WebSocketServer::~WebSocketServer() {
 	stop();
 }
 
+void WebSocketServer::start() {
+	PLOG_INFO << "Starting WebSocketServer";
+
+	// Connections are accepted on the poll service thread, which must not block, so clients are
+	// set up on the thread pool, and TLS handshakes run on the crypto pool
+	tcpServer->start([weak_this = weak_from_this()](shared_ptr<TcpTransport> incoming) {
+		auto shared_this = weak_this.lock();
+		if (!shared_this)
+			return;
+
+		auto token = shared_this->acquireHandshake();
+		if (!token) {
+			// Refuse the connection, the transport closes the socket on destruction
+			PLOG_WARNING << "WebSocketServer: Too many pending handshakes, refusing connection";
+			return;
+		}
+
+		ThreadPool::Instance().post(
+		    [weak_this, incoming = std::move(incoming), token = std::move(token)]() mutable {
+			    if (auto shared_this = weak_this.lock())
+				    shared_this->openClient(std::move(incoming), std::move(token));
+		    });
+	});
+}
+
 void WebSocketServer::stop() {
 	if (mStopped.exchange(true))
 		return;
 
-	PLOG_DEBUG << "Stopping WebSocketServer thread";
+	PLOG_INFO << "Stopping WebSocketServer";
 	tcpServer->close();
-	mThread.join();
 }
 
-void WebSocketServer::runLoop() {
-	PLOG_INFO << "Starting WebSocketServer";
+shared_ptr<void> WebSocketServer::acquireHandshake() {
+	size_t pending = mPendingHandshakes->fetch_add(1);
+	if (config.maxPendingHandshakes && pending >= *config.maxPendingHandshakes) {
+		mPendingHandshakes->fetch_sub(1);
+		return nullptr;
+	}
+
+	// The token may outlive the server
+	return shared_ptr<void>(mPendingHandshakes.get(),
+	                        [counter = mPendingHandshakes](void *) { --*counter; });
+}
+
+void WebSocketServer::openClient(shared_ptr<TcpTransport> incoming,
+                                 shared_ptr<void> handshakeToken) {
+	if (mStopped || !clientCallback)
+		return;
 
 	try {
-		while (auto incoming = tcpServer->accept()) {
-			try {
-				if (!clientCallback)
-					continue;
-
-				auto impl = std::make_shared<WebSocket>(nullopt, mCertificate);
-				impl->changeState(WebSocket::State::Connecting);
-				impl->setTcpTransport(incoming);
-				clientCallback(std::make_shared<rtc::WebSocket>(impl));
-
-			} catch (const std::exception &e) {
-				PLOG_ERROR << "WebSocketServer: " << e.what();
-			}
-		}
+		WebSocket::Configuration clientConfig;
+		clientConfig.deflate = config.deflate;
+		clientConfig.pingInterval = config.pingInterval;
+		clientConfig.kernelTls = config.kernelTls;
+		clientConfig.maxIncomingMessageSize = config.maxIncomingMessageSize;
+		clientConfig.maxIncomingFrameSize = config.maxIncomingFrameSize;
+		auto impl = std::make_shared<WebSocket>(std::move(clientConfig), mCertificate);
+		impl->changeState(WebSocket::State::Connecting);
+		impl->holdWhileConnecting(std::move(handshakeToken));
+		impl->setTcpTransport(incoming);
+		clientCallback(std::make_shared<rtc::WebSocket>(impl));
+
 	} catch (const std::exception &e) {
-		PLOG_FATAL << "WebSocketServer: " << e.what();
+		PLOG_ERROR << "WebSocketServer: " << e.what();
 	}
-
-	PLOG_INFO << "Stopped WebSocketServer";
 }
 
 } // namespace rtc::impl
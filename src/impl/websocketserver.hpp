@@ -32,7 +32,6 @@
 #include "rtc/websocketserver.hpp"
 
 #include <atomic>
-#include <thread>
 
 namespace rtc::impl {
 
@@ -42,21 +41,23 @@ struct WebSocketServer final : public std::enable_shared_from_this<WebSocketServ
 	WebSocketServer(Configuration config_);
 	~WebSocketServer();
 
+	void start();
 	void stop();
 
 	const Configuration config;
-	const unique_ptr<TcpServer> tcpServer;
+	const shared_ptr<TcpServer> tcpServer;
 
 	synchronized_callback<shared_ptr<rtc::WebSocket>> clientCallback;
 
 private:
 	const init_token mInitToken = Init::Instance().token();
 
-	void runLoop();
+	void openClient(shared_ptr<TcpTransport> incoming, shared_ptr<void> handshakeToken);
+	shared_ptr<void> acquireHandshake(); // null if too many handshakes are pending
 
 	certificate_ptr mCertificate;
-	std::thread mThread;
 	std::atomic<bool> mStopped;
+	const shared_ptr<std::atomic<size_t>> mPendingHandshakes; // shared with tokens
 };
 
 } // namespace rtc::impl
@@ -0,0 +1,662 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_WEBSOCKET
+
+#define RTC_LOG_SUBSYSTEM WebSocket
+
+#include "whipserver.hpp"
+#include "common.hpp"
+#include "http.hpp"
+#include "internals.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <sstream>
+
+namespace rtc::impl {
+
+namespace {
+
+const size_t MaxBodySize = 65536;
+
+string toLower(std::string_view str) {
+	string result(str);
+	std::transform(result.begin(), result.end(), result.begin(),
+	               [](unsigned char c) { return char(std::tolower(c)); });
+	return result;
+}
+
+// Media type without parameters, like "application/sdp" for "application/sdp; charset=utf-8"
+string mediaType(const string &contentType) {
+	return toLower(http::trim(std::string_view(contentType).substr(0, contentType.find(';'))));
+}
+
+} // namespace
+
+struct WhipServer::Connection {
+	shared_ptr<TcpTransport> tcp;
+	shared_ptr<TlsTransport> tls; // set once the TCP connection is up, if TLS is enabled
+
+	std::mutex mutex;
+	binary buffer;        // received data not processed yet
+	bool busy = false;    // a response is pending
+	bool closing = false; // no more requests are processed, the client is expected to close
+
+	shared_ptr<Transport> transport() const {
+		if (auto t = std::atomic_load(&tls))
+			return t;
+		return std::atomic_load(&tcp);
+	}
+};
+
+optional<string> WhipServer::Request::header(std::string_view name) const {
+	for (const auto &[key, value] : headers)
+		if (http::iequals(key, name))
+			return value;
+
+	return nullopt;
+}
+
+WhipServer::WhipServer(Configuration config_)
+    : config(std::move(config_)),
+      tcpServer(std::make_shared<TcpServer>(config.port, config.backlog, config.reusePort)),
+      mFactory(config.peerConfiguration), mStopped(false) {
+	PLOG_VERBOSE << "Creating WhipServer";
+
+	if (config.enableTls) {
+		if (config.certificatePemFile && config.keyPemFile) {
+			mCertificate = std::make_shared<Certificate>(Certificate::FromFile(
+			    *config.certificatePemFile, *config.keyPemFile, config.keyPemPass.value_or("")));
+
+		} else if (!config.certificatePemFile && !config.keyPemFile) {
+			mCertificate = std::make_shared<Certificate>(
+			    Certificate::Generate(CertificateType::Default, "localhost"));
+		} else {
+			throw std::invalid_argument(
+			    "Either none or both certificate and key PEM files must be specified");
+		}
+	}
+}
+
+WhipServer::~WhipServer() {
+	PLOG_VERBOSE << "Destroying WhipServer";
+	stop();
+}
+
+void WhipServer::start() {
+	PLOG_INFO << "Starting WhipServer";
+
+	// Connections are accepted on the poll service thread, which must not block
+	tcpServer->start([weak_this = weak_from_this()](shared_ptr<TcpTransport> incoming) {
+		ThreadPool::Instance().post([weak_this, incoming = std::move(incoming)]() mutable {
+			if (auto shared_this = weak_this.lock())
+				shared_this->openConnection(std::move(incoming));
+		});
+	});
+}
+
+void WhipServer::stop() {
+	if (mStopped.exchange(true))
+		return;
+
+	PLOG_INFO << "Stopping WhipServer";
+	tcpServer->close();
+
+	std::unordered_set<shared_ptr<Connection>> connections;
+	{
+		std::lock_guard lock(mConnectionsMutex);
+		std::swap(connections, mConnections);
+	}
+	for (const auto &connection : connections)
+		closeConnection(connection);
+
+	// Sessions are left running, the application may still hold their PeerConnections
+	std::lock_guard lock(mSessionsMutex);
+	mSessions.clear();
+}
+
+void WhipServer::setSessionCallback(session_callback callback) {
+	std::lock_guard lock(mCallbackMutex);
+	mSessionCallback = std::move(callback);
+}
+
+void WhipServer::openConnection(shared_ptr<TcpTransport> incoming) {
+	if (mStopped)
+		return;
+
+	using State = Transport::State;
+	auto connection = std::make_shared<Connection>();
+	connection->tcp = std::move(incoming);
+	{
+		std::lock_guard lock(mConnectionsMutex);
+		mConnections.insert(connection);
+	}
+
+	// Callbacks only hold weak references, the connection is owned by the server
+	auto recvCallback = [weak_this = weak_from_this(),
+	                     weak_connection = weak_ptr<Connection>(connection)](message_ptr message) {
+		auto shared_this = weak_this.lock();
+		auto connection = weak_connection.lock();
+		if (!shared_this || !connection)
+			return;
+
+		if (!message) {
+			shared_this->closeConnection(connection);
+			return;
+		}
+
+		{
+			std::lock_guard lock(connection->mutex);
+			connection->buffer.insert(connection->buffer.end(), message->payload(),
+			                          message->payload() + message->payloadSize());
+		}
+		shared_this->process(connection);
+	};
+
+	auto closeCallback = [weak_this = weak_from_this(),
+	                      weak_connection = weak_ptr<Connection>(connection)](State state) {
+		if (state != State::Disconnected && state != State::Failed)
+			return;
+
+		auto shared_this = weak_this.lock();
+		auto connection = weak_connection.lock();
+		if (shared_this && connection)
+			shared_this->closeConnection(connection);
+	};
+
+	try {
+		auto tcp = connection->tcp;
+		if (mCertificate) {
+			Init::Instance().init(Init::Subsystem::Tls);
+			tcp->onStateChange([weak_this = weak_from_this(),
+			                    weak_connection = weak_ptr<Connection>(connection), recvCallback,
+			                    closeCallback](State state) {
+				if (state != State::Connected) {
+					closeCallback(state);
+					return;
+				}
+
+				auto shared_this = weak_this.lock();
+				auto connection = weak_connection.lock();
+				if (!shared_this || !connection)
+					return;
+
+				try {
+					auto tcp = std::atomic_load(&connection->tcp);
+					if (!tcp)
+						return; // closed
+
+					auto certificate = shared_this->mCertificate;
+					auto tls =
+					    std::make_shared<TlsTransport>(tcp, nullopt, certificate, closeCallback);
+					tls->onRecv(recvCallback);
+					std::atomic_store(&connection->tls, tls);
+					tls->start();
+
+				} catch (const std::exception &e) {
+					PLOG_ERROR << "WhipServer: TLS transport initialization failed: " << e.what();
+					shared_this->closeConnection(connection);
+				}
+			});
+		} else {
+			tcp->onStateChange(closeCallback);
+			tcp->onRecv(recvCallback);
+		}
+
+		tcp->start();
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "WhipServer: " << e.what();
+		closeConnection(connection);
+	}
+}
+
+void WhipServer::closeConnection(const shared_ptr<Connection> &connection) {
+	{
+		std::lock_guard lock(mConnectionsMutex);
+		mConnections.erase(connection);
+	}
+
+	auto tls = std::atomic_exchange(&connection->tls, decltype(connection->tls)(nullptr));
+	auto tcp = std::atomic_exchange(&connection->tcp, decltype(connection->tcp)(nullptr));
+	if (!tcp)
+		return; // already closed
+
+	using array = std::array<shared_ptr<Transport>, 2>;
+	array transports{std::move(tls), std::move(tcp)};
+	for (const auto &t : transports) {
+		if (t) {
+			t->onRecv(nullptr);
+			t->onStateChange(nullptr);
+		}
+	}
+
+	// Pass the pointers to a thread, allowing to terminate a transport from its own thread
+	ThreadPool::Instance().post([transports = std::move(transports)]() mutable {
+		for (const auto &t : transports)
+			if (t)
+				t->stop();
+
+		for (auto &t : transports)
+			t.reset();
+	});
+}
+
+void WhipServer::process(const shared_ptr<Connection> &connection) {
+	Request request;
+	{
+		std::lock_guard lock(connection->mutex);
+		if (connection->busy || connection->closing)
+			return;
+
+		const auto &buffer = connection->buffer;
+		int error = 0;
+		try {
+			http::Head head;
+			size_t headSize = http::parseHead(buffer.data(), buffer.size(), head);
+			if (headSize == 0)
+				return; // incomplete
+
+			std::string_view line = head.startLine;
+			request.method = string(http::nextToken(line));
+			std::string_view target = http::nextToken(line);
+			std::string_view version = http::trim(line);
+			request.path = string(target.substr(0, target.find('?')));
+			request.headers.reserve(head.count);
+			for (size_t i = 0; i < head.count; ++i)
+				request.headers.emplace_back(head.headers[i].first, head.headers[i].second);
+
+			// Persistent connections are the default since HTTP/1.1
+			auto connectionHeader = request.header("Connection");
+			string connectionToken = connectionHeader ? toLower(*connectionHeader) : "";
+			request.keepAlive = version == "HTTP/1.1" ? connectionToken != "close"
+			                                          : connectionToken == "keep-alive";
+
+			size_t contentLength = 0;
+			if (request.header("Transfer-Encoding")) {
+				error = 501; // chunked bodies are not supported
+			} else if (auto value = request.header("Content-Length")) {
+				const char *first = value->data(), *last = value->data() + value->size();
+				auto [ptr, ec] = std::from_chars(first, last, contentLength);
+				if (ec != std::errc() || ptr != last)
+					error = 400;
+				else if (contentLength > MaxBodySize)
+					error = 413;
+			}
+
+			if (request.method.empty() || target.empty() || version.substr(0, 5) != "HTTP/")
+				error = 400;
+
+			if (!error) {
+				if (buffer.size() < headSize + contentLength)
+					return; // incomplete
+
+				auto body = reinterpret_cast<const char *>(buffer.data()) + headSize;
+				request.body.assign(body, contentLength);
+				connection->buffer.erase(connection->buffer.begin(),
+				                         connection->buffer.begin() + headSize + contentLength);
+			}
+
+		} catch (const http::HeadTooLarge &e) {
+			PLOG_WARNING << "WhipServer: " << e.what();
+			error = 431;
+		}
+
+		connection->busy = true;
+		if (error) {
+			// The request can't be delimited, so the following data is meaningless
+			connection->closing = true;
+			connection->buffer.clear();
+			ThreadPool::Instance().post([weak_this = weak_from_this(), connection, error]() {
+				if (auto shared_this = weak_this.lock())
+					shared_this->respond(connection, Response{error, {}, "", ""}, false);
+			});
+			return;
+		}
+	}
+
+	PLOG_DEBUG << "WhipServer: " << request.method << " " << request.path;
+
+	// Handling may create a PeerConnection, so it does not run on the transport thread
+	ThreadPool::Instance().post([weak_this = weak_from_this(), connection,
+	                             request = std::move(request)]() {
+		auto shared_this = weak_this.lock();
+		if (!shared_this)
+			return;
+
+		bool keepAlive = request.keepAlive;
+		auto respond = [weak_this, connection, keepAlive](Response response) {
+			if (auto shared_this = weak_this.lock())
+				shared_this->respond(connection, std::move(response), keepAlive);
+		};
+
+		try {
+			shared_this->handleRequest(request, std::move(respond));
+
+		} catch (const std::exception &e) {
+			PLOG_ERROR << "WhipServer: " << e.what();
+			shared_this->respond(connection, Response{500, {}, "", ""}, false);
+		}
+	});
+}
+
+void WhipServer::respond(const shared_ptr<Connection> &connection, Response response,
+                         bool keepAlive) {
+	{
+		std::lock_guard lock(connection->mutex);
+		if (!connection->busy)
+			return; // already responded
+
+		connection->busy = false;
+		if (!keepAlive)
+			connection->closing = true;
+	}
+
+	PLOG_DEBUG << "WhipServer: Response " << response.status;
+
+	std::ostringstream out;
+	out << "HTTP/1.1 " << response.status << " " << http::reasonPhrase(response.status) << "\r\n"
+	    << "Server: libdatachannel\r\n"
+	    << "Access-Control-Allow-Origin: *\r\n"
+	    << "Access-Control-Expose-Headers: Location\r\n";
+
+	for (const auto &[name, value] : response.headers)
+		out << name << ": " << value << "\r\n";
+
+	if (!response.contentType.empty())
+		out << "Content-Type: " << response.contentType << "\r\n";
+
+	out << "Content-Length: " << response.body.size() << "\r\n";
+	if (!keepAlive)
+		out << "Connection: close\r\n";
+
+	out << "\r\n" << response.body;
+
+	// The connection is not closed after a final response, so the data is not truncated, the
+	// client closes it once it has read the response
+	string str = out.str();
+	auto data = reinterpret_cast<const byte *>(str.data());
+	try {
+		if (auto transport = connection->transport())
+			transport->send(make_message(data, data + str.size()));
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "WhipServer: Failed to send response: " << e.what();
+		closeConnection(connection);
+		return;
+	}
+
+	if (keepAlive)
+		process(connection); // pipelined requests
+}
+
+void WhipServer::handleRequest(const Request &request, response_callback respond) {
+	const string &method = request.method;
+	if (method == "OPTIONS") {
+		// CORS preflight
+		respond(Response{204,
+		                 {{"Access-Control-Allow-Methods", "OPTIONS, POST, PATCH, DELETE"},
+		                  {"Access-Control-Allow-Headers", "Authorization, Content-Type, If-Match"},
+		                  {"Access-Control-Max-Age", "86400"}},
+		                 "",
+		                 ""});
+
+	} else if (auto kind = matchEndpoint(request.path)) {
+		if (method == "POST")
+			handleOffer(*kind, request, std::move(respond));
+		else
+			respond(Response{405, {{"Allow", "OPTIONS, POST"}}, "", ""});
+
+	} else if (auto id = matchSession(request.path)) {
+		if (method == "PATCH")
+			respond(handlePatch(*id, request));
+		else if (method == "DELETE")
+			respond(handleDelete(*id));
+		else
+			respond(Response{405, {{"Allow", "OPTIONS, PATCH, DELETE"}}, "", ""});
+
+	} else {
+		respond(Response{404, {}, "", ""});
+	}
+}
+
+void WhipServer::handleOffer(Kind kind, const Request &request, response_callback respond) {
+	if (mediaType(request.header("Content-Type").value_or("")) != "application/sdp") {
+		respond(Response{415, {{"Accept-Post", "application/sdp"}}, "", ""});
+		return;
+	}
+
+	optional<Description> offer;
+	try {
+		offer.emplace(request.body, Description::Type::Offer);
+		if (offer->mediaCount() == 0)
+			throw std::invalid_argument("No media in offer");
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "WhipServer: Invalid offer: " << e.what();
+		respond(Response{400, {}, "text/plain", string(e.what()) + "\n"});
+		return;
+	}
+
+	string id;
+	{
+		std::lock_guard lock(mSessionsMutex);
+		pruneSessions();
+		if (config.maxSessions && mSessions.size() >= *config.maxSessions) {
+			PLOG_WARNING << "WhipServer: Too many sessions, refusing offer";
+			respond(Response{503, {{"Retry-After", "10"}}, "", ""});
+			return;
+		}
+		id = generateId();
+	}
+
+	Session session{kind, id, request.path, request.header("Authorization"), std::move(*offer),
+	                mFactory.create()};
+	auto pc = session.peerConnection;
+
+	session_callback callback;
+	{
+		std::lock_guard lock(mCallbackMutex);
+		callback = mSessionCallback;
+	}
+
+	if (callback && !callback(session)) {
+		PLOG_DEBUG << "WhipServer: Session refused";
+		pc->close();
+		respond(Response{403, {}, "", ""});
+		return;
+	}
+
+	// The answer is sent once, when gathering completes or on timeout with the candidates so far
+	struct Pending {
+		std::atomic<bool> done = false;
+		response_callback respond;
+		string location;
+		weak_ptr<rtc::PeerConnection> pc;
+		TimerHandle timer;
+
+		void answer() {
+			if (done.exchange(true))
+				return;
+
+			timer.cancel();
+			auto callback = std::move(respond); // release the connection
+			auto locked = pc.lock();
+			auto description = locked ? locked->localDescription() : nullopt;
+			if (!description) {
+				callback(Response{500, {}, "", ""});
+				return;
+			}
+			callback(Response{201, {{"Location", location}}, "application/sdp",
+			                 string(*description)});
+		}
+	};
+
+	auto pending = std::make_shared<Pending>();
+	pending->respond = std::move(respond);
+	pending->location = request.path + "/" + id;
+	pending->pc = pc;
+	pending->timer = ThreadPool::Instance().scheduleTimer(
+	    config.gatheringTimeout, [weak_pending = weak_ptr<Pending>(pending)]() {
+		    if (auto pending = weak_pending.lock())
+			    pending->answer();
+	    });
+
+	pc->onGatheringStateChange([pending](rtc::PeerConnection::GatheringState state) {
+		if (state == rtc::PeerConnection::GatheringState::Complete)
+			pending->answer();
+	});
+
+	// Register the session first, so candidates trickled right after the answer are accepted
+	{
+		std::lock_guard lock(mSessionsMutex);
+		mSessions.emplace(id, pc);
+	}
+
+	try {
+		pc->setRemoteDescription(std::move(session.offer));
+		if (config.peerConfiguration.disableAutoNegotiation)
+			pc->setLocalDescription(Description::Type::Answer);
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "WhipServer: Failed to set offer: " << e.what();
+		{
+			std::lock_guard lock(mSessionsMutex);
+			mSessions.erase(id);
+		}
+		pc->close();
+		if (!pending->done.exchange(true)) {
+			pending->timer.cancel();
+			auto callback = std::move(pending->respond);
+			callback(Response{400, {}, "text/plain", string(e.what()) + "\n"});
+		}
+		return;
+	}
+
+	if (pc->gatheringState() == rtc::PeerConnection::GatheringState::Complete)
+		pending->answer();
+}
+
+WhipServer::Response WhipServer::handlePatch(const string &id, const Request &request) {
+	shared_ptr<rtc::PeerConnection> pc;
+	{
+		std::lock_guard lock(mSessionsMutex);
+		if (auto it = mSessions.find(id); it != mSessions.end())
+			pc = it->second;
+	}
+	if (!pc)
+		return Response{404, {}, "", ""};
+
+	if (mediaType(request.header("Content-Type").value_or("")) !=
+	    "application/trickle-ice-sdpfrag")
+		return Response{415, {{"Accept-Patch", "application/trickle-ice-sdpfrag"}}, "", ""};
+
+	auto remote = pc->remoteDescription();
+	if (!remote)
+		return Response{404, {}, "", ""};
+
+	// Candidates apply to the preceding media section of the fragment, ICE restarts are not
+	// supported so credentials are ignored
+	string mid = remote->bundleMid();
+	std::string_view body = request.body;
+	try {
+		while (!body.empty()) {
+			size_t end = body.find('\n');
+			std::string_view line = http::trim(body.substr(0, end));
+			body.remove_prefix(end != std::string_view::npos ? end + 1 : body.size());
+			if (line.substr(0, 6) == "a=mid:")
+				mid = string(line.substr(6));
+			else if (line.substr(0, 12) == "a=candidate:")
+				pc->addRemoteCandidate(Candidate(string(line.substr(2)), mid));
+		}
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "WhipServer: Invalid candidate: " << e.what();
+		return Response{400, {}, "text/plain", string(e.what()) + "\n"};
+	}
+
+	return Response{204, {}, "", ""};
+}
+
+WhipServer::Response WhipServer::handleDelete(const string &id) {
+	shared_ptr<rtc::PeerConnection> pc;
+	{
+		std::lock_guard lock(mSessionsMutex);
+		if (auto it = mSessions.find(id); it != mSessions.end()) {
+			pc = std::move(it->second);
+			mSessions.erase(it);
+		}
+	}
+	if (!pc)
+		return Response{404, {}, "", ""};
+
+	PLOG_DEBUG << "WhipServer: Closing session " << id;
+	pc->close();
+	return Response{200, {}, "", ""};
+}
+
+optional<WhipServer::Kind> WhipServer::matchEndpoint(const string &path) const {
+	if (path == config.whipPath)
+		return Kind::Whip;
+	if (path == config.whepPath)
+		return Kind::Whep;
+
+	return nullopt;
+}
+
+optional<string> WhipServer::matchSession(const string &path) const {
+	for (const string *prefix : {&config.whipPath, &config.whepPath}) {
+		if (path.size() > prefix->size() + 1 && path.compare(0, prefix->size(), *prefix) == 0 &&
+		    path[prefix->size()] == '/') {
+			string id = path.substr(prefix->size() + 1);
+			if (id.find('/') == string::npos)
+				return id;
+		}
+	}
+	return nullopt;
+}
+
+string WhipServer::generateId() {
+	// Session URLs act as capabilities for PATCH and DELETE, so they must not be guessable
+	static const char *hex = "0123456789abcdef";
+	string id;
+	id.reserve(32);
+	for (int i = 0; i < 4; ++i) {
+		auto value = uint32_t(mRandomDevice());
+		for (int j = 0; j < 8; ++j, value >>= 4)
+			id.push_back(hex[value & 0xF]);
+	}
+	return id;
+}
+
+void WhipServer::pruneSessions() {
+	using State = rtc::PeerConnection::State;
+	for (auto it = mSessions.begin(); it != mSessions.end();) {
+		auto state = it->second->state();
+		if (state == State::Closed || state == State::Failed)
+			it = mSessions.erase(it);
+		else
+			++it;
+	}
+}
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_WHIP_SERVER_H
+#define RTC_IMPL_WHIP_SERVER_H
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "certificate.hpp"
+#include "common.hpp"
+#include "init.hpp"
+#include "tcpserver.hpp"
+#include "tcptransport.hpp"
+#include "threadpool.hpp"
+#include "tlstransport.hpp"
+
+#include "rtc/peerconnectionfactory.hpp"
+#include "rtc/whipserver.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace rtc::impl {
+
+struct WhipServer final : public std::enable_shared_from_this<WhipServer> {
+	using Configuration = rtc::WhipServer::Configuration;
+	using Kind = rtc::WhipServer::Kind;
+	using Session = rtc::WhipServer::Session;
+	using session_callback = std::function<bool(Session &session)>;
+
+	WhipServer(Configuration config_);
+	~WhipServer();
+
+	void start();
+	void stop();
+
+	void setSessionCallback(session_callback callback);
+
+	const Configuration config;
+	const shared_ptr<TcpServer> tcpServer;
+
+private:
+	struct Connection; // HTTP/1.1 connection, requests are processed one at a time
+
+	struct Request {
+		string method;
+		string path; // request target without the query
+		std::vector<std::pair<string, string>> headers;
+		string body;
+		bool keepAlive;
+
+		optional<string> header(std::string_view name) const;
+	};
+
+	struct Response {
+		int status;
+		std::vector<std::pair<string, string>> headers;
+		string contentType;
+		string body;
+	};
+	using response_callback = std::function<void(Response response)>;
+
+	void openConnection(shared_ptr<TcpTransport> incoming);
+	void closeConnection(const shared_ptr<Connection> &connection);
+	void process(const shared_ptr<Connection> &connection);
+	void respond(const shared_ptr<Connection> &connection, Response response, bool keepAlive);
+
+	// The answer to an offer is sent asynchronously, once candidates are gathered
+	void handleRequest(const Request &request, response_callback respond);
+	void handleOffer(Kind kind, const Request &request, response_callback respond);
+	Response handlePatch(const string &id, const Request &request);
+	Response handleDelete(const string &id);
+
+	optional<Kind> matchEndpoint(const string &path) const;
+	optional<string> matchSession(const string &path) const; // session id
+	string generateId();
+	void pruneSessions(); // mSessionsMutex must be locked
+
+	const init_token mInitToken = Init::Instance().token();
+
+	certificate_ptr mCertificate;
+	PeerConnectionFactory mFactory;
+	std::atomic<bool> mStopped;
+
+	std::mutex mCallbackMutex;
+	session_callback mSessionCallback;
+
+	std::mutex mConnectionsMutex;
+	std::unordered_set<shared_ptr<Connection>> mConnections;
+
+	std::mutex mSessionsMutex;
+	std::random_device mRandomDevice; // protected by mSessionsMutex
+	std::unordered_map<string, shared_ptr<rtc::PeerConnection>> mSessions;
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "wsdeflate.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace rtc::impl {
+
+namespace {
+
+// Each compressed message ends with an empty stored block which is not transmitted
+const byte Tail[4] = {byte{0x00}, byte{0x00}, byte{0xFF}, byte{0xFF}};
+
+} // namespace
+
+#if USE_ZLIB
+
+bool WsDeflate::IsAvailable() { return true; }
+
+WsDeflate::WsDeflate(Parameters params) : mParams(std::move(params)) {
+	// Windows of 8 bits are not supported by zlib for raw deflate
+	const int localBits = std::clamp(mParams.localMaxWindowBits, 9, 15);
+
+	std::memset(&mDeflateStream, 0, sizeof(mDeflateStream));
+	if (deflateInit2(&mDeflateStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -localBits, 8,
+	                 Z_DEFAULT_STRATEGY) != Z_OK)
+		throw std::runtime_error("Failed to initialize deflate stream");
+
+	// Inflating with the maximum window accepts any smaller window
+	std::memset(&mInflateStream, 0, sizeof(mInflateStream));
+	if (inflateInit2(&mInflateStream, -15) != Z_OK) {
+		deflateEnd(&mDeflateStream);
+		throw std::runtime_error("Failed to initialize inflate stream");
+	}
+}
+
+WsDeflate::~WsDeflate() {
+	deflateEnd(&mDeflateStream);
+	inflateEnd(&mInflateStream);
+}
+
+message_ptr WsDeflate::compress(const byte *data, size_t size, Message::Type type) {
+	auto message = make_message(size_t(0), type);
+	message->resize(deflateBound(&mDeflateStream, uLong(size)) + 16);
+
+	mDeflateStream.next_in = reinterpret_cast<Bytef *>(const_cast<byte *>(data));
+	mDeflateStream.avail_in = uInt(size);
+	size_t len = 0;
+	while (true) {
+		mDeflateStream.next_out = reinterpret_cast<Bytef *>(message->data() + len);
+		mDeflateStream.avail_out = uInt(message->size() - len);
+		if (deflate(&mDeflateStream, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+			throw std::runtime_error("WebSocket message compression failed");
+
+		len = message->size() - mDeflateStream.avail_out;
+		if (mDeflateStream.avail_out > 0)
+			break; // flushed
+
+		message->resize(message->size() * 2);
+	}
+
+	if (len >= 4 && std::equal(Tail, Tail + 4, message->data() + len - 4))
+		len -= 4;
+
+	message->resize(len);
+	if (message->empty())
+		message->push_back(byte{0x00}); // RFC 7692 7.2.3.6
+
+	if (mParams.localNoContextTakeover)
+		deflateReset(&mDeflateStream);
+
+	return message;
+}
+
+message_ptr WsDeflate::decompress(message_ptr message, size_t maxSize) {
+	message->insert(message->end(), Tail, Tail + 4);
+
+	auto result = make_message(size_t(0), message->type);
+	result->resize(std::max(message->size() * 4, size_t(1024)));
+
+	mInflateStream.next_in = reinterpret_cast<Bytef *>(message->data());
+	mInflateStream.avail_in = uInt(message->size());
+	size_t len = 0;
+	while (true) {
+		mInflateStream.next_out = reinterpret_cast<Bytef *>(result->data() + len);
+		mInflateStream.avail_out = uInt(result->size() - len);
+		int ret = inflate(&mInflateStream, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END)
+			throw std::runtime_error("WebSocket message decompression failed");
+
+		len = result->size() - mInflateStream.avail_out;
+		if (len > maxSize)
+			throw std::length_error("WebSocket decompressed message exceeds limit");
+
+		if (ret == Z_STREAM_END) {
+			// The peer ended the stream with a final block, the context must be reset
+			inflateReset(&mInflateStream);
+			break;
+		}
+
+		if (mInflateStream.avail_in == 0 && mInflateStream.avail_out > 0)
+			break;
+
+		if (ret == Z_BUF_ERROR && mInflateStream.avail_out > 0)
+			throw std::runtime_error("WebSocket compressed message is truncated");
+
+		result->resize(result->size() * 2);
+	}
+
+	result->resize(len);
+
+	if (mParams.remoteNoContextTakeover)
+		inflateReset(&mInflateStream);
+
+	return result;
+}
+
+#else
+
+bool WsDeflate::IsAvailable() { return false; }
+
+WsDeflate::WsDeflate(Parameters params) : mParams(std::move(params)) {
+	throw std::logic_error("WebSocket compression support is disabled");
+}
+
+WsDeflate::~WsDeflate() {}
+
+message_ptr WsDeflate::compress(const byte *, size_t, Message::Type) { return nullptr; }
+
+message_ptr WsDeflate::decompress(message_ptr, size_t) { return nullptr; }
+
+#endif
+
+} // namespace rtc::impl
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RTC_IMPL_WS_DEFLATE_H
+#define RTC_IMPL_WS_DEFLATE_H
+
+#include "common.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "message.hpp"
+
+#include <limits>
+
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace rtc::impl {
+
+// permessage-deflate compression (RFC 7692), the contexts are not thread-safe
+class WsDeflate final {
+public:
+	// Negotiated parameters, local applies to sent messages and remote to received ones
+	struct Parameters {
+		bool localNoContextTakeover = false;
+		bool remoteNoContextTakeover = false;
+		int localMaxWindowBits = 15;
+		int remoteMaxWindowBits = 15;
+	};
+
+	static bool IsAvailable();
+
+	WsDeflate(Parameters params);
+	~WsDeflate();
+
+	message_ptr compress(const byte *data, size_t size, Message::Type type);
+	message_ptr decompress(message_ptr message, // message is modified
+	                       size_t maxSize = std::numeric_limits<size_t>::max());
+
+private:
+	const Parameters mParams;
+
+#if USE_ZLIB
+	z_stream mDeflateStream;
+	z_stream mInflateStream;
+#endif
+};
+
+} // namespace rtc::impl
+
+#endif
+
+#endif
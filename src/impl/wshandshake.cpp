@@ -16,20 +16,26 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM WebSocket
+
 #include "wshandshake.hpp"
 #include "base64.hpp"
+#include "http.hpp"
 #include "internals.hpp"
 #include "sha.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
 
 #include <algorithm>
+#include <array>
 #include <chrono>
 #include <climits>
+#include <cstring>
 #include <iostream>
 #include <iterator>
 #include <random>
 #include <sstream>
+#include <string_view>
 
 using std::string;
 
@@ -56,6 +62,66 @@ string implode(const std::vector<string> &tokens, char delim) {
 	return result;
 }
 
+string trim(const string &str) {
+	const char *whitespace = " \t";
+	size_t first = str.find_first_not_of(whitespace);
+	if (first == string::npos)
+		return "";
+
+	size_t last = str.find_last_not_of(whitespace);
+	return str.substr(first, last - first + 1);
+}
+
+// RFC 6455 9.1. Negotiating Extensions
+// Each extension is returned with its parameters, the value of a parameter is optional
+using ExtensionParameters = std::vector<std::pair<string, std::optional<string>>>;
+std::vector<std::pair<string, ExtensionParameters>> parseExtensions(const string &value) {
+	auto lower = [](string str) {
+		std::transform(str.begin(), str.end(), str.begin(),
+		               [](char c) { return std::tolower(c); });
+		return str;
+	};
+
+	std::vector<std::pair<string, ExtensionParameters>> result;
+	for (const string &extension : explode(value, ',')) {
+		auto tokens = explode(extension, ';');
+		if (tokens.empty() || trim(tokens.front()).empty())
+			continue;
+
+		ExtensionParameters params;
+		for (auto it = std::next(tokens.begin()); it != tokens.end(); ++it) {
+			if (size_t pos = it->find('='); pos != string::npos) {
+				string v = trim(it->substr(pos + 1));
+				if (v.size() >= 2 && v.front() == '"' && v.back() == '"')
+					v = v.substr(1, v.size() - 2);
+
+				params.emplace_back(lower(trim(it->substr(0, pos))), std::move(v));
+			} else {
+				params.emplace_back(lower(trim(*it)), std::nullopt);
+			}
+		}
+		result.emplace_back(lower(trim(tokens.front())), std::move(params));
+	}
+
+	return result;
+}
+
+std::optional<int> parseWindowBits(const std::optional<string> &value, int min = 8) {
+	if (!value || value->empty() || value->size() > 2 ||
+	    !std::all_of(value->begin(), value->end(), [](char c) { return std::isdigit(c); }))
+		return std::nullopt;
+
+	int bits = std::stoi(*value);
+	if (bits < min || bits > 15)
+		return std::nullopt;
+
+	return bits;
+}
+
+int clampWindowBits(int bits) {
+	return std::clamp(bits, 9, 15); // windows of 8 bits are not supported by zlib
+}
+
 } // namespace
 
 namespace rtc::impl {
@@ -65,10 +131,22 @@ using std::chrono::system_clock;
 using random_bytes_engine =
     std::independent_bits_engine<std::default_random_engine, CHAR_BIT, unsigned short>;
 
-WsHandshake::WsHandshake() {}
+WsHandshake::WsHandshake(optional<DeflateConfiguration> deflate)
+    : mDeflateConfig(std::move(deflate)) {
 
-WsHandshake::WsHandshake(string host, string path, std::vector<string> protocols)
-    : mHost(std::move(host)), mPath(std::move(path)), mProtocols(std::move(protocols)) {
+	if (mDeflateConfig && !WsDeflate::IsAvailable()) {
+		PLOG_WARNING << "WebSocket compression is not supported by this build, ignoring";
+		mDeflateConfig.reset();
+	}
+}
+
+WsHandshake::WsHandshake(string host, string path, std::vector<string> protocols,
+                         optional<DeflateConfiguration> deflate)
+    : WsHandshake(std::move(deflate)) {
+
+	mHost = std::move(host);
+	mPath = std::move(path);
+	mProtocols = std::move(protocols);
 
 	if (mHost.empty())
 		throw std::invalid_argument("WebSocket HTTP host cannot be empty");
@@ -92,6 +170,11 @@ std::vector<string> WsHandshake::protocols() const {
 	return mProtocols;
 }
 
+optional<WsDeflate::Parameters> WsHandshake::deflateParameters() const {
+	std::unique_lock lock(mMutex);
+	return mDeflateParams;
+}
+
 string WsHandshake::generateHttpRequest() {
 	std::unique_lock lock(mMutex);
 	mKey = generateKey();
@@ -110,39 +193,60 @@ string WsHandshake::generateHttpRequest() {
 	if (!mProtocols.empty())
 		out += "Sec-WebSocket-Protocol: " + implode(mProtocols, ',') + "\r\n";
 
+	if (mDeflateConfig)
+		out += "Sec-WebSocket-Extensions: " + generateDeflateOffer() + "\r\n";
+
 	out += "\r\n";
 
 	return out;
 }
 
+http::HeaderList WsHandshake::generateConnectRequest() {
+	std::unique_lock lock(mMutex);
+
+	// There is no key, the stream itself proves that the server supports WebSockets
+	http::HeaderList headers = {{":method", "CONNECT"},  {":protocol", "websocket"},
+	                            {":scheme", "https"},     {":path", mPath},
+	                            {":authority", mHost},    {"sec-websocket-version", "13"}};
+
+	if (!mProtocols.empty())
+		headers.emplace_back("sec-websocket-protocol", implode(mProtocols, ','));
+
+	if (mDeflateConfig)
+		headers.emplace_back("sec-websocket-extensions", generateDeflateOffer());
+
+	return headers;
+}
+
 string WsHandshake::generateHttpResponse() {
 	std::unique_lock lock(mMutex);
-	const string out = "HTTP/1.1 101 Switching Protocols\r\n"
-	                   "Server: libdatachannel\r\n"
-	                   "Connection: upgrade\r\n"
-	                   "Upgrade: websocket\r\n"
-	                   "Sec-WebSocket-Accept: " +
-	                   computeAcceptKey(mKey) + "\r\n\r\n";
+	string out = "HTTP/1.1 101 Switching Protocols\r\n"
+	             "Server: libdatachannel\r\n"
+	             "Connection: upgrade\r\n"
+	             "Upgrade: websocket\r\n"
+	             "Sec-WebSocket-Accept: " +
+	             computeAcceptKey(mKey) + "\r\n";
+
+	if (mDeflateParams)
+		out += "Sec-WebSocket-Extensions: " + generateDeflateResponse() + "\r\n";
+
+	out += "\r\n";
 
 	return out;
 }
 
 namespace {
 
-string GetHttpErrorName(int responseCode) {
-	switch (responseCode) {
-	case 400:
-		return "Bad Request";
-	case 404:
-		return "Not Found";
-	case 405:
-		return "Method Not Allowed";
-	case 426:
-		return "Upgrade Required";
-	case 500:
-		return "Internal Server Error";
-	default:
-		return "Error";
+// Head size errors are reported as request errors on the server side
+size_t parseHttpHead(const byte *buffer, size_t size, http::Head &head, bool request) {
+	try {
+		return http::parseHead(buffer, size, head);
+	} catch (const http::HeadTooLarge &e) {
+		const string message = string("WebSocket ") + e.what();
+		if (request)
+			throw WsHandshake::RequestError(message, 431);
+		else
+			throw WsHandshake::Error(message);
 	}
 }
 
@@ -151,7 +255,7 @@ string GetHttpErrorName(int responseCode) {
 string WsHandshake::generateHttpError(int responseCode) {
 	std::unique_lock lock(mMutex);
 
-	const string error = to_string(responseCode) + " " + GetHttpErrorName(responseCode);
+	const string error = to_string(responseCode) + " " + http::reasonPhrase(responseCode);
 
 	const string out = "HTTP/1.1 " + error +
 	                   "\r\n"
@@ -170,98 +274,135 @@ string WsHandshake::generateHttpError(int responseCode) {
 
 size_t WsHandshake::parseHttpRequest(const byte *buffer, size_t size) {
 	std::unique_lock lock(mMutex);
-	std::list<string> lines;
-	size_t length = parseHttpLines(buffer, size, lines);
+	http::Head head;
+	size_t length = parseHttpHead(buffer, size, head, true);
 	if (length == 0)
 		return 0;
 
-	if (lines.empty())
+	if (head.startLine.empty())
 		throw RequestError("Invalid HTTP request for WebSocket", 400);
 
-	std::istringstream requestLine(std::move(lines.front()));
-	lines.pop_front();
-
-	string method, path, protocol;
-	requestLine >> method >> path >> protocol;
+	auto requestLine = head.startLine;
+	auto method = http::nextToken(requestLine);
+	auto path = http::nextToken(requestLine);
 	PLOG_DEBUG << "WebSocket request method \"" << method << "\" for path: " << path;
 	if (method != "GET")
-		throw RequestError("Invalid request method \"" + method + "\" for WebSocket", 405);
-
-	mPath = std::move(path);
+		throw RequestError("Invalid request method \"" + string(method) + "\" for WebSocket",
+		                   405);
 
-	auto headers = parseHttpHeaders(lines);
+	mPath = string(path);
 
-	auto h = headers.find("host");
-	if (h == headers.end())
+	auto h = head.find("host");
+	if (!h)
 		throw RequestError("WebSocket host header missing in request", 400);
 
-	mHost = std::move(h->second);
+	mHost = string(*h);
 
-	h = headers.find("upgrade");
-	if (h == headers.end())
+	h = head.find("upgrade");
+	if (!h)
 		throw RequestError("WebSocket upgrade header missing in request", 426);
 
-	string upgrade;
-	std::transform(h->second.begin(), h->second.end(), std::back_inserter(upgrade),
-	               [](char c) { return std::tolower(c); });
-	if (upgrade != "websocket")
-		throw RequestError("WebSocket upgrade header mismatching: " + h->second, 426);
+	if (!http::iequals(*h, "websocket"))
+		throw RequestError("WebSocket upgrade header mismatching: " + string(*h), 426);
 
-	h = headers.find("sec-websocket-key");
-	if (h == headers.end())
+	h = head.find("sec-websocket-key");
+	if (!h)
 		throw RequestError("WebSocket key header missing in request", 400);
 
-	mKey = std::move(h->second);
+	mKey = string(*h);
+
+	h = head.find("sec-websocket-protocol");
+	if (h)
+		mProtocols = explode(string(*h), ',');
+
+	mDeflateParams.reset();
+	if (mDeflateConfig) {
+		string offers;
+		for (size_t i = 0; i < head.count; ++i) {
+			if (!http::iequals(head.headers[i].first, "sec-websocket-extensions"))
+				continue;
 
-	h = headers.find("sec-websocket-protocol");
-	if (h != headers.end())
-		mProtocols = explode(h->second, ',');
+			if (!offers.empty())
+				offers += ',';
+
+			offers += head.headers[i].second;
+		}
+
+		mDeflateParams = negotiateDeflate(offers);
+	}
 
 	return length;
 }
 
 size_t WsHandshake::parseHttpResponse(const byte *buffer, size_t size) {
 	std::unique_lock lock(mMutex);
-	std::list<string> lines;
-	size_t length = parseHttpLines(buffer, size, lines);
+	http::Head head;
+	size_t length = parseHttpHead(buffer, size, head, false);
 	if (length == 0)
 		return 0;
 
-	if (lines.empty())
+	if (head.startLine.empty())
 		throw Error("Invalid HTTP response for WebSocket");
 
-	std::istringstream status(std::move(lines.front()));
-	lines.pop_front();
-
-	string protocol;
+	auto status = head.startLine;
+	http::nextToken(status); // protocol
+	auto codeToken = http::nextToken(status);
 	unsigned int code = 0;
-	status >> protocol >> code;
+	if (codeToken.size() == 3 && std::all_of(codeToken.begin(), codeToken.end(), [](char c) {
+		    return std::isdigit(static_cast<unsigned char>(c));
+	    }))
+		for (char c : codeToken)
+			code = code * 10 + unsigned(c - '0');
+
 	PLOG_DEBUG << "WebSocket response code: " << code;
 	if (code != 101)
 		throw std::runtime_error("Unexpected response code " + to_string(code) + " for WebSocket");
 
-	auto headers = parseHttpHeaders(lines);
-
-	auto h = headers.find("upgrade");
-	if (h == headers.end())
+	auto h = head.find("upgrade");
+	if (!h)
 		throw Error("WebSocket update header missing");
 
-	string upgrade;
-	std::transform(h->second.begin(), h->second.end(), std::back_inserter(upgrade),
-	               [](char c) { return std::tolower(c); });
-	if (upgrade != "websocket")
-		throw Error("WebSocket update header mismatching: " + h->second);
+	if (!http::iequals(*h, "websocket"))
+		throw Error("WebSocket update header mismatching: " + string(*h));
 
-	h = headers.find("sec-websocket-accept");
-	if (h == headers.end())
+	h = head.find("sec-websocket-accept");
+	if (!h)
 		throw Error("WebSocket accept header missing");
 
-	if (h->second != computeAcceptKey(mKey))
+	if (*h != computeAcceptKey(mKey))
 		throw Error("WebSocket accept header is invalid");
 
+	mDeflateParams.reset();
+	h = head.find("sec-websocket-extensions");
+	if (h)
+		mDeflateParams = acceptDeflate(string(*h));
+
 	return length;
 }
 
+void WsHandshake::parseConnectResponse(const http::HeaderList &headers) {
+	std::unique_lock lock(mMutex);
+	auto find = [&headers](const string &name) -> const string * {
+		for (const auto &[key, value] : headers)
+			if (key == name) // HTTP/2 header names are lowercase
+				return &value;
+
+		return nullptr;
+	};
+
+	auto status = find(":status");
+	if (!status)
+		throw Error("Invalid HTTP/2 response for WebSocket");
+
+	PLOG_DEBUG << "WebSocket response status: " << *status;
+	if (*status != "200")
+		throw std::runtime_error("Unexpected response status " + *status + " for WebSocket");
+
+	mDeflateParams.reset();
+	if (auto h = find("sec-websocket-extensions"))
+		mDeflateParams = acceptDeflate(*h);
+}
+
 string WsHandshake::generateKey() {
 	// RFC 6455: The request MUST include a header field with the name Sec-WebSocket-Key.  The value
 	// of this header field MUST be a nonce consisting of a randomly selected 16-byte value that has
@@ -275,43 +416,116 @@ string WsHandshake::generateKey() {
 }
 
 string WsHandshake::computeAcceptKey(const string &key) {
-	return to_base64(Sha1(string(key) + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+	static const string Guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	return to_base64(Sha1(key + Guid));
+}
+
+// RFC 7692 7.1. Extension Negotiation Parameters
+string WsHandshake::generateDeflateOffer() const {
+	string out = "permessage-deflate";
+	if (mDeflateConfig->noContextTakeover)
+		out += "; client_no_context_takeover";
+	if (mDeflateConfig->remoteNoContextTakeover)
+		out += "; server_no_context_takeover";
+
+	// Always signal client_max_window_bits so the server may limit our window
+	out += "; client_max_window_bits";
+	if (int bits = clampWindowBits(mDeflateConfig->maxWindowBits); bits < 15)
+		out += "=" + to_string(bits);
+
+	if (int bits = clampWindowBits(mDeflateConfig->remoteMaxWindowBits); bits < 15)
+		out += "; server_max_window_bits=" + to_string(bits);
+
+	return out;
 }
 
-size_t WsHandshake::parseHttpLines(const byte *buffer, size_t size, std::list<string> &lines) {
-	lines.clear();
-	auto begin = reinterpret_cast<const char *>(buffer);
-	auto end = begin + size;
-	auto cur = begin;
-	while (true) {
-		auto last = cur;
-		cur = std::find(cur, end, '\n');
-		if (cur == end)
-			return 0;
-		string line(last, cur != begin && *std::prev(cur) == '\r' ? std::prev(cur++) : cur++);
-		if (line.empty())
-			break;
-		lines.emplace_back(std::move(line));
+string WsHandshake::generateDeflateResponse() const {
+	string out = "permessage-deflate";
+	if (mDeflateParams->localNoContextTakeover)
+		out += "; server_no_context_takeover";
+	if (mDeflateParams->remoteNoContextTakeover)
+		out += "; client_no_context_takeover";
+	if (mDeflateParams->localMaxWindowBits < 15)
+		out += "; server_max_window_bits=" + to_string(mDeflateParams->localMaxWindowBits);
+	if (mDeflateParams->remoteMaxWindowBits < 15)
+		out += "; client_max_window_bits=" + to_string(mDeflateParams->remoteMaxWindowBits);
+
+	return out;
+}
+
+optional<WsDeflate::Parameters> WsHandshake::negotiateDeflate(const string &offers) const {
+	// The server accepts the first acceptable offer, unacceptable ones are declined
+	for (const auto &[name, params] : parseExtensions(offers)) {
+		if (name != "permessage-deflate")
+			continue;
+
+		WsDeflate::Parameters result;
+		result.localNoContextTakeover = mDeflateConfig->noContextTakeover;
+		result.remoteNoContextTakeover = mDeflateConfig->remoteNoContextTakeover;
+		result.localMaxWindowBits = clampWindowBits(mDeflateConfig->maxWindowBits);
+		result.remoteMaxWindowBits = 15;
+
+		bool acceptable = true;
+		for (const auto &[key, value] : params) {
+			if (key == "server_no_context_takeover" && !value) {
+				result.localNoContextTakeover = true;
+			} else if (key == "client_no_context_takeover" && !value) {
+				result.remoteNoContextTakeover = true;
+			} else if (key == "server_max_window_bits") {
+				if (auto bits = parseWindowBits(value, 9))
+					result.localMaxWindowBits = std::min(result.localMaxWindowBits, *bits);
+				else
+					acceptable = false;
+			} else if (key == "client_max_window_bits") {
+				// Without value, the client only signals it supports limiting its window
+				if (auto bits = value ? parseWindowBits(value) : 15)
+					result.remoteMaxWindowBits =
+					    std::min(*bits, clampWindowBits(mDeflateConfig->remoteMaxWindowBits));
+				else
+					acceptable = false;
+			} else {
+				acceptable = false;
+			}
+		}
+
+		if (acceptable) {
+			PLOG_DEBUG << "WebSocket permessage-deflate accepted";
+			return result;
+		}
 	}
 
-	return cur - begin;
+	return nullopt;
 }
 
-std::multimap<string, string> WsHandshake::parseHttpHeaders(const std::list<string> &lines) {
-	std::multimap<string, string> headers;
-	for (const auto &line : lines) {
-		if (size_t pos = line.find_first_of(':'); pos != string::npos) {
-			string key = line.substr(0, pos);
-			string value = line.substr(line.find_first_not_of(' ', pos + 1));
-			std::transform(key.begin(), key.end(), key.begin(),
-			               [](char c) { return std::tolower(c); });
-			headers.emplace(std::move(key), std::move(value));
+WsDeflate::Parameters WsHandshake::acceptDeflate(const string &response) const {
+	auto extensions = parseExtensions(response);
+	if (!mDeflateConfig || extensions.size() != 1 ||
+	    extensions.front().first != "permessage-deflate")
+		throw Error("Unexpected WebSocket extensions in response: " + response);
+
+	WsDeflate::Parameters result;
+	result.localNoContextTakeover = mDeflateConfig->noContextTakeover;
+	result.remoteNoContextTakeover = false;
+	result.localMaxWindowBits = clampWindowBits(mDeflateConfig->maxWindowBits);
+	result.remoteMaxWindowBits = 15;
+
+	for (const auto &[key, value] : extensions.front().second) {
+		if (key == "server_no_context_takeover" && !value) {
+			result.remoteNoContextTakeover = true;
+		} else if (key == "client_no_context_takeover" && !value) {
+			result.localNoContextTakeover = true;
+		} else if (auto bits = parseWindowBits(value); bits && key == "server_max_window_bits") {
+			result.remoteMaxWindowBits = *bits;
+		} else if (auto bits = parseWindowBits(value, 9);
+		           bits && key == "client_max_window_bits") {
+			result.localMaxWindowBits = std::min(result.localMaxWindowBits, *bits);
 		} else {
-			headers.emplace(line, "");
+			throw Error("Invalid permessage-deflate parameter in response: " + key);
 		}
 	}
 
-	return headers;
+	PLOG_DEBUG << "WebSocket permessage-deflate negotiated";
+	return result;
 }
 
 WsHandshake::Error::Error(const string &w) : std::runtime_error(w) {}
@@ -23,24 +23,33 @@
 
 #if RTC_ENABLE_WEBSOCKET
 
-#include <list>
-#include <map>
+#include "http.hpp"
+#include "wsdeflate.hpp"
+
+#include "rtc/websocket.hpp"
 
 namespace rtc::impl {
 
 class WsHandshake final {
 public:
-	WsHandshake();
-	WsHandshake(string host, string path = "/", std::vector<string> protocols = {});
+	using DeflateConfiguration = rtc::WebSocket::DeflateConfiguration;
+
+	WsHandshake(optional<DeflateConfiguration> deflate = nullopt);
+	WsHandshake(string host, string path = "/", std::vector<string> protocols = {},
+	            optional<DeflateConfiguration> deflate = nullopt);
 
 	string host() const;
 	string path() const;
 	std::vector<string> protocols() const;
+	optional<WsDeflate::Parameters> deflateParameters() const; // nullopt if not negotiated
 
 	string generateHttpRequest();
 	string generateHttpResponse();
 	string generateHttpError(int responseCode = 400);
 
+	// Extended CONNECT over HTTP/2, see https://www.rfc-editor.org/rfc/rfc8441.html
+	http::HeaderList generateConnectRequest();
+
 	class Error : public std::runtime_error {
 	public:
 		explicit Error(const string &w);
@@ -57,17 +66,22 @@ public:
 
 	size_t parseHttpRequest(const byte *buffer, size_t size);
 	size_t parseHttpResponse(const byte *buffer, size_t size);
+	void parseConnectResponse(const http::HeaderList &headers);
 
 private:
 	static string generateKey();
 	static string computeAcceptKey(const string &key);
-	static size_t parseHttpLines(const byte *buffer, size_t size, std::list<string> &lines);
-	static std::multimap<string, string> parseHttpHeaders(const std::list<string> &lines);
+	string generateDeflateOffer() const;
+	string generateDeflateResponse() const;
+	optional<WsDeflate::Parameters> negotiateDeflate(const string &offers) const;
+	WsDeflate::Parameters acceptDeflate(const string &response) const;
 
 	string mHost;
 	string mPath;
 	std::vector<string> mProtocols;
 	string mKey;
+	optional<DeflateConfiguration> mDeflateConfig;
+	optional<WsDeflate::Parameters> mDeflateParams;
 	mutable std::mutex mMutex;
 };
 
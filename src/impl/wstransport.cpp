@@ -16,7 +16,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define RTC_LOG_SUBSYSTEM WebSocket
+
 #include "wstransport.hpp"
+#include "http2transport.hpp"
+#include "overloadcontroller.hpp"
 #include "tcptransport.hpp"
 #include "tlstransport.hpp"
 
@@ -24,11 +28,12 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <numeric>
-#include <random>
 #include <regex>
 #include <sstream>
+#include <utility>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -36,6 +41,14 @@
 #include <arpa/inet.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RTC_WS_MASK_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RTC_WS_MASK_NEON 1
+#endif
+
 #ifndef htonll
 #define htonll(x)                                                                                  \
 	((uint64_t)(((uint64_t)htonl((uint32_t)(x))) << 32) | (uint64_t)htonl((uint32_t)((x) >> 32)))
@@ -48,20 +61,66 @@ namespace rtc::impl {
 
 using std::to_integer;
 using std::to_string;
-using std::chrono::system_clock;
-using random_bytes_engine =
-    std::independent_bits_engine<std::default_random_engine, CHAR_BIT, unsigned short>;
+using std::chrono::milliseconds;
+
+namespace {
+
+// XOR the data with the 4-byte masking key repeated, 16 bytes at a time when SIMD is available
+// (SSE2 is baseline on x86-64 and NEON on ARM64, so no runtime dispatch is needed), then a word
+// at a time. The loop is bound by memory bandwidth, so wider AVX2 registers would not help much.
+void applyMask(byte *data, size_t size, const byte *maskingKey) {
+	byte pattern[16];
+	for (size_t k = 0; k < 16; ++k)
+		pattern[k] = maskingKey[k % 4];
+
+	size_t i = 0;
+#if RTC_WS_MASK_SSE2
+	const __m128i key128 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+	for (; i + 16 <= size; i += 16) {
+		auto p = reinterpret_cast<__m128i *>(data + i);
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key128));
+	}
+#elif RTC_WS_MASK_NEON
+	const uint8x16_t key128 = vld1q_u8(reinterpret_cast<const uint8_t *>(pattern));
+	for (; i + 16 <= size; i += 16) {
+		auto p = reinterpret_cast<uint8_t *>(data + i);
+		vst1q_u8(p, veorq_u8(vld1q_u8(p), key128));
+	}
+#endif
+
+	uint64_t key64;
+	std::memcpy(&key64, pattern, sizeof(key64));
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		word ^= key64;
+		std::memcpy(data + i, &word, sizeof(word));
+	}
+
+	for (; i < size; ++i)
+		data[i] ^= maskingKey[i % 4];
+}
+
+} // namespace
 
-WsTransport::WsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<TlsTransport>> lower,
-                         shared_ptr<WsHandshake> handshake, message_callback recvCallback,
-                         state_callback stateCallback)
+WsTransport::WsTransport(
+    variant<shared_ptr<TcpTransport>, shared_ptr<TlsTransport>, shared_ptr<Http2Stream>> lower,
+    shared_ptr<WsHandshake> handshake, optional<std::chrono::milliseconds> pingInterval,
+    message_callback recvCallback, state_callback stateCallback)
     : Transport(std::visit([](auto l) { return std::static_pointer_cast<Transport>(l); }, lower),
                 std::move(stateCallback)),
       mHandshake(std::move(handshake)),
       mIsClient(
           std::visit(rtc::overloaded{[](shared_ptr<TcpTransport> l) { return l->isActive(); },
-                                     [](shared_ptr<TlsTransport> l) { return l->isClient(); }},
-                     lower)) {
+                                     [](shared_ptr<TlsTransport> l) { return l->isClient(); },
+                                     [](shared_ptr<Http2Stream> l) { return l->isClient(); }},
+                     lower)),
+      mHttp2Stream(std::holds_alternative<shared_ptr<Http2Stream>>(lower)
+                       ? std::get<shared_ptr<Http2Stream>>(lower)
+                       : nullptr),
+      mMaxMessageSize(DEFAULT_MAX_MESSAGE_SIZE),
+      mPingInterval(std::max(pingInterval.value_or(DEFAULT_WS_PING_INTERVAL), milliseconds(0))),
+      mMaskGenerator(std::random_device{}()) {
 
 	onRecv(std::move(recvCallback));
 
@@ -76,8 +135,12 @@ void WsTransport::start() {
 	registerIncoming();
 
 	changeState(State::Connecting);
-	if (mIsClient)
+	if (mHttp2Stream) {
+		if (!sendConnectRequest())
+			changeState(State::Failed);
+	} else if (mIsClient) {
 		sendHttpRequest();
+	}
 }
 
 bool WsTransport::stop() {
@@ -92,9 +155,20 @@ bool WsTransport::send(message_ptr message) {
 	if (!message || state() != State::Connected)
 		return false;
 
-	PLOG_VERBOSE << "Send size=" << message->size();
-	return sendFrame({message->type == Message::String ? TEXT_FRAME : BINARY_FRAME, message->data(),
-	                  message->size(), true, mIsClient});
+	PLOG_VERBOSE << "Send size=" << message->payloadSize();
+
+	if (mDeflate) {
+		std::lock_guard lock(mSendMutex);
+		auto compressed = mDeflate->compress(message->payload(), message->payloadSize(),
+		                                     message->type);
+		return sendFrame({message->type == Message::String ? TEXT_FRAME : BINARY_FRAME,
+		                  compressed->data(), compressed->size(), true, mIsClient, true},
+		                 compressed);
+	}
+
+	return sendFrame({message->type == Message::String ? TEXT_FRAME : BINARY_FRAME,
+	                  message->payload(), message->payloadSize(), true, mIsClient},
+	                 message);
 }
 
 void WsTransport::incoming(message_ptr message) {
@@ -105,41 +179,51 @@ void WsTransport::incoming(message_ptr message) {
 	if (message) {
 		PLOG_VERBOSE << "Incoming size=" << message->size();
 
-		try {
-			mBuffer.insert(mBuffer.end(), message->begin(), message->end());
+		// Idle notifications from the lower layer are ignored, pings are sent by the keepalive
+		// timer instead
+		if (message->size() == 0)
+			return;
+
+		mLastReceived = ThreadPool::clock::now().time_since_epoch().count();
 
+		try {
 			if (state() == State::Connecting) {
+				mBuffer.insert(mBuffer.end(), message->begin(), message->end());
 				if (mIsClient) {
 					if (size_t len =
 					        mHandshake->parseHttpResponse(mBuffer.data(), mBuffer.size())) {
 						PLOG_INFO << "WebSocket client-side open";
+						initDeflate();
 						changeState(State::Connected);
 						mBuffer.erase(mBuffer.begin(), mBuffer.begin() + len);
 					}
 				} else {
 					if (size_t len = mHandshake->parseHttpRequest(mBuffer.data(), mBuffer.size())) {
+						// Under overload, the client should retry on another node
+						if (OverloadController::Instance().atLeast(OverloadLevel::RejectUpgrades))
+							throw WsHandshake::RequestError(
+							    "Rejecting WebSocket upgrade under overload", 503);
+
 						PLOG_INFO << "WebSocket server-side open";
+						initDeflate();
 						sendHttpResponse();
 						changeState(State::Connected);
 						mBuffer.erase(mBuffer.begin(), mBuffer.begin() + len);
 					}
 				}
-			}
 
-			if (state() == State::Connected) {
-				if (message->size() == 0) {
-					// TCP is idle, send a ping
-					PLOG_DEBUG << "WebSocket sending ping";
-					uint32_t dummy = 0;
-					sendFrame({PING, reinterpret_cast<byte *>(&dummy), 4, true, mIsClient});
+				if (state() == State::Connected) {
+					if (mPingInterval > milliseconds::zero())
+						schedulePing(mPingInterval);
 
-				} else {
-					Frame frame;
-					while (size_t len = readFrame(mBuffer.data(), mBuffer.size(), frame)) {
-						recvFrame(frame);
-						mBuffer.erase(mBuffer.begin(), mBuffer.begin() + len);
-					}
+					// Frames following the handshake in the same segment
+					binary remaining;
+					std::swap(remaining, mBuffer);
+					readFrames(remaining.data(), remaining.size());
 				}
+
+			} else if (state() == State::Connected) {
+				readFrames(message->data(), message->size());
 			}
 
 			return;
@@ -171,9 +255,54 @@ void WsTransport::incoming(message_ptr message) {
 	}
 }
 
-void WsTransport::close() {
+void WsTransport::initDeflate() {
+	if (auto params = mHandshake->deflateParameters()) {
+		PLOG_DEBUG << "WebSocket compression enabled";
+		mDeflate = std::make_unique<WsDeflate>(std::move(*params));
+	}
+}
+
+void WsTransport::schedulePing(milliseconds delay) {
+	std::lock_guard lock(mPingMutex);
+	mPingTimer.cancel();
+	mPingTimer = ThreadPool::Instance().scheduleTimer(delay, [weak_this = weak_from_this()]() {
+		if (auto locked = weak_this.lock())
+			locked->triggerPing();
+	});
+}
+
+void WsTransport::triggerPing() {
+	if (state() != State::Connected)
+		return;
+
+	// Only ping if nothing has been received for the whole interval, otherwise wait for the rest
+	using clock = ThreadPool::clock;
+	const auto lastReceived = clock::time_point(clock::duration(mLastReceived.load()));
+	const auto elapsed = clock::now() - lastReceived;
+	if (elapsed >= mPingInterval) {
+		PLOG_DEBUG << "WebSocket sending ping";
+		uint32_t dummy = 0;
+		sendFrame({PING, reinterpret_cast<byte *>(&dummy), 4, true, mIsClient});
+		schedulePing(mPingInterval);
+	} else {
+		schedulePing(std::chrono::ceil<milliseconds>(mPingInterval - elapsed));
+	}
+}
+
+void WsTransport::close(optional<uint16_t> code) {
+	{
+		std::lock_guard lock(mPingMutex);
+		mPingTimer.cancel();
+	}
+
 	if (state() == State::Connected) {
-		sendFrame({CLOSE, NULL, 0, true, mIsClient});
+		std::array<byte, 2> payload;
+		if (code) {
+			payload[0] = byte(*code >> 8);
+			payload[1] = byte(*code & 0xFF);
+		}
+		sendFrame({CLOSE, code ? payload.data() : nullptr, code ? payload.size() : 0, true,
+		           mIsClient});
 		PLOG_INFO << "WebSocket closing";
 		changeState(State::Disconnected);
 	}
@@ -187,6 +316,36 @@ bool WsTransport::sendHttpRequest() {
 	return outgoing(make_message(data, data + request.size()));
 }
 
+bool WsTransport::sendConnectRequest() {
+	PLOG_DEBUG << "Sending WebSocket HTTP/2 request";
+
+	// The response is received as stream headers instead of data
+	return mHttp2Stream->request(mHandshake->generateConnectRequest(),
+	                             [weak_this = weak_from_this()](const http::HeaderList &headers) {
+		                             if (auto shared_this = weak_this.lock())
+			                             shared_this->processConnectResponse(headers);
+	                             });
+}
+
+void WsTransport::processConnectResponse(const http::HeaderList &headers) {
+	if (state() != State::Connecting)
+		return;
+
+	try {
+		mHandshake->parseConnectResponse(headers);
+		PLOG_INFO << "WebSocket client-side open over HTTP/2";
+		initDeflate();
+		changeState(State::Connected);
+		if (mPingInterval > milliseconds::zero())
+			schedulePing(mPingInterval);
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << e.what();
+		PLOG_ERROR << "WebSocket handshake failed";
+		changeState(State::Failed);
+	}
+}
+
 bool WsTransport::sendHttpResponse() {
 	PLOG_DEBUG << "Sending WebSocket HTTP response";
 
@@ -225,94 +384,216 @@ bool WsTransport::sendHttpError(int code) {
 // |                     Payload Data continued ...                |
 // +---------------------------------------------------------------+
 
-size_t WsTransport::readFrame(byte *buffer, size_t size, Frame &frame) {
-	const byte *end = buffer + size;
-	if (end - buffer < 2)
-		return 0;
+void WsTransport::readFrames(const byte *data, size_t size) {
+	const byte *end = data + size;
+	while (state() == State::Connected) {
+		if (!mHeaderDone) {
+			data += readFrameHeader(data, size_t(end - data));
+			if (!mHeaderDone)
+				break; // wait for the rest of the header
 
-	byte *cur = buffer;
-	auto b1 = to_integer<uint8_t>(*cur++);
-	auto b2 = to_integer<uint8_t>(*cur++);
+			beginFrame();
+		}
 
-	frame.fin = (b1 & 0x80) != 0;
-	frame.mask = (b2 & 0x80) != 0;
-	frame.opcode = static_cast<Opcode>(b1 & 0x0F);
-	frame.length = b2 & 0x7F;
+		data += readFramePayload(data, size_t(end - data));
+		if (mPayloadPosition < mFrame.length)
+			break; // wait for the rest of the payload
 
-	if (frame.length == 0x7E) {
-		if (end - cur < 2)
-			return 0;
-		frame.length = ntohs(*reinterpret_cast<const uint16_t *>(cur));
-		cur += 2;
-	} else if (frame.length == 0x7F) {
-		if (end - cur < 8)
-			return 0;
-		frame.length = ntohll(*reinterpret_cast<const uint64_t *>(cur));
-		cur += 8;
+		mHeaderDone = false;
+		recvFrame(mFrame);
 	}
+}
 
-	const byte *maskingKey = nullptr;
-	if (frame.mask) {
-		if (end - cur < 4)
-			return 0;
-		maskingKey = cur;
-		cur += 4;
+size_t WsTransport::readFrameHeader(const byte *data, size_t size) {
+	size_t consumed = 0;
+	auto fill = [&](size_t target) {
+		size_t len = std::min(target - mHeaderSize, size - consumed);
+		std::memcpy(mHeader.data() + mHeaderSize, data + consumed, len);
+		mHeaderSize += len;
+		consumed += len;
+		return mHeaderSize == target;
+	};
+
+	if (!fill(2))
+		return consumed;
+
+	auto b1 = to_integer<uint8_t>(mHeader[0]);
+	auto b2 = to_integer<uint8_t>(mHeader[1]);
+	const size_t lengthSize = (b2 & 0x7F) == 0x7E ? 2 : (b2 & 0x7F) == 0x7F ? 8 : 0;
+	const size_t maskSize = (b2 & 0x80) ? 4 : 0;
+	if (!fill(2 + lengthSize + maskSize))
+		return consumed;
+
+	const byte *cur = mHeader.data() + 2;
+	mFrame.fin = (b1 & 0x80) != 0;
+	mFrame.rsv1 = (b1 & 0x40) != 0;
+	mFrame.mask = (b2 & 0x80) != 0;
+	mFrame.opcode = static_cast<Opcode>(b1 & 0x0F);
+	mFrame.payload = nullptr;
+	mFrame.length = b2 & 0x7F;
+
+	if (lengthSize == 2) {
+		uint16_t length;
+		std::memcpy(&length, cur, 2);
+		mFrame.length = ntohs(length);
+	} else if (lengthSize == 8) {
+		uint64_t length;
+		std::memcpy(&length, cur, 8);
+		mFrame.length = size_t(ntohll(length));
 	}
+	cur += lengthSize;
+
+	if (mFrame.mask)
+		std::memcpy(mMaskingKey.data(), cur, 4);
 
-	if (size_t(end - cur) < frame.length)
+	mHeaderSize = 0;
+	mHeaderDone = true;
+	mPayloadPosition = 0;
+	return consumed;
+}
+
+size_t WsTransport::readFramePayload(const byte *data, size_t size) {
+	size_t len = std::min(mFrame.length - mPayloadPosition, size);
+	if (len == 0)
 		return 0;
 
-	frame.payload = cur;
-	if (maskingKey)
-		for (size_t i = 0; i < frame.length; ++i)
-			frame.payload[i] ^= maskingKey[i % 4];
-	cur += frame.length;
+	const bool streamed = !(mFrame.opcode & 0x08) && mPartialStreamed;
+	message_ptr fragment = streamed ? make_message(size_t(0), Message::Binary) : nullptr;
+	auto &dest = mFrame.opcode & 0x08 ? mControl : streamed ? fragment : mPartial;
+	const size_t offset = dest->size();
+	dest->insert(dest->end(), data, data + len);
+	if (mFrame.mask) {
+		// Rotate the key so it lines up with the current position in the payload
+		byte key[4];
+		for (size_t k = 0; k < 4; ++k)
+			key[k] = mMaskingKey[(mPayloadPosition + k) % 4];
+
+		applyMask(dest->data() + offset, len, key);
+	}
+
+	mPayloadPosition += len;
 
-	return size_t(cur - buffer);
+	if (streamed)
+		mFragmentCallback(std::move(fragment), mFrame.fin && mPayloadPosition == mFrame.length);
+
+	return len;
 }
 
-void WsTransport::recvFrame(const Frame &frame) {
-	PLOG_DEBUG << "WebSocket received frame: opcode=" << int(frame.opcode)
-	           << ", length=" << frame.length;
+void WsTransport::beginFrame() {
+	// Space is reserved up front for the payload, up to a limit as the length is not trusted
+	const size_t maxReserved = 16 * 1024 * 1024;
+	const size_t reserved = std::min(mFrame.length, maxReserved);
 
-	switch (frame.opcode) {
+	// RSV1 is only allowed on the first frame of a message with permessage-deflate
+	const bool first = mFrame.opcode == TEXT_FRAME || mFrame.opcode == BINARY_FRAME;
+	if (mFrame.rsv1 && (!mDeflate || !first)) {
+		close();
+		throw std::invalid_argument("Unexpected RSV1 bit in WebSocket frame");
+	}
+
+	// Limits are checked on the header, before anything is buffered
+	if (mFrame.length > mMaxFrameSize) {
+		close(CloseMessageTooBig);
+		throw std::length_error("WebSocket frame size exceeds limit");
+	}
+
+	if (!(mFrame.opcode & 0x08)) {
+		// Streamed messages are not buffered, so only their frames are limited
+		const bool streamed = first ? mFrame.opcode == BINARY_FRAME && !mFrame.rsv1 &&
+		                                  bool(mFragmentCallback)
+		                            : mPartialStreamed;
+		const size_t buffered = !first && mPartial ? mPartial->size() : 0;
+		if (!streamed && mFrame.length > mMaxMessageSize - buffered) {
+			close(CloseMessageTooBig);
+			throw std::length_error("WebSocket message size exceeds limit");
+		}
+	}
+
+	switch (mFrame.opcode) {
 	case TEXT_FRAME:
 	case BINARY_FRAME: {
-		if (!mPartial.empty()) {
+		if (mPartial) {
 			PLOG_WARNING << "WebSocket unfinished message: type="
 			             << (mPartialOpcode == TEXT_FRAME ? "text" : "binary")
-			             << ", length=" << mPartial.size();
-			auto type = mPartialOpcode == TEXT_FRAME ? Message::String : Message::Binary;
-			recv(make_message(mPartial.begin(), mPartial.end(), type));
-			mPartial.clear();
+			             << ", length=" << mPartial->size();
+			if (mPartialStreamed)
+				mFragmentCallback(make_message(size_t(0), Message::Binary), true);
+			else if (mPartialCompressed)
+				mPartial.reset(); // can't be decompressed
+			else
+				recv(std::exchange(mPartial, nullptr));
 		}
-		mPartialOpcode = frame.opcode;
-		if (frame.fin) {
-			PLOG_DEBUG << "WebSocket finished message: type="
-			           << (frame.opcode == TEXT_FRAME ? "text" : "binary")
-			           << ", length=" << frame.length;
-			auto type = frame.opcode == TEXT_FRAME ? Message::String : Message::Binary;
-			recv(make_message(frame.payload, frame.payload + frame.length, type));
-		} else {
-			mPartial.insert(mPartial.end(), frame.payload, frame.payload + frame.length);
+		mPartialOpcode = mFrame.opcode;
+		mPartialCompressed = mFrame.rsv1;
+		mPartialStreamed = mFrame.opcode == BINARY_FRAME && !mFrame.rsv1 && bool(mFragmentCallback);
+		auto type = mFrame.opcode == TEXT_FRAME ? Message::String : Message::Binary;
+		mPartial = make_message(size_t(0), type);
+		if (!mPartialStreamed)
+			mPartial->reserve(reserved);
+		break;
+	}
+	case CONTINUATION: {
+		if (!mPartial) {
+			auto type = mPartialOpcode == TEXT_FRAME ? Message::String : Message::Binary;
+			mPartial = make_message(size_t(0), type);
 		}
+		if (!mPartialStreamed)
+			mPartial->reserve(mPartial->size() + reserved);
 		break;
 	}
+	case PING:
+	case PONG:
+	case CLOSE: {
+		mControl = make_message(size_t(0));
+		mControl->reserve(reserved);
+		break;
+	}
+	default: {
+		close();
+		throw std::invalid_argument("Unknown WebSocket opcode: " + to_string(mFrame.opcode));
+	}
+	}
+}
+
+void WsTransport::recvFrame(const Frame &frame) {
+	PLOG_VERBOSE << "WebSocket received frame: opcode=" << int(frame.opcode)
+	             << ", length=" << frame.length;
+
+	switch (frame.opcode) {
+	case TEXT_FRAME:
+	case BINARY_FRAME:
 	case CONTINUATION: {
-		mPartial.insert(mPartial.end(), frame.payload, frame.payload + frame.length);
+		// The payload has already been appended to mPartial, or passed as fragments
 		if (frame.fin) {
-			PLOG_DEBUG << "WebSocket finished message: type="
-			           << (frame.opcode == TEXT_FRAME ? "text" : "binary")
-			           << ", length=" << mPartial.size();
-			auto type = mPartialOpcode == TEXT_FRAME ? Message::String : Message::Binary;
-			recv(make_message(mPartial.begin(), mPartial.end(), type));
-			mPartial.clear();
+			auto message = std::exchange(mPartial, nullptr);
+			if (mPartialStreamed) {
+				// The last fragment has been passed already unless the frame is empty
+				if (frame.length == 0)
+					mFragmentCallback(make_message(size_t(0), Message::Binary), true);
+
+				mPartialStreamed = false;
+				break;
+			}
+
+			PLOG_VERBOSE << "WebSocket finished message: type="
+			             << (mPartialOpcode == TEXT_FRAME ? "text" : "binary")
+			             << ", length=" << message->size();
+			if (mPartialCompressed) {
+				try {
+					message = mDeflate->decompress(std::move(message), mMaxMessageSize);
+				} catch (const std::length_error &) {
+					close(CloseMessageTooBig);
+					throw;
+				}
+			}
+
+			recv(std::move(message));
 		}
 		break;
 	}
 	case PING: {
 		PLOG_DEBUG << "WebSocket received ping, sending pong";
-		sendFrame({PONG, frame.payload, frame.length, true, mIsClient});
+		sendFrame({PONG, mControl->data(), mControl->size(), true, mIsClient});
 		break;
 	}
 	case PONG: {
@@ -332,14 +613,32 @@ void WsTransport::recvFrame(const Frame &frame) {
 	}
 }
 
-bool WsTransport::sendFrame(const Frame &frame) {
-	PLOG_DEBUG << "WebSocket sending frame: opcode=" << int(frame.opcode)
-	           << ", length=" << frame.length;
+message_ptr WsTransport::BuildFrame(const message_ptr &message) {
+	Frame frame{message->type == Message::String ? TEXT_FRAME : BINARY_FRAME, message->payload(),
+	            message->payloadSize(), true, false};
 
-	byte buffer[14];
-	byte *cur = buffer;
+	byte header[14];
+	size_t headerSize = WriteFrameHeader(frame, header);
+	auto result = make_message(headerSize + frame.length);
+	std::memcpy(result->data(), header, headerSize);
+	if (frame.length > 0)
+		std::memcpy(result->data() + headerSize, frame.payload, frame.length);
 
-	*cur++ = byte((frame.opcode & 0x0F) | (frame.fin ? 0x80 : 0));
+	return result;
+}
+
+bool WsTransport::sendBuiltFrame(message_ptr frame) {
+	if (!frame || state() != State::Connected || !canSendFrame())
+		return false;
+
+	PLOG_VERBOSE << "WebSocket sending built frame, size=" << frame->size();
+	return outgoing(std::move(frame));
+}
+
+size_t WsTransport::WriteFrameHeader(const Frame &frame, byte *header) {
+	byte *cur = header;
+
+	*cur++ = byte((frame.opcode & 0x0F) | (frame.fin ? 0x80 : 0) | (frame.rsv1 ? 0x40 : 0));
 
 	if (frame.length < 0x7E) {
 		*cur++ = byte((frame.length & 0x7F) | (frame.mask ? 0x80 : 0));
@@ -353,22 +652,46 @@ bool WsTransport::sendFrame(const Frame &frame) {
 		cur += 8;
 	}
 
-	if (frame.mask) {
-		auto seed = static_cast<unsigned int>(system_clock::now().time_since_epoch().count());
-		random_bytes_engine generator(seed);
+	return size_t(cur - header); // the masking key is not included
+}
+
+bool WsTransport::sendFrame(const Frame &frame, message_ptr owner) {
+	PLOG_VERBOSE << "WebSocket sending frame: opcode=" << int(frame.opcode)
+	             << ", length=" << frame.length;
+
+	byte header[14];
+	byte *cur = header + WriteFrameHeader(frame, header);
 
-		byte *maskingKey = reinterpret_cast<byte *>(cur);
+	if (frame.mask) {
+		uint32_t key;
+		{
+			std::lock_guard lock(mMaskMutex);
+			key = uint32_t(mMaskGenerator());
+		}
 
-		auto u = reinterpret_cast<uint8_t *>(maskingKey);
-		std::generate(u, u + 4, [&]() { return uint8_t(generator()); });
+		std::memcpy(cur, &key, 4);
 		cur += 4;
 
-		for (size_t i = 0; i < frame.length; ++i)
-			frame.payload[i] ^= maskingKey[i % 4];
+		// The payload is masked while copied after the header, so the frame is sent as a single
+		// message and the source buffer is left untouched
+		const size_t headerSize = size_t(cur - header);
+		auto message = make_message(size_t(0));
+		message->reserve(headerSize + frame.length);
+		message->assign(header, cur);
+		message->insert(message->end(), frame.payload, frame.payload + frame.length);
+		applyMask(message->data() + headerSize, frame.length, cur - 4);
+		return outgoing(std::move(message));
 	}
 
-	outgoing(make_message(buffer, cur));                                        // header
-	return outgoing(make_message(frame.payload, frame.payload + frame.length)); // payload
+	auto headerMessage = make_message(header, cur);
+	if (frame.length == 0)
+		return outgoing(std::move(headerMessage));
+
+	// The unmasked payload is referenced if possible, the lower transport sends it along with the
+	// header in one vectored write or TLS record
+	auto payloadMessage = owner ? make_message(frame.payload, frame.length, std::move(owner))
+	                            : make_message(frame.payload, frame.payload + frame.length);
+	return outgoingBatch({std::move(headerMessage), std::move(payloadMessage)}) == 2;
 }
 
 } // namespace rtc::impl
@@ -20,31 +20,64 @@
 #define RTC_IMPL_WS_TRANSPORT_H
 
 #include "common.hpp"
+#include "threadpool.hpp"
 #include "transport.hpp"
+#include "wsdeflate.hpp"
 #include "wshandshake.hpp"
 
 #if RTC_ENABLE_WEBSOCKET
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <random>
+
 namespace rtc::impl {
 
 class TcpTransport;
 class TlsTransport;
+class Http2Stream;
 
-class WsTransport final : public Transport {
+class WsTransport final : public Transport, public std::enable_shared_from_this<WsTransport> {
 public:
-	WsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<TlsTransport>> lower,
-	            shared_ptr<WsHandshake> handshake, message_callback recvCallback,
-	            state_callback stateCallback);
+	WsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<TlsTransport>,
+	                    shared_ptr<Http2Stream>>
+	                lower,
+	            shared_ptr<WsHandshake> handshake, optional<std::chrono::milliseconds> pingInterval,
+	            message_callback recvCallback, state_callback stateCallback);
 	~WsTransport();
 
 	void start() override;
 	bool stop() override;
 	bool send(message_ptr message) override;
 	void incoming(message_ptr message) override;
-	void close();
+	// Status codes sent in the close frame (RFC 6455 7.4.1), none if unset
+	static const uint16_t ClosePolicyViolation = 1008;
+	static const uint16_t CloseMessageTooBig = 1009;
+	void close(optional<uint16_t> code = nullopt);
 
 	bool isClient() const { return mIsClient; }
 
+	// Limits for received frames and reassembled messages, exceeding them closes the connection
+	// with CloseMessageTooBig. Messages are limited to DEFAULT_MAX_MESSAGE_SIZE by default, after
+	// decompression.
+	void setMaxFrameSize(size_t size) { mMaxFrameSize = size; }     // before start()
+	void setMaxMessageSize(size_t size) { mMaxMessageSize = size; } // before start()
+
+	// If set, uncompressed binary messages are not reassembled, their payload is passed to the
+	// callback as it is received, along with a flag set on the last fragment of the message
+	using fragment_callback = std::function<void(message_ptr fragment, bool last)>;
+	void onFragment(fragment_callback callback) { mFragmentCallback = std::move(callback); }
+
+	// Server frames are unmasked, so without compression the same frame can be sent to many
+	// clients: it is built once by BuildFrame() and shared by the send queues of the clients.
+	static message_ptr BuildFrame(const message_ptr &message); // server-side frame
+	bool canSendFrame() const { return !mIsClient && !mDeflate; }
+	bool sendBuiltFrame(message_ptr frame); // only if canSendFrame(), frame must not be modified
+
 private:
 	enum Opcode : uint8_t {
 		CONTINUATION = 0,
@@ -57,26 +90,66 @@ private:
 
 	struct Frame {
 		Opcode opcode = BINARY_FRAME;
-		byte *payload = nullptr;
+		const byte *payload = nullptr;
 		size_t length = 0;
 		bool fin = true;
 		bool mask = true;
+		bool rsv1 = false; // set on the first frame of compressed messages
 	};
 
+	void initDeflate();
+	void schedulePing(std::chrono::milliseconds delay);
+	void triggerPing();
 	bool sendHttpRequest();
+	bool sendConnectRequest(); // over HTTP/2
+	void processConnectResponse(const http::HeaderList &headers);
 	bool sendHttpError(int code);
 	bool sendHttpResponse();
 
-	size_t readFrame(byte *buffer, size_t size, Frame &frame);
+	// Frames are parsed incrementally, each incoming byte is consumed once
+	void readFrames(const byte *data, size_t size);
+	size_t readFrameHeader(const byte *data, size_t size); // returns the number of bytes consumed
+	size_t readFramePayload(const byte *data, size_t size);
+	void beginFrame();
 	void recvFrame(const Frame &frame);
-	bool sendFrame(const Frame &frame);
+	bool sendFrame(const Frame &frame, message_ptr owner = nullptr); // owner of the payload
+	static size_t WriteFrameHeader(const Frame &frame, byte *header); // header must be 14 bytes
 
 	const shared_ptr<WsHandshake> mHandshake;
 	const bool mIsClient;
-
-	binary mBuffer;
-	binary mPartial;
-	Opcode mPartialOpcode;
+	const shared_ptr<Http2Stream> mHttp2Stream; // if the lower layer is an HTTP/2 stream
+
+	binary mBuffer; // HTTP handshake only
+
+	// Current frame
+	std::array<byte, 14> mHeader;
+	size_t mHeaderSize = 0;
+	bool mHeaderDone = false;
+	Frame mFrame;
+	std::array<byte, 4> mMaskingKey;
+	size_t mPayloadPosition = 0;
+	message_ptr mControl; // payload of the current control frame
+
+	message_ptr mPartial; // message being reassembled, payloads are unmasked directly into it
+	Opcode mPartialOpcode = BINARY_FRAME;
+	bool mPartialCompressed = false;
+	bool mPartialStreamed = false; // passed to mFragmentCallback instead of reassembled
+
+	size_t mMaxFrameSize = std::numeric_limits<size_t>::max();
+	size_t mMaxMessageSize;
+	fragment_callback mFragmentCallback;
+
+	// Keepalive, a ping is sent when nothing has been received for the interval
+	const std::chrono::milliseconds mPingInterval;
+	std::atomic<ThreadPool::clock::rep> mLastReceived = 0;
+	TimerHandle mPingTimer;
+	std::mutex mPingMutex;
+
+	unique_ptr<WsDeflate> mDeflate; // set once permessage-deflate is negotiated
+	std::mutex mSendMutex;          // compressed messages must be sent in compression order
+
+	std::mt19937 mMaskGenerator; // seeded once, for masking keys
+	std::mutex mMaskMutex;
 };
 
 } // namespace rtc::impl
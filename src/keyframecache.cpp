@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "keyframecache.hpp"
+#include "h264rtpdepacketizer.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+const size_t MaxKeyframePackets = 1024; // larger keyframes are not cached
+
+} // namespace
+
+KeyframeCache::KeyframeCache(keyframe_detector _isKeyframe)
+    : MediaHandlerElement(),
+      isKeyframe(_isKeyframe ? std::move(_isKeyframe) : H264RtpDepacketizer::IsKeyframe) {}
+
+std::vector<binary> KeyframeCache::keyframe(SSRC ssrc) const {
+	std::vector<binary> packets;
+	uint16_t seq;
+	{
+		std::lock_guard lock(mutex);
+		auto it = streams.find(ssrc);
+		if (it == streams.end() || it->second.cached.empty())
+			return packets;
+
+		packets = it->second.cached;
+		seq = uint16_t(*it->second.lastSeq - packets.size() + 1);
+	}
+
+	for (auto &packet : packets)
+		reinterpret_cast<RtpHeader *>(packet.data())->setSeqNumber(seq++);
+
+	return packets;
+}
+
+void KeyframeCache::clear() {
+	std::lock_guard lock(mutex);
+	streams.clear();
+}
+
+ChainedIncomingProduct
+KeyframeCache::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::lock_guard lock(mutex);
+	for (const auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize)
+			continue;
+
+		auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+		record(streams[rtp->ssrc()], *message);
+	}
+
+	return {messages};
+}
+
+void KeyframeCache::record(Stream &stream, const binary &packet) {
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet.data());
+	const uint16_t seq = rtp->seqNumber();
+	if (!stream.lastSeq || int16_t(seq - *stream.lastSeq) > 0)
+		stream.lastSeq = seq;
+
+	if (stream.timestamp != rtp->timestamp()) {
+		// A new frame starts, so a keyframe still being received lost its last packet
+		stream.receiving.clear();
+		stream.timestamp.reset();
+
+		if (!isKeyframe(packet))
+			return;
+
+		stream.timestamp = rtp->timestamp();
+	}
+
+	if (stream.receiving.size() >= MaxKeyframePackets) {
+		stream.receiving.clear();
+		stream.timestamp.reset();
+		return;
+	}
+
+	stream.receiving.push_back(packet);
+
+	if (rtp->marker()) {
+		if (IsComplete(stream.receiving))
+			stream.cached = std::move(stream.receiving);
+
+		stream.receiving.clear();
+		stream.timestamp.reset();
+	}
+}
+
+bool KeyframeCache::IsComplete(std::vector<binary> &packets) {
+	auto seqOf = [](const binary &packet) {
+		return reinterpret_cast<const RtpHeader *>(packet.data())->seqNumber();
+	};
+
+	// Packets might have been reordered
+	const uint16_t first = seqOf(packets.front());
+	std::sort(packets.begin(), packets.end(), [&](const binary &a, const binary &b) {
+		return int16_t(seqOf(a) - first) < int16_t(seqOf(b) - first);
+	});
+
+	for (size_t i = 1; i < packets.size(); ++i)
+		if (seqOf(packets[i]) != uint16_t(seqOf(packets[i - 1]) + 1))
+			return false;
+
+	return true;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
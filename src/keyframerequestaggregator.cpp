@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "keyframerequestaggregator.hpp"
+#include "h264rtpdepacketizer.hpp"
+
+#include "impl/internals.hpp"
+
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+// Returns the SSRC targeted by a PLI or FIR
+optional<SSRC> KeyframeRequestTarget(const RtcpHeader *header, size_t size) {
+	if (header->payloadType() != 206)
+		return nullopt;
+
+	auto fb = reinterpret_cast<const RtcpFbHeader *>(header);
+	if (header->reportCount() == 1 && size >= sizeof(RtcpFbHeader)) // PLI
+		return fb->mediaSourceSSRC();
+
+	if (header->reportCount() == 4 && size >= sizeof(RtcpFbHeader) + sizeof(RtcpFirPart)) { // FIR
+		// The media source SSRC is unused, the target is in the FCI
+		auto fir = reinterpret_cast<const RtcpFir *>(header);
+		return ntohl(fir->parts[0].ssrc);
+	}
+
+	return nullopt;
+}
+
+} // namespace
+
+KeyframeRequestAggregator::KeyframeRequestAggregator(std::chrono::milliseconds _window,
+                                                     keyframe_detector _isKeyframe)
+    : MediaHandlerElement(), window(_window),
+      isKeyframe(_isKeyframe ? std::move(_isKeyframe) : H264RtpDepacketizer::IsKeyframe) {}
+
+bool KeyframeRequestAggregator::request(SSRC ssrc) {
+	std::lock_guard lock(mutex);
+	return add(ssrc, clock::now());
+}
+
+void KeyframeRequestAggregator::onKeyframe(std::function<void(SSRC, size_t)> callback) {
+	keyframeCallback = callback;
+}
+
+message_ptr KeyframeRequestAggregator::processOutgoingControlMessage(message_ptr message) {
+	const auto now = clock::now();
+	std::lock_guard lock(mutex);
+
+	// Compact the compound packet in place, removing coalesced requests
+	size_t offset = 0;
+	size_t kept = 0;
+	while (offset + sizeof(RtcpHeader) <= message->size()) {
+		auto header = reinterpret_cast<const RtcpHeader *>(message->data() + offset);
+		const size_t size = header->lengthInBytes();
+		if (size > message->size() - offset)
+			break;
+
+		auto target = KeyframeRequestTarget(header, size);
+		if (!target || add(*target, now)) {
+			if (kept != offset)
+				std::memmove(message->data() + kept, message->data() + offset, size);
+
+			kept += size;
+		}
+
+		offset += size;
+	}
+
+	if (kept != offset)
+		message->resize(kept);
+
+	return message;
+}
+
+ChainedIncomingProduct
+KeyframeRequestAggregator::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::vector<std::pair<SSRC, size_t>> answered;
+	{
+		std::lock_guard lock(mutex);
+		for (const auto &message : *messages) {
+			if (pending.empty())
+				break;
+
+			if (message->size() < RtpHeaderMinSize)
+				continue;
+
+			auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+			auto it = pending.find(rtp->ssrc());
+			if (it == pending.end() || !isKeyframe(*message))
+				continue;
+
+			answered.emplace_back(it->first, it->second.requests);
+			pending.erase(it);
+		}
+	}
+
+	for (const auto &[ssrc, requests] : answered)
+		keyframeCallback(ssrc, requests);
+
+	return {messages};
+}
+
+bool KeyframeRequestAggregator::add(SSRC ssrc, clock::time_point now) {
+	auto [it, inserted] = pending.emplace(ssrc, Pending{now, 0});
+	auto &entry = it->second;
+	++entry.requests;
+	// If no keyframe was received in the window, the request might have been lost
+	if (inserted || now - entry.sent >= window) {
+		entry.sent = now;
+		return true;
+	}
+
+	LOG_VERBOSE << "Coalescing keyframe request for SSRC " << ssrc << " (" << entry.requests
+	            << " waiting)";
+	return false;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
@@ -27,86 +27,32 @@
 namespace rtc {
 
 MediaChainableHandler::MediaChainableHandler(shared_ptr<MediaHandlerRootElement> root)
-    : MediaHandler(), root(root), leaf(root) {}
+    : MediaPipelineBase(), root(root), leaf(root),
+      sendProductCallback([this](ChainedOutgoingProduct product) { return sendProduct(product); }) {
+}
 
 MediaChainableHandler::~MediaChainableHandler() { leaf->recursiveRemoveChain(); }
 
-bool MediaChainableHandler::sendProduct(ChainedOutgoingProduct product) {
-	bool result = true;
-	if (product.control) {
-		assert(product.control->type == Message::Control);
-		auto sendResult = send(product.control);
-		if (!sendResult) {
-			LOG_DEBUG << "Failed to send control message";
-		}
-		result = result && sendResult;
-	}
-	if (product.messages) {
-		auto messages = product.messages;
-		for (unsigned i = 0; i < messages->size(); i++) {
-			auto message = messages->at(i);
-			if (!message) {
-				LOG_DEBUG << "Invalid message to send " << i + 1 << "/" << messages->size();
-			}
-			auto sendResult = send(make_message(*message));
-			if (!sendResult) {
-				LOG_DEBUG << "Failed to send message " << i + 1 << "/" << messages->size();
-			}
-			result = result && sendResult;
-		}
-	}
-	return result;
-}
-
 message_ptr MediaChainableHandler::handleIncomingBinary(message_ptr msg) {
 	assert(msg->type == Message::Binary);
-	auto messages = root->split(msg);
-	auto incoming = getLeaf()->formIncomingBinaryMessage(
-	    messages, [this](ChainedOutgoingProduct outgoing) { return sendProduct(outgoing); });
-	if (incoming) {
-		return root->reduce(incoming);
-	} else {
-		return nullptr;
-	}
+	auto messages = root->split(std::move(msg));
+	auto incoming = getLeaf()->formIncomingBinaryMessage(std::move(messages), sendProductCallback);
+	return deliverIncomingProduct(*root, std::move(incoming));
 }
 
 message_ptr MediaChainableHandler::handleIncomingControl(message_ptr msg) {
 	assert(msg->type == Message::Control);
-	auto incoming = getLeaf()->formIncomingControlMessage(
-	    msg, [this](ChainedOutgoingProduct outgoing) { return sendProduct(outgoing); });
+	auto incoming = getLeaf()->formIncomingControlMessage(std::move(msg), sendProductCallback);
 	assert(!incoming || incoming->type == Message::Control);
 	return incoming;
 }
 
-message_ptr MediaChainableHandler::handleOutgoingBinary(message_ptr msg) {
+message_ptr MediaChainableHandler::handleOutgoingBinary(message_ptr msg,
+                                                        std::vector<message_ptr> *collected) {
 	assert(msg->type == Message::Binary);
-	auto messages = make_chained_messages_product(msg);
-	auto optOutgoing = root->formOutgoingBinaryMessage(ChainedOutgoingProduct(messages));
-	if (!optOutgoing.has_value()) {
-		LOG_ERROR << "Generating outgoing message failed";
-		return nullptr;
-	}
-	auto outgoing = optOutgoing.value();
-	if (outgoing.control) {
-		if (!send(outgoing.control)) {
-			LOG_DEBUG << "Failed to send control message";
-		}
-	}
-	auto lastMessage = outgoing.messages->back();
-	if (!lastMessage) {
-		LOG_DEBUG << "Invalid message to send";
-		return nullptr;
-	}
-	for (unsigned i = 0; i < outgoing.messages->size() - 1; i++) {
-		auto message = outgoing.messages->at(i);
-		if (!message) {
-			LOG_DEBUG << "Invalid message to send " << i + 1 << "/" << outgoing.messages->size();
-		}
-		if (!send(make_message(*message))) {
-			LOG_DEBUG << "Failed to send message " << i + 1 << "/" << outgoing.messages->size();
-		}
-	}
-	return make_message(*lastMessage);
+	auto batch = make_chained_messages_product(std::move(msg));
+	auto outgoing = root->formOutgoingBinaryMessage(ChainedOutgoingProduct(batch));
+	return sendOutgoingProduct(std::move(outgoing), std::move(batch), collected);
 }
 
 message_ptr MediaChainableHandler::handleOutgoingControl(message_ptr msg) {
@@ -117,6 +63,9 @@ message_ptr MediaChainableHandler::handleOutgoingControl(message_ptr msg) {
 		LOG_ERROR << "Generating outgoing control message failed";
 		return nullptr;
 	}
+	if (outgoing->empty())
+		return nullptr; // dropped by an element
+
 	return outgoing;
 }
 
@@ -134,6 +83,13 @@ message_ptr MediaChainableHandler::outgoing(message_ptr ptr) {
 	return ptr;
 }
 
+void MediaChainableHandler::outgoingBatch(message_ptr ptr, std::vector<message_ptr> &batch) {
+	if (ptr && ptr->type == Message::Binary)
+		handleOutgoingBinary(std::move(ptr), &batch);
+	else if (auto message = outgoing(std::move(ptr)))
+		batch.push_back(std::move(message));
+}
+
 message_ptr MediaChainableHandler::incoming(message_ptr ptr) {
 	if (!ptr) {
 		LOG_ERROR << "Incoming message is nullptr, ignoring";
@@ -147,16 +103,12 @@ message_ptr MediaChainableHandler::incoming(message_ptr ptr) {
 	return ptr;
 }
 
-bool MediaChainableHandler::send(message_ptr msg) {
-	try {
-		outgoingCallback(std::move(msg));
-		return true;
-	} catch (const std::exception &e) {
-		LOG_DEBUG << "Send in RTCP chain handler failed: " << e.what();
-	}
-	return false;
+void MediaChainableHandler::sent(const message_ptr &message) {
+	getLeaf()->chainSentBinaryMessage(message);
 }
 
+size_t MediaChainableHandler::memoryUsage() const { return getLeaf()->chainMemoryUsage(); }
+
 shared_ptr<MediaHandlerElement> MediaChainableHandler::getLeaf() const {
 	std::lock_guard lock(mutex);
 	return leaf;
@@ -166,6 +118,8 @@ void MediaChainableHandler::addToChain(shared_ptr<MediaHandlerElement> chainable
 	std::lock_guard lock(mutex);
 	assert(leaf);
 	leaf = leaf->chainWith(chainable);
+	// The callback is reset when the chain is removed on destruction
+	chainable->onTargetBitrate([this](unsigned int bitrate) { targetBitrateCallback(bitrate); });
 }
 
 } // namespace rtc
@@ -26,13 +26,35 @@
 
 namespace rtc {
 
+namespace {
+
+// Batches are recycled per thread, so processing a steady flow of messages does not allocate
+const size_t MaxSpareProducts = 8;
+thread_local std::vector<ChainedMessagesProduct> SpareProducts;
+
+} // namespace
+
 ChainedMessagesProduct make_chained_messages_product() {
-	return std::make_shared<std::vector<binary_ptr>>();
+	if (SpareProducts.empty())
+		return std::make_shared<std::vector<binary_ptr>>();
+
+	auto messages = std::move(SpareProducts.back());
+	SpareProducts.pop_back();
+	return messages;
 }
 
 ChainedMessagesProduct make_chained_messages_product(message_ptr msg) {
-	std::vector<binary_ptr> msgs = {msg};
-	return std::make_shared<std::vector<binary_ptr>>(msgs);
+	auto messages = make_chained_messages_product();
+	messages->push_back(std::move(msg));
+	return messages;
+}
+
+void recycle_chained_messages_product(ChainedMessagesProduct messages) {
+	if (!messages || messages.use_count() > 1 || SpareProducts.size() >= MaxSpareProducts)
+		return;
+
+	messages->clear(); // the capacity is kept
+	SpareProducts.push_back(std::move(messages));
 }
 
 ChainedOutgoingProduct::ChainedOutgoingProduct(ChainedMessagesProduct messages, message_ptr control)
@@ -42,6 +64,10 @@ ChainedIncomingProduct::ChainedIncomingProduct(ChainedMessagesProduct incoming,
                                                ChainedMessagesProduct outgoing)
     : incoming(incoming), outgoing(outgoing) {}
 
+ChainedIncomingProduct::ChainedIncomingProduct(ChainedMessagesProduct incoming,
+                                               ChainedOutgoingProduct outgoing)
+    : incoming(incoming), outgoing(outgoing) {}
+
 ChainedIncomingControlProduct::ChainedIncomingControlProduct(
     message_ptr incoming, optional<ChainedOutgoingProduct> outgoing)
     : incoming(incoming), outgoing(outgoing) {}
@@ -57,6 +83,7 @@ void MediaHandlerElement::removeFromChain() {
 	}
 	upstream = nullptr;
 	downstream = nullptr;
+	targetBitrateCallback = nullptr;
 }
 
 void MediaHandlerElement::recursiveRemoveChain() {
@@ -70,12 +97,25 @@ void MediaHandlerElement::recursiveRemoveChain() {
 	removeFromChain();
 }
 
+size_t MediaHandlerElement::chainMemoryUsage() const {
+	size_t usage = memoryUsage();
+	for (auto element = downstream; element; element = element->downstream)
+		usage += element->memoryUsage();
+
+	return usage;
+}
+
+void MediaHandlerElement::chainSentBinaryMessage(const message_ptr &message) {
+	processSentBinaryMessage(message);
+	for (auto element = downstream; element; element = element->downstream)
+		element->processSentBinaryMessage(message);
+}
+
 optional<ChainedOutgoingProduct>
-MediaHandlerElement::processOutgoingResponse(ChainedOutgoingProduct messages) {
+MediaHandlerElement::processOutgoingResponse(const ChainedOutgoingProduct &messages) {
 	if (messages.messages) {
 		if (upstream) {
-			auto msgs = upstream->formOutgoingBinaryMessage(
-			    ChainedOutgoingProduct(messages.messages, messages.control));
+			auto msgs = upstream->formOutgoingBinaryMessage(messages);
 			if (msgs.has_value()) {
 				return msgs.value();
 			} else {
@@ -89,6 +129,9 @@ MediaHandlerElement::processOutgoingResponse(ChainedOutgoingProduct messages) {
 		if (upstream) {
 			auto control = upstream->formOutgoingControlMessage(messages.control);
 			if (control) {
+				if (control->empty())
+					return ChainedOutgoingProduct(); // dropped by an element
+
 				return ChainedOutgoingProduct(nullptr, control);
 			} else {
 				LOG_ERROR << "Generating outgoing control message failed";
@@ -102,11 +145,11 @@ MediaHandlerElement::processOutgoingResponse(ChainedOutgoingProduct messages) {
 	}
 }
 
-void MediaHandlerElement::prepareAndSendResponse(optional<ChainedOutgoingProduct> outgoing,
-                                                 std::function<bool(ChainedOutgoingProduct)> send) {
+void MediaHandlerElement::prepareAndSendResponse(
+    const optional<ChainedOutgoingProduct> &outgoing,
+    const std::function<bool(ChainedOutgoingProduct)> &send) {
 	if (outgoing.has_value()) {
-		auto message = outgoing.value();
-		auto response = processOutgoingResponse(message);
+		auto response = processOutgoingResponse(*outgoing);
 		if (response.has_value()) {
 			if (!send(response.value())) {
 				LOG_DEBUG << "Send failed";
@@ -117,11 +160,10 @@ void MediaHandlerElement::prepareAndSendResponse(optional<ChainedOutgoingProduct
 	}
 }
 
-message_ptr
-MediaHandlerElement::formIncomingControlMessage(message_ptr message,
-                                                std::function<bool(ChainedOutgoingProduct)> send) {
+message_ptr MediaHandlerElement::formIncomingControlMessage(
+    message_ptr message, const std::function<bool(ChainedOutgoingProduct)> &send) {
 	assert(message);
-	auto product = processIncomingControlMessage(message);
+	auto product = processIncomingControlMessage(std::move(message));
 	prepareAndSendResponse(product.outgoing, send);
 	if (product.incoming) {
 		if (downstream) {
@@ -134,20 +176,27 @@ MediaHandlerElement::formIncomingControlMessage(message_ptr message,
 	}
 }
 
-ChainedMessagesProduct
-MediaHandlerElement::formIncomingBinaryMessage(ChainedMessagesProduct messages,
-                                               std::function<bool(ChainedOutgoingProduct)> send) {
+ChainedMessagesProduct MediaHandlerElement::formIncomingBinaryMessage(
+    ChainedMessagesProduct messages, const std::function<bool(ChainedOutgoingProduct)> &send) {
 	assert(messages && !messages->empty());
-	auto product = processIncomingBinaryMessage(messages);
-	prepareAndSendResponse(product.outgoing, send);
-	if (product.incoming) {
-		if (downstream) {
-			return downstream->formIncomingBinaryMessage(product.incoming, send);
-		} else {
-			return product.incoming;
+	// The chain is walked iteratively so the batch is only referenced here between elements
+	auto element = shared_from_this();
+	while (true) {
+		ChainedMessagesProduct incoming;
+		{
+			auto product = element->processIncomingBinaryMessage(messages);
+			element->prepareAndSendResponse(product.outgoing, send);
+			incoming = product.incoming;
 		}
-	} else {
-		return nullptr;
+		if (incoming != messages)
+			recycle_chained_messages_product(std::move(messages)); // replaced by the element
+
+		if (!incoming || incoming->empty() || !element->downstream)
+			return incoming;
+
+		messages = std::move(incoming);
+
+		element = element->downstream;
 	}
 }
 
@@ -159,6 +208,9 @@ message_ptr MediaHandlerElement::formOutgoingControlMessage(message_ptr message)
 		LOG_ERROR << "Failed to generate outgoing message";
 		return nullptr;
 	}
+	if (newMessage->empty())
+		return newMessage; // the element dropped the message
+
 	if (upstream) {
 		return upstream->formOutgoingControlMessage(newMessage);
 	} else {
@@ -167,23 +219,33 @@ message_ptr MediaHandlerElement::formOutgoingControlMessage(message_ptr message)
 }
 
 optional<ChainedOutgoingProduct>
-MediaHandlerElement::formOutgoingBinaryMessage(ChainedOutgoingProduct product) {
+MediaHandlerElement::formOutgoingBinaryMessage(const ChainedOutgoingProduct &product) {
 	assert(product.messages && !product.messages->empty());
-	auto newProduct = processOutgoingBinaryMessage(product.messages, product.control);
-	assert(!product.control || newProduct.control);
-	assert(newProduct.messages && !newProduct.messages->empty());
-	if (product.control && !newProduct.control) {
-		LOG_ERROR << "Outgoing message must not remove control message";
-		return nullopt;
-	}
-	if (!newProduct.messages || newProduct.messages->empty()) {
-		LOG_ERROR << "Failed to generate message";
-		return nullopt;
-	}
-	if (upstream) {
-		return upstream->formOutgoingBinaryMessage(newProduct);
-	} else {
-		return newProduct;
+	ChainedMessagesProduct messages = product.messages;
+	message_ptr control = product.control;
+	auto element = shared_from_this();
+	while (true) {
+		auto newProduct = element->processOutgoingBinaryMessage(messages, control);
+		assert(!control || newProduct.control);
+		assert(newProduct.messages);
+		if (control && !newProduct.control) {
+			LOG_ERROR << "Outgoing message must not remove control message";
+			return nullopt;
+		}
+		if (!newProduct.messages) {
+			LOG_ERROR << "Failed to generate message";
+			return nullopt;
+		}
+		if (newProduct.messages != messages && messages != product.messages)
+			recycle_chained_messages_product(std::move(messages)); // replaced by the element
+
+		// An empty batch means the element dropped all messages
+		if (newProduct.messages->empty() || !element->upstream)
+			return newProduct;
+
+		messages = newProduct.messages;
+		control = newProduct.control;
+		element = element->upstream;
 	}
 }
 
@@ -216,6 +278,14 @@ MediaHandlerElement::chainWith(shared_ptr<MediaHandlerElement> upstream) {
 	return upstream;
 }
 
+void MediaHandlerElement::onTargetBitrate(std::function<void(unsigned int bitrate)> callback) {
+	targetBitrateCallback = std::move(callback);
+}
+
+void MediaHandlerElement::reportTargetBitrate(unsigned int bitrate) {
+	targetBitrateCallback(bitrate);
+}
+
 } // namespace rtc
 
 #endif /* RTC_ENABLE_MEDIA */
@@ -23,20 +23,18 @@
 namespace rtc {
 
 message_ptr MediaHandlerRootElement::reduce(ChainedMessagesProduct messages) {
-	if (messages && !messages->empty()) {
-		auto msg_ptr = messages->front();
-		if (msg_ptr) {
-			return make_message(*msg_ptr);
-		} else {
-			return nullptr;
-		}
-	} else {
+	if (!messages || messages->empty() || !messages->front())
 		return nullptr;
-	}
+
+	// The packet can be taken over if nothing else references the batch
+	auto message = messages.use_count() == 1 ? make_media_message(std::move(messages->front()))
+	                                         : make_media_message(messages->front());
+	recycle_chained_messages_product(std::move(messages));
+	return message;
 }
 
 ChainedMessagesProduct MediaHandlerRootElement::split(message_ptr message) {
-	return make_chained_messages_product(message);
+	return make_chained_messages_product(std::move(message));
 }
 
 } // namespace rtc
@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "mediapipeline.hpp"
+
+#include "impl/internals.hpp"
+
+#include <cassert>
+
+namespace rtc {
+
+bool MediaPipelineBase::send(message_ptr msg) {
+	try {
+		outgoingCallback(std::move(msg));
+		return true;
+	} catch (const std::exception &e) {
+		LOG_DEBUG << "Send in media pipeline failed: " << e.what();
+	}
+	return false;
+}
+
+void MediaPipelineBase::deliver(message_ptr msg) {
+	try {
+		incomingCallback(std::move(msg));
+	} catch (const std::exception &e) {
+		LOG_DEBUG << "Deliver in media pipeline failed: " << e.what();
+	}
+}
+
+bool MediaPipelineBase::sendProduct(const ChainedOutgoingProduct &product) {
+	bool result = true;
+	if (product.control) {
+		assert(product.control->type == Message::Control);
+		auto sendResult = send(product.control);
+		if (!sendResult) {
+			LOG_DEBUG << "Failed to send control message";
+		}
+		result = result && sendResult;
+	}
+	if (product.messages) {
+		const auto &messages = *product.messages;
+		for (size_t i = 0; i < messages.size(); i++) {
+			const auto &message = messages[i];
+			if (!message) {
+				LOG_DEBUG << "Invalid message to send " << i + 1 << "/" << messages.size();
+			}
+			auto sendResult = send(make_media_message(message));
+			if (!sendResult) {
+				LOG_DEBUG << "Failed to send message " << i + 1 << "/" << messages.size();
+			}
+			result = result && sendResult;
+		}
+	}
+	return result;
+}
+
+message_ptr
+MediaPipelineBase::sendOutgoingProduct(optional<ChainedOutgoingProduct> &&optOutgoing,
+                                       ChainedMessagesProduct batch,
+                                       std::vector<message_ptr> *collected) {
+	if (!optOutgoing.has_value()) {
+		LOG_ERROR << "Generating outgoing message failed";
+		recycle_chained_messages_product(std::move(batch));
+		return nullptr;
+	}
+	auto messages = optOutgoing->messages;
+	auto control = optOutgoing->control;
+	optOutgoing.reset();
+	if (messages != batch)
+		recycle_chained_messages_product(std::move(batch)); // replaced by a packetizer
+	else
+		batch.reset();
+
+	if (control) {
+		if (collected) {
+			collected->push_back(std::move(control));
+		} else if (!send(control)) {
+			LOG_DEBUG << "Failed to send control message";
+		}
+	}
+
+	if (messages->empty()) {
+		// All messages were dropped
+		recycle_chained_messages_product(std::move(messages));
+		return nullptr;
+	}
+
+	// Packets can be taken over if no element kept a reference to the batch
+	const bool exclusive = messages.use_count() == 1;
+	auto take = [exclusive](binary_ptr &message) {
+		return exclusive ? make_media_message(std::move(message)) : make_media_message(message);
+	};
+
+	if (collected) {
+		collected->reserve(collected->size() + messages->size());
+		for (auto &message : *messages)
+			if (message)
+				collected->push_back(take(message));
+
+		recycle_chained_messages_product(std::move(messages));
+		return nullptr;
+	}
+
+	auto &lastMessage = messages->back();
+	if (!lastMessage) {
+		LOG_DEBUG << "Invalid message to send";
+		recycle_chained_messages_product(std::move(messages));
+		return nullptr;
+	}
+	for (size_t i = 0; i + 1 < messages->size(); i++) {
+		auto &message = messages->at(i);
+		if (!message) {
+			LOG_DEBUG << "Invalid message to send " << i + 1 << "/" << messages->size();
+		}
+		if (!send(take(message))) {
+			LOG_DEBUG << "Failed to send message " << i + 1 << "/" << messages->size();
+		}
+	}
+	auto last = take(lastMessage);
+	recycle_chained_messages_product(std::move(messages));
+	return last;
+}
+
+message_ptr MediaPipelineBase::deliverIncomingProduct(MediaHandlerRootElement &root,
+                                                      ChainedMessagesProduct incoming) {
+	if (!incoming || incoming->empty()) {
+		recycle_chained_messages_product(std::move(incoming));
+		return nullptr;
+	}
+
+	if (incoming->size() == 1)
+		return root.reduce(std::move(incoming));
+
+	// Elements like depacketizers may output multiple messages, all but the last are delivered
+	const bool exclusive = incoming.use_count() == 1;
+	for (size_t i = 0; i + 1 < incoming->size(); ++i) {
+		auto &message = incoming->at(i);
+		auto single = make_chained_messages_product();
+		single->push_back(exclusive ? std::move(message) : message);
+		if (auto reduced = root.reduce(std::move(single)))
+			deliver(std::move(reduced));
+	}
+	auto &last = incoming->back();
+	auto single = make_chained_messages_product();
+	single->push_back(exclusive ? std::move(last) : last);
+	recycle_chained_messages_product(std::move(incoming));
+	return root.reduce(std::move(single));
+}
+
+void MediaPipelineBase::logError(const char *message) { LOG_ERROR << message; }
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
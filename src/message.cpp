@@ -18,21 +18,26 @@
 
 #include "message.hpp"
 
+#include "impl/messagepool.hpp"
+
+#include <utility>
+
 namespace rtc {
 
-message_ptr make_message(size_t size, Message::Type type, unsigned int stream,
-                         shared_ptr<Reliability> reliability) {
-	auto message = std::make_shared<Message>(size, type);
+message_ptr make_message(size_t size, Message::Type type, unsigned int stream) {
+	auto message = impl::MessagePool::Acquire();
+	message->resize(size);
+	message->type = type;
 	message->stream = stream;
-	message->reliability = reliability;
 	return message;
 }
 
-message_ptr make_message(binary &&data, Message::Type type, unsigned int stream,
-                         shared_ptr<Reliability> reliability) {
-	auto message = std::make_shared<Message>(std::move(data), type);
+message_ptr make_message(binary &&data, Message::Type type, unsigned int stream) {
+	auto message = impl::MessagePool::Acquire();
+	// Swap so the recycled storage is not freed but left to the caller's binary
+	static_cast<binary &>(*message).swap(data);
+	message->type = type;
 	message->stream = stream;
-	message->reliability = reliability;
 	return message;
 }
 
@@ -48,13 +53,73 @@ message_ptr make_message(message_variant data) {
 	    std::move(data));
 }
 
+message_ptr make_payload_message(message_variant data) {
+	// A string can't give up its storage, so it is kept alive with the message unless a copy is
+	// cheaper than the allocation
+	const size_t MinReferencedSize = 1024;
+	if (auto str = std::get_if<string>(&data); str && str->size() >= MinReferencedSize) {
+		auto owned = std::make_shared<string>(std::move(*str));
+		auto b = reinterpret_cast<const byte *>(owned->data());
+		const size_t size = owned->size();
+		return make_message(b, size, std::move(owned), Message::String);
+	}
+
+	return make_message(std::move(data));
+}
+
+message_ptr make_message(const byte *data, size_t size, shared_ptr<const void> owner,
+                         Message::Type type) {
+	auto message = impl::MessagePool::Acquire();
+	message->type = type;
+	message->view.emplace(Message::View{data, size, std::move(owner)});
+	return message;
+}
+
+message_ptr make_media_message(binary_ptr &&packet) {
+	auto owned = std::move(packet);
+	if (!owned)
+		return nullptr;
+
+	if (owned.use_count() == 1 && owned->capacity() >= owned->size() + MediaTailroom) {
+		// Packets from RtpPacketizer are pooled messages already
+		if (auto message = impl::MessagePool::Adopt(owned))
+			return message;
+
+		return make_message(std::move(*owned)); // the storage is taken over
+	}
+
+	return make_media_message(std::as_const(owned));
+}
+
+message_ptr make_media_message(const binary_ptr &packet) {
+	if (!packet)
+		return nullptr;
+
+	auto message = impl::MessagePool::Acquire();
+	message->reserve(packet->size() + MediaTailroom);
+	message->assign(packet->begin(), packet->end());
+	return message;
+}
+
 message_variant to_variant(Message &&message) {
 	switch (message.type) {
 	case Message::String:
-		return string(reinterpret_cast<const char *>(message.data()), message.size());
+		return string(reinterpret_cast<const char *>(message.payload()), message.payloadSize());
 	default:
+		if (message.view)
+			return binary(message.payload(), message.payload() + message.payloadSize());
+
 		return std::move(message);
 	}
 }
 
+message_variant to_variant(const Message &message) {
+	switch (message.type) {
+	case Message::String:
+		return string(reinterpret_cast<const char *>(message.payload()), message.payloadSize());
+	default:
+		return binary(message.payload(), message.payload() + message.payloadSize());
+	}
+}
+
 } // namespace rtc
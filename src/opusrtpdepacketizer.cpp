@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "opusrtpdepacketizer.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/logcounter.hpp"
+
+namespace rtc {
+
+static impl::LogCounter COUNTER_BAD_RTP_HEADER(plog::warning, "Number of malformed RTP headers");
+
+OpusRtpDepacketizer::OpusRtpDepacketizer() : RtpDepacketizer(), MediaHandlerRootElement() {}
+
+ChainedIncomingProduct
+OpusRtpDepacketizer::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	auto frames = make_chained_messages_product();
+	frames->reserve(messages->size());
+	for (const auto &message : *messages) {
+		auto payload = parse(*message);
+		if (!payload) {
+			COUNTER_BAD_RTP_HEADER++;
+			continue;
+		}
+		if (payload->size == 0)
+			continue;
+
+		frames->push_back(std::make_shared<binary>(payload->data, payload->data + payload->size));
+	}
+
+	if (frames->empty())
+		return {nullptr};
+
+	return {frames};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
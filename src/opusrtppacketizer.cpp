@@ -20,16 +20,32 @@
 
 #include "opusrtppacketizer.hpp"
 
-#include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <utility>
 
 namespace rtc {
 
-OpusRtpPacketizer::OpusRtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig)
-    : RtpPacketizer(rtpConfig), MediaHandlerRootElement() {}
+OpusRtpPacketizer::OpusRtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig,
+                                     bool _suppressDtx)
+    : RtpPacketizer(rtpConfig), MediaHandlerRootElement(), suppressDtx(_suppressDtx),
+      audioLevelExtension(1) {}
 
-binary_ptr OpusRtpPacketizer::packetize(binary_ptr payload, [[maybe_unused]] bool setMark) {
-	assert(!setMark);
-	return RtpPacketizer::packetize(payload, false);
+binary_ptr OpusRtpPacketizer::packetize(binary_ptr payload, bool setMark) {
+	const uint8_t audioLevelId = rtpConfig->audioLevelId;
+	if (audioLevelId == 0)
+		return RtpPacketizer::packetize(payload, setMark);
+
+	// DTX frames carry comfort noise only
+	const bool dtx = IsDtxFrame(*payload);
+	const uint8_t level = dtx ? 127 : std::min(rtpConfig->audioLevel, uint8_t(127));
+	const bool voiceActivity = !dtx && rtpConfig->voiceActivity;
+	audioLevelExtension[0] = byte((voiceActivity ? 0x80 : 0x00) | level);
+
+	auto packet = createPacket(payload->size(), setMark, audioLevelId, &audioLevelExtension);
+	std::memcpy(packet->data() + packet->size() - payload->size(), payload->data(),
+	            payload->size());
+	return packet;
 }
 
 ChainedOutgoingProduct
@@ -37,12 +53,66 @@ OpusRtpPacketizer::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
                                                 message_ptr control) {
 	ChainedMessagesProduct packets = make_chained_messages_product();
 	packets->reserve(messages->size());
-	for (auto message : *messages) {
-		packets->push_back(packetize(message, false));
+	uint32_t previousSamples = 0;
+	for (const auto &message : *messages) {
+		// The clock rate of Opus is always 48kHz
+		rtpConfig->timestamp += previousSamples;
+		previousSamples = GetFrameSamples(*message);
+
+		if (IsDtxFrame(*message)) {
+			silent = true;
+			if (suppressDtx)
+				continue; // the receiver detects the silence from the timestamp gap
+
+			packets->push_back(packetize(message, false));
+			continue;
+		}
+
+		// The marker bit is set on the first packet of a talkspurt (RFC 3551)
+		packets->push_back(packetize(message, std::exchange(silent, false)));
 	}
 	return {packets, control};
 }
 
+bool OpusRtpPacketizer::IsDtxFrame(const binary &frame) {
+	// DTX frames only contain the TOC byte, and possibly a frame count
+	return frame.size() <= 2;
+}
+
+uint32_t OpusRtpPacketizer::GetFrameSamples(const binary &frame) {
+	if (frame.empty())
+		return 0;
+
+	// See https://www.rfc-editor.org/rfc/rfc6716#section-3.1
+	const uint8_t toc = uint8_t(frame[0]);
+	const uint8_t config = toc >> 3;
+	uint32_t frameSamples;
+	if (config < 12) // SILK-only: 10, 20, 40 or 60 ms
+		frameSamples = (config & 0x03) == 3 ? 2880 : 480 << (config & 0x03);
+	else if (config < 16) // Hybrid: 10 or 20 ms
+		frameSamples = 480 << (config & 0x01);
+	else // CELT-only: 2.5, 5, 10 or 20 ms
+		frameSamples = 120 << (config & 0x03);
+
+	uint32_t count;
+	switch (toc & 0x03) {
+	case 0:
+		count = 1;
+		break;
+	case 1:
+	case 2:
+		count = 2;
+		break;
+	default:
+		if (frame.size() < 2)
+			return 0;
+
+		count = uint8_t(frame[1]) & 0x3F;
+		break;
+	}
+	return frameSamples * count;
+}
+
 } // namespace rtc
 
 #endif /* RTC_ENABLE_MEDIA */
@@ -25,6 +25,7 @@
 #include "impl/dtlstransport.hpp"
 #include "impl/icetransport.hpp"
 #include "impl/internals.hpp"
+#include "impl/metrics.hpp"
 #include "impl/peerconnection.hpp"
 #include "impl/processor.hpp"
 #include "impl/sctptransport.hpp"
@@ -35,6 +36,9 @@
 #include "impl/dtlssrtptransport.hpp"
 #endif
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
 #include <iomanip>
 #include <set>
 #include <thread>
@@ -43,10 +47,62 @@ using namespace std::placeholders;
 
 namespace rtc {
 
+namespace {
+
+// Connections of PeerConnection::CloseAll() are closed by a fixed number of chains, each one
+// closing the next pending connection once the previous one is reclaimed
+struct BulkClose {
+	std::mutex mutex;
+	std::deque<shared_ptr<impl::PeerConnection>> pending;
+	size_t remaining = 0;
+	std::function<void()> callback;
+};
+
+void CloseNext(shared_ptr<BulkClose> bulk) {
+	shared_ptr<impl::PeerConnection> pc;
+	{
+		std::lock_guard lock(bulk->mutex);
+		if (bulk->pending.empty())
+			return;
+
+		pc = std::move(bulk->pending.front());
+		bulk->pending.pop_front();
+	}
+
+	// Keep the connection until reclaimed so it is destroyed on the thread pool
+	pc->onReclaimed([bulk, pc]() mutable {
+		pc.reset();
+		bool last;
+		{
+			std::lock_guard lock(bulk->mutex);
+			last = --bulk->remaining == 0;
+		}
+		if (!last)
+			CloseNext(std::move(bulk));
+		else if (bulk->callback)
+			bulk->callback();
+	});
+
+	try {
+		pc->close();
+	} catch (const std::exception &e) {
+		PLOG_ERROR << e.what();
+	}
+}
+
+} // namespace
+
 PeerConnection::PeerConnection() : PeerConnection(Configuration()) {}
 
 PeerConnection::PeerConnection(Configuration config)
-    : CheshireCat<impl::PeerConnection>(std::move(config)) {}
+    : CheshireCat<impl::PeerConnection>(std::move(config)) {
+	impl::MetricsRegistry::Instance().add(impl());
+}
+
+PeerConnection::PeerConnection(impl_ptr<impl::PeerConnection> impl_)
+    : CheshireCat<impl::PeerConnection>(std::move(impl_)) {
+	impl::MetricsRegistry::Instance().add(impl());
+}
 
 PeerConnection::~PeerConnection() {
 	try {
@@ -58,6 +114,28 @@ PeerConnection::~PeerConnection() {
 
 void PeerConnection::close() { impl()->close(); }
 
+void PeerConnection::CloseAll(std::vector<shared_ptr<PeerConnection>> peerConnections,
+                              std::function<void()> callback, unsigned int concurrency) {
+	auto bulk = std::make_shared<BulkClose>();
+	for (const auto &pc : peerConnections)
+		if (pc)
+			bulk->pending.push_back(pc->impl());
+
+	bulk->remaining = bulk->pending.size();
+	bulk->callback = std::move(callback);
+	PLOG_DEBUG << "Closing " << bulk->remaining << " PeerConnections";
+
+	if (bulk->remaining == 0) {
+		if (bulk->callback)
+			impl::ThreadPool::Instance().post(std::move(bulk->callback));
+		return;
+	}
+
+	const size_t chains = std::clamp(size_t(concurrency), size_t(1), bulk->remaining);
+	for (size_t i = 0; i < chains; ++i)
+		impl::ThreadPool::Instance().post(CloseNext, bulk);
+}
+
 const Configuration *PeerConnection::config() const { return &impl()->config; }
 
 PeerConnection::State PeerConnection::state() const { return impl()->state; }
@@ -158,6 +236,22 @@ void PeerConnection::setLocalDescription(Description::Type type) {
 	}
 }
 
+void PeerConnection::restartIce() {
+	std::unique_lock signalingLock(impl()->signalingMutex);
+	PLOG_VERBOSE << "Restarting ICE";
+
+	if (impl()->signalingState.load() != SignalingState::Stable)
+		throw std::logic_error("ICE restart is only possible in stable signaling state");
+
+	impl()->restartIce();
+	impl()->negotiationNeeded = true;
+	signalingLock.unlock();
+
+	// The next offer carries the new credentials
+	if (!impl()->config.disableAutoNegotiation)
+		setLocalDescription(Description::Type::Offer);
+}
+
 void PeerConnection::setRemoteDescription(Description description) {
 	std::unique_lock signalingLock(impl()->signalingMutex);
 	PLOG_VERBOSE << "Setting remote description: " << string(description);
@@ -300,6 +394,14 @@ void PeerConnection::onTrack(std::function<void(std::shared_ptr<Track>)> callbac
 	impl()->flushPendingTracks();
 }
 
+bool PeerConnection::sendDatagram(binary data) { return impl()->sendDatagram(std::move(data)); }
+
+void PeerConnection::onDatagram(std::function<void(binary data)> callback) {
+	impl()->datagramCallback = callback;
+}
+
+size_t PeerConnection::maxDatagramSize() const { return impl()->maxDatagramSize(); }
+
 void PeerConnection::onLocalDescription(std::function<void(Description description)> callback) {
 	impl()->localDescriptionCallback = callback;
 }
@@ -326,6 +428,9 @@ bool PeerConnection::getSelectedCandidatePair(Candidate *local, Candidate *remot
 }
 
 void PeerConnection::clearStats() {
+#if RTC_ENABLE_LATENCY_TRACING
+	impl()->latencyTracer->clear();
+#endif
 	if (auto sctpTransport = impl()->getSctpTransport())
 		return sctpTransport->clearStats();
 }
@@ -345,6 +450,91 @@ optional<std::chrono::milliseconds> PeerConnection::rtt() {
 	return sctpTransport ? sctpTransport->rtt() : nullopt;
 }
 
+size_t PeerConnection::sendThroughput() {
+	auto sctpTransport = impl()->getSctpTransport();
+	return sctpTransport ? sctpTransport->sendThroughput() : 0;
+}
+
+size_t PeerConnection::receiveThroughput() {
+	auto sctpTransport = impl()->getSctpTransport();
+	return sctpTransport ? sctpTransport->receiveThroughput() : 0;
+}
+
+optional<SctpStats> PeerConnection::sctpStats() {
+	auto sctpTransport = impl()->getSctpTransport();
+	return sctpTransport ? sctpTransport->stats() : nullopt;
+}
+
+optional<IceStats> PeerConnection::iceStats() {
+	auto iceTransport = impl()->getIceTransport();
+	if (!iceTransport)
+		return nullopt;
+
+	IceStats stats = iceTransport->stats();
+	if (auto sctpTransport = impl()->getSctpTransport())
+		stats.rtt = sctpTransport->rtt();
+
+	if (!stats.rtt)
+		if (auto dtlsTransport = impl()->getDtlsTransport())
+			stats.rtt = dtlsTransport->handshakeTimeline().rtt;
+
+	return stats;
+}
+
+optional<LatencyStats> PeerConnection::latencyStats() {
+#if RTC_ENABLE_LATENCY_TRACING
+	return impl()->latencyTracer->stats();
+#else
+	return nullopt;
+#endif
+}
+
+SetupTimeline PeerConnection::setupTimeline() { return impl()->setupTimeline(); }
+
+MemoryStats PeerConnection::memoryStats() { return impl()->memoryStats(); }
+
+size_t LatencyHistogram::BucketIndex(uint64_t ns) {
+	const uint64_t subBuckets = uint64_t(1) << SubBucketBits;
+	if (ns < subBuckets)
+		return size_t(ns);
+
+	int magnitude = 0;
+	for (uint64_t v = ns; v > 1; v >>= 1)
+		++magnitude;
+
+	if (magnitude >= MaxMagnitude)
+		return BucketCount - 1;
+
+	const int shift = magnitude - SubBucketBits;
+	const uint64_t sub = (ns >> shift) & (subBuckets - 1);
+	return (size_t(shift + 1) << SubBucketBits) + size_t(sub);
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t index) {
+	const uint64_t subBuckets = uint64_t(1) << SubBucketBits;
+	const size_t group = index >> SubBucketBits;
+	if (group == 0)
+		return uint64_t(index) + 1;
+
+	const int shift = int(group) - 1;
+	const uint64_t sub = uint64_t(index) & (subBuckets - 1);
+	return (subBuckets + sub + 1) << shift;
+}
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double p) const {
+	if (count == 0)
+		return std::chrono::nanoseconds::zero();
+
+	const auto rank = uint64_t(std::ceil(std::clamp(p, 0.0, 1.0) * double(count)));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BucketCount; ++i) {
+		seen += counts[i];
+		if (seen >= std::max(rank, uint64_t(1)))
+			return std::chrono::nanoseconds(BucketUpperBound(i));
+	}
+	return std::chrono::nanoseconds(BucketUpperBound(BucketCount - 1));
+}
+
 } // namespace rtc
 
 std::ostream &operator<<(std::ostream &out, rtc::PeerConnection::State state) {
@@ -0,0 +1,242 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "peerconnectionfactory.hpp"
+
+#include "impl/certificate.hpp"
+#include "impl/dnscache.hpp"
+#include "impl/icetransport.hpp"
+#include "impl/internals.hpp"
+#include "impl/peerconnection.hpp"
+#include "impl/threadpool.hpp"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+namespace rtc {
+
+using namespace std::chrono_literals;
+using clock = std::chrono::steady_clock;
+
+namespace {
+
+// Addresses are looked up again after this delay, the cache resolves them in the background
+const clock::duration RefreshInterval = 1min;
+
+// Pooled transports are replaced after this delay, as NAT bindings of server reflexive
+// candidates may time out without traffic
+const clock::duration MaxPoolAge = 30s;
+
+bool isResolvable(const IceServer &server) {
+	// TURN over TLS needs the hostname to verify the server certificate, and libjuice ignores
+	// TURN over TCP anyway
+	if (server.hostname.empty())
+		return false;
+
+	return server.type == IceServer::Type::Stun ||
+	       server.relayType == IceServer::RelayType::TurnUdp;
+}
+
+} // namespace
+
+struct PeerConnectionFactory::Template : std::enable_shared_from_this<Template> {
+	Template(Configuration config);
+
+	Configuration current(); // refreshes addresses if needed
+	void refresh(bool blocking);
+	shared_ptr<impl::IceTransport> take(); // null if the pool is empty
+	void expire();
+	void stop();
+	void fill();     // mutex must be locked
+	void schedule(); // mutex must be locked
+	std::vector<shared_ptr<impl::IceTransport>> popExpired(); // mutex must be locked
+
+	const Configuration original;
+	const impl::future_certificate_ptr certificate; // invalid if certificates are not shared
+
+	std::mutex mutex;
+	Configuration resolved;      // protected by mutex
+	clock::time_point refreshed; // same
+
+	// ICE transports gathering in advance, oldest first
+	std::deque<std::pair<clock::time_point, shared_ptr<impl::IceTransport>>> pool; // same
+	unsigned int pending = 0; // transports being created, same
+	impl::TimerHandle timer;  // expiry of the oldest pooled transport, same
+	bool stopped = false;     // same
+};
+
+PeerConnectionFactory::Template::Template(Configuration config)
+    : original(std::move(config)),
+      certificate(original.shareCertificate
+                      ? impl::make_certificate(original.certificateType, true)
+                      : impl::future_certificate_ptr()),
+      resolved(original) {
+	impl::PeerConnection::ValidateConfiguration(original);
+	refresh(true);
+}
+
+Configuration PeerConnectionFactory::Template::current() {
+	std::lock_guard lock(mutex);
+	if (clock::now() >= refreshed + RefreshInterval)
+		refresh(false);
+
+	return resolved;
+}
+
+void PeerConnectionFactory::Template::refresh(bool blocking) {
+	auto &dnsCache = impl::DnsCache::Instance();
+	for (size_t i = 0; i < original.iceServers.size(); ++i) {
+		const auto &server = original.iceServers[i];
+		if (!isResolvable(server))
+			continue;
+
+		// On a cache miss, keep the previous address until the background resolution is done
+		auto addresses = blocking ? optional<std::vector<string>>(dnsCache.resolve(server.hostname))
+		                          : dnsCache.lookup(server.hostname);
+		if (addresses && !addresses->empty())
+			resolved.iceServers[i].hostname = addresses->front();
+	}
+
+	refreshed = clock::now();
+}
+
+shared_ptr<impl::IceTransport> PeerConnectionFactory::Template::take() {
+	std::vector<shared_ptr<impl::IceTransport>> expired; // destroyed without the lock
+	shared_ptr<impl::IceTransport> transport;
+	{
+		std::lock_guard lock(mutex);
+		expired = popExpired();
+		if (!pool.empty()) {
+			transport = std::move(pool.front().second);
+			pool.pop_front();
+		}
+		fill();
+		schedule();
+	}
+	return transport;
+}
+
+void PeerConnectionFactory::Template::expire() {
+	// Expired transports are replaced in the background, so the pool stays ready even if no
+	// connection is created for a while
+	std::vector<shared_ptr<impl::IceTransport>> expired; // destroyed without the lock
+	{
+		std::lock_guard lock(mutex);
+		if (stopped)
+			return;
+
+		expired = popExpired();
+		if (!expired.empty()) {
+			PLOG_DEBUG << "Replacing " << expired.size() << " expired pooled ICE transports";
+		}
+
+		fill();
+		schedule();
+	}
+}
+
+void PeerConnectionFactory::Template::stop() {
+	std::deque<std::pair<clock::time_point, shared_ptr<impl::IceTransport>>> discarded;
+	{
+		std::lock_guard lock(mutex);
+		stopped = true;
+		timer.cancel();
+		std::swap(discarded, pool);
+	}
+}
+
+std::vector<shared_ptr<impl::IceTransport>> PeerConnectionFactory::Template::popExpired() {
+	std::vector<shared_ptr<impl::IceTransport>> expired;
+	const auto now = clock::now();
+	while (!pool.empty() && now - pool.front().first >= MaxPoolAge) {
+		expired.push_back(std::move(pool.front().second));
+		pool.pop_front();
+	}
+	return expired;
+}
+
+void PeerConnectionFactory::Template::schedule() {
+	timer.cancel();
+	if (pool.empty() || stopped)
+		return;
+
+	auto task = [weak_this = weak_from_this()]() {
+		if (auto locked = weak_this.lock())
+			locked->expire();
+	};
+	timer = impl::ThreadPool::Instance().scheduleTimer(pool.front().first + MaxPoolAge,
+	                                                   std::move(task));
+}
+
+void PeerConnectionFactory::Template::fill() {
+	// Creating an agent binds sockets, and TURN allocations take at least a round trip, so
+	// transports are created on the thread pool and added to the pool right away
+	if (original.enableInProcessLoopback || stopped)
+		return; // nothing to gather
+
+	while (pool.size() + pending < original.iceCandidatePoolSize) {
+		++pending;
+		impl::ThreadPool::Instance().post([weak_this = weak_from_this(), config = resolved]() {
+			auto shared_this = weak_this.lock();
+			if (!shared_this)
+				return;
+
+			shared_ptr<impl::IceTransport> transport;
+			try {
+				transport = std::make_shared<impl::IceTransport>(config, nullptr, nullptr, nullptr);
+				transport->pregather();
+			} catch (const std::exception &e) {
+				PLOG_WARNING << "Failed to pre-gather ICE candidates: " << e.what();
+				transport.reset();
+			}
+
+			std::lock_guard lock(shared_this->mutex);
+			--shared_this->pending;
+			if (transport && !shared_this->stopped) {
+				shared_this->pool.emplace_back(clock::now(), std::move(transport));
+				if (shared_this->pool.size() == 1)
+					shared_this->schedule();
+			}
+		});
+	}
+}
+
+PeerConnectionFactory::PeerConnectionFactory(Configuration config)
+    : tmpl(std::make_shared<Template>(std::move(config))) {
+	std::lock_guard lock(tmpl->mutex);
+	tmpl->fill();
+}
+
+PeerConnectionFactory::~PeerConnectionFactory() { tmpl->stop(); }
+
+Configuration PeerConnectionFactory::config() const {
+	std::lock_guard lock(tmpl->mutex);
+	return tmpl->resolved;
+}
+
+shared_ptr<PeerConnection> PeerConnectionFactory::create() {
+	auto impl = std::make_shared<impl::PeerConnection>(tmpl->current(), tmpl->certificate);
+	if (tmpl->original.iceCandidatePoolSize > 0)
+		if (auto transport = tmpl->take())
+			impl->setPregatheredIceTransport(std::move(transport));
+
+	return shared_ptr<PeerConnection>(new PeerConnection(std::move(impl)));
+}
+
+} // namespace rtc
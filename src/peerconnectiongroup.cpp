@@ -0,0 +1,229 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "peerconnectiongroup.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace rtc {
+
+namespace {
+
+using State = PeerConnection::State;
+
+State aggregate(const std::vector<State> &states) {
+	auto any = [&states](State s) {
+		return std::find(states.begin(), states.end(), s) != states.end();
+	};
+	auto all = [&states](State s) {
+		return std::all_of(states.begin(), states.end(), [s](State t) { return t == s; });
+	};
+
+	if (states.empty())
+		return State::New;
+	if (any(State::Failed))
+		return State::Failed;
+	if (all(State::Closed))
+		return State::Closed;
+	if (any(State::Disconnected) || any(State::Closed))
+		return State::Disconnected;
+	if (all(State::Connected))
+		return State::Connected;
+	if (any(State::Connecting) || any(State::Connected))
+		return State::Connecting;
+
+	return State::New;
+}
+
+} // namespace
+
+struct PeerConnectionGroup::Group : std::enable_shared_from_this<Group> {
+	Group(size_t size, const Configuration &config);
+
+	void init(); // sets the callbacks of members
+	void update();
+
+	std::vector<shared_ptr<PeerConnection>> members;
+	std::atomic<size_t> next = 0; // for round-robin assignment
+
+	std::mutex mutex;
+	State state = State::New; // protected by mutex
+
+	synchronized_callback<shared_ptr<DataChannel>> dataChannelCallback;
+	synchronized_callback<size_t, Description> localDescriptionCallback;
+	synchronized_callback<size_t, Candidate> localCandidateCallback;
+	synchronized_callback<State> stateChangeCallback;
+};
+
+PeerConnectionGroup::Group::Group(size_t size, const Configuration &config) {
+	if (size == 0)
+		throw std::invalid_argument("PeerConnectionGroup size must be at least 1");
+
+	members.reserve(size);
+	for (size_t i = 0; i < size; ++i)
+		members.push_back(std::make_shared<PeerConnection>(config));
+}
+
+void PeerConnectionGroup::Group::init() {
+	for (size_t i = 0; i < members.size(); ++i) {
+		auto &pc = members[i];
+		pc->onDataChannel([weak_this = weak_from_this()](shared_ptr<DataChannel> dataChannel) {
+			if (auto locked = weak_this.lock())
+				locked->dataChannelCallback(std::move(dataChannel));
+		});
+		pc->onLocalDescription([weak_this = weak_from_this(), i](Description description) {
+			if (auto locked = weak_this.lock()) {
+				locked->localDescriptionCallback(i, std::move(description));
+				locked->update(); // the member is now in use
+			}
+		});
+		pc->onLocalCandidate([weak_this = weak_from_this(), i](Candidate candidate) {
+			if (auto locked = weak_this.lock())
+				locked->localCandidateCallback(i, std::move(candidate));
+		});
+		pc->onStateChange([weak_this = weak_from_this()](State) {
+			if (auto locked = weak_this.lock())
+				locked->update();
+		});
+	}
+}
+
+void PeerConnectionGroup::Group::update() {
+	State current;
+	{
+		// States are read under the lock so concurrent updates can't apply a stale aggregate
+		std::lock_guard lock(mutex);
+		// Members without data channels are never negotiated, they must not hold the group back
+		std::vector<State> states;
+		states.reserve(members.size());
+		for (const auto &pc : members)
+			if (auto s = pc->state(); s != State::New || pc->localDescription())
+				states.push_back(s);
+
+		current = aggregate(states);
+		if (current == state)
+			return;
+
+		state = current;
+	}
+
+	PLOG_VERBOSE << "PeerConnectionGroup state changed to " << current;
+	stateChangeCallback(current);
+}
+
+PeerConnectionGroup::PeerConnectionGroup(size_t size, Configuration config)
+    : group(std::make_shared<Group>(size, config)) {
+	group->init();
+}
+
+PeerConnectionGroup::~PeerConnectionGroup() {
+	try {
+		close();
+	} catch (const std::exception &e) {
+		PLOG_ERROR << e.what();
+	}
+}
+
+void PeerConnectionGroup::close() {
+	for (auto &pc : group->members)
+		pc->close();
+}
+
+size_t PeerConnectionGroup::size() const { return group->members.size(); }
+
+shared_ptr<PeerConnection> PeerConnectionGroup::member(size_t index) const {
+	return group->members.at(index);
+}
+
+PeerConnectionGroup::State PeerConnectionGroup::state() const {
+	std::lock_guard lock(group->mutex);
+	return group->state;
+}
+
+void PeerConnectionGroup::setRemoteDescription(size_t index, Description description) {
+	member(index)->setRemoteDescription(std::move(description));
+}
+
+void PeerConnectionGroup::addRemoteCandidate(size_t index, Candidate candidate) {
+	member(index)->addRemoteCandidate(std::move(candidate));
+}
+
+shared_ptr<DataChannel> PeerConnectionGroup::createDataChannel(string label,
+                                                               DataChannelInit init) {
+	// Negotiated channels must be on the same member on both sides
+	size_t index = init.negotiated && init.id ? *init.id % size() : group->next++ % size();
+	return member(index)->createDataChannel(std::move(label), std::move(init));
+}
+
+void PeerConnectionGroup::onDataChannel(
+    std::function<void(shared_ptr<DataChannel> dataChannel)> callback) {
+	group->dataChannelCallback = std::move(callback);
+}
+
+void PeerConnectionGroup::onLocalDescription(
+    std::function<void(size_t index, Description description)> callback) {
+	group->localDescriptionCallback = std::move(callback);
+}
+
+void PeerConnectionGroup::onLocalCandidate(
+    std::function<void(size_t index, Candidate candidate)> callback) {
+	group->localCandidateCallback = std::move(callback);
+}
+
+void PeerConnectionGroup::onStateChange(std::function<void(State state)> callback) {
+	group->stateChangeCallback = std::move(callback);
+}
+
+size_t PeerConnectionGroup::bytesSent() {
+	size_t total = 0;
+	for (auto &pc : group->members)
+		total += pc->bytesSent();
+
+	return total;
+}
+
+size_t PeerConnectionGroup::bytesReceived() {
+	size_t total = 0;
+	for (auto &pc : group->members)
+		total += pc->bytesReceived();
+
+	return total;
+}
+
+size_t PeerConnectionGroup::sendThroughput() {
+	size_t total = 0;
+	for (auto &pc : group->members)
+		total += pc->sendThroughput();
+
+	return total;
+}
+
+size_t PeerConnectionGroup::receiveThroughput() {
+	size_t total = 0;
+	for (auto &pc : group->members)
+		total += pc->receiveThroughput();
+
+	return total;
+}
+
+} // namespace rtc
@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtcpnackrequester.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+const size_t MaxNackParts = 64; // keep NACK packets small
+
+// Minimum delay between two requests for the same packet
+const std::chrono::milliseconds MinRetryInterval(10);
+
+} // namespace
+
+RtcpNackRequester::RtcpNackRequester(std::chrono::milliseconds initialRtt, unsigned maxRetries)
+    : MediaHandlerElement(), maxRetries(std::clamp(maxRetries, 1u, 255u)), currentRtt(initialRtt) {}
+
+ChainedIncomingProduct
+RtcpNackRequester::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::lock_guard lock(mutex);
+	const auto now = clock::now();
+	for (const auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize)
+			continue;
+
+		auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+		receive(streams[rtp->ssrc()], rtp->seqNumber(), now);
+	}
+
+	// Retry only when the retransmission should have arrived
+	const auto interval = std::max(std::chrono::duration_cast<clock::duration>(currentRtt * 1.25),
+	                               std::chrono::duration_cast<clock::duration>(MinRetryInterval));
+
+	binary nacks;
+	for (auto &[ssrc, stream] : streams) {
+		if (stream.missingCount == 0)
+			continue;
+
+		// Request missing packets from the oldest to the newest
+		requests.clear();
+		uint16_t seq = uint16_t(stream.highest - WindowSize + 1);
+		for (size_t i = 0; i < WindowSize && stream.missingCount > 0; ++i, ++seq) {
+			if (!isMissing(stream, seq))
+				continue;
+
+			const size_t index = seq % WindowSize;
+			if (stream.retries[index] > 0 && now - stream.requested[index] < interval)
+				continue;
+
+			if (stream.retries[index] >= maxRetries) {
+				setMissing(stream, seq, false); // give up
+				continue;
+			}
+
+			++stream.retries[index];
+			stream.requested[index] = now;
+			requests.push_back(seq);
+		}
+
+		if (auto nack = buildNack(ssrc, requests))
+			nacks.insert(nacks.end(), nack->begin(), nack->end());
+	}
+
+	if (nacks.empty())
+		return {messages};
+
+	auto control = make_message(std::move(nacks), Message::Control);
+	return {messages, ChainedOutgoingProduct(nullptr, control)};
+}
+
+void RtcpNackRequester::setRtt(std::chrono::milliseconds rtt) {
+	std::lock_guard lock(mutex);
+	currentRtt = rtt;
+}
+
+std::chrono::milliseconds RtcpNackRequester::rtt() const {
+	std::lock_guard lock(mutex);
+	return std::chrono::duration_cast<std::chrono::milliseconds>(currentRtt);
+}
+
+void RtcpNackRequester::receive(Stream &stream, uint16_t seq, clock::time_point now) {
+	if (!stream.initialized) {
+		stream.initialized = true;
+		stream.highest = seq;
+		return;
+	}
+
+	const int16_t diff = int16_t(seq - stream.highest);
+	if (size_t(std::abs(diff)) >= WindowSize) {
+		// The sequence jumped beyond the window, restart without requesting the gap
+		stream.missing.fill(0);
+		stream.missingCount = 0;
+		stream.retries.fill(0);
+		stream.highest = seq;
+		return;
+	}
+
+	if (diff > 0) {
+		// Packets between the previous highest one and this one are missing
+		for (uint16_t s = uint16_t(stream.highest + 1); s != seq; ++s)
+			setMissing(stream, s, true); // evicts the state of sequence numbers leaving the window
+
+		setMissing(stream, seq, false);
+		stream.highest = seq;
+
+	} else if (diff < 0 && isMissing(stream, seq)) {
+		// The packet was reordered or retransmitted, use unambiguous samples for the round-trip
+		const size_t index = seq % WindowSize;
+		if (stream.retries[index] == 1) {
+			auto sample = std::chrono::duration<double, std::milli>(now - stream.requested[index]);
+			currentRtt = currentRtt * 0.875 + sample * 0.125;
+		}
+		setMissing(stream, seq, false);
+	}
+}
+
+void RtcpNackRequester::setMissing(Stream &stream, uint16_t seq, bool missing) {
+	const size_t index = seq % WindowSize;
+	const uint64_t mask = uint64_t(1) << (index % 64);
+	auto &word = stream.missing[index / 64];
+	const bool wasMissing = (word & mask) != 0;
+	if (missing) {
+		word |= mask;
+		stream.missingCount += wasMissing ? 0 : 1;
+	} else {
+		word &= ~mask;
+		stream.missingCount -= wasMissing ? 1 : 0;
+	}
+	stream.retries[index] = 0;
+}
+
+bool RtcpNackRequester::isMissing(const Stream &stream, uint16_t seq) const {
+	const size_t index = seq % WindowSize;
+	return (stream.missing[index / 64] >> (index % 64)) & 1;
+}
+
+message_ptr RtcpNackRequester::buildNack(SSRC ssrc, const std::vector<uint16_t> &seqs) const {
+	if (seqs.empty())
+		return nullptr;
+
+	// Batch sequence numbers in FCI fields of a packet ID and a bitmask of the 16 following ones
+	std::vector<std::pair<uint16_t, uint16_t>> parts;
+	for (uint16_t seq : seqs) {
+		const uint16_t offset = parts.empty() ? 0 : uint16_t(seq - parts.back().first);
+		if (!parts.empty() && offset >= 1 && offset <= 16) {
+			parts.back().second |= uint16_t(1u << (offset - 1));
+		} else {
+			if (parts.size() == MaxNackParts)
+				break;
+
+			parts.emplace_back(seq, 0);
+		}
+	}
+
+	auto message = make_message(RtcpNack::Size(unsigned(parts.size())), Message::Control);
+	auto nack = reinterpret_cast<RtcpNack *>(message->data());
+	nack->preparePacket(ssrc, unsigned(parts.size()));
+	for (size_t i = 0; i < parts.size(); ++i) {
+		nack->parts[i].setPid(parts[i].first);
+		nack->parts[i].setBlp(parts[i].second);
+	}
+	return message;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
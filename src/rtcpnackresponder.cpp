@@ -21,26 +21,96 @@
 #include "rtcpnackresponder.hpp"
 
 #include "impl/internals.hpp"
+#include "impl/messagepool.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 namespace rtc {
 
-RtcpNackResponder::Storage::Element::Element(binary_ptr packet, uint16_t sequenceNumber,
-                                             shared_ptr<Element> next)
-    : packet(packet), sequenceNumber(sequenceNumber), next(next) {}
+namespace {
 
-unsigned RtcpNackResponder::Storage::size() { return unsigned(storage.size()); }
+size_t RoundUpPowerOfTwo(size_t value) {
+	size_t result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+} // namespace
+
+RtcpNackResponder::Storage::Storage(unsigned _maximumSize,
+                                    std::chrono::milliseconds _maximumDuration,
+                                    size_t _maximumBytes)
+    : ring(RoundUpPowerOfTwo(std::clamp(_maximumSize, 1u, 32768u))),
+      maximumSize(std::clamp(_maximumSize, 1u, 32768u)), maximumDuration(_maximumDuration),
+      maximumBytes(_maximumBytes) {
+	assert(_maximumSize > 0);
+}
+
+RtcpNackResponder::Storage::Element &RtcpNackResponder::Storage::at(uint16_t sequenceNumber) {
+	return ring[sequenceNumber & (ring.size() - 1)];
+}
+
+void RtcpNackResponder::Storage::release(Element &element) {
+	if (element.packet) {
+		bytes -= element.packet->size();
+		element.packet = nullptr;
+	}
+}
 
-RtcpNackResponder::Storage::Storage(unsigned _maximumSize) : maximumSize(_maximumSize) {
-	assert(maximumSize > 0);
-	storage.reserve(maximumSize);
+void RtcpNackResponder::Storage::evictOldest() {
+	release(at(*oldest));
+	if (*oldest == newest)
+		oldest.reset();
+	else
+		oldest = uint16_t(*oldest + 1);
 }
 
 optional<binary_ptr> RtcpNackResponder::Storage::get(uint16_t sequenceNumber) {
-	auto position = storage.find(sequenceNumber);
-	return position != storage.end() ? std::make_optional(storage.at(sequenceNumber)->packet)
-	                                 : nullopt;
+	std::lock_guard lock(mutex);
+	if (!oldest || uint16_t(sequenceNumber - *oldest) > uint16_t(newest - *oldest))
+		return nullopt;
+
+	auto &element = at(sequenceNumber);
+	return element.packet ? std::make_optional(element.packet) : nullopt;
+}
+
+optional<binary_ptr>
+RtcpNackResponder::Storage::getForRetransmission(uint16_t sequenceNumber, clock::time_point now,
+                                                 std::chrono::milliseconds minInterval,
+                                                 std::chrono::milliseconds maxAge) {
+	std::lock_guard lock(mutex);
+	if (!oldest || uint16_t(sequenceNumber - *oldest) > uint16_t(newest - *oldest))
+		return nullopt;
+
+	auto &element = at(sequenceNumber);
+	if (!element.packet)
+		return nullopt;
+
+	if (maxAge.count() > 0 && now - element.time > maxAge)
+		return nullopt;
+
+	// Duplicate requests sent before the previous retransmission could arrive are ignored
+	if (minInterval.count() > 0 && element.retransmitted != clock::time_point() &&
+	    now - element.retransmitted < minInterval)
+		return nullopt;
+
+	return element.packet;
+}
+
+void RtcpNackResponder::Storage::setRetransmitted(uint16_t sequenceNumber, clock::time_point now) {
+	std::lock_guard lock(mutex);
+	if (!oldest || uint16_t(sequenceNumber - *oldest) > uint16_t(newest - *oldest))
+		return;
+
+	at(sequenceNumber).retransmitted = now;
+}
+
+size_t RtcpNackResponder::Storage::storedBytes() {
+	std::lock_guard lock(mutex);
+	return bytes;
 }
 
 void RtcpNackResponder::Storage::store(binary_ptr packet) {
@@ -49,32 +119,169 @@ void RtcpNackResponder::Storage::store(binary_ptr packet) {
 	}
 	auto rtp = reinterpret_cast<RtpHeader *>(packet->data());
 	auto sequenceNumber = rtp->seqNumber();
+	const auto now = clock::now();
 
-	assert((storage.empty() && !oldest && !newest) || (!storage.empty() && oldest && newest));
+	std::lock_guard lock(mutex);
+	const int16_t diff = int16_t(sequenceNumber - newest);
+	if (oldest && (diff <= 0 || unsigned(diff) >= maximumSize)) {
+		// Sequence numbers jumped beyond the window, restart from this packet
+		while (oldest)
+			evictOldest();
+	}
 
-	if (size() == 0) {
-		newest = std::make_shared<Element>(packet, sequenceNumber);
-		oldest = newest;
+	if (!oldest) {
+		oldest = sequenceNumber;
 	} else {
-		auto current = std::make_shared<Element>(packet, sequenceNumber);
-		newest->next = current;
-		newest = current;
+		// Evicting first keeps the range within the ring, so no slot is shared
+		while (uint16_t(sequenceNumber - *oldest) >= maximumSize)
+			evictOldest();
+
+		// Skipped sequence numbers are left empty
+		while (newest != uint16_t(sequenceNumber - 1))
+			release(at(++newest));
 	}
 
-	storage.emplace(sequenceNumber, newest);
+	newest = sequenceNumber;
+	auto &element = at(sequenceNumber);
+	release(element);
+	bytes += packet->size();
+	element.packet = std::move(packet);
+	element.time = now;
+	element.retransmitted = clock::time_point();
 
-	if (size() > maximumSize) {
-		assert(oldest);
-		if (oldest) {
-			storage.erase(oldest->sequenceNumber);
-			oldest = oldest->next;
-		}
+	// Older packets are evicted by size or age, the newest packet is always kept
+	while (*oldest != newest) {
+		const auto &older = at(*oldest);
+		if (older.packet && !(maximumBytes > 0 && bytes > maximumBytes) &&
+		    !(maximumDuration.count() > 0 && now - older.time > maximumDuration))
+			break;
+
+		evictOldest();
 	}
 }
 
 RtcpNackResponder::RtcpNackResponder(unsigned maxStoredPacketCount)
     : MediaHandlerElement(), storage(std::make_shared<Storage>(maxStoredPacketCount)) {}
 
+RtcpNackResponder::RtcpNackResponder(std::chrono::milliseconds maxStoredDuration,
+                                     size_t maxStoredBytes, unsigned maxStoredPacketCount)
+    : MediaHandlerElement(), storage(std::make_shared<Storage>(maxStoredPacketCount,
+                                                             maxStoredDuration, maxStoredBytes)) {}
+
+void RtcpNackResponder::enableRtx(SSRC rtxSsrc, uint8_t rtxPayloadType) {
+	std::lock_guard lock(rtxMutex);
+	rtx.emplace(Rtx{rtxSsrc, rtxPayloadType, uint16_t(rand())});
+}
+
+void RtcpNackResponder::disableRtx() {
+	std::lock_guard lock(rtxMutex);
+	rtx.reset();
+}
+
+void RtcpNackResponder::enableTransportSequenceNumbers(
+    uint8_t extensionId, shared_ptr<std::atomic<uint16_t>> transportSequenceNumber) {
+	if (extensionId == 0)
+		throw std::invalid_argument("Invalid transport-wide sequence number extension ID");
+
+	if (!transportSequenceNumber)
+		throw std::invalid_argument("Missing transport-wide sequence number counter");
+
+	std::lock_guard lock(rtxMutex);
+	transportSequenceNumberId = extensionId;
+	this->transportSequenceNumber = std::move(transportSequenceNumber);
+}
+
+void RtcpNackResponder::setRetransmissionBudget(double fraction) {
+	std::lock_guard lock(budgetMutex);
+	budgetFraction = std::max(fraction, 0.);
+	budgetBytes = 0.;
+}
+
+void RtcpNackResponder::setRtt(std::chrono::milliseconds rtt) {
+	std::lock_guard lock(rtxMutex);
+	this->rtt = std::max(rtt, std::chrono::milliseconds::zero());
+}
+
+void RtcpNackResponder::setMaxPacketAge(std::chrono::milliseconds maxAge) {
+	std::lock_guard lock(rtxMutex);
+	maxPacketAge = std::max(maxAge, std::chrono::milliseconds::zero());
+}
+
+void RtcpNackResponder::updateBudget(size_t sentBytes, clock::time_point now) {
+	// The send rate is measured over windows of at least 500ms
+	using namespace std::chrono_literals;
+	std::lock_guard lock(budgetMutex);
+	if (rateWindowStart == clock::time_point())
+		rateWindowStart = now;
+
+	rateWindowBytes += sentBytes;
+	if (const auto elapsed = now - rateWindowStart; elapsed >= 500ms) {
+		sendRate = double(rateWindowBytes) / std::chrono::duration<double>(elapsed).count();
+		rateWindowBytes = 0;
+		rateWindowStart = now;
+	}
+
+	if (budgetFraction <= 0.)
+		return;
+
+	// Credit the budget, allowing bursts of up to one second of retransmissions
+	budgetBytes += budgetFraction * double(sentBytes);
+	if (sendRate > 0.)
+		budgetBytes = std::min(budgetBytes, budgetFraction * sendRate);
+}
+
+bool RtcpNackResponder::consumeBudget(size_t bytes) {
+	std::lock_guard lock(budgetMutex);
+	if (budgetFraction <= 0.)
+		return true;
+
+	if (budgetBytes < double(bytes))
+		return false;
+
+	budgetBytes -= double(bytes);
+	return true;
+}
+
+size_t RtcpNackResponder::memoryUsage() const { return storage->storedBytes(); }
+
+binary_ptr RtcpNackResponder::createRtxPacket(const binary &packet) {
+	// The RTX payload is the original sequence number followed by the original payload
+	auto original = reinterpret_cast<const RtpHeader *>(packet.data());
+	const size_t headerSize = original->getSize() + original->getExtensionHeaderSize();
+	if (headerSize > packet.size())
+		return nullptr;
+
+	const size_t size = packet.size() + sizeof(uint16_t);
+	binary_ptr msg = impl::MessagePool::Acquire();
+	msg->reserve(size + MediaTailroom);
+	msg->resize(size);
+	std::memcpy(msg->data(), packet.data(), headerSize);
+	std::memcpy(msg->data() + headerSize + sizeof(uint16_t), packet.data() + headerSize,
+	            packet.size() - headerSize);
+
+	// Original sequence number in network byte order
+	const uint16_t osn = original->seqNumber();
+	msg->at(headerSize) = byte(osn >> 8);
+	msg->at(headerSize + 1) = byte(osn & 0xFF);
+
+	auto rtp = reinterpret_cast<RtpHeader *>(msg->data());
+	rtp->setSsrc(rtx->ssrc);
+	rtp->setPayloadType(rtx->payloadType);
+	rtp->setSeqNumber(rtx->sequenceNumber++);
+	return msg;
+}
+
+// rtxMutex must be locked
+void RtcpNackResponder::renumberTransportSequence(binary &packet) {
+	if (!transportSequenceNumber)
+		return;
+
+	RtpExtensionIndex extensions(packet.data(), packet.size());
+	if (extensions.transportSequenceNumber(transportSequenceNumberId))
+		extensions.writeTransportSequenceNumber(packet.data(), transportSequenceNumberId,
+		                                        (*transportSequenceNumber)++);
+}
+
 ChainedIncomingControlProduct
 RtcpNackResponder::processIncomingControlMessage(message_ptr message) {
 	optional<ChainedOutgoingProduct> optPackets = ChainedOutgoingProduct(nullptr);
@@ -100,13 +307,43 @@ RtcpNackResponder::processIncomingControlMessage(message_ptr message) {
 			                              newMissingSeqenceNumbers.end());
 		}
 		packets->reserve(packets->size() + missingSequenceNumbers.size());
+		std::lock_guard lock(rtxMutex);
+		const auto now = clock::now();
+		size_t overBudget = 0;
 		for (auto sequenceNumber : missingSequenceNumbers) {
-			auto optPacket = storage->get(sequenceNumber);
-			if (optPacket.has_value()) {
-				auto packet = optPacket.value();
+			auto optPacket = storage->getForRetransmission(sequenceNumber, now, rtt, maxPacketAge);
+			if (!optPacket.has_value())
+				continue;
+
+			auto packet = optPacket.value();
+			if (!consumeBudget(packet->size())) {
+				++overBudget;
+				continue;
+			}
+
+			storage->setRetransmitted(sequenceNumber, now);
+			if (rtx) {
+				// Retransmit on the RTX stream so the original stream statistics are preserved
+				if (auto rtxPacket = createRtxPacket(*packet)) {
+					renumberTransportSequence(*rtxPacket);
+					packets->push_back(std::move(rtxPacket));
+				}
+			} else if (transportSequenceNumber) {
+				// The stored packet is shared, so it is copied before being renumbered
+				binary_ptr copy = impl::MessagePool::Acquire();
+				copy->reserve(packet->size() + MediaTailroom);
+				copy->assign(packet->begin(), packet->end());
+				renumberTransportSequence(*copy);
+				packets->push_back(std::move(copy));
+			} else {
 				packets->push_back(packet);
 			}
 		}
+
+		if (overBudget > 0) {
+			PLOG_DEBUG << "Retransmission budget exceeded, skipped " << overBudget
+			           << " requested packets";
+		}
 	}
 
 	if (!packets->empty()) {
@@ -119,9 +356,14 @@ RtcpNackResponder::processIncomingControlMessage(message_ptr message) {
 ChainedOutgoingProduct
 RtcpNackResponder::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
                                                 message_ptr control) {
-	for (auto message : *messages) {
+	size_t sentBytes = 0;
+	for (const auto &message : *messages) {
+		if (message)
+			sentBytes += message->size();
+
 		storage->store(message);
 	}
+	updateBudget(sentBytes, clock::now());
 	return {messages, control};
 }
 
@@ -24,7 +24,9 @@
 
 #include "impl/logcounter.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <utility>
 
 #ifdef _WIN32
@@ -42,6 +44,41 @@ static impl::LogCounter COUNTER_BAD_NOTIF_LEN(plog::warning,
 static impl::LogCounter COUNTER_BAD_SCTP_STATUS(plog::warning,
                                                 "Number of unknown SCTP_STATUS errors");
 
+namespace {
+
+// See https://www.rfc-editor.org/rfc/rfc3550#appendix-A.1
+const uint32_t RtpSeqMod = 1 << 16;
+const uint16_t MaxDropout = 3000;
+const uint16_t MaxMisorder = 100;
+const int MinSequential = 2;
+
+const size_t MaxReportBlocks = 31;
+
+} // namespace
+
+RtcpReceivingSession::RtcpReceivingSession(uint32_t clockRate)
+    : mClockRate(clockRate > 0 ? clockRate : 90000), mStart(clock::now()) {}
+
+optional<RtcpReceivingSession::Stats> RtcpReceivingSession::stats(SSRC ssrc) const {
+	std::lock_guard lock(mMutex);
+	auto it = mSources.find(ssrc);
+	if (it == mSources.end() || !it->second.valid())
+		return nullopt;
+
+	return makeStats(ssrc, it->second);
+}
+
+std::vector<RtcpReceivingSession::Stats> RtcpReceivingSession::stats() const {
+	std::lock_guard lock(mMutex);
+	std::vector<Stats> result;
+	result.reserve(mSources.size());
+	for (const auto &[ssrc, source] : mSources)
+		if (source.valid())
+			result.push_back(makeStats(ssrc, source));
+
+	return result;
+}
+
 message_ptr RtcpReceivingSession::outgoing(message_ptr ptr) { return ptr; }
 
 message_ptr RtcpReceivingSession::incoming(message_ptr ptr) {
@@ -65,6 +102,7 @@ message_ptr RtcpReceivingSession::incoming(message_ptr ptr) {
 		// Padding-processing is a user-level thing
 
 		mSsrc = rtp->ssrc();
+		recordPacket(rtp, ptr->arrivalTime.value_or(clock::now()));
 
 		return ptr;
 	}
@@ -82,9 +120,15 @@ message_ptr RtcpReceivingSession::incoming(message_ptr ptr) {
 		mSyncRTPTS = sr->rtpTimestamp();
 		mSyncNTPTS = sr->ntpTimestamp();
 		sr->log();
+		{
+			std::lock_guard lock(mMutex);
+			auto &source = mSources[mSsrc];
+			source.lastSrNtp = mSyncNTPTS;
+			source.lastSrTime = ptr->arrivalTime.value_or(clock::now());
+		}
 
 		// TODO For the time being, we will send RR's/REMB's when we get an SR
-		pushRR(0);
+		pushRR();
 		if (mRequestedBitrate > 0)
 			pushREMB(mRequestedBitrate);
 	}
@@ -107,13 +151,49 @@ void RtcpReceivingSession::pushREMB(unsigned int bitrate) {
 	send(msg);
 }
 
-void RtcpReceivingSession::pushRR(unsigned int lastSR_delay) {
-	auto msg = make_message(RtcpRr::SizeWithReportBlocks(1), Message::Control);
-	auto rr = reinterpret_cast<RtcpRr *>(msg->data());
-	rr->preparePacket(mSsrc, 1);
-	rr->getReportBlock(0)->preparePacket(mSsrc, 0, 0, uint16_t(mGreatestSeqNo), 0, 0, mSyncNTPTS,
-	                                     lastSR_delay);
-	rr->log();
+void RtcpReceivingSession::pushRR() {
+	message_ptr msg;
+	{
+		std::lock_guard lock(mMutex);
+		const auto now = clock::now();
+		size_t count = 0;
+		for (const auto &entry : mSources)
+			if (entry.second.valid())
+				++count;
+
+		count = std::min(count, MaxReportBlocks);
+		msg = make_message(RtcpRr::SizeWithReportBlocks(uint8_t(count)), Message::Control);
+		auto rr = reinterpret_cast<RtcpRr *>(msg->data());
+		rr->preparePacket(mSsrc, uint8_t(count));
+
+		int i = 0;
+		for (auto &[ssrc, source] : mSources) {
+			if (!source.valid() || size_t(i) >= count)
+				continue;
+
+			// The delay since the last SR is expressed in units of 1/65536 seconds
+			const auto stats = makeStats(ssrc, source);
+			const uint32_t delay =
+			    source.lastSrNtp
+			        ? uint32_t(std::chrono::duration<double>(now - source.lastSrTime).count() *
+			                   65536)
+			        : 0;
+
+			auto block = rr->getReportBlock(i++);
+			block->setSSRC(ssrc);
+			block->setLoss(stats.fractionLost, stats.packetsLost);
+			block->setSeqNo(uint16_t(stats.extendedHighestSeqNo),
+			                uint16_t(stats.extendedHighestSeqNo >> 16));
+			block->setJitter(stats.jitter);
+			block->setNTPOfSR(source.lastSrNtp.value_or(0));
+			block->setDelaySinceSR(delay);
+
+			// The fraction lost of the next report covers the interval from now
+			source.expectedPrior = source.expected();
+			source.receivedPrior = source.received;
+		}
+		rr->log();
+	}
 
 	send(msg);
 }
@@ -140,6 +220,139 @@ void RtcpReceivingSession::pushPLI() {
 	send(msg);
 }
 
+RtcpReceivingSession::Stats RtcpReceivingSession::makeStats(SSRC ssrc,
+                                                            const Source &source) const {
+	Stats stats;
+	stats.ssrc = ssrc;
+	stats.extendedHighestSeqNo = source.extendedMax();
+	stats.packetsReceived = source.received;
+	stats.packetsLost = source.lost();
+	stats.fractionLost = source.fraction();
+	stats.jitter = uint32_t(source.jitter);
+	stats.jitterSeconds = source.jitter / mClockRate;
+	stats.lastSrNtp = source.lastSrNtp;
+	return stats;
+}
+
+void RtcpReceivingSession::recordPacket(const RtpHeader *rtp, clock::time_point now) {
+	std::lock_guard lock(mMutex);
+	auto &source = mSources[rtp->ssrc()];
+	const uint16_t seq = rtp->seqNumber();
+	if (!source.initialized) {
+		source.init(seq);
+		source.maxSeq = uint16_t(seq - 1);
+		source.probation = MinSequential;
+		source.initialized = true;
+	}
+
+	if (!source.update(seq))
+		return;
+
+	mGreatestSeqNo = source.extendedMax();
+
+	// Interarrival jitter, see https://www.rfc-editor.org/rfc/rfc3550#appendix-A.8
+	const double elapsed = std::chrono::duration<double>(now - mStart).count();
+	const uint32_t arrival = uint32_t(uint64_t(elapsed * mClockRate));
+	const uint32_t transit = arrival - rtp->timestamp();
+	if (source.transit) {
+		const int32_t d = int32_t(transit - *source.transit);
+		source.jitter += (std::abs(double(d)) - source.jitter) / 16;
+	}
+	source.transit = transit;
+}
+
+void RtcpReceivingSession::Source::init(uint16_t seq) {
+	baseSeq = seq;
+	maxSeq = seq;
+	badSeq = RtpSeqMod + 1; // so seq == badSeq is false
+	cycles = 0;
+	received = 0;
+	receivedPrior = 0;
+	expectedPrior = 0;
+	seen.reset();
+	seen.set(seq % DuplicateWindow);
+}
+
+bool RtcpReceivingSession::Source::update(uint16_t seq) {
+	const uint16_t delta = uint16_t(seq - maxSeq);
+	if (probation > 0) {
+		// The source is valid once enough packets were received in sequence
+		if (seq == uint16_t(maxSeq + 1)) {
+			--probation;
+			maxSeq = seq;
+			if (probation == 0) {
+				init(seq);
+				++received;
+				return true;
+			}
+		} else {
+			probation = MinSequential - 1;
+			maxSeq = seq;
+		}
+		return false;
+	}
+
+	if (delta == 0) {
+		return false; // duplicate
+
+	} else if (delta < MaxDropout) {
+		// In order, with a permissible gap
+		if (seq < maxSeq)
+			cycles += RtpSeqMod; // wrapped
+
+		// Skipped sequence numbers are cleared, the whole ring if the jump exceeds it
+		if (delta >= DuplicateWindow)
+			seen.reset();
+		else
+			for (uint16_t s = uint16_t(maxSeq + 1); s != seq; ++s)
+				seen.reset(s % DuplicateWindow);
+
+		maxSeq = seq;
+		seen.set(seq % DuplicateWindow);
+
+	} else if (delta <= RtpSeqMod - MaxMisorder) {
+		// The sequence number made a very large jump
+		if (seq != badSeq) {
+			badSeq = (seq + 1) & (RtpSeqMod - 1);
+			return false;
+		}
+		// Two sequential packets, assume the other side restarted without telling us
+		init(seq);
+
+	} else {
+		// Duplicate or reordered packet
+		if (uint16_t(maxSeq - seq) < DuplicateWindow) {
+			if (seen.test(seq % DuplicateWindow))
+				return false;
+
+			seen.set(seq % DuplicateWindow);
+		}
+	}
+
+	++received;
+	return true;
+}
+
+bool RtcpReceivingSession::Source::valid() const { return initialized && probation == 0; }
+
+uint32_t RtcpReceivingSession::Source::extendedMax() const { return cycles + maxSeq; }
+
+uint32_t RtcpReceivingSession::Source::expected() const { return extendedMax() - baseSeq + 1; }
+
+int32_t RtcpReceivingSession::Source::lost() const {
+	return int32_t(int64_t(expected()) - int64_t(received));
+}
+
+uint8_t RtcpReceivingSession::Source::fraction() const {
+	const int64_t expectedInterval = int64_t(expected()) - expectedPrior;
+	const int64_t receivedInterval = int64_t(received) - receivedPrior;
+	const int64_t lostInterval = expectedInterval - receivedInterval;
+	if (expectedInterval <= 0 || lostInterval <= 0)
+		return 0;
+
+	return uint8_t(std::min<int64_t>((lostInterval << 8) / expectedInterval, 255));
+}
+
 } // namespace rtc
 
 #endif // RTC_ENABLE_MEDIA
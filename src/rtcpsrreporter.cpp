@@ -20,31 +20,132 @@
 
 #include "rtcpsrreporter.hpp"
 
+#include "impl/threadpool.hpp"
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <mutex>
+#include <random>
+#include <vector>
 
 namespace rtc {
 
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// See https://www.rfc-editor.org/rfc/rfc3550#section-6.3.1
+const double RtcpBandwidthFraction = 0.05;  // of the session bandwidth
+const double SenderBandwidthFraction = 0.25; // of the RTCP bandwidth
+const double Compensation = 1.21828;         // e - 3/2, for the timer reconsideration algorithm
+const size_t UdpIpHeaderSize = 28;
+const size_t MaxSdesChunks = 31; // the source count is 5 bits
+
+} // namespace
+
+struct RtcpSrReporter::Group : std::enable_shared_from_this<Group> {
+	std::vector<RtcpSrReporter *> members; // protected by mutex
+	std::atomic<bool> needsToReport = false;
+	std::mutex mutex;
+
+	// Automatic reports, protected by mutex
+	bool automatic = false;
+	std::chrono::milliseconds minInterval{0};
+	impl::TimerHandle timer;
+	double avgReportSize = 0; // in octets, including UDP and IP headers
+	uint64_t sentOctets = 0;  // since the previous schedule
+	clock::time_point lastSchedule;
+	std::default_random_engine generator{
+	    static_cast<unsigned int>(clock::now().time_since_epoch().count())};
+
+	void schedule(bool initial);
+	void fire();
+};
+
+void RtcpSrReporter::Group::schedule(bool initial) {
+	using seconds = std::chrono::duration<double>;
+	const auto now = clock::now();
+	const double elapsed = seconds(now - lastSchedule).count();
+	const double bitrate = !initial && elapsed > 0 ? double(sentOctets) * 8 / elapsed : 0;
+	sentOctets = 0;
+	lastSchedule = now;
+
+	// Deterministic interval, see https://www.rfc-editor.org/rfc/rfc3550#appendix-A.7
+	const double senderBandwidth =
+	    bitrate * RtcpBandwidthFraction * SenderBandwidthFraction / 8; // octets per second
+	const double minimum = seconds(minInterval).count() / (initial ? 2 : 1);
+	double interval = senderBandwidth > 0 ? avgReportSize * double(members.size()) / senderBandwidth
+	                                      : 0;
+	interval = std::max(interval, minimum);
+
+	// Randomize to avoid synchronization with other participants
+	std::uniform_real_distribution<double> uniform(0.5, 1.5);
+	interval = interval * uniform(generator) / Compensation;
+
+	auto delay = std::chrono::duration_cast<clock::duration>(seconds(interval));
+	timer = impl::ThreadPool::Instance().scheduleTimer(
+	    delay, [weak_this = weak_from_this()]() {
+		    if (auto locked = weak_this.lock())
+			    locked->fire();
+	    });
+}
+
+void RtcpSrReporter::Group::fire() {
+	std::lock_guard lock(mutex);
+	if (!automatic)
+		return;
+
+	needsToReport = true;
+	schedule(false);
+}
+
+RtcpSrReporter::RtcpSrReporter(shared_ptr<RtpPacketizationConfig> rtpConfig,
+                               shared_ptr<RtcpSrReporter> reportWith)
+    : MediaHandlerElement(), group(reportWith ? reportWith->group : std::make_shared<Group>()),
+      rtpConfig(rtpConfig) {
+	std::lock_guard lock(group->mutex);
+	group->members.push_back(this);
+}
+
+RtcpSrReporter::~RtcpSrReporter() {
+	std::lock_guard lock(group->mutex);
+	auto &members = group->members;
+	members.erase(std::remove(members.begin(), members.end(), this), members.end());
+	if (members.empty()) {
+		group->automatic = false;
+		group->timer.cancel();
+	}
+}
+
 ChainedOutgoingProduct RtcpSrReporter::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
                                                                     message_ptr control) {
-	if (needsToReport) {
-		auto timestamp = rtpConfig->timestamp;
-		auto sr = getSenderReport(timestamp);
+	std::vector<Report> reports;
+	{
+		std::lock_guard lock(group->mutex);
+		if (group->needsToReport.exchange(false))
+			reports = collectReports(rtpConfig->timestamp);
+
+		for (const auto &message : *messages) {
+			auto rtp = reinterpret_cast<RtpHeader *>(message->data());
+			addToReport(rtp, uint32_t(message->size()));
+		}
+	}
+
+	if (!reports.empty()) {
+		auto sr = BuildSenderReport(reports);
 		if (control) {
 			control->insert(control->end(), sr->begin(), sr->end());
 		} else {
 			control = sr;
 		}
-		needsToReport = false;
-	}
-	for (auto message : *messages) {
-		auto rtp = reinterpret_cast<RtpHeader *>(message->data());
-		addToReport(rtp, uint32_t(message->size()));
 	}
 	return {messages, control};
 }
 
 void RtcpSrReporter::startRecording() {
+	std::lock_guard lock(group->mutex);
 	mPreviousReportedTimestamp = rtpConfig->timestamp;
 	timeOffset = rtpConfig->startTime - rtpConfig->timestampToSeconds(rtpConfig->timestamp);
 }
@@ -53,39 +154,97 @@ void RtcpSrReporter::addToReport(RtpHeader *rtp, uint32_t rtpSize) {
 	packetCount += 1;
 	assert(!rtp->padding());
 	payloadOctets += rtpSize - uint32_t(rtp->getSize());
+	lastTimestamp = rtp->timestamp();
+	group->sentOctets += rtpSize;
 }
 
-RtcpSrReporter::RtcpSrReporter(shared_ptr<RtpPacketizationConfig> rtpConfig)
-    : MediaHandlerElement(), rtpConfig(rtpConfig) {}
-
 uint64_t RtcpSrReporter::secondsToNTP(double seconds) {
 	return uint64_t(std::round(seconds * double(uint64_t(1) << 32)));
 }
 
-void RtcpSrReporter::setNeedsToReport() { needsToReport = true; }
-
-message_ptr RtcpSrReporter::getSenderReport(uint32_t timestamp) {
-	auto srSize = RtcpSr::Size(0);
-	auto msg = make_message(srSize + RtcpSdes::Size({{uint8_t(rtpConfig->cname.size())}}),
-	                        Message::Control);
-	auto sr = reinterpret_cast<RtcpSr *>(msg->data());
-	auto timestamp_s = rtpConfig->timestampToSeconds(timestamp);
-	auto currentTime = timeOffset + timestamp_s;
-	sr->setNtpTimestamp(secondsToNTP(currentTime));
-	sr->setRtpTimestamp(timestamp);
-	sr->setPacketCount(packetCount);
-	sr->setOctetCount(payloadOctets);
-	sr->preparePacket(rtpConfig->ssrc, 0);
-
-	auto sdes = reinterpret_cast<RtcpSdes *>(msg->data() + srSize);
-	auto chunk = sdes->getChunk(0);
-	chunk->setSSRC(rtpConfig->ssrc);
-	auto item = chunk->getItem(0);
-	item->type = 1;
-	item->setText(rtpConfig->cname);
-	sdes->preparePacket(1);
-
-	mPreviousReportedTimestamp = timestamp;
+void RtcpSrReporter::setNeedsToReport() { group->needsToReport = true; }
+
+void RtcpSrReporter::enableAutomaticReports(std::chrono::milliseconds minInterval) {
+	std::lock_guard lock(group->mutex);
+	group->minInterval = minInterval;
+	group->timer.cancel();
+	group->automatic = true;
+	group->schedule(true);
+}
+
+void RtcpSrReporter::disableAutomaticReports() {
+	std::lock_guard lock(group->mutex);
+	group->automatic = false;
+	group->timer.cancel();
+}
+
+std::vector<RtcpSrReporter::Report> RtcpSrReporter::collectReports(uint32_t timestamp) {
+	// One SR per SSRC of the group, members which did not send yet are skipped
+	std::vector<Report> reports;
+	reports.reserve(group->members.size());
+	for (auto member : group->members) {
+		if (member != this && !member->lastTimestamp)
+			continue;
+
+		const uint32_t ts = member == this ? timestamp : *member->lastTimestamp;
+		const auto &config = member->rtpConfig;
+		const double currentTime = member->timeOffset + config->timestampToSeconds(ts);
+		reports.push_back({config->ssrc, config->cname, ts, secondsToNTP(currentTime),
+		                   member->packetCount, member->payloadOctets});
+
+		member->mPreviousReportedTimestamp = ts;
+	}
+
+	const double size = double(SenderReportSize(reports) + UdpIpHeaderSize);
+	group->avgReportSize =
+	    group->avgReportSize > 0 ? size / 16 + group->avgReportSize * 15 / 16 : size;
+
+	return reports;
+}
+
+size_t RtcpSrReporter::SenderReportSize(const std::vector<Report> &reports) {
+	size_t size = RtcpSr::Size(0) * reports.size();
+	for (size_t first = 0; first < reports.size(); first += MaxSdesChunks) {
+		const size_t count = std::min(reports.size() - first, MaxSdesChunks);
+		std::vector<std::vector<uint8_t>> lengths;
+		lengths.reserve(count);
+		for (size_t i = first; i < first + count; ++i)
+			lengths.push_back({uint8_t(reports[i].cname.size())});
+
+		size += RtcpSdes::Size(lengths);
+	}
+	return size;
+}
+
+message_ptr RtcpSrReporter::BuildSenderReport(const std::vector<Report> &reports) {
+	// The SRs are followed by SDES packets of at most 31 chunks, in a compound packet
+	auto msg = make_message(SenderReportSize(reports), Message::Control);
+	const auto srSize = RtcpSr::Size(0);
+	for (size_t i = 0; i < reports.size(); ++i) {
+		const auto &report = reports[i];
+		auto sr = reinterpret_cast<RtcpSr *>(msg->data() + srSize * i);
+		sr->setNtpTimestamp(report.ntpTimestamp);
+		sr->setRtpTimestamp(report.timestamp);
+		sr->setPacketCount(report.packetCount);
+		sr->setOctetCount(report.octetCount);
+		sr->preparePacket(report.ssrc, 0);
+	}
+
+	auto data = msg->data() + srSize * reports.size();
+	for (size_t first = 0; first < reports.size(); first += MaxSdesChunks) {
+		const size_t count = std::min(reports.size() - first, MaxSdesChunks);
+		auto sdes = reinterpret_cast<RtcpSdes *>(data);
+		for (size_t i = 0; i < count; ++i) {
+			const auto &report = reports[first + i];
+			auto chunk = sdes->getChunk(int(i));
+			chunk->setSSRC(report.ssrc);
+			auto item = chunk->getItem(0);
+			item->type = 1;
+			item->setText(report.cname);
+		}
+		sdes->preparePacket(uint8_t(count));
+		data += sdes->header.lengthInBytes();
+	}
 
 	return msg;
 }
@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtcptwccreporter.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/messagepool.hpp"
+
+#include <algorithm>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+const int64_t MaxStatusCount = 512; // keep feedback packets smaller than the MTU
+
+const int64_t ReferenceTimeUnit = 64000; // us
+const int64_t DeltaUnit = 250;           // us
+
+// Two-bit packet status symbols
+const uint8_t NotReceived = 0;
+const uint8_t SmallDelta = 1;
+const uint8_t LargeDelta = 2;
+
+} // namespace
+
+RtcpTwccReporter::RtcpTwccReporter(uint8_t _extensionId, std::chrono::milliseconds _interval)
+    : MediaHandlerElement(), extensionId(_extensionId), interval(_interval), start(clock::now()),
+      lastFeedback(start) {}
+
+ChainedIncomingProduct
+RtcpTwccReporter::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::lock_guard lock(mutex);
+	const auto now = clock::now();
+	for (const auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize)
+			continue;
+
+		RtpExtensionIndex extensions(message->data(), message->size());
+		auto value = extensions.transportSequenceNumber(extensionId);
+		if (!value)
+			continue;
+
+		auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+		const uint16_t seq = *value;
+		const int64_t unwrapped = highest ? *highest + int16_t(seq - uint16_t(*highest)) : seq;
+		if (nextBase && unwrapped < *nextBase)
+			continue; // too late, already reported as lost
+
+		// Packets straight from the transport carry their reception time
+		auto received = impl::MessagePool::Peek(message);
+		const auto arrival = received && received->arrivalTime ? *received->arrivalTime : now;
+		const auto time = std::chrono::duration_cast<std::chrono::microseconds>(arrival - start);
+		arrivals.emplace(unwrapped, time.count());
+		if (!highest || unwrapped > *highest)
+			highest = unwrapped;
+
+		mediaSsrc = rtp->ssrc();
+	}
+
+	if (arrivals.empty() || now - lastFeedback < interval)
+		return {messages};
+
+	lastFeedback = now;
+	return {messages, ChainedOutgoingProduct(nullptr, buildFeedback())};
+}
+
+message_ptr RtcpTwccReporter::buildFeedback() {
+	// Report all packets since the previous feedback, missing ones are reported as lost
+	const int64_t end = *highest + 1;
+	const int64_t base = std::max(nextBase.value_or(arrivals.begin()->first), end - MaxStatusCount);
+
+	auto first = arrivals.lower_bound(base);
+	const int64_t reference = first != arrivals.end() ? first->second / ReferenceTimeUnit : 0;
+	int64_t previous = reference * ReferenceTimeUnit;
+
+	std::vector<uint8_t> symbols;
+	symbols.reserve(size_t(end - base));
+	binary deltas;
+	for (int64_t seq = base; seq < end; ++seq) {
+		auto it = arrivals.find(seq);
+		if (it == arrivals.end()) {
+			symbols.push_back(NotReceived);
+			continue;
+		}
+
+		// Arrival times are relative to the previous packet, with a resolution of 250us
+		const int64_t delta = std::clamp((it->second - previous) / DeltaUnit, int64_t(INT16_MIN),
+		                                 int64_t(INT16_MAX));
+		previous += delta * DeltaUnit;
+		if (delta >= 0 && delta <= 0xFF) {
+			symbols.push_back(SmallDelta);
+			deltas.push_back(byte(delta));
+		} else {
+			symbols.push_back(LargeDelta);
+			deltas.push_back(byte((uint16_t(delta) >> 8) & 0xFF));
+			deltas.push_back(byte(uint16_t(delta) & 0xFF));
+		}
+	}
+
+	arrivals.clear();
+	nextBase = end;
+
+	// Runs of identical symbols are sent in run length chunks, others in two-bit vector chunks
+	binary body;
+	size_t i = 0;
+	while (i < symbols.size()) {
+		size_t run = 1;
+		while (i + run < symbols.size() && symbols[i + run] == symbols[i] && run < 0x1FFF)
+			++run;
+
+		uint16_t chunk;
+		if (run >= 7) {
+			chunk = uint16_t((symbols[i] << 13) | run);
+			i += run;
+		} else {
+			chunk = 0xC000;
+			for (size_t k = 0; k < 7 && i + k < symbols.size(); ++k)
+				chunk |= uint16_t(symbols[i + k] << (12 - 2 * k));
+			i += 7;
+		}
+		body.push_back(byte(chunk >> 8));
+		body.push_back(byte(chunk & 0xFF));
+	}
+	body.insert(body.end(), deltas.begin(), deltas.end());
+
+	auto message = make_message(RtcpTwcc::Size(body.size()), Message::Control);
+	auto twcc = reinterpret_cast<RtcpTwcc *>(message->data());
+	twcc->preparePacket(mediaSsrc, mediaSsrc, body.size());
+	twcc->setBaseSeqNumber(uint16_t(base));
+	twcc->setPacketStatusCount(uint16_t(end - base));
+	twcc->setReferenceTime(int32_t(reference & 0xFFFFFF));
+	twcc->setFeedbackCount(feedbackCount++);
+	std::copy(body.begin(), body.end(), reinterpret_cast<byte *>(twcc->getBody()));
+	return message;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
@@ -22,6 +22,7 @@
 
 #include "impl/internals.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
@@ -105,6 +106,8 @@ void RtpHeader::setTimestamp(uint32_t i) { _timestamp = htonl(i); }
 
 void RtpHeader::setExtension(bool extension) { _first = (_first & ~0x10) | ((extension & 1) << 4); }
 
+void RtpHeader::setPadding(bool padding) { _first = (_first & ~0x20) | ((padding & 1) << 5); }
+
 void RtpHeader::log() const {
 	PLOG_VERBOSE << "RtpHeader V: " << (int)version() << " P: " << (padding() ? "P" : " ")
 	             << " X: " << (extension() ? "X" : " ") << " CC: " << (int)csrcCount()
@@ -142,41 +145,313 @@ void RtpExtensionHeader::writeCurrentVideoOrientation(size_t offset, uint8_t id,
 	buf[1] = value;
 }
 
+void RtpExtensionHeader::writeOneByteHeader(size_t offset, uint8_t id, const byte *value,
+                                            size_t size) {
+	if ((id == 0) || (id > 14) || (size == 0) || (size > 16) || ((offset + 1 + size) > getSize()))
+		return;
+	auto buf = getBody() + offset;
+	buf[0] = char((id << 4) | (size - 1));
+	std::memcpy(buf + 1, value, size);
+}
+
+void RtpExtensionHeader::writeTwoByteHeader(size_t offset, uint8_t id, const byte *value,
+                                            size_t size) {
+	if ((id == 0) || (size > 255) || ((offset + 2 + size) > getSize()))
+		return;
+	auto buf = getBody() + offset;
+	buf[0] = char(id);
+	buf[1] = char(size);
+	if (size > 0)
+		std::memcpy(buf + 2, value, size);
+}
+
+const char *RtpExtensionHeader::findOneByteHeader(uint8_t id, size_t &size) const {
+	if (profileSpecificId() != 0xBEDE)
+		return nullptr;
+
+	auto buf = getBody();
+	const size_t total = getSize();
+	size_t offset = 0;
+	while (offset < total) {
+		const uint8_t first = uint8_t(buf[offset]);
+		if (first == 0) { // padding
+			++offset;
+			continue;
+		}
+		const uint8_t elementId = first >> 4;
+		if (elementId == 15) // reserved, stop parsing
+			break;
+
+		const size_t elementSize = (first & 0x0F) + 1;
+		if (offset + 1 + elementSize > total)
+			break;
+
+		if (elementId == id) {
+			size = elementSize;
+			return buf + offset + 1;
+		}
+		offset += 1 + elementSize;
+	}
+	return nullptr;
+}
+
+const char *RtpExtensionHeader::findTwoByteHeader(uint8_t id, size_t &size) const {
+	if ((profileSpecificId() & 0xFFF0) != 0x1000)
+		return nullptr;
+
+	auto buf = getBody();
+	const size_t total = getSize();
+	size_t offset = 0;
+	while (offset < total) {
+		const uint8_t elementId = uint8_t(buf[offset]);
+		if (elementId == 0) { // padding
+			++offset;
+			continue;
+		}
+		if (offset + 2 > total)
+			break;
+
+		const size_t elementSize = uint8_t(buf[offset + 1]);
+		if (offset + 2 + elementSize > total)
+			break;
+
+		if (elementId == id) {
+			size = elementSize;
+			return buf + offset + 2;
+		}
+		offset += 2 + elementSize;
+	}
+	return nullptr;
+}
+
+const char *RtpExtensionHeader::findHeader(uint8_t id, size_t &size) const {
+	if (auto value = findOneByteHeader(id, size))
+		return value;
+
+	return findTwoByteHeader(id, size);
+}
+
+optional<string> RtpExtensionHeader::findStringHeader(uint8_t id) const {
+	size_t size = 0;
+	auto value = findHeader(id, size);
+	if (!value)
+		return nullopt;
+
+	// Trailing null bytes are not part of the value
+	while (size > 0 && value[size - 1] == '\0')
+		--size;
+
+	return string(value, size);
+}
+
+RtpExtensionIndex::RtpExtensionIndex(const byte *packet, size_t size) { parse(packet, size); }
+
+bool RtpExtensionIndex::parse(const byte *packet, size_t size) {
+	clear();
+	mPacket = packet;
+
+	const size_t headerSize = 12;
+	if (size < headerSize)
+		return false;
+
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet);
+	if (!rtp->extension())
+		return true;
+
+	size_t offset = headerSize + rtp->csrcCount() * sizeof(SSRC);
+	if (offset + 4 > size)
+		return false;
+
+	auto extHeader = reinterpret_cast<const RtpExtensionHeader *>(packet + offset);
+	const uint16_t profile = extHeader->profileSpecificId();
+	offset += 4;
+	const size_t end = offset + extHeader->getSize();
+	if (end > size)
+		return false;
+
+	if (profile == 0xBEDE) {
+		mTwoByte = false;
+	} else if ((profile & 0xFFF0) == 0x1000) {
+		mTwoByte = true;
+	} else {
+		return true; // unknown form
+	}
+
+	auto buf = reinterpret_cast<const uint8_t *>(packet);
+	while (offset < end && mCount < MaxElements) {
+		if (buf[offset] == 0) { // padding
+			++offset;
+			continue;
+		}
+
+		uint8_t id;
+		size_t elementSize;
+		if (!mTwoByte) {
+			id = buf[offset] >> 4;
+			if (id == 15) // reserved, stop parsing
+				break;
+
+			elementSize = (buf[offset] & 0x0F) + 1;
+			offset += 1;
+		} else {
+			if (offset + 2 > end)
+				return false;
+
+			id = buf[offset];
+			elementSize = buf[offset + 1];
+			offset += 2;
+		}
+		if (offset + elementSize > end)
+			return false;
+
+		mElements[mCount++] = {id, uint8_t(elementSize), uint16_t(offset)};
+		offset += elementSize;
+	}
+	return true;
+}
+
+void RtpExtensionIndex::clear() {
+	mPacket = nullptr;
+	mCount = 0;
+	mTwoByte = false;
+}
+
+const RtpExtensionIndex::Element *RtpExtensionIndex::find(uint8_t id) const {
+	for (auto it = begin(); it != end(); ++it)
+		if (it->id == id)
+			return it;
+
+	return nullptr;
+}
+
+const byte *RtpExtensionIndex::value(uint8_t id, size_t &size) const {
+	auto element = find(id);
+	if (!element)
+		return nullptr;
+
+	size = element->size;
+	return mPacket + element->offset;
+}
+
+optional<uint32_t> RtpExtensionIndex::absSendTime(uint8_t id) const {
+	size_t size = 0;
+	auto v = reinterpret_cast<const uint8_t *>(value(id, size));
+	if (!v || size < 3)
+		return nullopt;
+
+	return (uint32_t(v[0]) << 16) | (uint32_t(v[1]) << 8) | uint32_t(v[2]);
+}
+
+optional<uint16_t> RtpExtensionIndex::transportSequenceNumber(uint8_t id) const {
+	size_t size = 0;
+	auto v = reinterpret_cast<const uint8_t *>(value(id, size));
+	if (!v || size < 2)
+		return nullopt;
+
+	return uint16_t((v[0] << 8) | v[1]);
+}
+
+optional<RtpExtensionIndex::AudioLevel> RtpExtensionIndex::audioLevel(uint8_t id) const {
+	size_t size = 0;
+	auto v = reinterpret_cast<const uint8_t *>(value(id, size));
+	if (!v || size < 1)
+		return nullopt;
+
+	return AudioLevel{(v[0] & 0x80) != 0, uint8_t(v[0] & 0x7F)};
+}
+
+optional<string_view> RtpExtensionIndex::stringValue(uint8_t id) const {
+	size_t size = 0;
+	auto v = reinterpret_cast<const char *>(value(id, size));
+	if (!v)
+		return nullopt;
+
+	// Trailing null bytes are not part of the value
+	while (size > 0 && v[size - 1] == '\0')
+		--size;
+
+	return string_view(v, size);
+}
+
+optional<RtpExtensionIndex::DependencyDescriptor>
+RtpExtensionIndex::dependencyDescriptor(uint8_t id) const {
+	size_t size = 0;
+	auto v = reinterpret_cast<const uint8_t *>(value(id, size));
+	if (!v || size < 3)
+		return nullopt;
+
+	return DependencyDescriptor{(v[0] & 0x80) != 0, (v[0] & 0x40) != 0, uint8_t(v[0] & 0x3F),
+	                            uint16_t((v[1] << 8) | v[2])};
+}
+
+bool RtpExtensionIndex::write(byte *packet, uint8_t id, const byte *value, size_t size) const {
+	auto element = find(id);
+	if (!element || element->size != size || packet != mPacket)
+		return false;
+
+	std::memcpy(packet + element->offset, value, size);
+	return true;
+}
+
+bool RtpExtensionIndex::writeAbsSendTime(byte *packet, uint8_t id, uint32_t time) const {
+	const byte value[3] = {byte(time >> 16), byte(time >> 8), byte(time)};
+	return write(packet, id, value, 3);
+}
+
+bool RtpExtensionIndex::writeTransportSequenceNumber(byte *packet, uint8_t id,
+                                                     uint16_t seq) const {
+	const byte value[2] = {byte(seq >> 8), byte(seq)};
+	return write(packet, id, value, 2);
+}
+
 SSRC RtcpReportBlock::getSSRC() const { return ntohl(_ssrc); }
 
-void RtcpReportBlock::preparePacket(SSRC in_ssrc, [[maybe_unused]] unsigned int packetsLost,
-                                    [[maybe_unused]] unsigned int totalPackets,
-                                    uint16_t highestSeqNo, uint16_t seqNoCycles, uint32_t jitter,
-                                    uint64_t lastSR_NTP, uint64_t lastSR_DELAY) {
+void RtcpReportBlock::preparePacket(SSRC in_ssrc, unsigned int packetsLost,
+                                    unsigned int totalPackets, uint16_t highestSeqNo,
+                                    uint16_t seqNoCycles, uint32_t jitter, uint64_t lastSR_NTP,
+                                    uint64_t lastSR_DELAY) {
 	setSeqNo(highestSeqNo, seqNoCycles);
 	setJitter(jitter);
 	setSSRC(in_ssrc);
+	setPacketsLost(packetsLost, totalPackets);
 
 	// Middle 32 bits of NTP Timestamp
-	// _lastReport = lastSR_NTP >> 16u;
 	setNTPOfSR(uint64_t(lastSR_NTP));
-	setDelaySinceSR(uint32_t(lastSR_DELAY));
 
 	// The delay, expressed in units of 1/65536 seconds
-	// _delaySinceLastReport = lastSR_DELAY;
+	setDelaySinceSR(uint32_t(lastSR_DELAY));
 }
 
 void RtcpReportBlock::setSSRC(SSRC in_ssrc) { _ssrc = htonl(in_ssrc); }
 
-void RtcpReportBlock::setPacketsLost([[maybe_unused]] unsigned int packetsLost,
-                                     [[maybe_unused]] unsigned int totalPackets) {
-	// TODO Implement loss percentages.
-	_fractionLostAndPacketsLost = 0;
+void RtcpReportBlock::setPacketsLost(unsigned int packetsLost, unsigned int totalPackets) {
+	const unsigned int fraction =
+	    totalPackets > 0 ? std::min(packetsLost, totalPackets) * 256 / totalPackets : 0;
+	setLoss(uint8_t(std::min(fraction, 255u)), int32_t(std::min(packetsLost, 0x7FFFFFu)));
+}
+
+void RtcpReportBlock::setLoss(uint8_t fractionLost, int32_t cumulativeLost) {
+	// The cumulative number of packets lost is a signed 24-bit value
+	cumulativeLost = std::clamp(cumulativeLost, -0x800000, 0x7FFFFF);
+	_fractionLostAndPacketsLost =
+	    htonl((uint32_t(fractionLost) << 24) | (uint32_t(cumulativeLost) & 0xFFFFFF));
+}
+
+uint8_t RtcpReportBlock::fractionLost() const {
+	return uint8_t(ntohl(_fractionLostAndPacketsLost) >> 24);
+}
+
+int32_t RtcpReportBlock::cumulativeLost() const {
+	const uint32_t value = ntohl(_fractionLostAndPacketsLost) & 0xFFFFFF;
+	return value & 0x800000 ? int32_t(value) - 0x1000000 : int32_t(value);
 }
 
 unsigned int RtcpReportBlock::getLossPercentage() const {
-	// TODO Implement loss percentages.
-	return 0;
+	return (unsigned int)(fractionLost()) * 100 / 256;
 }
 
 unsigned int RtcpReportBlock::getPacketLostCount() const {
-	// TODO Implement total packets lost.
-	return 0;
+	return unsigned(std::max(cumulativeLost(), 0));
 }
 
 uint16_t RtcpReportBlock::seqNoCycles() const { return ntohs(_seqNoCycles); }
@@ -194,9 +469,9 @@ void RtcpReportBlock::setSeqNo(uint16_t highestSeqNo, uint16_t seqNoCycles) {
 
 void RtcpReportBlock::setJitter(uint32_t jitter) { _jitter = htonl(jitter); }
 
-void RtcpReportBlock::setNTPOfSR(uint64_t ntp) { _lastReport = htonll(ntp >> 16u); }
+void RtcpReportBlock::setNTPOfSR(uint64_t ntp) { _lastReport = htonl(uint32_t(ntp >> 16u)); }
 
-uint32_t RtcpReportBlock::getNTPOfSR() const { return ntohl(_lastReport) << 16u; }
+uint64_t RtcpReportBlock::getNTPOfSR() const { return uint64_t(ntohl(_lastReport)) << 16u; }
 
 void RtcpReportBlock::setDelaySinceSR(uint32_t sr) {
 	// The delay, expressed in units of 1/65536 seconds
@@ -205,14 +480,10 @@ void RtcpReportBlock::setDelaySinceSR(uint32_t sr) {
 
 void RtcpReportBlock::log() const {
 	PLOG_VERBOSE << "RTCP report block: "
-	             << "ssrc="
-	             << ntohl(_ssrc)
-	             // TODO: Implement these reports
-	             //	<< ", fractionLost=" << fractionLost
-	             //	<< ", packetsLost=" << packetsLost
-	             << ", highestSeqNo=" << highestSeqNo() << ", seqNoCycles=" << seqNoCycles()
-	             << ", jitter=" << jitter() << ", lastSR=" << getNTPOfSR()
-	             << ", lastSRDelay=" << delaySinceSR();
+	             << "ssrc=" << ntohl(_ssrc) << ", fractionLost=" << unsigned(fractionLost())
+	             << ", packetsLost=" << cumulativeLost() << ", highestSeqNo=" << highestSeqNo()
+	             << ", seqNoCycles=" << seqNoCycles() << ", jitter=" << jitter()
+	             << ", lastSR=" << getNTPOfSR() << ", lastSRDelay=" << delaySinceSR();
 }
 
 uint8_t RtcpHeader::version() const { return _first >> 6; }
@@ -624,6 +895,48 @@ bool RtcpNack::addMissingPacket(unsigned int *fciCount, uint16_t *fciPID, uint16
 	}
 }
 
+unsigned int RtcpTwcc::Size(size_t bodySize) {
+	return unsigned(sizeof(RtcpTwcc) + (bodySize + 3) / 4 * 4);
+}
+
+uint16_t RtcpTwcc::baseSeqNumber() const { return ntohs(_baseSeqNumber); }
+
+uint16_t RtcpTwcc::packetStatusCount() const { return ntohs(_packetStatusCount); }
+
+int32_t RtcpTwcc::referenceTime() const {
+	// Sign-extend the 24-bit value
+	return int32_t(ntohl(_referenceTimeAndCount)) >> 8;
+}
+
+uint8_t RtcpTwcc::feedbackCount() const { return uint8_t(ntohl(_referenceTimeAndCount) & 0xFF); }
+
+const uint8_t *RtcpTwcc::getBody() const { return reinterpret_cast<const uint8_t *>(this + 1); }
+
+uint8_t *RtcpTwcc::getBody() { return reinterpret_cast<uint8_t *>(this + 1); }
+
+size_t RtcpTwcc::getBodySize() const { return header.header.lengthInBytes() - sizeof(RtcpTwcc); }
+
+void RtcpTwcc::preparePacket(SSRC senderSSRC, SSRC mediaSSRC, size_t bodySize) {
+	header.header.prepareHeader(205, 15, uint16_t(Size(bodySize) / 4 - 1));
+	header.setPacketSenderSSRC(senderSSRC);
+	header.setMediaSourceSSRC(mediaSSRC);
+}
+
+void RtcpTwcc::setBaseSeqNumber(uint16_t baseSeqNumber) { _baseSeqNumber = htons(baseSeqNumber); }
+
+void RtcpTwcc::setPacketStatusCount(uint16_t packetStatusCount) {
+	_packetStatusCount = htons(packetStatusCount);
+}
+
+void RtcpTwcc::setReferenceTime(int32_t referenceTime) {
+	_referenceTimeAndCount =
+	    htonl((uint32_t(referenceTime) << 8) | (ntohl(_referenceTimeAndCount) & 0xFF));
+}
+
+void RtcpTwcc::setFeedbackCount(uint8_t feedbackCount) {
+	_referenceTimeAndCount = htonl((ntohl(_referenceTimeAndCount) & 0xFFFFFF00) | feedbackCount);
+}
+
 uint16_t RtpRtx::getOriginalSeqNo() const { return ntohs(*(uint16_t *)(header.getBody())); }
 
 const char *RtpRtx::getBody() const { return header.getBody() + sizeof(uint16_t); }
@@ -640,17 +953,16 @@ size_t RtpRtx::normalizePacket(size_t totalSize, SSRC originalSSRC, uint8_t orig
 	header.setSeqNumber(getOriginalSeqNo());
 	header.setSsrc(originalSSRC);
 	header.setPayloadType(originalPayloadType);
-	// TODO, the -12 is the size of the header (which is variable!)
-	memmove(header.getBody(), getBody(), totalSize - getSize());
-	return totalSize - 2;
+	memmove(header.getBody(), getBody(), getBodySize(totalSize));
+	return totalSize - sizeof(uint16_t);
 }
 
 size_t RtpRtx::copyTo(RtpHeader *dest, size_t totalSize, uint8_t originalPayloadType) {
-	memmove((char *)dest, (char *)this, header.getSize());
+	memmove((char *)dest, (char *)this, header.getSize() + header.getExtensionHeaderSize());
 	dest->setSeqNumber(getOriginalSeqNo());
 	dest->setPayloadType(originalPayloadType);
 	memmove(dest->getBody(), getBody(), getBodySize(totalSize));
-	return totalSize;
+	return totalSize - sizeof(uint16_t);
 }
 
 }; // namespace rtc
@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtpdepacketizer.hpp"
+
+namespace rtc {
+
+RtpDepacketizer::RtpDepacketizer() {}
+
+RtpDepacketizer::~RtpDepacketizer() {}
+
+optional<RtpDepacketizer::Payload> RtpDepacketizer::parse(const binary &packet) {
+	const size_t minSize = 12;
+	if (packet.size() < minSize)
+		return nullopt;
+
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet.data());
+	if (rtp->version() != 2 || packet.size() < rtp->getSize() + (rtp->extension() ? 4 : 0))
+		return nullopt;
+
+	const size_t headerSize = rtp->getSize() + rtp->getExtensionHeaderSize();
+	if (packet.size() < headerSize)
+		return nullopt;
+
+	size_t size = packet.size() - headerSize;
+	if (rtp->padding()) {
+		const size_t paddingSize = size > 0 ? std::to_integer<size_t>(packet.back()) : 0;
+		if (paddingSize == 0 || paddingSize > size)
+			return nullopt;
+
+		size -= paddingSize;
+	}
+	return Payload{rtp, packet.data() + headerSize, size};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
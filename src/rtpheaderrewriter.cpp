@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtpheaderrewriter.hpp"
+#include "h264rtpdepacketizer.hpp"
+
+#include "impl/internals.hpp"
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+} // namespace
+
+RtpHeaderRewriter::RtpHeaderRewriter(SSRC _ssrc, uint32_t _clockRate,
+                                     keyframe_detector _isKeyframe)
+    : MediaHandlerElement(), ssrc(_ssrc), clockRate(_clockRate),
+      isKeyframe(_isKeyframe ? std::move(_isKeyframe) : H264RtpDepacketizer::IsKeyframe) {}
+
+void RtpHeaderRewriter::switchTo(SSRC source) {
+	{
+		std::lock_guard lock(mutex);
+		if (current && source == *current) {
+			pending.reset();
+			return;
+		}
+		if (pending && source == *pending)
+			return;
+
+		pending = source;
+	}
+
+	keyframeRequestCallback(source);
+}
+
+void RtpHeaderRewriter::stop() {
+	std::lock_guard lock(mutex);
+	current.reset();
+	pending.reset();
+}
+
+void RtpHeaderRewriter::onKeyframeRequest(std::function<void(SSRC ssrc)> callback) {
+	keyframeRequestCallback = std::move(callback);
+}
+
+optional<SSRC> RtpHeaderRewriter::selectedSsrc() const {
+	std::lock_guard lock(mutex);
+	return current;
+}
+
+optional<SSRC> RtpHeaderRewriter::pendingSsrc() const {
+	std::lock_guard lock(mutex);
+	return pending;
+}
+
+ChainedOutgoingProduct
+RtpHeaderRewriter::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                message_ptr control) {
+	std::lock_guard lock(mutex);
+	const auto now = clock::now();
+	auto out = messages->begin();
+	for (auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize)
+			continue;
+
+		auto rtp = reinterpret_cast<RtpHeader *>(message->data());
+		const SSRC source = rtp->ssrc();
+		if (pending && source == *pending && isKeyframe(*message)) {
+			current = pending;
+			pending.reset();
+			seqOffset = uint16_t(rtp->seqNumber() - (forwarded ? uint16_t(lastSeq + 1) : 0));
+			// Continue timestamps from the last forwarded packet with the elapsed time
+			const auto elapsed = std::chrono::duration<double>(now - lastForward).count();
+			const uint32_t timestamp =
+			    forwarded ? lastTimestamp + uint32_t(elapsed * clockRate) + 1 : 0;
+			timestampOffset = rtp->timestamp() - timestamp;
+		}
+
+		if (!current || source != *current)
+			continue; // dropped
+
+		rewrite(rtp, now);
+		*out++ = std::move(message);
+	}
+	messages->erase(out, messages->end());
+
+	return {messages, control};
+}
+
+ChainedIncomingControlProduct
+RtpHeaderRewriter::processIncomingControlMessage(message_ptr message) {
+	bool requested = false;
+	size_t offset = 0;
+	while (offset + sizeof(RtcpHeader) <= message->size()) {
+		auto header = reinterpret_cast<const RtcpHeader *>(message->data() + offset);
+		const size_t size = header->lengthInBytes();
+		if (size > message->size() - offset)
+			break;
+
+		// PLI or FIR
+		if (header->payloadType() == 206 &&
+		    (header->reportCount() == 1 || header->reportCount() == 4))
+			requested = true;
+
+		offset += size;
+	}
+
+	optional<SSRC> request;
+	if (requested) {
+		std::lock_guard lock(mutex);
+		request = pending ? pending : current;
+	}
+
+	if (request)
+		keyframeRequestCallback(*request);
+
+	return {message};
+}
+
+void RtpHeaderRewriter::rewrite(RtpHeader *rtp, clock::time_point now) {
+	const uint16_t seq = uint16_t(rtp->seqNumber() - seqOffset);
+	const uint32_t timestamp = rtp->timestamp() - timestampOffset;
+
+	// Reordered packets must not move the continuation point backwards
+	if (!forwarded || int16_t(seq - lastSeq) > 0) {
+		lastSeq = seq;
+		lastTimestamp = timestamp;
+		lastForward = now;
+		forwarded = true;
+	}
+
+	rtp->setSsrc(ssrc);
+	rtp->setSeqNumber(seq);
+	rtp->setTimestamp(timestamp);
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
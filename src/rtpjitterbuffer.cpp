@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtpjitterbuffer.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/logcounter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rtc {
+
+static impl::LogCounter COUNTER_BAD_RTP_HEADER(plog::warning, "Number of malformed RTP headers");
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+// Larger deviations from the expected transit are timestamp discontinuities, not jitter
+const double MaxTransitDeviation = 3000.; // ms
+
+size_t RoundUpPowerOfTwo(size_t value) {
+	size_t result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+} // namespace
+
+RtpJitterBuffer::Stream::Stream(size_t capacity) : packets(capacity), arrivals(capacity) {}
+
+RtpJitterBuffer::RtpJitterBuffer(uint32_t clockRate, std::chrono::milliseconds minDelay,
+                                 std::chrono::milliseconds maxDelay, size_t capacity)
+    : clockRate(clockRate), minDelay(minDelay), maxDelay(std::max(minDelay, maxDelay)),
+      capacity(RoundUpPowerOfTwo(std::clamp(capacity, size_t(2), size_t(32768)))) {
+	if (clockRate == 0)
+		throw std::invalid_argument("Invalid clock rate for jitter buffer");
+}
+
+ChainedIncomingProduct
+RtpJitterBuffer::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::lock_guard lock(mutex);
+	auto released = make_chained_messages_product();
+	const auto now = clock::now();
+	for (auto &message : *messages) {
+		auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+		if (message->size() < RtpHeaderMinSize || message->size() < rtp->getSize()) {
+			COUNTER_BAD_RTP_HEADER++;
+			continue;
+		}
+		auto it = streams.find(rtp->ssrc());
+		if (it == streams.end())
+			it = streams.emplace(rtp->ssrc(), Stream(capacity)).first;
+
+		insert(it->second, message, now, *released);
+	}
+
+	if (released->empty())
+		return {nullptr};
+
+	return {released};
+}
+
+std::chrono::milliseconds RtpJitterBuffer::delay(SSRC ssrc) const {
+	std::lock_guard lock(mutex);
+	auto it = streams.find(ssrc);
+	return it != streams.end() ? targetDelay(it->second) : minDelay;
+}
+
+void RtpJitterBuffer::insert(Stream &stream, binary_ptr packet, clock::time_point now,
+                             std::vector<binary_ptr> &released) {
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet->data());
+	const uint16_t seq = rtp->seqNumber();
+	if (!stream.next)
+		stream.next = seq;
+
+	const int16_t diff = int16_t(seq - *stream.next);
+	if (diff < 0 && size_t(-int(diff)) < capacity)
+		return; // late or duplicate packet
+
+	if (diff < 0 || size_t(diff) >= capacity) {
+		// The sequence jumped beyond the window, because the buffer overflows or the source
+		// restarted, flush it and restart from this packet
+		releaseAll(stream, released);
+		stream.next = seq;
+	}
+
+	// Update the interarrival jitter estimation with new packets
+	const uint32_t timestamp = rtp->timestamp();
+	if (stream.lastArrival) {
+		using double_ms = std::chrono::duration<double, std::milli>;
+		double arrival = double_ms(now - *stream.lastArrival).count();
+		double transit = double(int32_t(timestamp - stream.lastTimestamp)) * 1000. / clockRate;
+		double deviation = std::abs(arrival - transit);
+		if (deviation < MaxTransitDeviation)
+			stream.jitter += (deviation - stream.jitter) / 16.;
+	}
+	stream.lastArrival = now;
+	stream.lastTimestamp = timestamp;
+
+	const size_t slot = seq & (capacity - 1);
+	if (!stream.packets[slot]) {
+		stream.packets[slot] = std::move(packet);
+		stream.arrivals[slot] = now;
+		++stream.count;
+	}
+
+	release(stream, now, released);
+}
+
+void RtpJitterBuffer::release(Stream &stream, clock::time_point now,
+                              std::vector<binary_ptr> &released) {
+	const auto delay = targetDelay(stream);
+	while (stream.count > 0) {
+		size_t slot = *stream.next & (capacity - 1);
+		if (!stream.packets[slot]) {
+			// Find the first held packet, and skip missing packets if it waited long enough
+			uint16_t seq = *stream.next;
+			do {
+				slot = ++seq & (capacity - 1);
+			} while (!stream.packets[slot]);
+
+			if (now - stream.arrivals[slot] < delay)
+				break;
+
+			stream.next = seq;
+		}
+
+		released.push_back(std::move(stream.packets[slot]));
+		stream.packets[slot] = nullptr;
+		--stream.count;
+		stream.next = uint16_t(*stream.next + 1);
+	}
+}
+
+void RtpJitterBuffer::releaseAll(Stream &stream, std::vector<binary_ptr> &released) {
+	uint16_t seq = *stream.next;
+	while (stream.count > 0) {
+		const size_t slot = seq++ & (capacity - 1);
+		if (stream.packets[slot]) {
+			released.push_back(std::move(stream.packets[slot]));
+			stream.packets[slot] = nullptr;
+			--stream.count;
+		}
+	}
+}
+
+std::chrono::milliseconds RtpJitterBuffer::targetDelay(const Stream &stream) const {
+	// Wait for a few times the jitter so reordered packets are not considered lost
+	auto delay = std::chrono::milliseconds(int64_t(std::ceil(3. * stream.jitter)));
+	return std::clamp(delay, minDelay, maxDelay);
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
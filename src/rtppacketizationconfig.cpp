@@ -43,6 +43,7 @@ RtpPacketizationConfig::RtpPacketizationConfig(SSRC ssrc, string cname, uint8_t
 		this->timestamp = rand();
 	}
 	this->mStartTimestamp = this->timestamp;
+	this->transportSequenceNumber = std::make_shared<std::atomic<uint16_t>>(uint16_t(0));
 }
 
 void RtpPacketizationConfig::setStartTime(double startTime, EpochStart epochStart,
@@ -20,6 +20,8 @@
 
 #include "rtppacketizer.hpp"
 
+#include "impl/messagepool.hpp"
+
 #include <cstring>
 
 namespace rtc {
@@ -27,16 +29,40 @@ namespace rtc {
 RtpPacketizer::RtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig) : rtpConfig(rtpConfig) {}
 
 binary_ptr RtpPacketizer::packetize(shared_ptr<binary> payload, bool setMark) {
-	int rtpExtHeaderSize = 0;
+	auto msg = createPacket(payload->size(), setMark);
+	std::memcpy(msg->data() + msg->size() - payload->size(), payload->data(), payload->size());
+	return msg;
+}
+
+binary_ptr RtpPacketizer::createPacket(size_t payloadSize, bool setMark, uint8_t extensionId,
+                                       const binary *extension) {
+	size_t extBodySize = 0;
 	const bool setVideoRotation =
 		(rtpConfig->videoOrientationId != 0) &&
 		(rtpConfig->videoOrientationId < 15) &&  // needs fixing if longer extension headers are supported
 		setMark &&
 		(rtpConfig->videoOrientation != 0);
 	if (setVideoRotation) {
-		rtpExtHeaderSize = rtpExtHeaderCvoSize;
+		extBodySize += 2;
+	}
+	const bool setExtension = (extensionId != 0) && (extensionId < 15) && extension &&
+	                          !extension->empty() && (extension->size() <= 16);
+	if (setExtension) {
+		extBodySize += 1 + extension->size();
+	}
+	const bool setTransportSequenceNumber = (rtpConfig->transportSequenceNumberId != 0) &&
+	                                        (rtpConfig->transportSequenceNumberId < 15) &&
+	                                        rtpConfig->transportSequenceNumber;
+	if (setTransportSequenceNumber) {
+		extBodySize += 1 + 2;
 	}
-	auto msg = std::make_shared<binary>(rtpHeaderSize + rtpExtHeaderSize + payload->size());
+	// The one-byte header extension body is padded to a multiple of 4 bytes
+	const size_t extSize = extBodySize ? rtpExtHeaderSize + (extBodySize + 3) / 4 * 4 : 0;
+	const size_t size = rtpHeaderSize + extSize + payloadSize;
+	// The packet is a pooled message, so its storage is recycled once sent
+	binary_ptr msg = impl::MessagePool::Acquire();
+	msg->reserve(size + MediaTailroom); // so the packet is never reallocated until sent
+	msg->resize(size);
 	auto *rtp = (RtpHeader *)msg->data();
 	rtp->setPayloadType(rtpConfig->payloadType);
 	// increase sequence number
@@ -46,18 +72,31 @@ binary_ptr RtpPacketizer::packetize(shared_ptr<binary> payload, bool setMark) {
 	if (setMark) {
 		rtp->setMarker(true);
 	}
-	if (rtpExtHeaderSize) {
+	if (extSize) {
 		rtp->setExtension(true);
 
 		auto extHeader = rtp->getExtensionHeader();
 		extHeader->setProfileSpecificId(0xbede);
-		extHeader->setHeaderLength(1);
+		extHeader->setHeaderLength(uint16_t((extSize - rtpExtHeaderSize) / 4));
 		extHeader->clearBody();
-		extHeader->writeCurrentVideoOrientation(0,
-			rtpConfig->videoOrientationId, rtpConfig->videoOrientation);
+		size_t offset = 0;
+		if (setVideoRotation) {
+			extHeader->writeCurrentVideoOrientation(offset,
+				rtpConfig->videoOrientationId, rtpConfig->videoOrientation);
+			offset += 2;
+		}
+		if (setExtension) {
+			extHeader->writeOneByteHeader(offset, extensionId, extension->data(),
+			                              extension->size());
+			offset += 1 + extension->size();
+		}
+		if (setTransportSequenceNumber) {
+			const uint16_t seq = (*rtpConfig->transportSequenceNumber)++;
+			const byte value[2] = {byte(seq >> 8), byte(seq & 0xFF)};
+			extHeader->writeOneByteHeader(offset, rtpConfig->transportSequenceNumberId, value, 2);
+		}
 	}
 	rtp->preparePacket();
-	std::memcpy(msg->data() + rtpHeaderSize + rtpExtHeaderSize, payload->data(), payload->size());
 	return msg;
 }
 
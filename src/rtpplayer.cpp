@@ -0,0 +1,387 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtpplayer.hpp"
+#include "rtprecorder.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/threadpool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rtc {
+
+namespace {
+
+// See RtpRecorder for the file format
+const size_t FileHeaderSize = 16;
+const size_t ChunkHeaderSize = 12;
+const size_t RecordHeaderSize = 12;
+const size_t RtpHeaderMinSize = 12;
+
+template <typename T> T read(const byte *data) {
+	T value = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+		value = T(value << 8) | T(std::to_integer<uint8_t>(data[i]));
+
+	return value;
+}
+
+// Read-only memory mapping of a file
+class MappedFile final {
+public:
+	MappedFile(const string &path) {
+#ifdef _WIN32
+		mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		                    FILE_ATTRIBUTE_NORMAL, NULL);
+		if (mFile == INVALID_HANDLE_VALUE)
+			throw std::runtime_error("Unable to open recording file " + path);
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) {
+			CloseHandle(mFile);
+			throw std::runtime_error("Unable to map recording file " + path);
+		}
+		mSize = size_t(size.QuadPart);
+
+		mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		void *data = mMapping ? MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (!data) {
+			if (mMapping)
+				CloseHandle(mMapping);
+			CloseHandle(mFile);
+			throw std::runtime_error("Unable to map recording file " + path);
+		}
+		mData = static_cast<const byte *>(data);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Unable to open recording file " + path);
+
+		struct stat st;
+		void *data = MAP_FAILED;
+		if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+			mSize = size_t(st.st_size);
+			data = ::mmap(NULL, mSize, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		::close(fd); // the mapping keeps a reference to the file
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Unable to map recording file " + path);
+
+		// Records are read sequentially
+		::madvise(data, mSize, MADV_SEQUENTIAL);
+		mData = static_cast<const byte *>(data);
+#endif
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		UnmapViewOfFile(mData);
+		CloseHandle(mMapping);
+		CloseHandle(mFile);
+#else
+		::munmap(const_cast<byte *>(mData), mSize);
+#endif
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	const byte *data() const { return mData; }
+	size_t size() const { return mSize; }
+
+private:
+	const byte *mData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = NULL;
+#endif
+};
+
+} // namespace
+
+struct RtpPlayer::State : std::enable_shared_from_this<State> {
+	struct Record {
+		std::chrono::microseconds time;
+		const byte *data;
+		size_t size;
+	};
+
+	struct Output {
+		weak_ptr<Track> track;
+		Track::ForwardingRules rules;
+		optional<uint16_t> seqOffset; // set on the first packet if renumbering
+	};
+
+	State(const string &path);
+
+	optional<Record> record(size_t at) const; // record at an offset in the current chunk
+	void enter(size_t c);                     // moves to the beginning of a chunk
+	bool seek(std::chrono::microseconds position);
+	void schedule();
+	void play();
+
+	MappedFile file;
+	std::vector<RtpRecorder::IndexEntry> index;
+
+	// Protected by mutex
+	std::vector<Output> outputs;
+	bool playing = false;
+	size_t chunk = 0;    // index of the current chunk
+	size_t offset = 0;   // offset of the next record in the mapped file
+	size_t chunkEnd = 0; // end of the current chunk in the mapped file
+	clock::time_point startTime;           // when playing started
+	std::chrono::microseconds position{0}; // position when playing started
+	impl::TimerHandle timer;
+	std::mutex mutex;
+
+	synchronized_callback<> endedCallback;
+};
+
+RtpPlayer::State::State(const string &path) : file(path), index(RtpRecorder::ReadIndex(path)) {
+	if (file.size() < FileHeaderSize)
+		throw std::runtime_error("Invalid recording file " + path);
+
+	// Ignore entries of chunks which were not entirely written
+	auto it = std::find_if(index.begin(), index.end(), [this](const RtpRecorder::IndexEntry &e) {
+		return e.offset + ChunkHeaderSize > file.size() ||
+		       e.offset + ChunkHeaderSize + read<uint32_t>(file.data() + e.offset + 4) >
+		           file.size();
+	});
+	index.erase(it, index.end());
+}
+
+optional<RtpPlayer::State::Record> RtpPlayer::State::record(size_t at) const {
+	if (at + RecordHeaderSize > chunkEnd)
+		return nullopt;
+
+	const byte *data = file.data() + at;
+	const size_t size = read<uint32_t>(data + 8);
+	if (size > chunkEnd - at - RecordHeaderSize)
+		return nullopt;
+
+	return Record{std::chrono::microseconds(read<uint64_t>(data)), data + RecordHeaderSize,
+	              size};
+}
+
+void RtpPlayer::State::enter(size_t c) {
+	const size_t begin = size_t(index[c].offset);
+	chunk = c;
+	offset = begin + ChunkHeaderSize;
+	chunkEnd = offset + read<uint32_t>(file.data() + begin + 4);
+}
+
+bool RtpPlayer::State::seek(std::chrono::microseconds target) {
+	// Start from the last chunk beginning before the target
+	auto it = std::upper_bound(
+	    index.begin(), index.end(), target,
+	    [](std::chrono::microseconds t, const RtpRecorder::IndexEntry &e) { return t < e.time; });
+	chunk = it != index.begin() ? size_t(std::distance(index.begin(), it)) - 1 : 0;
+
+	for (; chunk < index.size(); ++chunk) {
+		enter(chunk);
+		while (auto r = record(offset)) {
+			if (r->time >= target)
+				return true;
+
+			offset += RecordHeaderSize + r->size;
+		}
+	}
+	return false;
+}
+
+void RtpPlayer::State::schedule() {
+	// mutex needs to be locked
+	optional<std::chrono::microseconds> next;
+	if (auto r = record(offset))
+		next = r->time;
+	else if (chunk + 1 < index.size())
+		next = index[chunk + 1].time;
+
+	if (!next) {
+		playing = false;
+		return;
+	}
+
+	timer = impl::ThreadPool::Instance().scheduleTimer(
+	    startTime + (*next - position), [weak_this = weak_from_this()]() {
+		    if (auto locked = weak_this.lock())
+			    locked->play();
+	    });
+}
+
+void RtpPlayer::State::play() {
+	std::vector<std::pair<shared_ptr<Track>, std::vector<binary>>> batches;
+	bool ended = false;
+	{
+		std::lock_guard lock(mutex);
+		if (!playing)
+			return;
+
+		using namespace std::chrono;
+		const auto now = position + duration_cast<microseconds>(clock::now() - startTime);
+
+		for (auto &output : outputs)
+			if (auto track = output.track.lock())
+				batches.emplace_back(std::move(track), std::vector<binary>{});
+
+		while (true) {
+			auto r = record(offset);
+			if (!r) {
+				if (chunk + 1 >= index.size())
+					break;
+
+				enter(chunk + 1);
+				continue;
+			}
+
+			if (r->time > now)
+				break;
+
+			offset += RecordHeaderSize + r->size;
+			if (r->size < RtpHeaderMinSize)
+				continue;
+
+			// Only the header of each copy is rewritten
+			size_t i = 0;
+			for (auto &output : outputs) {
+				if (output.track.expired())
+					continue;
+
+				auto &packet = batches[i++].second.emplace_back(r->data, r->data + r->size);
+				auto rtp = reinterpret_cast<RtpHeader *>(packet.data());
+				const auto &rules = output.rules;
+				if (rules.ssrc)
+					rtp->setSsrc(*rules.ssrc);
+
+				if (rules.payloadType)
+					rtp->setPayloadType(*rules.payloadType);
+
+				if (rules.firstSequenceNumber) {
+					if (!output.seqOffset)
+						output.seqOffset = uint16_t(*rules.firstSequenceNumber - rtp->seqNumber());
+
+					rtp->setSeqNumber(uint16_t(rtp->seqNumber() + *output.seqOffset));
+				}
+			}
+		}
+
+		schedule();
+		ended = !playing;
+	}
+
+	for (auto &[track, packets] : batches) {
+		if (packets.empty() || !track->isOpen())
+			continue;
+
+		try {
+			track->sendBatch(std::move(packets));
+
+		} catch (const std::exception &e) {
+			// The track was closed concurrently
+			PLOG_VERBOSE << "Playback failed: " << e.what();
+		}
+	}
+
+	if (ended)
+		endedCallback();
+}
+
+RtpPlayer::RtpPlayer(string path) : state(std::make_shared<State>(path)) {}
+
+RtpPlayer::~RtpPlayer() { stop(); }
+
+void RtpPlayer::addTrack(shared_ptr<Track> track, Track::ForwardingRules rules) {
+	std::lock_guard lock(state->mutex);
+	state->outputs.push_back(State::Output{track, std::move(rules), nullopt});
+}
+
+void RtpPlayer::removeTrack(shared_ptr<Track> track) {
+	std::lock_guard lock(state->mutex);
+	auto &outputs = state->outputs;
+	outputs.erase(std::remove_if(outputs.begin(), outputs.end(),
+	                             [&](const State::Output &o) {
+		                             auto t = o.track.lock();
+		                             return !t || t == track;
+	                             }),
+	              outputs.end());
+}
+
+void RtpPlayer::start(std::chrono::microseconds position) {
+	std::lock_guard lock(state->mutex);
+	state->timer.cancel();
+	state->playing = state->seek(position);
+	if (!state->playing)
+		return;
+
+	state->startTime = clock::now();
+	state->position = position;
+	state->schedule();
+}
+
+void RtpPlayer::stop() {
+	std::lock_guard lock(state->mutex);
+	state->playing = false;
+	state->timer.cancel();
+}
+
+bool RtpPlayer::isPlaying() const {
+	std::lock_guard lock(state->mutex);
+	return state->playing;
+}
+
+std::chrono::microseconds RtpPlayer::duration() const {
+	std::lock_guard lock(state->mutex);
+	if (state->index.empty())
+		return std::chrono::microseconds::zero();
+
+	// Walk the last chunk to find its last record
+	const auto &last = state->index.back();
+	const byte *data = state->file.data();
+	size_t at = size_t(last.offset) + ChunkHeaderSize;
+	const size_t end = at + read<uint32_t>(data + last.offset + 4);
+	auto result = last.time;
+	while (at + RecordHeaderSize <= end) {
+		result = std::chrono::microseconds(read<uint64_t>(data + at));
+		at += RecordHeaderSize + read<uint32_t>(data + at + 8);
+	}
+	return result;
+}
+
+void RtpPlayer::onEnded(std::function<void()> callback) {
+	state->endedCallback = std::move(callback);
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
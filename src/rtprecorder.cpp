@@ -0,0 +1,241 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtprecorder.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/processor.hpp"
+
+#include <cstring>
+#include <fstream>
+
+namespace rtc {
+
+namespace {
+
+const char RecordingMagic[] = "RTCREC01";
+const char IndexMagic[] = "RTCRIDX1";
+const char ChunkMagic[] = "RCHK";
+const size_t FileHeaderSize = 16;
+const size_t ChunkHeaderSize = 12;
+const size_t RecordHeaderSize = 12;
+const size_t IndexEntrySize = 16;
+
+void append(binary &b, const char *magic) {
+	auto p = reinterpret_cast<const byte *>(magic);
+	b.insert(b.end(), p, p + std::strlen(magic));
+}
+
+template <typename T> void append(binary &b, T value) {
+	for (int i = int(sizeof(T)) - 1; i >= 0; --i)
+		b.push_back(byte(uint8_t(value >> (i * 8))));
+}
+
+template <typename T> T read(const binary &b, size_t offset) {
+	T value = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+		value = T(value << 8) | T(std::to_integer<uint8_t>(b[offset + i]));
+
+	return value;
+}
+
+bool readExactly(std::ifstream &ifs, binary &b, size_t size) {
+	b.resize(size);
+	ifs.read(reinterpret_cast<char *>(b.data()), std::streamsize(size));
+	return size_t(ifs.gcount()) == size;
+}
+
+bool hasMagic(const binary &b, const char *magic) {
+	const size_t len = std::strlen(magic);
+	return b.size() >= len && std::memcmp(b.data(), magic, len) == 0;
+}
+
+void write(std::ofstream &ofs, const binary &b) {
+	ofs.write(reinterpret_cast<const char *>(b.data()), std::streamsize(b.size()));
+}
+
+} // namespace
+
+struct RtpRecorder::Writer {
+	Writer(const string &path, uint64_t startTime) {
+		data.open(path, std::ios::binary | std::ios::trunc);
+		if (!data)
+			throw std::runtime_error("Unable to open recording file " + path);
+
+		index.open(path + ".idx", std::ios::binary | std::ios::trunc);
+		if (!index)
+			throw std::runtime_error("Unable to open recording index file " + path + ".idx");
+
+		binary header;
+		append(header, RecordingMagic);
+		append(header, startTime);
+		write(data, header);
+		offset = header.size();
+
+		binary indexHeader;
+		append(indexHeader, IndexMagic);
+		write(index, indexHeader);
+	}
+
+	void writeChunk(binary chunk, std::chrono::microseconds time) {
+		// The chunk is written before its index entry so the index never points past the data
+		write(data, chunk);
+		data.flush();
+
+		binary entry;
+		append(entry, uint64_t(time.count()));
+		append(entry, offset);
+		write(index, entry);
+		index.flush();
+
+		if (!data || !index) {
+			LOG_ERROR << "Failed to write recording chunk";
+		}
+
+		offset += chunk.size();
+	}
+
+	std::ofstream data;
+	std::ofstream index;
+	uint64_t offset = 0;
+
+	// Declared last so pending writes are done before the files are closed
+	impl::Processor processor;
+};
+
+RtpRecorder::RtpRecorder(string path, size_t chunkSize, std::chrono::milliseconds chunkDuration)
+    : chunkSize(chunkSize), chunkDuration(chunkDuration), startTime(clock::now()) {
+	using namespace std::chrono;
+	const auto since = system_clock::now().time_since_epoch();
+	writer = std::make_unique<Writer>(path, uint64_t(duration_cast<microseconds>(since).count()));
+}
+
+RtpRecorder::~RtpRecorder() {
+	std::lock_guard lock(mutex);
+	flushChunk();
+	writer.reset();
+}
+
+void RtpRecorder::flush() {
+	std::lock_guard lock(mutex);
+	flushChunk();
+}
+
+ChainedIncomingProduct RtpRecorder::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	using namespace std::chrono;
+	std::lock_guard lock(mutex);
+	const auto now = duration_cast<microseconds>(clock::now() - startTime);
+	for (const auto &message : *messages) {
+		if (chunkCount == 0) {
+			chunk.reserve(std::min(chunkSize, size_t(64 * 1024)) + ChunkHeaderSize);
+			chunk.resize(ChunkHeaderSize); // filled when flushed
+			chunkTime = now;
+		}
+
+		append(chunk, uint64_t(now.count()));
+		append(chunk, uint32_t(message->size()));
+		chunk.insert(chunk.end(), message->begin(), message->end());
+		++chunkCount;
+	}
+
+	if (chunkCount > 0 && (chunk.size() >= chunkSize || now - chunkTime >= chunkDuration))
+		flushChunk();
+
+	return {messages};
+}
+
+void RtpRecorder::flushChunk() {
+	if (chunkCount == 0 || !writer)
+		return;
+
+	binary header;
+	append(header, ChunkMagic);
+	append(header, uint32_t(chunk.size() - ChunkHeaderSize));
+	append(header, chunkCount);
+	std::copy(header.begin(), header.end(), chunk.begin());
+
+	writer->processor.enqueue([w = writer.get(), c = std::move(chunk), t = chunkTime]() mutable {
+		w->writeChunk(std::move(c), t);
+	});
+	chunk = binary();
+	chunkCount = 0;
+}
+
+std::vector<RtpRecorder::IndexEntry> RtpRecorder::ReadIndex(const string &path) {
+	std::ifstream ifs(path + ".idx", std::ios::binary);
+	if (!ifs)
+		throw std::runtime_error("Unable to open recording index file " + path + ".idx");
+
+	binary b;
+	if (!readExactly(ifs, b, std::strlen(IndexMagic)) || !hasMagic(b, IndexMagic))
+		throw std::runtime_error("Invalid recording index file " + path + ".idx");
+
+	// A truncated last entry is ignored, the chunk might still be in the process of being written
+	std::vector<IndexEntry> entries;
+	while (readExactly(ifs, b, IndexEntrySize))
+		entries.push_back(IndexEntry{std::chrono::microseconds(read<uint64_t>(b, 0)),
+		                             read<uint64_t>(b, 8)});
+
+	return entries;
+}
+
+std::vector<RtpRecorder::Record> RtpRecorder::ReadChunk(const string &path, uint64_t offset) {
+	std::ifstream ifs(path, std::ios::binary);
+	if (!ifs)
+		throw std::runtime_error("Unable to open recording file " + path);
+
+	binary b;
+	if (!readExactly(ifs, b, FileHeaderSize) || !hasMagic(b, RecordingMagic))
+		throw std::runtime_error("Invalid recording file " + path);
+
+	ifs.seekg(std::streamoff(offset));
+	if (!readExactly(ifs, b, ChunkHeaderSize) || !hasMagic(b, ChunkMagic))
+		throw std::invalid_argument("No recording chunk at offset " + std::to_string(offset));
+
+	const uint32_t size = read<uint32_t>(b, 4);
+	const uint32_t count = read<uint32_t>(b, 8);
+	binary payload;
+	if (!readExactly(ifs, payload, size))
+		throw std::runtime_error("Truncated recording chunk at offset " + std::to_string(offset));
+
+	std::vector<Record> records;
+	records.reserve(count);
+	size_t pos = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (pos + RecordHeaderSize > payload.size())
+			throw std::runtime_error("Invalid recording chunk at offset " + std::to_string(offset));
+
+		const auto time = std::chrono::microseconds(read<uint64_t>(payload, pos));
+		const size_t recordSize = read<uint32_t>(payload, pos + 8);
+		pos += RecordHeaderSize;
+		if (recordSize > payload.size() - pos)
+			throw std::runtime_error("Invalid recording chunk at offset " + std::to_string(offset));
+
+		records.push_back(Record{time, binary(payload.begin() + pos,
+		                                      payload.begin() + pos + recordSize)});
+		pos += recordSize;
+	}
+
+	return records;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
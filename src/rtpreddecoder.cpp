@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtpreddecoder.hpp"
+
+#include "impl/internals.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+struct RedBlock {
+	uint8_t payloadType;
+	uint32_t timestampOffset;
+	size_t offset; // in the packet
+	size_t size;
+};
+
+} // namespace
+
+RtpRedDecoder::RtpRedDecoder(uint8_t _payloadType)
+    : MediaHandlerElement(), payloadType(_payloadType) {}
+
+ChainedIncomingProduct
+RtpRedDecoder::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::lock_guard lock(mutex);
+	auto result = make_chained_messages_product();
+	result->reserve(messages->size());
+	std::vector<RedBlock> blocks;
+	for (auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize) {
+			result->push_back(std::move(message));
+			continue;
+		}
+
+		auto rtp = reinterpret_cast<RtpHeader *>(message->data());
+		const uint16_t seq = rtp->seqNumber();
+		optional<uint16_t> lastSeq;
+		if (auto it = lastSeqs.find(rtp->ssrc()); it != lastSeqs.end()) {
+			lastSeq = it->second;
+			if (int16_t(seq - it->second) > 0)
+				it->second = seq;
+		} else {
+			lastSeqs.emplace(rtp->ssrc(), seq);
+		}
+
+		if (rtp->payloadType() != payloadType) {
+			result->push_back(std::move(message));
+			continue;
+		}
+
+		// RED packets don't use padding
+		const size_t headerSize = rtp->getSize() + rtp->getExtensionHeaderSize();
+		const auto *data = reinterpret_cast<const uint8_t *>(message->data());
+		size_t pos = headerSize;
+		blocks.clear();
+		while (pos < message->size() && (data[pos] & 0x80)) {
+			if (pos + 4 > message->size())
+				break;
+
+			RedBlock block;
+			block.payloadType = data[pos] & 0x7F;
+			block.timestampOffset = (uint32_t(data[pos + 1]) << 6) | (data[pos + 2] >> 2);
+			block.size = (size_t(data[pos + 2] & 0x03) << 8) | data[pos + 3];
+			blocks.push_back(block);
+			pos += 4;
+		}
+		if (pos >= message->size() || (data[pos] & 0x80)) {
+			LOG_VERBOSE << "Truncated RED header";
+			continue;
+		}
+
+		const uint8_t primaryType = data[pos] & 0x7F;
+		size_t offset = pos + 1;
+		bool valid = true;
+		for (auto &block : blocks) {
+			block.offset = offset;
+			offset += block.size;
+			if (offset > message->size())
+				valid = false;
+		}
+		if (!valid) {
+			LOG_VERBOSE << "Invalid RED block lengths";
+			continue;
+		}
+
+		// Restore missing packets, the last block is assumed to be the previous packet
+		const size_t baseSize = rtp->getSize();
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			const auto &block = blocks[i];
+			const uint16_t blockSeq = uint16_t(seq - (blocks.size() - i));
+			if (!lastSeq || int16_t(blockSeq - *lastSeq) <= 0)
+				continue; // not missing
+
+			// Header extensions belong to the carrying packet and are not copied
+			auto restored = std::make_shared<binary>(message->begin(),
+			                                         message->begin() + baseSize);
+			restored->insert(restored->end(), message->begin() + block.offset,
+			                 message->begin() + block.offset + block.size);
+			auto header = reinterpret_cast<RtpHeader *>(restored->data());
+			header->setExtension(false);
+			header->setMarker(false);
+			header->setPayloadType(block.payloadType);
+			header->setSeqNumber(blockSeq);
+			header->setTimestamp(rtp->timestamp() - block.timestampOffset);
+			result->push_back(std::move(restored));
+		}
+
+		// Keep the primary payload in place
+		std::memmove(message->data() + headerSize, message->data() + offset,
+		             message->size() - offset);
+		message->resize(headerSize + message->size() - offset);
+		rtp = reinterpret_cast<RtpHeader *>(message->data());
+		rtp->setPayloadType(primaryType);
+		result->push_back(std::move(message));
+	}
+
+	return {result};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtpredencoder.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/messagepool.hpp"
+
+#include <cstring>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+const uint32_t MaxTimestampOffset = (1 << 14) - 1; // 14-bit field
+const size_t MaxBlockSize = (1 << 10) - 1;         // 10-bit field
+
+} // namespace
+
+RtpRedEncoder::RtpRedEncoder(uint8_t _payloadType, unsigned int _redundancy)
+    : MediaHandlerElement(), payloadType(_payloadType), redundancy(_redundancy) {}
+
+ChainedOutgoingProduct RtpRedEncoder::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                                   message_ptr control) {
+	std::lock_guard lock(mutex);
+	for (auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize)
+			continue;
+
+		auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+		const size_t headerSize = rtp->getSize() + rtp->getExtensionHeaderSize();
+		size_t end = message->size();
+		if (rtp->padding() && end > headerSize)
+			end -= std::min(size_t(std::to_integer<uint8_t>(message->back())), end - headerSize);
+
+		if (headerSize > end)
+			continue;
+
+		const uint8_t primaryType = rtp->payloadType();
+		const uint32_t timestamp = rtp->timestamp();
+
+		// Older blocks are only sent if their offset and size fit in the block header
+		while (!previous.empty() && (timestamp - previous.front().timestamp > MaxTimestampOffset))
+			previous.pop_front();
+
+		size_t size = headerSize + 1 + (end - headerSize);
+		for (const auto &block : previous)
+			if (block.payload.size() <= MaxBlockSize)
+				size += 4 + block.payload.size();
+
+		binary_ptr packet = impl::MessagePool::Acquire();
+		packet->reserve(size + MediaTailroom);
+		packet->resize(size);
+		std::memcpy(packet->data(), message->data(), headerSize);
+
+		auto red = reinterpret_cast<RtpHeader *>(packet->data());
+		red->_first &= ~0x20; // padding was removed
+		red->setPayloadType(payloadType);
+
+		auto *p = reinterpret_cast<uint8_t *>(packet->data()) + headerSize;
+		for (const auto &block : previous) {
+			if (block.payload.size() > MaxBlockSize)
+				continue;
+
+			const uint32_t offset = timestamp - block.timestamp;
+			const size_t length = block.payload.size();
+			*p++ = 0x80 | (block.payloadType & 0x7F);
+			*p++ = uint8_t(offset >> 6);
+			*p++ = uint8_t(((offset & 0x3F) << 2) | (length >> 8));
+			*p++ = uint8_t(length & 0xFF);
+		}
+		*p++ = primaryType & 0x7F;
+
+		for (const auto &block : previous) {
+			if (block.payload.size() > MaxBlockSize)
+				continue;
+
+			std::memcpy(p, block.payload.data(), block.payload.size());
+			p += block.payload.size();
+		}
+		std::memcpy(p, message->data() + headerSize, end - headerSize);
+
+		if (redundancy > 0) {
+			binary payload(message->begin() + headerSize, message->begin() + end);
+			previous.push_back(Block{primaryType, timestamp, std::move(payload)});
+			if (previous.size() > redundancy)
+				previous.pop_front();
+		}
+
+		message = std::move(packet);
+	}
+
+	return {messages, control};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
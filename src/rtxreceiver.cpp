@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "rtxreceiver.hpp"
+
+#include "impl/internals.hpp"
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+} // namespace
+
+RtxReceiver::RtxReceiver(SSRC _ssrc, SSRC _rtxSsrc)
+    : MediaHandlerElement(), ssrc(_ssrc), rtxSsrc(_rtxSsrc) {}
+
+void RtxReceiver::addPayloadType(uint8_t rtxPayloadType, uint8_t payloadType) {
+	std::lock_guard lock(mutex);
+	payloadTypes[rtxPayloadType] = payloadType;
+}
+
+ChainedIncomingProduct RtxReceiver::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::lock_guard lock(mutex);
+	auto result = make_chained_messages_product();
+	result->reserve(messages->size());
+	for (auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize) {
+			result->push_back(std::move(message));
+			continue;
+		}
+
+		auto rtx = reinterpret_cast<RtpRtx *>(message->data());
+		if (rtx->header.ssrc() != rtxSsrc) {
+			result->push_back(std::move(message));
+			continue;
+		}
+
+		auto it = payloadTypes.find(rtx->header.payloadType());
+		if (it == payloadTypes.end()) {
+			LOG_VERBOSE << "Unknown RTX payload type " << int(rtx->header.payloadType());
+			continue;
+		}
+
+		const size_t bodyOffset = rtx->header.getBody() - reinterpret_cast<char *>(message->data());
+		if (bodyOffset > message->size())
+			continue; // truncated
+
+		// Padding comes after the original payload, so it is removed before unwrapping, as it
+		// is not part of the original packet
+		size_t size = message->size();
+		if (rtx->header.padding()) {
+			const size_t paddingSize = std::to_integer<size_t>(message->back());
+			if (paddingSize == 0 || bodyOffset + paddingSize > size)
+				continue; // invalid padding
+
+			size -= paddingSize;
+			rtx->header.setPadding(false);
+		}
+
+		if (bodyOffset + sizeof(uint16_t) > size)
+			continue; // padding-only packet, used for bandwidth probing
+
+		message->resize(rtx->normalizePacket(size, ssrc, it->second));
+		result->push_back(std::move(message));
+	}
+
+	return {result};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
@@ -0,0 +1,229 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "simulcastforwarder.hpp"
+#include "h264rtpdepacketizer.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+const auto MeasureWindow = std::chrono::milliseconds(500);
+const auto LayerTimeout = std::chrono::seconds(1); // a layer is inactive after this duration
+const double UpswitchMargin = 1.15; // higher layers must fit the target with this margin
+
+} // namespace
+
+SimulcastForwarder::SimulcastForwarder(SSRC _ssrc, uint32_t _clockRate,
+                                       keyframe_detector _isKeyframe)
+    : MediaHandlerElement(), ssrc(_ssrc), clockRate(_clockRate),
+      isKeyframe(_isKeyframe ? std::move(_isKeyframe) : H264RtpDepacketizer::IsKeyframe) {}
+
+void SimulcastForwarder::setRidExtensionId(uint8_t id) {
+	std::lock_guard lock(mutex);
+	ridExtensionId = id;
+}
+
+void SimulcastForwarder::setTargetBitrate(unsigned int bitrate) {
+	std::lock_guard lock(mutex);
+	targetBitrate = bitrate;
+}
+
+void SimulcastForwarder::onKeyframeRequest(std::function<void(SSRC ssrc)> callback) {
+	keyframeRequestCallback = std::move(callback);
+}
+
+optional<SSRC> SimulcastForwarder::selectedSsrc() const {
+	std::lock_guard lock(mutex);
+	return current;
+}
+
+optional<string> SimulcastForwarder::selectedRid() const {
+	std::lock_guard lock(mutex);
+	if (!current)
+		return nullopt;
+
+	auto it = layers.find(*current);
+	return it != layers.end() ? it->second.rid : nullopt;
+}
+
+ChainedOutgoingProduct
+SimulcastForwarder::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                 message_ptr control) {
+	optional<SSRC> request;
+	{
+		std::lock_guard lock(mutex);
+		const auto now = clock::now();
+		auto out = messages->begin();
+		for (auto &message : *messages) {
+			if (message->size() < RtpHeaderMinSize)
+				continue;
+
+			auto rtp = reinterpret_cast<RtpHeader *>(message->data());
+			const SSRC source = rtp->ssrc();
+			auto &layer = layers[source];
+			if (layer.bytes == 0 && layer.bitrate == 0)
+				layer.windowStart = now;
+
+			layer.bytes += message->size();
+			layer.lastPacket = now;
+			if (ridExtensionId && !layer.rid) {
+				RtpExtensionIndex extensions(message->data(), message->size());
+				if (auto rid = extensions.stringValue(ridExtensionId))
+					layer.rid = string(*rid);
+			}
+
+			if (now - lastUpdate >= MeasureWindow) {
+				updateLayers(now);
+				lastUpdate = now;
+			}
+
+			if (auto selected = select(now); selected != current && selected != pending) {
+				pending = selected;
+				request = pending;
+			}
+
+			if (pending && source == *pending && isKeyframe(*message)) {
+				current = pending;
+				pending.reset();
+				seqOffset = uint16_t(rtp->seqNumber() - (forwarded ? uint16_t(lastSeq + 1) : 0));
+				// Continue timestamps from the last forwarded packet with the elapsed time
+				const auto elapsed = std::chrono::duration<double>(now - lastForward).count();
+				const uint32_t timestamp =
+				    forwarded ? lastTimestamp + uint32_t(elapsed * clockRate) + 1 : 0;
+				timestampOffset = rtp->timestamp() - timestamp;
+			}
+
+			if (!current || source != *current)
+				continue; // dropped
+
+			rewrite(rtp, now);
+			*out++ = std::move(message);
+		}
+		messages->erase(out, messages->end());
+	}
+
+	if (request)
+		keyframeRequestCallback(*request);
+
+	return {messages, control};
+}
+
+ChainedIncomingControlProduct
+SimulcastForwarder::processIncomingControlMessage(message_ptr message) {
+	bool requested = false;
+	size_t offset = 0;
+	while (offset + sizeof(RtcpHeader) <= message->size()) {
+		auto header = reinterpret_cast<const RtcpHeader *>(message->data() + offset);
+		const size_t size = header->lengthInBytes();
+		if (size > message->size() - offset)
+			break;
+
+		// PLI or FIR
+		if (header->payloadType() == 206 &&
+		    (header->reportCount() == 1 || header->reportCount() == 4))
+			requested = true;
+
+		offset += size;
+	}
+
+	optional<SSRC> request;
+	if (requested) {
+		std::lock_guard lock(mutex);
+		request = pending ? pending : current;
+	}
+
+	if (request)
+		keyframeRequestCallback(*request);
+
+	return {message};
+}
+
+optional<SSRC> SimulcastForwarder::select(clock::time_point now) const {
+	// Select the highest measured bitrate fitting the target, or the lowest one if none fits
+	optional<SSRC> lowest, best;
+	double lowestBitrate = 0, bestBitrate = 0;
+	double currentBitrate = 0;
+	if (auto it = current ? layers.find(*current) : layers.end(); it != layers.end())
+		currentBitrate = it->second.bitrate;
+
+	for (const auto &[source, layer] : layers) {
+		if (layer.bitrate == 0 || now - layer.lastPacket > LayerTimeout)
+			continue;
+
+		if (!lowest || layer.bitrate < lowestBitrate) {
+			lowest = source;
+			lowestBitrate = layer.bitrate;
+		}
+
+		// Switching up needs a margin to prevent oscillations
+		const double required = layer.bitrate > currentBitrate && (!current || source != *current)
+		                            ? layer.bitrate * UpswitchMargin
+		                            : layer.bitrate;
+		if (required <= double(targetBitrate) && layer.bitrate > bestBitrate) {
+			best = source;
+			bestBitrate = layer.bitrate;
+		}
+	}
+
+	return best ? best : lowest;
+}
+
+void SimulcastForwarder::updateLayers(clock::time_point now) {
+	auto it = layers.begin();
+	while (it != layers.end()) {
+		auto &layer = it->second;
+		if (now - layer.lastPacket > LayerTimeout && (!current || it->first != *current) &&
+		    (!pending || it->first != *pending)) {
+			it = layers.erase(it);
+			continue;
+		}
+
+		const double elapsed = std::chrono::duration<double>(now - layer.windowStart).count();
+		if (elapsed >= std::chrono::duration<double>(MeasureWindow).count()) {
+			const double bitrate = layer.bytes * 8 / elapsed;
+			layer.bitrate = layer.bitrate > 0 ? 0.5 * layer.bitrate + 0.5 * bitrate : bitrate;
+			layer.bytes = 0;
+			layer.windowStart = now;
+		}
+		++it;
+	}
+}
+
+void SimulcastForwarder::rewrite(RtpHeader *rtp, clock::time_point now) {
+	lastSeq = uint16_t(rtp->seqNumber() - seqOffset);
+	lastTimestamp = rtp->timestamp() - timestampOffset;
+	lastForward = now;
+	forwarded = true;
+
+	rtp->setSsrc(ssrc);
+	rtp->setSeqNumber(lastSeq);
+	rtp->setTimestamp(lastTimestamp);
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
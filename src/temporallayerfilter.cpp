@@ -0,0 +1,376 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "temporallayerfilter.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+const auto MeasureWindow = std::chrono::milliseconds(500);
+const double UpswitchMargin = 1.15; // upper layers must fit the target with this margin
+
+const uint8_t StapANalUnitType = 24;
+const uint8_t FuANalUnitType = 28;
+
+class BitReader {
+public:
+	BitReader(const uint8_t *data, size_t size) : mData(data), mSize(size) {}
+
+	uint32_t read(int bits) {
+		uint32_t value = 0;
+		while (bits-- > 0) {
+			value <<= 1;
+			if (mPos < mSize * 8)
+				value |= (mData[mPos / 8] >> (7 - mPos % 8)) & 0x01;
+
+			++mPos;
+		}
+		return value;
+	}
+
+	bool overflow() const { return mPos > mSize * 8; }
+
+private:
+	const uint8_t *mData;
+	size_t mSize;
+	size_t mPos = 0;
+};
+
+uint8_t clampLayer(unsigned int layer) {
+	return uint8_t(std::min(layer, unsigned(TemporalLayerFilter::MaxLayers - 1)));
+}
+
+} // namespace
+
+TemporalLayerFilter::TemporalLayerFilter(Codec _codec)
+    : MediaHandlerElement(), codec(_codec), windowStart(clock::now()) {}
+
+void TemporalLayerFilter::setDependencyDescriptorExtensionId(uint8_t id) {
+	std::lock_guard lock(mutex);
+	dependencyDescriptorId = id;
+}
+
+void TemporalLayerFilter::setTargetBitrate(unsigned int bitrate) {
+	std::lock_guard lock(mutex);
+	targetBitrate = bitrate;
+}
+
+void TemporalLayerFilter::setMaxLayer(optional<uint8_t> _maxLayer) {
+	std::lock_guard lock(mutex);
+	maxLayer = _maxLayer;
+}
+
+uint8_t TemporalLayerFilter::forwardedLayer() const {
+	std::lock_guard lock(mutex);
+	return layer;
+}
+
+uint64_t TemporalLayerFilter::droppedFrames() const {
+	std::lock_guard lock(mutex);
+	return dropped;
+}
+
+ChainedOutgoingProduct
+TemporalLayerFilter::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                  message_ptr control) {
+	std::lock_guard lock(mutex);
+	auto out = messages->begin();
+	for (auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize)
+			continue;
+
+		auto rtp = reinterpret_cast<RtpHeader *>(message->data());
+		const uint32_t timestamp = rtp->timestamp();
+		const uint16_t seq = rtp->seqNumber();
+
+		// Look for the frame in the recent ones, the newest first
+		const Frame *frame = nullptr;
+		for (size_t i = 0; i < std::min(frameCount, frames.size()) && !frame; ++i) {
+			const auto &f = frames[(frameCount - 1 - i) % frames.size()];
+			if (f.timestamp == timestamp)
+				frame = &f;
+		}
+
+		if (!frame) {
+			const auto &newest = frames[(frameCount + frames.size() - 1) % frames.size()];
+			if (frameCount > 0 && int32_t(timestamp - newest.timestamp) < 0)
+				continue; // late packet of a frame too old to be known, dropped
+
+			startFrame(*message, timestamp, seq);
+			frame = &frames[(frameCount - 1) % frames.size()];
+		}
+
+		layerBytes[frame->layer] += message->size();
+		if (frame->dropped)
+			continue;
+
+		const uint16_t rewritten = uint16_t(seq - frame->seqOffset);
+		if (!forwarded || int16_t(rewritten - lastSeq) > 0)
+			lastSeq = rewritten;
+
+		forwarded = true;
+		rtp->setSeqNumber(rewritten);
+		*out++ = std::move(message);
+	}
+	messages->erase(out, messages->end());
+	return {messages, control};
+}
+
+void TemporalLayerFilter::startFrame(const binary &packet, uint32_t timestamp, uint16_t seq) {
+	// A frame without layer information is kept, as it might be a reference
+	const FrameInfo info = parse(packet).value_or(FrameInfo{});
+
+	const auto now = clock::now();
+	if (now - windowStart >= MeasureWindow)
+		updateBitrates(now);
+
+	// Layers are removed at once, but restored only where no dropped frame is referenced anymore
+	const uint8_t selected = select();
+	if (selected < layer || (selected > layer && (info.layer == 0 || info.switchingPoint))) {
+		PLOG_VERBOSE << "Forwarding temporal layers up to " << int(selected);
+		layer = selected;
+	}
+
+	const auto &previous = frames[(frameCount + frames.size() - 1) % frames.size()];
+	Frame frame;
+	frame.timestamp = timestamp;
+	frame.layer = info.layer;
+	frame.dropped = info.layer > layer;
+	if (frame.dropped) {
+		++dropped;
+	} else if (frameCount > 0 && previous.dropped && forwarded) {
+		// Continue the sequence after the last forwarded packet to hide the dropped frames
+		seqOffset = uint16_t(seq - uint16_t(lastSeq + 1));
+	}
+	frame.seqOffset = seqOffset;
+
+	frames[frameCount++ % frames.size()] = frame;
+}
+
+uint8_t TemporalLayerFilter::select() const {
+	const uint8_t cap = clampLayer(maxLayer.value_or(MaxLayers - 1));
+	if (targetBitrate == 0)
+		return cap;
+
+	// Layers are cumulative, each one needs the lower ones to be decoded
+	double total = 0;
+	uint8_t selected = 0;
+	for (uint8_t l = 0; l <= cap; ++l) {
+		total += layerBitrates[l];
+		const double required = l > layer ? total * UpswitchMargin : total;
+		if (l > 0 && required > double(targetBitrate))
+			break;
+
+		selected = l;
+	}
+	return selected;
+}
+
+void TemporalLayerFilter::updateBitrates(clock::time_point now) {
+	const double elapsed = std::chrono::duration<double>(now - windowStart).count();
+	for (size_t l = 0; l < MaxLayers; ++l) {
+		const double bitrate = layerBytes[l] * 8 / elapsed;
+		layerBitrates[l] = layerBitrates[l] > 0 ? 0.5 * layerBitrates[l] + 0.5 * bitrate : bitrate;
+		layerBytes[l] = 0;
+	}
+	windowStart = now;
+}
+
+optional<TemporalLayerFilter::FrameInfo> TemporalLayerFilter::parse(const binary &packet) {
+	if (dependencyDescriptorId)
+		if (auto info = parseDependencyDescriptor(packet))
+			return info;
+
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet.data());
+	auto payload = reinterpret_cast<const uint8_t *>(rtp->getBody());
+	auto end = reinterpret_cast<const uint8_t *>(packet.data()) + packet.size();
+	if (rtp->padding() && payload < end)
+		end -= std::min(size_t(end[-1]), size_t(end - payload));
+
+	if (payload >= end)
+		return nullopt;
+
+	switch (codec) {
+	case Codec::H264:
+		return parseH264(payload, end);
+	case Codec::VP8:
+		return parseVP8(payload, end);
+	case Codec::VP9:
+		return parseVP9(payload, end);
+	default:
+		return nullopt;
+	}
+}
+
+optional<TemporalLayerFilter::FrameInfo>
+TemporalLayerFilter::parseDependencyDescriptor(const binary &packet) {
+	RtpExtensionIndex extensions(packet.data(), packet.size());
+	size_t size = 0;
+	auto value = reinterpret_cast<const uint8_t *>(extensions.value(dependencyDescriptorId, size));
+	if (!value || size < 3)
+		return nullopt;
+
+	// The template dependency structure is sent with keyframes, only the layers of templates
+	// are read from it as temporal IDs are sufficient to drop frames
+	bool structurePresent = false;
+	if (size > 3) {
+		BitReader reader(value + 3, size - 3);
+		structurePresent = reader.read(1) != 0;
+		reader.read(4); // active decode targets, custom DTIs, fdiffs, and chains flags
+		if (structurePresent) {
+			const uint32_t templateIdOffset = reader.read(6);
+			reader.read(5); // decode targets count minus one
+			std::array<uint8_t, 64> layers = {};
+			unsigned int temporalId = 0;
+			uint32_t nextLayer = 0;
+			for (uint32_t i = 0; i < 64 && nextLayer != 3; ++i) {
+				layers[(templateIdOffset + i) % 64] = clampLayer(temporalId);
+				nextLayer = reader.read(2);
+				if (nextLayer == 1)
+					++temporalId;
+				else if (nextLayer == 2)
+					temporalId = 0; // next spatial layer
+			}
+			if (reader.overflow())
+				return nullopt;
+
+			templateLayers = layers;
+			hasTemplates = true;
+		}
+	}
+
+	if (!hasTemplates)
+		return nullopt;
+
+	FrameInfo info;
+	info.layer = templateLayers[value[0] & 0x3F];
+	info.switchingPoint = structurePresent;
+	return info;
+}
+
+optional<TemporalLayerFilter::FrameInfo>
+TemporalLayerFilter::parseH264(const uint8_t *payload, const uint8_t *end) const {
+	// The temporal ID is in the SVC extension of prefix NAL units, otherwise frames with
+	// nal_ref_idc 0 are not referenced
+	optional<unsigned int> temporalId;
+	bool known = false, reference = false;
+	auto inspect = [&](uint8_t header, const uint8_t *extension) {
+		const uint8_t type = header & 0x1F;
+		if (type == 14 || type == 20) {
+			if (extension + 3 <= end && (extension[0] & 0x80))
+				temporalId = std::max(temporalId.value_or(0), unsigned(extension[2] >> 5));
+
+			return;
+		}
+		if (type == 6 || type == 9 || type == 12)
+			return; // SEI, access unit delimiter, and filler data don't tell
+
+		known = true;
+		reference = reference || (header & 0x60) != 0;
+	};
+
+	const uint8_t type = payload[0] & 0x1F;
+	if (type == StapANalUnitType) {
+		auto p = payload + 1;
+		while (p + 3 <= end) {
+			const size_t size = (size_t(p[0]) << 8) | p[1];
+			inspect(p[2], p + 3);
+			p += 2 + size;
+		}
+	} else if (type == FuANalUnitType) {
+		// The NAL unit header is only complete in the first fragment
+		if (payload + 1 < end)
+			inspect(uint8_t((payload[0] & 0xE0) | (payload[1] & 0x1F)),
+			        (payload[1] & 0x80) ? payload + 2 : end);
+	} else {
+		inspect(payload[0], payload + 1);
+	}
+
+	if (temporalId)
+		return FrameInfo{clampLayer(*temporalId), false};
+
+	if (!known)
+		return nullopt;
+
+	// As nothing depends on a non-reference frame, they can be restored at any time
+	return reference ? FrameInfo{0, false} : FrameInfo{1, true};
+}
+
+optional<TemporalLayerFilter::FrameInfo>
+TemporalLayerFilter::parseVP8(const uint8_t *payload, const uint8_t *end) const {
+	// See RFC 7741 4.2
+	const bool nonReference = (payload[0] & 0x20) != 0; // N
+	if (payload[0] & 0x80) {                            // X
+		auto p = payload + 1;
+		if (p >= end)
+			return nullopt;
+
+		const uint8_t extension = *p++;
+		if (extension & 0x80) { // I, 7 or 15-bit picture ID
+			if (p >= end)
+				return nullopt;
+
+			p += (*p & 0x80) ? 2 : 1;
+		}
+		if (extension & 0x40) // L, TL0PICIDX
+			++p;
+
+		if (extension & 0x20) { // T, TID and Y for layer sync
+			if (p >= end)
+				return nullopt;
+
+			return FrameInfo{clampLayer(*p >> 6), (*p & 0x20) != 0};
+		}
+	}
+
+	return nonReference ? FrameInfo{1, true} : FrameInfo{0, false};
+}
+
+optional<TemporalLayerFilter::FrameInfo>
+TemporalLayerFilter::parseVP9(const uint8_t *payload, const uint8_t *end) const {
+	// See RFC 9628 4.2
+	const bool interPredicted = (payload[0] & 0x40) != 0; // P
+	auto p = payload + 1;
+	if (payload[0] & 0x80) { // I, 7 or 15-bit picture ID
+		if (p >= end)
+			return nullopt;
+
+		p += (*p & 0x80) ? 2 : 1;
+	}
+	if (payload[0] & 0x20) { // L, TID, U for switching up point, SID, and D
+		if (p >= end)
+			return nullopt;
+
+		return FrameInfo{clampLayer(*p >> 5), (*p & 0x10) != 0 || !interPredicted};
+	}
+
+	return FrameInfo{0, !interPredicted};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
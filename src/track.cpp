@@ -36,11 +36,32 @@ void Track::setDescription(Description::Media description) {
 	impl()->setDescription(std::move(description));
 }
 
+std::vector<RtpStreamStats> Track::stats() const { return impl()->stats(); }
+
+optional<RtpStreamStats> Track::stats(uint32_t ssrc) const { return impl()->stats(ssrc); }
+
 void Track::close() { impl()->close(); }
 
 bool Track::send(message_variant data) { return impl()->outgoing(make_message(std::move(data))); }
 
-bool Track::send(const byte *data, size_t size) { return send(binary(data, data + size)); }
+bool Track::send(const byte *data, size_t size) {
+	auto message = make_message(size_t(0));
+	message->reserve(size + MediaTailroom);
+	message->assign(data, data + size);
+	return impl()->outgoing(std::move(message));
+}
+
+bool Track::sendBatch(std::vector<binary> messages) {
+	std::vector<message_ptr> batch;
+	batch.reserve(messages.size());
+	for (auto &data : messages) {
+		auto message = make_message(size_t(0));
+		message->reserve(data.size() + MediaTailroom);
+		message->assign(data.begin(), data.end());
+		batch.push_back(std::move(message));
+	}
+	return impl()->outgoingBatch(std::move(batch));
+}
 
 bool Track::isOpen(void) const { return impl()->isOpen(); }
 
@@ -61,4 +82,33 @@ bool Track::requestKeyframe() {
 
 shared_ptr<MediaHandler> Track::getMediaHandler() { return impl()->getMediaHandler(); }
 
+void Track::forwardTo(shared_ptr<Track> target, ForwardingRules rules) {
+	if (!target)
+		throw std::invalid_argument("Forwarding target is null");
+
+	if (target.get() == this)
+		throw std::invalid_argument("Track can't forward to itself");
+
+	impl()->forwardTo(target->impl(), std::move(rules));
+}
+
+void Track::forwardTo(shared_ptr<Track> target) { forwardTo(std::move(target), ForwardingRules{}); }
+
+void Track::stopForwarding(shared_ptr<Track> target) {
+	if (target)
+		impl()->stopForwarding(target->impl());
+}
+
+unsigned int Track::dscp() const { return impl()->dscp(); }
+
+void Track::setDscp(unsigned int dscp) { impl()->setDscp(dscp); }
+
+void Track::setReceiveQueueLimit(optional<size_t> amount) {
+	impl()->setReceiveQueueLimit(amount);
+}
+
+void Track::onTargetBitrate(std::function<void(unsigned int bitrate)> callback) {
+	impl()->targetBitrateCallback = callback;
+}
+
 } // namespace rtc
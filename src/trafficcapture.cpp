@@ -0,0 +1,218 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "trafficcapture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <tuple>
+
+namespace rtc {
+
+namespace {
+
+const char CaptureMagic[] = "RTCCAP01";
+const char ChunkMagic[] = "CCHK";
+const size_t FileHeaderSize = 16;
+const size_t ChunkHeaderSize = 12;
+const size_t RecordHeaderSize = 13;
+const uint8_t OutgoingFlag = 0x80;
+
+const size_t SctpCommonHeaderSize = 12;
+const size_t SctpDataHeaderSize = 16;
+const uint8_t SctpDataChunkType = 0;
+const size_t SctpIDataHeaderSize = 20; // RFC 8260 2.1
+const uint8_t SctpIDataChunkType = 64;
+const uint8_t SctpUnorderedFlag = 0x04;
+const uint8_t SctpBeginningFlag = 0x02;
+const uint8_t SctpEndingFlag = 0x01;
+
+template <typename T> T read(const binary &b, size_t offset) {
+	T value = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+		value = T(value << 8) | T(std::to_integer<uint8_t>(b[offset + i]));
+
+	return value;
+}
+
+bool readExactly(std::ifstream &ifs, binary &b, size_t size) {
+	b.resize(size);
+	ifs.read(reinterpret_cast<char *>(b.data()), std::streamsize(size));
+	return size_t(ifs.gcount()) == size;
+}
+
+bool hasMagic(const binary &b, const char *magic) {
+	const size_t len = std::strlen(magic);
+	return b.size() >= len && std::memcmp(b.data(), magic, len) == 0;
+}
+
+} // namespace
+
+TrafficCapture::TrafficCapture(const string &path) {
+	std::ifstream ifs(path, std::ios::binary);
+	if (!ifs)
+		throw std::runtime_error("Unable to open capture file " + path);
+
+	binary b;
+	if (!readExactly(ifs, b, FileHeaderSize) || !hasMagic(b, CaptureMagic))
+		throw std::runtime_error("Invalid capture file " + path);
+
+	// The last chunk might still be in the process of being written
+	binary payload;
+	while (readExactly(ifs, b, ChunkHeaderSize)) {
+		if (!hasMagic(b, ChunkMagic))
+			throw std::runtime_error("Invalid capture chunk in " + path);
+
+		const uint32_t size = read<uint32_t>(b, 4);
+		const uint32_t count = read<uint32_t>(b, 8);
+		if (!readExactly(ifs, payload, size))
+			break;
+
+		size_t pos = 0;
+		for (uint32_t i = 0; i < count; ++i) {
+			if (pos + RecordHeaderSize > payload.size())
+				throw std::runtime_error("Invalid capture chunk in " + path);
+
+			const auto time = std::chrono::microseconds(read<uint64_t>(payload, pos));
+			const uint8_t type = read<uint8_t>(payload, pos + 8);
+			const size_t recordSize = read<uint32_t>(payload, pos + 9);
+			pos += RecordHeaderSize;
+			if (recordSize > payload.size() - pos)
+				throw std::runtime_error("Invalid capture chunk in " + path);
+
+			mRecords.push_back(Record{time, Type(type & ~OutgoingFlag), (type & OutgoingFlag) != 0,
+			                          binary(payload.begin() + pos,
+			                                 payload.begin() + pos + recordSize)});
+			pos += recordSize;
+		}
+	}
+}
+
+std::chrono::microseconds TrafficCapture::duration() const {
+	return !mRecords.empty() ? mRecords.back().time : std::chrono::microseconds::zero();
+}
+
+std::vector<TrafficCapture::SctpMessage> TrafficCapture::sctpMessages(bool outgoing) const {
+	struct Fragment {
+		std::chrono::microseconds time;
+		uint8_t flags;
+		uint16_t stream;
+		uint32_t ppid;
+		binary data;
+	};
+
+	// Fragments of a message have consecutive TSNs, so chunks are sorted by unwrapped TSN, which
+	// also discards retransmissions
+	std::map<int64_t, Fragment> fragments;
+	optional<uint32_t> lastTsn;
+	int64_t lastUnwrapped = 0;
+
+	// With message interleaving, fragments of I-DATA chunks are identified by the message ID on
+	// the stream and the fragment sequence number instead, which also discards retransmissions
+	using MessageKey = std::tuple<uint16_t, bool, uint32_t>; // stream, unordered, and MID
+	std::map<MessageKey, std::map<uint32_t, Fragment>> interleaved;
+	for (const auto &record : mRecords) {
+		if (record.type != Type::Sctp || record.outgoing != outgoing)
+			continue;
+
+		const binary &packet = record.data;
+		size_t pos = SctpCommonHeaderSize;
+		while (pos + 4 <= packet.size()) {
+			const uint8_t chunkType = read<uint8_t>(packet, pos);
+			const uint8_t flags = read<uint8_t>(packet, pos + 1);
+			const size_t length = read<uint16_t>(packet, pos + 2);
+			if (length < 4 || length > packet.size() - pos)
+				break;
+
+			if (chunkType == SctpDataChunkType && length >= SctpDataHeaderSize) {
+				const uint32_t tsn = read<uint32_t>(packet, pos + 4);
+				lastUnwrapped = lastTsn ? lastUnwrapped + int32_t(tsn - *lastTsn) : 0;
+				lastTsn = tsn;
+				fragments.emplace(lastUnwrapped,
+				                  Fragment{record.time, flags, read<uint16_t>(packet, pos + 8),
+				                           read<uint32_t>(packet, pos + 12),
+				                           binary(packet.begin() + pos + SctpDataHeaderSize,
+				                                  packet.begin() + pos + length)});
+
+			} else if (chunkType == SctpIDataChunkType && length >= SctpIDataHeaderSize) {
+				// The first fragment carries the PPID instead of the FSN, which is 0
+				const bool first = flags & SctpBeginningFlag;
+				const uint32_t ppidOrFsn = read<uint32_t>(packet, pos + 16);
+				const MessageKey key{read<uint16_t>(packet, pos + 8),
+				                     (flags & SctpUnorderedFlag) != 0,
+				                     read<uint32_t>(packet, pos + 12)};
+				interleaved[key].emplace(first ? 0 : ppidOrFsn,
+				                         Fragment{record.time, flags, std::get<0>(key),
+				                                  first ? ppidOrFsn : 0,
+				                                  binary(packet.begin() + pos + SctpIDataHeaderSize,
+				                                         packet.begin() + pos + length)});
+			}
+
+			pos += (length + 3) & ~size_t(3); // chunks are padded to 4 bytes
+		}
+	}
+
+	std::vector<SctpMessage> messages;
+	optional<SctpMessage> current;
+	int64_t expected = 0;
+	for (auto &[tsn, fragment] : fragments) {
+		if (current && tsn != expected)
+			current.reset(); // a fragment is missing from the capture
+
+		if (fragment.flags & SctpBeginningFlag)
+			current.emplace(SctpMessage{fragment.time, fragment.stream, fragment.ppid,
+			                            (fragment.flags & SctpUnorderedFlag) != 0, {}});
+
+		if (current) {
+			current->time = std::max(current->time, fragment.time);
+			current->data.insert(current->data.end(), fragment.data.begin(), fragment.data.end());
+			if (fragment.flags & SctpEndingFlag) {
+				messages.push_back(std::move(*current));
+				current.reset();
+			}
+		}
+
+		expected = tsn + 1;
+	}
+
+	for (auto &[key, messageFragments] : interleaved) {
+		// Fragments must be contiguous from the beginning to the end of the message
+		auto first = messageFragments.begin();
+		auto last = std::prev(messageFragments.end());
+		if (!(first->second.flags & SctpBeginningFlag) || !(last->second.flags & SctpEndingFlag) ||
+		    first->first != 0 || last->first != messageFragments.size() - 1)
+			continue; // a fragment is missing from the capture
+
+		SctpMessage message{first->second.time, std::get<0>(key), first->second.ppid,
+		                    std::get<1>(key), {}};
+		for (auto &[fsn, fragment] : messageFragments) {
+			message.time = std::max(message.time, fragment.time);
+			message.data.insert(message.data.end(), fragment.data.begin(), fragment.data.end());
+		}
+		messages.push_back(std::move(message));
+	}
+
+	std::stable_sort(messages.begin(), messages.end(),
+	                 [](const SctpMessage &a, const SctpMessage &b) { return a.time < b.time; });
+	return messages;
+}
+
+} // namespace rtc
@@ -0,0 +1,602 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "twccbandwidthestimator.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/messagepool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+
+const int64_t ReferenceTimeUnit = 64000; // us
+const int64_t DeltaUnit = 250;           // us
+
+const int64_t GroupDuration = 5000;         // us, packets sent in this duration are grouped
+const int64_t AckedWindow = 500000;         // us, window for the acknowledged bitrate
+const int64_t MinAckedSpan = 100000;        // us
+const int64_t MinDecreaseInterval = 200000; // us
+
+const double SmoothingCoeff = 0.9;
+const double ThresholdGain = 4.0;
+const double OverusingTime = 10.0; // ms
+const double ThresholdUp = 0.0087;
+const double ThresholdDown = 0.039;
+const double DecreaseFactor = 0.85;
+const double IncreaseRate = 1.08; // per second
+
+const size_t MinLossPackets = 20;
+
+const double MarkedFractionGain = 1.0 / 16; // like DCTCP
+
+const double InitialProbeFactors[] = {3.0, 6.0}; // of the initial bitrate
+const double ProbeFactor = 2.0;                  // of the result of a successful probe
+const double ProbeSuccessRatio = 0.8;
+const double ProbeMinReceivedRatio = 0.8;
+const int64_t ProbeDuration = 15000;  // us
+const int64_t ProbeTimeout = 1000000; // us
+const size_t MinProbePackets = 5;
+const size_t MaxProbePackets = 100;
+const size_t PaddingSize = 255;
+const size_t ProbeExtensionSize = 8; // one-byte header extension with the sequence number
+
+optional<uint16_t> GetTransportSequenceNumber(const binary &packet, uint8_t extensionId) {
+	if (packet.size() < RtpHeaderMinSize)
+		return nullopt;
+
+	return RtpExtensionIndex(packet.data(), packet.size()).transportSequenceNumber(extensionId);
+}
+
+} // namespace
+
+TwccBandwidthEstimator::TwccBandwidthEstimator(uint8_t _extensionId, unsigned int initialBitrate,
+                                               unsigned int _minBitrate, unsigned int _maxBitrate)
+    : MediaHandlerElement(), extensionId(_extensionId), minBitrate(double(_minBitrate)),
+      maxBitrate(double(std::max(_minBitrate, _maxBitrate))), start(clock::now()),
+      history(HistorySize) {
+	delayBitrate = std::clamp(double(initialBitrate), minBitrate, maxBitrate);
+	lossBitrate = delayBitrate;
+	currentTarget = unsigned(delayBitrate);
+}
+
+ChainedOutgoingProduct
+TwccBandwidthEstimator::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                     message_ptr control) {
+	std::lock_guard lock(mutex);
+	const int64_t now =
+	    std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+	for (const auto &message : *messages) {
+		if (auto seq = GetTransportSequenceNumber(*message, extensionId))
+			history[*seq % HistorySize] = SentPacket{true, *seq, now, message->size()};
+	}
+
+	if (probing && !messages->empty()) {
+		if (!probing->started) {
+			// Probe as soon as media starts to ramp up quickly after connection setup
+			probing->started = true;
+			for (double factor : InitialProbeFactors)
+				pendingProbes.push_back(std::min(factor * double(currentTarget), maxBitrate));
+		}
+
+		if (!pendingProbes.empty()) {
+			const auto &last = messages->back();
+			const uint32_t timestamp =
+			    last->size() >= RtpHeaderMinSize
+			        ? reinterpret_cast<const RtpHeader *>(last->data())->timestamp()
+			        : 0;
+			for (double bitrate : pendingProbes)
+				sendProbe(bitrate, timestamp, now, *messages);
+
+			pendingProbes.clear();
+		}
+	}
+
+	return {messages, control};
+}
+
+void TwccBandwidthEstimator::processSentBinaryMessage(const message_ptr &message) {
+	auto seq = GetTransportSequenceNumber(*message, extensionId);
+	if (!seq)
+		return;
+
+	// Packets may be held back by the pacer, so the send time is updated on release
+	std::lock_guard lock(mutex);
+	auto &sent = history[*seq % HistorySize];
+	if (sent.valid && sent.seq == *seq)
+		sent.time =
+		    std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+}
+
+ChainedIncomingControlProduct
+TwccBandwidthEstimator::processIncomingControlMessage(message_ptr message) {
+	optional<unsigned int> report;
+	{
+		std::lock_guard lock(mutex);
+		// Feedback is timed on reception, before the handoffs to the processor
+		const auto received = message->arrivalTime.value_or(clock::now());
+		const int64_t now =
+		    std::chrono::duration_cast<std::chrono::microseconds>(received - start).count();
+		size_t p = 0;
+		while (p + sizeof(RtcpHeader) <= message->size()) {
+			auto header = reinterpret_cast<const RtcpHeader *>(message->data() + p);
+			const size_t length = header->lengthInBytes();
+			if (length > message->size() - p)
+				break;
+
+			if (header->payloadType() == 205 && header->reportCount() == 15 &&
+			    length >= sizeof(RtcpTwcc))
+				processFeedback(reinterpret_cast<const RtcpTwcc *>(header), now);
+			else if (header->payloadType() == 205 && header->reportCount() == 11)
+				processCongestionFeedback(reinterpret_cast<const uint8_t *>(header), length, now);
+
+			p += length;
+		}
+
+		const auto target = unsigned(std::clamp(std::min(delayBitrate, lossBitrate), minBitrate,
+		                                        maxBitrate));
+		if (target != currentTarget) {
+			currentTarget = target;
+			report = target;
+		}
+	}
+
+	// Report outside of the lock as the callback might query the estimator
+	if (report)
+		reportTargetBitrate(*report);
+
+	return {message};
+}
+
+unsigned int TwccBandwidthEstimator::targetBitrate() const {
+	std::lock_guard lock(mutex);
+	return currentTarget;
+}
+
+void TwccBandwidthEstimator::enableProbing(
+    SSRC ssrc, uint8_t payloadType, shared_ptr<std::atomic<uint16_t>> transportSequenceNumber) {
+	if (extensionId == 0 || extensionId >= 15)
+		throw std::invalid_argument("Probing requires a one-byte header extension ID");
+
+	if (!transportSequenceNumber)
+		throw std::invalid_argument("Probing requires a transport-wide sequence number counter");
+
+	std::lock_guard lock(mutex);
+	probing.emplace(
+	    Probing{ssrc, payloadType, std::move(transportSequenceNumber), uint16_t(rand())});
+}
+
+void TwccBandwidthEstimator::probe(unsigned int bitrate) {
+	std::lock_guard lock(mutex);
+	if (probing && pendingProbes.size() < MaxProbeClusters)
+		pendingProbes.push_back(std::clamp(double(bitrate), minBitrate, maxBitrate));
+}
+
+void TwccBandwidthEstimator::sendProbe(double bitrate, uint32_t timestamp, int64_t now,
+                                       std::vector<binary_ptr> &out) {
+	// A cluster is a burst of padding-only packets lasting the probe duration at the bitrate,
+	// the last byte of the padding is its length
+	// See https://www.rfc-editor.org/rfc/rfc3550.html#section-5.1
+	const size_t packetSize = RtpHeaderMinSize + ProbeExtensionSize + PaddingSize;
+	const double bytes = bitrate * double(ProbeDuration) / 8e6;
+	const size_t count =
+	    std::clamp(size_t(bytes / double(packetSize)) + 1, MinProbePackets, MaxProbePackets);
+
+	ProbeCluster cluster{nextClusterId++, bitrate, now};
+	cluster.sentCount = count;
+	out.reserve(out.size() + count);
+	for (size_t i = 0; i < count; ++i) {
+		binary_ptr packet = impl::MessagePool::Acquire();
+		packet->reserve(packetSize + MediaTailroom);
+		packet->resize(packetSize);
+		auto rtp = reinterpret_cast<RtpHeader *>(packet->data());
+		rtp->preparePacket();
+		rtp->setPadding(true);
+		rtp->setExtension(true);
+		rtp->setPayloadType(probing->payloadType);
+		rtp->setSeqNumber(probing->sequenceNumber++);
+		rtp->setTimestamp(timestamp);
+		rtp->setSsrc(probing->ssrc);
+
+		const uint16_t seq = (*probing->transportSequenceNumber)++;
+		const byte value[2] = {byte(seq >> 8), byte(seq & 0xFF)};
+		auto extHeader = rtp->getExtensionHeader();
+		extHeader->setProfileSpecificId(0xbede);
+		extHeader->setHeaderLength(uint16_t((ProbeExtensionSize - 4) / 4));
+		extHeader->clearBody();
+		extHeader->writeOneByteHeader(0, extensionId, value, 2);
+		packet->back() = byte(PaddingSize);
+
+		history[seq % HistorySize] = SentPacket{true, seq, now, packetSize, cluster.id};
+		out.push_back(std::move(packet));
+	}
+
+	clusters.push_back(std::move(cluster));
+	while (clusters.size() > MaxProbeClusters)
+		clusters.pop_front();
+}
+
+void TwccBandwidthEstimator::processFeedback(const RtcpTwcc *twcc, int64_t now) {
+	const uint8_t *body = twcc->getBody();
+	const size_t bodySize = twcc->getBodySize();
+	const uint16_t base = twcc->baseSeqNumber();
+	const size_t count = twcc->packetStatusCount();
+
+	// Packet status chunks
+	std::vector<uint8_t> symbols;
+	symbols.reserve(count);
+	size_t offset = 0;
+	while (symbols.size() < count) {
+		if (offset + 2 > bodySize)
+			return; // truncated
+
+		const uint16_t chunk = uint16_t((body[offset] << 8) | body[offset + 1]);
+		offset += 2;
+		if (!(chunk & 0x8000)) {
+			// Run length chunk
+			const uint8_t symbol = (chunk >> 13) & 0x03;
+			for (size_t k = 0; k < size_t(chunk & 0x1FFF) && symbols.size() < count; ++k)
+				symbols.push_back(symbol);
+		} else if (!(chunk & 0x4000)) {
+			// One-bit status vector chunk
+			for (int k = 0; k < 14 && symbols.size() < count; ++k)
+				symbols.push_back((chunk >> (13 - k)) & 0x01);
+		} else {
+			// Two-bit status vector chunk
+			for (int k = 0; k < 7 && symbols.size() < count; ++k)
+				symbols.push_back((chunk >> (12 - 2 * k)) & 0x03);
+		}
+	}
+
+	// Receive deltas
+	std::vector<PacketResult> results;
+	results.reserve(count);
+	size_t lost = 0, total = 0;
+	int64_t arrivalTime = int64_t(twcc->referenceTime()) * ReferenceTimeUnit;
+	for (size_t i = 0; i < count; ++i) {
+		const uint16_t seq = uint16_t(base + i);
+		auto &sent = history[seq % HistorySize];
+		const bool known = sent.valid && sent.seq == seq;
+		if (symbols[i] == 0) {
+			if (known) {
+				sent.valid = false;
+				++lost;
+				++total;
+			}
+			continue;
+		}
+
+		int64_t delta;
+		if (symbols[i] == 1) {
+			if (offset + 1 > bodySize)
+				break;
+
+			delta = body[offset];
+			offset += 1;
+		} else if (symbols[i] == 2) {
+			if (offset + 2 > bodySize)
+				break;
+
+			delta = int16_t(uint16_t((body[offset] << 8) | body[offset + 1]));
+			offset += 2;
+		} else {
+			break; // reserved
+		}
+
+		arrivalTime += delta * DeltaUnit;
+		if (known) {
+			sent.valid = false;
+			results.push_back(PacketResult{sent.time, arrivalTime, sent.size, sent.cluster});
+			++total;
+		}
+	}
+
+	if (total == 0)
+		return;
+
+	updateAckedBitrate(results);
+	updateDelayBased(results, now);
+	updateLossBased(lost, total);
+	updateProbes(results, now);
+}
+
+void TwccBandwidthEstimator::processCongestionFeedback(const uint8_t *data, size_t size,
+                                                       int64_t now) {
+	// RFC 8888 feedback: after the header and the sender SSRC, a block per media SSRC with the
+	// begin sequence number and a 16-bit report per packet (received flag, ECN, arrival time
+	// offset), padded to 32 bits, then the report timestamp
+	// See https://www.rfc-editor.org/rfc/rfc8888.html#section-3.1
+	const size_t end = size >= 12 ? size - 4 : 0;
+	size_t offset = 8;
+	size_t received = 0, marked = 0, scalable = 0;
+	while (offset + 8 <= end) {
+		const size_t count = size_t((data[offset + 6] << 8) | data[offset + 7]);
+		offset += 8;
+		if (count * 2 > end - offset)
+			break; // truncated
+
+		for (size_t i = 0; i < count; ++i) {
+			const uint8_t first = data[offset + 2 * i];
+			if (!(first & 0x80))
+				continue; // not received
+
+			++received;
+			const uint8_t ecn = (first >> 5) & 0x03;
+			if (ecn == 0x03)
+				++marked; // Congestion Experienced
+			else if (ecn == 0x01)
+				++scalable; // ECT(1)
+		}
+		offset += (count * 2 + 3) & ~size_t(3);
+	}
+
+	if (received > 0)
+		updateEcnBased(marked, received, scalable > 0, now);
+}
+
+void TwccBandwidthEstimator::updateAckedBitrate(const std::vector<PacketResult> &results) {
+	for (const auto &result : results) {
+		acked.emplace_back(result.arrivalTime, result.size);
+		ackedBytes += result.size;
+	}
+
+	if (acked.empty())
+		return;
+
+	const int64_t latest = acked.back().first;
+	while (!acked.empty() && acked.front().first < latest - AckedWindow) {
+		ackedBytes -= acked.front().second;
+		acked.pop_front();
+	}
+
+	const int64_t span = latest - acked.front().first;
+	if (span >= MinAckedSpan)
+		ackedBitrate = double(ackedBytes) * 8.0 * 1e6 / double(span);
+}
+
+void TwccBandwidthEstimator::updateDelayBased(const std::vector<PacketResult> &results,
+                                              int64_t now) {
+	// Delay variations are computed between groups of packets sent in a short duration
+	for (const auto &result : results) {
+		if (!currentGroup.valid) {
+			currentGroup = PacketGroup{true, result.sendTime, result.sendTime, result.arrivalTime};
+			continue;
+		}
+
+		if (result.sendTime - currentGroup.firstSendTime <= GroupDuration) {
+			currentGroup.lastSendTime = std::max(currentGroup.lastSendTime, result.sendTime);
+			currentGroup.lastArrivalTime =
+			    std::max(currentGroup.lastArrivalTime, result.arrivalTime);
+			continue;
+		}
+
+		if (previousGroup.valid) {
+			const int64_t sendDelta = currentGroup.lastSendTime - previousGroup.lastSendTime;
+			const int64_t arrivalDelta =
+			    currentGroup.lastArrivalTime - previousGroup.lastArrivalTime;
+			updateTrendline(double(arrivalDelta - sendDelta) / 1000.0, double(sendDelta) / 1000.0,
+			                currentGroup.lastArrivalTime);
+		}
+
+		previousGroup = currentGroup;
+		currentGroup = PacketGroup{true, result.sendTime, result.sendTime, result.arrivalTime};
+	}
+
+	// Additive-increase multiplicative-decrease rate control
+	const double elapsed = lastUpdate ? std::min(double(now - *lastUpdate) / 1e6, 1.0) : 0.0;
+	lastUpdate = now;
+	switch (usage) {
+	case Usage::Overusing:
+		if (!lastDecrease || now - *lastDecrease >= MinDecreaseInterval) {
+			const double decreased = DecreaseFactor * ackedBitrate.value_or(delayBitrate);
+			delayBitrate = std::min(delayBitrate, decreased);
+			lastDecrease = now;
+			probeBitrate.reset();
+		}
+		break;
+	case Usage::Normal:
+		delayBitrate *= std::pow(IncreaseRate, elapsed);
+		// Do not increase far beyond what the network actually delivers or a probe went through
+		if (ackedBitrate)
+			delayBitrate = std::min(
+			    delayBitrate, std::max(1.5 * *ackedBitrate + 10000.0, probeBitrate.value_or(0.0)));
+		break;
+	case Usage::Underusing:
+		// Queues are draining, hold the bitrate
+		break;
+	}
+	delayBitrate = std::clamp(delayBitrate, minBitrate, maxBitrate);
+}
+
+void TwccBandwidthEstimator::updateTrendline(double delta, double sendDelta,
+                                             int64_t arrivalTime) {
+	deltaCount = std::min(deltaCount + 1, size_t(1000));
+	accumulatedDelay += delta;
+	smoothedDelay = SmoothingCoeff * smoothedDelay + (1.0 - SmoothingCoeff) * accumulatedDelay;
+
+	if (!firstArrivalTime)
+		firstArrivalTime = arrivalTime;
+
+	trendline.emplace_back(double(arrivalTime - *firstArrivalTime) / 1000.0, smoothedDelay);
+	if (trendline.size() > TrendlineWindowSize)
+		trendline.pop_front();
+
+	// The trend is the slope of the linear regression of the smoothed delay
+	double trend = previousTrend;
+	if (trendline.size() == TrendlineWindowSize) {
+		double meanX = 0, meanY = 0;
+		for (const auto &[x, y] : trendline) {
+			meanX += x;
+			meanY += y;
+		}
+		meanX /= double(trendline.size());
+		meanY /= double(trendline.size());
+
+		double numerator = 0, denominator = 0;
+		for (const auto &[x, y] : trendline) {
+			numerator += (x - meanX) * (y - meanY);
+			denominator += (x - meanX) * (x - meanX);
+		}
+		if (denominator != 0)
+			trend = numerator / denominator;
+	}
+
+	// Overuse detection against an adaptive threshold
+	const double modified = double(std::min(deltaCount, size_t(60))) * trend * ThresholdGain;
+	if (modified > threshold) {
+		timeOverUsing = timeOverUsing < 0 ? sendDelta / 2 : timeOverUsing + sendDelta;
+		++overuseCounter;
+		if (timeOverUsing > OverusingTime && overuseCounter > 1 && trend >= previousTrend) {
+			timeOverUsing = 0;
+			overuseCounter = 0;
+			usage = Usage::Overusing;
+		}
+	} else if (modified < -threshold) {
+		timeOverUsing = -1;
+		overuseCounter = 0;
+		usage = Usage::Underusing;
+	} else {
+		timeOverUsing = -1;
+		overuseCounter = 0;
+		usage = Usage::Normal;
+	}
+	previousTrend = trend;
+
+	const double absModified = std::abs(modified);
+	if (lastThresholdUpdate && absModified <= threshold + 15.0) {
+		const double k = absModified < threshold ? ThresholdDown : ThresholdUp;
+		const double dt = std::min(double(arrivalTime - *lastThresholdUpdate) / 1000.0, 100.0);
+		threshold = std::clamp(threshold + k * (absModified - threshold) * dt, 6.0, 600.0);
+	}
+	lastThresholdUpdate = arrivalTime;
+}
+
+void TwccBandwidthEstimator::updateEcnBased(size_t marked, size_t total, bool scalable,
+                                            int64_t now) {
+	const double fraction = double(marked) / double(total);
+	markedFraction = (1.0 - MarkedFractionGain) * markedFraction + MarkedFractionGain * fraction;
+	if (marked == 0 || (lastDecrease && now - *lastDecrease < MinDecreaseInterval))
+		return;
+
+	if (scalable) {
+		// L4S: decrease in proportion to the extent of congestion
+		// See https://www.rfc-editor.org/rfc/rfc9331.html#section-4.3
+		delayBitrate *= 1.0 - std::max(markedFraction, fraction) / 2.0;
+	} else {
+		// Classic ECN: Congestion Experienced is equivalent to loss
+		// See https://www.rfc-editor.org/rfc/rfc3168.html#section-5
+		const double decreased = DecreaseFactor * ackedBitrate.value_or(delayBitrate);
+		delayBitrate = std::min(delayBitrate, decreased);
+	}
+	delayBitrate = std::clamp(delayBitrate, minBitrate, maxBitrate);
+	lastDecrease = now;
+	probeBitrate.reset();
+}
+
+void TwccBandwidthEstimator::updateProbes(const std::vector<PacketResult> &results,
+                                          int64_t now) {
+	if (clusters.empty())
+		return;
+
+	for (const auto &result : results) {
+		if (result.cluster < 0)
+			continue;
+
+		auto it = std::find_if(clusters.begin(), clusters.end(),
+		                       [&](const ProbeCluster &c) { return c.id == result.cluster; });
+		if (it == clusters.end())
+			continue;
+
+		auto &cluster = *it;
+		if (cluster.receivedCount == 0 || result.arrivalTime < cluster.firstArrivalTime)
+			cluster.firstArrivalTime = result.arrivalTime;
+
+		if (cluster.receivedCount == 0 || result.arrivalTime >= cluster.lastArrivalTime) {
+			cluster.lastArrivalTime = result.arrivalTime;
+			cluster.lastSize = result.size;
+		}
+
+		++cluster.receivedCount;
+		cluster.receivedBytes += result.size;
+	}
+
+	auto it = clusters.begin();
+	while (it != clusters.end()) {
+		const auto &cluster = *it;
+		if (cluster.receivedCount < MinProbePackets ||
+		    double(cluster.receivedCount) < ProbeMinReceivedRatio * double(cluster.sentCount)) {
+			// Clusters with too many lost packets are abandoned
+			it = now - cluster.sendTime > ProbeTimeout ? clusters.erase(it) : std::next(it);
+			continue;
+		}
+
+		// The size of the last packet is excluded as the span ends when it starts arriving
+		const int64_t span = cluster.lastArrivalTime - cluster.firstArrivalTime;
+		if (span > 0) {
+			const double received =
+			    double(cluster.receivedBytes - cluster.lastSize) * 8.0 * 1e6 / double(span);
+			const double result = std::min(received, cluster.bitrate);
+			PLOG_DEBUG << "Probe cluster at " << unsigned(cluster.bitrate) << " bit/s received at "
+			           << unsigned(received) << " bit/s";
+
+			probeBitrate = result;
+			if (usage != Usage::Overusing && result > delayBitrate) {
+				delayBitrate = std::min(result, maxBitrate);
+				lossBitrate = std::max(lossBitrate, delayBitrate);
+			}
+
+			// Probe further while clusters go through, once no other cluster is in flight
+			if (result >= ProbeSuccessRatio * cluster.bitrate && result < maxBitrate &&
+			    pendingProbes.empty() && clusters.size() == 1)
+				pendingProbes.push_back(std::min(ProbeFactor * result, maxBitrate));
+		}
+
+		it = clusters.erase(it);
+	}
+}
+
+void TwccBandwidthEstimator::updateLossBased(size_t lost, size_t total) {
+	lostCount += lost;
+	totalCount += total;
+	if (totalCount < MinLossPackets)
+		return;
+
+	const double loss = double(lostCount) / double(totalCount);
+	lostCount = 0;
+	totalCount = 0;
+
+	if (loss > 0.10) {
+		// Heavy loss, decrease from the current target
+		lossBitrate = std::min(lossBitrate, delayBitrate) * (1.0 - 0.5 * loss);
+	} else if (loss < 0.02) {
+		lossBitrate = std::min(lossBitrate * 1.05, maxBitrate);
+	}
+	lossBitrate = std::max(lossBitrate, minBitrate);
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
@@ -0,0 +1,155 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "ulpfecgenerator.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/messagepool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+const size_t FecHeaderSize = 10;
+const size_t FecLevelHeaderSize = 4; // with a 16-bit mask
+
+const size_t MaxGroupSize = 16;
+
+size_t GroupSize(double protectionRatio) {
+	if (!(protectionRatio > 0))
+		return MaxGroupSize;
+
+	return std::clamp(size_t(std::lround(1.0 / std::min(protectionRatio, 1.0))), size_t(1),
+	                  MaxGroupSize);
+}
+
+} // namespace
+
+UlpfecGenerator::UlpfecGenerator(uint8_t _payloadType, double protectionRatio)
+    : MediaHandlerElement(), payloadType(_payloadType), groupSize(GroupSize(protectionRatio)) {}
+
+void UlpfecGenerator::setProtectionRatio(double protectionRatio) {
+	std::lock_guard lock(mutex);
+	groupSize = GroupSize(protectionRatio);
+}
+
+ChainedOutgoingProduct
+UlpfecGenerator::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                              message_ptr control) {
+	std::lock_guard lock(mutex);
+	auto result = make_chained_messages_product();
+	result->reserve(messages->size() + messages->size() / groupSize + 1);
+	for (auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize) {
+			result->push_back(std::move(message));
+			continue;
+		}
+
+		auto rtp = reinterpret_cast<RtpHeader *>(message->data());
+		rtp->setSeqNumber(uint16_t(rtp->seqNumber() + seqOffset));
+		protect(*message);
+
+		const bool marker = rtp->marker();
+		binary_ptr fec;
+		if (group.count >= groupSize || marker)
+			fec = generate(rtp);
+
+		result->push_back(std::move(message));
+		if (fec)
+			result->push_back(std::move(fec));
+	}
+
+	return {result, control};
+}
+
+void UlpfecGenerator::protect(const binary &packet) {
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet.data());
+	if (group.count == 0) {
+		group = Group{};
+		group.base = rtp->seqNumber();
+	}
+
+	const auto *data = reinterpret_cast<const uint8_t *>(packet.data());
+	const size_t size = packet.size() - RtpHeaderMinSize;
+	group.mask |= uint16_t(0x8000 >> uint16_t(rtp->seqNumber() - group.base));
+	group.first ^= data[0] & 0x3F;
+	group.second ^= data[1];
+	group.timestamp ^= rtp->timestamp();
+	group.length ^= uint16_t(size);
+	if (group.payload.size() < size)
+		group.payload.resize(size, byte(0));
+
+	for (size_t i = 0; i < size; ++i)
+		group.payload[i] ^= packet[RtpHeaderMinSize + i];
+
+	++group.count;
+}
+
+binary_ptr UlpfecGenerator::generate(const RtpHeader *last) {
+	const size_t size =
+	    RtpHeaderMinSize + FecHeaderSize + FecLevelHeaderSize + group.payload.size();
+	binary_ptr packet = impl::MessagePool::Acquire();
+	packet->reserve(size + MediaTailroom);
+	packet->resize(size);
+
+	auto rtp = reinterpret_cast<RtpHeader *>(packet->data());
+	rtp->preparePacket();
+	rtp->setPayloadType(payloadType);
+	rtp->setSeqNumber(uint16_t(last->seqNumber() + 1));
+	rtp->setTimestamp(last->timestamp());
+	rtp->setSsrc(last->ssrc());
+	++seqOffset;
+
+	auto *p = reinterpret_cast<uint8_t *>(packet->data()) + RtpHeaderMinSize;
+	p[0] = group.first; // E and L are unset
+	p[1] = group.second;
+	const uint16_t base = htons(group.base);
+	const uint32_t timestamp = htonl(group.timestamp);
+	const uint16_t length = htons(group.length);
+	std::memcpy(p + 2, &base, 2);
+	std::memcpy(p + 4, &timestamp, 4);
+	std::memcpy(p + 8, &length, 2);
+
+	// Level 0 protects the whole packets
+	p += FecHeaderSize;
+	const uint16_t protectionLength = htons(uint16_t(group.payload.size()));
+	const uint16_t mask = htons(group.mask);
+	std::memcpy(p, &protectionLength, 2);
+	std::memcpy(p + 2, &mask, 2);
+	std::memcpy(p + FecLevelHeaderSize, group.payload.data(), group.payload.size());
+
+	group.count = 0;
+	return packet;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
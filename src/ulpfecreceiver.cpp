@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "ulpfecreceiver.hpp"
+
+#include "impl/internals.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace rtc {
+
+namespace {
+
+const size_t RtpHeaderMinSize = 12;
+const size_t FecHeaderSize = 10;
+
+uint16_t ReadUint16(const byte *p) {
+	uint16_t value;
+	std::memcpy(&value, p, 2);
+	return ntohs(value);
+}
+
+uint32_t ReadUint32(const byte *p) {
+	uint32_t value;
+	std::memcpy(&value, p, 4);
+	return ntohl(value);
+}
+
+} // namespace
+
+UlpfecReceiver::UlpfecReceiver(uint8_t _payloadType)
+    : MediaHandlerElement(), payloadType(_payloadType) {}
+
+ChainedIncomingProduct
+UlpfecReceiver::processIncomingBinaryMessage(ChainedMessagesProduct messages) {
+	std::lock_guard lock(mutex);
+	auto result = make_chained_messages_product();
+	result->reserve(messages->size());
+	for (auto &message : *messages) {
+		if (message->size() < RtpHeaderMinSize) {
+			result->push_back(std::move(message));
+			continue;
+		}
+
+		auto rtp = reinterpret_cast<const RtpHeader *>(message->data());
+		if (rtp->payloadType() != payloadType) {
+			store(message);
+			result->push_back(std::move(message));
+			continue;
+		}
+
+		if (auto recovered = recover(*message)) {
+			LOG_VERBOSE << "Recovered RTP packet with FEC, seq="
+			            << reinterpret_cast<const RtpHeader *>(recovered->data())->seqNumber();
+			store(recovered);
+			result->push_back(std::move(recovered));
+		}
+	}
+
+	return {result};
+}
+
+binary_ptr UlpfecReceiver::recover(const binary &fec) {
+	auto rtp = reinterpret_cast<const RtpHeader *>(fec.data());
+	const size_t headerSize = rtp->getSize() + rtp->getExtensionHeaderSize();
+	if (headerSize + FecHeaderSize > fec.size())
+		return nullptr;
+
+	const byte *p = fec.data() + headerSize;
+	const uint8_t flags = std::to_integer<uint8_t>(p[0]);
+	if (flags & 0x80) // E must be unset
+		return nullptr;
+
+	// The level 0 header has a 16-bit mask, or a 48-bit one if L is set
+	const bool longMask = flags & 0x40;
+	const size_t levelHeaderSize = longMask ? 8 : 4;
+	if (headerSize + FecHeaderSize + levelHeaderSize > fec.size())
+		return nullptr;
+
+	const byte *level = p + FecHeaderSize;
+	const size_t protectionLength = ReadUint16(level);
+	const uint64_t mask = longMask ? (uint64_t(ReadUint16(level + 2)) << 32) | ReadUint32(level + 4)
+	                               : uint64_t(ReadUint16(level + 2)) << 32;
+	const byte *payload = level + levelHeaderSize;
+	if (payload + protectionLength > fec.data() + fec.size())
+		return nullptr;
+
+	const uint16_t base = ReadUint16(p + 2);
+	const SSRC ssrc = rtp->ssrc();
+	optional<uint16_t> missing;
+	for (int i = 0; i < 48; ++i) {
+		if (!(mask & (uint64_t(1) << (47 - i))))
+			continue;
+
+		const uint16_t seq = uint16_t(base + i);
+		if (!find(ssrc, seq)) {
+			if (missing)
+				return nullptr; // more than one packet is missing
+
+			missing = seq;
+		}
+	}
+	if (!missing)
+		return nullptr;
+
+	uint8_t first = flags;
+	uint8_t second = std::to_integer<uint8_t>(p[1]);
+	uint32_t timestamp = ReadUint32(p + 4);
+	uint16_t length = ReadUint16(p + 8);
+	binary recovered(payload, payload + protectionLength);
+	for (int i = 0; i < 48; ++i) {
+		const uint16_t seq = uint16_t(base + i);
+		if (!(mask & (uint64_t(1) << (47 - i))) || seq == *missing)
+			continue;
+
+		auto packet = find(ssrc, seq);
+		auto header = reinterpret_cast<const RtpHeader *>(packet->data());
+		first ^= std::to_integer<uint8_t>(packet->at(0));
+		second ^= std::to_integer<uint8_t>(packet->at(1));
+		timestamp ^= header->timestamp();
+		length ^= uint16_t(packet->size() - RtpHeaderMinSize);
+		const size_t size = std::min(protectionLength, packet->size() - RtpHeaderMinSize);
+		for (size_t j = 0; j < size; ++j)
+			recovered[j] ^= packet->at(RtpHeaderMinSize + j);
+	}
+
+	if (length > protectionLength) // only part of the packet is protected
+		return nullptr;
+
+	auto packet = std::make_shared<binary>(RtpHeaderMinSize + length);
+	packet->at(0) = byte(0x80 | (first & 0x3F));
+	packet->at(1) = byte(second);
+	auto header = reinterpret_cast<RtpHeader *>(packet->data());
+	header->setSeqNumber(*missing);
+	header->setTimestamp(timestamp);
+	header->setSsrc(ssrc);
+	std::memcpy(packet->data() + RtpHeaderMinSize, recovered.data(), length);
+	return packet;
+}
+
+void UlpfecReceiver::store(binary_ptr packet) {
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet->data());
+	history[rtp->seqNumber() & (HistorySize - 1)] = std::move(packet);
+}
+
+binary_ptr UlpfecReceiver::find(SSRC ssrc, uint16_t seq) const {
+	const auto &packet = history[seq & (HistorySize - 1)];
+	if (!packet || packet->size() < RtpHeaderMinSize)
+		return nullptr;
+
+	auto rtp = reinterpret_cast<const RtpHeader *>(packet->data());
+	return rtp->seqNumber() == seq && rtp->ssrc() == ssrc ? packet : nullptr;
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
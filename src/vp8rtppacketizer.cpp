@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "vp8rtppacketizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+namespace rtc {
+
+namespace {
+
+// Payload descriptor: X (1 bit), R (1 bit), N (1 bit), S (1 bit), R (1 bit), PID (3 bits)
+const uint8_t DescriptorExtended = 0x80;         // X: extended control bits are present
+const uint8_t DescriptorStartOfPartition = 0x10; // S: start of a VP8 partition
+
+// Extended control bits: I (1 bit), L (1 bit), T (1 bit), K (1 bit), reserved (4 bits)
+const uint8_t ExtensionPictureId = 0x80; // I: picture ID is present
+const uint8_t PictureIdLong = 0x80;      // M: picture ID is 15 bits long
+const uint16_t PictureIdMask = 0x7FFF;
+
+const size_t DescriptorSize = 4;
+
+} // namespace
+
+VP8RtpPacketizer::VP8RtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig,
+                                   uint16_t maximumPayloadSize)
+    : RtpPacketizer(rtpConfig), MediaHandlerRootElement(), maximumPayloadSize(maximumPayloadSize) {
+	if (maximumPayloadSize <= DescriptorSize)
+		throw std::invalid_argument("Maximum payload size is too small for VP8");
+
+	// The initial picture ID should be random
+	std::default_random_engine generator(
+	    static_cast<unsigned int>(std::chrono::system_clock::now().time_since_epoch().count()));
+	pictureId = std::uniform_int_distribution<uint16_t>(0, PictureIdMask)(generator);
+}
+
+ChainedOutgoingProduct
+VP8RtpPacketizer::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                               message_ptr control) {
+	ChainedMessagesProduct packets = make_chained_messages_product();
+	for (const auto &message : *messages) {
+		if (message->empty())
+			continue;
+
+		const size_t maxLength = maximumPayloadSize - DescriptorSize;
+		size_t offset = 0;
+		while (offset < message->size()) {
+			const size_t length = std::min(maxLength, message->size() - offset);
+			const bool last = offset + length == message->size();
+			const size_t payloadSize = DescriptorSize + length;
+			auto packet = createPacket(payloadSize, last);
+			byte *data = packet->data() + packet->size() - payloadSize;
+			data[0] = byte(DescriptorExtended | (offset == 0 ? DescriptorStartOfPartition : 0));
+			data[1] = byte(ExtensionPictureId);
+			data[2] = byte(PictureIdLong | (pictureId >> 8));
+			data[3] = byte(pictureId & 0xFF);
+			std::memcpy(data + DescriptorSize, message->data() + offset, length);
+			packets->push_back(std::move(packet));
+			offset += length;
+		}
+		pictureId = (pictureId + 1) & PictureIdMask;
+	}
+	return {packets, control};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
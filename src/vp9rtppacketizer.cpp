@@ -0,0 +1,321 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if RTC_ENABLE_MEDIA
+
+#include "vp9rtppacketizer.hpp"
+
+#include "impl/internals.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+namespace rtc {
+
+namespace {
+
+// Payload descriptor: I, P, L, F, B, E, V, Z (1 bit each)
+const uint8_t DescriptorPictureId = 0x80;    // I: picture ID is present
+const uint8_t DescriptorInterPicture = 0x40; // P: inter-picture predicted
+const uint8_t DescriptorLayerIndices = 0x20; // L: layer indices are present
+const uint8_t DescriptorStartOfFrame = 0x08; // B: start of a frame
+const uint8_t DescriptorEndOfFrame = 0x04;   // E: end of a frame
+const uint8_t DescriptorScalability = 0x02;  // V: scalability structure is present
+const uint8_t DescriptorNotReference = 0x01; // Z: not a reference for upper spatial layers
+const uint8_t PictureIdLong = 0x80;          // M: picture ID is 15 bits long
+const uint16_t PictureIdMask = 0x7FFF;
+
+// Scalability structure: N_S (3 bits), Y (1 bit), G (1 bit), reserved (3 bits)
+const uint8_t ScalabilityResolutions = 0x10;  // Y: spatial layer resolutions are present
+
+const uint8_t MaxSpatialLayers = 8;
+const uint8_t MaxTemporalLayers = 8;
+
+// Fixed part, layer indices, and the largest scalability structure, without picture group
+const size_t MaxDescriptorSize = 5 + (1 + MaxSpatialLayers * 4);
+
+const uint32_t FrameMarker = 0x2;
+const uint32_t FrameSyncCode = 0x498342;
+const uint32_t ColorSpaceRgb = 7;
+
+struct Frame {
+	const byte *data;
+	size_t size;
+};
+
+class BitReader {
+public:
+	BitReader(const byte *data, size_t size) : mData(data), mSize(size) {}
+
+	uint32_t read(int bits) {
+		uint32_t value = 0;
+		while (bits-- > 0) {
+			if (mBit >= mSize * 8) {
+				mOverflow = true;
+				return 0;
+			}
+			value = (value << 1) | ((uint8_t(mData[mBit / 8]) >> (7 - mBit % 8)) & 1);
+			++mBit;
+		}
+		return value;
+	}
+
+	bool overflow() const { return mOverflow; }
+
+private:
+	const byte *mData;
+	size_t mSize;
+	size_t mBit = 0;
+	bool mOverflow = false;
+};
+
+struct FrameHeader {
+	bool keyFrame = false;
+	uint16_t width = 0; // only known for key frames
+	uint16_t height = 0;
+};
+
+// See the uncompressed header in the VP9 bitstream specification
+FrameHeader ParseFrameHeader(const Frame &frame) {
+	FrameHeader header;
+	BitReader reader(frame.data, frame.size);
+	if (reader.read(2) != FrameMarker)
+		return header;
+
+	uint32_t profile = reader.read(1);
+	profile |= reader.read(1) << 1;
+	if (profile == 3)
+		reader.read(1); // reserved_zero
+
+	if (reader.read(1)) // show_existing_frame
+		return header;
+
+	const bool keyFrame = reader.read(1) == 0; // frame_type
+	reader.read(2);                            // show_frame and error_resilient_mode
+	if (reader.overflow() || !keyFrame)
+		return header;
+
+	header.keyFrame = true;
+	if (reader.read(24) != FrameSyncCode)
+		return header;
+
+	// color_config
+	if (profile >= 2)
+		reader.read(1); // ten_or_twelve_bit
+
+	if (reader.read(3) != ColorSpaceRgb) {
+		reader.read(1); // color_range
+		if (profile == 1 || profile == 3)
+			reader.read(3); // subsampling_x, subsampling_y, and reserved_zero
+	} else if (profile == 1 || profile == 3) {
+		reader.read(1); // reserved_zero
+	}
+
+	// frame_size
+	const uint32_t width = reader.read(16) + 1;
+	const uint32_t height = reader.read(16) + 1;
+	if (!reader.overflow()) {
+		header.width = uint16_t(width);
+		header.height = uint16_t(height);
+	}
+	return header;
+}
+
+// Superframe index: marker (3 bits), bytes per frame size minus 1 (2 bits), frames minus 1 (3 bits)
+std::vector<Frame> SplitSuperframe(const binary &message) {
+	const uint8_t marker = uint8_t(message.back());
+	if ((marker & 0xE0) == 0xC0) {
+		const size_t count = (marker & 0x07) + 1;
+		const size_t magnitude = ((marker >> 3) & 0x03) + 1;
+		const size_t indexSize = 2 + magnitude * count;
+		if (message.size() >= indexSize &&
+		    uint8_t(message[message.size() - indexSize]) == marker) {
+			std::vector<Frame> frames;
+			const byte *index = message.data() + message.size() - indexSize + 1;
+			const byte *data = message.data();
+			size_t remaining = message.size() - indexSize;
+			for (size_t i = 0; i < count; ++i) {
+				size_t size = 0;
+				for (size_t j = 0; j < magnitude; ++j)
+					size |= size_t(uint8_t(index[j])) << (j * 8);
+
+				index += magnitude;
+				if (size > remaining) {
+					LOG_WARNING << "Invalid VP9 superframe index, ignoring!";
+					return {};
+				}
+				if (size > 0)
+					frames.push_back({data, size});
+
+				data += size;
+				remaining -= size;
+			}
+			return frames;
+		}
+	}
+	return {{message.data(), message.size()}};
+}
+
+// The picture group is not described, as the encoder might not follow a fixed pattern
+void WriteScalabilityStructure(binary &data, const std::vector<Frame> &frames,
+                               uint8_t spatialLayers) {
+	std::vector<FrameHeader> headers;
+	bool resolutions = frames.size() == spatialLayers;
+	for (const auto &frame : frames) {
+		headers.push_back(ParseFrameHeader(frame));
+		resolutions = resolutions && headers.back().width > 0;
+	}
+
+	uint8_t flags = uint8_t((spatialLayers - 1) << 5);
+	if (resolutions)
+		flags |= ScalabilityResolutions;
+
+	data.push_back(byte(flags));
+	if (resolutions) {
+		for (const auto &header : headers) {
+			data.push_back(byte(header.width >> 8));
+			data.push_back(byte(header.width & 0xFF));
+			data.push_back(byte(header.height >> 8));
+			data.push_back(byte(header.height & 0xFF));
+		}
+	}
+}
+
+} // namespace
+
+void VP9RtpPacketizer::setPictureLayers(PictureLayers layers) {
+	if (layers.temporalId >= temporalLayers)
+		throw std::invalid_argument("Invalid VP9 temporal layer index");
+
+	if (layers.firstSpatialId >= spatialLayers)
+		throw std::invalid_argument("Invalid VP9 spatial layer index");
+
+	std::lock_guard lock(layersMutex);
+	nextLayers = layers;
+}
+
+VP9RtpPacketizer::VP9RtpPacketizer(shared_ptr<RtpPacketizationConfig> rtpConfig,
+                                   uint16_t maximumPayloadSize, uint8_t spatialLayers,
+                                   uint8_t temporalLayers)
+    : RtpPacketizer(rtpConfig), MediaHandlerRootElement(), maximumPayloadSize(maximumPayloadSize),
+      spatialLayers(spatialLayers), temporalLayers(temporalLayers) {
+	if (spatialLayers < 1 || spatialLayers > MaxSpatialLayers)
+		throw std::invalid_argument("Invalid number of VP9 spatial layers");
+
+	if (temporalLayers < 1 || temporalLayers > MaxTemporalLayers)
+		throw std::invalid_argument("Invalid number of VP9 temporal layers");
+
+	if (maximumPayloadSize <= MaxDescriptorSize)
+		throw std::invalid_argument("Maximum payload size is too small for VP9");
+
+	// The initial picture ID should be random
+	std::default_random_engine generator(
+	    static_cast<unsigned int>(std::chrono::system_clock::now().time_since_epoch().count()));
+	pictureId = std::uniform_int_distribution<uint16_t>(0, PictureIdMask)(generator);
+}
+
+ChainedOutgoingProduct
+VP9RtpPacketizer::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                               message_ptr control) {
+	ChainedMessagesProduct packets = make_chained_messages_product();
+	binary descriptor;
+	for (const auto &message : *messages) {
+		if (message->empty())
+			continue;
+
+		// Without spatial layers, a superframe is a single picture and is sent as is
+		auto frames = spatialLayers > 1 ? SplitSuperframe(*message)
+		                                : std::vector<Frame>{{message->data(), message->size()}};
+		if (frames.empty())
+			continue;
+
+		// Layers are only signaled when the encoder described them
+		optional<PictureLayers> layers;
+		{
+			std::lock_guard lock(layersMutex);
+			std::swap(layers, nextLayers);
+		}
+		const bool layered = layers.has_value();
+		if (layered && layers->temporalId == 0)
+			++tl0PicIdx;
+
+		const bool keyPicture = ParseFrameHeader(frames.front()).keyFrame;
+		for (size_t i = 0; i < frames.size(); ++i) {
+			const auto &frame = frames[i];
+			const auto spatialId =
+			    layered ? uint8_t(std::min(layers->firstSpatialId + i, size_t(spatialLayers - 1)))
+			            : uint8_t(0);
+			const bool lastFrame = i + 1 == frames.size();
+			size_t offset = 0;
+			while (offset < frame.size) {
+				const bool withStructure = layered && keyPicture && i == 0 && offset == 0;
+				uint8_t flags = DescriptorPictureId;
+				if (!keyPicture)
+					flags |= DescriptorInterPicture;
+				if (layered)
+					flags |= DescriptorLayerIndices;
+				if (offset == 0)
+					flags |= DescriptorStartOfFrame;
+				if (withStructure)
+					flags |= DescriptorScalability;
+				if (lastFrame)
+					flags |= DescriptorNotReference;
+
+				descriptor.clear();
+				descriptor.push_back(byte(flags));
+				descriptor.push_back(byte(PictureIdLong | (pictureId >> 8)));
+				descriptor.push_back(byte(pictureId & 0xFF));
+				if (layered) {
+					const uint8_t switchingUp = layers->switchingUp ? 0x10 : 0;
+					const uint8_t interLayer =
+					    layers->interLayerDependency && spatialId > 0 ? 0x01 : 0;
+					descriptor.push_back(byte((layers->temporalId & 0x07) << 5 | switchingUp |
+					                          spatialId << 1 | interLayer));
+					descriptor.push_back(byte(tl0PicIdx));
+				}
+				if (withStructure)
+					WriteScalabilityStructure(descriptor, frames, spatialLayers);
+
+				const size_t length =
+				    std::min(maximumPayloadSize - descriptor.size(), frame.size - offset);
+				const bool end = offset + length == frame.size;
+				if (end)
+					descriptor[0] |= byte(DescriptorEndOfFrame);
+
+				// The marker bit is set at the end of the picture, on the last spatial layer
+				const size_t payloadSize = descriptor.size() + length;
+				auto packet = createPacket(payloadSize, end && lastFrame);
+				byte *data = packet->data() + packet->size() - payloadSize;
+				std::memcpy(data, descriptor.data(), descriptor.size());
+				std::memcpy(data + descriptor.size(), frame.data + offset, length);
+				packets->push_back(std::move(packet));
+				offset += length;
+			}
+		}
+		pictureId = (pictureId + 1) & PictureIdMask;
+	}
+	return {packets, control};
+}
+
+} // namespace rtc
+
+#endif /* RTC_ENABLE_MEDIA */
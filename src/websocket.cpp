@@ -22,6 +22,7 @@
 #include "common.hpp"
 
 #include "impl/internals.hpp"
+#include "impl/metrics.hpp"
 #include "impl/websocket.hpp"
 
 namespace rtc {
@@ -30,16 +31,21 @@ WebSocket::WebSocket() : WebSocket(Configuration()) {}
 
 WebSocket::WebSocket(Configuration config)
     : CheshireCat<impl::WebSocket>(std::move(config)),
-      Channel(std::dynamic_pointer_cast<impl::Channel>(CheshireCat<impl::WebSocket>::impl())) {}
+      Channel(std::dynamic_pointer_cast<impl::Channel>(CheshireCat<impl::WebSocket>::impl())) {
+	impl::MetricsRegistry::Instance().add(CheshireCat<impl::WebSocket>::impl());
+}
 
 WebSocket::WebSocket(impl_ptr<impl::WebSocket> impl)
     : CheshireCat<impl::WebSocket>(std::move(impl)),
-      Channel(std::dynamic_pointer_cast<impl::Channel>(CheshireCat<impl::WebSocket>::impl())) {}
+      Channel(std::dynamic_pointer_cast<impl::Channel>(CheshireCat<impl::WebSocket>::impl())) {
+	impl::MetricsRegistry::Instance().add(CheshireCat<impl::WebSocket>::impl());
+}
 
 WebSocket::~WebSocket() {
 	try {
 		impl()->remoteClose();
 		impl()->resetCallbacks(); // not done by impl::WebSocket
+		impl()->fragmentCallback = nullptr;
 	} catch (const std::exception &e) {
 		PLOG_ERROR << e.what();
 	}
@@ -61,13 +67,28 @@ void WebSocket::open(const string &url) {
 void WebSocket::close() { impl()->close(); }
 
 bool WebSocket::send(message_variant data) {
-	return impl()->outgoing(make_message(std::move(data)));
+	return impl()->outgoing(make_payload_message(std::move(data)));
 }
 
 bool WebSocket::send(const byte *data, size_t size) {
 	return impl()->outgoing(make_message(data, data + size, Message::Binary));
 }
 
+size_t WebSocket::Broadcast(const std::vector<shared_ptr<WebSocket>> &webSockets,
+                            message_variant data) {
+	std::vector<shared_ptr<impl::WebSocket>> impls;
+	impls.reserve(webSockets.size());
+	for (const auto &webSocket : webSockets)
+		if (webSocket)
+			impls.push_back(webSocket->impl());
+
+	return impl::WebSocket::Broadcast(impls, make_payload_message(std::move(data)));
+}
+
+void WebSocket::onFragment(std::function<void(binary data, bool last)> callback) {
+	impl()->fragmentCallback = callback;
+}
+
 optional<string> WebSocket::remoteAddress() const {
 	auto tcpTransport = impl()->getTcpTransport();
 	return tcpTransport ? make_optional(tcpTransport->remoteAddress()) : nullopt;
@@ -29,7 +29,9 @@ namespace rtc {
 WebSocketServer::WebSocketServer() : WebSocketServer(Configuration()) {}
 
 WebSocketServer::WebSocketServer(Configuration config)
-    : CheshireCat<impl::WebSocketServer>(std::move(config)) {}
+    : CheshireCat<impl::WebSocketServer>(std::move(config)) {
+	impl()->start();
+}
 
 WebSocketServer::~WebSocketServer() { impl()->stop(); }
 
@@ -0,0 +1,1006 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+// Benchmark suite running repeatable in-process scenarios and reporting results as JSON
+//
+// Usage: rtc_bench [--duration ms] [--connections n] [--iterations n] [--port port]
+//                  [--idle-connections n] [--in-process 0|1] [--replay capture] [--speed x]
+//                  [--filter name] [--output file]
+
+#include "rtc/rtc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace rtc;
+using namespace std;
+using namespace chrono_literals;
+
+using chrono::milliseconds;
+using chrono::steady_clock;
+
+namespace {
+
+struct Options {
+	milliseconds duration = 5s;   // per measurement
+	size_t connections = 8;       // maximum for the scaling scenario
+	int iterations = 20;          // for the connection setup scenario
+	uint16_t port = 48090;        // for the WebSocket scenario
+	size_t idleConnections = 200; // for the idle footprint scenario
+	bool inProcess = false;       // in-process loopback instead of UDP, excludes the kernel
+	string replay;                // capture to replay, see Configuration::capturePath
+	double replaySpeed = 1.;      // multiplier of the capture pace, 0 is as fast as possible
+	string filter;                // run only scenarios whose name contains this string
+	string output;                // write JSON to this file instead of stdout
+};
+
+struct Result {
+	string name;
+	vector<pair<string, string>> params;
+	vector<pair<string, double>> metrics;
+
+	Result(string _name) : name(std::move(_name)) {}
+
+	Result &param(string key, string value) {
+		params.emplace_back(std::move(key), std::move(value));
+		return *this;
+	}
+
+	Result &param(string key, size_t value) { return param(std::move(key), to_string(value)); }
+
+	Result &metric(string key, double value) {
+		metrics.emplace_back(std::move(key), value);
+		return *this;
+	}
+};
+
+using Results = vector<Result>;
+
+double seconds(steady_clock::duration d) { return chrono::duration<double>(d).count(); }
+
+double micros(steady_clock::duration d) {
+	return chrono::duration<double, std::micro>(d).count();
+}
+
+// Add nearest-rank percentiles of the samples, which are in microseconds
+void addPercentiles(Result &result, const string &prefix, vector<double> samples) {
+	result.metric(prefix + "_samples", double(samples.size()));
+	if (samples.empty())
+		return;
+
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&samples](double p) {
+		size_t rank = size_t(std::ceil(p * double(samples.size())));
+		return samples[std::clamp(rank, size_t(1), samples.size()) - 1];
+	};
+
+	result.metric(prefix + "_p50_us", percentile(0.50));
+	result.metric(prefix + "_p90_us", percentile(0.90));
+	result.metric(prefix + "_p99_us", percentile(0.99));
+	result.metric(prefix + "_max_us", samples.back());
+}
+
+binary makePayload(size_t size) {
+	binary payload(size);
+	std::mt19937 generator(42);
+	for (auto &b : payload)
+		b = byte(generator() & 0xFF);
+
+	return payload;
+}
+
+// Two peer connections signaling each other in-process
+class Loopback final {
+public:
+	Loopback(const Configuration &config = {}) : pc1(config), pc2(config) {
+		pc1.onLocalDescription([this](Description sdp) { pc2.setRemoteDescription(sdp); });
+		pc1.onLocalCandidate([this](Candidate candidate) { pc2.addRemoteCandidate(candidate); });
+		pc2.onLocalDescription([this](Description sdp) { pc1.setRemoteDescription(sdp); });
+		pc2.onLocalCandidate([this](Candidate candidate) { pc1.addRemoteCandidate(candidate); });
+		pc2.onDataChannel([this](shared_ptr<DataChannel> dc) {
+			std::lock_guard lock(mutex);
+			remote = std::move(dc);
+			cv.notify_all();
+		});
+	}
+
+	~Loopback() {
+		pc1.close();
+		pc2.close();
+	}
+
+	// Create a channel and wait until both ends are open, this must be called only once
+	pair<shared_ptr<DataChannel>, shared_ptr<DataChannel>> open(DataChannelInit init = {},
+	                                                            milliseconds timeout = 10s) {
+		auto local = pc1.createDataChannel("benchmark", std::move(init));
+		local->onOpen([this]() {
+			std::lock_guard lock(mutex);
+			cv.notify_all();
+		});
+
+		std::unique_lock lock(mutex);
+		if (!cv.wait_for(lock, timeout, [&]() { return local->isOpen() && remote; }))
+			throw runtime_error("DataChannel did not open");
+
+		local->onOpen(nullptr);
+		return {std::move(local), remote};
+	}
+
+	// Create a negotiated channel with the stream id on both ends and wait until they are open
+	// The remote end is created once the local one is open, so it does not trigger a negotiation
+	pair<shared_ptr<DataChannel>, shared_ptr<DataChannel>>
+	openNegotiated(uint16_t stream, milliseconds timeout = 10s) {
+		DataChannelInit init;
+		init.negotiated = true;
+		init.id = stream;
+		const auto deadline = steady_clock::now() + timeout;
+		auto local = pc1.createDataChannel("replay", init);
+		while (!local->isOpen() && steady_clock::now() < deadline)
+			this_thread::sleep_for(10ms);
+
+		auto other = pc2.createDataChannel("replay", init);
+		while (!other->isOpen() && steady_clock::now() < deadline)
+			this_thread::sleep_for(10ms);
+
+		if (!local->isOpen() || !other->isOpen())
+			throw runtime_error("DataChannel did not open");
+
+		return {std::move(local), std::move(other)};
+	}
+
+	SetupTimeline setupTimeline() { return pc1.setupTimeline(); }
+
+private:
+	std::mutex mutex;
+	std::condition_variable cv;
+	shared_ptr<DataChannel> remote;
+
+	PeerConnection pc1;
+	PeerConnection pc2;
+};
+
+// Counters of received binary messages
+struct Sink {
+	std::atomic<size_t> size = 0;
+	std::atomic<size_t> count = 0;
+
+	void attach(const shared_ptr<DataChannel> &dc) {
+		dc->onMessage([this](variant<binary, string> message) {
+			if (holds_alternative<binary>(message)) {
+				size += get<binary>(message).size();
+				++count;
+			}
+		});
+	}
+};
+
+// Send as fast as the channel accepts until the deadline, returns the count of messages sent
+size_t flood(const shared_ptr<DataChannel> &dc, const binary &payload,
+             steady_clock::time_point deadline) {
+	const size_t limit = std::max(payload.size() * 4, size_t(256 * 1024));
+	auto mutex = std::make_shared<std::mutex>();
+	auto cv = std::make_shared<std::condition_variable>();
+	dc->setBufferedAmountLowThreshold(limit / 2);
+	dc->onBufferedAmountLow([mutex, cv]() {
+		std::lock_guard lock(*mutex);
+		cv->notify_all();
+	});
+
+	size_t sent = 0;
+	while (dc->isOpen() && steady_clock::now() < deadline) {
+		if (dc->bufferedAmount() < limit) {
+			dc->send(payload);
+			++sent;
+		} else {
+			std::unique_lock lock(*mutex);
+			cv->wait_for(lock, 10ms, [&]() { return dc->bufferedAmount() <= limit / 2; });
+		}
+	}
+
+	dc->onBufferedAmountLow(nullptr);
+	return sent;
+}
+
+DataChannelInit makeInit(bool reliable) {
+	DataChannelInit init;
+	if (!reliable) {
+		init.reliability.type = Reliability::Type::Rexmit;
+		init.reliability.rexmit = 0;
+		init.reliability.unordered = true;
+	}
+	return init;
+}
+
+// Emulated network of the impaired scenarios, over the in-process loopback
+struct Profile {
+	string name;
+	NetworkImpairment impairment;
+};
+
+// Impairments are seeded, so results of successive runs are comparable
+vector<Profile> makeProfiles() {
+	NetworkImpairment wan;
+	wan.delay = 25ms;
+	wan.jitter = 5ms;
+
+	NetworkImpairment randomLoss = wan;
+	randomLoss.lossGood = 0.02;
+
+	NetworkImpairment burstLoss = wan;
+	burstLoss.goodToBad = 0.01;
+	burstLoss.badToGood = 0.25;
+	burstLoss.lossBad = 0.5;
+
+	NetworkImpairment bottleneck = wan;
+	bottleneck.bitrate = 10000000;
+	bottleneck.queueSize = 128 * 1024;
+
+	return {{"wan", wan},
+	        {"random_loss", randomLoss},
+	        {"burst_loss", burstLoss},
+	        {"bottleneck", bottleneck}};
+}
+
+Configuration makeConfig(const Options &options, const Profile *profile = nullptr) {
+	Configuration config;
+	config.enableInProcessLoopback = options.inProcess || profile;
+	if (profile)
+		config.loopbackImpairment = profile->impairment;
+
+	return config;
+}
+
+void addTransportParams(Result &result, const Options &options, const Profile *profile) {
+	result.param("transport", options.inProcess || profile ? "memory" : "udp");
+	if (profile)
+		result.param("network", profile->name);
+}
+
+Result benchThroughput(const Options &options, size_t messageSize, bool reliable,
+                       const Profile *profile = nullptr) {
+	Loopback loopback(makeConfig(options, profile));
+	auto [local, remote] = loopback.open(makeInit(reliable));
+
+	Sink sink;
+	sink.attach(remote);
+
+	const binary payload = makePayload(messageSize);
+	const auto startTime = steady_clock::now();
+	size_t sent = flood(local, payload, startTime + options.duration);
+	const auto elapsed = steady_clock::now() - startTime;
+
+	this_thread::sleep_for(500ms); // let the last messages arrive
+	remote->onMessage(nullptr);
+
+	Result result(profile ? "impaired_throughput" : "datachannel_throughput");
+	result.param("message_size", messageSize);
+	result.param("reliability", reliable ? "reliable" : "unreliable");
+	addTransportParams(result, options, profile);
+	result.metric("goodput_mbps", double(sink.size) * 8 / (seconds(elapsed) * 1e6));
+	result.metric("messages_per_s", double(sink.count) / seconds(elapsed));
+	result.metric("delivered_ratio", sent > 0 ? double(sink.count) / double(sent) : 0.);
+	return result;
+}
+
+// Ping-pong single messages to measure the round-trip time without queuing
+Result benchLatency(const Options &options, size_t messageSize, bool reliable,
+                    const Profile *profile = nullptr) {
+	Loopback loopback(makeConfig(options, profile));
+	auto [local, remote] = loopback.open(makeInit(reliable));
+
+	remote->onMessage([wremote = weak_ptr<DataChannel>(remote)](variant<binary, string> message) {
+		if (auto remote = wremote.lock())
+			remote->send(std::move(message));
+	});
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	uint64_t echoed = 0;
+	local->onMessage([&](variant<binary, string> message) {
+		if (!holds_alternative<binary>(message))
+			return;
+
+		const auto &bin = get<binary>(message);
+		uint64_t seq = 0;
+		std::memcpy(&seq, bin.data(), std::min(bin.size(), sizeof(seq)));
+		std::lock_guard lock(mutex);
+		echoed = std::max(echoed, seq);
+		cv.notify_all();
+	});
+
+	binary payload = makePayload(std::max(messageSize, sizeof(uint64_t)));
+	vector<double> samples;
+	size_t lost = 0;
+	const size_t maxSamples = 100000;
+	const auto startTime = steady_clock::now();
+	for (uint64_t seq = 1; samples.size() < maxSamples; ++seq) {
+		if (steady_clock::now() - startTime >= options.duration)
+			break;
+
+		std::memcpy(payload.data(), &seq, sizeof(seq));
+		const auto sendTime = steady_clock::now();
+		local->send(payload);
+
+		std::unique_lock lock(mutex);
+		if (cv.wait_for(lock, 1s, [&]() { return echoed >= seq; }))
+			samples.push_back(micros(steady_clock::now() - sendTime));
+		else
+			++lost;
+	}
+
+	local->onMessage(nullptr);
+	remote->onMessage(nullptr);
+
+	Result result(profile ? "impaired_latency" : "datachannel_latency");
+	result.param("message_size", payload.size());
+	result.param("reliability", reliable ? "reliable" : "unreliable");
+	addTransportParams(result, options, profile);
+	addPercentiles(result, "rtt", std::move(samples));
+	result.metric("lost", double(lost));
+	return result;
+}
+
+// Replay the Data Channel messages and media packets received in a capture made with
+// Configuration::capturePath, at the original pace multiplied by the speed, or as fast as possible
+// with a speed of 0. Messages are sent on negotiated channels with the captured stream ids, and
+// media packets are fed to a receiving RTCP session, which is the start of the media chain.
+Result benchReplay(const Options &options) {
+	const uint32_t DcepPpid = 50; // channel opening, replaced by negotiated channels
+
+	const TrafficCapture capture(options.replay);
+	const auto messages = capture.sctpMessages();
+
+	Loopback loopback(makeConfig(options));
+	std::map<uint16_t, shared_ptr<DataChannel>> channels;
+	Sink sink;
+	for (const auto &message : messages) {
+		if (message.ppid == DcepPpid || channels.find(message.stream) != channels.end())
+			continue;
+
+		auto [local, remote] = loopback.openNegotiated(message.stream);
+		sink.attach(remote);
+		channels.emplace(message.stream, std::move(local));
+	}
+
+#if RTC_ENABLE_MEDIA
+	RtcpReceivingSession session;
+#endif
+
+	// Messages and packets are dispatched in capture order, the lag is the delay to the schedule
+	const auto &records = capture.records();
+	auto next = messages.begin();
+	auto record = records.begin();
+	size_t sent = 0;
+	size_t mediaCount = 0;
+	vector<double> lags;
+	const auto startTime = steady_clock::now();
+	while (next != messages.end() || record != records.end()) {
+		const bool isMessage =
+		    record == records.end() || (next != messages.end() && next->time <= record->time);
+		const auto time = isMessage ? next->time : record->time;
+		if (options.replaySpeed > 0) {
+			const auto due = startTime + chrono::duration_cast<steady_clock::duration>(
+			                                 chrono::duration<double, std::micro>(
+			                                     double(time.count()) / options.replaySpeed));
+			this_thread::sleep_until(due);
+			lags.push_back(micros(steady_clock::now() - due));
+		}
+
+		if (isMessage) {
+			if (next->ppid != DcepPpid) {
+				// Strings are sent as binary, which only changes the PPID
+				channels[next->stream]->send(next->data);
+				++sent;
+			}
+			++next;
+			continue;
+		}
+
+#if RTC_ENABLE_MEDIA
+		if (!record->outgoing && record->type != TrafficCapture::Type::Sctp) {
+			const auto type = record->type == TrafficCapture::Type::Rtcp ? Message::Control
+			                                                             : Message::Binary;
+			session.incoming(make_message(binary(record->data), type));
+			++mediaCount;
+		}
+#endif
+		++record;
+	}
+
+	const auto deliveryDeadline = steady_clock::now() + 10s;
+	while (sink.count < sent && steady_clock::now() < deliveryDeadline)
+		this_thread::sleep_for(10ms);
+
+	const auto elapsed = steady_clock::now() - startTime;
+	for (auto &[stream, channel] : channels)
+		channel->close();
+
+	Result result("capture_replay");
+	result.param("capture", options.replay);
+	result.param("speed", to_string(options.replaySpeed));
+	addTransportParams(result, options, nullptr);
+	result.metric("capture_duration_s", double(capture.duration().count()) / 1e6);
+	result.metric("replay_duration_s", seconds(elapsed));
+	result.metric("messages", double(sent));
+	result.metric("media_packets", double(mediaCount));
+	result.metric("goodput_mbps", double(sink.size) * 8 / (seconds(elapsed) * 1e6));
+	result.metric("delivered_ratio", sent > 0 ? double(sink.count) / double(sent) : 1.);
+	addPercentiles(result, "lag", std::move(lags));
+	return result;
+}
+
+Result benchScaling(const Options &options, size_t connections) {
+	const size_t messageSize = 16384;
+	vector<unique_ptr<Loopback>> loopbacks;
+	vector<pair<shared_ptr<DataChannel>, shared_ptr<DataChannel>>> channels;
+	vector<unique_ptr<Sink>> sinks;
+
+	const auto setupStartTime = steady_clock::now();
+	for (size_t i = 0; i < connections; ++i)
+		loopbacks.emplace_back(std::make_unique<Loopback>(makeConfig(options)));
+
+	for (auto &loopback : loopbacks) {
+		channels.emplace_back(loopback->open());
+		sinks.emplace_back(std::make_unique<Sink>())->attach(channels.back().second);
+	}
+	const auto setupElapsed = steady_clock::now() - setupStartTime;
+
+	const binary payload = makePayload(messageSize);
+	const auto startTime = steady_clock::now();
+	const auto deadline = startTime + options.duration;
+	vector<std::thread> threads;
+	for (auto &[local, remote] : channels)
+		threads.emplace_back(
+		    [&payload, deadline, local = local]() { flood(local, payload, deadline); });
+
+	for (auto &t : threads)
+		t.join();
+
+	const auto elapsed = steady_clock::now() - startTime;
+	this_thread::sleep_for(500ms);
+
+	double total = 0;
+	double minimum = std::numeric_limits<double>::max();
+	for (size_t i = 0; i < connections; ++i) {
+		channels[i].second->onMessage(nullptr);
+		double goodput = double(sinks[i]->size) * 8 / (seconds(elapsed) * 1e6);
+		total += goodput;
+		minimum = std::min(minimum, goodput);
+	}
+
+	Result result("datachannel_scaling");
+	result.param("connections", connections);
+	result.param("message_size", messageSize);
+	addTransportParams(result, options, nullptr);
+	result.metric("setup_ms", seconds(setupElapsed) * 1e3);
+	result.metric("aggregate_goodput_mbps", total);
+	result.metric("min_goodput_mbps", minimum);
+	return result;
+}
+
+// Per-connection target of the compact profile, see Configuration::compactMemory
+const size_t CompactFootprintTarget = 128 * 1024;
+
+// Resident set size of the process in bytes, 0 if not available
+size_t residentMemory() {
+#ifdef __linux__
+	std::ifstream file("/proc/self/statm");
+	size_t size = 0, resident = 0;
+	if (file >> size >> resident)
+		return resident * size_t(sysconf(_SC_PAGESIZE));
+#endif
+	return 0;
+}
+
+// Memory held by connections with one open Data Channel once idle, measured as the growth of the
+// resident set size, so it includes the library, usrsctp, and TLS library allocations
+Result benchIdleFootprint(const Options &options, bool compact) {
+	const size_t before = residentMemory();
+	if (before == 0)
+		throw runtime_error("Resident memory is not available on this platform");
+
+	Configuration config;
+	config.compactMemory = compact;
+
+	const size_t count = std::max(options.idleConnections / 2, size_t(1)); // two per loopback
+	vector<unique_ptr<Loopback>> loopbacks;
+	vector<pair<shared_ptr<DataChannel>, shared_ptr<DataChannel>>> channels;
+	for (size_t i = 0; i < count; ++i) {
+		loopbacks.emplace_back(std::make_unique<Loopback>(config));
+		channels.emplace_back(loopbacks.back()->open());
+	}
+
+	// Exercise the send and receive paths once, then let the connections settle
+	const binary payload = makePayload(64);
+	for (auto &[local, remote] : channels)
+		local->send(payload);
+
+	this_thread::sleep_for(2s);
+
+	const size_t after = residentMemory();
+	const double perConnection = double(after > before ? after - before : 0) / double(2 * count);
+
+	Result result("idle_footprint");
+	result.param("profile", compact ? "compact" : "default");
+	result.param("connections", 2 * count);
+	result.metric("bytes_per_connection", perConnection);
+	if (compact) {
+		result.metric("target_bytes", double(CompactFootprintTarget));
+		result.metric("within_target", perConnection <= double(CompactFootprintTarget) ? 1 : 0);
+	}
+	return result;
+}
+
+// Time from channel creation until both ends are open, broken down with the setup timeline
+Result benchSetup(const Options &options) {
+	vector<double> setup, ice, dtls, sctp;
+	for (int i = 0; i < options.iterations; ++i) {
+		Loopback loopback(makeConfig(options));
+		const auto startTime = steady_clock::now();
+		loopback.open();
+		setup.push_back(micros(steady_clock::now() - startTime));
+
+		auto timeline = loopback.setupTimeline();
+		if (timeline.iceConnected)
+			ice.push_back(micros(*timeline.iceConnected - timeline.created));
+		if (timeline.dtlsConnected)
+			dtls.push_back(micros(*timeline.dtlsConnected - timeline.created));
+		if (timeline.sctpConnected)
+			sctp.push_back(micros(*timeline.sctpConnected - timeline.created));
+	}
+
+	Result result("connection_setup");
+	result.param("iterations", size_t(options.iterations));
+	addTransportParams(result, options, nullptr);
+	addPercentiles(result, "open", std::move(setup));
+	addPercentiles(result, "ice_connected", std::move(ice));
+	addPercentiles(result, "dtls_connected", std::move(dtls));
+	addPercentiles(result, "sctp_connected", std::move(sctp));
+	return result;
+}
+
+// Measure the rate at which a large multi-track SDP is parsed and generated again
+Result benchSdp(const Options &options, int tracks) {
+	Description description("v=0\r\n"
+	                        "o=rtc 123456789 0 IN IP4 127.0.0.1\r\n"
+	                        "s=-\r\n"
+	                        "t=0 0\r\n",
+	                        Description::Type::Offer);
+	description.setFingerprint(
+	    "AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:45:"
+	    "67:89");
+	for (int i = 0; i < tracks; ++i) {
+		if (i % 2 == 0) {
+			Description::Video video("video-" + to_string(i));
+			video.addH264Codec(96);
+			video.addVP8Codec(98);
+			video.addRTXCodec(97, 96, 90000);
+			video.addSSRC(uint32_t(1000 + i), "cname-" + to_string(i), "stream", "track");
+			description.addMedia(std::move(video));
+		} else {
+			Description::Audio audio("audio-" + to_string(i));
+			audio.addOpusCodec(111);
+			audio.addSSRC(uint32_t(1000 + i), "cname-" + to_string(i), "stream", "track");
+			description.addMedia(std::move(audio));
+		}
+	}
+	description.addApplication("data");
+	const string sdp = description.generateSdp("\r\n");
+
+	size_t parsed = 0;
+	steady_clock::duration parseElapsed{}, generateElapsed{};
+	const auto startTime = steady_clock::now();
+	while (steady_clock::now() - startTime < options.duration) {
+		const auto parseTime = steady_clock::now();
+		Description desc(sdp, Description::Type::Offer);
+		const auto generateTime = steady_clock::now();
+		if (desc.generateSdp("\r\n").size() != sdp.size())
+			throw runtime_error("SDP mismatch after parsing");
+
+		parseElapsed += generateTime - parseTime;
+		generateElapsed += steady_clock::now() - generateTime;
+		++parsed;
+	}
+
+	Result result("sdp");
+	result.param("tracks", size_t(tracks));
+	result.param("sdp_size", sdp.size());
+	result.metric("parse_per_s", double(parsed) / seconds(parseElapsed));
+	result.metric("generate_per_s", double(parsed) / seconds(generateElapsed));
+	return result;
+}
+
+#if RTC_ENABLE_MEDIA
+
+// Measure the rate at which H264 access units with start sequences are split and packetized
+Result benchH264(const Options &options, size_t frameSize) {
+	binary frame = makePayload(std::max(frameSize, size_t(64)));
+
+	// Emulation prevention, like a real keyframe
+	for (size_t i = 2; i < frame.size(); ++i)
+		if (frame[i - 2] == byte(0) && frame[i - 1] == byte(0) && uint8_t(frame[i]) <= 3)
+			frame[i] = byte(3);
+
+	// SPS, PPS, and IDR slice
+	const size_t positions[] = {0, 16, 32};
+	for (size_t pos : positions) {
+		std::fill(frame.begin() + pos, frame.begin() + pos + 3, byte(0));
+		frame[pos + 3] = byte(1);
+	}
+
+	auto rtpConfig = std::make_shared<RtpPacketizationConfig>(42, "benchmark", 96,
+	                                                          H264RtpPacketizer::defaultClockRate);
+	H264RtpPacketizer packetizer(H264RtpPacketizer::Separator::StartSequence, rtpConfig);
+
+	size_t processedSize = 0;
+	size_t packetCount = 0;
+	const auto startTime = steady_clock::now();
+	while (steady_clock::now() - startTime < options.duration) {
+		auto messages = make_chained_messages_product();
+		messages->push_back(std::make_shared<binary>(frame));
+		auto product = packetizer.processOutgoingBinaryMessage(messages, nullptr);
+		packetCount += product.messages ? product.messages->size() : 0;
+		processedSize += frame.size();
+	}
+	const auto elapsed = steady_clock::now() - startTime;
+
+	Result result("h264_packetization");
+	result.param("frame_size", frame.size());
+	result.metric("mbytes_per_s", double(processedSize) / (seconds(elapsed) * 1e6));
+	result.metric("packets_per_s", double(packetCount) / seconds(elapsed));
+	return result;
+}
+
+// Measure the SRTP protect/unprotect rate by sending RTP packets on a track as fast as possible
+Result benchSrtp(const Options &options, size_t packetSize) {
+	PeerConnection pc1;
+	PeerConnection pc2;
+	pc1.onLocalDescription([&pc2](Description sdp) { pc2.setRemoteDescription(std::move(sdp)); });
+	pc1.onLocalCandidate(
+	    [&pc2](Candidate candidate) { pc2.addRemoteCandidate(std::move(candidate)); });
+	pc2.onLocalDescription([&pc1](Description sdp) { pc1.setRemoteDescription(std::move(sdp)); });
+	pc2.onLocalCandidate(
+	    [&pc1](Candidate candidate) { pc1.addRemoteCandidate(std::move(candidate)); });
+
+	std::atomic<size_t> receivedCount = 0;
+	shared_ptr<Track> t2;
+	pc2.onTrack([&t2, &receivedCount](shared_ptr<Track> t) {
+		t->onMessage([&receivedCount](variant<binary, string> message) {
+			if (holds_alternative<binary>(message))
+				++receivedCount;
+		});
+		std::atomic_store(&t2, t);
+	});
+
+	const uint32_t ssrc = 42;
+	Description::Video media("benchmark", Description::Direction::SendOnly);
+	media.addH264Codec(96);
+	media.addSSRC(ssrc, "benchmark");
+	auto t1 = pc1.addTrack(media);
+	pc1.setLocalDescription();
+
+	const auto openDeadline = steady_clock::now() + 10s;
+	while (!t1->isOpen() && steady_clock::now() < openDeadline)
+		this_thread::sleep_for(10ms);
+
+	if (!t1->isOpen())
+		throw runtime_error("Track is not open");
+
+	binary packet(std::max(packetSize, sizeof(RtpHeader)));
+	std::fill(packet.begin(), packet.end(), byte(0xFF));
+	std::fill(packet.begin(), packet.begin() + sizeof(RtpHeader), byte(0));
+	auto rtp = reinterpret_cast<RtpHeader *>(packet.data());
+	rtp->preparePacket();
+	rtp->setPayloadType(96);
+	rtp->setSsrc(ssrc);
+
+	size_t sentCount = 0;
+	uint16_t seqNumber = 0;
+	const auto startTime = steady_clock::now();
+	while (steady_clock::now() - startTime < options.duration) {
+		rtp->setSeqNumber(seqNumber++);
+		if (t1->send(packet))
+			++sentCount;
+	}
+	const auto elapsed = steady_clock::now() - startTime;
+	this_thread::sleep_for(500ms); // let the last packets arrive
+
+	if (auto t = std::atomic_load(&t2))
+		t->onMessage(nullptr);
+
+	pc1.close();
+	pc2.close();
+
+	Result result("srtp");
+	result.param("packet_size", packet.size());
+	result.metric("protect_packets_per_s", double(sentCount) / seconds(elapsed));
+	result.metric("unprotect_packets_per_s", double(receivedCount) / seconds(elapsed));
+	return result;
+}
+
+#endif
+
+#if RTC_ENABLE_WEBSOCKET
+
+// Echo messages through a local WebSocket server with a bounded number in flight
+Results benchWebSocket(const Options &options) {
+	WebSocketServer::Configuration serverConfig;
+	serverConfig.port = options.port;
+	WebSocketServer server(std::move(serverConfig));
+	server.onClient([](shared_ptr<WebSocket> client) {
+		client->onMessage([wclient = weak_ptr<WebSocket>(client)](variant<binary, string> message) {
+			if (auto client = wclient.lock())
+				client->send(std::move(message));
+		});
+	});
+
+	Results results;
+	for (size_t messageSize : {size_t(64), size_t(16384)}) {
+		const size_t window = 32;
+		std::mutex mutex;
+		std::condition_variable cv;
+		size_t inFlight = 0;
+		size_t echoedSize = 0;
+		size_t echoedCount = 0;
+
+		WebSocket ws;
+		ws.onOpen([&]() {
+			std::lock_guard lock(mutex);
+			cv.notify_all();
+		});
+		ws.onMessage([&](variant<binary, string> message) {
+			if (!holds_alternative<binary>(message))
+				return;
+
+			std::lock_guard lock(mutex);
+			echoedSize += get<binary>(message).size();
+			++echoedCount;
+			--inFlight;
+			cv.notify_all();
+		});
+		ws.open("ws://127.0.0.1:" + to_string(options.port) + "/");
+
+		{
+			std::unique_lock lock(mutex);
+			if (!cv.wait_for(lock, 10s, [&]() { return ws.isOpen(); }))
+				throw runtime_error("WebSocket is not open");
+		}
+
+		const binary payload = makePayload(messageSize);
+		const auto startTime = steady_clock::now();
+		while (steady_clock::now() - startTime < options.duration) {
+			std::unique_lock lock(mutex);
+			if (!cv.wait_for(lock, 1s, [&]() { return inFlight < window; }))
+				throw runtime_error("WebSocket echo stalled");
+
+			++inFlight;
+			lock.unlock();
+			ws.send(payload);
+		}
+		const auto elapsed = steady_clock::now() - startTime;
+
+		ws.onOpen(nullptr);
+		ws.onMessage(nullptr);
+		ws.close();
+
+		std::lock_guard lock(mutex);
+		Result result("websocket_echo");
+		result.param("message_size", messageSize);
+		result.param("window", window);
+		result.metric("goodput_mbps", double(echoedSize) * 8 / (seconds(elapsed) * 1e6));
+		result.metric("messages_per_s", double(echoedCount) / seconds(elapsed));
+		results.push_back(std::move(result));
+	}
+
+	server.stop();
+	return results;
+}
+
+#endif
+
+string escape(const string &str) {
+	string out;
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (uint8_t(c) < 0x20) {
+			std::ostringstream oss;
+			oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c);
+			out += oss.str();
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
+
+void writeJson(std::ostream &os, const Options &options, const Results &results) {
+	os << std::fixed << std::setprecision(3);
+	os << "{\n";
+	os << "  \"suite\": \"rtc_bench\",\n";
+	os << "  \"duration_ms\": " << options.duration.count() << ",\n";
+	os << "  \"results\": [";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto &result = results[i];
+		os << (i > 0 ? "," : "") << "\n    {\"name\": \"" << escape(result.name) << "\"";
+
+		os << ", \"params\": {";
+		for (size_t j = 0; j < result.params.size(); ++j)
+			os << (j > 0 ? ", " : "") << "\"" << escape(result.params[j].first) << "\": \""
+			   << escape(result.params[j].second) << "\"";
+
+		os << "}, \"metrics\": {";
+		for (size_t j = 0; j < result.metrics.size(); ++j) {
+			os << (j > 0 ? ", " : "") << "\"" << escape(result.metrics[j].first) << "\": ";
+			if (std::isfinite(result.metrics[j].second))
+				os << result.metrics[j].second;
+			else
+				os << "null";
+		}
+		os << "}}";
+	}
+	os << "\n  ]\n}\n";
+}
+
+Options parseOptions(int argc, char **argv) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+		if (i + 1 >= argc)
+			throw invalid_argument("Missing value for " + arg);
+
+		const string value = argv[++i];
+		if (arg == "--duration")
+			options.duration = milliseconds(std::stoul(value));
+		else if (arg == "--connections")
+			options.connections = std::stoul(value);
+		else if (arg == "--iterations")
+			options.iterations = std::stoi(value);
+		else if (arg == "--port")
+			options.port = uint16_t(std::stoul(value));
+		else if (arg == "--idle-connections")
+			options.idleConnections = std::stoul(value);
+		else if (arg == "--in-process")
+			options.inProcess = std::stoi(value) != 0;
+		else if (arg == "--replay")
+			options.replay = value;
+		else if (arg == "--speed")
+			options.replaySpeed = std::stod(value);
+		else if (arg == "--filter")
+			options.filter = value;
+		else if (arg == "--output")
+			options.output = value;
+		else
+			throw invalid_argument("Unknown option " + arg);
+	}
+	return options;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	Options options;
+	try {
+		options = parseOptions(argc, argv);
+	} catch (const std::exception &e) {
+		cerr << "Invalid arguments: " << e.what() << endl;
+		return -1;
+	}
+
+	// Logs go to stderr so stdout only contains JSON
+	rtc::InitLogger(LogLevel::Warning, [](LogLevel, string message) { cerr << message << endl; });
+	rtc::Preload();
+
+	vector<pair<string, std::function<Results()>>> scenarios;
+	auto add = [&scenarios](string name, std::function<Results()> func) {
+		scenarios.emplace_back(std::move(name), std::move(func));
+	};
+
+	for (bool reliable : {true, false}) {
+		for (size_t size : {size_t(64), size_t(65535)}) {
+			add("datachannel_throughput", [&, size, reliable]() {
+				return Results{benchThroughput(options, size, reliable)};
+			});
+			add("datachannel_latency", [&, size, reliable]() {
+				return Results{benchLatency(options, size, reliable)};
+			});
+		}
+	}
+	// Goodput and latency over emulated networks, for transport behavior regressions
+	for (const auto &profile : makeProfiles()) {
+		add("impaired_throughput", [&, profile]() {
+			return Results{benchThroughput(options, 16384, true, &profile)};
+		});
+		add("impaired_latency",
+		    [&, profile]() { return Results{benchLatency(options, 1024, true, &profile)}; });
+	}
+	for (size_t n = 1; n <= options.connections; n *= 2)
+		add("datachannel_scaling", [&, n]() { return Results{benchScaling(options, n)}; });
+
+	if (!options.replay.empty())
+		add("capture_replay", [&]() { return Results{benchReplay(options)}; });
+
+	add("connection_setup", [&]() { return Results{benchSetup(options)}; });
+	// The compact profile is measured first since freed memory is reused by the next scenario
+	for (bool compact : {true, false})
+		add("idle_footprint",
+		    [&, compact]() { return Results{benchIdleFootprint(options, compact)}; });
+	add("sdp", [&]() { return Results{benchSdp(options, 64)}; });
+#if RTC_ENABLE_MEDIA
+	add("h264_packetization", [&]() { return Results{benchH264(options, 1 << 20)}; });
+	add("srtp", [&]() { return Results{benchSrtp(options, 1200)}; });
+#endif
+#if RTC_ENABLE_WEBSOCKET
+	add("websocket_echo", [&]() { return benchWebSocket(options); });
+#endif
+
+	Results results;
+	bool failed = false;
+	for (auto &[name, func] : scenarios) {
+		if (name.find(options.filter) == string::npos)
+			continue;
+
+		cerr << "Running " << name << "..." << endl;
+		try {
+			for (auto &result : func())
+				results.push_back(std::move(result));
+
+		} catch (const std::exception &e) {
+			cerr << "Scenario " << name << " failed: " << e.what() << endl;
+			results.push_back(std::move(Result(name).param("error", e.what())));
+			failed = true;
+		}
+	}
+
+	rtc::Cleanup();
+
+	if (options.output.empty()) {
+		writeJson(cout, options, results);
+	} else {
+		std::ofstream file(options.output);
+		writeJson(file, options, results);
+		if (!file) {
+			cerr << "Failed to write " << options.output << endl;
+			return -1;
+		}
+	}
+
+	return failed ? -1 : 0;
+}
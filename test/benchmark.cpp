@@ -22,6 +22,8 @@
 #include <chrono>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <string>
 #include <thread>
 
 using namespace rtc;
@@ -34,7 +36,7 @@ using chrono::steady_clock;
 
 template <class T> weak_ptr<T> make_weak_ptr(shared_ptr<T> ptr) { return ptr; }
 
-size_t benchmark(milliseconds duration) {
+size_t benchmark(milliseconds duration, size_t messageSize) {
 	rtc::InitLogger(LogLevel::Warning);
 	rtc::Preload();
 
@@ -80,22 +82,25 @@ size_t benchmark(milliseconds duration) {
 		cout << "Gathering state 2: " << state << endl;
 	});
 
-	const size_t messageSize = 65535;
 	binary messageData(messageSize);
 	fill(messageData.begin(), messageData.end(), byte(0xFF));
 
 	atomic<size_t> receivedSize = 0;
+	atomic<size_t> receivedCount = 0;
 
 	steady_clock::time_point startTime, openTime, receivedTime, endTime;
 
 	shared_ptr<DataChannel> dc2;
-	pc2.onDataChannel([&dc2, &receivedSize, &receivedTime](shared_ptr<DataChannel> dc) {
-		dc->onMessage([&receivedTime, &receivedSize](variant<binary, string> message) {
+	pc2.onDataChannel([&dc2, &receivedSize, &receivedCount,
+	                   &receivedTime](shared_ptr<DataChannel> dc) {
+		dc->onMessage([&receivedTime, &receivedSize,
+		               &receivedCount](variant<binary, string> message) {
 			if (holds_alternative<binary>(message)) {
 				const auto &bin = get<binary>(message);
-				if (receivedSize == 0)
+				if (receivedCount == 0)
 					receivedTime = steady_clock::now();
 				receivedSize += bin.size();
+				++receivedCount;
 			}
 		});
 
@@ -164,6 +169,12 @@ size_t benchmark(milliseconds duration) {
 	cout << "Goodput: " << goodput * 0.001 << " MB/s"
 	     << " (" << goodput * 0.001 * 8 << " Mbit/s)" << endl;
 
+	size_t rate = transferDuration.count() > 0
+	                  ? size_t(receivedCount.load() * 1000 / transferDuration.count())
+	                  : 0;
+	cout << "Message rate: " << rate << " messages/s"
+	     << " (message size: " << messageSize << " bytes)" << endl;
+
 	pc1.close();
 	pc2.close();
 
@@ -171,13 +182,190 @@ size_t benchmark(milliseconds duration) {
 	return goodput;
 }
 
+// Measure the SRTP protect/unprotect rate by sending RTP packets on a track as fast as possible
+size_t benchmarkMedia(milliseconds duration, size_t packetSize) {
+	rtc::InitLogger(LogLevel::Warning);
+	rtc::Preload();
+
+	PeerConnection pc1;
+	PeerConnection pc2;
+
+	pc1.onLocalDescription([&pc2](Description sdp) { pc2.setRemoteDescription(std::move(sdp)); });
+	pc1.onLocalCandidate(
+	    [&pc2](Candidate candidate) { pc2.addRemoteCandidate(std::move(candidate)); });
+	pc2.onLocalDescription([&pc1](Description sdp) { pc1.setRemoteDescription(std::move(sdp)); });
+	pc2.onLocalCandidate(
+	    [&pc1](Candidate candidate) { pc1.addRemoteCandidate(std::move(candidate)); });
+
+	atomic<size_t> receivedCount = 0;
+	shared_ptr<Track> t2;
+	pc2.onTrack([&t2, &receivedCount](shared_ptr<Track> t) {
+		t->onMessage([&receivedCount](variant<binary, string> message) {
+			if (holds_alternative<binary>(message))
+				++receivedCount;
+		});
+		std::atomic_store(&t2, t);
+	});
+
+	const uint32_t ssrc = 42;
+	Description::Video media("benchmark", Description::Direction::SendOnly);
+	media.addH264Codec(96);
+	media.addSSRC(ssrc, "benchmark");
+	auto t1 = pc1.addTrack(media);
+	pc1.setLocalDescription();
+
+	int attempts = 10;
+	while (!t1->isOpen() && attempts--)
+		this_thread::sleep_for(1s);
+
+	if (!t1->isOpen())
+		throw runtime_error("Track is not open");
+
+	binary packet(std::max(packetSize, sizeof(RtpHeader)));
+	fill(packet.begin(), packet.end(), byte(0xFF));
+	fill(packet.begin(), packet.begin() + sizeof(RtpHeader), byte(0));
+	auto rtp = reinterpret_cast<RtpHeader *>(packet.data());
+	rtp->preparePacket();
+	rtp->setPayloadType(96);
+	rtp->setSsrc(ssrc);
+
+	cout << "Track open, sending RTP packets..." << endl;
+	size_t sentCount = 0;
+	const auto startTime = steady_clock::now();
+	uint16_t seqNumber = 0;
+	while (steady_clock::now() - startTime < duration) {
+		rtp->setSeqNumber(seqNumber++);
+		if (t1->send(packet))
+			++sentCount;
+	}
+	const auto elapsed = duration_cast<milliseconds>(steady_clock::now() - startTime);
+	this_thread::sleep_for(1s); // let the last packets arrive
+
+	size_t sentRate = elapsed.count() > 0 ? size_t(sentCount * 1000 / elapsed.count()) : 0;
+	size_t receivedRate =
+	    elapsed.count() > 0 ? size_t(receivedCount.load() * 1000 / elapsed.count()) : 0;
+	cout << "SRTP protect rate: " << sentRate << " packets/s"
+	     << " (packet size: " << packet.size() << " bytes)" << endl;
+	cout << "SRTP unprotect rate: " << receivedRate << " packets/s" << endl;
+
+	pc1.close();
+	pc2.close();
+
+	rtc::Cleanup();
+	return receivedRate;
+}
+
+// Measure the rate at which H264 access units with start sequences are split and packetized
+size_t benchmarkH264(milliseconds duration, size_t frameSize) {
+	// Random payload with emulation prevention, like a real keyframe
+	std::mt19937 generator(42);
+	binary frame(std::max(frameSize, size_t(64)));
+	for (auto &b : frame)
+		b = byte(generator() & 0xFF);
+
+	for (size_t i = 2; i < frame.size(); ++i)
+		if (frame[i - 2] == byte(0) && frame[i - 1] == byte(0) && uint8_t(frame[i]) <= 3)
+			frame[i] = byte(3);
+
+	// SPS, PPS, and IDR slice
+	const size_t positions[] = {0, 16, 32};
+	for (size_t pos : positions) {
+		std::fill(frame.begin() + pos, frame.begin() + pos + 3, byte(0));
+		frame[pos + 3] = byte(1);
+	}
+
+	auto rtpConfig = std::make_shared<RtpPacketizationConfig>(42, "benchmark", 96,
+	                                                          H264RtpPacketizer::defaultClockRate);
+	H264RtpPacketizer packetizer(H264RtpPacketizer::Separator::StartSequence, rtpConfig);
+
+	size_t processedSize = 0;
+	size_t packetCount = 0;
+	const auto startTime = steady_clock::now();
+	while (steady_clock::now() - startTime < duration) {
+		auto messages = make_chained_messages_product();
+		messages->push_back(std::make_shared<binary>(frame));
+		auto product = packetizer.processOutgoingBinaryMessage(messages, nullptr);
+		packetCount += product.messages ? product.messages->size() : 0;
+		processedSize += frame.size();
+	}
+	const auto elapsed = duration_cast<milliseconds>(steady_clock::now() - startTime);
+
+	size_t rate = elapsed.count() > 0 ? processedSize / elapsed.count() : 0;
+	cout << "H264 packetization rate: " << rate * 0.001 << " MB/s"
+	     << " (frame size: " << frame.size() << " bytes, " << packetCount << " packets)" << endl;
+
+	return rate;
+}
+
+// Measure the rate at which a large multi-track SDP is parsed and generated again
+size_t benchmarkSdp(milliseconds duration, int tracks) {
+	Description description("v=0\r\n"
+	                        "o=rtc 123456789 0 IN IP4 127.0.0.1\r\n"
+	                        "s=-\r\n"
+	                        "t=0 0\r\n",
+	                        Description::Type::Offer);
+	description.setFingerprint(
+	    "AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:45:"
+	    "67:89");
+	for (int i = 0; i < tracks; ++i) {
+		if (i % 2 == 0) {
+			Description::Video video("video-" + std::to_string(i));
+			video.addH264Codec(96);
+			video.addVP8Codec(98);
+			video.addVP9Codec(100);
+			video.addAV1Codec(102);
+			video.addRTXCodec(97, 96, 90000);
+			video.addSSRC(uint32_t(1000 + i), "cname-" + std::to_string(i), "stream", "track");
+			description.addMedia(std::move(video));
+		} else {
+			Description::Audio audio("audio-" + std::to_string(i));
+			audio.addOpusCodec(111);
+			audio.addSSRC(uint32_t(1000 + i), "cname-" + std::to_string(i), "stream", "track");
+			description.addMedia(std::move(audio));
+		}
+	}
+	description.addApplication("data");
+	const string sdp = description.generateSdp("\r\n");
+
+	size_t count = 0;
+	const auto startTime = steady_clock::now();
+	while (steady_clock::now() - startTime < duration) {
+		Description parsed(sdp, Description::Type::Offer);
+		if (parsed.generateSdp("\r\n").size() != sdp.size())
+			throw runtime_error("SDP mismatch after parsing");
+
+		++count;
+	}
+	const auto elapsed = duration_cast<milliseconds>(steady_clock::now() - startTime);
+
+	size_t rate = elapsed.count() > 0 ? count * 1000 / elapsed.count() : 0;
+	cout << "SDP parsing and generation rate: " << rate << " descriptions/s"
+	     << " (" << tracks << " tracks, " << sdp.size() << " bytes)" << endl;
+
+	return rate;
+}
+
 #ifdef BENCHMARK_MAIN
 int main(int argc, char **argv) {
 	try {
-		size_t goodput = benchmark(30s);
+		// An optional argument sets the message size, e.g. 64 for small messages
+		const size_t messageSize = argc > 1 ? size_t(std::stoul(argv[1])) : 65535;
+		size_t goodput = benchmark(30s, messageSize);
 		if (goodput == 0)
 			throw runtime_error("No data received");
 
+		size_t packetRate = benchmarkMedia(10s, 1200);
+		if (packetRate == 0)
+			throw runtime_error("No media received");
+
+		size_t h264Rate = benchmarkH264(5s, 1 << 20);
+		if (h264Rate == 0)
+			throw runtime_error("No H264 frame packetized");
+
+		size_t sdpRate = benchmarkSdp(5s, 64);
+		if (sdpRate == 0)
+			throw runtime_error("No SDP parsed");
+
 		return 0;
 
 	} catch (const std::exception &e) {
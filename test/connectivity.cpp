@@ -59,9 +59,27 @@ void test_connectivity() {
 
 	PeerConnection pc2(config2);
 
-	pc1.onLocalDescription([&pc2](Description sdp) {
+	// Pre-negotiated channel, messages sent before open must be delivered in order
+	DataChannelInit earlyInit;
+	earlyInit.negotiated = true;
+	earlyInit.id = 43;
+	shared_ptr<DataChannel> early2;
+	std::atomic<int> earlyReceived = 0;
+
+	pc1.onLocalDescription([&pc2, &early2, &earlyInit, &earlyReceived](Description sdp) {
 		cout << "Description 1: " << sdp << endl;
 		pc2.setRemoteDescription(string(sdp));
+
+		// Create the remote side once the offer is received, so it does not start a negotiation
+		if (!std::atomic_load(&early2)) {
+			auto dc = pc2.createDataChannel("early", earlyInit);
+			dc->onMessage([&earlyReceived](variant<binary, string> message) {
+				if (holds_alternative<string>(message) &&
+				    get<string>(message) == "Early " + to_string(earlyReceived + 1))
+					++earlyReceived;
+			});
+			std::atomic_store(&early2, dc);
+		}
 	});
 
 	pc1.onLocalCandidate([&pc2](Candidate candidate) {
@@ -123,6 +141,13 @@ void test_connectivity() {
 
 	auto dc1 = pc1.createDataChannel("test");
 
+	auto early1 = pc1.createDataChannel("early", earlyInit);
+	if (early1->isOpen())
+		throw runtime_error("Pre-negotiated DataChannel is open before connection");
+
+	early1->send("Early 1");
+	early1->send("Early 2");
+
 	dc1->onOpen([wdc1 = make_weak_ptr(dc1)]() {
 		if (auto dc1 = wdc1.lock()) {
 			cout << "DataChannel 1: Open" << endl;
@@ -149,6 +174,13 @@ void test_connectivity() {
 	if (!adc2 || !adc2->isOpen() || !dc1->isOpen())
 		throw runtime_error("DataChannel is not open");
 
+	attempts = 5;
+	while (earlyReceived < 2 && attempts--)
+		this_thread::sleep_for(1s);
+
+	if (earlyReceived != 2)
+		throw runtime_error("Messages sent before open on a pre-negotiated DataChannel were lost");
+
 	if (dc1->maxMessageSize() != CUSTOM_MAX_MESSAGE_SIZE || dc2->maxMessageSize() != CUSTOM_MAX_MESSAGE_SIZE)
 		throw runtime_error("DataChannel max message size is incorrect");
 
@@ -171,6 +203,28 @@ void test_connectivity() {
 		cout << "Remote candidate 2: " << remote << endl;
 	}
 
+	auto timeline = pc1.setupTimeline();
+	if (!timeline.iceConnected || !timeline.dtlsConnected || !timeline.sctpConnected ||
+	    !timeline.dataChannelOpen || timeline.dtlsFlights.empty())
+		throw runtime_error("Setup timeline is incomplete");
+
+	auto since = [&timeline](SetupTimeline::clock::time_point t) {
+		return chrono::duration_cast<chrono::milliseconds>(t - timeline.created).count();
+	};
+	cout << "Setup timeline 1: ICE " << since(*timeline.iceConnected) << "ms, DTLS "
+	     << since(*timeline.dtlsConnected) << "ms (" << timeline.dtlsFlights.size()
+	     << " flights), SCTP " << since(*timeline.sctpConnected) << "ms, DataChannel "
+	     << since(*timeline.dataChannelOpen) << "ms" << endl;
+
+	auto iceStats = pc1.iceStats();
+	if (!iceStats || iceStats->packetsSent == 0 || iceStats->packetsReceived == 0 ||
+	    !iceStats->rtt)
+		throw runtime_error("ICE stats are incomplete");
+
+	cout << "ICE stats 1: " << iceStats->packetsSent << " packets sent, "
+	     << iceStats->packetsReceived << " packets received, RTT " << iceStats->rtt->count()
+	     << "ms" << endl;
+
 	// Try to open a second data channel with another label
 	shared_ptr<DataChannel> second2;
 	pc2.onDataChannel([&second2](shared_ptr<DataChannel> dc) {
@@ -246,6 +300,42 @@ void test_connectivity() {
 	if (!received)
 		throw runtime_error("Negotiated DataChannel failed");
 
+	// Try a compressed channel, unless the library is built without zlib
+	DataChannelInit compressedInit = init;
+	compressedInit.id = 44;
+	compressedInit.compression = true;
+	shared_ptr<DataChannel> compressed1;
+	try {
+		compressed1 = pc1.createDataChannel("compressed", compressedInit);
+	} catch (const std::logic_error &e) {
+		cout << "Skipping compressed DataChannel: " << e.what() << endl;
+	}
+	if (compressed1) {
+		auto compressed2 = pc2.createDataChannel("compressed", compressedInit);
+		if (!compressed1->isCompressed() || !compressed2->isCompressed())
+			throw runtime_error("DataChannel is not compressed");
+
+		string text;
+		for (int i = 0; i < 100; ++i)
+			text += "{\"type\":\"update\",\"index\":" + to_string(i) + "}";
+
+		std::atomic<bool> decompressed = false;
+		compressed2->onMessage([&decompressed, text](const variant<binary, string> &message) {
+			if (holds_alternative<string>(message) && get<string>(message) == text)
+				decompressed = true;
+		});
+
+		compressed1->send(text);
+
+		// Wait a bit
+		attempts = 5;
+		while (!decompressed && attempts--)
+			this_thread::sleep_for(1s);
+
+		if (!decompressed)
+			throw runtime_error("Compressed DataChannel failed");
+	}
+
 	// Delay close of peer 2 to check closing works properly
 	pc1.close();
 	this_thread::sleep_for(1s);
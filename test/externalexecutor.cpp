@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtc/rtc.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+using namespace rtc;
+using namespace std;
+using namespace chrono_literals;
+
+// Drives two PeerConnections from a single thread, all library tasks being run by Poll()
+void test_external_executor() {
+	InitLogger(LogLevel::Debug);
+
+	ThreadPoolSettings settings;
+	settings.external = true;
+	SetThreadPoolSettings(settings);
+
+	auto poll = [](chrono::milliseconds duration, auto done) {
+		auto deadline = chrono::steady_clock::now() + duration;
+		while (!done() && chrono::steady_clock::now() < deadline)
+			Poll(50ms);
+
+		return done();
+	};
+
+	string received;
+	{
+		auto pc1 = make_unique<PeerConnection>();
+		auto pc2 = make_unique<PeerConnection>();
+
+		// Callbacks run on this thread, inside Poll()
+		pc1->onLocalDescription([&pc2](Description sdp) {
+			if (pc2)
+				pc2->setRemoteDescription(sdp);
+		});
+		pc1->onLocalCandidate([&pc2](Candidate candidate) {
+			if (pc2)
+				pc2->addRemoteCandidate(candidate);
+		});
+		pc2->onLocalDescription([&pc1](Description sdp) {
+			if (pc1)
+				pc1->setRemoteDescription(sdp);
+		});
+		pc2->onLocalCandidate([&pc1](Candidate candidate) {
+			if (pc1)
+				pc1->addRemoteCandidate(candidate);
+		});
+
+		shared_ptr<DataChannel> dc2;
+		pc2->onDataChannel([&dc2, &received](shared_ptr<DataChannel> dc) {
+			dc->onMessage([&received](variant<binary, string> message) {
+				if (holds_alternative<string>(message))
+					received = get<string>(message);
+			});
+			dc2 = dc;
+		});
+
+		// Creating the DataChannel triggers setLocalDescription() on this thread, which must not
+		// block waiting for the certificate
+		auto dc1 = pc1->createDataChannel("test");
+		dc1->onOpen([wdc = weak_ptr<DataChannel>(dc1)]() {
+			if (auto dc = wdc.lock())
+				dc->send("Hello from 1");
+		});
+
+		if (!poll(10s, [&]() { return !received.empty(); }))
+			throw runtime_error("No message received with an external executor");
+
+		cout << "Message 2: " << received << endl;
+		if (received != "Hello from 1")
+			throw runtime_error("Wrong message received with an external executor");
+
+		dc1->close();
+		dc1.reset();
+		dc2.reset();
+
+		// Destroying the PeerConnections waits for their pending tasks on this thread
+		pc1.reset();
+		pc2.reset();
+	}
+
+	// Remaining tasks hold the library initialized, so keep polling until cleanup is done
+	auto cleanup = Cleanup();
+	if (!poll(10s, [&]() { return cleanup.wait_for(0s) == future_status::ready; }))
+		throw runtime_error("Cleanup timeout with an external executor");
+
+	SetThreadPoolSettings({});
+}
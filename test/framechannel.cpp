@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtc/rtc.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace rtc;
+using namespace std;
+using namespace chrono_literals;
+
+void test_framechannel() {
+	InitLogger(LogLevel::Debug);
+
+	PeerConnection pc1;
+	PeerConnection pc2;
+
+	pc1.onLocalDescription([&pc2](Description sdp) {
+		cout << "Description 1: " << sdp << endl;
+		pc2.setRemoteDescription(string(sdp));
+	});
+
+	pc1.onLocalCandidate([&pc2](Candidate candidate) {
+		cout << "Candidate 1: " << candidate << endl;
+		pc2.addRemoteCandidate(string(candidate));
+	});
+
+	pc2.onLocalDescription([&pc1](Description sdp) {
+		cout << "Description 2: " << sdp << endl;
+		pc1.setRemoteDescription(string(sdp));
+	});
+
+	pc2.onLocalCandidate([&pc1](Candidate candidate) {
+		cout << "Candidate 2: " << candidate << endl;
+		pc1.addRemoteCandidate(string(candidate));
+	});
+
+	// Frames larger than a chunk are split, the last one is empty
+	const vector<size_t> sizes = {1000, 40000, 100000, 0};
+	auto makeFrame = [](size_t size, size_t index) {
+		binary frame(size);
+		for (size_t i = 0; i < size; ++i)
+			frame[i] = byte((i + index) & 0xFF);
+		return frame;
+	};
+
+	std::mutex mutex;
+	vector<binary> received;
+	shared_ptr<FrameChannel> fc2;
+	pc2.onDataChannel([&](shared_ptr<DataChannel> dc) {
+		cout << "DataChannel 2: Received with label \"" << dc->label() << "\"" << endl;
+		auto fc = std::make_shared<FrameChannel>(dc);
+		fc->onFrame([&](const binary &frame) {
+			std::lock_guard lock(mutex);
+			received.push_back(frame);
+		});
+		std::atomic_store(&fc2, fc);
+	});
+
+	// The channel is reliable, frames are only partially reliable
+	auto dc1 = pc1.createDataChannel("frames");
+	FrameChannel fc1(dc1);
+
+	int attempts = 10;
+	while (!dc1->isOpen() && attempts--)
+		this_thread::sleep_for(1s);
+
+	if (!dc1->isOpen())
+		throw runtime_error("DataChannel is not open");
+
+	for (size_t i = 0; i < sizes.size(); ++i)
+		fc1.sendFrame(makeFrame(sizes[i], i), 5s);
+
+	// A message with its own reliability must not change the one of the channel
+	if (dc1->reliability().type != Reliability::Type::Reliable || dc1->reliability().unordered)
+		throw runtime_error("Frames changed the DataChannel reliability");
+
+	attempts = 10;
+	while (attempts--) {
+		{
+			std::lock_guard lock(mutex);
+			if (received.size() >= sizes.size())
+				break;
+		}
+		this_thread::sleep_for(1s);
+	}
+
+	{
+		std::lock_guard lock(mutex);
+		if (received.size() != sizes.size())
+			throw runtime_error("Frames not received");
+
+		for (size_t i = 0; i < sizes.size(); ++i)
+			if (received[i] != makeFrame(sizes[i], i))
+				throw runtime_error("Frame " + to_string(i) + " is corrupted or out of order");
+	}
+
+	if (fc1.stats().framesSent != sizes.size())
+		throw runtime_error("Wrong count of sent frames");
+
+	if (auto fc = std::atomic_load(&fc2);
+	    !fc || fc->stats().framesReceived != sizes.size() || fc->stats().framesDropped != 0)
+		throw runtime_error("Wrong count of received frames");
+
+	pc1.close();
+	pc2.close();
+	this_thread::sleep_for(1s);
+
+	cout << "Success" << endl;
+}
@@ -0,0 +1,236 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtc/rtc.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "impl/hpack.hpp"
+#include "impl/http2transport.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+using namespace rtc;
+using namespace std;
+
+namespace {
+
+binary fromHex(const string &hex) {
+	binary out;
+	for (size_t i = 0; i + 1 < hex.size();) {
+		if (hex[i] == ' ') {
+			++i;
+			continue;
+		}
+		out.push_back(byte(stoul(hex.substr(i, 2), nullptr, 16)));
+		i += 2;
+	}
+	return out;
+}
+
+void checkHeaders(const impl::http::HeaderList &headers, const impl::http::HeaderList &expected,
+                  const string &name) {
+	if (headers != expected)
+		throw runtime_error("Unexpected headers decoded for " + name);
+}
+
+binary frame(uint8_t type, uint8_t flags, uint32_t id, const binary &payload = {}) {
+	binary out(9);
+	out[0] = byte(payload.size() >> 16);
+	out[1] = byte(payload.size() >> 8);
+	out[2] = byte(payload.size());
+	out[3] = byte(type);
+	out[4] = byte(flags);
+	out[5] = byte(id >> 24);
+	out[6] = byte(id >> 16);
+	out[7] = byte(id >> 8);
+	out[8] = byte(id);
+	out.insert(out.end(), payload.begin(), payload.end());
+	return out;
+}
+
+void test_hpack() {
+	using impl::hpack::Decoder;
+	const impl::http::HeaderList request1 = {
+	    {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}};
+	auto request2 = request1;
+	request2.emplace_back("cache-control", "no-cache");
+	const impl::http::HeaderList request3 = {{":method", "GET"},
+	                                         {":scheme", "https"},
+	                                         {":path", "/index.html"},
+	                                         {":authority", "www.example.com"},
+	                                         {"custom-key", "custom-value"}};
+
+	// Requests without Huffman coding, see https://www.rfc-editor.org/rfc/rfc7541.html#appendix-C.3
+	{
+		Decoder decoder;
+		auto block = fromHex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+		checkHeaders(decoder.decode(block.data(), block.size()), request1, "C.3.1");
+		block = fromHex("8286 84be 5808 6e6f 2d63 6163 6865");
+		checkHeaders(decoder.decode(block.data(), block.size()), request2, "C.3.2");
+		block = fromHex("8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65");
+		checkHeaders(decoder.decode(block.data(), block.size()), request3, "C.3.3");
+	}
+
+	// Requests with Huffman coding, see https://www.rfc-editor.org/rfc/rfc7541.html#appendix-C.4
+	{
+		Decoder decoder;
+		auto block = fromHex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff");
+		checkHeaders(decoder.decode(block.data(), block.size()), request1, "C.4.1");
+		block = fromHex("8286 84be 5886 a8eb 1064 9cbf");
+		checkHeaders(decoder.decode(block.data(), block.size()), request2, "C.4.2");
+		block = fromHex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf");
+		checkHeaders(decoder.decode(block.data(), block.size()), request3, "C.4.3");
+	}
+
+	// Responses evicting entries from a 256-byte dynamic table, see
+	// https://www.rfc-editor.org/rfc/rfc7541.html#appendix-C.5
+	{
+		Decoder decoder(256);
+		const impl::http::HeaderList response1 = {{":status", "302"},
+		                                          {"cache-control", "private"},
+		                                          {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+		                                          {"location", "https://www.example.com"}};
+		auto response2 = response1;
+		response2[0].second = "307";
+		const impl::http::HeaderList response3 = {
+		    {":status", "200"},
+		    {"cache-control", "private"},
+		    {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+		    {"location", "https://www.example.com"},
+		    {"content-encoding", "gzip"},
+		    {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}};
+
+		auto block = fromHex("4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 "
+		                     "7420 3230 3133 2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 "
+		                     "3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+		checkHeaders(decoder.decode(block.data(), block.size()), response1, "C.5.1");
+		block = fromHex("4803 3330 37c1 c0bf");
+		checkHeaders(decoder.decode(block.data(), block.size()), response2, "C.5.2");
+		block = fromHex("88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 "
+		                "3220 474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a "
+		                "584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33 "
+		                "3630 303b 2076 6572 7369 6f6e 3d31");
+		checkHeaders(decoder.decode(block.data(), block.size()), response3, "C.5.3");
+	}
+
+	// The encoder output must decode to the same list
+	{
+		Decoder decoder;
+		const impl::http::HeaderList headers = {{":method", "CONNECT"},
+		                                        {":protocol", "websocket"},
+		                                        {":path", "/chat"},
+		                                        {"sec-websocket-version", "13"}};
+		auto block = impl::hpack::encode(headers);
+		checkHeaders(decoder.decode(block.data(), block.size()), headers, "encoder output");
+	}
+
+	// A reference outside of the tables is an error
+	{
+		Decoder decoder;
+		auto block = fromHex("be");
+		bool failed = false;
+		try {
+			decoder.decode(block.data(), block.size());
+		} catch (const impl::hpack::Error &) {
+			failed = true;
+		}
+		if (!failed)
+			throw runtime_error("Invalid index not detected");
+	}
+}
+
+void test_http2_framing() {
+	using impl::Http2Stream;
+	using impl::Http2Transport;
+	using State = impl::Transport::State;
+
+	const uint8_t DATA = 0x0, HEADERS = 0x1, SETTINGS = 0x4;
+	const uint8_t FlagEndStream = 0x1, FlagEndHeaders = 0x4, FlagPadded = 0x8;
+
+	atomic<State> state = State::Disconnected;
+	auto connection =
+	    make_shared<Http2Transport>(nullptr, [&state](State s) { state = s; });
+	connection->start();
+
+	// The server preface enables extended CONNECT
+	connection->incoming(make_message(frame(SETTINGS, 0, 0, fromHex("0008 0000 0001"))));
+	if (state != State::Connected || !connection->isConnectProtocolEnabled())
+		throw runtime_error("HTTP/2 connection is not connected after SETTINGS");
+
+	atomic<State> streamState = State::Disconnected;
+	auto stream =
+	    make_shared<Http2Stream>(connection, [&streamState](State s) { streamState = s; });
+	binary received;
+	bool ended = false;
+	stream->onRecv([&received, &ended](message_ptr message) {
+		if (message)
+			received.insert(received.end(), message->begin(), message->end());
+		else
+			ended = true;
+	});
+	stream->start();
+
+	optional<impl::http::HeaderList> response;
+	if (!stream->request({{":method", "CONNECT"}, {":protocol", "websocket"}},
+	                     [&response](const impl::http::HeaderList &headers) { response = headers; }))
+		throw runtime_error("HTTP/2 stream could not be opened");
+
+	const uint32_t id = 1;
+	connection->incoming(make_message(
+	    frame(HEADERS, FlagEndHeaders, id, impl::hpack::encode({{":status", "200"}}))));
+	if (!response || response->empty() || response->front().second != "200" ||
+	    streamState != State::Connected)
+		throw runtime_error("HTTP/2 response not received");
+
+	// A frame split over several reads, then a padded frame
+	auto data = frame(DATA, 0, id, fromHex("0102 0304"));
+	connection->incoming(make_message(data.begin(), data.begin() + 5));
+	connection->incoming(make_message(data.begin() + 5, data.end()));
+	connection->incoming(make_message(frame(DATA, FlagPadded, id, fromHex("0205 0600 00"))));
+	if (received != fromHex("0102 0304 0506"))
+		throw runtime_error("HTTP/2 stream data not received properly");
+
+	connection->incoming(make_message(frame(DATA, FlagEndStream, id)));
+	if (!ended)
+		throw runtime_error("HTTP/2 stream end not received");
+
+	// A frame larger than the advertised maximum is a connection error
+	connection->incoming(make_message(frame(DATA, 0, 3, binary(16385))));
+	if (state != State::Failed || !connection->isGoingAway())
+		throw runtime_error("HTTP/2 oversized frame not detected");
+
+	connection->stop();
+	stream->stop();
+}
+
+} // namespace
+
+void test_http2() {
+	InitLogger(LogLevel::Debug);
+
+	test_hpack();
+	cout << "HPACK: Success" << endl;
+
+	test_http2_framing();
+	cout << "HTTP/2 framing: Success" << endl;
+}
+
+#endif
@@ -0,0 +1,255 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtc/rtc.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "impl/icetcpmux.hpp"
+#include "impl/sha.hpp"
+#include "impl/tcptransport.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace rtc;
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+binary fromHex(const string &hex) {
+	binary out;
+	for (size_t i = 0; i + 1 < hex.size(); i += 2)
+		out.push_back(byte(stoul(hex.substr(i, 2), nullptr, 16)));
+
+	return out;
+}
+
+void test_hmac_sha1() {
+	// See https://www.rfc-editor.org/rfc/rfc2202.html#section-3
+	struct Vector {
+		binary key;
+		string data;
+		string digest;
+	};
+	const Vector vectors[] = {
+	    {binary(20, byte(0x0b)), "Hi There", "b617318655057264e28bc0b6fb378c8ef146be00"},
+	    {fromHex("4a656665"), "what do ya want for nothing?",
+	     "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79"},
+	    {binary(20, byte(0xaa)), string(50, '\xdd'), "125d7342b9ac11cd91a39af48aa17b4f63f175d3"},
+	    {fromHex("0102030405060708090a0b0c0d0e0f10111213141516171819"), string(50, '\xcd'),
+	     "4c9007f4026250c6bc8414f9bf50c86c2d7235da"},
+	    {binary(20, byte(0x0c)), "Test With Truncation",
+	     "4c1a03424b55e07fe7f27be1d58bb9324a9a5a04"},
+	    {binary(80, byte(0xaa)), "Test Using Larger Than Block-Size Key - Hash Key First",
+	     "aa4ae5e15272d00e95705637ce8a3b55ed402112"},
+	    {binary(80, byte(0xaa)),
+	     "Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data",
+	     "e8e99d0f45237d786d6bbaa7965c7808bbff1a91"},
+	};
+
+	int index = 0;
+	for (const auto &vector : vectors) {
+		++index;
+		const string key(reinterpret_cast<const char *>(vector.key.data()), vector.key.size());
+		const auto digest = impl::HmacSha1(
+		    key, reinterpret_cast<const byte *>(vector.data.data()), vector.data.size());
+		if (digest != fromHex(vector.digest))
+			throw runtime_error("HMAC-SHA1 test case " + to_string(index) + " failed");
+	}
+}
+
+void write16(binary &buffer, size_t offset, uint16_t value) {
+	buffer[offset] = byte(value >> 8);
+	buffer[offset + 1] = byte(value);
+}
+
+void appendAttribute(binary &buffer, uint16_t type, const binary &value) {
+	const size_t offset = buffer.size();
+	buffer.resize(offset + 4 + ((value.size() + 3) & ~size_t(3)), byte(0));
+	write16(buffer, offset, type);
+	write16(buffer, offset + 2, uint16_t(value.size()));
+	copy(value.begin(), value.end(), buffer.begin() + offset + 4);
+	write16(buffer, 2, uint16_t(buffer.size() - 20));
+}
+
+// Binding request from the controlling remote agent, nominating the connection
+binary bindingRequest(const string &username, const string &key, byte id) {
+	binary request(20, byte(0));
+	write16(request, 0, 0x0001);
+	const binary cookie = fromHex("2112a442");
+	copy(cookie.begin(), cookie.end(), request.begin() + 4);
+	fill(request.begin() + 8, request.end(), id);
+	appendAttribute(request, 0x0006, binary(reinterpret_cast<const byte *>(username.data()),
+	                                        reinterpret_cast<const byte *>(username.data()) +
+	                                            username.size()));
+	appendAttribute(request, 0x0024, fromHex("6e7fffff"));         // PRIORITY
+	appendAttribute(request, 0x802A, fromHex("0102030405060708")); // ICE-CONTROLLING
+	appendAttribute(request, 0x0025, {});                          // USE-CANDIDATE
+
+	// MESSAGE-INTEGRITY covers the header with a length including the attribute
+	write16(request, 2, uint16_t(request.size() + 24 - 20));
+	appendAttribute(request, 0x0008, impl::HmacSha1(key, request.data(), request.size()));
+	return request;
+}
+
+void test_ice_tcp_passive() {
+	const string localUfrag = "tcpl", localPwd = "localpassword0123456789";
+	const string remoteUfrag = "tcpr", remotePwd = "remotepassword012345678";
+
+	using impl::IceTcpConnection;
+	using impl::IceTcpSession;
+	using impl::TcpTransport;
+	using State = impl::Transport::State;
+
+	mutex mutex;
+	binary received;
+	atomic<bool> selected = false;
+	auto session = make_shared<IceTcpSession>(0, localUfrag, localPwd);
+	session->start(
+	    [&](message_ptr message) {
+		    if (message) {
+			    lock_guard lock(mutex);
+			    received.insert(received.end(), message->begin(), message->end());
+		    }
+	    },
+	    [&selected](bool s) { selected = s; });
+	session->setRemoteCredentials(remoteUfrag, remotePwd, false); // controlled
+
+	// A connection whose first request has the wrong password is dropped
+	{
+		auto tcp = make_shared<TcpTransport>("127.0.0.1", to_string(session->port()), nullptr);
+		auto rejected = make_shared<IceTcpConnection>(tcp);
+		atomic<State> rejectedState = State::Disconnected;
+		rejected->onStateChange([&rejectedState](State state) { rejectedState = state; });
+		rejected->start();
+
+		int attempts = 50;
+		while (rejectedState != State::Connected && attempts--)
+			this_thread::sleep_for(100ms);
+
+		if (rejectedState != State::Connected)
+			throw runtime_error("ICE-TCP client is not connected");
+
+		rejected->send(
+		    make_message(bindingRequest(localUfrag + ':' + remoteUfrag, remotePwd, byte(1))));
+
+		attempts = 50;
+		while (rejectedState == State::Connected && attempts--)
+			this_thread::sleep_for(100ms);
+
+		if (rejectedState == State::Connected || selected)
+			throw runtime_error("Unauthenticated ICE-TCP connection was not dropped");
+
+		rejected->onStateChange(nullptr);
+		rejected->stop();
+	}
+
+	auto tcp = make_shared<TcpTransport>("127.0.0.1", to_string(session->port()), nullptr);
+	auto client = make_shared<IceTcpConnection>(tcp);
+	vector<message_ptr> responses;
+	client->onRecv([&](message_ptr message) {
+		if (message) {
+			lock_guard lock(mutex);
+			responses.push_back(std::move(message));
+		}
+	});
+	atomic<State> clientState = State::Disconnected;
+	client->onStateChange([&clientState](State state) { clientState = state; });
+	client->start();
+
+	int attempts = 50;
+	while (clientState != State::Connected && attempts--)
+		this_thread::sleep_for(100ms);
+
+	if (clientState != State::Connected)
+		throw runtime_error("ICE-TCP client is not connected");
+
+	// An authenticated request is answered and nominates the connection
+	client->send(make_message(bindingRequest(localUfrag + ':' + remoteUfrag, localPwd, byte(2))));
+
+	// The connection is selected before the response reaches the client
+	attempts = 50;
+	while (attempts--) {
+		{
+			lock_guard lock(mutex);
+			if (selected && !responses.empty())
+				break;
+		}
+		this_thread::sleep_for(100ms);
+	}
+
+	if (!selected || !session->isSelected())
+		throw runtime_error("ICE-TCP connection is not selected");
+
+	{
+		lock_guard lock(mutex);
+		if (responses.size() != 1)
+			throw runtime_error("Expected a single ICE-TCP binding response");
+
+		const auto &response = *responses.front();
+		if (response.size() < 20 || response[0] != byte(0x01) || response[1] != byte(0x01) ||
+		    response[8] != byte(2))
+			throw runtime_error("Unexpected ICE-TCP binding response");
+	}
+
+	// Media flows both ways over the selected connection
+	const binary payload = fromHex("80600001000000000000000100");
+	client->send(make_message(payload));
+	session->send(make_message(payload));
+
+	attempts = 50;
+	while (attempts--) {
+		{
+			lock_guard lock(mutex);
+			if (received == payload && responses.size() == 2)
+				break;
+		}
+		this_thread::sleep_for(100ms);
+	}
+
+	{
+		lock_guard lock(mutex);
+		if (received != payload)
+			throw runtime_error("ICE-TCP packet not received by the session");
+
+		if (responses.size() != 2 || *responses.back() != payload)
+			throw runtime_error("ICE-TCP packet not received by the remote");
+	}
+
+	client->stop();
+	session->stop();
+}
+
+} // namespace
+
+void test_ice_tcp() {
+	InitLogger(LogLevel::Debug);
+
+	test_hmac_sha1();
+	cout << "HMAC-SHA1: Success" << endl;
+
+	test_ice_tcp_passive();
+	cout << "ICE-TCP passive: Success" << endl;
+}
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtc/rtc.hpp"
+
+#include "impl/impairedlink.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace rtc;
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+using impl::ImpairedLink;
+using clock_type = ImpairedLink::clock;
+
+struct Delivery {
+	size_t index;
+	clock_type::duration time;
+
+	bool operator==(const Delivery &other) const {
+		return index == other.index && time == other.time;
+	}
+};
+
+// Sends count datagrams, one per millisecond of virtual time, and returns what is delivered
+vector<Delivery> run(const NetworkImpairment &impairment, size_t count) {
+	const auto start = clock_type::time_point(); // arbitrary origin of the virtual clock
+	auto now = start;
+	vector<Delivery> delivered;
+	auto link = std::make_shared<ImpairedLink>(
+	    impairment,
+	    [&](message_ptr message) {
+		    delivered.push_back({size_t(message->stream), now - start});
+	    },
+	    [&now]() { return now; });
+
+	for (size_t i = 0; i < count; ++i) {
+		link->send(make_message(100, Message::Binary, uint16_t(i)));
+		link->poll();
+		now += 1ms;
+	}
+
+	now += 10s;
+	link->poll();
+	link->stop();
+	return delivered;
+}
+
+} // namespace
+
+void test_impairedlink() {
+	// Timing is exact with a virtual clock: 100-byte datagrams take 100 ms at 8 kbit/s
+	NetworkImpairment bottleneck;
+	bottleneck.delay = 50ms;
+	bottleneck.bitrate = 8000;
+	bottleneck.queueSize = 300;
+	{
+		auto now = clock_type::time_point();
+		size_t count = 0;
+		auto link = std::make_shared<ImpairedLink>(
+		    bottleneck, [&count](message_ptr) { ++count; }, [&now]() { return now; });
+
+		for (int i = 0; i < 4; ++i)
+			link->send(make_message(100)); // the last one overflows the queue
+
+		now += 149ms;
+		link->poll();
+		if (count != 0)
+			throw runtime_error("Datagram delivered before the end of its transmission");
+
+		now += 1ms;
+		link->poll();
+		if (count != 1)
+			throw runtime_error("Datagram not delivered after transmission and delay");
+
+		now += 1s;
+		link->poll();
+		if (count != 3)
+			throw runtime_error("Bottleneck queue did not tail drop, delivered " +
+			                    to_string(count));
+
+		// Nothing is delivered once stopped
+		link->send(make_message(100));
+		link->stop();
+		now += 1s;
+		link->poll();
+		if (count != 3)
+			throw runtime_error("Datagram delivered after stop");
+	}
+
+	// The same seed gives the same losses, reordering, and timing
+	NetworkImpairment lossy;
+	lossy.delay = 20ms;
+	lossy.jitter = 10ms;
+	lossy.lossGood = 0.05;
+	lossy.lossBad = 0.5;
+	lossy.goodToBad = 0.05;
+	lossy.badToGood = 0.3;
+	lossy.reorder = 0.1;
+	lossy.seed = 42;
+
+	const size_t count = 1000;
+	const auto first = run(lossy, count);
+	const auto second = run(lossy, count);
+	if (first != second)
+		throw runtime_error("Runs with the same seed differ");
+
+	if (first.empty() || first.size() >= count)
+		throw runtime_error("Unexpected loss count: " + to_string(count - first.size()));
+
+	bool reordered = false;
+	for (size_t i = 1; i < first.size(); ++i) {
+		if (first[i].time < first[i - 1].time)
+			throw runtime_error("Datagrams not delivered in order of arrival");
+		if (first[i].index < first[i - 1].index)
+			reordered = true;
+	}
+	if (!reordered)
+		throw runtime_error("No datagram was reordered");
+
+	lossy.seed = 43;
+	if (run(lossy, count) == first)
+		throw runtime_error("Runs with different seeds are identical");
+
+	cout << "Success" << endl;
+}
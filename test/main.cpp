@@ -26,6 +26,9 @@ using namespace std;
 using namespace chrono_literals;
 
 void test_connectivity();
+void test_peerconnectiongroup();
+void test_framechannel();
+void test_impairedlink();
 void test_turn_connectivity();
 void test_track();
 void test_capi_connectivity();
@@ -33,10 +36,17 @@ void test_capi_track();
 void test_websocket();
 void test_websocketserver();
 void test_capi_websocketserver();
-size_t benchmark(chrono::milliseconds duration);
+void test_http2();
+void test_whipserver();
+void test_ice_tcp();
+void test_external_executor();
+size_t benchmark(chrono::milliseconds duration, size_t messageSize);
+size_t benchmarkMedia(chrono::milliseconds duration, size_t packetSize);
+size_t benchmarkH264(chrono::milliseconds duration, size_t frameSize);
+size_t benchmarkSdp(chrono::milliseconds duration, int tracks);
 
 void test_benchmark() {
-	size_t goodput = benchmark(10s);
+	size_t goodput = benchmark(10s, 65535);
 
 	if (goodput == 0)
 		throw runtime_error("No data received");
@@ -44,6 +54,26 @@ void test_benchmark() {
 	const size_t threshold = 1000; // 1 MB/s;
 	if (goodput < threshold)
 		throw runtime_error("Goodput is too low");
+
+	// Small messages stress the per-message overhead rather than the bandwidth
+	size_t smallGoodput = benchmark(10s, 64);
+	if (smallGoodput == 0)
+		throw runtime_error("No data received with small messages");
+
+	// SRTP packets per second on a single track
+	size_t packetRate = benchmarkMedia(5s, 1200);
+	if (packetRate == 0)
+		throw runtime_error("No media received");
+
+	// Splitting and packetization of a 1 MB keyframe
+	size_t h264Rate = benchmarkH264(2s, 1 << 20);
+	if (h264Rate == 0)
+		throw runtime_error("No H264 frame packetized");
+
+	// Parsing and generation of a large multi-track SDP
+	size_t sdpRate = benchmarkSdp(2s, 64);
+	if (sdpRate == 0)
+		throw runtime_error("No SDP parsed");
 }
 
 int main(int argc, char **argv) {
@@ -56,6 +86,30 @@ int main(int argc, char **argv) {
 		cerr << "WebRTC connectivity test failed: " << e.what() << endl;
 		return -1;
 	}
+	try {
+		cout << endl << "*** Running WebRTC PeerConnectionGroup test..." << endl;
+		test_peerconnectiongroup();
+		cout << "*** Finished WebRTC PeerConnectionGroup test" << endl;
+	} catch (const exception &e) {
+		cerr << "WebRTC PeerConnectionGroup test failed: " << e.what() << endl;
+		return -1;
+	}
+	try {
+		cout << endl << "*** Running WebRTC FrameChannel test..." << endl;
+		test_framechannel();
+		cout << "*** Finished WebRTC FrameChannel test" << endl;
+	} catch (const exception &e) {
+		cerr << "WebRTC FrameChannel test failed: " << e.what() << endl;
+		return -1;
+	}
+	try {
+		cout << endl << "*** Running impaired link test..." << endl;
+		test_impairedlink();
+		cout << "*** Finished impaired link test" << endl;
+	} catch (const exception &e) {
+		cerr << "Impaired link test failed: " << e.what() << endl;
+		return -1;
+	}
 	try {
 		cout << endl << "*** Running WebRTC TURN connectivity test..." << endl;
 		test_turn_connectivity();
@@ -94,6 +148,30 @@ int main(int argc, char **argv) {
 		cerr << "WebSocketServer test failed: " << e.what() << endl;
 		return -1;
 	}
+	try {
+		cout << endl << "*** Running HTTP/2 test..." << endl;
+		test_http2();
+		cout << "*** Finished HTTP/2 test" << endl;
+	} catch (const exception &e) {
+		cerr << "HTTP/2 test failed: " << e.what() << endl;
+		return -1;
+	}
+	try {
+		cout << endl << "*** Running WhipServer test..." << endl;
+		test_whipserver();
+		cout << "*** Finished WhipServer test" << endl;
+	} catch (const exception &e) {
+		cerr << "WhipServer test failed: " << e.what() << endl;
+		return -1;
+	}
+	try {
+		cout << endl << "*** Running ICE-TCP test..." << endl;
+		test_ice_tcp();
+		cout << "*** Finished ICE-TCP test" << endl;
+	} catch (const exception &e) {
+		cerr << "ICE-TCP test failed: " << e.what() << endl;
+		return -1;
+	}
 #endif
 	try {
 		// Every created object must have been destroyed, otherwise the wait will block
@@ -105,6 +183,15 @@ int main(int argc, char **argv) {
 		cerr << "Cleanup failed: " << e.what() << endl;
 		return -1;
 	}
+	try {
+		// Run after cleanup, as thread pool settings take effect on next initialization
+		cout << endl << "*** Running external executor test..." << endl;
+		test_external_executor();
+		cout << "*** Finished external executor test" << endl;
+	} catch (const exception &e) {
+		cerr << "External executor test failed: " << e.what() << endl;
+		return -1;
+	}
 
 	// C API tests
 	try {
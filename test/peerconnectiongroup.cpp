@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtc/rtc.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace rtc;
+using namespace std;
+using namespace chrono_literals;
+
+template <class T> weak_ptr<T> make_weak_ptr(shared_ptr<T> ptr) { return ptr; }
+
+void test_peerconnectiongroup() {
+	InitLogger(LogLevel::Debug);
+
+	// Only one member of each group carries a channel, the others are never negotiated
+	const size_t size = 3;
+	PeerConnectionGroup group1(size);
+	PeerConnectionGroup group2(size);
+
+	group1.onLocalDescription([&group2](size_t index, Description sdp) {
+		cout << "Description 1." << index << ": " << sdp << endl;
+		group2.setRemoteDescription(index, string(sdp));
+	});
+
+	group1.onLocalCandidate([&group2](size_t index, Candidate candidate) {
+		cout << "Candidate 1." << index << ": " << candidate << endl;
+		group2.addRemoteCandidate(index, string(candidate));
+	});
+
+	group1.onStateChange(
+	    [](PeerConnectionGroup::State state) { cout << "State 1: " << state << endl; });
+
+	group2.onLocalDescription([&group1](size_t index, Description sdp) {
+		cout << "Description 2." << index << ": " << sdp << endl;
+		group1.setRemoteDescription(index, string(sdp));
+	});
+
+	group2.onLocalCandidate([&group1](size_t index, Candidate candidate) {
+		cout << "Candidate 2." << index << ": " << candidate << endl;
+		group1.addRemoteCandidate(index, string(candidate));
+	});
+
+	group2.onStateChange(
+	    [](PeerConnectionGroup::State state) { cout << "State 2: " << state << endl; });
+
+	shared_ptr<DataChannel> dc2;
+	group2.onDataChannel([&dc2](shared_ptr<DataChannel> dc) {
+		cout << "DataChannel 2: Received with label \"" << dc->label() << "\"" << endl;
+		dc->onOpen([wdc = make_weak_ptr(dc)]() {
+			if (auto dc = wdc.lock())
+				dc->send("Hello from 2");
+		});
+		std::atomic_store(&dc2, dc);
+	});
+
+	atomic<bool> received = false;
+	auto dc1 = group1.createDataChannel("test");
+	dc1->onMessage([&received](variant<binary, string> message) {
+		if (holds_alternative<string>(message) && get<string>(message) == "Hello from 2")
+			received = true;
+	});
+
+	int attempts = 10;
+	while ((group1.state() != PeerConnectionGroup::State::Connected ||
+	        group2.state() != PeerConnectionGroup::State::Connected || !received) &&
+	       attempts--)
+		this_thread::sleep_for(1s);
+
+	if (group1.state() != PeerConnectionGroup::State::Connected ||
+	    group2.state() != PeerConnectionGroup::State::Connected)
+		throw runtime_error("PeerConnectionGroup is not connected");
+
+	if (!atomic_load(&dc2) || !received)
+		throw runtime_error("DataChannel message not received");
+
+	for (size_t i = 1; i < size; ++i)
+		if (group1.member(i)->state() != PeerConnection::State::New)
+			throw runtime_error("Unused PeerConnectionGroup member was negotiated");
+
+	group1.close();
+	group2.close();
+	this_thread::sleep_for(1s);
+
+	if (group1.state() != PeerConnectionGroup::State::Closed)
+		throw runtime_error("PeerConnectionGroup is not closed");
+
+	cout << "Success" << endl;
+}
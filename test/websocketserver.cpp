@@ -31,16 +31,17 @@ using namespace std;
 
 template <class T> weak_ptr<T> make_weak_ptr(shared_ptr<T> ptr) { return ptr; }
 
-void test_websocketserver() {
-	InitLogger(LogLevel::Debug);
-
+// Echo through a local server, optionally with permessage-deflate on both sides
+static void run_websocketserver(uint16_t port, bool deflate) {
 	const string myMessage = "Hello world from client";
 
 	WebSocketServer::Configuration serverConfig;
-	serverConfig.port = 48080;
+	serverConfig.port = port;
 	serverConfig.enableTls = true;
 	// serverConfig.certificatePemFile = ...
 	// serverConfig.keyPemFile = ...
+	if (deflate)
+		serverConfig.deflate.emplace();
 	WebSocketServer server(std::move(serverConfig));
 
 	shared_ptr<WebSocket> client;
@@ -70,6 +71,10 @@ void test_websocketserver() {
 
 	WebSocket::Configuration config;
 	config.disableTlsVerification = true;
+	if (deflate) {
+		config.deflate.emplace();
+		config.deflate->remoteNoContextTakeover = true;
+	}
 	WebSocket ws(std::move(config));
 
 	ws.onOpen([&ws, &myMessage]() {
@@ -90,7 +95,7 @@ void test_websocketserver() {
 		}
 	});
 
-	ws.open("wss://localhost:48080/");
+	ws.open("wss://localhost:" + to_string(port) + "/");
 
 	int attempts = 15;
 	while ((!ws.isOpen() || !received) && attempts--)
@@ -107,6 +112,15 @@ void test_websocketserver() {
 
 	server.stop();
 	this_thread::sleep_for(1s);
+}
+
+void test_websocketserver() {
+	InitLogger(LogLevel::Debug);
+
+	run_websocketserver(48080, false);
+
+	cout << "WebSocket: Testing permessage-deflate" << endl;
+	run_websocketserver(48081, true);
 
 	cout << "Success" << endl;
 }
@@ -0,0 +1,275 @@
+/**
+ * Copyright (c) 2022 Paul-Louis Ageneau
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rtc/rtc.hpp"
+
+#if RTC_ENABLE_WEBSOCKET
+
+#include "impl/tcptransport.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace rtc;
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const uint16_t Port = 48090;
+
+struct HttpResponse {
+	int status = 0;
+	vector<pair<string, string>> headers;
+	string body;
+
+	optional<string> header(const string &name) const {
+		for (const auto &[key, value] : headers)
+			if (key == name)
+				return value;
+		return nullopt;
+	}
+};
+
+// Raw HTTP/1.1 client, so requests can be pipelined or malformed on purpose
+class HttpClient {
+public:
+	HttpClient() {
+		using State = impl::Transport::State;
+		mTcp = make_shared<impl::TcpTransport>("127.0.0.1", to_string(Port), nullptr);
+		mTcp->onRecv([this](message_ptr message) {
+			if (message) {
+				lock_guard lock(mMutex);
+				mReceived.append(reinterpret_cast<const char *>(message->data()), message->size());
+			}
+		});
+		atomic<State> state = State::Disconnected;
+		mTcp->onStateChange([&state](State s) { state = s; });
+		mTcp->start();
+
+		int attempts = 50;
+		while (state != State::Connected && attempts--)
+			this_thread::sleep_for(100ms);
+
+		mTcp->onStateChange(nullptr);
+		if (state != State::Connected)
+			throw runtime_error("HTTP client is not connected");
+	}
+
+	~HttpClient() {
+		mTcp->onRecv(nullptr);
+		mTcp->stop();
+	}
+
+	void send(const string &data) {
+		mTcp->send(make_message(reinterpret_cast<const byte *>(data.data()),
+		                        reinterpret_cast<const byte *>(data.data()) + data.size()));
+	}
+
+	// Waits for count complete responses
+	vector<HttpResponse> receive(size_t count = 1, chrono::milliseconds timeout = 10s) {
+		vector<HttpResponse> responses;
+		auto deadline = chrono::steady_clock::now() + timeout;
+		while (responses.size() < count) {
+			if (!parse(responses)) {
+				if (chrono::steady_clock::now() >= deadline)
+					throw runtime_error("HTTP response not received");
+				this_thread::sleep_for(10ms);
+			}
+		}
+		return responses;
+	}
+
+private:
+	bool parse(vector<HttpResponse> &responses) {
+		lock_guard lock(mMutex);
+		size_t end = mReceived.find("\r\n\r\n");
+		if (end == string::npos)
+			return false;
+
+		HttpResponse response;
+		size_t lineEnd = mReceived.find("\r\n");
+		response.status = stoi(mReceived.substr(9, 3)); // after "HTTP/1.1 "
+		size_t contentLength = 0;
+		while (lineEnd < end) {
+			size_t next = mReceived.find("\r\n", lineEnd + 2);
+			string line = mReceived.substr(lineEnd + 2, next - lineEnd - 2);
+			size_t colon = line.find(':');
+			string name = line.substr(0, colon);
+			string value = line.substr(line.find_first_not_of(' ', colon + 1));
+			if (name == "Content-Length")
+				contentLength = stoul(value);
+			response.headers.emplace_back(std::move(name), std::move(value));
+			lineEnd = next;
+		}
+
+		if (mReceived.size() < end + 4 + contentLength)
+			return false;
+
+		response.body = mReceived.substr(end + 4, contentLength);
+		mReceived.erase(0, end + 4 + contentLength);
+		responses.push_back(std::move(response));
+		return true;
+	}
+
+	shared_ptr<impl::TcpTransport> mTcp;
+	mutex mMutex;
+	string mReceived;
+};
+
+string postRequest(const string &path, const string &sdp) {
+	return "POST " + path + " HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/sdp\r\n" +
+	       "Content-Length: " + to_string(sdp.size()) + "\r\n\r\n" + sdp;
+}
+
+string emptyRequest(const string &method, const string &path) {
+	return method + " " + path + " HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n";
+}
+
+// Offer of a client peer with a data channel, including all candidates
+string gatherOffer(PeerConnection &pc, shared_ptr<DataChannel> &dc) {
+	dc = pc.createDataChannel("whip");
+	int attempts = 50;
+	while (pc.gatheringState() != PeerConnection::GatheringState::Complete && attempts--)
+		this_thread::sleep_for(100ms);
+
+	auto description = pc.localDescription();
+	if (!description)
+		throw runtime_error("Offer not generated");
+
+	return string(*description);
+}
+
+void expectStatus(const HttpResponse &response, int status, const string &what) {
+	if (response.status != status)
+		throw runtime_error(what + ": expected " + to_string(status) + ", got " +
+		                    to_string(response.status));
+}
+
+} // namespace
+
+void test_whipserver() {
+	InitLogger(LogLevel::Debug);
+
+	WhipServer::Configuration config;
+	config.port = Port;
+	config.maxSessions = 1;
+	config.gatheringTimeout = 1s;
+
+	WhipServer server(std::move(config));
+
+	atomic<int> sessions = 0;
+	server.onSession([&sessions](WhipServer::Session &session) {
+		cout << "WhipServer: Session " << session.id << " on " << session.path << endl;
+		++sessions;
+		return true;
+	});
+
+	// The offer is answered in the response, with the session URL in Location
+	PeerConnection pc;
+	shared_ptr<DataChannel> dc;
+	const string offer = gatherOffer(pc, dc);
+
+	HttpClient client;
+	client.send(postRequest("/whip", offer));
+	auto post = client.receive().front();
+	expectStatus(post, 201, "POST offer");
+
+	auto location = post.header("Location");
+	if (!location || location->rfind("/whip/", 0) != 0)
+		throw runtime_error("Missing or invalid Location header");
+
+	if (post.header("Content-Type") != "application/sdp" || sessions != 1)
+		throw runtime_error("Unexpected POST response");
+
+	pc.setRemoteDescription(Description(post.body, Description::Type::Answer));
+
+	// Candidates are trickled with PATCH on the session URL
+	const string fragment = "a=mid:0\r\n"
+	                        "a=candidate:1 1 UDP 2122317823 127.0.0.1 9 typ host\r\n";
+	client.send("PATCH " + *location + " HTTP/1.1\r\nHost: localhost\r\n" +
+	            "Content-Type: application/trickle-ice-sdpfrag\r\n" +
+	            "Content-Length: " + to_string(fragment.size()) + "\r\n\r\n" + fragment);
+	expectStatus(client.receive().front(), 204, "PATCH candidate");
+
+	client.send(emptyRequest("PATCH", *location));
+	expectStatus(client.receive().front(), 415, "PATCH without fragment");
+
+	client.send(emptyRequest("PATCH", "/whip/unknown"));
+	expectStatus(client.receive().front(), 404, "PATCH on unknown session");
+
+	// Further offers are refused while the session is up
+	{
+		PeerConnection other;
+		shared_ptr<DataChannel> otherDc;
+		client.send(postRequest("/whip", gatherOffer(other, otherDc)));
+		auto refused = client.receive().front();
+		expectStatus(refused, 503, "POST over maxSessions");
+		if (!refused.header("Retry-After"))
+			throw runtime_error("Missing Retry-After header");
+	}
+
+	int attempts = 10;
+	while (pc.state() != PeerConnection::State::Connected && attempts--)
+		this_thread::sleep_for(1s);
+
+	if (pc.state() != PeerConnection::State::Connected)
+		throw runtime_error("WHIP client is not connected");
+
+	// Pipelined requests are answered in order on the same connection
+	client.send(emptyRequest("OPTIONS", "/whip") + emptyRequest("GET", "/unknown") +
+	            emptyRequest("GET", "/whip"));
+	auto pipelined = client.receive(3);
+	expectStatus(pipelined[0], 204, "Pipelined OPTIONS");
+	expectStatus(pipelined[1], 404, "Pipelined GET on unknown path");
+	expectStatus(pipelined[2], 405, "Pipelined GET on endpoint");
+
+	// Sessions are deleted once
+	client.send(emptyRequest("DELETE", *location));
+	expectStatus(client.receive().front(), 200, "DELETE session");
+
+	client.send(emptyRequest("DELETE", *location));
+	expectStatus(client.receive().front(), 404, "DELETE deleted session");
+
+	// Requests which can't be handled get a final response and the connection is closed
+	const pair<string, int> limits[] = {
+	    {"POST /whip HTTP/1.1\r\nContent-Length: 70000\r\n\r\n", 413},
+	    {"POST /whip HTTP/1.1\r\nX-Padding: " + string(9000, 'x') + "\r\n\r\n", 431},
+	    {"POST /whip HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", 501},
+	};
+	for (const auto &[request, status] : limits) {
+		HttpClient limited;
+		limited.send(request);
+		auto response = limited.receive().front();
+		expectStatus(response, status, "Request over limits");
+		if (response.header("Connection") != "close")
+			throw runtime_error("Connection not closed after error " + to_string(status));
+	}
+
+	pc.close();
+	server.stop();
+	this_thread::sleep_for(1s);
+
+	cout << "Success" << endl;
+}
+
+#endif